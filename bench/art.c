@@ -0,0 +1,166 @@
+/////////////////////////////////////////////////////////////////////////////
+//
+// Terrascale
+// Copyright (c) Dave Kilian & Emily Kilian 2023. All rights reserved.
+//
+//////////////////////////////////////////////////////////////////////////////
+
+#include <pch.h>
+#include <bench/bench.h>
+#include <index/art.h>
+#include <index/btree.h>
+
+#include <unistd.h>
+
+//
+// An index of a million asset paths like
+// "assets/terrain/region017/lod2/tile_000123_000456.png", in an adaptive
+// radix tree and in the disk B+tree (through a pool holding all of it),
+// both filled by inserts in random order. Reports insert and lookup rates,
+// a full scan, and the memory each takes per key, against the bytes of the
+// keys themselves.
+//
+
+#define ART_NKEYS       (1000 * 1000)
+#define ART_NFRAMES     (32 * 1024)
+
+static uint64_t bench_rand(uint64_t *state)
+{
+    uint64_t x = *state;
+    x ^= x << 13;
+    x ^= x >> 7;
+    x ^= x << 17;
+    return *state = x;
+}
+
+// Path i; paths are spread over a few hundred directories
+static unsigned art_key(uint64_t i, char *key)
+{
+    static const char *kinds[] = { "terrain", "water", "roads", "buildings" };
+    return snprintf(key, 96, "assets/%s/region%03u/lod%u/tile_%06u_%06u.png", kinds[i % 4],
+        (unsigned)(i / 4 % 97), (unsigned)(i / 388 % 3), (unsigned)(i * 7919 % 999983), (unsigned)i);
+}
+
+static uint64_t *art_order()
+{
+    uint64_t seed = 0x2545f4914f6cdd1d;
+    uint64_t *order = tr_alloc(ART_NKEYS * sizeof(uint64_t), 'bnch');
+    for (unsigned i = 0; i < ART_NKEYS; ++i) {
+        order[i] = i;
+    }
+    for (unsigned i = ART_NKEYS - 1; i > 0; --i) {
+        unsigned j = bench_rand(&seed) % (i + 1);
+        uint64_t t = order[i];
+        order[i] = order[j];
+        order[j] = t;
+    }
+    return order;
+}
+
+static bool art_count(const void *key, unsigned keylen, uint64_t value, void *context)
+{
+    (void)key, (void)keylen;
+    *(uint64_t *)context += value;
+    return true;
+}
+
+static void art_report(const char *metric, const char *label, double value, const char *unit)
+{
+    char name[64];
+    snprintf(name, sizeof(name), "%s (%s)", metric, label);
+    BENCH_REPORT(name, value, unit);
+}
+
+static void art_vs_btree()
+{
+    uint64_t *order = art_order();
+    uint64_t keybytes = 0;
+    for (unsigned i = 0; i < ART_NKEYS; ++i) {
+        char key[96];
+        keybytes += art_key(i, key);
+    }
+    BENCH_REPORT("key bytes", (double)keybytes / ART_NKEYS, "bytes/key");
+
+    // Radix tree
+    trart art;
+    tr_art_initialize(&art, 'bnch');
+    trtime start = tr_clock_now();
+    for (unsigned i = 0; i < ART_NKEYS; ++i) {
+        char key[96];
+        tr_require(tr_ok(tr_art_put(&art, key, art_key(order[i], key), order[i] + 1)));
+    }
+    art_report("insert", "art", BENCH_RATE(ART_NKEYS, tr_clock_now() - start), "ops/s");
+
+    uint64_t seed = 0x9e3779b97f4a7c15;
+    uint64_t sum = 0;
+    start = tr_clock_now();
+    for (unsigned i = 0; i < ART_NKEYS; ++i) {
+        char key[96];
+        uint64_t value;
+        tr_require(tr_ok(tr_art_get(&art, key, art_key(bench_rand(&seed) % ART_NKEYS, key), &value)));
+        sum += value;
+    }
+    art_report("lookup", "art", (double)(tr_clock_now() - start) / ART_NKEYS, "ns");
+
+    uint64_t total = 0;
+    start = tr_clock_now();
+    tr_art_scan(&art, "", 0, art_count, &total);
+    art_report("full scan", "art", BENCH_RATE(ART_NKEYS, tr_clock_now() - start), "keys/s");
+    tr_require(total == (uint64_t)ART_NKEYS * (ART_NKEYS + 1) / 2);
+
+    trartstat stat = tr_art_stat(&art);
+    art_report("memory", "art", (double)stat.bytes / ART_NKEYS, "bytes/key");
+    tr_art_cleanup(&art);
+
+    // B+tree
+    char path[64];
+    snprintf(path, sizeof(path), "/tmp/trbench-art-%d", (int)getpid());
+    trfile file;
+    trbufpool pool;
+    trbtree btree;
+    tr_file_open(&file, path, tr_file_create | tr_file_truncate);
+    tr_bufpool_initialize(&pool, ART_NFRAMES, 'bnch');
+    tr_btree_create(&btree, &pool, &file, 'bnch');
+
+    start = tr_clock_now();
+    for (unsigned i = 0; i < ART_NKEYS; ++i) {
+        char key[96];
+        tr_require(tr_ok(tr_btree_put(&btree, key, art_key(order[i], key), order[i] + 1)));
+    }
+    art_report("insert", "btree", BENCH_RATE(ART_NKEYS, tr_clock_now() - start), "ops/s");
+
+    seed = 0x9e3779b97f4a7c15;
+    uint64_t btreesum = 0;
+    start = tr_clock_now();
+    for (unsigned i = 0; i < ART_NKEYS; ++i) {
+        char key[96];
+        uint64_t value;
+        tr_require(tr_ok(tr_btree_get(&btree, key, art_key(bench_rand(&seed) % ART_NKEYS, key), &value)));
+        btreesum += value;
+    }
+    art_report("lookup", "btree", (double)(tr_clock_now() - start) / ART_NKEYS, "ns");
+    tr_require(btreesum == sum);
+
+    total = 0;
+    start = tr_clock_now();
+    tr_btree_scan(&btree, "", 0, art_count, &total);
+    art_report("full scan", "btree", BENCH_RATE(ART_NKEYS, tr_clock_now() - start), "keys/s");
+    tr_require(total == (uint64_t)ART_NKEYS * (ART_NKEYS + 1) / 2);
+
+    trbtreestat btstat;
+    tr_btree_stat(&btree, &btstat);
+    art_report("memory", "btree", (double)(btstat.nleaves + btstat.ninner) * tr_pagesize / ART_NKEYS, "bytes/key");
+
+    tr_btree_cleanup(&btree);
+    tr_bufpool_cleanup(&pool);
+    tr_file_close(&file);
+    unlink(path);
+    tr_free(order);
+}
+
+static const bench_case art_cases[] =
+{
+    BENCH_CASE(art_vs_btree),
+};
+
+BENCH_SUITE(art_bench, art_cases);
@@ -0,0 +1,60 @@
+//////////////////////////////////////////////////////////////////////////////
+//
+// Terrascale
+// Copyright (c) Dave Kilian & Emily Kilian 2023. All rights reserved.
+//
+// bench.h - a small benchmark framework
+//
+// Benchmarks are laid out the same way as tests (see test/test.h):
+//
+// 1. Define a new module in this project (e.g. mysuite.c)
+// 2. Define your benchmarks in the module as static functions local to the
+//    module. Each benchmark times whatever it likes using tr_clock_now(),
+//    and reports its results using BENCH_REPORT.
+// 3. Define a private, static array of benchmarks using the BENCH_CASE macro
+// 4. Define a public, static suite with the BENCH_SUITE macro
+// 5. In benchmain.c, forward declare your suite (as extern const)
+// 6. Add your suite to the bench_suites array in benchmain.c
+//
+// Run all benchmarks with `make bench`, or only those whose names contain a
+// given substring with `make bench FILTER=substring`.
+//
+//////////////////////////////////////////////////////////////////////////////
+
+#pragma once
+
+#include <runtime/clock.h>
+
+// Reports a single measurement for the running benchmark
+#define BENCH_REPORT(metric, value, unit) bench_report((metric), (value), (unit))
+
+void bench_report(const char *metric, double value, const char *unit);
+
+// Computes a rate (things per second) from a count and an elapsed time
+#define BENCH_RATE(count, elapsed) ((double)(count) / tr_clock_seconds(elapsed))
+
+// Function signature for each benchmark this framework can execute
+typedef void bench_entry(void);
+
+// Information about a benchmark
+typedef struct {
+    const char *name;   // The name of the entry point routine
+    const char *file;   // File where the benchmark is defined
+    bench_entry *entry; // The benchmark entry point routine
+} bench_case;
+
+// Information about all benchmarks in a single code module
+typedef struct {
+    const bench_case *cases; // Array of benchmarks
+    int ncases;              // Number of benchmarks in the array
+} bench_suite;
+
+// Defines an entry in an array of benchmarks
+#define BENCH_CASE(func) { .name = #func, .file = __FILE__, .entry = &(func) }
+
+// Locally defines a benchmark suite with the given name and case array
+#define BENCH_SUITE(_name, _cases) \
+        bench_suite _name = { \
+            .cases = (_cases), \
+            .ncases = sizeof(_cases) / sizeof((_cases)[0]) \
+        }
@@ -0,0 +1,89 @@
+//////////////////////////////////////////////////////////////////////////////
+//
+// Terrascale
+// Copyright (c) Dave Kilian & Emily Kilian 2023. All rights reserved.
+//
+//////////////////////////////////////////////////////////////////////////////
+
+#include <pch.h>
+#include <bench/bench.h>
+
+extern bench_suite art_bench;
+extern bench_suite btree_bench;
+extern bench_suite bufpool_bench;
+extern bench_suite column_bench;
+extern bench_suite crc32c_bench;
+extern bench_suite exthash_bench;
+extern bench_suite epoch_bench;
+extern bench_suite filter_bench;
+extern bench_suite load_bench;
+extern bench_suite lockmgr_bench;
+extern bench_suite lsm_bench;
+extern bench_suite lz_bench;
+extern bench_suite memtree_bench;
+extern bench_suite mvcc_bench;
+extern bench_suite query_bench;
+extern bench_suite rtree_bench;
+extern bench_suite schema_bench;
+extern bench_suite segment_bench;
+extern bench_suite sync_bench;
+extern bench_suite taskman_bench;
+extern bench_suite wal_bench;
+
+static const bench_suite *bench_suites[] =
+{
+    &crc32c_bench,
+    &lz_bench,
+    &taskman_bench,
+    &sync_bench,
+    &epoch_bench,
+    &mvcc_bench,
+    &lockmgr_bench,
+    &bufpool_bench,
+    &wal_bench,
+    &segment_bench,
+    &lsm_bench,
+    &memtree_bench,
+    &column_bench,
+    &schema_bench,
+    &load_bench,
+    &btree_bench,
+    &exthash_bench,
+    &filter_bench,
+    &rtree_bench,
+    &art_bench,
+    &query_bench,
+};
+
+static const int nsuites = arraysize(bench_suites);
+
+void bench_report(const char *metric, double value, const char *unit)
+{
+    printf("    %-40s %14.2f %s\n", metric, value, unit);
+    fflush(stdout);
+}
+
+int main(int argc, const char *argv[])
+{
+    const char *filter = argc > 1 ? argv[1] : NULL;
+
+    for (int i = 0; i < nsuites; ++i) {
+
+        const bench_suite *suite = bench_suites[i];
+
+        for (int j = 0; j < suite->ncases; ++j) {
+
+            const bench_case *bench = suite->cases + j;
+            if (filter != NULL && strstr(bench->name, filter) == NULL) {
+                continue;
+            }
+
+            printf("(%s) %s\n", bench->file, bench->name);
+            fflush(stdout);
+
+            bench->entry();
+        }
+    }
+
+    return 0;
+}
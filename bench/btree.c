@@ -0,0 +1,180 @@
+/////////////////////////////////////////////////////////////////////////////
+//
+// Terrascale
+// Copyright (c) Dave Kilian & Emily Kilian 2023. All rights reserved.
+//
+//////////////////////////////////////////////////////////////////////////////
+
+#include <pch.h>
+#include <bench/bench.h>
+#include <index/btree.h>
+
+#include <unistd.h>
+
+//
+// A secondary index of a million keys like "tile/<zoom>/<x>/<y>", built by
+// random inserts and by a bulk build, with the pool large enough to hold
+// the whole tree, so the numbers are the tree's own costs. Reports insert,
+// lookup and scan rates, and how full and deep each tree ends up.
+//
+
+#define BTREE_NKEYS     (1000 * 1000)
+#define BTREE_NFRAMES   (16 * 1024)
+
+static char bench_path[64];
+
+static uint64_t bench_rand(uint64_t *state)
+{
+    uint64_t x = *state;
+    x ^= x << 13;
+    x ^= x >> 7;
+    x ^= x << 17;
+    return *state = x;
+}
+
+// Key i in sorted order; sorted since the fields are zero-padded
+static unsigned btree_key(uint64_t i, char *key)
+{
+    return snprintf(key, 64, "tile/%02u/%06u/%06u", (unsigned)(i / 100000), (unsigned)(i / 1000 % 100),
+        (unsigned)(i % 1000) * 997);
+}
+
+static void btree_setup(trfile *file, trbufpool *pool, trbtree *tree)
+{
+    snprintf(bench_path, sizeof(bench_path), "/tmp/trbench-btree-%d", (int)getpid());
+    tr_file_open(file, bench_path, tr_file_create | tr_file_truncate);
+    tr_bufpool_initialize(pool, BTREE_NFRAMES, 'bnch');
+    tr_btree_create(tree, pool, file, 'bnch');
+}
+
+static void btree_teardown(trfile *file, trbufpool *pool, trbtree *tree)
+{
+    tr_btree_cleanup(tree);
+    tr_bufpool_cleanup(pool);
+    tr_file_close(file);
+    unlink(bench_path);
+}
+
+static void btree_report_shape(trbtree *tree, const char *label)
+{
+    trbtreestat stat;
+    tr_btree_stat(tree, &stat);
+
+    char metric[64];
+    snprintf(metric, sizeof(metric), "leaf fill (%s)", label);
+    BENCH_REPORT(metric, stat.leaffill * 100, "%");
+    snprintf(metric, sizeof(metric), "leaves (%s)", label);
+    BENCH_REPORT(metric, stat.nleaves, "pages");
+    snprintf(metric, sizeof(metric), "height (%s)", label);
+    BENCH_REPORT(metric, stat.height, "levels");
+}
+
+static void btree_lookups(trbtree *tree, const char *label)
+{
+    uint64_t seed = 0x9e3779b97f4a7c15;
+    uint64_t sum = 0;
+    trtime start = tr_clock_now();
+    for (unsigned i = 0; i < BTREE_NKEYS; ++i) {
+        char key[64];
+        uint64_t k = bench_rand(&seed) % BTREE_NKEYS;
+        uint64_t value;
+        tr_require(tr_ok(tr_btree_get(tree, key, btree_key(k, key), &value)));
+        sum += value;
+    }
+    trtime elapsed = tr_clock_now() - start;
+    tr_require(sum > 0);
+
+    char metric[64];
+    snprintf(metric, sizeof(metric), "lookup (%s)", label);
+    BENCH_REPORT(metric, BENCH_RATE(BTREE_NKEYS, elapsed), "ops/s");
+}
+
+static bool btree_count(const void *key, unsigned keylen, uint64_t value, void *context)
+{
+    (void)key, (void)keylen;
+    *(uint64_t *)context += value;
+    return true;
+}
+
+static void btree_inserts()
+{
+    trfile file;
+    trbufpool pool;
+    trbtree tree;
+    btree_setup(&file, &pool, &tree);
+
+    // Every key once, in random order
+    uint64_t seed = 0x2545f4914f6cdd1d;
+    uint64_t *order = tr_alloc(BTREE_NKEYS * sizeof(uint64_t), 'bnch');
+    for (unsigned i = 0; i < BTREE_NKEYS; ++i) {
+        order[i] = i;
+    }
+    for (unsigned i = BTREE_NKEYS - 1; i > 0; --i) {
+        unsigned j = bench_rand(&seed) % (i + 1);
+        uint64_t t = order[i];
+        order[i] = order[j];
+        order[j] = t;
+    }
+
+    trtime start = tr_clock_now();
+    for (unsigned i = 0; i < BTREE_NKEYS; ++i) {
+        char key[64];
+        tr_require(tr_ok(tr_btree_put(&tree, key, btree_key(order[i], key), order[i] + 1)));
+    }
+    trtime elapsed = tr_clock_now() - start;
+    BENCH_REPORT("random insert", BENCH_RATE(BTREE_NKEYS, elapsed), "ops/s");
+
+    btree_lookups(&tree, "inserted");
+    btree_report_shape(&tree, "inserted");
+
+    tr_free(order);
+    btree_teardown(&file, &pool, &tree);
+}
+
+static void btree_bulk_build()
+{
+    double fills[] = { 1.0, 0.9 };
+    for (unsigned f = 0; f < arraysize(fills); ++f) {
+        trfile file;
+        trbufpool pool;
+        trbtree tree;
+        btree_setup(&file, &pool, &tree);
+
+        trbtbuilder builder;
+        trtime start = tr_clock_now();
+        tr_btree_build_begin(&builder, &tree, fills[f]);
+        for (unsigned i = 0; i < BTREE_NKEYS; ++i) {
+            char key[64];
+            tr_btree_build_add(&builder, key, btree_key(i, key), i + 1);
+        }
+        tr_require(tr_ok(tr_btree_build_finish(&builder)));
+        trtime elapsed = tr_clock_now() - start;
+
+        char label[32];
+        snprintf(label, sizeof(label), "built, fill %.1f", fills[f]);
+        char metric[64];
+        snprintf(metric, sizeof(metric), "bulk build (fill %.1f)", fills[f]);
+        BENCH_REPORT(metric, BENCH_RATE(BTREE_NKEYS, elapsed), "keys/s");
+
+        btree_lookups(&tree, label);
+        btree_report_shape(&tree, label);
+
+        uint64_t sum = 0;
+        start = tr_clock_now();
+        tr_btree_scan(&tree, "", 0, btree_count, &sum);
+        elapsed = tr_clock_now() - start;
+        tr_require(sum == (uint64_t)BTREE_NKEYS * (BTREE_NKEYS + 1) / 2);
+        snprintf(metric, sizeof(metric), "full scan (%s)", label);
+        BENCH_REPORT(metric, BENCH_RATE(BTREE_NKEYS, elapsed), "keys/s");
+
+        btree_teardown(&file, &pool, &tree);
+    }
+}
+
+static const bench_case btree_cases[] =
+{
+    BENCH_CASE(btree_inserts),
+    BENCH_CASE(btree_bulk_build),
+};
+
+BENCH_SUITE(btree_bench, btree_cases);
@@ -0,0 +1,224 @@
+/////////////////////////////////////////////////////////////////////////////
+//
+// Terrascale
+// Copyright (c) Dave Kilian & Emily Kilian 2023. All rights reserved.
+//
+//////////////////////////////////////////////////////////////////////////////
+
+#include <pch.h>
+#include <bench/bench.h>
+#include <store/bufpool.h>
+
+#include <unistd.h>
+
+//
+// Buffer pool workloads over a file four times the size of the pool, so
+// that the replacement policy matters: the hit path (pinning resident
+// pages), skewed random reads, sequential scans, and point lookups mixed
+// with scans, which shouldn't cost the lookups their hot pages.
+//
+
+#define BUFPOOL_NFRAMES 256
+#define BUFPOOL_NPAGES  (4 * BUFPOOL_NFRAMES)
+#define BUFPOOL_NHITS   (2 * 1000 * 1000)
+#define BUFPOOL_NREADS  (200 * 1000)
+#define BUFPOOL_NSCANS  8
+#define BUFPOOL_NROUNDS 200
+
+static char bench_path[64];
+
+static void bufpool_setup(trfile *file, trbufpool *pool)
+{
+    snprintf(bench_path, sizeof(bench_path), "/tmp/trbench-bufpool-%d", (int)getpid());
+    tr_file_open(file, bench_path, tr_file_create | tr_file_truncate);
+    tr_bufpool_initialize(pool, BUFPOOL_NFRAMES, 'bnch');
+
+    for (int i = 0; i < BUFPOOL_NPAGES; ++i) {
+        trpageno pageno;
+        trframe *frame;
+        tr_bufpool_pin_new(pool, file, &pageno, &frame);
+        memset(tr_page_data(frame->data), i, tr_page_payload);
+        tr_bufpool_unpin(pool, frame, true);
+    }
+
+    tr_bufpool_flush(pool, file);
+}
+
+static void bufpool_teardown(trfile *file, trbufpool *pool)
+{
+    tr_bufpool_cleanup(pool);
+    tr_file_close(file);
+    unlink(bench_path);
+}
+
+static uint64_t bench_rand(uint64_t *state)
+{
+    uint64_t x = *state;
+    x ^= x << 13;
+    x ^= x >> 7;
+    x ^= x << 17;
+    return *state = x;
+}
+
+static void bufpool_hit_path()
+{
+    trfile file;
+    trbufpool pool;
+    bufpool_setup(&file, &pool);
+
+    // The last pages written are the ones still resident
+    trpageno resident = BUFPOOL_NPAGES - 1;
+    trframe *frame;
+
+    trtime start = tr_clock_now();
+    for (int i = 0; i < BUFPOOL_NHITS; ++i) {
+        tr_bufpool_pin(&pool, &file, resident - (i & 63), &frame);
+        tr_bufpool_unpin(&pool, frame, false);
+    }
+    trtime elapsed = tr_clock_now() - start;
+
+    BENCH_REPORT("pin+unpin (hit)", (double)elapsed / BUFPOOL_NHITS, "ns");
+    BENCH_REPORT("pins", BENCH_RATE(BUFPOOL_NHITS, elapsed), "/s");
+
+    bufpool_teardown(&file, &pool);
+}
+
+static void bufpool_skewed_reads()
+{
+    trfile file;
+    trbufpool pool;
+    bufpool_setup(&file, &pool);
+
+    // 90% of reads go to a hot eighth of the file
+    uint64_t seed = 0x2545f4914f6cdd1dull;
+    trbufpoolstat before = tr_bufpool_stat(&pool);
+
+    trtime start = tr_clock_now();
+    for (int i = 0; i < BUFPOOL_NREADS; ++i) {
+        uint64_t r = bench_rand(&seed);
+        trpageno pageno = (r % 10) != 0
+            ? (r >> 8) % (BUFPOOL_NPAGES / 8)
+            : (r >> 8) % BUFPOOL_NPAGES;
+
+        trframe *frame;
+        tr_bufpool_pin(&pool, &file, pageno, &frame);
+        tr_bufpool_unpin(&pool, frame, false);
+    }
+    trtime elapsed = tr_clock_now() - start;
+
+    trbufpoolstat stat = tr_bufpool_stat(&pool);
+    uint64_t hits = stat.hits - before.hits;
+    uint64_t misses = stat.misses - before.misses;
+
+    BENCH_REPORT("reads", BENCH_RATE(BUFPOOL_NREADS, elapsed), "/s");
+    BENCH_REPORT("hit rate", 100.0 * hits / (hits + misses), "%");
+
+    bufpool_teardown(&file, &pool);
+}
+
+static void bufpool_scan()
+{
+    trfile file;
+    trbufpool pool;
+    bufpool_setup(&file, &pool);
+
+    uint64_t checksum = 0;
+    trtime start = tr_clock_now();
+    for (int scan = 0; scan < BUFPOOL_NSCANS; ++scan) {
+        for (trpageno i = 0; i < BUFPOOL_NPAGES; ++i) {
+            trframe *frame;
+            tr_bufpool_pin(&pool, &file, i, &frame);
+            checksum += ((uint8_t *)tr_page_data(frame->data))[0];
+            tr_bufpool_unpin(&pool, frame, false);
+        }
+    }
+    trtime elapsed = tr_clock_now() - start;
+
+    double bytes = (double)BUFPOOL_NSCANS * BUFPOOL_NPAGES * tr_pagesize;
+    BENCH_REPORT("scan", bytes / 1e6 / tr_clock_seconds(elapsed), "MB/s");
+    BENCH_REPORT("checksum", (double)checksum, "");
+
+    bufpool_teardown(&file, &pool);
+}
+
+// Point lookups into a hot eighth of the file, for the mixed workload.
+// Returns the hit rate.
+//
+static double bufpool_lookups(trfile *file, trbufpool *pool, uint64_t *seed, int count)
+{
+    trbufpoolstat before = tr_bufpool_stat(pool);
+
+    for (int i = 0; i < count; ++i) {
+        trpageno pageno = (bench_rand(seed) >> 8) % (BUFPOOL_NPAGES / 8);
+        trframe *frame;
+        tr_bufpool_pin(pool, file, pageno, &frame);
+        tr_bufpool_unpin(pool, frame, false);
+    }
+
+    trbufpoolstat stat = tr_bufpool_stat(pool);
+    uint64_t hits = stat.hits - before.hits;
+    uint64_t misses = stat.misses - before.misses;
+    return (double)hits / (hits + misses);
+}
+
+static void bufpool_mixed()
+{
+    trfile file;
+    trbufpool pool;
+    bufpool_setup(&file, &pool);
+
+    trtaskmanconfig tmconfig;
+    tr_taskman_defaults(&tmconfig, trtaskman_shared);
+    tmconfig.pin = false;
+    tmconfig.tag = 'bnch';
+
+    trtaskman tm;
+    tr_taskman_initialize(&tm, &tmconfig);
+    tr_bufpool_readahead(&pool, &tm);
+
+    // Warm up, then measure lookups alone
+    uint64_t seed = 0x2545f4914f6cdd1dull;
+    bufpool_lookups(&file, &pool, &seed, BUFPOOL_NREADS);
+    double alone = bufpool_lookups(&file, &pool, &seed, BUFPOOL_NREADS);
+
+    // Then alternate batches of lookups with scans of the whole file, which
+    // is four times the size of the pool
+    double mixed = 0;
+    uint64_t checksum = 0;
+    trtime start = tr_clock_now();
+    for (int round = 0; round < BUFPOOL_NROUNDS; ++round) {
+        mixed += bufpool_lookups(&file, &pool, &seed, BUFPOOL_NREADS / BUFPOOL_NROUNDS);
+
+        if (round % (BUFPOOL_NROUNDS / BUFPOOL_NSCANS) == 0) {
+            for (trpageno i = 0; i < BUFPOOL_NPAGES; ++i) {
+                trframe *frame;
+                tr_bufpool_pin(&pool, &file, i, &frame);
+                checksum += ((uint8_t *)tr_page_data(frame->data))[0];
+                tr_bufpool_unpin(&pool, frame, false);
+            }
+        }
+    }
+    trtime elapsed = tr_clock_now() - start;
+    tr_bufpool_flush(&pool, &file);
+
+    trbufpoolstat stat = tr_bufpool_stat(&pool);
+    BENCH_REPORT("lookup hit rate (alone)", 100.0 * alone, "%");
+    BENCH_REPORT("lookup hit rate (with scans)", 100.0 * mixed / BUFPOOL_NROUNDS, "%");
+    BENCH_REPORT("mixed ops", BENCH_RATE(BUFPOOL_NREADS + BUFPOOL_NSCANS * BUFPOOL_NPAGES, elapsed), "/s");
+    BENCH_REPORT("pages read ahead", (double)stat.prefetches, "");
+    BENCH_REPORT("checksum", (double)checksum, "");
+
+    tr_taskman_drain(&tm);
+    tr_taskman_cleanup(&tm);
+    bufpool_teardown(&file, &pool);
+}
+
+static const bench_case bufpool_cases[] =
+{
+    BENCH_CASE(bufpool_hit_path),
+    BENCH_CASE(bufpool_skewed_reads),
+    BENCH_CASE(bufpool_scan),
+    BENCH_CASE(bufpool_mixed),
+};
+
+BENCH_SUITE(bufpool_bench, bufpool_cases);
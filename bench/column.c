@@ -0,0 +1,199 @@
+/////////////////////////////////////////////////////////////////////////////
+//
+// Terrascale
+// Copyright (c) Dave Kilian & Emily Kilian 2023. All rights reserved.
+//
+//////////////////////////////////////////////////////////////////////////////
+
+#include <pch.h>
+#include <bench/bench.h>
+#include <table/colpred.h>
+
+//
+// Filter: a table of map tiles, filtered on `zoom == 12 && x between a and
+// b`, which selects about 2.5% of rows. The rows are scanned as an array of
+// structs, then as columns with each kernel implementation.
+//
+// Zone maps: a range of a sorted id column, which zone maps decide for all
+// but two chunks.
+//
+// Encodings: low-cardinality columns (a zoom level, a biome id drawn from a
+// few widely spread values, and a material id in long runs) filtered plain
+// and encoded, with the bytes each takes per row.
+//
+
+#define COLUMN_NROWS    (2 * 1024 * 1024)
+#define COLUMN_NPASSES  10
+
+typedef struct {
+    int64_t id;
+    int32_t zoom;
+    int32_t x;
+    int32_t y;
+    double size;
+} bench_tile;
+
+static uint64_t bench_rand(uint64_t *state)
+{
+    uint64_t x = *state;
+    x ^= x << 13;
+    x ^= x >> 7;
+    x ^= x << 17;
+    return *state = x;
+}
+
+static const char *bench_impl_names[] = { "scalar", "sse4.2", "avx2" };
+
+static void column_filter()
+{
+    bench_tile *rows = tr_alloc(COLUMN_NROWS * sizeof(bench_tile), 'bnch');
+    trcolumn zoom, x;
+    tr_column_initialize(&zoom, trcol_i32, 'bnch');
+    tr_column_initialize(&x, trcol_i32, 'bnch');
+    zoom.encode = false;
+    x.encode = false;
+
+    uint64_t seed = 0x9e3779b97f4a7c15;
+    for (int64_t i = 0; i < COLUMN_NROWS; ++i) {
+        uint64_t r = bench_rand(&seed);
+        rows[i] = (bench_tile){
+            .id = i, .zoom = r % 20, .x = (r >> 8) % 4096, .y = (r >> 20) % 4096, .size = r % 1000,
+        };
+        tr_column_append(&zoom, &rows[i].zoom, 1);
+        tr_column_append(&x, &rows[i].x, 1);
+    }
+
+    trcolvalue twelve = { .i = 12 }, lo = { .i = 1000 }, hi = { .i = 3047 };
+
+    // Rows
+    uint64_t nrow = 0;
+    trtime start = tr_clock_now();
+    for (int pass = 0; pass < COLUMN_NPASSES; ++pass) {
+        for (int i = 0; i < COLUMN_NROWS; ++i) {
+            nrow += rows[i].zoom == twelve.i && rows[i].x >= lo.i && rows[i].x <= hi.i;
+        }
+    }
+    BENCH_REPORT("rows", BENCH_RATE((uint64_t)COLUMN_NROWS * COLUMN_NPASSES, tr_clock_now() - start), "rows/s");
+
+    // Columns
+    uint64_t *bitmap = tr_alloc(tr_colpred_words(&zoom) * sizeof(uint64_t), 'bnch');
+    for (trcolimpl impl = trcolimpl_scalar; impl <= tr_colpred_best(); ++impl) {
+        trcolpred zoompred, xpred;
+        tr_colpred_compile_with(impl, &zoompred, trcol_i32, trcolop_eq, twelve, twelve);
+        tr_colpred_compile_with(impl, &xpred, trcol_i32, trcolop_between, lo, hi);
+
+        uint64_t ncol = 0;
+        start = tr_clock_now();
+        for (int pass = 0; pass < COLUMN_NPASSES; ++pass) {
+            tr_colpred_filter(&zoompred, &zoom, bitmap, false, NULL);
+            ncol += tr_colpred_filter(&xpred, &x, bitmap, true, NULL);
+        }
+        trtime elapsed = tr_clock_now() - start;
+        tr_assert(ncol == nrow);
+
+        char metric[64];
+        snprintf(metric, sizeof(metric), "columns (%s)", bench_impl_names[impl]);
+        BENCH_REPORT(metric, BENCH_RATE((uint64_t)COLUMN_NROWS * COLUMN_NPASSES, elapsed), "rows/s");
+    }
+    BENCH_REPORT("selectivity", 100.0 * nrow / COLUMN_NPASSES / COLUMN_NROWS, "%");
+
+    tr_free(bitmap);
+    tr_column_cleanup(&zoom);
+    tr_column_cleanup(&x);
+    tr_free(rows);
+}
+
+static void column_zone_maps()
+{
+    trcolumn ids;
+    tr_column_initialize(&ids, trcol_i64, 'bnch');
+    for (int64_t i = 0; i < COLUMN_NROWS; ++i) {
+        tr_column_append(&ids, &i, 1);
+    }
+
+    uint64_t *bitmap = tr_alloc(tr_colpred_words(&ids) * sizeof(uint64_t), 'bnch');
+    trcolvalue lo = { .i = COLUMN_NROWS / 4 + 100 }, hi = { .i = COLUMN_NROWS / 2 + 100 };
+    trcolpred pred;
+    tr_colpred_compile(&pred, trcol_i64, trcolop_between, lo, hi);
+
+    trcolscanstat stat;
+    trtime start = tr_clock_now();
+    for (int pass = 0; pass < COLUMN_NPASSES; ++pass) {
+        tr_colpred_filter(&pred, &ids, bitmap, false, &stat);
+    }
+    trtime elapsed = tr_clock_now() - start;
+
+    BENCH_REPORT("range of sorted ids", BENCH_RATE((uint64_t)COLUMN_NROWS * COLUMN_NPASSES, elapsed), "rows/s");
+    BENCH_REPORT("chunks skipped", (double)stat.nskipped, "");
+    BENCH_REPORT("chunks matched whole", (double)stat.nfull, "");
+    BENCH_REPORT("chunks scanned", (double)stat.nscanned, "");
+
+    tr_free(bitmap);
+    tr_column_cleanup(&ids);
+}
+
+static void column_encodings_run(bool encode)
+{
+    static const int64_t biomes[] = { -7000000000, 12, 4096, 1 << 20, 5000000000, 90000000000 };
+
+    trcolumn zoom, biome, material;
+    tr_column_initialize(&zoom, trcol_i32, 'bnch');
+    tr_column_initialize(&biome, trcol_i64, 'bnch');
+    tr_column_initialize(&material, trcol_i64, 'bnch');
+    zoom.encode = biome.encode = material.encode = encode;
+
+    uint64_t seed = 0x9e3779b97f4a7c15;
+    for (int64_t i = 0; i < COLUMN_NROWS; ++i) {
+        uint64_t r = bench_rand(&seed);
+        int32_t z = r % 20;
+        int64_t b = biomes[(r >> 8) % arraysize(biomes)];
+        int64_t m = i / 5000;
+        tr_column_append(&zoom, &z, 1);
+        tr_column_append(&biome, &b, 1);
+        tr_column_append(&material, &m, 1);
+    }
+
+    struct { const char *name; trcolumn *column; trcolvalue lo, hi; } filters[] = {
+        { "zoom", &zoom, { .i = 10 }, { .i = 12 } },
+        { "biome", &biome, { .i = 4096 }, { .i = 4096 } },
+        { "material", &material, { .i = 100 }, { .i = 150 } },
+    };
+
+    uint64_t *bitmap = tr_alloc(tr_colpred_words(&zoom) * sizeof(uint64_t), 'bnch');
+    for (int f = 0; f < arraysize(filters); ++f) {
+        trcolpred pred;
+        tr_colpred_compile(&pred, filters[f].column->type, trcolop_between, filters[f].lo, filters[f].hi);
+
+        trtime start = tr_clock_now();
+        for (int pass = 0; pass < COLUMN_NPASSES; ++pass) {
+            tr_colpred_filter(&pred, filters[f].column, bitmap, false, NULL);
+        }
+        trtime elapsed = tr_clock_now() - start;
+
+        char metric[64];
+        snprintf(metric, sizeof(metric), "%s (%s)", filters[f].name, encode ? "encoded" : "plain");
+        BENCH_REPORT(metric, BENCH_RATE((uint64_t)COLUMN_NROWS * COLUMN_NPASSES, elapsed), "rows/s");
+        snprintf(metric, sizeof(metric), "%s size (%s)", filters[f].name, encode ? "encoded" : "plain");
+        BENCH_REPORT(metric, (double)tr_column_size(filters[f].column) / COLUMN_NROWS, "bytes/row");
+    }
+
+    tr_free(bitmap);
+    tr_column_cleanup(&zoom);
+    tr_column_cleanup(&biome);
+    tr_column_cleanup(&material);
+}
+
+static void column_encodings()
+{
+    column_encodings_run(false);
+    column_encodings_run(true);
+}
+
+static const bench_case column_cases[] =
+{
+    BENCH_CASE(column_filter),
+    BENCH_CASE(column_zone_maps),
+    BENCH_CASE(column_encodings),
+};
+
+BENCH_SUITE(column_bench, column_cases);
@@ -0,0 +1,70 @@
+/////////////////////////////////////////////////////////////////////////////
+//
+// Terrascale
+// Copyright (c) Dave Kilian & Emily Kilian 2023. All rights reserved.
+//
+//////////////////////////////////////////////////////////////////////////////
+
+#include <pch.h>
+#include <bench/bench.h>
+#include <runtime/crc32c.h>
+
+//
+// Checksum throughput for each CRC-32C implementation the CPU supports, on
+// single pages (the per-I/O cost) and on a large buffer (scan bandwidth)
+//
+
+#define CRC_TOTAL (1ull << 30)
+
+// Keeps the checksums from being optimized away
+static volatile uint32_t crc_sink;
+
+static const char *crc_names[] = { "software", "sse4.2", "sse4.2+pclmul" };
+
+static void crc_run(size_t size)
+{
+    uint8_t *buffer = tr_alloc_aligned(size, 64, 'bnch');
+    for (size_t i = 0; i < size; ++i) {
+        buffer[i] = (uint8_t)(i * 131);
+    }
+
+    for (trcrcimpl impl = trcrc_software; impl <= tr_crc32c_best(); ++impl) {
+
+        // The software path is much slower; don't wait for a whole gigabyte
+        uint64_t total = impl == trcrc_software ? CRC_TOTAL / 8 : CRC_TOTAL;
+        uint64_t iterations = total / size;
+
+        // Chain the checksums, so that the calls can't be hoisted
+        uint32_t crc = 0;
+        trtime start = tr_clock_now();
+        for (uint64_t i = 0; i < iterations; ++i) {
+            crc = tr_crc32c_with(impl, crc, buffer, size);
+        }
+        trtime elapsed = tr_clock_now() - start;
+
+        char metric[64];
+        snprintf(metric, sizeof(metric), "%s (%zu bytes)", crc_names[impl], size);
+        BENCH_REPORT(metric, (double)iterations * size / 1e9 / tr_clock_seconds(elapsed), "GB/s");
+        crc_sink = crc;
+    }
+
+    tr_free(buffer);
+}
+
+static void crc32c_page()
+{
+    crc_run(8192);
+}
+
+static void crc32c_large()
+{
+    crc_run(4 << 20);
+}
+
+static const bench_case crc32c_cases[] =
+{
+    BENCH_CASE(crc32c_page),
+    BENCH_CASE(crc32c_large),
+};
+
+BENCH_SUITE(crc32c_bench, crc32c_cases);
@@ -0,0 +1,122 @@
+/////////////////////////////////////////////////////////////////////////////
+//
+// Terrascale
+// Copyright (c) Dave Kilian & Emily Kilian 2023. All rights reserved.
+//
+//////////////////////////////////////////////////////////////////////////////
+
+#include <pch.h>
+#include <bench/bench.h>
+#include <protect/epoch.h>
+
+//
+// The cost of pinning, which readers pay on every operation, alone and with
+// other threads pinning and retiring at the same time; and the throughput
+// of retiring blocks, which writers pay for every node they unlink.
+//
+
+#define EPOCH_NPINS     (10 * 1000 * 1000)
+#define EPOCH_NRETIRES  (1000 * 1000)
+#define EPOCH_NTHREADS  4
+
+typedef struct {
+    trepochnode node;
+    uint64_t payload[4];
+} benchblock;
+
+typedef struct {
+    trepoch *epoch;
+    _Atomic(benchblock *) *shared;
+    bool writer;
+    uint64_t sum;
+} benchworker;
+
+static void epoch_pin()
+{
+    trepoch epoch;
+    tr_epoch_initialize(&epoch);
+
+    trepochthread t;
+    tr_epoch_register(&epoch, &t);
+
+    trtime start = tr_clock_now();
+    for (int i = 0; i < EPOCH_NPINS; ++i) {
+        tr_epoch_enter(&t);
+        tr_epoch_exit(&t);
+    }
+    trtime elapsed = tr_clock_now() - start;
+
+    BENCH_REPORT("enter+exit", (double)elapsed / EPOCH_NPINS, "ns");
+
+    tr_epoch_unregister(&t);
+    tr_epoch_cleanup(&epoch);
+}
+
+static void *epoch_worker(void *arg)
+{
+    benchworker *w = arg;
+    trepochthread t;
+    tr_epoch_register(w->epoch, &t);
+
+    int count = w->writer ? EPOCH_NRETIRES : EPOCH_NPINS / EPOCH_NTHREADS;
+    for (int i = 0; i < count; ++i) {
+        if (w->writer) {
+            benchblock *b = tr_alloc(sizeof(benchblock), 'bnch');
+            b->payload[0] = i;
+            benchblock *old = atomic_exchange(w->shared, b);
+            tr_epoch_free(&t, old, &old->node);
+        } else {
+            tr_epoch_enter(&t);
+            w->sum += atomic_load_explicit(w->shared, memory_order_acquire)->payload[0];
+            tr_epoch_exit(&t);
+        }
+    }
+
+    tr_epoch_unregister(&t);
+    return NULL;
+}
+
+// Readers pin and read a shared pointer which one writer keeps replacing
+static void epoch_readers_writer()
+{
+    trepoch epoch;
+    tr_epoch_initialize(&epoch);
+
+    benchblock *first = tr_alloc(sizeof(benchblock), 'bnch');
+    first->payload[0] = 0;
+    _Atomic(benchblock *) shared = first;
+
+    pthread_t threads[EPOCH_NTHREADS + 1];
+    benchworker workers[EPOCH_NTHREADS + 1];
+
+    trtime start = tr_clock_now();
+    for (int i = 0; i <= EPOCH_NTHREADS; ++i) {
+        workers[i] = (benchworker){ &epoch, &shared, i == EPOCH_NTHREADS, 0 };
+        pthread_create(threads + i, NULL, &epoch_worker, workers + i);
+    }
+
+    for (int i = 0; i < EPOCH_NTHREADS; ++i) {
+        pthread_join(threads[i], NULL);
+    }
+    trtime readtime = tr_clock_now() - start;
+
+    pthread_join(threads[EPOCH_NTHREADS], NULL);
+    trtime writetime = tr_clock_now() - start;
+
+    trepochstat stat = tr_epoch_stat(&epoch);
+    BENCH_REPORT("reads (4 threads)", BENCH_RATE(EPOCH_NPINS, readtime), "/s");
+    BENCH_REPORT("retires", BENCH_RATE(EPOCH_NRETIRES, writetime), "/s");
+    BENCH_REPORT("epoch advances", (double)stat.advances, "");
+    BENCH_REPORT("freed before cleanup", 100.0 * stat.freed / stat.retired, "%");
+
+    tr_epoch_cleanup(&epoch);
+    tr_free(atomic_load(&shared));
+}
+
+static const bench_case epoch_cases[] =
+{
+    BENCH_CASE(epoch_pin),
+    BENCH_CASE(epoch_readers_writer),
+};
+
+BENCH_SUITE(epoch_bench, epoch_cases);
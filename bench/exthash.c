@@ -0,0 +1,154 @@
+/////////////////////////////////////////////////////////////////////////////
+//
+// Terrascale
+// Copyright (c) Dave Kilian & Emily Kilian 2023. All rights reserved.
+//
+//////////////////////////////////////////////////////////////////////////////
+
+#include <pch.h>
+#include <bench/bench.h>
+#include <index/btree.h>
+#include <index/exthash.h>
+#include <index/memtree.h>
+
+#include <unistd.h>
+
+//
+// Point lookups of random 64-bit tile ids in an extendible hash table, the
+// in-memory B+tree and the disk B+tree (through a pool holding all of it),
+// each holding the same four million ids. Also reports the slowest insert
+// which doubled the hash table's directory, which would show any pause to
+// grow it.
+//
+
+#define EXTHASH_NKEYS       (4 * 1024 * 1024)
+#define EXTHASH_NLOOKUPS    (4 * 1024 * 1024)
+
+static uint64_t bench_rand(uint64_t *state)
+{
+    uint64_t x = *state;
+    x ^= x << 13;
+    x ^= x >> 7;
+    x ^= x << 17;
+    return *state = x;
+}
+
+static uint64_t exthash_key(uint64_t i)
+{
+    return i * 0x9e3779b97f4a7c15ull;
+}
+
+// Orders key indexes by their keys
+static int exthash_order(const void *a, const void *b)
+{
+    uint64_t ka = exthash_key(*(const uint64_t *)a);
+    uint64_t kb = exthash_key(*(const uint64_t *)b);
+    return ka < kb ? -1 : ka > kb;
+}
+
+static void exthash_report(const char *label, trtime elapsed)
+{
+    char metric[64];
+    snprintf(metric, sizeof(metric), "lookup (%s)", label);
+    BENCH_REPORT(metric, (double)elapsed / EXTHASH_NLOOKUPS, "ns");
+}
+
+static void exthash_lookups()
+{
+    // Hash table
+    trexthash table;
+    tr_exthash_initialize(&table, 'bnch');
+    trtime slowest = 0;
+    trtime start = tr_clock_now();
+    for (uint64_t i = 0; i < EXTHASH_NKEYS; ++i) {
+        uint64_t ndoublings = table.ndoublings;
+        trtime t = tr_clock_now();
+        tr_exthash_put(&table, exthash_key(i), i);
+        if (table.ndoublings != ndoublings) {
+            slowest = max(slowest, tr_clock_now() - t);
+        }
+    }
+    trtime elapsed = tr_clock_now() - start;
+    BENCH_REPORT("insert (hash)", BENCH_RATE(EXTHASH_NKEYS, elapsed), "ops/s");
+    BENCH_REPORT("slowest doubling insert (hash)", slowest / 1e3, "us");
+    BENCH_REPORT("load (hash)", tr_exthash_stat(&table).load * 100, "%");
+
+    uint64_t seed = 0x2545f4914f6cdd1d;
+    uint64_t sum = 0;
+    start = tr_clock_now();
+    for (unsigned i = 0; i < EXTHASH_NLOOKUPS; ++i) {
+        uint64_t value;
+        tr_exthash_get(&table, exthash_key(bench_rand(&seed) % EXTHASH_NKEYS), &value);
+        sum += value;
+    }
+    exthash_report("hash", tr_clock_now() - start);
+    tr_exthash_cleanup(&table);
+
+    // In-memory B+tree
+    trmemtree memtree;
+    tr_memtree_initialize(&memtree, 'bnch');
+    for (uint64_t i = 0; i < EXTHASH_NKEYS; ++i) {
+        tr_memtree_put(&memtree, exthash_key(i), i);
+    }
+
+    seed = 0x2545f4914f6cdd1d;
+    uint64_t treesum = 0;
+    start = tr_clock_now();
+    for (unsigned i = 0; i < EXTHASH_NLOOKUPS; ++i) {
+        uint64_t value;
+        tr_memtree_get(&memtree, exthash_key(bench_rand(&seed) % EXTHASH_NKEYS), &value);
+        treesum += value;
+    }
+    exthash_report("memtree", tr_clock_now() - start);
+    tr_memtree_cleanup(&memtree);
+    tr_require(treesum == sum);
+
+    // Disk B+tree, bulk built from big-endian keys so they sort as numbers
+    char path[64];
+    snprintf(path, sizeof(path), "/tmp/trbench-exthash-%d", (int)getpid());
+    trfile file;
+    trbufpool pool;
+    trbtree btree;
+    tr_file_open(&file, path, tr_file_create | tr_file_truncate);
+    tr_bufpool_initialize(&pool, 32 * 1024, 'bnch');
+    tr_btree_create(&btree, &pool, &file, 'bnch');
+
+    uint64_t *order = tr_alloc(EXTHASH_NKEYS * sizeof(uint64_t), 'bnch');
+    for (uint64_t i = 0; i < EXTHASH_NKEYS; ++i) {
+        order[i] = i;
+    }
+    qsort(order, EXTHASH_NKEYS, sizeof(uint64_t), exthash_order);
+
+    trbtbuilder builder;
+    tr_btree_build_begin(&builder, &btree, 1.0);
+    for (uint64_t i = 0; i < EXTHASH_NKEYS; ++i) {
+        uint64_t key = __builtin_bswap64(exthash_key(order[i]));
+        tr_btree_build_add(&builder, &key, sizeof(key), order[i]);
+    }
+    tr_require(tr_ok(tr_btree_build_finish(&builder)));
+    tr_free(order);
+
+    seed = 0x2545f4914f6cdd1d;
+    treesum = 0;
+    start = tr_clock_now();
+    for (unsigned i = 0; i < EXTHASH_NLOOKUPS; ++i) {
+        uint64_t value;
+        uint64_t key = __builtin_bswap64(exthash_key(bench_rand(&seed) % EXTHASH_NKEYS));
+        tr_btree_get(&btree, &key, sizeof(key), &value);
+        treesum += value;
+    }
+    exthash_report("btree", tr_clock_now() - start);
+    tr_require(treesum == sum);
+
+    tr_btree_cleanup(&btree);
+    tr_bufpool_cleanup(&pool);
+    tr_file_close(&file);
+    unlink(path);
+}
+
+static const bench_case exthash_cases[] =
+{
+    BENCH_CASE(exthash_lookups),
+};
+
+BENCH_SUITE(exthash_bench, exthash_cases);
@@ -0,0 +1,82 @@
+/////////////////////////////////////////////////////////////////////////////
+//
+// Terrascale
+// Copyright (c) Dave Kilian & Emily Kilian 2023. All rights reserved.
+//
+//////////////////////////////////////////////////////////////////////////////
+
+#include <pch.h>
+#include <bench/bench.h>
+#include <runtime/hash.h>
+#include <store/filter.h>
+
+//
+// Flat and blocked filters over four million keys at several bits per key.
+// The filters are larger than the caches, as a large store's filters are
+// together. Reports the measured false positive rate, and the time to check
+// keys the filter doesn't hold (which is what filters are for) and keys it
+// does.
+//
+
+#define FILTER_NKEYS    (4 * 1024 * 1024)
+#define FILTER_NCHECKS  (4 * 1024 * 1024)
+
+static const char *filter_names[] = { "flat", "blocked" };
+
+static void filter_run(unsigned bitsperkey, trfilterlayout layout, const uint64_t *hashes)
+{
+    size_t size = tr_filter_size(FILTER_NKEYS, bitsperkey, layout);
+    void *filter = tr_alloc_aligned(size, tr_filter_blocksize, 'bnch');
+    tr_filter_build(filter, size, bitsperkey, layout, hashes, FILTER_NKEYS);
+
+    // Keys from past the end of those added
+    uint64_t positives = 0;
+    trtime start = tr_clock_now();
+    for (uint64_t i = FILTER_NKEYS; i < FILTER_NKEYS + FILTER_NCHECKS; ++i) {
+        positives += tr_filter_check(filter, size, tr_hash_u64(i));
+    }
+    trtime negative = tr_clock_now() - start;
+
+    // Keys which were added, hashed again rather than read from the array,
+    // whose cache misses would swamp the filter's
+    uint64_t hits = 0;
+    start = tr_clock_now();
+    for (uint64_t i = 0; i < FILTER_NCHECKS; ++i) {
+        hits += tr_filter_check(filter, size, tr_hash_u64(i % FILTER_NKEYS));
+    }
+    trtime positive = tr_clock_now() - start;
+    tr_require(hits == FILTER_NCHECKS);
+
+    char metric[64];
+    snprintf(metric, sizeof(metric), "false positives (%s, %u bits)", filter_names[layout], bitsperkey);
+    BENCH_REPORT(metric, 100.0 * positives / FILTER_NCHECKS, "%");
+    snprintf(metric, sizeof(metric), "check absent (%s, %u bits)", filter_names[layout], bitsperkey);
+    BENCH_REPORT(metric, (double)negative / FILTER_NCHECKS, "ns");
+    snprintf(metric, sizeof(metric), "check present (%s, %u bits)", filter_names[layout], bitsperkey);
+    BENCH_REPORT(metric, (double)positive / FILTER_NCHECKS, "ns");
+
+    tr_free(filter);
+}
+
+static void filter_layouts()
+{
+    uint64_t *hashes = tr_alloc(FILTER_NKEYS * sizeof(uint64_t), 'bnch');
+    for (uint64_t i = 0; i < FILTER_NKEYS; ++i) {
+        hashes[i] = tr_hash_u64(i);
+    }
+
+    unsigned bits[] = { 6, 10, 16 };
+    for (unsigned b = 0; b < arraysize(bits); ++b) {
+        filter_run(bits[b], trfilter_flat, hashes);
+        filter_run(bits[b], trfilter_blocked, hashes);
+    }
+
+    tr_free(hashes);
+}
+
+static const bench_case filter_cases[] =
+{
+    BENCH_CASE(filter_layouts),
+};
+
+BENCH_SUITE(filter_bench, filter_cases);
@@ -0,0 +1,109 @@
+/////////////////////////////////////////////////////////////////////////////
+//
+// Terrascale
+// Copyright (c) Dave Kilian & Emily Kilian 2023. All rights reserved.
+//
+//////////////////////////////////////////////////////////////////////////////
+
+#include <pch.h>
+#include <bench/bench.h>
+#include <table/load.h>
+
+//
+// Bulk loads of a few million rows of (zoom i32, id i64, size f64) from
+// memory, as CSV and as packed binary records, on one worker and on every
+// core.
+//
+
+#define LOAD_NROWS (4 * 1024 * 1024)
+#define LOAD_RECORD 20
+
+static uint64_t bench_rand(uint64_t *state)
+{
+    uint64_t x = *state;
+    x ^= x << 13;
+    x ^= x >> 7;
+    x ^= x << 17;
+    return *state = x;
+}
+
+static void load_run(trloadformat format, const void *data, size_t size, int nworkers, const char *label)
+{
+    trtaskmanconfig tmconfig;
+    tr_taskman_defaults(&tmconfig, trtaskman_shared);
+    tmconfig.nworkers = nworkers;
+    tmconfig.tag = 'bnch';
+
+    trtaskman tm;
+    tr_require(tr_ok(tr_taskman_initialize(&tm, &tmconfig)));
+    nworkers = tr_taskman_nworkers(&tm);
+
+    trcolumn columns[3];
+    tr_column_initialize(columns + 0, trcol_i32, 'bnch');
+    tr_column_initialize(columns + 1, trcol_i64, 'bnch');
+    tr_column_initialize(columns + 2, trcol_f64, 'bnch');
+
+    trloadconfig config;
+    tr_load_defaults(&config, format);
+    config.tag = 'bnch';
+
+    trloadstat stat;
+    tr_require(tr_ok(tr_load_buffer(&tm, &config, data, size, columns, 3, &stat)));
+    tr_require(stat.nrows == LOAD_NROWS);
+
+    char metric[64];
+    snprintf(metric, sizeof(metric), "%s, %d workers", label, nworkers);
+    BENCH_REPORT(metric, stat.rate, "rows/s");
+    snprintf(metric, sizeof(metric), "%s bytes, %d workers", label, nworkers);
+    BENCH_REPORT(metric, BENCH_RATE(size, stat.elapsed) / (1024 * 1024), "MB/s");
+
+    for (int c = 0; c < 3; ++c) {
+        tr_column_cleanup(columns + c);
+    }
+    tr_taskman_cleanup(&tm);
+}
+
+static void load_csv()
+{
+    size_t capacity = (size_t)LOAD_NROWS * 48;
+    char *text = tr_alloc(capacity, 'bnch');
+    size_t size = 0;
+    uint64_t seed = 0x2545f4914f6cdd1d;
+    for (unsigned i = 0; i < LOAD_NROWS; ++i) {
+        uint64_t r = bench_rand(&seed);
+        size += snprintf(text + size, capacity - size, "%d,%u,%.3f\n",
+            (int)(r % 20), i, (double)(r >> 44) / 1000);
+    }
+
+    load_run(trload_csv, text, size, 1, "csv");
+    load_run(trload_csv, text, size, 0, "csv");
+    tr_free(text);
+}
+
+static void load_binary()
+{
+    uint8_t *records = tr_alloc((size_t)LOAD_NROWS * LOAD_RECORD, 'bnch');
+    uint64_t seed = 0x2545f4914f6cdd1d;
+    for (unsigned i = 0; i < LOAD_NROWS; ++i) {
+        uint64_t r = bench_rand(&seed);
+        int32_t zoom = r % 20;
+        int64_t id = i;
+        double size = (double)(r >> 44) / 1000;
+        uint8_t *record = records + (size_t)i * LOAD_RECORD;
+        memcpy(record, &zoom, 4);
+        memcpy(record + 4, &id, 8);
+        memcpy(record + 12, &size, 8);
+    }
+
+    load_run(trload_binary, records, (size_t)LOAD_NROWS * LOAD_RECORD, 1, "binary");
+    load_run(trload_binary, records, (size_t)LOAD_NROWS * LOAD_RECORD, 0, "binary");
+    tr_free(records);
+}
+
+static const bench_case load_cases[] =
+{
+    BENCH_CASE(load_csv),
+    BENCH_CASE(load_binary),
+};
+
+BENCH_SUITE(load_bench, load_cases);
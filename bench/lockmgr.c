@@ -0,0 +1,164 @@
+/////////////////////////////////////////////////////////////////////////////
+//
+// Terrascale
+// Copyright (c) Dave Kilian & Emily Kilian 2023. All rights reserved.
+//
+//////////////////////////////////////////////////////////////////////////////
+
+#include <pch.h>
+#include <bench/bench.h>
+#include <protect/lockmgr.h>
+#include <runtime/hash.h>
+
+//
+// Acquire cost: one owner locks many rows of one table and releases them,
+// with escalation off and on. Without escalation every row costs a lock
+// table entry; with it, the owner trades them for one table lock.
+//
+// Contention: many transactions lock a few random rows each of one table,
+// all taking IX on that table. The table's lock is the hot spot a single
+// lock table would serialize on; here only the first row of each
+// transaction touches it.
+//
+
+#define LOCKMGR_NROWS       (64 * 1024)
+#define LOCKMGR_ROWSPERPAGE 64
+#define LOCKMGR_NCLIENTS    16
+#define LOCKMGR_NTXNS       2000
+#define LOCKMGR_TXNROWS     8
+
+static trlockname bench_row(uint64_t row)
+{
+    return tr_lockname_row(1, row / LOCKMGR_ROWSPERPAGE, row);
+}
+
+static void lockmgr_acquire_run(unsigned escalation, const char *label)
+{
+    trlockmgr mgr;
+    tr_lockmgr_initialize(&mgr, escalation, 'bnch');
+
+    trlockowner owner;
+    tr_lockmgr_owner_initialize(&mgr, &owner);
+
+    // Warm the owner's and the partitions' spare lists
+    for (uint64_t i = 0; i < LOCKMGR_NROWS; ++i) {
+        tr_lockmgr_lock(&owner, NULL, bench_row(i), trlock_x);
+    }
+    tr_lockmgr_release_all(&owner);
+
+    trtime start = tr_clock_now();
+    for (uint64_t i = 0; i < LOCKMGR_NROWS; ++i) {
+        tr_lockmgr_lock(&owner, NULL, bench_row(i), trlock_x);
+    }
+    trtime locked = tr_clock_now();
+    uint64_t held = tr_lockmgr_stat(&mgr).nheld;
+    tr_lockmgr_release_all(&owner);
+    trtime released = tr_clock_now();
+
+    char metric[64];
+    snprintf(metric, sizeof(metric), "lock (%s)", label);
+    BENCH_REPORT(metric, (double)(locked - start) / LOCKMGR_NROWS, "ns/row");
+    snprintf(metric, sizeof(metric), "release (%s)", label);
+    BENCH_REPORT(metric, (double)(released - locked) / LOCKMGR_NROWS, "ns/row");
+    snprintf(metric, sizeof(metric), "locks held (%s)", label);
+    BENCH_REPORT(metric, (double)held, "");
+
+    tr_lockmgr_owner_cleanup(&owner);
+    tr_lockmgr_cleanup(&mgr);
+}
+
+static void lockmgr_acquire()
+{
+    lockmgr_acquire_run(UINT32_MAX, "no escalation");
+    lockmgr_acquire_run(0, "escalation");
+}
+
+typedef struct {
+    trtask task;
+    trlockowner owner;
+    int remaining;      // Transactions left to run
+    int nlocked;        // Rows locked by the current transaction
+    uint64_t seed;
+} lockclient;
+
+static trstatus lockclient_run(trtask *task)
+{
+    lockclient *c = container_of(task, lockclient, task);
+
+    while (c->remaining > 0) {
+        while (c->nlocked < LOCKMGR_TXNROWS) {
+            // Each row's choice is a function of the transaction's seed, so
+            // a resumed or retried request asks for the same row again
+            uint64_t row = tr_hash_u64(c->seed + c->nlocked) % LOCKMGR_NROWS;
+            trstatus s = tr_lockmgr_lock(&c->owner, task, bench_row(row), trlock_x);
+            if (s == trstatus_pending) {
+                return s;
+            }
+            if (s == trstatus_conflict) {
+                tr_lockmgr_release_all(&c->owner);
+                c->nlocked = 0;
+                return trstatus_later;
+            }
+            c->nlocked++;
+        }
+
+        tr_lockmgr_release_all(&c->owner);
+        c->nlocked = 0;
+        c->seed += LOCKMGR_TXNROWS;
+        c->remaining--;
+    }
+
+    return trstatus_ok;
+}
+
+static void lockmgr_contention()
+{
+    trlockmgr mgr;
+    tr_lockmgr_initialize(&mgr, 0, 'bnch');
+
+    trtaskmanconfig config;
+    tr_taskman_defaults(&config, trtaskman_shared);
+    config.nworkers = 4;
+    config.tag = 'bnch';
+
+    trtaskman tm;
+    tr_taskman_initialize(&tm, &config);
+
+    lockclient *clients = tr_alloc(LOCKMGR_NCLIENTS * sizeof(lockclient), 'bnch');
+    trtime start = tr_clock_now();
+    for (int i = 0; i < LOCKMGR_NCLIENTS; ++i) {
+        lockclient *c = clients + i;
+        tr_task_initialize(&c->task, &lockclient_run, NULL);
+        tr_lockmgr_owner_initialize(&mgr, &c->owner);
+        c->remaining = LOCKMGR_NTXNS;
+        c->nlocked = 0;
+        c->seed = (uint64_t)i << 32;
+        tr_taskman_submit(&tm, &c->task);
+    }
+    tr_taskman_drain(&tm);
+    trtime elapsed = tr_clock_now() - start;
+    tr_taskman_cleanup(&tm);
+
+    trlockmgrstat stat = tr_lockmgr_stat(&mgr);
+    BENCH_REPORT("transactions", BENCH_RATE(LOCKMGR_NCLIENTS * LOCKMGR_NTXNS, elapsed), "/s");
+    BENCH_REPORT("locks granted", BENCH_RATE(stat.locks.nacquire, elapsed), "/s");
+    BENCH_REPORT("waits", (double)stat.locks.ncontended, "");
+    BENCH_REPORT("mean wait", stat.locks.ncontended > 0
+        ? (double)stat.locks.waittime / stat.locks.ncontended / tr_us(1) : 0, "us");
+    BENCH_REPORT("wait-die conflicts", (double)stat.nconflicts, "");
+    BENCH_REPORT("partition guard waits", (double)stat.nguardwaits, "");
+
+    for (int i = 0; i < LOCKMGR_NCLIENTS; ++i) {
+        tr_lockmgr_owner_cleanup(&clients[i].owner);
+    }
+    tr_free(clients);
+    tr_lockmgr_cleanup(&mgr);
+}
+
+static const bench_case lockmgr_cases[] =
+{
+    BENCH_CASE(lockmgr_acquire),
+    BENCH_CASE(lockmgr_contention),
+};
+
+BENCH_SUITE(lockmgr_bench, lockmgr_cases);
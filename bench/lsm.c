@@ -0,0 +1,175 @@
+/////////////////////////////////////////////////////////////////////////////
+//
+// Terrascale
+// Copyright (c) Dave Kilian & Emily Kilian 2023. All rights reserved.
+//
+//////////////////////////////////////////////////////////////////////////////
+
+#include <pch.h>
+#include <bench/bench.h>
+#include <runtime/hash.h>
+#include <store/lsm.h>
+
+#include <dirent.h>
+#include <unistd.h>
+
+//
+// Ingest workload: writer threads put 100-byte values under random 16-byte
+// keys, with some keys overwritten, as fast as the store will take them.
+// Reports ingest throughput including any stalls, write amplification (bytes
+// written to tables per byte written by callers), and then the rate of
+// random point lookups against the settled tree.
+//
+
+#define LSM_NKEYS    (1 << 20)   // Distinct keys
+#define LSM_NWRITES  (2 << 20)   // Writes in total, across all threads
+#define LSM_VALUE    100
+#define LSM_NREADS   (1 << 19)
+
+typedef struct {
+    trlsm *lsm;         // The store
+    int thread;         // Index of this writer
+    int nthreads;       // Number of writers
+} lsmwriter;
+
+static void lsm_key(char *key, uint64_t i)
+{
+    snprintf(key, 17, "%016llx", (unsigned long long)tr_hash_u64(i));
+}
+
+static void *lsm_write_thread(void *context)
+{
+    lsmwriter *w = context;
+    char key[17];
+    char value[LSM_VALUE];
+    memset(value, 'v', sizeof(value));
+
+    for (uint64_t i = w->thread; i < LSM_NWRITES; i += w->nthreads) {
+        lsm_key(key, tr_hash_u64(i) % LSM_NKEYS);
+        memcpy(value, &i, sizeof(i));
+        tr_lsm_put(w->lsm, key, 16, value, sizeof(value), NULL);
+    }
+
+    return NULL;
+}
+
+static void lsm_remove_dir(const char *path)
+{
+    DIR *dir = opendir(path);
+    if (dir == NULL) {
+        return;
+    }
+
+    struct dirent *entry;
+    while ((entry = readdir(dir)) != NULL) {
+        if (entry->d_name[0] != '.') {
+            unlinkat(dirfd(dir), entry->d_name, 0);
+        }
+    }
+
+    closedir(dir);
+    rmdir(path);
+}
+
+static void lsm_run(int nthreads)
+{
+    char dir[64];
+    snprintf(dir, sizeof(dir), "/tmp/trbench-lsm-%d", (int)getpid());
+    lsm_remove_dir(dir);
+
+    trtaskmanconfig tmconfig;
+    tr_taskman_defaults(&tmconfig, trtaskman_shared);
+    tmconfig.pin = false;
+    tmconfig.tag = 'bnch';
+
+    trtaskman tm;
+    tr_taskman_initialize(&tm, &tmconfig);
+
+    trlsmconfig config;
+    tr_lsm_defaults(&config, dir, &tm);
+    config.tag = 'bnch';
+
+    trlsm lsm;
+    tr_lsm_open(&lsm, &config);
+
+    pthread_t *threads = tr_alloc(nthreads * sizeof(pthread_t), 'bnch');
+    lsmwriter *writers = tr_alloc(nthreads * sizeof(lsmwriter), 'bnch');
+
+    trtime start = tr_clock_now();
+    for (int i = 0; i < nthreads; ++i) {
+        writers[i] = (lsmwriter){ &lsm, i, nthreads };
+        pthread_create(threads + i, NULL, &lsm_write_thread, writers + i);
+    }
+    for (int i = 0; i < nthreads; ++i) {
+        pthread_join(threads[i], NULL);
+    }
+    trtime ingest = tr_clock_now() - start;
+
+    // Let background work catch up, so amplification covers all of it
+    tr_lsm_flush(&lsm);
+    tr_lsm_settle(&lsm);
+    trtime settled = tr_clock_now() - start;
+
+    trlsmstat stat = tr_lsm_stat(&lsm);
+
+    char metric[64];
+    snprintf(metric, sizeof(metric), "%d writers", nthreads);
+    BENCH_REPORT(metric, BENCH_RATE(LSM_NWRITES, ingest), "puts/s");
+    BENCH_REPORT("  ingest", BENCH_RATE(stat.userbytes, ingest) / (1 << 20), "MB/s");
+    BENCH_REPORT("  ingest, settled", BENCH_RATE(stat.userbytes, settled) / (1 << 20), "MB/s");
+    BENCH_REPORT("  write amplification",
+            (double)(stat.flushbytes + stat.compactbytes) / stat.userbytes, "x");
+    BENCH_REPORT("  stalls", stat.nstalls, "");
+
+    int deepest = 0;
+    for (int i = 0; i < tr_lsm_nlevels; ++i) {
+        if (stat.ntables[i] > 0) {
+            deepest = i;
+        }
+    }
+    BENCH_REPORT("  deepest level", deepest, "");
+
+    // Lookups of keys which exist, and of keys which don't, which the
+    // filters should answer without reading any blocks
+    char key[17];
+    char value[LSM_VALUE];
+    unsigned vallen;
+    int found = 0;
+
+    start = tr_clock_now();
+    for (uint64_t i = 0; i < LSM_NREADS; ++i) {
+        lsm_key(key, tr_hash_u64(i) % LSM_NKEYS);
+        found += tr_ok(tr_lsm_get(&lsm, key, 16, value, sizeof(value), &vallen));
+    }
+    BENCH_REPORT("  gets, present", BENCH_RATE(LSM_NREADS, tr_clock_now() - start), "gets/s");
+
+    start = tr_clock_now();
+    for (uint64_t i = 0; i < LSM_NREADS; ++i) {
+        lsm_key(key, LSM_NKEYS + i);
+        found += tr_ok(tr_lsm_get(&lsm, key, 16, value, sizeof(value), &vallen));
+    }
+    BENCH_REPORT("  gets, absent", BENCH_RATE(LSM_NREADS, tr_clock_now() - start), "gets/s");
+
+    tr_lsm_close(&lsm);
+    tr_taskman_cleanup(&tm);
+    tr_free(writers);
+    tr_free(threads);
+    lsm_remove_dir(dir);
+
+    (void)found;
+}
+
+static void lsm_ingest()
+{
+    int counts[] = { 1, 4 };
+    for (int i = 0; i < arraysize(counts); ++i) {
+        lsm_run(counts[i]);
+    }
+}
+
+static const bench_case lsm_cases[] =
+{
+    BENCH_CASE(lsm_ingest),
+};
+
+BENCH_SUITE(lsm_bench, lsm_cases);
@@ -0,0 +1,179 @@
+/////////////////////////////////////////////////////////////////////////////
+//
+// Terrascale
+// Copyright (c) Dave Kilian & Emily Kilian 2023. All rights reserved.
+//
+//////////////////////////////////////////////////////////////////////////////
+
+#include <pch.h>
+#include <bench/bench.h>
+#include <runtime/lz.h>
+#include <store/file.h>
+
+//
+// Compression ratio and speed on synthetic terrain: a fractal heightfield
+// of 16-bit samples, cut into 256x256 tiles as the tiler stores them, and
+// into store pages. Tiles are measured both raw and with each sample
+// replaced by its difference from the one to its left, which turns smooth
+// slopes into runs of small repeated values.
+//
+
+#define LZ_SIZE     2048    // Width and height of the heightfield
+#define LZ_TILE     256     // Width and height of a tile
+#define LZ_OCTAVES  6
+#define LZ_REPEAT   4       // Times to pass over the data when timing
+
+// Keeps the results from being optimized away
+static volatile unsigned lz_sink;
+
+static uint32_t lz_hash(uint32_t x, uint32_t y, uint32_t octave)
+{
+    uint32_t h = x * 0x9e3779b1u ^ y * 0x85ebca77u ^ octave * 0xc2b2ae3du;
+    h ^= h >> 15;
+    h *= 0x2c1b3c6du;
+    h ^= h >> 12;
+    return h;
+}
+
+// Builds value noise: random heights on a lattice for each octave, halving
+// in spacing and amplitude each time, interpolated bilinearly
+//
+static int16_t *lz_heightfield()
+{
+    int16_t *height = tr_alloc(LZ_SIZE * LZ_SIZE * sizeof(int16_t), 'bnch');
+
+    for (int y = 0; y < LZ_SIZE; ++y) {
+        for (int x = 0; x < LZ_SIZE; ++x) {
+            int32_t sum = 0;
+            for (int k = 0; k < LZ_OCTAVES; ++k) {
+                int cell = 512 >> k;
+                int32_t amplitude = 8192 >> k;
+                int cx = x / cell, cy = y / cell;
+                int fx = x % cell, fy = y % cell;
+
+                int32_t v00 = lz_hash(cx, cy, k) % (2 * amplitude) - amplitude;
+                int32_t v10 = lz_hash(cx + 1, cy, k) % (2 * amplitude) - amplitude;
+                int32_t v01 = lz_hash(cx, cy + 1, k) % (2 * amplitude) - amplitude;
+                int32_t v11 = lz_hash(cx + 1, cy + 1, k) % (2 * amplitude) - amplitude;
+
+                int64_t top = (int64_t)v00 * (cell - fx) + (int64_t)v10 * fx;
+                int64_t bottom = (int64_t)v01 * (cell - fx) + (int64_t)v11 * fx;
+                sum += (top * (cell - fy) + bottom * fy) / ((int64_t)cell * cell);
+            }
+            height[y * LZ_SIZE + x] = (int16_t)(sum / 2);
+        }
+    }
+
+    return height;
+}
+
+// Cuts the heightfield into tiles, laid out one after another
+static int16_t *lz_tiles(const int16_t *height, bool delta)
+{
+    int16_t *tiles = tr_alloc(LZ_SIZE * LZ_SIZE * sizeof(int16_t), 'bnch');
+    int16_t *out = tiles;
+
+    for (int ty = 0; ty < LZ_SIZE; ty += LZ_TILE) {
+        for (int tx = 0; tx < LZ_SIZE; tx += LZ_TILE) {
+            for (int y = ty; y < ty + LZ_TILE; ++y) {
+                int16_t prev = 0;
+                for (int x = tx; x < tx + LZ_TILE; ++x) {
+                    int16_t h = height[y * LZ_SIZE + x];
+                    *out++ = delta ? (int16_t)(h - prev) : h;
+                    prev = h;
+                }
+            }
+        }
+    }
+
+    return tiles;
+}
+
+// Compresses and decompresses the data in blocks of the given size
+static void lz_run(const char *name, const void *data, size_t size, unsigned block)
+{
+    unsigned nblocks = size / block;
+    unsigned bound = tr_lz_bound(block);
+    uint8_t *compressed = tr_alloc((size_t)nblocks * bound, 'bnch');
+    unsigned *zlengths = tr_alloc(nblocks * sizeof(unsigned), 'bnch');
+    uint8_t *output = tr_alloc(block, 'bnch');
+
+    uint64_t ztotal = 0;
+    trtime start = tr_clock_now();
+    for (int r = 0; r < LZ_REPEAT; ++r) {
+        ztotal = 0;
+        for (unsigned i = 0; i < nblocks; ++i) {
+            tr_lz_compress(ptr_add(data, (size_t)i * block), block,
+                           compressed + (size_t)i * bound, bound, &zlengths[i]);
+            ztotal += zlengths[i];
+        }
+    }
+    trtime ctime = tr_clock_now() - start;
+
+    unsigned check = 0;
+    start = tr_clock_now();
+    for (int r = 0; r < LZ_REPEAT; ++r) {
+        for (unsigned i = 0; i < nblocks; ++i) {
+            unsigned length;
+            tr_lz_decompress(compressed + (size_t)i * bound, zlengths[i], output, block, &length);
+            check += output[length / 2];
+        }
+    }
+    trtime dtime = tr_clock_now() - start;
+    lz_sink = check;
+
+    char metric[64];
+    double mb = (double)size * LZ_REPEAT / 1e6;
+
+    snprintf(metric, sizeof(metric), "%s ratio", name);
+    BENCH_REPORT(metric, (double)size / ztotal, "x");
+    snprintf(metric, sizeof(metric), "%s compress", name);
+    BENCH_REPORT(metric, mb / tr_clock_seconds(ctime), "MB/s");
+    snprintf(metric, sizeof(metric), "%s decompress", name);
+    BENCH_REPORT(metric, mb / tr_clock_seconds(dtime), "MB/s");
+
+    tr_free(output);
+    tr_free(zlengths);
+    tr_free(compressed);
+}
+
+static void lz_heightfield_tiles()
+{
+    int16_t *height = lz_heightfield();
+    size_t size = LZ_SIZE * LZ_SIZE * sizeof(int16_t);
+    unsigned tile = LZ_TILE * LZ_TILE * sizeof(int16_t);
+
+    int16_t *raw = lz_tiles(height, false);
+    lz_run("raw tiles", raw, size, tile);
+    lz_run("raw pages", raw, size, tr_page_payload);
+
+    int16_t *delta = lz_tiles(height, true);
+    lz_run("delta tiles", delta, size, tile);
+    lz_run("delta pages", delta, size, tr_page_payload);
+
+    tr_free(delta);
+    tr_free(raw);
+    tr_free(height);
+}
+
+static void lz_random()
+{
+    size_t size = 16 << 20;
+    uint8_t *data = tr_alloc(size, 'bnch');
+    uint32_t x = 1;
+    for (size_t i = 0; i < size; ++i) {
+        x = x * 1103515245u + 12345u;
+        data[i] = x >> 24;
+    }
+
+    lz_run("random pages", data, size, tr_page_payload);
+    tr_free(data);
+}
+
+static const bench_case lz_cases[] =
+{
+    BENCH_CASE(lz_heightfield_tiles),
+    BENCH_CASE(lz_random),
+};
+
+BENCH_SUITE(lz_bench, lz_cases);
@@ -0,0 +1,129 @@
+/////////////////////////////////////////////////////////////////////////////
+//
+// Terrascale
+// Copyright (c) Dave Kilian & Emily Kilian 2023. All rights reserved.
+//
+//////////////////////////////////////////////////////////////////////////////
+
+#include <pch.h>
+#include <bench/bench.h>
+#include <index/memtree.h>
+
+#include <unistd.h>
+
+//
+// Read scaling: 1 to 8 threads look up random keys in a prefilled tree,
+// first through its optimistic latches and then with the whole tree behind
+// a pthread reader/writer lock, which every lookup writes. Optimistic
+// lookups should scale with cores; locked ones stop scaling as the lock's
+// cache line bounces between them.
+//
+
+#define MEMTREE_NKEYS       (1000 * 1000)
+#define MEMTREE_MAXTHREADS  8
+#define MEMTREE_DURATION    tr_ms(500)
+
+typedef struct {
+    trmemtree *tree;
+    pthread_rwlock_t *lock;     // If set, taken shared around each lookup
+    _Atomic bool *stop;
+    uint64_t seed;
+    uint64_t count;             // Lookups done
+} memtreeworker;
+
+static uint64_t bench_rand(uint64_t *state)
+{
+    uint64_t x = *state;
+    x ^= x << 13;
+    x ^= x >> 7;
+    x ^= x << 17;
+    return *state = x;
+}
+
+static void *memtree_reader(void *arg)
+{
+    memtreeworker *w = arg;
+    uint64_t sum = 0;
+
+    while (!atomic_load_explicit(w->stop, memory_order_relaxed)) {
+        for (int i = 0; i < 64; ++i) {
+            uint64_t value = 0;
+            uint64_t key = bench_rand(&w->seed) % MEMTREE_NKEYS * 2;
+
+            if (w->lock != NULL) {
+                pthread_rwlock_rdlock(w->lock);
+                tr_memtree_get(w->tree, key, &value);
+                pthread_rwlock_unlock(w->lock);
+            } else {
+                tr_memtree_get(w->tree, key, &value);
+            }
+            sum += value;
+        }
+        w->count += 64;
+    }
+
+    w->seed = sum;
+    return NULL;
+}
+
+// Runs some readers for a while, and returns their lookups per second
+static double memtree_run(trmemtree *tree, pthread_rwlock_t *lock, int nthreads)
+{
+    _Atomic bool stop = false;
+    pthread_t threads[MEMTREE_MAXTHREADS];
+    memtreeworker workers[MEMTREE_MAXTHREADS];
+
+    for (int i = 0; i < nthreads; ++i) {
+        workers[i] = (memtreeworker){ tree, lock, &stop, 0x9e3779b97f4a7c15ull * (i + 1), 0 };
+        pthread_create(threads + i, NULL, &memtree_reader, workers + i);
+    }
+
+    trtime start = tr_clock_now();
+    while (tr_clock_now() - start < MEMTREE_DURATION) {
+        usleep(1000);
+    }
+    atomic_store(&stop, true);
+
+    uint64_t lookups = 0;
+    for (int i = 0; i < nthreads; ++i) {
+        pthread_join(threads[i], NULL);
+        lookups += workers[i].count;
+    }
+
+    return BENCH_RATE(lookups, tr_clock_now() - start);
+}
+
+static void memtree_read_scaling()
+{
+    trmemtree tree;
+    tr_memtree_initialize(&tree, 'bnch');
+
+    for (uint64_t i = 0; i < MEMTREE_NKEYS; ++i) {
+        tr_memtree_put(&tree, i * 2, i);
+    }
+
+    pthread_rwlock_t lock;
+    pthread_rwlock_init(&lock, NULL);
+
+    trmemtreestat stat = tr_memtree_stat(&tree);
+    BENCH_REPORT("height", (double)stat.height, "");
+    BENCH_REPORT("cpus", (double)sysconf(_SC_NPROCESSORS_ONLN), "");
+
+    for (int n = 1; n <= MEMTREE_MAXTHREADS; n *= 2) {
+        char metric[64];
+        snprintf(metric, sizeof(metric), "lookups, %d thread%s (optimistic)", n, n > 1 ? "s" : "");
+        BENCH_REPORT(metric, memtree_run(&tree, NULL, n), "/s");
+        snprintf(metric, sizeof(metric), "lookups, %d thread%s (rwlock)", n, n > 1 ? "s" : "");
+        BENCH_REPORT(metric, memtree_run(&tree, &lock, n), "/s");
+    }
+
+    pthread_rwlock_destroy(&lock);
+    tr_memtree_cleanup(&tree);
+}
+
+static const bench_case memtree_cases[] =
+{
+    BENCH_CASE(memtree_read_scaling),
+};
+
+BENCH_SUITE(memtree_bench, memtree_cases);
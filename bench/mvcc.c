@@ -0,0 +1,178 @@
+/////////////////////////////////////////////////////////////////////////////
+//
+// Terrascale
+// Copyright (c) Dave Kilian & Emily Kilian 2023. All rights reserved.
+//
+//////////////////////////////////////////////////////////////////////////////
+
+#include <pch.h>
+#include <bench/bench.h>
+#include <protect/mvcc.h>
+
+#include <unistd.h>
+
+//
+// Mixed workload: writers run short transactions which update a few random
+// rows, first alone and then alongside scanners, each of which reads every
+// row in one snapshot and vacuums afterwards. Scans take no locks, so the
+// writers' throughput should hold up while they run.
+//
+
+#define MVCC_NROWS      (100 * 1000)
+#define MVCC_ROWSIZE    64
+#define MVCC_NWRITES    4
+#define MVCC_NWRITERS   2
+#define MVCC_NSCANNERS  2
+#define MVCC_DURATION   tr_ms(1000)
+
+typedef struct {
+    trmvcc *mvcc;
+    trmvccrow *rows;
+    _Atomic bool *stop;
+    uint64_t seed;
+    uint64_t count;     // Transactions committed, or rows scanned
+    uint64_t scans;     // Scans finished
+} mvccworker;
+
+static uint64_t bench_rand(uint64_t *state)
+{
+    uint64_t x = *state;
+    x ^= x << 13;
+    x ^= x >> 7;
+    x ^= x << 17;
+    return *state = x;
+}
+
+static void *mvcc_writer(void *arg)
+{
+    mvccworker *w = arg;
+    char row[MVCC_ROWSIZE];
+
+    while (!atomic_load_explicit(w->stop, memory_order_relaxed)) {
+        trmvcctxn txn;
+        tr_mvcc_begin(w->mvcc, &txn);
+
+        bool ok = true;
+        for (int i = 0; i < MVCC_NWRITES && ok; ++i) {
+            uint64_t r = bench_rand(&w->seed);
+            memset(row, (int)r, sizeof(row));
+            ok = tr_ok(tr_mvcc_write(&txn, w->rows + r % MVCC_NROWS, row, sizeof(row)));
+        }
+
+        if (ok) {
+            tr_mvcc_commit(&txn);
+            w->count++;
+        } else {
+            tr_mvcc_abort(&txn);
+        }
+    }
+
+    return NULL;
+}
+
+static void *mvcc_scanner(void *arg)
+{
+    mvccworker *w = arg;
+    char row[MVCC_ROWSIZE];
+    uint64_t checksum = 0;
+
+    while (!atomic_load_explicit(w->stop, memory_order_relaxed)) {
+        trmvcctxn txn;
+        tr_mvcc_begin(w->mvcc, &txn);
+
+        for (int i = 0; i < MVCC_NROWS; ++i) {
+            unsigned length;
+            if (tr_ok(tr_mvcc_read(&txn, w->rows + i, row, sizeof(row), &length))) {
+                checksum += (uint8_t)row[0];
+            }
+        }
+        tr_mvcc_commit(&txn);
+
+        w->count += MVCC_NROWS;
+        w->scans++;
+        tr_mvcc_vacuum(w->mvcc, w->rows, MVCC_NROWS);
+    }
+
+    w->seed = checksum;
+    return NULL;
+}
+
+// Runs the writers, and optionally the scanners, for a while. Returns the
+// writers' transactions per second.
+//
+static double mvcc_run(trmvcc *mvcc, trmvccrow *rows, int nscanners, double *scanrate)
+{
+    _Atomic bool stop = false;
+    pthread_t threads[MVCC_NWRITERS + MVCC_NSCANNERS];
+    mvccworker workers[MVCC_NWRITERS + MVCC_NSCANNERS];
+    int nthreads = MVCC_NWRITERS + nscanners;
+
+    for (int i = 0; i < nthreads; ++i) {
+        workers[i] = (mvccworker){ mvcc, rows, &stop, 0x9e3779b97f4a7c15ull * (i + 1), 0, 0 };
+        pthread_create(threads + i, NULL,
+            i < MVCC_NWRITERS ? &mvcc_writer : &mvcc_scanner, workers + i);
+    }
+
+    trtime start = tr_clock_now();
+    while (tr_clock_now() - start < MVCC_DURATION) {
+        usleep(1000);
+    }
+    atomic_store(&stop, true);
+
+    uint64_t txns = 0, scanned = 0;
+    for (int i = 0; i < nthreads; ++i) {
+        pthread_join(threads[i], NULL);
+        if (i < MVCC_NWRITERS) {
+            txns += workers[i].count;
+        } else {
+            scanned += workers[i].count;
+        }
+    }
+    trtime elapsed = tr_clock_now() - start;
+
+    *scanrate = BENCH_RATE(scanned, elapsed);
+    return BENCH_RATE(txns, elapsed);
+}
+
+static void mvcc_mixed()
+{
+    trmvcc mvcc;
+    tr_mvcc_initialize(&mvcc, 'bnch');
+
+    trmvccrow *rows = tr_alloc(MVCC_NROWS * sizeof(trmvccrow), 'bnch');
+    char row[MVCC_ROWSIZE] = {0};
+
+    trmvcctxn txn;
+    tr_mvcc_begin(&mvcc, &txn);
+    for (int i = 0; i < MVCC_NROWS; ++i) {
+        tr_mvcc_row_initialize(rows + i);
+        tr_mvcc_write(&txn, rows + i, row, sizeof(row));
+    }
+    tr_mvcc_commit(&txn);
+
+    double scanrate;
+    double alone = mvcc_run(&mvcc, rows, 0, &scanrate);
+    trmvccstat before = tr_mvcc_stat(&mvcc);
+    double mixed = mvcc_run(&mvcc, rows, MVCC_NSCANNERS, &scanrate);
+    trmvccstat stat = tr_mvcc_stat(&mvcc);
+
+    BENCH_REPORT("write txns (alone)", alone, "/s");
+    BENCH_REPORT("write txns (with scans)", mixed, "/s");
+    BENCH_REPORT("rows scanned (with writes)", scanrate, "/s");
+    BENCH_REPORT("conflicts", (double)(stat.conflicts - before.conflicts), "");
+    BENCH_REPORT("versions written", (double)(stat.versions - before.versions), "");
+    BENCH_REPORT("versions collected", (double)(stat.collected - before.collected), "");
+
+    for (int i = 0; i < MVCC_NROWS; ++i) {
+        tr_mvcc_row_cleanup(rows + i);
+    }
+    tr_free(rows);
+    tr_mvcc_cleanup(&mvcc);
+}
+
+static const bench_case mvcc_cases[] =
+{
+    BENCH_CASE(mvcc_mixed),
+};
+
+BENCH_SUITE(mvcc_bench, mvcc_cases);
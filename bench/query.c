@@ -0,0 +1,340 @@
+/////////////////////////////////////////////////////////////////////////////
+//
+// Terrascale
+// Copyright (c) Dave Kilian & Emily Kilian 2023. All rights reserved.
+//
+//////////////////////////////////////////////////////////////////////////////
+
+#include <pch.h>
+#include <bench/bench.h>
+#include <query/query.h>
+
+//
+// A benchmark per operator. Operators other than scan read from a source
+// operator defined here, which copies batches out of plain arrays, so each
+// measures little but the operator itself; the rate of the source alone is
+// reported for comparison.
+//
+// - Scan: plain and encoded columns, decoded a batch at a time.
+// - Filter: a comparison selecting half, and a hundredth, of the rows, and
+//   the second of two filters, which narrows a selection vector.
+// - Project: integer and double arithmetic.
+// - Aggregate: sums and maxima over all rows, and grouped by a key with a
+//   hundred and a hundred thousand values.
+// - Join: a million build rows, probed by keys which match once each, and
+//   by keys of which a tenth match.
+//
+
+#define QUERY_NROWS     (4 * 1024 * 1024)
+#define QUERY_NPASSES   4
+
+static uint64_t bench_rand(uint64_t *state)
+{
+    uint64_t x = *state;
+    x ^= x << 13;
+    x ^= x >> 7;
+    x ^= x << 17;
+    return *state = x;
+}
+
+// A source of batches copied from arrays, read `npasses` times over
+typedef struct {
+
+    trqop op;
+    const void *const *arrays;  // Each column's values
+    uint64_t nrows;             // Rows in each
+    uint64_t row;               // Next row to copy
+    unsigned npasses;           // Passes left
+    trbatch *batch;
+
+} bench_source;
+
+static trstatus bench_source_next(trqop *op, trbatch **batch)
+{
+    bench_source *source = (bench_source *)op;
+    if (source->row == source->nrows) {
+        if (--source->npasses == 0) {
+            *batch = NULL;
+            return trstatus_ok;
+        }
+        source->row = 0;
+    }
+
+    trbatch *out = source->batch;
+    unsigned count = min(source->nrows - source->row, tr_batch_rows);
+    for (unsigned c = 0; c < op->ncolumns; ++c) {
+        unsigned width = tr_coltype_width(op->types[c]);
+        memcpy(out->columns[c].values, ptr_add(source->arrays[c], source->row * width), count * width);
+    }
+    out->count = count;
+    out->sel = NULL;
+    out->nsel = count;
+    source->row += count;
+    *batch = out;
+    return trstatus_ok;
+}
+
+static trqop *bench_source_create(trquery *query, const trcoltype *types, const void *const *arrays,
+        unsigned ncolumns, uint64_t nrows, unsigned npasses)
+{
+    bench_source *source = (bench_source *)tr_query_op(query, sizeof(bench_source), bench_source_next,
+        NULL, types, ncolumns);
+    tr_require(source != NULL);
+    source->arrays = arrays;
+    source->nrows = nrows;
+    source->npasses = npasses;
+    source->batch = tr_query_batch(query, types, ncolumns);
+    tr_require(source->batch != NULL);
+    return &source->op;
+}
+
+// Pulls every batch from an operator, returning the live rows
+static uint64_t bench_drain(trqop *op)
+{
+    uint64_t nrows = 0;
+    for (;;) {
+        trbatch *batch;
+        tr_require(tr_ok(tr_query_next(op, &batch)));
+        if (batch == NULL) {
+            return nrows;
+        }
+        nrows += batch->nsel;
+    }
+}
+
+// Reports the rate `nrows` input rows went through an operator
+static void bench_rate(const char *metric, uint64_t nrows, trtime elapsed)
+{
+    BENCH_REPORT(metric, BENCH_RATE(nrows, elapsed), "rows/s");
+}
+
+// Random i64 values in [0, range), and the same as doubles
+static int64_t *bench_values(uint64_t nrows, uint64_t range, uint64_t seed)
+{
+    int64_t *values = tr_alloc(nrows * sizeof(int64_t), 'bnch');
+    for (uint64_t i = 0; i < nrows; ++i) {
+        values[i] = bench_rand(&seed) % range;
+    }
+    return values;
+}
+
+static double *bench_doubles(const int64_t *values, uint64_t nrows)
+{
+    double *doubles = tr_alloc(nrows * sizeof(double), 'bnch');
+    for (uint64_t i = 0; i < nrows; ++i) {
+        doubles[i] = values[i] * 0.25;
+    }
+    return doubles;
+}
+
+static void query_scan()
+{
+    // Plain doubles, and integers which pack into 2 bytes
+    trcolumn plain, packed;
+    tr_column_initialize(&plain, trcol_f64, 'bnch');
+    tr_column_initialize(&packed, trcol_i64, 'bnch');
+    uint64_t seed = 0x9e3779b97f4a7c15;
+    for (uint64_t i = 0; i < QUERY_NROWS; ++i) {
+        int64_t v = 1000000 + bench_rand(&seed) % 50000;
+        double f = v * 0.5;
+        tr_column_append(&plain, &f, 1);
+        tr_column_append(&packed, &v, 1);
+    }
+
+    const trcolumn *columns[][1] = { { &plain }, { &packed } };
+    const char *metrics[] = { "scan (plain f64)", "scan (packed i64)" };
+    for (unsigned i = 0; i < 2; ++i) {
+        trquery query;
+        trqop *scan;
+        tr_require(tr_ok(tr_query_initialize(&query, 'bnch')));
+        tr_require(tr_ok(tr_query_scan(&query, columns[i], 1, &scan)));
+        trtime start = tr_clock_now();
+        tr_require(bench_drain(scan) == QUERY_NROWS);
+        bench_rate(metrics[i], QUERY_NROWS, tr_clock_now() - start);
+        tr_query_cleanup(&query);
+    }
+
+    tr_column_cleanup(&plain);
+    tr_column_cleanup(&packed);
+}
+
+static void query_filter()
+{
+    static const trcoltype types[] = { trcol_i64, trcol_i64 };
+    int64_t *a = bench_values(QUERY_NROWS, 1000, 0x2545f4914f6cdd1d);
+    int64_t *b = bench_values(QUERY_NROWS, 1000, 0x9e3779b97f4a7c15);
+    const void *arrays[] = { a, b };
+    uint64_t nrows = (uint64_t)QUERY_NROWS * QUERY_NPASSES;
+
+    // The source alone
+    trquery query;
+    tr_require(tr_ok(tr_query_initialize(&query, 'bnch')));
+    trqop *source = bench_source_create(&query, types, arrays, 2, QUERY_NROWS, QUERY_NPASSES);
+    trtime start = tr_clock_now();
+    bench_drain(source);
+    bench_rate("source", nrows, tr_clock_now() - start);
+    tr_query_cleanup(&query);
+
+    // One filter selecting half, or a hundredth
+    int64_t bounds[] = { 500, 10 };
+    const char *metrics[] = { "filter (1/2 selected)", "filter (1/100 selected)" };
+    for (unsigned i = 0; i < 2; ++i) {
+        trqop *filter;
+        tr_require(tr_ok(tr_query_initialize(&query, 'bnch')));
+        source = bench_source_create(&query, types, arrays, 2, QUERY_NROWS, QUERY_NPASSES);
+        tr_require(tr_ok(tr_query_filter(&query, source, 0, trcolop_lt, (trcolvalue){ .i = bounds[i] },
+            (trcolvalue){ 0 }, &filter)));
+        start = tr_clock_now();
+        tr_require(bench_drain(filter) > 0);
+        bench_rate(metrics[i], nrows, tr_clock_now() - start);
+        tr_query_cleanup(&query);
+    }
+
+    // A second filter refining the first's selection
+    trqop *first, *second;
+    tr_require(tr_ok(tr_query_initialize(&query, 'bnch')));
+    source = bench_source_create(&query, types, arrays, 2, QUERY_NROWS, QUERY_NPASSES);
+    tr_require(tr_ok(tr_query_filter(&query, source, 0, trcolop_lt, (trcolvalue){ .i = 500 },
+        (trcolvalue){ 0 }, &first)));
+    tr_require(tr_ok(tr_query_filter(&query, first, 1, trcolop_between, (trcolvalue){ .i = 100 },
+        (trcolvalue){ .i = 599 }, &second)));
+    start = tr_clock_now();
+    tr_require(bench_drain(second) > 0);
+    bench_rate("filter (two, 1/4 selected)", nrows, tr_clock_now() - start);
+    tr_query_cleanup(&query);
+
+    tr_free(a);
+    tr_free(b);
+}
+
+static void query_project()
+{
+    static const trcoltype types[] = { trcol_i64, trcol_i64, trcol_f64 };
+    int64_t *a = bench_values(QUERY_NROWS, 1 << 20, 0x2545f4914f6cdd1d);
+    int64_t *b = bench_values(QUERY_NROWS, 1 << 20, 0x9e3779b97f4a7c15);
+    double *f = bench_doubles(a, QUERY_NROWS);
+    const void *arrays[] = { a, b, f };
+    uint64_t nrows = (uint64_t)QUERY_NROWS * QUERY_NPASSES;
+
+    trqexpr ints[] = { { .op = trqexpr_mul, .left = 0, .right = 1 } };
+    trqexpr doubles[] = { { .op = trqexpr_add, .left = 2, .constant = true, .value = { .f = 0.5 } } };
+    trqexpr mixed[] = { { .op = trqexpr_mul, .left = 2, .right = 1 } };
+    const trqexpr *exprs[] = { ints, doubles, mixed };
+    const char *metrics[] = { "project (i64 * i64)", "project (f64 + constant)", "project (f64 * i64)" };
+
+    for (unsigned i = 0; i < 3; ++i) {
+        trquery query;
+        trqop *project;
+        tr_require(tr_ok(tr_query_initialize(&query, 'bnch')));
+        trqop *source = bench_source_create(&query, types, arrays, 3, QUERY_NROWS, QUERY_NPASSES);
+        tr_require(tr_ok(tr_query_project(&query, source, exprs[i], 1, &project)));
+        trtime start = tr_clock_now();
+        tr_require(bench_drain(project) == nrows);
+        bench_rate(metrics[i], nrows, tr_clock_now() - start);
+        tr_query_cleanup(&query);
+    }
+
+    tr_free(a);
+    tr_free(b);
+    tr_free(f);
+}
+
+static void query_aggregate()
+{
+    static const trcoltype types[] = { trcol_i64, trcol_i64, trcol_i64, trcol_f64 };
+    int64_t *small = bench_values(QUERY_NROWS, 100, 0x2545f4914f6cdd1d);
+    int64_t *large = bench_values(QUERY_NROWS, 100000, 0x9e3779b97f4a7c15);
+    int64_t *values = bench_values(QUERY_NROWS, 1 << 20, 0xd1b54a32d192ed03);
+    double *f = bench_doubles(values, QUERY_NROWS);
+    const void *arrays[] = { small, large, values, f };
+    uint64_t nrows = (uint64_t)QUERY_NROWS * QUERY_NPASSES;
+
+    trqagg aggs[] = { { trqagg_sum, 2 }, { trqagg_max, 3 } };
+    unsigned groups[] = { tr_query_nogroup, 0, 1 };
+    unsigned ngroups[] = { 1, 100, 100000 };
+    const char *metrics[] = { "aggregate (1 group)", "aggregate (100 groups)", "aggregate (100k groups)" };
+
+    for (unsigned i = 0; i < 3; ++i) {
+        trquery query;
+        trqop *agg;
+        tr_require(tr_ok(tr_query_initialize(&query, 'bnch')));
+        trqop *source = bench_source_create(&query, types, arrays, 4, QUERY_NROWS, QUERY_NPASSES);
+        tr_require(tr_ok(tr_query_aggregate(&query, source, groups[i], aggs, 2, &agg)));
+        trtime start = tr_clock_now();
+        tr_require(bench_drain(agg) == ngroups[i]);
+        bench_rate(metrics[i], nrows, tr_clock_now() - start);
+        tr_query_cleanup(&query);
+    }
+
+    tr_free(small);
+    tr_free(large);
+    tr_free(values);
+    tr_free(f);
+}
+
+static void query_join()
+{
+    enum { nbuild = 1024 * 1024 };
+    static const trcoltype types[] = { trcol_i64, trcol_i64 };
+
+    // Build keys are 0 .. nbuild - 1, shuffled, with a payload
+    int64_t *buildkeys = tr_alloc(nbuild * sizeof(int64_t), 'bnch');
+    int64_t *payload = bench_values(nbuild, 1 << 20, 0xd1b54a32d192ed03);
+    uint64_t seed = 0x2545f4914f6cdd1d;
+    for (int64_t i = 0; i < nbuild; ++i) {
+        buildkeys[i] = i;
+    }
+    for (unsigned i = nbuild - 1; i > 0; --i) {
+        unsigned j = bench_rand(&seed) % (i + 1);
+        int64_t t = buildkeys[i];
+        buildkeys[i] = buildkeys[j];
+        buildkeys[j] = t;
+    }
+    const void *build[] = { buildkeys, payload };
+
+    // Probe keys all matching, or a tenth
+    int64_t *all = bench_values(QUERY_NROWS, nbuild, 0x9e3779b97f4a7c15);
+    int64_t *tenth = bench_values(QUERY_NROWS, nbuild * 10ull, 0x9e3779b97f4a7c15);
+    const void *probes[][2] = { { all, all }, { tenth, tenth } };
+    const char *metrics[] = { "join probe (all match)", "join probe (1/10 match)" };
+
+    for (unsigned i = 0; i < 2; ++i) {
+        trquery query;
+        trqop *join;
+        tr_require(tr_ok(tr_query_initialize(&query, 'bnch')));
+        trqop *buildsource = bench_source_create(&query, types, build, 2, nbuild, 1);
+        trqop *probesource = bench_source_create(&query, types, probes[i], 2, QUERY_NROWS, 1);
+        tr_require(tr_ok(tr_query_join(&query, buildsource, 0, probesource, 0, &join)));
+
+        // The first batch builds the hash table
+        trbatch *batch;
+        trtime start = tr_clock_now();
+        tr_require(tr_ok(tr_query_next(join, &batch)));
+        trtime built = tr_clock_now();
+        if (i == 0) {
+            bench_rate("join build", nbuild, built - start);
+        }
+
+        uint64_t nmatches = batch != NULL ? batch->nsel : 0;
+        nmatches += bench_drain(join);
+        bench_rate(metrics[i], QUERY_NROWS, tr_clock_now() - built);
+        tr_require(i == 0 ? nmatches == QUERY_NROWS : nmatches < QUERY_NROWS / 5);
+        tr_query_cleanup(&query);
+    }
+
+    tr_free(buildkeys);
+    tr_free(payload);
+    tr_free(all);
+    tr_free(tenth);
+}
+
+static const bench_case query_cases[] =
+{
+    BENCH_CASE(query_scan),
+    BENCH_CASE(query_filter),
+    BENCH_CASE(query_project),
+    BENCH_CASE(query_aggregate),
+    BENCH_CASE(query_join),
+};
+
+BENCH_SUITE(query_bench, query_cases);
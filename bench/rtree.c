@@ -0,0 +1,141 @@
+/////////////////////////////////////////////////////////////////////////////
+//
+// Terrascale
+// Copyright (c) Dave Kilian & Emily Kilian 2023. All rights reserved.
+//
+//////////////////////////////////////////////////////////////////////////////
+
+#include <pch.h>
+#include <bench/bench.h>
+#include <index/rtree.h>
+
+//
+// Window queries over the two million zoom 11 tiles covering half of the
+// unit square, in a tree filled by random inserts and in one bulk built.
+// Each window is a viewport of about 8 by 6 tiles at a random position.
+// Reports insert and build rates, query and result rates, each tree's
+// shape, and the query rate of checking every tile, for comparison.
+//
+
+#define RTREE_ZOOM      11
+#define RTREE_WIDTH     (1u << RTREE_ZOOM)
+#define RTREE_HEIGHT    (RTREE_WIDTH / 2)
+#define RTREE_NTILES    (RTREE_WIDTH * RTREE_HEIGHT)
+#define RTREE_NQUERIES  (1000 * 1000)
+#define RTREE_NSCANS    20
+
+static uint64_t bench_rand(uint64_t *state)
+{
+    uint64_t x = *state;
+    x ^= x << 13;
+    x ^= x >> 7;
+    x ^= x << 17;
+    return *state = x;
+}
+
+// Tile i's bounds, with the tiles in random order
+static trrtentry *rtree_tiles()
+{
+    trrtentry *tiles = tr_alloc(RTREE_NTILES * sizeof(trrtentry), 'bnch');
+    double size = 1.0 / RTREE_WIDTH;
+    for (unsigned i = 0; i < RTREE_NTILES; ++i) {
+        double x = (i % RTREE_WIDTH) * size, y = (i / RTREE_WIDTH) * size;
+        tiles[i] = (trrtentry){ tr_rect_make(x, y, x + size, y + size), i };
+    }
+
+    uint64_t seed = 0x2545f4914f6cdd1d;
+    for (unsigned i = RTREE_NTILES - 1; i > 0; --i) {
+        unsigned j = bench_rand(&seed) % (i + 1);
+        trrtentry t = tiles[i];
+        tiles[i] = tiles[j];
+        tiles[j] = t;
+    }
+    return tiles;
+}
+
+static trrect rtree_window(uint64_t *seed)
+{
+    double size = 1.0 / RTREE_WIDTH;
+    double x = (double)(bench_rand(seed) % (1u << 30)) / (1u << 30) * (RTREE_WIDTH - 8) * size;
+    double y = (double)(bench_rand(seed) % (1u << 30)) / (1u << 30) * (RTREE_HEIGHT - 6) * size;
+    return tr_rect_make(x, y, x + 7.5 * size, y + 5.5 * size);
+}
+
+static bool rtree_count(trrect rect, uint64_t value, void *context)
+{
+    (void)rect, (void)value;
+    ++*(uint64_t *)context;
+    return true;
+}
+
+static void rtree_queries(const trrtree *tree, const char *label)
+{
+    uint64_t seed = 0x9e3779b97f4a7c15;
+    uint64_t nresults = 0;
+    trtime start = tr_clock_now();
+    for (unsigned i = 0; i < RTREE_NQUERIES; ++i) {
+        tr_rtree_search(tree, rtree_window(&seed), rtree_count, &nresults);
+    }
+    trtime elapsed = tr_clock_now() - start;
+
+    // Each window covers 8 or 9 columns and 6 or 7 rows of tiles
+    tr_require(nresults >= 48ull * RTREE_NQUERIES && nresults <= 63ull * RTREE_NQUERIES);
+
+    char metric[64];
+    snprintf(metric, sizeof(metric), "window query (%s)", label);
+    BENCH_REPORT(metric, BENCH_RATE(RTREE_NQUERIES, elapsed), "queries/s");
+    snprintf(metric, sizeof(metric), "results (%s)", label);
+    BENCH_REPORT(metric, BENCH_RATE(nresults, elapsed), "tiles/s");
+
+    trrtreestat stat = tr_rtree_stat(tree);
+    snprintf(metric, sizeof(metric), "leaf fill (%s)", label);
+    BENCH_REPORT(metric, stat.leaffill * 100, "%");
+    snprintf(metric, sizeof(metric), "height (%s)", label);
+    BENCH_REPORT(metric, stat.height, "levels");
+}
+
+static void rtree_windows()
+{
+    trrtentry *tiles = rtree_tiles();
+
+    // Checking every tile
+    uint64_t seed = 0x9e3779b97f4a7c15;
+    uint64_t nresults = 0;
+    trtime start = tr_clock_now();
+    for (unsigned q = 0; q < RTREE_NSCANS; ++q) {
+        trrect window = rtree_window(&seed);
+        for (unsigned i = 0; i < RTREE_NTILES; ++i) {
+            nresults += tr_rect_intersects(tiles[i].rect, window);
+        }
+    }
+    tr_require(nresults > 0);
+    BENCH_REPORT("window query (scan)", BENCH_RATE(RTREE_NSCANS, tr_clock_now() - start), "queries/s");
+
+    // Random inserts
+    trrtree tree;
+    tr_rtree_initialize(&tree, 'bnch');
+    start = tr_clock_now();
+    for (unsigned i = 0; i < RTREE_NTILES; ++i) {
+        tr_rtree_insert(&tree, tiles[i].rect, tiles[i].value);
+    }
+    BENCH_REPORT("insert", BENCH_RATE(RTREE_NTILES, tr_clock_now() - start), "tiles/s");
+    rtree_queries(&tree, "inserted");
+    tr_rtree_cleanup(&tree);
+
+    // Bulk build
+    tr_rtree_initialize(&tree, 'bnch');
+    start = tr_clock_now();
+    tr_require(tr_ok(tr_rtree_build(&tree, tiles, RTREE_NTILES)));
+    BENCH_REPORT("bulk build", BENCH_RATE(RTREE_NTILES, tr_clock_now() - start), "tiles/s");
+    rtree_queries(&tree, "built");
+    tr_rtree_cleanup(&tree);
+
+    tr_free(tiles);
+}
+
+static const bench_case rtree_cases[] =
+{
+    BENCH_CASE(rtree_windows),
+};
+
+BENCH_SUITE(rtree_bench, rtree_cases);
@@ -0,0 +1,218 @@
+/////////////////////////////////////////////////////////////////////////////
+//
+// Terrascale
+// Copyright (c) Dave Kilian & Emily Kilian 2023. All rights reserved.
+//
+//////////////////////////////////////////////////////////////////////////////
+
+#include <pch.h>
+#include <bench/bench.h>
+#include <table/schema.h>
+
+//
+// Point reads and writes of single fields of random rows, in compiled
+// layouts and in a generic self-describing encoding. The generic encoding
+// stores fields in schema order, packed, with varlen fields prefixed by
+// their lengths, so finding a field means interpreting the schema and
+// walking every field before it. The rows fit in cache, so the cost of
+// finding fields isn't hidden behind misses.
+//
+
+#define SCHEMA_NROWS    (8 * 1024)
+#define SCHEMA_NOPS     (4 * 1024 * 1024)
+
+static const trfielddef schema_defs[] = {
+    { "flags", trfield_i8 },
+    { "name", trfield_bytes },
+    { "zoom", trfield_i32 },
+    { "id", trfield_i64 },
+    { "level", trfield_i16 },
+    { "note", trfield_bytes },
+    { "size", trfield_f64 },
+    { "x", trfield_i32 },
+    { "tags", trfield_bytes },
+};
+
+#define SCHEMA_NFIELDS  arraysize(schema_defs)
+#define SCHEMA_X        7
+#define SCHEMA_TAGS     8
+
+static uint64_t bench_rand(uint64_t *state)
+{
+    uint64_t x = *state;
+    x ^= x << 13;
+    x ^= x >> 7;
+    x ^= x << 17;
+    return *state = x;
+}
+
+// Gets the offset of a field of a generic row by walking the fields before
+// it. Kept out of line, as an interpreter would be, so the compiler can't
+// specialize it for the constant schema.
+//
+__attribute__((noipa))
+static size_t generic_find(const trfielddef *defs, unsigned nfields, const void *row, unsigned index)
+{
+    static const unsigned widths[] = {
+        [trfield_i8] = 1, [trfield_i16] = 2, [trfield_i32] = 4, [trfield_i64] = 8, [trfield_f64] = 8,
+    };
+
+    // One null byte per field, then the fields
+    size_t offset = nfields;
+    for (unsigned i = 0; i < index; ++i) {
+        if (defs[i].type == trfield_bytes) {
+            uint32_t size;
+            memcpy(&size, ptr_add(row, offset), sizeof(size));
+            offset += sizeof(size) + size;
+        } else {
+            offset += widths[defs[i].type];
+        }
+    }
+
+    return offset;
+}
+
+static int32_t generic_i32(const void *row, unsigned index)
+{
+    int32_t value;
+    memcpy(&value, ptr_add(row, generic_find(schema_defs, SCHEMA_NFIELDS, row, index)), sizeof(value));
+    return value;
+}
+
+static void generic_set_i32(void *row, unsigned index, int32_t value)
+{
+    memcpy(ptr_add(row, generic_find(schema_defs, SCHEMA_NFIELDS, row, index)), &value, sizeof(value));
+    *(uint8_t *)ptr_add(row, index) = 0;
+}
+
+static const void *generic_bytes(const void *row, unsigned index, uint32_t *size)
+{
+    size_t offset = generic_find(schema_defs, SCHEMA_NFIELDS, row, index);
+    memcpy(size, ptr_add(row, offset), sizeof(*size));
+    return ptr_add(row, offset + sizeof(*size));
+}
+
+// Writes a generic row, returning its size
+static size_t generic_encode(const trfieldvalue *values, void *row)
+{
+    size_t offset = SCHEMA_NFIELDS;
+    for (unsigned i = 0; i < SCHEMA_NFIELDS; ++i) {
+        *(uint8_t *)ptr_add(row, i) = values[i].null;
+
+        int64_t v = values[i].i;
+        switch (schema_defs[i].type) {
+        case trfield_i8:
+            *(int8_t *)ptr_add(row, offset) = v;
+            offset += 1;
+            break;
+        case trfield_i16:
+            memcpy(ptr_add(row, offset), &(int16_t){ v }, 2);
+            offset += 2;
+            break;
+        case trfield_i32:
+            memcpy(ptr_add(row, offset), &(int32_t){ v }, 4);
+            offset += 4;
+            break;
+        case trfield_i64:
+        case trfield_f64:
+            memcpy(ptr_add(row, offset), &v, 8);
+            offset += 8;
+            break;
+        case trfield_bytes:
+            memcpy(ptr_add(row, offset), &values[i].bytes.size, 4);
+            memcpy(ptr_add(row, offset + 4), values[i].bytes.data, values[i].bytes.size);
+            offset += 4 + values[i].bytes.size;
+            break;
+        }
+    }
+
+    return offset;
+}
+
+static void schema_point_access()
+{
+    trrowlayout layout;
+    tr_rowlayout_compile(&layout, schema_defs, SCHEMA_NFIELDS, 'bnch');
+    const trrowfield *x = tr_rowlayout_find(&layout, "x");
+    const trrowfield *tags = tr_rowlayout_find(&layout, "tags");
+
+    // Rows of up to 128 bytes, each in an aligned slot of both encodings
+    char text[64];
+    memset(text, 'a', sizeof(text));
+    uint8_t *compiled = tr_alloc_aligned((size_t)SCHEMA_NROWS * 128, 64, 'bnch');
+    uint8_t *generic = tr_alloc_aligned((size_t)SCHEMA_NROWS * 128, 64, 'bnch');
+
+    uint64_t seed = 0x2545f4914f6cdd1d;
+    for (unsigned i = 0; i < SCHEMA_NROWS; ++i) {
+        uint64_t r = bench_rand(&seed);
+        trfieldvalue values[SCHEMA_NFIELDS] = {
+            { .i = r % 3 },
+            { .bytes = { text, r % 24 } },
+            { .i = r % 20 },
+            { .i = i },
+            { .i = r % 7, .null = r % 5 == 0 },
+            { .bytes = { text, (r >> 8) % 16 } },
+            { .i = r },
+            { .i = (r >> 16) % 4096 },
+            { .bytes = { text, (r >> 24) % 8 } },
+        };
+        tr_require(tr_row_size(&layout, values) <= 128);
+        tr_row_encode(&layout, values, compiled + (size_t)i * 128);
+        tr_require(generic_encode(values, generic + (size_t)i * 128) <= 128);
+    }
+
+    // Reads
+    uint64_t sum = 0, gsum = 0;
+    seed = 0x1234567;
+    trtime start = tr_clock_now();
+    for (unsigned i = 0; i < SCHEMA_NOPS; ++i) {
+        const void *row = compiled + bench_rand(&seed) % SCHEMA_NROWS * 128;
+        uint32_t size;
+        tr_row_bytes(row, tags, &size);
+        sum += tr_row_i32(row, x) + size;
+    }
+    trtime elapsed = tr_clock_now() - start;
+    BENCH_REPORT("read (compiled)", (double)elapsed / SCHEMA_NOPS, "ns/row");
+
+    seed = 0x1234567;
+    start = tr_clock_now();
+    for (unsigned i = 0; i < SCHEMA_NOPS; ++i) {
+        const void *row = generic + bench_rand(&seed) % SCHEMA_NROWS * 128;
+        uint32_t size;
+        generic_bytes(row, SCHEMA_TAGS, &size);
+        gsum += generic_i32(row, SCHEMA_X) + size;
+    }
+    elapsed = tr_clock_now() - start;
+    BENCH_REPORT("read (generic)", (double)elapsed / SCHEMA_NOPS, "ns/row");
+    tr_require(sum == gsum);
+
+    // Writes
+    seed = 0x7654321;
+    start = tr_clock_now();
+    for (unsigned i = 0; i < SCHEMA_NOPS; ++i) {
+        uint64_t r = bench_rand(&seed);
+        tr_row_set_i32(compiled + r % SCHEMA_NROWS * 128, x, r >> 40);
+    }
+    elapsed = tr_clock_now() - start;
+    BENCH_REPORT("write (compiled)", (double)elapsed / SCHEMA_NOPS, "ns/row");
+
+    seed = 0x7654321;
+    start = tr_clock_now();
+    for (unsigned i = 0; i < SCHEMA_NOPS; ++i) {
+        uint64_t r = bench_rand(&seed);
+        generic_set_i32(generic + r % SCHEMA_NROWS * 128, SCHEMA_X, r >> 40);
+    }
+    elapsed = tr_clock_now() - start;
+    BENCH_REPORT("write (generic)", (double)elapsed / SCHEMA_NOPS, "ns/row");
+
+    tr_free(compiled);
+    tr_free(generic);
+    tr_rowlayout_cleanup(&layout);
+}
+
+static const bench_case schema_cases[] =
+{
+    BENCH_CASE(schema_point_access),
+};
+
+BENCH_SUITE(schema_bench, schema_cases);
@@ -0,0 +1,113 @@
+/////////////////////////////////////////////////////////////////////////////
+//
+// Terrascale
+// Copyright (c) Dave Kilian & Emily Kilian 2023. All rights reserved.
+//
+//////////////////////////////////////////////////////////////////////////////
+
+#include <pch.h>
+#include <bench/bench.h>
+#include <store/segment.h>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+//
+// Random blob reads from a warm segment, zero-copy through the mapping
+// versus copying each blob out with pread (as a buffer pool would), and the
+// time to open a large segment.
+//
+
+#define SEGMENT_NBLOBS (16 * 1024)
+#define SEGMENT_BLOB   4096
+#define SEGMENT_NREADS (200 * 1000)
+
+static char bench_path[64];
+
+static void segment_build()
+{
+    snprintf(bench_path, sizeof(bench_path), "/tmp/trbench-segment-%d", (int)getpid());
+
+    char *blob = tr_alloc(SEGMENT_BLOB, 'bnch');
+    trsegwriter writer;
+    tr_segwriter_create(&writer, bench_path, 'bnch');
+    for (int i = 0; i < SEGMENT_NBLOBS; ++i) {
+        uint32_t index;
+        memset(blob, i, SEGMENT_BLOB);
+        tr_segwriter_add(&writer, blob, SEGMENT_BLOB, &index);
+    }
+    tr_segwriter_finish(&writer);
+    tr_free(blob);
+}
+
+static uint64_t sum_blob(const uint64_t *words, uint64_t length)
+{
+    uint64_t sum = 0;
+    for (uint64_t i = 0; i < length / sizeof(uint64_t); ++i) {
+        sum += words[i];
+    }
+    return sum;
+}
+
+static void segment_random_reads()
+{
+    segment_build();
+
+    trsegment seg;
+    trtime start = tr_clock_now();
+    tr_segment_open(&seg, bench_path, trsegment_random);
+    BENCH_REPORT("open 64MB segment", (tr_clock_now() - start) / 1e3, "us");
+
+    // Warm the page cache, so both approaches read from memory
+    uint64_t checksum = 0;
+    for (uint32_t i = 0; i < seg.count; ++i) {
+        const void *data;
+        uint64_t length;
+        tr_segment_get(&seg, i, &data, &length);
+        checksum += sum_blob(data, length);
+    }
+
+    uint32_t x = 12345;
+    start = tr_clock_now();
+    for (int i = 0; i < SEGMENT_NREADS; ++i) {
+        x = x * 1664525u + 1013904223u;
+        const void *data;
+        uint64_t length;
+        tr_segment_get(&seg, x % SEGMENT_NBLOBS, &data, &length);
+        checksum += sum_blob(data, length);
+    }
+    trtime elapsed = tr_clock_now() - start;
+
+    double bytes = (double)SEGMENT_NREADS * SEGMENT_BLOB;
+    BENCH_REPORT("zero-copy reads", BENCH_RATE(SEGMENT_NREADS, elapsed), "/s");
+    BENCH_REPORT("zero-copy bandwidth", bytes / 1e6 / tr_clock_seconds(elapsed), "MB/s");
+
+    int fd = open(bench_path, O_RDONLY);
+    uint64_t *buffer = tr_alloc_aligned(SEGMENT_BLOB, 64, 'bnch');
+
+    x = 12345;
+    start = tr_clock_now();
+    for (int i = 0; i < SEGMENT_NREADS; ++i) {
+        x = x * 1664525u + 1013904223u;
+        const trsegentry *entry = seg.index + (x % SEGMENT_NBLOBS);
+        pread(fd, buffer, entry->length, entry->offset);
+        checksum += sum_blob(buffer, entry->length);
+    }
+    elapsed = tr_clock_now() - start;
+
+    BENCH_REPORT("copied reads", BENCH_RATE(SEGMENT_NREADS, elapsed), "/s");
+    BENCH_REPORT("copied bandwidth", bytes / 1e6 / tr_clock_seconds(elapsed), "MB/s");
+    BENCH_REPORT("checksum", (double)(checksum & 0xffff), "");
+
+    tr_free(buffer);
+    close(fd);
+    tr_segment_close(&seg);
+    unlink(bench_path);
+}
+
+static const bench_case segment_cases[] =
+{
+    BENCH_CASE(segment_random_reads),
+};
+
+BENCH_SUITE(segment_bench, segment_cases);
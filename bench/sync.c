@@ -0,0 +1,142 @@
+/////////////////////////////////////////////////////////////////////////////
+//
+// Terrascale
+// Copyright (c) Dave Kilian & Emily Kilian 2023. All rights reserved.
+//
+//////////////////////////////////////////////////////////////////////////////
+
+#include <pch.h>
+#include <bench/bench.h>
+#include <taskman/sync.h>
+
+//
+// Contention workload: lockers repeatedly take one hot lock and do a little
+// work while holding it, while independent bystander tasks share the same
+// workers. With a pthread mutex, a worker waiting for the lock can't run
+// bystanders; with a trmutex, the waiting task parks and the worker stays
+// busy.
+//
+
+#define SYNC_NLOCKERS    16
+#define SYNC_NITERS      500
+#define SYNC_NBYSTANDERS 20000
+#define SYNC_HOLD        tr_us(2)
+
+typedef struct {
+    trtask task;        // The locker task
+    int remaining;      // Iterations left to run
+    bool holding;       // Whether the task holds the lock
+} locker;
+
+static pthread_mutex_t bench_pmutex = PTHREAD_MUTEX_INITIALIZER;
+static trmutex bench_tmutex;
+
+static void spin_for(trtime duration)
+{
+    trtime end = tr_clock_now() + duration;
+    while (tr_clock_now() < end) {
+    }
+}
+
+static trstatus pthread_locker(trtask *task)
+{
+    locker *l = container_of(task, locker, task);
+
+    pthread_mutex_lock(&bench_pmutex);
+    spin_for(SYNC_HOLD);
+    pthread_mutex_unlock(&bench_pmutex);
+
+    return --l->remaining > 0 ? trstatus_later : trstatus_ok;
+}
+
+static trstatus task_locker(trtask *task)
+{
+    locker *l = container_of(task, locker, task);
+
+    if (tr_mutex_acquire(&bench_tmutex, task) == trstatus_pending) {
+        return trstatus_pending;
+    }
+
+    spin_for(SYNC_HOLD);
+    tr_mutex_release(&bench_tmutex);
+
+    return --l->remaining > 0 ? trstatus_later : trstatus_ok;
+}
+
+static _Atomic trtime bystander_done;
+
+static trstatus bystander(trtask *task)
+{
+    spin_for(tr_ns(500));
+    atomic_store_explicit(&bystander_done, tr_clock_now(), memory_order_relaxed);
+    (void)task;
+    return trstatus_ok;
+}
+
+static void sync_run(trtaskfn *run, const char *label)
+{
+    trtaskmanconfig config;
+    tr_taskman_defaults(&config, trtaskman_shared);
+    config.nworkers = 4;
+    config.tag = 'bnch';
+
+    trtaskman tm;
+    tr_require(tr_ok(tr_taskman_initialize(&tm, &config)));
+
+    locker *lockers = tr_alloc(SYNC_NLOCKERS * sizeof(locker), 'bnch');
+    trtask *bystanders = tr_alloc(SYNC_NBYSTANDERS * sizeof(trtask), 'bnch');
+
+    trtime start = tr_clock_now();
+
+    for (int i = 0; i < SYNC_NLOCKERS; ++i) {
+        tr_task_initialize(&lockers[i].task, run, NULL);
+        lockers[i].remaining = SYNC_NITERS;
+        tr_taskman_submit(&tm, &lockers[i].task);
+    }
+
+    for (int i = 0; i < SYNC_NBYSTANDERS; ++i) {
+        tr_task_initialize(bystanders + i, &bystander, NULL);
+        tr_taskman_submit(&tm, bystanders + i);
+    }
+
+    tr_taskman_drain(&tm);
+    trtime elapsed = tr_clock_now() - start;
+    trtime bystanders_elapsed = atomic_load(&bystander_done) - start;
+
+    char metric[64];
+    snprintf(metric, sizeof(metric), "%s total", label);
+    BENCH_REPORT(metric, tr_clock_seconds(elapsed) * 1000, "ms");
+    snprintf(metric, sizeof(metric), "%s bystanders", label);
+    BENCH_REPORT(metric, BENCH_RATE(SYNC_NBYSTANDERS, bystanders_elapsed), "tasks/s");
+
+    tr_taskman_cleanup(&tm);
+    tr_free(bystanders);
+    tr_free(lockers);
+}
+
+static void sync_pthread_mutex()
+{
+    sync_run(&pthread_locker, "pthread mutex");
+}
+
+static void sync_task_mutex()
+{
+    for (int fair = 0; fair < 2; ++fair) {
+        tr_mutex_initialize(&bench_tmutex, fair);
+        sync_run(&task_locker, fair ? "fair trmutex" : "unfair trmutex");
+
+        trlockstat stat = tr_mutex_stat(&bench_tmutex);
+        BENCH_REPORT("  contended acquires", (double)stat.ncontended, "");
+        BENCH_REPORT("  mean wait",
+                stat.ncontended ? stat.waittime / 1e3 / stat.ncontended : 0, "us");
+        BENCH_REPORT("  max wait", stat.maxwait / 1e3, "us");
+    }
+}
+
+static const bench_case sync_cases[] =
+{
+    BENCH_CASE(sync_pthread_mutex),
+    BENCH_CASE(sync_task_mutex),
+};
+
+BENCH_SUITE(sync_bench, sync_cases);
@@ -0,0 +1,371 @@
+/////////////////////////////////////////////////////////////////////////////
+//
+// Terrascale
+// Copyright (c) Dave Kilian & Emily Kilian 2023. All rights reserved.
+//
+//////////////////////////////////////////////////////////////////////////////
+
+#include <pch.h>
+#include <bench/bench.h>
+#include <taskman/taskman.h>
+
+#include <time.h>
+
+//
+// Key-value workload: every request reads or updates one key of a table.
+//
+// In shared mode, the table is a single array guarded by striped locks and
+// any worker may serve any request. In sharded mode, each shard owns the
+// keys which hash to it and requests are routed to the owning shard, which
+// touches its partition without locking.
+//
+
+#define KV_NKEYS    (1 << 16)
+#define KV_NOPS     (400 * 1000)
+#define KV_NSTRIPES 64
+#define KV_BATCH    128
+
+typedef struct {
+    trtask task;        // Task which serves this request
+    uint32_t key;       // Key to read or update
+    bool write;         // Whether to update (true) or read (false)
+} kvrequest;
+
+// A worker's sum of the values it read, on its own cache line so workers
+// don't contend for it
+typedef struct {
+    uint64_t sum;
+    char pad[tr_cacheline - sizeof(uint64_t)];
+} kvchecksum;
+
+typedef struct {
+    trtaskman *tm;                      // Task manager serving requests
+    uint64_t *values;                   // Shared mode: the whole table
+    pthread_mutex_t stripes[KV_NSTRIPES]; // Shared mode: key locks
+    uint64_t **partitions;              // Sharded mode: per-shard tables
+    kvrequest *requests;                // All requests in the run
+    kvchecksum *checksums;              // Per-worker sums of values read
+} kvstore;
+
+typedef struct {
+    trtask task;        // The generator task
+    kvstore *kv;        // Store to send requests to
+    int first;          // Index of the next request to submit
+    int end;            // Index after the last request to submit
+} kvclient;
+
+static kvstore *bench_kv;
+
+static int kv_shard(uint32_t key, int nshards)
+{
+    return (int)((key * 2654435761u) >> 16) % nshards;
+}
+
+static trstatus kv_shared_request(trtask *task)
+{
+    kvrequest *req = container_of(task, kvrequest, task);
+    pthread_mutex_t *stripe = bench_kv->stripes + (req->key % KV_NSTRIPES);
+
+    pthread_mutex_lock(stripe);
+    if (req->write) {
+        bench_kv->values[req->key] += 1;
+    } else {
+        bench_kv->checksums[tr_taskman_current(bench_kv->tm)].sum += bench_kv->values[req->key];
+    }
+    pthread_mutex_unlock(stripe);
+
+    return trstatus_ok;
+}
+
+static trstatus kv_sharded_request(trtask *task)
+{
+    kvrequest *req = container_of(task, kvrequest, task);
+    int shard = tr_taskman_current(bench_kv->tm);
+    uint64_t *partition = bench_kv->partitions[shard];
+
+    if (req->write) {
+        partition[req->key] += 1;
+    } else {
+        bench_kv->checksums[shard].sum += partition[req->key];
+    }
+
+    return trstatus_ok;
+}
+
+static trstatus kv_client(trtask *task)
+{
+    kvclient *client = container_of(task, kvclient, task);
+    trtaskman *tm = client->kv->tm;
+    bool sharded = (tm->config.mode == trtaskman_sharded);
+    int nshards = tr_taskman_nworkers(tm);
+
+    int end = min(client->first + KV_BATCH, client->end);
+    for (; client->first < end; ++client->first) {
+        kvrequest *req = client->kv->requests + client->first;
+        if (sharded) {
+            tr_taskman_submit_to(tm, kv_shard(req->key, nshards), &req->task);
+        } else {
+            tr_taskman_submit(tm, &req->task);
+        }
+    }
+
+    return client->first < client->end ? trstatus_later : trstatus_ok;
+}
+
+static void kv_run(trtaskmode mode, int nworkers, const char *label)
+{
+    trtaskmanconfig config;
+    tr_taskman_defaults(&config, mode);
+    config.nworkers = nworkers;
+    config.tag = 'bnch';
+
+    trtaskman tm;
+    tr_require(tr_ok(tr_taskman_initialize(&tm, &config)));
+    nworkers = tr_taskman_nworkers(&tm);
+
+    kvstore *kv = tr_alloc(sizeof(kvstore), 'bnch');
+    kv->tm = &tm;
+    kv->checksums = tr_alloc_aligned(nworkers * sizeof(kvchecksum), tr_cacheline, 'bnch');
+    memset(kv->checksums, 0, nworkers * sizeof(kvchecksum));
+    kv->values = tr_alloc(KV_NKEYS * sizeof(uint64_t), 'bnch');
+    memset(kv->values, 0, KV_NKEYS * sizeof(uint64_t));
+    for (int i = 0; i < KV_NSTRIPES; ++i) {
+        pthread_mutex_init(kv->stripes + i, NULL);
+    }
+
+    kv->partitions = tr_alloc(nworkers * sizeof(uint64_t *), 'bnch');
+    for (int i = 0; i < nworkers; ++i) {
+        kv->partitions[i] = tr_alloc(KV_NKEYS * sizeof(uint64_t), 'bnch');
+        memset(kv->partitions[i], 0, KV_NKEYS * sizeof(uint64_t));
+    }
+
+    trtaskfn *serve = (mode == trtaskman_sharded)
+        ? &kv_sharded_request
+        : &kv_shared_request;
+
+    kv->requests = tr_alloc(KV_NOPS * sizeof(kvrequest), 'bnch');
+    uint32_t rng = 12345;
+    for (int i = 0; i < KV_NOPS; ++i) {
+        rng = rng * 1103515245 + 12345;
+        kvrequest *req = kv->requests + i;
+        tr_task_initialize(&req->task, serve, NULL);
+        req->key = (rng >> 8) % KV_NKEYS;
+        req->write = (rng >> 4) % 10 == 0;
+    }
+
+    bench_kv = kv;
+
+    kvclient *clients = tr_alloc(nworkers * sizeof(kvclient), 'bnch');
+    int per = KV_NOPS / nworkers;
+    for (int i = 0; i < nworkers; ++i) {
+        clients[i].kv = kv;
+        clients[i].first = i * per;
+        clients[i].end = (i == nworkers - 1) ? KV_NOPS : (i + 1) * per;
+        tr_task_initialize(&clients[i].task, &kv_client, NULL);
+    }
+
+    trtime start = tr_clock_now();
+    for (int i = 0; i < nworkers; ++i) {
+        tr_taskman_submit_to(&tm, i, &clients[i].task);
+    }
+    tr_taskman_drain(&tm);
+    trtime elapsed = tr_clock_now() - start;
+
+    char metric[64];
+    snprintf(metric, sizeof(metric), "%s, %d workers", label, nworkers);
+    BENCH_REPORT(metric, BENCH_RATE(KV_NOPS, elapsed), "ops/s");
+
+    // The sums are only read once the workers have drained, and reporting
+    // them keeps the reads from being optimized away
+    uint64_t checksum = 0;
+    for (int i = 0; i < nworkers; ++i) {
+        checksum += kv->checksums[i].sum;
+    }
+    BENCH_REPORT("checksum", (double)checksum, "");
+
+    tr_taskman_cleanup(&tm);
+
+    for (int i = 0; i < nworkers; ++i) {
+        tr_free(kv->partitions[i]);
+    }
+    for (int i = 0; i < KV_NSTRIPES; ++i) {
+        pthread_mutex_destroy(kv->stripes + i);
+    }
+    tr_free(clients);
+    tr_free(kv->requests);
+    tr_free(kv->partitions);
+    tr_free(kv->values);
+    tr_free(kv->checksums);
+    tr_free(kv);
+}
+
+static void taskman_kv_shared()
+{
+    kv_run(trtaskman_shared, 2, "work-stealing");
+    kv_run(trtaskman_shared, 0, "work-stealing");
+}
+
+static void taskman_kv_sharded()
+{
+    kv_run(trtaskman_sharded, 2, "thread-per-core");
+    kv_run(trtaskman_sharded, 0, "thread-per-core");
+}
+
+//
+// Mixed workload: a stream of short point lookups arrives while long scans
+// are running. Without priority classes, lookups queue FIFO behind scans;
+// with them, lookups are critical, scans are background and yield whenever
+// tr_task_should_yield says so.
+//
+
+#define MIX_NSCANS      16
+#define MIX_SCAN_WORK   tr_ms(20)
+#define MIX_SCAN_CHUNK  tr_us(50)
+#define MIX_NLOOKUPS    2000
+#define MIX_LOOKUP_WORK tr_us(5)
+#define MIX_INTERVAL    tr_us(50)
+
+typedef struct {
+    trtask task;        // The scan task
+    trtime remaining;   // Work left to do
+    bool cooperative;   // Whether to yield only when asked to
+} mixscan;
+
+typedef struct {
+    trtask task;        // The lookup task
+    trtime submitted;   // When the lookup was submitted
+    trtime latency;     // Submit-to-completion time
+} mixlookup;
+
+static void mix_spin(trtime duration)
+{
+    trtime end = tr_clock_now() + duration;
+    while (tr_clock_now() < end) {
+    }
+}
+
+static trstatus mix_scan(trtask *task)
+{
+    mixscan *scan = container_of(task, mixscan, task);
+
+    while (scan->remaining > 0) {
+        trtime chunk = min(scan->remaining, MIX_SCAN_CHUNK);
+        mix_spin(chunk);
+        scan->remaining -= chunk;
+
+        if (!scan->cooperative || tr_task_should_yield(task)) {
+            break;
+        }
+    }
+
+    return scan->remaining > 0 ? trstatus_later : trstatus_ok;
+}
+
+static trstatus mix_lookup(trtask *task)
+{
+    mix_spin(MIX_LOOKUP_WORK);
+    (void)task;
+    return trstatus_ok;
+}
+
+static void mix_lookup_done(trtask *task, trstatus status)
+{
+    mixlookup *lookup = container_of(task, mixlookup, task);
+    lookup->latency = tr_clock_now() - lookup->submitted;
+    (void)status;
+}
+
+static int mix_compare(const void *a, const void *b)
+{
+    trtime x = *(const trtime *)a;
+    trtime y = *(const trtime *)b;
+    return (x > y) - (x < y);
+}
+
+static void mix_run(bool classes, const char *label)
+{
+    trtaskmanconfig config;
+    tr_taskman_defaults(&config, trtaskman_shared);
+    config.nworkers = 1;
+    config.tag = 'bnch';
+
+    trtaskman tm;
+    tr_require(tr_ok(tr_taskman_initialize(&tm, &config)));
+
+    mixscan *scans = tr_alloc(MIX_NSCANS * sizeof(mixscan), 'bnch');
+    mixlookup *lookups = tr_alloc(MIX_NLOOKUPS * sizeof(mixlookup), 'bnch');
+
+    for (int i = 0; i < MIX_NSCANS; ++i) {
+        tr_task_initialize(&scans[i].task, &mix_scan, NULL);
+        scans[i].remaining = MIX_SCAN_WORK;
+        scans[i].cooperative = classes;
+        if (classes) {
+            tr_task_set_priority(&scans[i].task, trtask_background, 0);
+        }
+        tr_taskman_submit(&tm, &scans[i].task);
+    }
+
+    for (int i = 0; i < MIX_NLOOKUPS; ++i) {
+        mixlookup *lookup = lookups + i;
+        tr_task_initialize(&lookup->task, &mix_lookup, NULL);
+        lookup->task.done = &mix_lookup_done;
+        if (classes) {
+            tr_task_set_priority(&lookup->task, trtask_critical, 0);
+        }
+
+        struct timespec interval = { .tv_nsec = MIX_INTERVAL };
+        nanosleep(&interval, NULL);
+        lookup->submitted = tr_clock_now();
+        tr_taskman_submit(&tm, &lookup->task);
+    }
+
+    tr_taskman_drain(&tm);
+
+    trtime *latencies = tr_alloc(MIX_NLOOKUPS * sizeof(trtime), 'bnch');
+    for (int i = 0; i < MIX_NLOOKUPS; ++i) {
+        latencies[i] = lookups[i].latency;
+    }
+    qsort(latencies, MIX_NLOOKUPS, sizeof(trtime), &mix_compare);
+
+    char metric[64];
+    snprintf(metric, sizeof(metric), "%s lookup p50", label);
+    BENCH_REPORT(metric, latencies[MIX_NLOOKUPS / 2] / 1e3, "us");
+    snprintf(metric, sizeof(metric), "%s lookup p99", label);
+    BENCH_REPORT(metric, latencies[MIX_NLOOKUPS * 99 / 100] / 1e3, "us");
+
+    for (int c = 0; c < tr_taskclasses; ++c) {
+        trtaskclassstat stat = tr_taskman_classstat(&tm, c);
+        if (stat.nrun == 0) {
+            continue;
+        }
+
+        static const char *names[] = { "critical", "normal", "background" };
+        snprintf(metric, sizeof(metric), "  %s mean queue wait", names[c]);
+        BENCH_REPORT(metric, stat.waittime / 1e3 / stat.nrun, "us");
+    }
+
+    tr_taskman_cleanup(&tm);
+    tr_free(latencies);
+    tr_free(lookups);
+    tr_free(scans);
+}
+
+static void taskman_mixed_fifo()
+{
+    mix_run(false, "single class");
+}
+
+static void taskman_mixed_priority()
+{
+    mix_run(true, "priority classes");
+}
+
+static const bench_case taskman_cases[] =
+{
+    BENCH_CASE(taskman_kv_shared),
+    BENCH_CASE(taskman_kv_sharded),
+    BENCH_CASE(taskman_mixed_fifo),
+    BENCH_CASE(taskman_mixed_priority),
+};
+
+BENCH_SUITE(taskman_bench, taskman_cases);
@@ -0,0 +1,149 @@
+/////////////////////////////////////////////////////////////////////////////
+//
+// Terrascale
+// Copyright (c) Dave Kilian & Emily Kilian 2023. All rights reserved.
+//
+//////////////////////////////////////////////////////////////////////////////
+
+#include <pch.h>
+#include <bench/bench.h>
+#include <store/wal.h>
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+//
+// Commit workload: each committer task repeatedly appends a small record
+// and parks until it's durable. With group commit, throughput should grow
+// with the number of committers, since they share each sync.
+//
+
+#define WAL_RECORD   128
+#define WAL_DURATION tr_sec(1)
+
+typedef struct {
+    trtask task;            // The committer task
+    trwal *wal;             // Log to commit to
+    trwalwaiter waiter;     // Waiter for the current commit
+    trlsn end;              // LSN the current commit waits for
+    trtime stop;            // When to stop committing
+    uint64_t ncommits;      // Commits completed
+    bool waiting;           // Whether a commit is in flight
+} walcommitter;
+
+static trstatus wal_commit_task(trtask *task)
+{
+    walcommitter *c = container_of(task, walcommitter, task);
+    char record[WAL_RECORD] = {0};
+
+    for (;;) {
+        if (!c->waiting) {
+            if (tr_clock_now() >= c->stop) {
+                return trstatus_ok;
+            }
+
+            trstatus s = tr_wal_append(c->wal, record, sizeof(record), &c->end);
+            if (tr_failed(s)) {
+                return s;
+            }
+            c->waiting = true;
+        }
+
+        if (tr_wal_wait(c->wal, &c->waiter, c->end, task) == trstatus_pending) {
+            return trstatus_pending;
+        }
+
+        c->waiting = false;
+        c->ncommits += 1;
+    }
+}
+
+static void wal_remove_dir(const char *path)
+{
+    DIR *dir = opendir(path);
+    if (dir == NULL) {
+        return;
+    }
+
+    struct dirent *entry;
+    while ((entry = readdir(dir)) != NULL) {
+        if (entry->d_name[0] != '.') {
+            unlinkat(dirfd(dir), entry->d_name, 0);
+        }
+    }
+
+    closedir(dir);
+    rmdir(path);
+}
+
+static void wal_run(int ncommitters)
+{
+    char dir[64];
+    snprintf(dir, sizeof(dir), "/tmp/trbench-wal-%d", (int)getpid());
+    wal_remove_dir(dir);
+
+    trwalconfig config;
+    tr_wal_defaults(&config, dir);
+    config.segsize = 4 << 20;
+    config.tag = 'bnch';
+
+    trwal wal;
+    tr_wal_open(&wal, &config, NULL, NULL);
+
+    trtaskmanconfig tmconfig;
+    tr_taskman_defaults(&tmconfig, trtaskman_shared);
+    tmconfig.pin = false;
+    tmconfig.tag = 'bnch';
+
+    trtaskman tm;
+    tr_taskman_initialize(&tm, &tmconfig);
+
+    walcommitter *committers = tr_alloc(ncommitters * sizeof(walcommitter), 'bnch');
+    trtime start = tr_clock_now();
+    for (int i = 0; i < ncommitters; ++i) {
+        walcommitter *c = committers + i;
+        c->wal = &wal;
+        c->stop = start + WAL_DURATION;
+        c->ncommits = 0;
+        c->waiting = false;
+        tr_task_initialize(&c->task, &wal_commit_task, c);
+        tr_taskman_submit(&tm, &c->task);
+    }
+
+    tr_taskman_drain(&tm);
+    trtime elapsed = tr_clock_now() - start;
+
+    uint64_t ncommits = 0;
+    for (int i = 0; i < ncommitters; ++i) {
+        ncommits += committers[i].ncommits;
+    }
+
+    trwalstat stat = tr_wal_stat(&wal);
+
+    char metric[64];
+    snprintf(metric, sizeof(metric), "%d committers", ncommitters);
+    BENCH_REPORT(metric, BENCH_RATE(ncommits, elapsed), "commits/s");
+    BENCH_REPORT("  commits per sync",
+            stat.nflushes ? (double)stat.nrecords / stat.nflushes : 0, "");
+
+    tr_taskman_cleanup(&tm);
+    tr_wal_close(&wal);
+    tr_free(committers);
+    wal_remove_dir(dir);
+}
+
+static void wal_group_commit()
+{
+    int counts[] = { 1, 4, 16, 64, 256 };
+    for (int i = 0; i < arraysize(counts); ++i) {
+        wal_run(counts[i]);
+    }
+}
+
+static const bench_case wal_cases[] =
+{
+    BENCH_CASE(wal_group_commit),
+};
+
+BENCH_SUITE(wal_bench, wal_cases);
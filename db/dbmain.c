@@ -1,6 +1,80 @@
 #include "pch.h"
 
-int main(int /* argc */, const char * /* argv */[])
+#include <store/wal.h>
+#include <taskman/taskman.h>
+
+static void usage(const char *argv0)
+{
+    fprintf(stderr, "usage: %s [-m shared|sharded] [-w workers] [-l logdir]\n", argv0);
+}
+
+static trstatus count_record(void *context, trlsn lsn, const void *data, unsigned length)
 {
+    *(uint64_t *)context += 1;
+    (void)lsn; (void)data; (void)length;
+    return trstatus_ok;
+}
+
+int main(int argc, const char *argv[])
+{
+    trtaskmode mode = trtaskman_shared;
+    int nworkers = 0;
+    const char *logdir = NULL;
+
+    for (int i = 1; i < argc; ++i) {
+        if (0 == strcmp(argv[i], "-m") && i + 1 < argc) {
+            const char *arg = argv[++i];
+            if (0 == strcmp(arg, "shared")) {
+                mode = trtaskman_shared;
+            } else if (0 == strcmp(arg, "sharded")) {
+                mode = trtaskman_sharded;
+            } else {
+                usage(argv[0]);
+                return 1;
+            }
+        } else if (0 == strcmp(argv[i], "-w") && i + 1 < argc) {
+            nworkers = atoi(argv[++i]);
+        } else if (0 == strcmp(argv[i], "-l") && i + 1 < argc) {
+            logdir = argv[++i];
+        } else {
+            usage(argv[0]);
+            return 1;
+        }
+    }
+
+    trtaskmanconfig config;
+    tr_taskman_defaults(&config, mode);
+    config.nworkers = nworkers;
+
+    trtaskman tm;
+    trstatus s = tr_taskman_initialize(&tm, &config);
+    if (tr_failed(s)) {
+        tr_log("failed to start task manager: 0x%08x", s);
+        return 1;
+    }
+
+    trwal wal;
+    if (logdir != NULL) {
+        trwalconfig walconfig;
+        tr_wal_defaults(&walconfig, logdir);
+
+        uint64_t nrecords = 0;
+        s = tr_wal_open(&wal, &walconfig, &count_record, &nrecords);
+        if (tr_failed(s)) {
+            tr_log("failed to open log in %s: 0x%08x", logdir, s);
+            tr_taskman_cleanup(&tm);
+            return 1;
+        }
+
+        tr_log("replayed %llu log records", (unsigned long long)nrecords);
+    }
+
+    tr_taskman_drain(&tm);
+
+    if (logdir != NULL) {
+        tr_wal_close(&wal);
+    }
+
+    tr_taskman_cleanup(&tm);
     return 0;
 }
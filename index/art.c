@@ -0,0 +1,880 @@
+//////////////////////////////////////////////////////////////////////////////
+//
+// Terrascale
+// Copyright (c) Dave Kilian & Emily Kilian 2023. All rights reserved.
+//
+//////////////////////////////////////////////////////////////////////////////
+
+#include <pch.h>
+#include <index/art.h>
+#include <store/kv.h>
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+#endif
+
+static const unsigned tr_art_sizes[] = {
+    sizeof(trartnode4), sizeof(trartnode16), sizeof(trartnode48), sizeof(trartnode256),
+};
+
+//
+// Leaves
+//
+
+static inline bool tr_art_isleaf(const trartnode *node)
+{
+    return (uintptr_t)node & 1;
+}
+
+static inline trartleaf *tr_art_leaf(const trartnode *node)
+{
+    return (trartleaf *)((uintptr_t)node & ~(uintptr_t)1);
+}
+
+static inline trartnode *tr_art_tag(trartleaf *leaf)
+{
+    return (trartnode *)((uintptr_t)leaf | 1);
+}
+
+static inline bool tr_art_matches(const trartleaf *leaf, const uint8_t *key, unsigned keylen)
+{
+    return leaf->keylen == keylen && memcmp(leaf->key, key, keylen) == 0;
+}
+
+static trartleaf *tr_art_new_leaf(trart *tree, const uint8_t *key, unsigned keylen, uint64_t value)
+{
+    trartleaf *leaf = tr_alloc(sizeof(trartleaf) + keylen, tree->tag);
+    if (leaf == NULL) {
+        return NULL;
+    }
+
+    leaf->value = value;
+    leaf->keylen = keylen;
+    memcpy(leaf->key, key, keylen);
+    tree->bytes += sizeof(trartleaf) + keylen;
+    return leaf;
+}
+
+static void tr_art_free_leaf(trart *tree, trartleaf *leaf)
+{
+    tree->bytes -= sizeof(trartleaf) + leaf->keylen;
+    tr_free(leaf);
+}
+
+//
+// Inner nodes
+//
+
+static trartnode *tr_art_new_node(trart *tree, trartnodetype type)
+{
+    trartnode *node = tr_alloc(tr_art_sizes[type], tree->tag);
+    if (node == NULL) {
+        return NULL;
+    }
+
+    memset(node, 0, tr_art_sizes[type]);
+    node->type = type;
+    tree->nnodes[type]++;
+    tree->bytes += tr_art_sizes[type];
+    return node;
+}
+
+static void tr_art_free_node(trart *tree, trartnode *node)
+{
+    tree->nnodes[node->type]--;
+    tree->bytes -= tr_art_sizes[node->type];
+    tr_free(node);
+}
+
+// Copies the header of a node being replaced by one of another size
+static void tr_art_copy_header(trartnode *to, const trartnode *from)
+{
+    to->count = from->count;
+    to->prefixlen = from->prefixlen;
+    memcpy(to->prefix, from->prefix, tr_art_maxprefix);
+    to->leaf = from->leaf;
+}
+
+// Finds the child for a key byte, returning the pointer to it, or NULL
+static trartnode **tr_art_find(const trartnode *node, uint8_t byte)
+{
+    switch (node->type) {
+    case trart_node4: {
+        trartnode4 *n = (trartnode4 *)node;
+        for (unsigned i = 0; i < node->count; ++i) {
+            if (n->keys[i] == byte) {
+                return n->children + i;
+            }
+        }
+        return NULL;
+    }
+
+    case trart_node16: {
+        trartnode16 *n = (trartnode16 *)node;
+#if defined(__x86_64__)
+        // SSE2 is always there on x86-64; one compare covers every key
+        __m128i keys = _mm_loadu_si128((const __m128i *)n->keys);
+        unsigned mask = _mm_movemask_epi8(_mm_cmpeq_epi8(keys, _mm_set1_epi8((char)byte)));
+        mask &= (1u << node->count) - 1;
+        return mask != 0 ? n->children + __builtin_ctz(mask) : NULL;
+#else
+        for (unsigned i = 0; i < node->count; ++i) {
+            if (n->keys[i] == byte) {
+                return n->children + i;
+            }
+        }
+        return NULL;
+#endif
+    }
+
+    case trart_node48: {
+        trartnode48 *n = (trartnode48 *)node;
+        return n->index[byte] != 0 ? n->children + n->index[byte] - 1 : NULL;
+    }
+
+    default: {
+        trartnode256 *n = (trartnode256 *)node;
+        return n->children[byte] != NULL ? n->children + byte : NULL;
+    }
+    }
+}
+
+// Inserts a child into sorted key and child arrays with room for it
+static void tr_art_insert_sorted(uint8_t *keys, trartnode **children, unsigned count,
+        uint8_t byte, trartnode *child)
+{
+    unsigned i = 0;
+    while (i < count && keys[i] < byte) {
+        i++;
+    }
+    memmove(keys + i + 1, keys + i, count - i);
+    memmove(children + i + 1, children + i, (count - i) * sizeof(trartnode *));
+    keys[i] = byte;
+    children[i] = child;
+}
+
+// Adds a child for a key byte the node has no child for, growing the node
+// if it's full. `ref` points to the node.
+//
+static trstatus tr_art_add_child(trart *tree, trartnode **ref, uint8_t byte, trartnode *child)
+{
+    trartnode *node = *ref;
+    switch (node->type) {
+    case trart_node4: {
+        trartnode4 *n = (trartnode4 *)node;
+        if (node->count < 4) {
+            tr_art_insert_sorted(n->keys, n->children, node->count++, byte, child);
+            return trstatus_ok;
+        }
+
+        trartnode16 *grown = (trartnode16 *)tr_art_new_node(tree, trart_node16);
+        if (grown == NULL) {
+            return trstatus_no_mem;
+        }
+        tr_art_copy_header(&grown->node, node);
+        memcpy(grown->keys, n->keys, 4);
+        memcpy(grown->children, n->children, 4 * sizeof(trartnode *));
+        tr_art_free_node(tree, node);
+        *ref = &grown->node;
+        return tr_art_add_child(tree, ref, byte, child);
+    }
+
+    case trart_node16: {
+        trartnode16 *n = (trartnode16 *)node;
+        if (node->count < 16) {
+            tr_art_insert_sorted(n->keys, n->children, node->count++, byte, child);
+            return trstatus_ok;
+        }
+
+        trartnode48 *grown = (trartnode48 *)tr_art_new_node(tree, trart_node48);
+        if (grown == NULL) {
+            return trstatus_no_mem;
+        }
+        tr_art_copy_header(&grown->node, node);
+        for (unsigned i = 0; i < 16; ++i) {
+            grown->index[n->keys[i]] = i + 1;
+            grown->children[i] = n->children[i];
+        }
+        tr_art_free_node(tree, node);
+        *ref = &grown->node;
+        return tr_art_add_child(tree, ref, byte, child);
+    }
+
+    case trart_node48: {
+        trartnode48 *n = (trartnode48 *)node;
+        if (node->count < 48) {
+            unsigned slot = 0;
+            while (n->children[slot] != NULL) {
+                slot++;
+            }
+            n->children[slot] = child;
+            n->index[byte] = slot + 1;
+            node->count++;
+            return trstatus_ok;
+        }
+
+        trartnode256 *grown = (trartnode256 *)tr_art_new_node(tree, trart_node256);
+        if (grown == NULL) {
+            return trstatus_no_mem;
+        }
+        tr_art_copy_header(&grown->node, node);
+        for (unsigned b = 0; b < 256; ++b) {
+            if (n->index[b] != 0) {
+                grown->children[b] = n->children[n->index[b] - 1];
+            }
+        }
+        tr_art_free_node(tree, node);
+        *ref = &grown->node;
+        return tr_art_add_child(tree, ref, byte, child);
+    }
+
+    default: {
+        trartnode256 *n = (trartnode256 *)node;
+        n->children[byte] = child;
+        node->count++;
+        return trstatus_ok;
+    }
+    }
+}
+
+// Gets the smallest leaf under a node: its own leaf if it has one, which
+// is shorter than every other key under it
+//
+static const trartleaf *tr_art_minimum(const trartnode *node)
+{
+    while (!tr_art_isleaf(node)) {
+        if (node->leaf != NULL) {
+            return node->leaf;
+        }
+
+        switch (node->type) {
+        case trart_node4:
+            node = ((const trartnode4 *)node)->children[0];
+            break;
+        case trart_node16:
+            node = ((const trartnode16 *)node)->children[0];
+            break;
+        case trart_node48: {
+            const trartnode48 *n = (const trartnode48 *)node;
+            unsigned b = 0;
+            while (n->index[b] == 0) {
+                b++;
+            }
+            node = n->children[n->index[b] - 1];
+            break;
+        }
+        default: {
+            const trartnode256 *n = (const trartnode256 *)node;
+            unsigned b = 0;
+            while (n->children[b] == NULL) {
+                b++;
+            }
+            node = n->children[b];
+            break;
+        }
+        }
+    }
+
+    return tr_art_leaf(node);
+}
+
+// Gets a node's whole prefix, which starts at `depth` in its keys. Only the
+// first tr_art_maxprefix bytes are kept in the node; the rest are read from
+// a key under it.
+//
+static inline const uint8_t *tr_art_prefix(const trartnode *node, unsigned depth)
+{
+    return node->prefixlen <= tr_art_maxprefix ? node->prefix : tr_art_minimum(node)->key + depth;
+}
+
+// Gets how many bytes of a node's prefix match the key from `depth`
+static unsigned tr_art_match_prefix(const trartnode *node, const uint8_t *key, unsigned keylen, unsigned depth)
+{
+    const uint8_t *prefix = tr_art_prefix(node, depth);
+    unsigned limit = min(node->prefixlen, keylen - depth);
+    unsigned i = 0;
+    while (i < limit && prefix[i] == key[depth + i]) {
+        i++;
+    }
+    return i;
+}
+
+static void tr_art_free_subtree(trart *tree, trartnode *node)
+{
+    if (tr_art_isleaf(node)) {
+        tr_art_free_leaf(tree, tr_art_leaf(node));
+        return;
+    }
+
+    if (node->leaf != NULL) {
+        tr_art_free_leaf(tree, node->leaf);
+    }
+
+    switch (node->type) {
+    case trart_node4:
+        for (unsigned i = 0; i < node->count; ++i) {
+            tr_art_free_subtree(tree, ((trartnode4 *)node)->children[i]);
+        }
+        break;
+    case trart_node16:
+        for (unsigned i = 0; i < node->count; ++i) {
+            tr_art_free_subtree(tree, ((trartnode16 *)node)->children[i]);
+        }
+        break;
+    case trart_node48:
+        for (unsigned i = 0; i < 48; ++i) {
+            if (((trartnode48 *)node)->children[i] != NULL) {
+                tr_art_free_subtree(tree, ((trartnode48 *)node)->children[i]);
+            }
+        }
+        break;
+    default:
+        for (unsigned b = 0; b < 256; ++b) {
+            if (((trartnode256 *)node)->children[b] != NULL) {
+                tr_art_free_subtree(tree, ((trartnode256 *)node)->children[b]);
+            }
+        }
+        break;
+    }
+
+    tr_art_free_node(tree, node);
+}
+
+void tr_art_initialize(trart *tree, tralloctag tag)
+{
+    memset(tree, 0, sizeof(*tree));
+    tree->tag = tag;
+}
+
+void tr_art_cleanup(trart *tree)
+{
+    if (tree->root != NULL) {
+        tr_art_free_subtree(tree, tree->root);
+    }
+}
+
+//
+// Lookups
+//
+
+trstatus tr_art_get(const trart *tree, const void *key, unsigned keylen, uint64_t *value)
+{
+    const uint8_t *bytes = key;
+    const trartnode *node = tree->root;
+    unsigned depth = 0;
+
+    while (node != NULL) {
+        if (tr_art_isleaf(node)) {
+            const trartleaf *leaf = tr_art_leaf(node);
+            if (!tr_art_matches(leaf, bytes, keylen)) {
+                return trstatus_not_found;
+            }
+            *value = leaf->value;
+            return trstatus_ok;
+        }
+
+        // Check the prefix bytes the node keeps, and skip the rest
+        if (node->prefixlen > 0) {
+            unsigned limit = min(min(node->prefixlen, (uint32_t)tr_art_maxprefix), keylen - min(depth, keylen));
+            if (memcmp(node->prefix, bytes + depth, limit) != 0) {
+                return trstatus_not_found;
+            }
+            depth += node->prefixlen;
+            if (depth > keylen) {
+                return trstatus_not_found;
+            }
+        }
+
+        if (depth == keylen) {
+            if (node->leaf == NULL || !tr_art_matches(node->leaf, bytes, keylen)) {
+                return trstatus_not_found;
+            }
+            *value = node->leaf->value;
+            return trstatus_ok;
+        }
+
+        trartnode **child = tr_art_find(node, bytes[depth]);
+        node = child != NULL ? *child : NULL;
+        depth++;
+    }
+
+    return trstatus_not_found;
+}
+
+//
+// Inserts
+//
+
+// Puts a leaf whose key continues past `depth` under a new node, or makes
+// it the node's own leaf if it ends there. The node has room.
+//
+static void tr_art_place(trart *tree, trartnode **ref, trartleaf *leaf, unsigned depth)
+{
+    if (leaf->keylen == depth) {
+        (*ref)->leaf = leaf;
+    } else {
+        tr_art_add_child(tree, ref, leaf->key[depth], tr_art_tag(leaf));
+    }
+}
+
+trstatus tr_art_put(trart *tree, const void *key, unsigned keylen, uint64_t value)
+{
+    if (keylen > tr_art_maxkey) {
+        return trstatus_too_large;
+    }
+
+    const uint8_t *bytes = key;
+    trartnode **ref = &tree->root;
+    unsigned depth = 0;
+
+    for (;;) {
+        trartnode *node = *ref;
+
+        if (node == NULL) {
+            trartleaf *leaf = tr_art_new_leaf(tree, bytes, keylen, value);
+            if (leaf == NULL) {
+                return trstatus_no_mem;
+            }
+            *ref = tr_art_tag(leaf);
+            tree->nentries++;
+            return trstatus_ok;
+        }
+
+        // Another key's leaf: replace its value, or put both under a new
+        // node at the point where they differ
+        if (tr_art_isleaf(node)) {
+            trartleaf *other = tr_art_leaf(node);
+            if (tr_art_matches(other, bytes, keylen)) {
+                other->value = value;
+                return trstatus_ok;
+            }
+
+            unsigned limit = min(other->keylen, keylen);
+            unsigned common = depth;
+            while (common < limit && other->key[common] == bytes[common]) {
+                common++;
+            }
+
+            trartleaf *leaf = tr_art_new_leaf(tree, bytes, keylen, value);
+            trartnode *split = leaf != NULL ? tr_art_new_node(tree, trart_node4) : NULL;
+            if (split == NULL) {
+                if (leaf != NULL) {
+                    tr_art_free_leaf(tree, leaf);
+                }
+                return trstatus_no_mem;
+            }
+
+            split->prefixlen = common - depth;
+            memcpy(split->prefix, bytes + depth, min(split->prefixlen, (uint32_t)tr_art_maxprefix));
+            *ref = split;
+            tr_art_place(tree, ref, other, common);
+            tr_art_place(tree, ref, leaf, common);
+            tree->nentries++;
+            return trstatus_ok;
+        }
+
+        // A key leaving the node's prefix part way gets a new node above
+        // it, at the point where they differ
+        if (node->prefixlen > 0) {
+            unsigned matched = tr_art_match_prefix(node, bytes, keylen, depth);
+            if (matched < node->prefixlen) {
+                trartleaf *leaf = tr_art_new_leaf(tree, bytes, keylen, value);
+                trartnode *split = leaf != NULL ? tr_art_new_node(tree, trart_node4) : NULL;
+                if (split == NULL) {
+                    if (leaf != NULL) {
+                        tr_art_free_leaf(tree, leaf);
+                    }
+                    return trstatus_no_mem;
+                }
+
+                const uint8_t *prefix = tr_art_prefix(node, depth);
+                split->prefixlen = matched;
+                memcpy(split->prefix, prefix, min(matched, (unsigned)tr_art_maxprefix));
+
+                // The node keeps what follows the byte where they differ
+                uint8_t byte = prefix[matched];
+                node->prefixlen -= matched + 1;
+                memmove(node->prefix, prefix + matched + 1, min(node->prefixlen, (uint32_t)tr_art_maxprefix));
+
+                *ref = split;
+                tr_art_add_child(tree, ref, byte, node);
+                tr_art_place(tree, ref, leaf, depth + matched);
+                tree->nentries++;
+                return trstatus_ok;
+            }
+            depth += node->prefixlen;
+        }
+
+        // A key ending at the node is its own leaf
+        if (depth == keylen) {
+            if (node->leaf != NULL) {
+                node->leaf->value = value;
+                return trstatus_ok;
+            }
+            node->leaf = tr_art_new_leaf(tree, bytes, keylen, value);
+            if (node->leaf == NULL) {
+                return trstatus_no_mem;
+            }
+            tree->nentries++;
+            return trstatus_ok;
+        }
+
+        trartnode **child = tr_art_find(node, bytes[depth]);
+        if (child != NULL) {
+            ref = child;
+            depth++;
+            continue;
+        }
+
+        trartleaf *leaf = tr_art_new_leaf(tree, bytes, keylen, value);
+        if (leaf == NULL) {
+            return trstatus_no_mem;
+        }
+        trstatus s = tr_art_add_child(tree, ref, bytes[depth], tr_art_tag(leaf));
+        if (tr_failed(s)) {
+            tr_art_free_leaf(tree, leaf);
+            return s;
+        }
+        tree->nentries++;
+        return trstatus_ok;
+    }
+}
+
+//
+// Deletes
+//
+
+// Removes the child for a key byte, and shrinks the node if it's become
+// sparse enough for a smaller size. The thresholds are below the smaller
+// size's capacity, so a node at the boundary doesn't flip back and forth.
+// Shrinking copies into a new node, which can fail; the node is then left
+// as it is, which is still correct.
+//
+static void tr_art_remove_child(trart *tree, trartnode **ref, uint8_t byte)
+{
+    trartnode *node = *ref;
+    switch (node->type) {
+    case trart_node4:
+    case trart_node16: {
+        uint8_t *keys = node->type == trart_node4 ? ((trartnode4 *)node)->keys : ((trartnode16 *)node)->keys;
+        trartnode **children = node->type == trart_node4 ?
+            ((trartnode4 *)node)->children : ((trartnode16 *)node)->children;
+        unsigned i = 0;
+        while (keys[i] != byte) {
+            i++;
+        }
+        memmove(keys + i, keys + i + 1, node->count - i - 1);
+        memmove(children + i, children + i + 1, (node->count - i - 1) * sizeof(trartnode *));
+        node->count--;
+
+        if (node->type == trart_node16 && node->count == 3) {
+            trartnode4 *shrunk = (trartnode4 *)tr_art_new_node(tree, trart_node4);
+            if (shrunk != NULL) {
+                tr_art_copy_header(&shrunk->node, node);
+                memcpy(shrunk->keys, keys, 3);
+                memcpy(shrunk->children, children, 3 * sizeof(trartnode *));
+                tr_art_free_node(tree, node);
+                *ref = &shrunk->node;
+            }
+        }
+        break;
+    }
+
+    case trart_node48: {
+        trartnode48 *n = (trartnode48 *)node;
+        n->children[n->index[byte] - 1] = NULL;
+        n->index[byte] = 0;
+        node->count--;
+
+        if (node->count == 12) {
+            trartnode16 *shrunk = (trartnode16 *)tr_art_new_node(tree, trart_node16);
+            if (shrunk != NULL) {
+                tr_art_copy_header(&shrunk->node, node);
+                unsigned j = 0;
+                for (unsigned b = 0; b < 256; ++b) {
+                    if (n->index[b] != 0) {
+                        shrunk->keys[j] = b;
+                        shrunk->children[j++] = n->children[n->index[b] - 1];
+                    }
+                }
+                tr_art_free_node(tree, node);
+                *ref = &shrunk->node;
+            }
+        }
+        break;
+    }
+
+    default: {
+        trartnode256 *n = (trartnode256 *)node;
+        n->children[byte] = NULL;
+        node->count--;
+
+        if (node->count == 37) {
+            trartnode48 *shrunk = (trartnode48 *)tr_art_new_node(tree, trart_node48);
+            if (shrunk != NULL) {
+                tr_art_copy_header(&shrunk->node, node);
+                unsigned j = 0;
+                for (unsigned b = 0; b < 256; ++b) {
+                    if (n->children[b] != NULL) {
+                        shrunk->children[j] = n->children[b];
+                        shrunk->index[b] = ++j;
+                    }
+                }
+                tr_art_free_node(tree, node);
+                *ref = &shrunk->node;
+            }
+        }
+        break;
+    }
+    }
+}
+
+// Gets the only child of a node with a count of one, and its key byte
+//
+static trartnode *tr_art_only_child(const trartnode *node, uint8_t *byte)
+{
+    switch (node->type) {
+    case trart_node4:
+        *byte = ((const trartnode4 *)node)->keys[0];
+        return ((const trartnode4 *)node)->children[0];
+    case trart_node16:
+        *byte = ((const trartnode16 *)node)->keys[0];
+        return ((const trartnode16 *)node)->children[0];
+    case trart_node48: {
+        const trartnode48 *n = (const trartnode48 *)node;
+        unsigned b = 0;
+        while (n->index[b] == 0) {
+            b++;
+        }
+        *byte = b;
+        return n->children[n->index[b] - 1];
+    }
+    default: {
+        const trartnode256 *n = (const trartnode256 *)node;
+        unsigned b = 0;
+        while (n->children[b] == NULL) {
+            b++;
+        }
+        *byte = b;
+        return n->children[b];
+    }
+    }
+}
+
+// Folds away a node which no longer branches: one with only its own leaf
+// becomes that leaf, and one with a single child and no leaf is merged
+// into the child, whose prefix grows by the node's prefix and the child's
+// key byte. Larger nodes only get this sparse if shrinking them failed,
+// but are merged all the same: a node without a leaf then never drops to
+// no children, which would leave nothing to put in its parent's slot.
+//
+static void tr_art_collapse(trart *tree, trartnode **ref)
+{
+    trartnode *node = *ref;
+    if (node->count == 0) {
+        tr_assert(node->leaf != NULL);
+        *ref = tr_art_tag(node->leaf);
+        tr_art_free_node(tree, node);
+        return;
+    }
+
+    if (node->count > 1 || node->leaf != NULL) {
+        return;
+    }
+
+    uint8_t byte;
+    trartnode *child = tr_art_only_child(node, &byte);
+    if (!tr_art_isleaf(child)) {
+        uint8_t prefix[tr_art_maxprefix];
+        unsigned len = min(node->prefixlen, (uint32_t)tr_art_maxprefix);
+        memcpy(prefix, node->prefix, len);
+        if (len < tr_art_maxprefix) {
+            prefix[len++] = byte;
+        }
+        unsigned rest = min(child->prefixlen, (uint32_t)(tr_art_maxprefix - len));
+        memcpy(prefix + len, child->prefix, rest);
+
+        child->prefixlen += node->prefixlen + 1;
+        memcpy(child->prefix, prefix, len + rest);
+    }
+
+    *ref = child;
+    tr_art_free_node(tree, node);
+}
+
+trstatus tr_art_delete(trart *tree, const void *key, unsigned keylen)
+{
+    const uint8_t *bytes = key;
+    trartnode **ref = &tree->root;
+    unsigned depth = 0;
+
+    for (;;) {
+        trartnode *node = *ref;
+        if (node == NULL) {
+            return trstatus_not_found;
+        }
+
+        // Only a root can be a leaf here; leaves deeper down are removed
+        // from their parent below
+        if (tr_art_isleaf(node)) {
+            if (!tr_art_matches(tr_art_leaf(node), bytes, keylen)) {
+                return trstatus_not_found;
+            }
+            tr_art_free_leaf(tree, tr_art_leaf(node));
+            *ref = NULL;
+            tree->nentries--;
+            return trstatus_ok;
+        }
+
+        if (node->prefixlen > 0) {
+            unsigned limit = min(min(node->prefixlen, (uint32_t)tr_art_maxprefix), keylen - min(depth, keylen));
+            if (memcmp(node->prefix, bytes + depth, limit) != 0) {
+                return trstatus_not_found;
+            }
+            depth += node->prefixlen;
+            if (depth > keylen) {
+                return trstatus_not_found;
+            }
+        }
+
+        if (depth == keylen) {
+            if (node->leaf == NULL || !tr_art_matches(node->leaf, bytes, keylen)) {
+                return trstatus_not_found;
+            }
+            tr_art_free_leaf(tree, node->leaf);
+            node->leaf = NULL;
+            tr_art_collapse(tree, ref);
+            tree->nentries--;
+            return trstatus_ok;
+        }
+
+        trartnode **child = tr_art_find(node, bytes[depth]);
+        if (child == NULL) {
+            return trstatus_not_found;
+        }
+
+        if (tr_art_isleaf(*child)) {
+            trartleaf *leaf = tr_art_leaf(*child);
+            if (!tr_art_matches(leaf, bytes, keylen)) {
+                return trstatus_not_found;
+            }
+            tr_art_free_leaf(tree, leaf);
+            tr_art_remove_child(tree, ref, bytes[depth]);
+            tr_art_collapse(tree, ref);
+            tree->nentries--;
+            return trstatus_ok;
+        }
+
+        ref = child;
+        depth++;
+    }
+}
+
+//
+// Scans
+//
+
+// Scans a subtree, every entry of it if `from` is NULL, else those at or
+// after `from`, whose first `depth` bytes lead to the subtree. Returns
+// false once `fn` does.
+//
+static bool tr_art_scan_node(const trartnode *node, unsigned depth, const uint8_t *from, unsigned fromlen,
+        trartscanfn *fn, void *context)
+{
+    if (tr_art_isleaf(node)) {
+        const trartleaf *leaf = tr_art_leaf(node);
+        if (from != NULL && tr_kv_compare(leaf->key, leaf->keylen, from, fromlen) < 0) {
+            return true;
+        }
+        return fn(leaf->key, leaf->keylen, leaf->value, context);
+    }
+
+    // Compare the prefix with the rest of `from`: the whole subtree is
+    // either before it, after it, or still needs checking further down
+    if (from != NULL && node->prefixlen > 0) {
+        const uint8_t *prefix = tr_art_prefix(node, depth);
+        unsigned limit = min(node->prefixlen, fromlen - depth);
+        int cmp = memcmp(prefix, from + depth, limit);
+        if (cmp < 0) {
+            return true;
+        }
+        if (cmp > 0 || limit < node->prefixlen) {
+            from = NULL;
+        }
+    }
+    depth += node->prefixlen;
+    if (from != NULL && depth == fromlen) {
+        from = NULL;
+    }
+
+    // The node's own leaf is a prefix of every other key under it, so
+    // comes first, unless it's shorter than `from` and so before it
+    if (node->leaf != NULL && from == NULL) {
+        if (!fn(node->leaf->key, node->leaf->keylen, node->leaf->value, context)) {
+            return false;
+        }
+    }
+
+    // Children before `from`'s next byte are skipped, and those after it
+    // are scanned whole
+    int next = from != NULL ? from[depth] : -1;
+    switch (node->type) {
+    case trart_node4:
+    case trart_node16: {
+        const uint8_t *keys = node->type == trart_node4 ?
+            ((const trartnode4 *)node)->keys : ((const trartnode16 *)node)->keys;
+        trartnode *const *children = node->type == trart_node4 ?
+            ((const trartnode4 *)node)->children : ((const trartnode16 *)node)->children;
+        for (unsigned i = 0; i < node->count; ++i) {
+            if (keys[i] < next) {
+                continue;
+            }
+            if (!tr_art_scan_node(children[i], depth + 1, keys[i] == next ? from : NULL, fromlen, fn, context)) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    case trart_node48: {
+        const trartnode48 *n = (const trartnode48 *)node;
+        for (int b = max(next, 0); b < 256; ++b) {
+            if (n->index[b] != 0 &&
+                !tr_art_scan_node(n->children[n->index[b] - 1], depth + 1, b == next ? from : NULL, fromlen,
+                    fn, context)) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    default: {
+        const trartnode256 *n = (const trartnode256 *)node;
+        for (int b = max(next, 0); b < 256; ++b) {
+            if (n->children[b] != NULL &&
+                !tr_art_scan_node(n->children[b], depth + 1, b == next ? from : NULL, fromlen, fn, context)) {
+                return false;
+            }
+        }
+        return true;
+    }
+    }
+}
+
+void tr_art_scan(const trart *tree, const void *from, unsigned fromlen,
+        trartscanfn *fn, void *context)
+{
+    if (tree->root != NULL) {
+        tr_art_scan_node(tree->root, 0, fromlen > 0 ? from : NULL, fromlen, fn, context);
+    }
+}
+
+trartstat tr_art_stat(const trart *tree)
+{
+    trartstat stat = {
+        .nentries = tree->nentries,
+        .bytes = tree->bytes,
+    };
+    memcpy(stat.nnodes, tree->nnodes, sizeof(stat.nnodes));
+    return stat;
+}
@@ -0,0 +1,163 @@
+//////////////////////////////////////////////////////////////////////////////
+//
+// Terrascale
+// Copyright (c) Dave Kilian & Emily Kilian 2023. All rights reserved.
+//
+// art.h - an in-memory adaptive radix tree
+//
+// The tree maps byte-string keys, such as asset paths, to 64-bit values,
+// ordered as in kv.h. Rather than comparing whole keys at each level, as a
+// B+tree does, a lookup consumes the key a byte at a time, each byte
+// choosing a child of the node it's at, so keys sharing a long prefix cost
+// no more to tell apart than short ones.
+//
+// Each inner node is one of four sizes, and grows or shrinks to the next as
+// children come and go, so sparse nodes stay small:
+//
+// - trartnode4 and trartnode16 hold up to 4 and 16 sorted key bytes and
+//   the matching children. A lookup in a trartnode16 compares the byte
+//   against all 16 at once with SIMD.
+// - trartnode48 maps every byte to one of 48 child slots, with a 256-entry
+//   table of one-byte slot numbers.
+// - trartnode256 has a child for every byte.
+//
+// Two more techniques keep the tree shallow:
+//
+// - Path compression: a run of nodes with one child each is folded into
+//   the prefix of the node below it. The first tr_art_maxprefix bytes of
+//   the prefix are kept in the node; lookups skip any more and rely on the
+//   final comparison against the leaf's whole key.
+// - Lazy expansion: a key which no other key shares a path with sits in a
+//   leaf directly below the point where it becomes unique.
+//
+// A leaf holds a whole key and its value. Child pointers to leaves are
+// tagged in their low bit. A key which is a prefix of others, ending at an
+// inner node, hangs off that node's own leaf pointer.
+//
+// The tree isn't synchronized. Lookups and scans may run in parallel with
+// each other, but writers must be serialized against everything else.
+//
+//////////////////////////////////////////////////////////////////////////////
+
+#pragma once
+
+// Longest key the tree accepts
+#define tr_art_maxkey 1024
+
+// Prefix bytes kept in each inner node
+#define tr_art_maxprefix 10
+
+// Inner node sizes
+typedef enum {
+
+    trart_node4,
+    trart_node16,
+    trart_node48,
+    trart_node256,
+
+} trartnodetype;
+
+// A leaf: a whole key and its value
+typedef struct {
+
+    uint64_t value;
+    uint32_t keylen;
+    uint8_t key[];
+
+} trartleaf;
+
+// Common inner node header
+typedef struct trartnode trartnode;
+struct trartnode {
+
+    uint8_t type;                       // trartnodetype
+    uint16_t count;                     // Number of children
+    uint32_t prefixlen;                 // Length of the compressed path
+    uint8_t prefix[tr_art_maxprefix];   // Its first bytes
+    trartleaf *leaf;                    // The key ending at this node, if any
+
+};
+
+// Up to 4 children, by sorted key byte
+typedef struct {
+
+    trartnode node;
+    uint8_t keys[4];
+    trartnode *children[4];
+
+} trartnode4;
+
+// Up to 16 children, by sorted key byte
+typedef struct {
+
+    trartnode node;
+    uint8_t keys[16];
+    trartnode *children[16];
+
+} trartnode16;
+
+// Up to 48 children, with a slot number + 1 for each key byte (0 if none)
+typedef struct {
+
+    trartnode node;
+    uint8_t index[256];
+    trartnode *children[48];
+
+} trartnode48;
+
+// A child for every key byte
+typedef struct {
+
+    trartnode node;
+    trartnode *children[256];
+
+} trartnode256;
+
+// Tree statistics
+typedef struct {
+
+    uint64_t nentries;      // Keys in the tree
+    uint64_t nnodes[4];     // Inner nodes of each trartnodetype
+    uint64_t bytes;         // Bytes allocated for nodes and leaves
+
+} trartstat;
+
+// An adaptive radix tree
+typedef struct {
+
+    trartnode *root;        // The root, a tagged leaf, or NULL if empty
+    uint64_t nentries;      // Statistics
+    uint64_t nnodes[4];
+    uint64_t bytes;
+    tralloctag tag;         // Tag for node and leaf allocations
+
+} trart;
+
+// Initializes an empty tree
+void tr_art_initialize(trart *tree, tralloctag tag);
+
+// Frees every node and leaf
+void tr_art_cleanup(trart *tree);
+
+// Looks up a key. Returns trstatus_not_found if it isn't in the tree.
+trstatus tr_art_get(const trart *tree, const void *key, unsigned keylen, uint64_t *value);
+
+// Inserts a key, or replaces its value if it's already there. Returns
+// trstatus_too_large if the key is longer than tr_art_maxkey.
+//
+trstatus tr_art_put(trart *tree, const void *key, unsigned keylen, uint64_t value);
+
+// Removes a key. Returns trstatus_not_found if it isn't in the tree.
+trstatus tr_art_delete(trart *tree, const void *key, unsigned keylen);
+
+// Called for each entry of a scan, in key order. Returns false to stop.
+typedef bool trartscanfn(const void *key, unsigned keylen, uint64_t value, void *context);
+
+// Calls `fn` for each entry with a key at or after `from`, in key order,
+// until it returns false or the entries run out
+//
+void tr_art_scan(const trart *tree, const void *from, unsigned fromlen,
+        trartscanfn *fn, void *context);
+
+// Gets the tree's statistics
+trartstat tr_art_stat(const trart *tree);
@@ -0,0 +1,1308 @@
+//////////////////////////////////////////////////////////////////////////////
+//
+// Terrascale
+// Copyright (c) Dave Kilian & Emily Kilian 2023. All rights reserved.
+//
+//////////////////////////////////////////////////////////////////////////////
+
+#include <pch.h>
+#include <index/btree.h>
+#include <store/kv.h>
+
+// Bytes available to a node
+#define tr_btree_payload ((unsigned)tr_page_payload)
+
+// Heap bytes taken by an entry besides its key suffix: its value
+#define tr_btree_valsize sizeof(uint64_t)
+
+// An entry with its whole key, used while rewriting nodes
+typedef struct {
+
+    const uint8_t *key;
+    unsigned keylen;
+    uint64_t value;
+
+} trbtentry;
+
+// Optimistic readers may see a node in the middle of a change (see
+// latch.h), so whatever locates bytes in a node is clamped to the page
+// before use. On a node which isn't changing, the clamps do nothing.
+//
+static inline unsigned tr_btree_clamp(unsigned value, unsigned limit)
+{
+    return value < limit ? value : limit;
+}
+
+static inline trbtnode *tr_btree_node(trframe *frame)
+{
+    return tr_page_data(frame->data);
+}
+
+static inline uint8_t *tr_btree_lower(const trbtnode *node)
+{
+    return (uint8_t *)(node + 1);
+}
+
+static inline uint8_t *tr_btree_upper(const trbtnode *node)
+{
+    return tr_btree_lower(node) + node->lowerlen;
+}
+
+// Offset of the slot array of a node with fences of the given lengths
+static inline unsigned tr_btree_slotstart(unsigned lowerlen, unsigned upperlen)
+{
+    return (sizeof(trbtnode) + lowerlen + upperlen + 3) & ~3u;
+}
+
+static inline trbtslot *tr_btree_slots(const trbtnode *node)
+{
+    unsigned lowerlen = tr_btree_clamp(node->lowerlen, tr_btree_maxkey);
+    unsigned upperlen = tr_btree_clamp(node->upperlen, tr_btree_maxkey);
+    return ptr_add(node, tr_btree_slotstart(lowerlen, upperlen));
+}
+
+// Gets a node's number of slots, which fit in the page whatever the fences
+static inline unsigned tr_btree_count(const trbtnode *node)
+{
+    unsigned start = tr_btree_slotstart(tr_btree_maxkey, tr_btree_maxkey);
+    return tr_btree_clamp(node->count, (tr_btree_payload - start) / sizeof(trbtslot));
+}
+
+static inline const uint8_t *tr_btree_suffix(const trbtnode *node, const trbtslot *slot)
+{
+    return ptr_add(node, slot->offset);
+}
+
+static inline uint64_t tr_btree_value(const trbtnode *node, const trbtslot *slot)
+{
+    uint64_t value;
+    unsigned offset = tr_btree_clamp(slot->offset + slot->length, tr_btree_payload - sizeof(value));
+    memcpy(&value, ptr_add(node, offset), sizeof(value));
+    return value;
+}
+
+static inline void tr_btree_set_value(trbtnode *node, trbtslot *slot, uint64_t value)
+{
+    memcpy(ptr_add(node, slot->offset + slot->length), &value, sizeof(value));
+}
+
+// Gets the first four bytes of a key suffix as a big-endian integer, padded
+// with zeros, so that comparing heads orders keys by their first bytes
+//
+static inline uint32_t tr_btree_head(const uint8_t *suffix, unsigned length)
+{
+    uint8_t bytes[4] = { 0 };
+    memcpy(bytes, suffix, min(length, 4u));
+    return (uint32_t)bytes[0] << 24 | (uint32_t)bytes[1] << 16 | (uint32_t)bytes[2] << 8 | bytes[3];
+}
+
+// Gets the length of the common prefix of two keys
+static unsigned tr_btree_common(const uint8_t *a, unsigned alen, const uint8_t *b, unsigned blen)
+{
+    unsigned n = min(alen, blen);
+    unsigned i = 0;
+    while (i < n && a[i] == b[i]) {
+        i++;
+    }
+
+    return i;
+}
+
+// Compares the key of a slot with a key suffix whose head is `head`
+static int tr_btree_compare(const trbtnode *node, const trbtslot *slot,
+        const uint8_t *suffix, unsigned length, uint32_t head)
+{
+    if (slot->head != head) {
+        return slot->head < head ? -1 : 1;
+    }
+
+    // With equal heads, a suffix of four bytes or less is a prefix of the
+    // other, so the shorter sorts first
+    unsigned slotlen = slot->length;
+    if (slotlen <= 4 || length <= 4) {
+        return slotlen < length ? -1 : slotlen > length ? 1 : 0;
+    }
+
+    unsigned offset = tr_btree_clamp(slot->offset, tr_btree_payload);
+    slotlen = tr_btree_clamp(slotlen, tr_btree_payload - offset);
+    return tr_kv_compare(ptr_add(node, offset + 4), max(slotlen, 4u) - 4, suffix + 4, length - 4);
+}
+
+// Finds the first slot whose key is at least the given key, or with `after`
+// set, greater than it. Sets *equal if that slot's key is the given key.
+//
+static unsigned tr_btree_search(const trbtnode *node, const uint8_t *key, unsigned keylen,
+        bool after, bool *equal)
+{
+    *equal = false;
+
+    // Keys routed to this node share its prefix; any others sort before or
+    // after all of its keys
+    unsigned prefixlen = tr_btree_clamp(node->prefixlen, tr_btree_maxkey);
+    unsigned count = tr_btree_count(node);
+    unsigned n = min(keylen, prefixlen);
+    int c = memcmp(key, tr_btree_lower(node), n);
+    if (c == 0 && keylen < prefixlen) {
+        c = -1;
+    }
+    if (c != 0) {
+        return c < 0 ? 0 : count;
+    }
+
+    const uint8_t *suffix = key + prefixlen;
+    unsigned length = keylen - prefixlen;
+    uint32_t head = tr_btree_head(suffix, length);
+    const trbtslot *slots = tr_btree_slots(node);
+
+    unsigned lo = 0;
+    unsigned hi = count;
+    while (lo < hi) {
+        unsigned mid = (lo + hi) / 2;
+        c = tr_btree_compare(node, slots + mid, suffix, length, head);
+        if (c < 0 || (after && c == 0)) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+
+    *equal = !after && lo < count && tr_btree_compare(node, slots + lo, suffix, length, head) == 0;
+    return lo;
+}
+
+// Finds the child of an inner node which could hold the key
+static trpageno tr_btree_child(const trbtnode *node, const uint8_t *key, unsigned keylen)
+{
+    bool equal;
+    unsigned index = tr_btree_search(node, key, keylen, true, &equal);
+    return index < tr_btree_count(node) ? (trpageno)tr_btree_value(node, tr_btree_slots(node) + index) : node->upper;
+}
+
+// Starts an empty node with the given fences. Without an upper fence, the
+// node is unbounded above and its keys share no prefix.
+//
+static void tr_btree_node_init(trbtnode *node, unsigned flags,
+        const uint8_t *lower, unsigned lowerlen, const uint8_t *upper, unsigned upperlen)
+{
+    memset(node, 0, sizeof(*node));
+    node->flags = flags;
+    node->lowerlen = lowerlen;
+    node->upperlen = upperlen;
+    node->prefixlen = (flags & tr_btnode_upper) ? tr_btree_common(lower, lowerlen, upper, upperlen) : 0;
+    node->heap = tr_btree_payload;
+    if (lowerlen > 0) {
+        memcpy(tr_btree_lower(node), lower, lowerlen);
+    }
+    if (upperlen > 0) {
+        memcpy(tr_btree_upper(node), upper, upperlen);
+    }
+}
+
+// Gets the bytes of a node in use
+static unsigned tr_btree_node_used(const trbtnode *node)
+{
+    return tr_btree_slotstart(node->lowerlen, node->upperlen) + node->count * sizeof(trbtslot) +
+        tr_btree_payload - node->heap - node->freed;
+}
+
+// Rewrites a node's heap without the space of removed entries
+static void tr_btree_node_compact(trbtnode *node)
+{
+    uint8_t copy[tr_btree_payload];
+    memcpy(copy, node, tr_btree_payload);
+
+    trbtslot *slots = tr_btree_slots(node);
+    unsigned heap = tr_btree_payload;
+    for (unsigned i = 0; i < node->count; ++i) {
+        unsigned size = slots[i].length + tr_btree_valsize;
+        heap -= size;
+        memcpy(ptr_add(node, heap), copy + slots[i].offset, size);
+        slots[i].offset = heap;
+    }
+
+    node->heap = heap;
+    node->freed = 0;
+}
+
+// Checks whether a node has room for one more entry whose key suffix is
+// `length` bytes, once the space of removed entries is reclaimed
+//
+static bool tr_btree_node_room(const trbtnode *node, unsigned length)
+{
+    unsigned end = tr_btree_slotstart(node->lowerlen, node->upperlen) + node->count * sizeof(trbtslot);
+    return end + sizeof(trbtslot) + length + tr_btree_valsize <= node->heap + node->freed;
+}
+
+// Inserts an entry at the given slot, which must keep the slots in order.
+// Returns false if the node doesn't have room.
+//
+static bool tr_btree_node_insert(trbtnode *node, unsigned index,
+        const uint8_t *key, unsigned keylen, uint64_t value)
+{
+    tr_assert(keylen >= node->prefixlen);
+    unsigned length = keylen - node->prefixlen;
+    unsigned size = length + tr_btree_valsize;
+    unsigned end = tr_btree_slotstart(node->lowerlen, node->upperlen) + node->count * sizeof(trbtslot);
+
+    if (end + sizeof(trbtslot) + size > node->heap) {
+        if (!tr_btree_node_room(node, length)) {
+            return false;
+        }
+        tr_btree_node_compact(node);
+    }
+
+    node->heap -= size;
+    memcpy(ptr_add(node, node->heap), key + node->prefixlen, length);
+    memcpy(ptr_add(node, node->heap + length), &value, sizeof(value));
+
+    trbtslot *slots = tr_btree_slots(node);
+    memmove(slots + index + 1, slots + index, (node->count - index) * sizeof(trbtslot));
+    slots[index].offset = node->heap;
+    slots[index].length = length;
+    slots[index].head = tr_btree_head(key + node->prefixlen, length);
+    node->count++;
+    return true;
+}
+
+// Removes the entry at the given slot
+static void tr_btree_node_remove(trbtnode *node, unsigned index)
+{
+    trbtslot *slots = tr_btree_slots(node);
+    node->freed += slots[index].length + tr_btree_valsize;
+    memmove(slots + index, slots + index + 1, (node->count - index - 1) * sizeof(trbtslot));
+    node->count--;
+}
+
+// Sets up the parts of a tree which aren't on its meta page
+static void tr_btree_setup(trbtree *tree, trbufpool *pool, trfile *file, tralloctag tag)
+{
+    tree->pool = pool;
+    tree->file = file;
+    atomic_init(&tree->root, tree->meta.root);
+    atomic_init(&tree->nentries, tree->meta.nentries);
+    pthread_mutex_init(&tree->splitlock, NULL);
+    tree->tag = tag;
+}
+
+trstatus tr_btree_create(trbtree *tree, trbufpool *pool, trfile *file, tralloctag tag)
+{
+    if (tr_file_npages(file) != 0) {
+        return trstatus_argument;
+    }
+
+    trpageno metano, rootno;
+    trframe *meta, *root;
+    trstatus status = tr_bufpool_pin_new(pool, file, &metano, &meta);
+    if (!tr_ok(status)) {
+        return status;
+    }
+    status = tr_bufpool_pin_new(pool, file, &rootno, &root);
+    if (!tr_ok(status)) {
+        tr_bufpool_unpin(pool, meta, true);
+        return status;
+    }
+
+    tr_btree_node_init(tr_btree_node(root), tr_btnode_leaf, NULL, 0, NULL, 0);
+    tr_bufpool_unpin(pool, root, true);
+
+    memset(&tree->meta, 0, sizeof(tree->meta));
+    tree->meta.magic = tr_btree_magic;
+    tree->meta.root = rootno;
+    tree->meta.height = 1;
+    tree->meta.nleaves = 1;
+    memcpy(tr_page_data(meta->data), &tree->meta, sizeof(tree->meta));
+    tr_bufpool_unpin(pool, meta, true);
+
+    tr_btree_setup(tree, pool, file, tag);
+    return trstatus_ok;
+}
+
+trstatus tr_btree_open(trbtree *tree, trbufpool *pool, trfile *file, tralloctag tag)
+{
+    trframe *frame;
+    trstatus status = tr_bufpool_pin(pool, file, 0, &frame);
+    if (!tr_ok(status)) {
+        return status;
+    }
+
+    memcpy(&tree->meta, tr_page_data(frame->data), sizeof(tree->meta));
+    tr_bufpool_unpin(pool, frame, false);
+    if (tree->meta.magic != tr_btree_magic || tree->meta.height == 0 ||
+        tree->meta.height > tr_btree_maxheight || tree->meta.root >= tr_file_npages(file)) {
+        return trstatus_corrupt;
+    }
+
+    tr_btree_setup(tree, pool, file, tag);
+    return trstatus_ok;
+}
+
+trstatus tr_btree_flush(trbtree *tree)
+{
+    pthread_mutex_lock(&tree->splitlock);
+    tree->meta.nentries = atomic_load(&tree->nentries);
+
+    trframe *frame;
+    trstatus status = tr_bufpool_pin(tree->pool, tree->file, 0, &frame);
+    if (tr_ok(status)) {
+        memcpy(tr_page_data(frame->data), &tree->meta, sizeof(tree->meta));
+        tr_bufpool_unpin(tree->pool, frame, true);
+        status = tr_bufpool_flush(tree->pool, tree->file);
+    }
+
+    pthread_mutex_unlock(&tree->splitlock);
+    return status;
+}
+
+void tr_btree_cleanup(trbtree *tree)
+{
+    pthread_mutex_destroy(&tree->splitlock);
+}
+
+// Descends optimistically from the root to the leaf which could hold the
+// key, and pins the leaf, setting *version to the version it was read at.
+// Returns trstatus_later if a node changed underneath the descent, in which
+// case the caller must restart.
+//
+static trstatus tr_btree_descend(trbtree *tree, const uint8_t *key, unsigned keylen,
+        trframe **leaf, uint64_t *version)
+{
+    trpageno pageno = atomic_load_explicit(&tree->root, memory_order_acquire);
+    trframe *frame;
+    trstatus status = tr_bufpool_pin(tree->pool, tree->file, pageno, &frame);
+    if (!tr_ok(status)) {
+        return status;
+    }
+
+    // The root may have split before its version was noted
+    uint64_t v;
+    tr_latch_read(&frame->latch, &v);
+    if (pageno != atomic_load_explicit(&tree->root, memory_order_acquire)) {
+        tr_bufpool_unpin(tree->pool, frame, false);
+        return trstatus_later;
+    }
+
+    for (unsigned depth = 1; ; ++depth) {
+        const trbtnode *node = tr_btree_node(frame);
+        if (node->flags & tr_btnode_leaf) {
+            *leaf = frame;
+            *version = v;
+            return trstatus_ok;
+        }
+
+        pageno = tr_btree_child(node, key, keylen);
+        if (!tr_latch_validate(&frame->latch, v)) {
+            tr_bufpool_unpin(tree->pool, frame, false);
+            return trstatus_later;
+        }
+        if (depth == tr_btree_maxheight) {
+            tr_bufpool_unpin(tree->pool, frame, false);
+            return trstatus_corrupt;
+        }
+
+        // A split of the child changes the parent too, so validating the
+        // parent once the child's version is noted covers both
+        trframe *child;
+        status = tr_bufpool_pin(tree->pool, tree->file, pageno, &child);
+        if (!tr_ok(status)) {
+            tr_bufpool_unpin(tree->pool, frame, false);
+            return status;
+        }
+
+        uint64_t cv;
+        tr_latch_read(&child->latch, &cv);
+        bool valid = tr_latch_validate(&frame->latch, v);
+        tr_bufpool_unpin(tree->pool, frame, false);
+        if (!valid) {
+            tr_bufpool_unpin(tree->pool, child, false);
+            return trstatus_later;
+        }
+
+        frame = child;
+        v = cv;
+    }
+}
+
+trstatus tr_btree_get(trbtree *tree, const void *key, unsigned keylen, uint64_t *value)
+{
+    if (keylen > tr_btree_maxkey) {
+        return trstatus_not_found;
+    }
+
+    for (;;) {
+        trframe *frame;
+        uint64_t v;
+        trstatus status = tr_btree_descend(tree, key, keylen, &frame, &v);
+        if (status == trstatus_later) {
+            continue;
+        }
+        if (!tr_ok(status)) {
+            return status;
+        }
+
+        const trbtnode *node = tr_btree_node(frame);
+        bool equal;
+        unsigned index = tr_btree_search(node, key, keylen, false, &equal);
+        uint64_t found = equal ? tr_btree_value(node, tr_btree_slots(node) + index) : 0;
+        bool valid = tr_latch_validate(&frame->latch, v);
+        tr_bufpool_unpin(tree->pool, frame, false);
+
+        if (valid) {
+            if (!equal) {
+                return trstatus_not_found;
+            }
+            *value = found;
+            return trstatus_ok;
+        }
+    }
+}
+
+// The nodes a split may change, from the shallowest one it can reach down to
+// a leaf, each pinned and latched exclusively
+//
+typedef struct {
+
+    trpageno pages[tr_btree_maxheight];
+    trframe *frames[tr_btree_maxheight];
+    bool dirty[tr_btree_maxheight];
+    unsigned top;           // Depth of the shallowest node held
+    unsigned leaf;          // Depth of the leaf
+
+} trbtpath;
+
+// Lets go of the nodes of a path at depths [from, to)
+static void tr_btree_release(trbtree *tree, trbtpath *path, unsigned from, unsigned to)
+{
+    for (unsigned depth = from; depth < to; ++depth) {
+        trframe *frame = path->frames[depth];
+        tr_latch_unlock(&frame->latch);
+        tr_bufpool_unpin(tree->pool, frame, path->dirty[depth]);
+    }
+}
+
+// Descends to the leaf which could hold the key, latching each node on the
+// way, but letting go of the nodes above any inner node with room for a
+// separator of any length. Called with the split lock held, so that only
+// leaves change underneath.
+//
+static trstatus tr_btree_descend_locked(trbtree *tree, const uint8_t *key, unsigned keylen,
+        trbtpath *path)
+{
+    trpageno pageno = tree->meta.root;
+    path->top = 0;
+    for (unsigned depth = 0; ; ++depth) {
+        if (depth == tree->meta.height) {
+            tr_btree_release(tree, path, path->top, depth);
+            return trstatus_corrupt;
+        }
+
+        trframe *frame;
+        trstatus status = tr_bufpool_pin(tree->pool, tree->file, pageno, &frame);
+        if (!tr_ok(status)) {
+            tr_btree_release(tree, path, path->top, depth);
+            return status;
+        }
+
+        tr_latch_lock(&frame->latch);
+        path->pages[depth] = pageno;
+        path->frames[depth] = frame;
+        path->dirty[depth] = false;
+
+        const trbtnode *node = tr_btree_node(frame);
+        if (node->flags & tr_btnode_leaf) {
+            path->leaf = depth;
+            return trstatus_ok;
+        }
+
+        if (tr_btree_node_room(node, tr_btree_maxkey)) {
+            tr_btree_release(tree, path, path->top, depth);
+            path->top = depth;
+        }
+        pageno = tr_btree_child(node, key, keylen);
+    }
+}
+
+// Copies a node's entries out with their whole keys, inserting one more
+// entry at `index`. Returns the buffer holding the keys, to be freed by
+// the caller, or NULL if out of memory.
+//
+static uint8_t *tr_btree_gather(trbtree *tree, const trbtnode *node, unsigned index,
+        const uint8_t *key, unsigned keylen, uint64_t value, trbtentry *entries)
+{
+    uint8_t *arena = tr_alloc(node->count * node->prefixlen + tr_btree_payload, tree->tag);
+    if (arena == NULL) {
+        return NULL;
+    }
+
+    const trbtslot *slots = tr_btree_slots(node);
+    uint8_t *next = arena;
+    for (unsigned i = 0, j = 0; i <= node->count; ++i) {
+        if (i == index) {
+            entries[i] = (trbtentry){ key, keylen, value };
+            continue;
+        }
+
+        const trbtslot *slot = slots + j++;
+        memcpy(next, tr_btree_lower(node), node->prefixlen);
+        memcpy(next + node->prefixlen, tr_btree_suffix(node, slot), slot->length);
+        entries[i] = (trbtentry){ next, node->prefixlen + slot->length, tr_btree_value(node, slot) };
+        next += entries[i].keylen;
+    }
+
+    return arena;
+}
+
+// Fills an initialized node with entries
+static void tr_btree_node_fill(trbtnode *node, const trbtentry *entries, unsigned count)
+{
+    for (unsigned i = 0; i < count; ++i) {
+        bool fits = tr_btree_node_insert(node, i, entries[i].key, entries[i].keylen, entries[i].value);
+        tr_require(fits);
+    }
+}
+
+// Points an inner node's pointer to one child at another instead
+static void tr_btree_redirect(trbtnode *node, trpageno from, trpageno to)
+{
+    if (node->upper == from) {
+        node->upper = to;
+        return;
+    }
+
+    trbtslot *slots = tr_btree_slots(node);
+    for (unsigned i = 0; i < node->count; ++i) {
+        if (tr_btree_value(node, slots + i) == from) {
+            tr_btree_set_value(node, slots + i, to);
+            return;
+        }
+    }
+}
+
+// One node's part in a split
+typedef struct {
+
+    uint8_t *copy;          // The node as it was, followed by its entries
+    uint8_t *arena;         // The entries' keys
+    trbtentry *entries;     // The node's entries, with the new one
+    unsigned count;         // Number of entries
+    unsigned mid;           // First entry to the right (or moving up)
+    const uint8_t *sep;     // Separator between the halves
+    unsigned seplen;
+    trpageno rightno;       // New page for the right half
+    trframe *right;
+
+} trbtsplit;
+
+// Works out how to split a node which has no room for an entry, and pins
+// a new page for the right half, changing nothing. An inner node's pointer
+// to the child which split below it is redirected to `redirect`, the
+// child's right half, since the separator from below goes in before it.
+//
+static trstatus tr_btree_plan(trbtree *tree, const trbtnode *node, trpageno child, trpageno redirect,
+        unsigned index, const uint8_t *key, unsigned keylen, uint64_t value, trbtsplit *split)
+{
+    bool leaf = node->flags & tr_btnode_leaf;
+
+    split->copy = tr_alloc(tr_btree_payload + (node->count + 1) * sizeof(trbtentry), tree->tag);
+    if (split->copy == NULL) {
+        return trstatus_no_mem;
+    }
+    memcpy(split->copy, node, tr_btree_payload);
+    trbtnode *old = (trbtnode *)split->copy;
+    if (!leaf) {
+        tr_btree_redirect(old, child, redirect);
+    }
+
+    split->entries = ptr_add(split->copy, tr_btree_payload);
+    split->arena = tr_btree_gather(tree, old, index, key, keylen, value, split->entries);
+    if (split->arena == NULL) {
+        tr_free(split->copy);
+        return trstatus_no_mem;
+    }
+
+    trstatus status = tr_bufpool_pin_new(tree->pool, tree->file, &split->rightno, &split->right);
+    if (!tr_ok(status)) {
+        tr_free(split->arena);
+        tr_free(split->copy);
+        return status;
+    }
+
+    // Split at the middle byte
+    const trbtentry *entries = split->entries;
+    unsigned count = old->count + 1;
+    unsigned total = 0;
+    for (unsigned i = 0; i < count; ++i) {
+        total += entries[i].keylen + tr_btree_valsize + sizeof(trbtslot);
+    }
+    unsigned mid = 0;
+    for (unsigned sum = 0; mid < count && sum < total / 2; ++mid) {
+        sum += entries[mid].keylen + tr_btree_valsize + sizeof(trbtslot);
+    }
+    mid = max(mid, 1u);
+    mid = min(mid, leaf ? count - 1 : count - 2);
+
+    // A leaf's separator is the shortest prefix of the right half's first
+    // key which is greater than the left half's last key. An inner node
+    // moves its middle separator up, and its child becomes the left half's
+    // upper child.
+    split->count = count;
+    split->mid = mid;
+    split->sep = entries[mid].key;
+    split->seplen = leaf ?
+        tr_btree_common(entries[mid - 1].key, entries[mid - 1].keylen, split->sep, entries[mid].keylen) + 1 :
+        entries[mid].keylen;
+    tr_assert(split->seplen <= entries[mid].keylen);
+    return trstatus_ok;
+}
+
+// Frees a split's buffers
+static void tr_btree_plan_free(trbtsplit *split)
+{
+    tr_free(split->arena);
+    tr_free(split->copy);
+}
+
+// Rewrites a node as the left half of a planned split, and fills in the
+// right half. The left half stays on the node's page, so its left
+// sibling's link stays valid.
+//
+static void tr_btree_apply(trbtree *tree, trbtnode *node, trbtsplit *split)
+{
+    const trbtnode *old = (const trbtnode *)split->copy;
+    const trbtentry *entries = split->entries;
+    unsigned count = split->count;
+    unsigned mid = split->mid;
+
+    unsigned upperflag = old->flags & tr_btnode_upper;
+    trbtnode *rnode = tr_btree_node(split->right);
+    tr_btree_node_init(rnode, (old->flags & tr_btnode_leaf) | upperflag,
+        split->sep, split->seplen, tr_btree_upper(old), old->upperlen);
+    tr_btree_node_init(node, (old->flags & tr_btnode_leaf) | tr_btnode_upper,
+        tr_btree_lower(old), old->lowerlen, split->sep, split->seplen);
+
+    if (old->flags & tr_btnode_leaf) {
+        tr_btree_node_fill(node, entries, mid);
+        tr_btree_node_fill(rnode, entries + mid, count - mid);
+        rnode->next = old->next;
+        node->next = split->rightno;
+        tree->meta.nleaves++;
+    } else {
+        tr_btree_node_fill(node, entries, mid);
+        tr_btree_node_fill(rnode, entries + mid + 1, count - mid - 1);
+        node->upper = entries[mid].value;
+        rnode->upper = old->upper;
+        tree->meta.ninner++;
+    }
+
+    tr_bufpool_unpin(tree->pool, split->right, true);
+}
+
+// Splits the leaf of a path, which has no room for an entry, putting the
+// entry in whichever half it belongs to, and inserts the separator between
+// the halves into the leaf's parent, splitting that in turn if need be, up
+// to a new root. Every split is planned, and every page pinned, before any
+// node changes, so on failure the tree is left as it was.
+//
+static trstatus tr_btree_split(trbtree *tree, trbtpath *path,
+        unsigned index, const uint8_t *key, unsigned keylen, uint64_t value)
+{
+    trbtsplit splits[tr_btree_maxheight];
+    unsigned nsplits = 0;
+    trpageno rootno = 0;
+    trframe *root = NULL;
+    trstatus status = trstatus_ok;
+
+    // Plan from the leaf up, until a node has room for the separator from
+    // below, or the root splits
+    unsigned depth = path->leaf;
+    for (;;) {
+        trpageno child = nsplits > 0 ? path->pages[depth + 1] : 0;
+        trpageno redirect = nsplits > 0 ? splits[nsplits - 1].rightno : 0;
+        status = tr_btree_plan(tree, tr_btree_node(path->frames[depth]), child, redirect,
+            index, key, keylen, value, splits + nsplits);
+        if (!tr_ok(status)) {
+            break;
+        }
+
+        const trbtsplit *split = splits + nsplits++;
+        key = split->sep;
+        keylen = split->seplen;
+        value = path->pages[depth];
+
+        if (depth == 0) {
+            status = tree->meta.height == tr_btree_maxheight ? trstatus_too_large :
+                tr_bufpool_pin_new(tree->pool, tree->file, &rootno, &root);
+            break;
+        }
+
+        // Nodes above the path's top have room for any separator
+        depth--;
+        tr_assert(depth >= path->top);
+        const trbtnode *parent = tr_btree_node(path->frames[depth]);
+        bool equal;
+        index = tr_btree_search(parent, key, keylen, false, &equal);
+        if (tr_btree_node_room(parent, keylen - parent->prefixlen)) {
+            break;
+        }
+    }
+
+    if (!tr_ok(status)) {
+        for (unsigned i = 0; i < nsplits; ++i) {
+            // A fresh page which nothing points to; it's wasted but harmless
+            tr_btree_node_init(tr_btree_node(splits[i].right), tr_btnode_leaf, NULL, 0, NULL, 0);
+            tr_bufpool_unpin(tree->pool, splits[i].right, true);
+            tr_btree_plan_free(splits + i);
+        }
+        return status;
+    }
+
+    for (unsigned i = 0; i < nsplits; ++i) {
+        unsigned d = path->leaf - i;
+        tr_btree_apply(tree, tr_btree_node(path->frames[d]), splits + i);
+        path->dirty[d] = true;
+    }
+
+    const trbtsplit *last = splits + nsplits - 1;
+    if (root != NULL) {
+        // A new root above the two halves of the old one
+        trbtnode *rnode = tr_btree_node(root);
+        tr_btree_node_init(rnode, 0, NULL, 0, NULL, 0);
+        bool fits = tr_btree_node_insert(rnode, 0, key, keylen, value);
+        tr_require(fits);
+        rnode->upper = last->rightno;
+        tr_bufpool_unpin(tree->pool, root, true);
+
+        tree->meta.root = rootno;
+        tree->meta.height++;
+        tree->meta.ninner++;
+        atomic_store_explicit(&tree->root, rootno, memory_order_release);
+    } else {
+        // The parent's pointer to the node which split now covers its right
+        // half, and the left half goes in before it
+        trbtnode *parent = tr_btree_node(path->frames[depth]);
+        tr_btree_redirect(parent, path->pages[depth + 1], last->rightno);
+        bool fits = tr_btree_node_insert(parent, index, key, keylen, value);
+        tr_require(fits);
+        path->dirty[depth] = true;
+    }
+
+    for (unsigned i = 0; i < nsplits; ++i) {
+        tr_btree_plan_free(splits + i);
+    }
+    return trstatus_ok;
+}
+
+// Puts an entry which didn't fit in its leaf, splitting as need be
+static trstatus tr_btree_put_split(trbtree *tree, const uint8_t *key, unsigned keylen, uint64_t value)
+{
+    pthread_mutex_lock(&tree->splitlock);
+    trbtpath path;
+    trstatus status = tr_btree_descend_locked(tree, key, keylen, &path);
+    if (tr_ok(status)) {
+        // Another put may have made room, or added the key, in the meantime
+        trbtnode *node = tr_btree_node(path.frames[path.leaf]);
+        bool equal;
+        unsigned index = tr_btree_search(node, key, keylen, false, &equal);
+        if (equal) {
+            tr_btree_set_value(node, tr_btree_slots(node) + index, value);
+            path.dirty[path.leaf] = true;
+        } else if (tr_btree_node_insert(node, index, key, keylen, value)) {
+            path.dirty[path.leaf] = true;
+            atomic_fetch_add(&tree->nentries, 1);
+        } else {
+            status = tr_btree_split(tree, &path, index, key, keylen, value);
+            if (tr_ok(status)) {
+                atomic_fetch_add(&tree->nentries, 1);
+            }
+        }
+
+        tr_btree_release(tree, &path, path.top, path.leaf + 1);
+    }
+
+    pthread_mutex_unlock(&tree->splitlock);
+    return status;
+}
+
+trstatus tr_btree_put(trbtree *tree, const void *key, unsigned keylen, uint64_t value)
+{
+    if (keylen > tr_btree_maxkey) {
+        return trstatus_too_large;
+    }
+
+    for (;;) {
+        trframe *frame;
+        uint64_t v;
+        trstatus status = tr_btree_descend(tree, key, keylen, &frame, &v);
+        if (status == trstatus_later) {
+            continue;
+        }
+        if (!tr_ok(status)) {
+            return status;
+        }
+
+        if (!tr_latch_upgrade(&frame->latch, v)) {
+            tr_bufpool_unpin(tree->pool, frame, false);
+            continue;
+        }
+
+        trbtnode *node = tr_btree_node(frame);
+        bool equal;
+        unsigned index = tr_btree_search(node, key, keylen, false, &equal);
+        bool done = true;
+        if (equal) {
+            tr_btree_set_value(node, tr_btree_slots(node) + index, value);
+        } else if (tr_btree_node_insert(node, index, key, keylen, value)) {
+            atomic_fetch_add(&tree->nentries, 1);
+        } else {
+            done = false;
+        }
+
+        tr_latch_unlock(&frame->latch);
+        tr_bufpool_unpin(tree->pool, frame, done);
+        return done ? trstatus_ok : tr_btree_put_split(tree, key, keylen, value);
+    }
+}
+
+trstatus tr_btree_delete(trbtree *tree, const void *key, unsigned keylen)
+{
+    if (keylen > tr_btree_maxkey) {
+        return trstatus_not_found;
+    }
+
+    for (;;) {
+        trframe *frame;
+        uint64_t v;
+        trstatus status = tr_btree_descend(tree, key, keylen, &frame, &v);
+        if (status == trstatus_later) {
+            continue;
+        }
+        if (!tr_ok(status)) {
+            return status;
+        }
+
+        // Only the leaf changes, so only its latch matters
+        if (!tr_latch_upgrade(&frame->latch, v)) {
+            tr_bufpool_unpin(tree->pool, frame, false);
+            continue;
+        }
+
+        trbtnode *node = tr_btree_node(frame);
+        bool equal;
+        unsigned index = tr_btree_search(node, key, keylen, false, &equal);
+        if (equal) {
+            tr_btree_node_remove(node, index);
+            atomic_fetch_sub(&tree->nentries, 1);
+        }
+
+        tr_latch_unlock(&frame->latch);
+        tr_bufpool_unpin(tree->pool, frame, equal);
+        return equal ? trstatus_ok : trstatus_not_found;
+    }
+}
+
+trstatus tr_btree_scan(trbtree *tree, const void *from, unsigned fromlen,
+        trbtscanfn *fn, void *context)
+{
+    trframe *frame;
+    uint64_t v;
+    trstatus status;
+    do {
+        status = tr_btree_descend(tree, from, fromlen, &frame, &v);
+    } while (status == trstatus_later);
+    if (!tr_ok(status)) {
+        return status;
+    }
+
+    // Each leaf is copied out, and the copy validated, before its entries go
+    // to the callback. A leaf which splits keeps its lower keys, and links
+    // to the page the rest moved to, so after a retry the scan just carries
+    // on past the last key it returned.
+    _Alignas(uint64_t) uint8_t copy[tr_btree_payload];
+    uint8_t key[tr_btree_maxkey];
+    unsigned keylen = 0;
+    bool started = false;
+    for (;;) {
+        memcpy(copy, tr_btree_node(frame), tr_btree_payload);
+        if (!tr_latch_validate(&frame->latch, v)) {
+            tr_latch_read(&frame->latch, &v);
+            continue;
+        }
+        tr_bufpool_unpin(tree->pool, frame, false);
+
+        const trbtnode *node = (const trbtnode *)copy;
+        const trbtslot *slots = tr_btree_slots(node);
+        bool equal;
+        unsigned index = started ?
+            tr_btree_search(node, key, keylen, true, &equal) :
+            tr_btree_search(node, from, fromlen, false, &equal);
+
+        memcpy(key, tr_btree_lower(node), node->prefixlen);
+        for (; index < node->count; ++index) {
+            const trbtslot *slot = slots + index;
+            memcpy(key + node->prefixlen, tr_btree_suffix(node, slot), slot->length);
+            keylen = node->prefixlen + slot->length;
+            started = true;
+            if (!fn(key, keylen, tr_btree_value(node, slot), context)) {
+                return trstatus_ok;
+            }
+        }
+
+        // On to the right sibling
+        if (node->next == 0) {
+            return trstatus_ok;
+        }
+        status = tr_bufpool_pin(tree->pool, tree->file, node->next, &frame);
+        if (!tr_ok(status)) {
+            return status;
+        }
+        tr_latch_read(&frame->latch, &v);
+    }
+}
+
+// Adds up the used bytes of a subtree's leaves and inner nodes. Called with
+// the split lock held, so only leaves change underneath.
+//
+static trstatus tr_btree_measure(trbtree *tree, trpageno pageno, unsigned depth, uint64_t *used)
+{
+    if (depth == tree->meta.height) {
+        return trstatus_corrupt;
+    }
+
+    trframe *frame;
+    trstatus status = tr_bufpool_pin(tree->pool, tree->file, pageno, &frame);
+    if (!tr_ok(status)) {
+        return status;
+    }
+
+    const trbtnode *node = tr_btree_node(frame);
+    bool leaf = node->flags & tr_btnode_leaf;
+    if (leaf) {
+        uint64_t v, size;
+        do {
+            tr_latch_read(&frame->latch, &v);
+            size = tr_btree_node_used(node);
+        } while (!tr_latch_validate(&frame->latch, v));
+        used[1] += size;
+    } else {
+        used[0] += tr_btree_node_used(node);
+        const trbtslot *slots = tr_btree_slots(node);
+        for (unsigned i = 0; i <= node->count && tr_ok(status); ++i) {
+            trpageno child = i < node->count ? (trpageno)tr_btree_value(node, slots + i) : node->upper;
+            status = tr_btree_measure(tree, child, depth + 1, used);
+        }
+    }
+
+    tr_bufpool_unpin(tree->pool, frame, false);
+    return status;
+}
+
+trstatus tr_btree_stat(trbtree *tree, trbtreestat *stat)
+{
+    pthread_mutex_lock(&tree->splitlock);
+    uint64_t used[2] = { 0, 0 };
+    trstatus status = tr_btree_measure(tree, tree->meta.root, 0, used);
+
+    stat->nentries = atomic_load(&tree->nentries);
+    stat->nleaves = tree->meta.nleaves;
+    stat->ninner = tree->meta.ninner;
+    stat->height = tree->meta.height;
+    stat->leaffill = (double)used[1] / ((double)stat->nleaves * tr_btree_payload);
+    stat->innerfill = stat->ninner == 0 ? 0 : (double)used[0] / ((double)stat->ninner * tr_btree_payload);
+
+    pthread_mutex_unlock(&tree->splitlock);
+    return status;
+}
+
+//
+// Bulk building
+//
+// Each level stages entries until they'd overfill a node, then writes a node
+// of them and passes its upper fence and page up to the level above, which
+// stages them in turn. At a leaf level, a staged entry is a key and its
+// value; above, it's a child and the child's upper fence, and the last child
+// of each node becomes its upper child. Nodes are written left to right, so
+// each leaf's link is filled in when its right sibling is written.
+//
+
+trstatus tr_btree_build_begin(trbtbuilder *builder, trbtree *tree, double fill)
+{
+    if (atomic_load(&tree->nentries) != 0 || tree->meta.height != 1 || !(fill >= 0.5 && fill <= 1)) {
+        return trstatus_argument;
+    }
+
+    memset(builder, 0, sizeof(*builder));
+    builder->tree = tree;
+    builder->limit = fill * tr_btree_payload;
+    builder->status = trstatus_ok;
+    return trstatus_ok;
+}
+
+// Makes room for one more staged entry with a key of the given length
+static trstatus tr_btree_level_reserve(trbtree *tree, trbtlevel *level, unsigned keylen)
+{
+    if (level->arenasize + keylen > level->arenacap) {
+        unsigned cap = max(max(level->arenacap * 2, (unsigned)tr_pagesize), level->arenasize + keylen);
+        uint8_t *arena = tr_alloc(cap, tree->tag);
+        if (arena == NULL) {
+            return trstatus_no_mem;
+        }
+        if (level->arena != NULL) {
+            memcpy(arena, level->arena, level->arenasize);
+            tr_free(level->arena);
+        }
+        level->arena = arena;
+        level->arenacap = cap;
+    }
+
+    if (level->count == level->capacity) {
+        unsigned cap = max(level->capacity * 2, 64u);
+        size_t each = sizeof(uint32_t) + sizeof(uint16_t) + sizeof(uint64_t);
+        uint8_t *block = tr_alloc(cap * each, tree->tag);
+        if (block == NULL) {
+            return trstatus_no_mem;
+        }
+
+        // One allocation holds all three arrays, values first for alignment
+        uint64_t *values = (uint64_t *)block;
+        uint32_t *offsets = (uint32_t *)(values + cap);
+        uint16_t *lengths = (uint16_t *)(offsets + cap);
+        if (level->values != NULL) {
+            memcpy(values, level->values, level->count * sizeof(uint64_t));
+            memcpy(offsets, level->offsets, level->count * sizeof(uint32_t));
+            memcpy(lengths, level->lengths, level->count * sizeof(uint16_t));
+            tr_free(level->values);
+        }
+        level->values = values;
+        level->offsets = offsets;
+        level->lengths = lengths;
+        level->capacity = cap;
+    }
+
+    return trstatus_ok;
+}
+
+static inline const uint8_t *tr_btree_level_key(const trbtlevel *level, unsigned i)
+{
+    return level->arena + level->offsets[i];
+}
+
+// Gets the size of a node made of the first n staged entries of a level,
+// with the given upper fence (or none if upper is NULL). In an inner node,
+// the last of them becomes the upper child and takes no slot.
+//
+static unsigned tr_btree_level_size(const trbtlevel *level, bool leaf, unsigned n,
+        const uint8_t *upper, unsigned upperlen)
+{
+    unsigned prefix = upper == NULL ? 0 : tr_btree_common(level->lower, level->lowerlen, upper, upperlen);
+    unsigned nslots = leaf ? n : n - 1;
+    unsigned size = tr_btree_slotstart(level->lowerlen, upper == NULL ? 0 : upperlen);
+    for (unsigned i = 0; i < nslots; ++i) {
+        size += sizeof(trbtslot) + level->lengths[i] - prefix + tr_btree_valsize;
+    }
+
+    return size;
+}
+
+static trstatus tr_btree_stage(trbtbuilder *builder, unsigned depth,
+        const uint8_t *key, unsigned keylen, uint64_t value, bool bounded);
+
+// Writes a node of the first n staged entries of a level, and passes it up.
+// Its upper fence is `upper`, or if NULL, the node is the last of its level
+// and unbounded.
+//
+static trstatus tr_btree_level_write(trbtbuilder *builder, unsigned depth, unsigned n,
+        const uint8_t *upper, unsigned upperlen)
+{
+    trbtree *tree = builder->tree;
+    trbtlevel *level = builder->levels + depth;
+    bool leaf = depth == 0;
+
+    trpageno pageno;
+    trframe *frame;
+    trstatus status = tr_bufpool_pin_new(tree->pool, tree->file, &pageno, &frame);
+    if (!tr_ok(status)) {
+        return status;
+    }
+
+    trbtnode *node = tr_btree_node(frame);
+    tr_btree_node_init(node, (leaf ? tr_btnode_leaf : 0) | (upper != NULL ? tr_btnode_upper : 0),
+        level->lower, level->lowerlen, upper, upper == NULL ? 0 : upperlen);
+    unsigned nslots = leaf ? n : n - 1;
+    for (unsigned i = 0; i < nslots; ++i) {
+        bool fits = tr_btree_node_insert(node, i, tr_btree_level_key(level, i), level->lengths[i], level->values[i]);
+        tr_require(fits);
+    }
+    if (!leaf) {
+        node->upper = level->values[n - 1];
+    }
+    tr_bufpool_unpin(tree->pool, frame, true);
+
+    // Link the leaf before it to this one
+    if (leaf && level->last != 0) {
+        status = tr_bufpool_pin(tree->pool, tree->file, level->last, &frame);
+        if (!tr_ok(status)) {
+            return status;
+        }
+        tr_btree_node(frame)->next = pageno;
+        tr_bufpool_unpin(tree->pool, frame, true);
+    }
+    level->last = pageno;
+
+    // The upper fence is the next node's lower fence. Copy it out before
+    // dropping the written entries, since it may be one of their keys.
+    if (upper != NULL) {
+        memmove(level->lower, upper, upperlen);
+        level->lowerlen = upperlen;
+    }
+
+    unsigned drop = level->count > n ? level->offsets[n] : level->arenasize;
+    memmove(level->arena, level->arena + drop, level->arenasize - drop);
+    level->arenasize -= drop;
+    for (unsigned i = n; i < level->count; ++i) {
+        level->offsets[i - n] = level->offsets[i] - drop;
+        level->lengths[i - n] = level->lengths[i];
+        level->values[i - n] = level->values[i];
+    }
+    level->count -= n;
+
+    if (leaf) {
+        builder->nleaves++;
+    } else {
+        builder->ninner++;
+    }
+
+    if (depth + 1 == tr_btree_maxheight) {
+        return trstatus_too_large;
+    }
+    return tr_btree_stage(builder, depth + 1, level->lower, level->lowerlen, pageno, upper != NULL);
+}
+
+// Writes the longest run of staged entries at the front of a level which
+// fits in a page, with the entry after them bounding the node. `n` is the
+// number of entries to try first.
+//
+static trstatus tr_btree_level_flush(trbtbuilder *builder, unsigned depth, unsigned n)
+{
+    trbtlevel *level = builder->levels + depth;
+    bool leaf = depth == 0;
+
+    for (;; --n) {
+        const uint8_t *upper;
+        unsigned upperlen;
+        if (leaf) {
+            // Truncate the next key to the shortest prefix which is greater
+            // than the node's last key
+            upper = tr_btree_level_key(level, n);
+            upperlen = tr_btree_common(tr_btree_level_key(level, n - 1), level->lengths[n - 1],
+                upper, level->lengths[n]) + 1;
+        } else {
+            upper = tr_btree_level_key(level, n - 1);
+            upperlen = level->lengths[n - 1];
+        }
+
+        if (n == 1 || tr_btree_level_size(level, leaf, n, upper, upperlen) <= tr_btree_payload) {
+            return tr_btree_level_write(builder, depth, n, upper, upperlen);
+        }
+    }
+}
+
+// Stages an entry at a level, writing a node first if the entry would
+// overfill it. `bounded` is false for the last child of a level, which has
+// no upper fence.
+//
+static trstatus tr_btree_stage(trbtbuilder *builder, unsigned depth,
+        const uint8_t *key, unsigned keylen, uint64_t value, bool bounded)
+{
+    trbtlevel *level = builder->levels + depth;
+    trstatus status = tr_btree_level_reserve(builder->tree, level, keylen);
+    if (!tr_ok(status)) {
+        return status;
+    }
+
+    unsigned i = level->count++;
+    level->offsets[i] = level->arenasize;
+    level->lengths[i] = bounded ? keylen : 0;
+    level->values[i] = value;
+    if (bounded) {
+        memcpy(level->arena + level->arenasize, key, keylen);
+        level->arenasize += keylen;
+    }
+
+    // A leaf holding this entry too would have at most this key as its
+    // upper fence, and an inner node would have this child's. If that's too
+    // full, the node ends just before this entry.
+    if (bounded && i > 0 && tr_btree_level_size(level, depth == 0, i + 1, key, keylen) > builder->limit) {
+        return tr_btree_level_flush(builder, depth, i);
+    }
+
+    return trstatus_ok;
+}
+
+trstatus tr_btree_build_add(trbtbuilder *builder, const void *key, unsigned keylen, uint64_t value)
+{
+    if (!tr_ok(builder->status)) {
+        return builder->status;
+    }
+    if (keylen > tr_btree_maxkey) {
+        return trstatus_too_large;
+    }
+    if (builder->nentries > 0 && tr_kv_compare(builder->lastkey, builder->lastlen, key, keylen) >= 0) {
+        return trstatus_argument;
+    }
+
+    builder->status = tr_btree_stage(builder, 0, key, keylen, value, true);
+    memcpy(builder->lastkey, key, keylen);
+    builder->lastlen = keylen;
+    builder->nentries++;
+    return builder->status;
+}
+
+trstatus tr_btree_build_finish(trbtbuilder *builder)
+{
+    trbtree *tree = builder->tree;
+    trstatus status = builder->status;
+    trpageno root = 0;
+    unsigned height = 0;
+
+    // Write what's left at each level, bottom up, until a level is down to
+    // the one child which is the root
+    for (unsigned depth = 0; tr_ok(status) && builder->nentries > 0; ++depth) {
+        trbtlevel *level = builder->levels + depth;
+        if (depth > 0 && level->last == 0 && level->count == 1) {
+            root = level->values[0];
+            height = depth;
+            break;
+        }
+
+        while (tr_ok(status) && level->count > 0) {
+            bool leaf = depth == 0;
+            unsigned n = level->count;
+            if (tr_btree_level_size(level, leaf, n, NULL, 0) <= tr_btree_payload) {
+                status = tr_btree_level_write(builder, depth, n, NULL, 0);
+            } else {
+                status = tr_btree_level_flush(builder, depth, n - 1);
+            }
+        }
+    }
+
+    if (tr_ok(status) && builder->nentries > 0) {
+        tree->meta.root = root;
+        tree->meta.height = height;
+        tree->meta.nentries = builder->nentries;
+        tree->meta.nleaves = builder->nleaves;
+        tree->meta.ninner = builder->ninner;
+        atomic_store(&tree->root, root);
+        atomic_store(&tree->nentries, builder->nentries);
+    }
+
+    for (unsigned depth = 0; depth < tr_btree_maxheight; ++depth) {
+        trbtlevel *level = builder->levels + depth;
+        if (level->arena != NULL) {
+            tr_free(level->arena);
+        }
+        if (level->values != NULL) {
+            tr_free(level->values);
+        }
+    }
+
+    return status;
+}
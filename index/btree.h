@@ -0,0 +1,242 @@
+//////////////////////////////////////////////////////////////////////////////
+//
+// Terrascale
+// Copyright (c) Dave Kilian & Emily Kilian 2023. All rights reserved.
+//
+// btree.h - a disk-backed B+tree over buffer pool pages
+//
+// The tree maps byte-string keys, ordered as in kv.h, to 64-bit values
+// (typically row ids), and is meant for secondary indexes. It lives in its
+// own page file (see file.h) and every access goes through a buffer pool
+// (see bufpool.h). Page 0 holds a trbtmeta describing the tree; every other
+// page is a node.
+//
+// A node is a trbtnode header, the node's two fence keys, a slot array, and
+// a heap growing down from the end of the page:
+//
+//     trbtnode | lower fence | upper fence | slots -->    <-- heap
+//
+// The fences bound the keys the node may hold: every key is at least the
+// lower fence and less than the upper fence. Keys in a node therefore all
+// share the fences' common prefix, which is stored once (as the start of
+// the lower fence) and stripped from every key in the node. Only the rest of
+// each key, its suffix, goes on the heap, followed by the entry's value.
+//
+// Each slot holds the offset and length of its suffix and the suffix's first
+// four bytes as a big-endian integer, so a binary search over the slots
+// mostly compares integers in one small array, and only touches the heap to
+// break ties.
+//
+// In inner nodes, each slot holds a separator and the child holding keys
+// less than it (and at least the slot before's); the header's `upper` is the
+// child holding everything else. Separators are truncated when a leaf
+// splits: the separator between two leaves is the shortest prefix of the
+// right one's first key which is greater than the left one's last key, so
+// inner nodes stay small and the tree stays shallow.
+//
+// Leaves are linked to their right siblings, so range scans walk the
+// leaves without going back up the tree.
+//
+// Trees can be bulk built from entries in key order with a trbtbuilder,
+// which fills pages left to right, bottom up, to a given fill factor, and
+// never splits.
+//
+// Deletes just remove entries from their leaf; nodes are never merged, so
+// a page which holds a node always will.
+//
+// Each node is guarded by the optimistic latch of its buffer pool frame
+// (see latch.h), used with optimistic lock coupling:
+//
+// - Lookups and scans descend without writing anything shared but their
+//   pins. At each step they note the child's version and validate the
+//   parent's, and restart from the root if a node changed underneath them.
+//   Scans copy each leaf out and validate the copy before handing its
+//   entries to the caller.
+//
+// - Puts and deletes descend the same way, and latch only their leaf.
+//
+// - A put which must split a leaf takes the tree's split lock and descends
+//   again, latching nodes exclusively, but letting go of everything above
+//   any inner node with room for another separator, since the split can't
+//   reach past it. Every page the split needs is pinned, and every buffer
+//   allocated, before any node changes, so a failure leaves the tree as it
+//   was.
+//
+//////////////////////////////////////////////////////////////////////////////
+
+#pragma once
+
+#include <store/bufpool.h>
+
+// Identifies a tree's meta page ('TRBT')
+#define tr_btree_magic 0x54425254
+
+// Longest key the tree accepts
+#define tr_btree_maxkey 1024
+
+// Most levels a tree may have, including the leaves
+#define tr_btree_maxheight 16
+
+// Describes a whole tree; the payload of page 0
+typedef struct {
+
+    uint32_t magic;         // tr_btree_magic
+    trpageno root;          // The root node
+    uint32_t height;        // Levels, including the leaves
+    uint32_t reserved;      // Reserved; zero
+    uint64_t nentries;      // Entries in the leaves
+    uint64_t nleaves;       // Leaf nodes
+    uint64_t ninner;        // Inner nodes
+
+} trbtmeta;
+
+// Flags in a node header
+typedef enum {
+
+    tr_btnode_leaf  = 0x01, // The node is a leaf
+    tr_btnode_upper = 0x02, // The node has an upper fence (else it's unbounded)
+
+} trbtnodeflags;
+
+// Header at the beginning of every node's payload
+typedef struct {
+
+    uint8_t flags;          // trbtnodeflags
+    uint8_t reserved;       // Reserved; zero
+    uint16_t count;         // Number of slots
+    uint16_t prefixlen;     // Bytes stripped from every key
+    uint16_t lowerlen;      // Length of the lower fence
+    uint16_t upperlen;      // Length of the upper fence
+    uint16_t heap;          // Offset of the start of the heap
+    uint16_t freed;         // Heap bytes of removed entries
+    uint16_t reserved2;     // Reserved; zero
+    trpageno next;          // Leaves: the right sibling, or 0 for none
+    trpageno upper;         // Inner nodes: child for keys past every separator
+
+} trbtnode;
+
+static_assert(sizeof(trbtnode) == 24);
+
+// A slot, pointing at an entry on the heap
+typedef struct {
+
+    uint16_t offset;        // Offset of the key suffix
+    uint16_t length;        // Length of the key suffix
+    uint32_t head;          // First four bytes of the suffix, big-endian
+
+} trbtslot;
+
+// Tree statistics
+typedef struct {
+
+    uint64_t nentries;      // Entries in the leaves
+    uint64_t nleaves;       // Leaf nodes
+    uint64_t ninner;        // Inner nodes
+    unsigned height;        // Levels, including the leaves
+    double leaffill;        // Fraction of leaf page bytes in use
+    double innerfill;       // Fraction of inner page bytes in use
+
+} trbtreestat;
+
+// A B+tree
+typedef struct {
+
+    trbufpool *pool;        // Pool caching the tree's pages
+    trfile *file;           // File holding the tree
+    _Atomic trpageno root;  // The root node
+    _Atomic uint64_t nentries;  // Entries in the leaves
+    pthread_mutex_t splitlock;  // Serializes splits, and protects meta
+    trbtmeta meta;          // The tree's meta page, as of the last split
+    tralloctag tag;         // Tag for temporary buffers
+
+} trbtree;
+
+// Creates an empty tree in an empty file
+trstatus tr_btree_create(trbtree *tree, trbufpool *pool, trfile *file, tralloctag tag);
+
+// Opens a tree in a file written by tr_btree_create and tr_btree_flush.
+// Returns trstatus_corrupt if the file doesn't hold a tree.
+//
+trstatus tr_btree_open(trbtree *tree, trbufpool *pool, trfile *file, tralloctag tag);
+
+// Writes the tree's meta page and flushes all of its pages to disk. For a
+// consistent image on disk, no puts or deletes may run during the flush.
+//
+trstatus tr_btree_flush(trbtree *tree);
+
+// Forgets the tree. Changes since the last flush may be lost.
+void tr_btree_cleanup(trbtree *tree);
+
+// Looks up a key. Returns trstatus_not_found if it isn't in the tree.
+trstatus tr_btree_get(trbtree *tree, const void *key, unsigned keylen, uint64_t *value);
+
+// Inserts a key, or replaces its value if it's already there. Returns
+// trstatus_too_large if the key is longer than tr_btree_maxkey.
+//
+trstatus tr_btree_put(trbtree *tree, const void *key, unsigned keylen, uint64_t value);
+
+// Removes a key. Returns trstatus_not_found if it isn't in the tree.
+trstatus tr_btree_delete(trbtree *tree, const void *key, unsigned keylen);
+
+// Called for each entry of a scan, in key order. Returns false to stop.
+typedef bool trbtscanfn(const void *key, unsigned keylen, uint64_t value, void *context);
+
+// Calls `fn` for each entry with a key at or after `from`, in key order,
+// until it returns false or the entries run out
+//
+trstatus tr_btree_scan(trbtree *tree, const void *from, unsigned fromlen,
+        trbtscanfn *fn, void *context);
+
+// Gets the tree's statistics, walking every node to measure how full they
+// are
+//
+trstatus tr_btree_stat(trbtree *tree, trbtreestat *stat);
+
+// Entries staged for one level of a bulk build
+typedef struct {
+
+    uint8_t *arena;         // Staged keys
+    unsigned arenasize;     // Bytes of the arena in use
+    unsigned arenacap;      // Capacity of the arena
+    uint32_t *offsets;      // Offset of each staged key in the arena
+    uint16_t *lengths;      // Length of each staged key
+    uint64_t *values;       // Value (or child) of each staged entry
+    unsigned count;         // Number of staged entries
+    unsigned capacity;      // Capacity of the arrays
+    uint8_t lower[tr_btree_maxkey];     // Lower fence of the next node
+    unsigned lowerlen;
+    trpageno last;          // Last node written at this level, or 0
+
+} trbtlevel;
+
+// Builds a tree bottom up from entries in key order
+typedef struct {
+
+    trbtree *tree;          // The tree being built
+    unsigned limit;         // Bytes to fill each node to
+    trbtlevel levels[tr_btree_maxheight];
+    uint8_t lastkey[tr_btree_maxkey];   // The last key added
+    unsigned lastlen;
+    uint64_t nentries;      // Entries added
+    uint64_t nleaves;       // Nodes written
+    uint64_t ninner;
+    trstatus status;        // The first failure, if any
+
+} trbtbuilder;
+
+// Starts bulk building a tree, which must be empty, filling each node to
+// `fill` (between 0.5 and 1) of its page
+//
+trstatus tr_btree_build_begin(trbtbuilder *builder, trbtree *tree, double fill);
+
+// Adds the next entry. Keys must be strictly increasing; returns
+// trstatus_argument otherwise, or trstatus_too_large if the key is longer
+// than tr_btree_maxkey.
+//
+trstatus tr_btree_build_add(trbtbuilder *builder, const void *key, unsigned keylen, uint64_t value);
+
+// Writes the nodes still being filled and the tree's new root, and frees
+// the builder's buffers. Returns the first failure of the build, if any, in
+// which case the tree is left empty.
+//
+trstatus tr_btree_build_finish(trbtbuilder *builder);
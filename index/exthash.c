@@ -0,0 +1,325 @@
+//////////////////////////////////////////////////////////////////////////////
+//
+// Terrascale
+// Copyright (c) Dave Kilian & Emily Kilian 2023. All rights reserved.
+//
+//////////////////////////////////////////////////////////////////////////////
+
+#include <pch.h>
+#include <index/exthash.h>
+#include <runtime/hash.h>
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+#endif
+
+static_assert(tr_exthash_slots == 32);
+
+// The fingerprint of a hash comes from its low bits, which the directory
+// doesn't use until it's very deep
+//
+static inline uint8_t tr_exthash_fingerprint(uint64_t hash)
+{
+    return 0x80 | (hash & 0x7f);
+}
+
+// Gets a mask of the slots whose fingerprints equal `fingerprint` (0 finds
+// the empty slots)
+//
+static inline uint32_t tr_exthash_match(const trexthashbucket *bucket, uint8_t fingerprint)
+{
+#if defined(__x86_64__)
+    // SSE2 is always there on x86-64; two compares cover 32 slots
+    __m128i needle = _mm_set1_epi8((char)fingerprint);
+    __m128i lo = _mm_load_si128((const __m128i *)bucket->fingerprints);
+    __m128i hi = _mm_load_si128((const __m128i *)(bucket->fingerprints + 16));
+    uint32_t mlo = (uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi8(lo, needle));
+    uint32_t mhi = (uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi8(hi, needle));
+    return mlo | mhi << 16;
+#else
+    uint32_t mask = 0;
+    for (unsigned i = 0; i < tr_exthash_slots; ++i) {
+        mask |= (uint32_t)(bucket->fingerprints[i] == fingerprint) << i;
+    }
+    return mask;
+#endif
+}
+
+// Finds a key's slot in a bucket, or returns -1
+static inline int tr_exthash_find(const trexthashbucket *bucket, uint64_t key, uint64_t hash)
+{
+    uint32_t mask = tr_exthash_match(bucket, tr_exthash_fingerprint(hash));
+    while (mask != 0) {
+        int slot = __builtin_ctz(mask);
+        if (bucket->entries[slot].key == key) {
+            return slot;
+        }
+        mask &= mask - 1;
+    }
+
+    return -1;
+}
+
+// Whether an entry of the old directory has been copied to the new one
+static inline bool tr_exthash_migrated(const trexthash *table, size_t i)
+{
+    return i < table->cursor || table->old[i] == NULL;
+}
+
+// Gets the bucket for a hash
+static inline trexthashbucket *tr_exthash_bucket(const trexthash *table, uint64_t hash)
+{
+    size_t j = table->depth == 0 ? 0 : hash >> (64 - table->depth);
+    if (table->old != NULL && !tr_exthash_migrated(table, j >> 1)) {
+        return table->old[j >> 1];
+    }
+
+    return table->dir[j];
+}
+
+static trexthashbucket *tr_exthash_new_bucket(trexthash *table, unsigned depth)
+{
+    trexthashbucket *bucket = tr_alloc_aligned(sizeof(trexthashbucket), 64, table->tag);
+    if (bucket == NULL) {
+        return NULL;
+    }
+
+    memset(bucket, 0, sizeof(*bucket));
+    bucket->depth = depth;
+    table->nbuckets++;
+    return bucket;
+}
+
+trstatus tr_exthash_initialize(trexthash *table, tralloctag tag)
+{
+    memset(table, 0, sizeof(*table));
+    table->tag = tag;
+
+    table->dir = tr_alloc(sizeof(trexthashbucket *), tag);
+    if (table->dir == NULL) {
+        return trstatus_no_mem;
+    }
+
+    table->dir[0] = tr_exthash_new_bucket(table, 0);
+    if (table->dir[0] == NULL) {
+        tr_free(table->dir);
+        return trstatus_no_mem;
+    }
+
+    return trstatus_ok;
+}
+
+// Copies one entry of the old directory to its two places in the new one
+static inline void tr_exthash_migrate_one(trexthash *table, size_t i)
+{
+    table->dir[2 * i] = table->old[i];
+    table->dir[2 * i + 1] = table->old[i];
+    table->old[i] = NULL;
+}
+
+// Copies up to `count` more entries of the old directory, and drops it once
+// every entry is copied
+//
+static void tr_exthash_migrate(trexthash *table, size_t count)
+{
+    size_t size = (size_t)1 << (table->depth - 1);
+    for (; table->cursor < size && count > 0; ++table->cursor, --count) {
+        if (table->old[table->cursor] != NULL) {
+            tr_exthash_migrate_one(table, table->cursor);
+        }
+    }
+
+    if (table->cursor == size) {
+        tr_free(table->old);
+        table->old = NULL;
+    }
+}
+
+void tr_exthash_cleanup(trexthash *table)
+{
+    if (table->old != NULL) {
+        tr_exthash_migrate(table, SIZE_MAX);
+    }
+
+    // A bucket of depth d fills an aligned run of 2^(depth - d) entries;
+    // free it once, and skip the rest of its run
+    size_t size = (size_t)1 << table->depth;
+    for (size_t j = 0; j < size;) {
+        trexthashbucket *bucket = table->dir[j];
+        unsigned depth = bucket->depth;
+        tr_free(bucket);
+        j += (size_t)1 << (table->depth - depth);
+    }
+
+    tr_free(table->dir);
+}
+
+trstatus tr_exthash_get(const trexthash *table, uint64_t key, uint64_t *value)
+{
+    uint64_t hash = tr_hash_u64(key);
+    const trexthashbucket *bucket = tr_exthash_bucket(table, hash);
+    int slot = tr_exthash_find(bucket, key, hash);
+    if (slot < 0) {
+        return trstatus_not_found;
+    }
+
+    *value = bucket->entries[slot].value;
+    return trstatus_ok;
+}
+
+// Starts doubling the directory. Any doubling still in progress is
+// finished first.
+//
+static trstatus tr_exthash_double(trexthash *table)
+{
+    if (table->depth == tr_exthash_maxdepth) {
+        return trstatus_too_large;
+    }
+    if (table->old != NULL) {
+        tr_exthash_migrate(table, SIZE_MAX);
+    }
+
+    trexthashbucket **dir = tr_alloc(sizeof(trexthashbucket *) << (table->depth + 1), table->tag);
+    if (dir == NULL) {
+        return trstatus_no_mem;
+    }
+
+    // A one-entry directory is copied at once
+    table->old = table->dir;
+    table->dir = dir;
+    table->depth++;
+    table->cursor = 0;
+    table->ndoublings++;
+    if (table->depth == 1) {
+        tr_exthash_migrate(table, 1);
+    }
+
+    return trstatus_ok;
+}
+
+// Points `count` directory entries from `first` at a bucket. The range is
+// aligned to its size, which is a power of two.
+//
+static void tr_exthash_point(trexthash *table, size_t first, size_t count, trexthashbucket *bucket)
+{
+    for (size_t j = first; j < first + count; ++j) {
+        if (table->old == NULL) {
+            table->dir[j] = bucket;
+            continue;
+        }
+
+        // A single entry can't be expressed in the old directory, which
+        // only has one entry for each pair in the new one
+        size_t i = j >> 1;
+        if (count == 1 && !tr_exthash_migrated(table, i)) {
+            tr_exthash_migrate_one(table, i);
+        }
+
+        if (tr_exthash_migrated(table, i)) {
+            table->dir[j] = bucket;
+        } else if ((j & 1) == 0) {
+            table->old[i] = bucket;
+        }
+    }
+}
+
+// Splits the bucket holding a hash in two, by the next bit of the hashes
+static trstatus tr_exthash_split(trexthash *table, uint64_t hash)
+{
+    trexthashbucket *bucket = tr_exthash_bucket(table, hash);
+    if (bucket->depth == table->depth) {
+        trstatus status = tr_exthash_double(table);
+        if (!tr_ok(status)) {
+            return status;
+        }
+    }
+
+    unsigned depth = bucket->depth;
+    trexthashbucket *split = tr_exthash_new_bucket(table, depth + 1);
+    if (split == NULL) {
+        return trstatus_no_mem;
+    }
+
+    // Entries with the next bit set move to the new bucket, keeping their
+    // slots, so the fingerprints just move with them
+    uint64_t bit = (uint64_t)1 << (63 - depth);
+    for (unsigned i = 0; i < tr_exthash_slots; ++i) {
+        if (bucket->fingerprints[i] != 0 && (tr_hash_u64(bucket->entries[i].key) & bit)) {
+            split->fingerprints[i] = bucket->fingerprints[i];
+            split->entries[i] = bucket->entries[i];
+            split->count++;
+            bucket->fingerprints[i] = 0;
+            bucket->count--;
+        }
+    }
+    bucket->depth = depth + 1;
+
+    // The bucket's directory entries are an aligned run; the upper half of
+    // it now belongs to the new bucket
+    size_t run = (size_t)1 << (table->depth - depth);
+    size_t first = (depth == 0 ? 0 : hash >> (64 - depth)) * run;
+    tr_exthash_point(table, first + run / 2, run / 2, split);
+    table->nsplits++;
+    return trstatus_ok;
+}
+
+trstatus tr_exthash_put(trexthash *table, uint64_t key, uint64_t value)
+{
+    if (table->old != NULL) {
+        tr_exthash_migrate(table, tr_exthash_migratestep);
+    }
+
+    uint64_t hash = tr_hash_u64(key);
+    for (;;) {
+        trexthashbucket *bucket = tr_exthash_bucket(table, hash);
+        int slot = tr_exthash_find(bucket, key, hash);
+        if (slot >= 0) {
+            bucket->entries[slot].value = value;
+            return trstatus_ok;
+        }
+
+        uint32_t empty = tr_exthash_match(bucket, 0);
+        if (empty != 0) {
+            slot = __builtin_ctz(empty);
+            bucket->fingerprints[slot] = tr_exthash_fingerprint(hash);
+            bucket->entries[slot] = (trexthashentry){ key, value };
+            bucket->count++;
+            table->nentries++;
+            return trstatus_ok;
+        }
+
+        // Split until the key's bucket has room; usually once
+        trstatus status = tr_exthash_split(table, hash);
+        if (!tr_ok(status)) {
+            return status;
+        }
+    }
+}
+
+trstatus tr_exthash_delete(trexthash *table, uint64_t key)
+{
+    uint64_t hash = tr_hash_u64(key);
+    trexthashbucket *bucket = tr_exthash_bucket(table, hash);
+    int slot = tr_exthash_find(bucket, key, hash);
+    if (slot < 0) {
+        return trstatus_not_found;
+    }
+
+    bucket->fingerprints[slot] = 0;
+    bucket->count--;
+    table->nentries--;
+    return trstatus_ok;
+}
+
+trexthashstat tr_exthash_stat(const trexthash *table)
+{
+    trexthashstat stat = {
+        .nentries = table->nentries,
+        .nbuckets = table->nbuckets,
+        .depth = table->depth,
+        .load = (double)table->nentries / ((double)table->nbuckets * tr_exthash_slots),
+        .nsplits = table->nsplits,
+        .ndoublings = table->ndoublings,
+    };
+    return stat;
+}
@@ -0,0 +1,119 @@
+//////////////////////////////////////////////////////////////////////////////
+//
+// Terrascale
+// Copyright (c) Dave Kilian & Emily Kilian 2023. All rights reserved.
+//
+// exthash.h - an in-memory extendible hash index
+//
+// The table maps 64-bit keys (tile ids, object ids) to 64-bit values, for
+// equality lookups which don't need the order a B+tree keeps. A lookup
+// hashes the key, uses the top bits of the hash to index a directory of
+// bucket pointers, and probes one cache-aligned bucket. It touches a
+// directory entry, the bucket's fingerprints and the matching entry, so
+// three cache misses at most, whatever the table's size.
+//
+// Each bucket holds tr_exthash_slots entries, and a one-byte fingerprint of
+// each entry's hash, with 0 marking an empty slot. A probe compares the
+// key's fingerprint against all the bucket's fingerprints at once with
+// SIMD, and only compares keys of slots whose fingerprints match, which
+// for a full bucket is the key's own slot and rarely any other.
+//
+// Growth never rehashes the whole table:
+//
+// - A bucket which overflows is split on its own: its entries are divided
+//   by the next bit of their hashes between it and a new bucket, and the
+//   directory entries which pointed at it are divided between the two.
+//
+// - When a bucket which needs splitting is already indexed by every bit
+//   the directory uses, the directory doubles. The new directory is filled
+//   in incrementally: each later insert copies a few more of the old
+//   directory's entries across, and lookups in the meantime read whichever
+//   of the two directories holds the entry they need. A split which needs
+//   an entry not yet copied copies that one entry straight away.
+//
+// Deletes just empty their slot; buckets are never merged.
+//
+// The table isn't synchronized. Lookups may run in parallel with each
+// other, but writers must be serialized against everything else.
+//
+//////////////////////////////////////////////////////////////////////////////
+
+#pragma once
+
+// Entries in each bucket
+#define tr_exthash_slots 32
+
+// Most bits of the hash the directory may use
+#define tr_exthash_maxdepth 28
+
+// Old directory entries copied across by each insert while doubling
+#define tr_exthash_migratestep 64
+
+// An entry; the key and value share a cache line
+typedef struct {
+
+    uint64_t key;
+    uint64_t value;
+
+} trexthashentry;
+
+// A bucket of entries
+typedef struct {
+
+    uint8_t fingerprints[tr_exthash_slots]; // Per slot: 0 if empty, else 0x80 | hash bits
+    trexthashentry entries[tr_exthash_slots];
+    uint8_t depth;          // Leading hash bits all its entries share
+    uint8_t count;          // Number of entries
+
+} trexthashbucket;
+
+// Table statistics
+typedef struct {
+
+    uint64_t nentries;      // Entries in the table
+    uint64_t nbuckets;      // Buckets allocated
+    unsigned depth;         // Hash bits the directory uses
+    double load;            // Fraction of bucket slots in use
+    uint64_t nsplits;       // Bucket splits so far
+    uint64_t ndoublings;    // Directory doublings so far
+
+} trexthashstat;
+
+// An extendible hash table
+typedef struct {
+
+    trexthashbucket **dir;  // The directory, of 2^depth bucket pointers
+    unsigned depth;         // Hash bits the directory uses
+
+    trexthashbucket **old;  // While doubling, the previous directory, else NULL
+    size_t cursor;          // Entries of the old directory copied so far
+
+    uint64_t nentries;      // Statistics
+    uint64_t nbuckets;
+    uint64_t nsplits;
+    uint64_t ndoublings;
+
+    tralloctag tag;         // Tag for the directory and buckets
+
+} trexthash;
+
+// Initializes an empty table
+trstatus tr_exthash_initialize(trexthash *table, tralloctag tag);
+
+// Frees the table's directory and buckets
+void tr_exthash_cleanup(trexthash *table);
+
+// Looks up a key. Returns trstatus_not_found if it isn't in the table.
+trstatus tr_exthash_get(const trexthash *table, uint64_t key, uint64_t *value);
+
+// Inserts a key, or replaces its value if it's already there. Returns
+// trstatus_too_large if the directory would have to grow beyond
+// tr_exthash_maxdepth bits.
+//
+trstatus tr_exthash_put(trexthash *table, uint64_t key, uint64_t value);
+
+// Removes a key. Returns trstatus_not_found if it isn't in the table.
+trstatus tr_exthash_delete(trexthash *table, uint64_t key);
+
+// Gets the table's statistics
+trexthashstat tr_exthash_stat(const trexthash *table);
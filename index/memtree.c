@@ -0,0 +1,478 @@
+//////////////////////////////////////////////////////////////////////////////
+//
+// Terrascale
+// Copyright (c) Dave Kilian & Emily Kilian 2023. All rights reserved.
+//
+//////////////////////////////////////////////////////////////////////////////
+
+#include <pch.h>
+#include <index/memtree.h>
+
+static trmtleaf *tr_memtree_new_leaf(trmemtree *tree)
+{
+    trmtleaf *leaf = tr_alloc(sizeof(trmtleaf), tree->tag);
+    if (leaf == NULL) {
+        return NULL;
+    }
+
+    memset(leaf, 0, sizeof(*leaf));
+    tr_latch_initialize(&leaf->node.latch);
+    leaf->node.leaf = true;
+    atomic_fetch_add_explicit(&tree->nleaves, 1, memory_order_relaxed);
+    return leaf;
+}
+
+static trmtinner *tr_memtree_new_inner(trmemtree *tree)
+{
+    trmtinner *inner = tr_alloc(sizeof(trmtinner), tree->tag);
+    if (inner == NULL) {
+        return NULL;
+    }
+
+    memset(inner, 0, sizeof(*inner));
+    tr_latch_initialize(&inner->node.latch);
+    atomic_fetch_add_explicit(&tree->ninner, 1, memory_order_relaxed);
+    return inner;
+}
+
+// Frees a node that was never linked into the tree
+static void tr_memtree_free_new(trmemtree *tree, trmtnode *node)
+{
+    atomic_fetch_sub_explicit(node->leaf ? &tree->nleaves : &tree->ninner, 1,
+        memory_order_relaxed);
+    tr_free(node);
+}
+
+trstatus tr_memtree_initialize(trmemtree *tree, tralloctag tag)
+{
+    tree->tag = tag;
+    atomic_init(&tree->nleaves, 0);
+    atomic_init(&tree->ninner, 0);
+    atomic_init(&tree->height, 1);
+
+    trmtleaf *root = tr_memtree_new_leaf(tree);
+    if (root == NULL) {
+        return trstatus_no_mem;
+    }
+
+    atomic_init(&tree->root, &root->node);
+    return trstatus_ok;
+}
+
+static void tr_memtree_free(trmtnode *node)
+{
+    if (!node->leaf) {
+        trmtinner *inner = (trmtinner *)node;
+        for (unsigned i = 0; i <= inner->node.count; ++i) {
+            tr_memtree_free(inner->children[i]);
+        }
+    }
+
+    tr_free(node);
+}
+
+void tr_memtree_cleanup(trmemtree *tree)
+{
+    tr_memtree_free(atomic_load_explicit(&tree->root, memory_order_relaxed));
+}
+
+// Finds the first of `count` sorted keys which is at least `key`
+static unsigned tr_memtree_lower(const uint64_t *keys, unsigned count, uint64_t key)
+{
+    unsigned lo = 0;
+    unsigned hi = count;
+
+    while (lo < hi) {
+        unsigned mid = (lo + hi) / 2;
+        if (keys[mid] < key) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+
+    return lo;
+}
+
+// Key counts read optimistically may be torn; these keep them in bounds
+// until the read is validated
+//
+static inline unsigned tr_memtree_leafcount(trmtleaf *leaf)
+{
+    return min(leaf->node.count, (unsigned)tr_memtree_fanout);
+}
+
+static inline unsigned tr_memtree_innercount(trmtinner *inner)
+{
+    return min(inner->node.count, (unsigned)tr_memtree_fanout - 1);
+}
+
+// Starts an optimistic read of the root, returning NULL if the caller must
+// restart because the root was replaced in the meantime
+//
+static trmtnode *tr_memtree_read_root(trmemtree *tree, uint64_t *version)
+{
+    trmtnode *root = atomic_load_explicit(&tree->root, memory_order_acquire);
+    if (!tr_latch_read(&root->latch, version) ||
+        root != atomic_load_explicit(&tree->root, memory_order_acquire)) {
+        return NULL;
+    }
+
+    return root;
+}
+
+// Starts reading a child found in an inner node. The inner node is
+// validated before the child pointer is trusted, and again once the child's
+// version is noted, since a split of the child in between would have
+// locked the inner node too. Returns false if the caller must restart.
+//
+static bool tr_memtree_couple(trmtnode *inner, uint64_t version,
+        trmtnode *child, uint64_t *childversion)
+{
+    return tr_latch_validate(&inner->latch, version) &&
+        tr_latch_read(&child->latch, childversion) &&
+        tr_latch_validate(&inner->latch, version);
+}
+
+// One step down the tree: finds the child of an inner node which could hold
+// the key and starts reading it. Returns NULL if the caller must restart.
+//
+static trmtnode *tr_memtree_descend(trmtinner *inner, uint64_t version,
+        uint64_t key, uint64_t *childversion)
+{
+    unsigned pos = tr_memtree_lower(inner->keys, tr_memtree_innercount(inner), key);
+    trmtnode *child = inner->children[pos];
+
+    if (!tr_memtree_couple(&inner->node, version, child, childversion)) {
+        return NULL;
+    }
+
+    return child;
+}
+
+trstatus tr_memtree_get(trmemtree *tree, uint64_t key, uint64_t *value)
+{
+restart:;
+    uint64_t v;
+    trmtnode *node = tr_memtree_read_root(tree, &v);
+    if (node == NULL) {
+        goto restart;
+    }
+
+    while (!node->leaf) {
+        node = tr_memtree_descend((trmtinner *)node, v, key, &v);
+        if (node == NULL) {
+            goto restart;
+        }
+    }
+
+    trmtleaf *leaf = (trmtleaf *)node;
+    unsigned count = tr_memtree_leafcount(leaf);
+    unsigned pos = tr_memtree_lower(leaf->keys, count, key);
+    bool found = pos < count && leaf->keys[pos] == key;
+    uint64_t result = found ? leaf->values[pos] : 0;
+
+    if (!tr_latch_validate(&node->latch, v)) {
+        goto restart;
+    }
+
+    if (!found) {
+        return trstatus_not_found;
+    }
+
+    *value = result;
+    return trstatus_ok;
+}
+
+// Moves the upper half of a full leaf into a new right sibling, returning
+// the largest key left behind. Called with the leaf locked.
+//
+static uint64_t tr_memtree_split_leaf(trmtleaf *leaf, trmtleaf *right)
+{
+    unsigned count = leaf->node.count;
+    unsigned left = count / 2;
+
+    right->node.count = count - left;
+    memcpy(right->keys, leaf->keys + left, right->node.count * sizeof(uint64_t));
+    memcpy(right->values, leaf->values + left, right->node.count * sizeof(uint64_t));
+    leaf->node.count = left;
+
+    return leaf->keys[left - 1];
+}
+
+// Moves the upper half of a full inner node into a new right sibling,
+// returning the separator key between them, which is pushed up into the
+// parent. Called with the node locked.
+//
+static uint64_t tr_memtree_split_inner(trmtinner *inner, trmtinner *right)
+{
+    unsigned count = inner->node.count;
+    unsigned left = count / 2;
+    uint64_t separator = inner->keys[left];
+
+    right->node.count = count - left - 1;
+    memcpy(right->keys, inner->keys + left + 1, right->node.count * sizeof(uint64_t));
+    memcpy(right->children, inner->children + left + 1,
+        (right->node.count + 1) * sizeof(trmtnode *));
+    inner->node.count = left;
+
+    return separator;
+}
+
+// Adds a new child to the right of the one holding keys up to `separator`.
+// Called with the node locked; it mustn't be full.
+//
+static void tr_memtree_insert_inner(trmtinner *inner, uint64_t separator, trmtnode *child)
+{
+    unsigned count = inner->node.count;
+    unsigned pos = tr_memtree_lower(inner->keys, count, separator);
+
+    memmove(inner->keys + pos + 1, inner->keys + pos, (count - pos) * sizeof(uint64_t));
+    memmove(inner->children + pos + 2, inner->children + pos + 1,
+        (count - pos) * sizeof(trmtnode *));
+    inner->keys[pos] = separator;
+    inner->children[pos + 1] = child;
+    inner->node.count = count + 1;
+}
+
+// Splits a full node, which the caller has read at the given version, and
+// whose parent (if any) it has read at `pv`. Either way, the caller
+// restarts afterwards.
+//
+static trstatus tr_memtree_split(trmemtree *tree, trmtnode *parent, uint64_t pv,
+        trmtnode *node, uint64_t v)
+{
+    if (parent != NULL && !tr_latch_upgrade(&parent->latch, pv)) {
+        return trstatus_ok;
+    }
+
+    if (!tr_latch_upgrade(&node->latch, v)) {
+        if (parent != NULL) {
+            tr_latch_unlock(&parent->latch);
+        }
+        return trstatus_ok;
+    }
+
+    // Without a parent, the node had better still be the root
+    if (parent == NULL && node != atomic_load_explicit(&tree->root, memory_order_relaxed)) {
+        tr_latch_unlock(&node->latch);
+        return trstatus_ok;
+    }
+
+    // Allocate everything first, so failure leaves the tree alone
+    trmtnode *right = node->leaf ?
+        (trmtnode *)tr_memtree_new_leaf(tree) : (trmtnode *)tr_memtree_new_inner(tree);
+    trmtinner *root = parent == NULL ? tr_memtree_new_inner(tree) : NULL;
+
+    if (right == NULL || (parent == NULL && root == NULL)) {
+        if (right != NULL) tr_memtree_free_new(tree, right);
+        if (root != NULL) tr_memtree_free_new(tree, &root->node);
+
+        tr_latch_unlock(&node->latch);
+        if (parent != NULL) {
+            tr_latch_unlock(&parent->latch);
+        }
+        return trstatus_no_mem;
+    }
+
+    uint64_t separator = node->leaf ?
+        tr_memtree_split_leaf((trmtleaf *)node, (trmtleaf *)right) :
+        tr_memtree_split_inner((trmtinner *)node, (trmtinner *)right);
+
+    if (parent != NULL) {
+        tr_memtree_insert_inner((trmtinner *)parent, separator, right);
+    } else {
+        root->keys[0] = separator;
+        root->children[0] = node;
+        root->children[1] = right;
+        root->node.count = 1;
+        atomic_store_explicit(&tree->root, &root->node, memory_order_release);
+        atomic_fetch_add_explicit(&tree->height, 1, memory_order_relaxed);
+    }
+
+    tr_latch_unlock(&node->latch);
+    if (parent != NULL) {
+        tr_latch_unlock(&parent->latch);
+    }
+    return trstatus_ok;
+}
+
+trstatus tr_memtree_put(trmemtree *tree, uint64_t key, uint64_t value)
+{
+restart:;
+    uint64_t v;
+    trmtnode *node = tr_memtree_read_root(tree, &v);
+    if (node == NULL) {
+        goto restart;
+    }
+
+    trmtnode *parent = NULL;
+    uint64_t pv = 0;
+
+    for (;;) {
+
+        // Split full nodes on the way down, so there's always room in the
+        // parent for a split below it
+        unsigned full = node->leaf ? tr_memtree_fanout : tr_memtree_fanout - 1;
+        if (node->count >= full) {
+            trstatus s = tr_memtree_split(tree, parent, pv, node, v);
+            if (tr_failed(s)) {
+                return s;
+            }
+            goto restart;
+        }
+
+        if (node->leaf) {
+            break;
+        }
+
+        if (parent != NULL && !tr_latch_validate(&parent->latch, pv)) {
+            goto restart;
+        }
+
+        parent = node;
+        pv = v;
+        node = tr_memtree_descend((trmtinner *)node, v, key, &v);
+        if (node == NULL) {
+            goto restart;
+        }
+    }
+
+    if (!tr_latch_upgrade(&node->latch, v)) {
+        goto restart;
+    }
+
+    if (parent != NULL && !tr_latch_validate(&parent->latch, pv)) {
+        tr_latch_unlock(&node->latch);
+        goto restart;
+    }
+
+    trmtleaf *leaf = (trmtleaf *)node;
+    unsigned count = leaf->node.count;
+    unsigned pos = tr_memtree_lower(leaf->keys, count, key);
+
+    if (pos < count && leaf->keys[pos] == key) {
+        leaf->values[pos] = value;
+    } else {
+        memmove(leaf->keys + pos + 1, leaf->keys + pos, (count - pos) * sizeof(uint64_t));
+        memmove(leaf->values + pos + 1, leaf->values + pos, (count - pos) * sizeof(uint64_t));
+        leaf->keys[pos] = key;
+        leaf->values[pos] = value;
+        leaf->node.count = count + 1;
+    }
+
+    tr_latch_unlock(&node->latch);
+    return trstatus_ok;
+}
+
+trstatus tr_memtree_delete(trmemtree *tree, uint64_t key)
+{
+restart:;
+    uint64_t v;
+    trmtnode *node = tr_memtree_read_root(tree, &v);
+    if (node == NULL) {
+        goto restart;
+    }
+
+    while (!node->leaf) {
+        node = tr_memtree_descend((trmtinner *)node, v, key, &v);
+        if (node == NULL) {
+            goto restart;
+        }
+    }
+
+    // Only the leaf changes, so only its latch matters
+    if (!tr_latch_upgrade(&node->latch, v)) {
+        goto restart;
+    }
+
+    trmtleaf *leaf = (trmtleaf *)node;
+    unsigned count = leaf->node.count;
+    unsigned pos = tr_memtree_lower(leaf->keys, count, key);
+    bool found = pos < count && leaf->keys[pos] == key;
+
+    if (found) {
+        memmove(leaf->keys + pos, leaf->keys + pos + 1, (count - pos - 1) * sizeof(uint64_t));
+        memmove(leaf->values + pos, leaf->values + pos + 1, (count - pos - 1) * sizeof(uint64_t));
+        leaf->node.count = count - 1;
+    }
+
+    tr_latch_unlock(&node->latch);
+    return found ? trstatus_ok : trstatus_not_found;
+}
+
+unsigned tr_memtree_scan(trmemtree *tree, uint64_t from,
+        uint64_t *keys, uint64_t *values, unsigned capacity)
+{
+    unsigned n = 0;
+
+    while (n < capacity) {
+
+        // Descend to the leaf holding `from`, noting the smallest
+        // separator above it, which bounds the leaf's keys
+        bool bounded;
+        uint64_t upper;
+        trmtnode *node;
+        uint64_t v;
+
+    restart:
+        bounded = false;
+        upper = 0;
+        node = tr_memtree_read_root(tree, &v);
+        if (node == NULL) {
+            goto restart;
+        }
+
+        while (!node->leaf) {
+            trmtinner *inner = (trmtinner *)node;
+            unsigned count = tr_memtree_innercount(inner);
+            unsigned pos = tr_memtree_lower(inner->keys, count, from);
+            uint64_t bound = inner->keys[min(pos, (unsigned)tr_memtree_fanout - 2)];
+            trmtnode *child = inner->children[pos];
+
+            uint64_t childversion;
+            if (!tr_memtree_couple(node, v, child, &childversion)) {
+                goto restart;
+            }
+            if (pos < count) {
+                bounded = true;
+                upper = bound;
+            }
+
+            node = child;
+            v = childversion;
+        }
+
+        // Copy the leaf's entries, and keep them only if the leaf didn't
+        // change meanwhile
+        trmtleaf *leaf = (trmtleaf *)node;
+        unsigned count = tr_memtree_leafcount(leaf);
+        unsigned pos = tr_memtree_lower(leaf->keys, count, from);
+        unsigned copied = min(count - pos, capacity - n);
+        for (unsigned i = 0; i < copied; ++i) {
+            keys[n + i] = leaf->keys[pos + i];
+            values[n + i] = leaf->values[pos + i];
+        }
+
+        if (!tr_latch_validate(&node->latch, v)) {
+            goto restart;
+        }
+
+        n += copied;
+        if (!bounded || upper == UINT64_MAX) {
+            break;
+        }
+        from = upper + 1;
+    }
+
+    return n;
+}
+
+trmemtreestat tr_memtree_stat(trmemtree *tree)
+{
+    trmemtreestat stat;
+    stat.nleaves = atomic_load_explicit(&tree->nleaves, memory_order_relaxed);
+    stat.ninner = atomic_load_explicit(&tree->ninner, memory_order_relaxed);
+    stat.height = atomic_load_explicit(&tree->height, memory_order_relaxed);
+    return stat;
+}
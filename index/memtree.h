@@ -0,0 +1,107 @@
+//////////////////////////////////////////////////////////////////////////////
+//
+// Terrascale
+// Copyright (c) Dave Kilian & Emily Kilian 2023. All rights reserved.
+//
+// memtree.h - an in-memory B+tree with optimistic lock coupling
+//
+// The tree maps 64-bit keys to 64-bit values (typically row ids or
+// pointers). Every node carries an optimistic latch (see latch.h):
+//
+// - Lookups and scans descend without writing anything shared. At each
+//   step they read the child pointer, validate the parent's version, and
+//   note the child's; if a version changed underneath them, they restart
+//   from the root. Many threads can therefore read the tree at once
+//   without bouncing cache lines between their cores.
+//
+// - Writers descend the same way, then upgrade the latch of the leaf they
+//   change. A full node is split on the way down, while holding both it and
+//   its parent, and the writer restarts afterwards.
+//
+// Nodes are never merged or freed while the tree exists: deletes just
+// remove entries from their leaf. So a reader can always safely look at a
+// node it reached, however stale its pointer, and no epoch protection is
+// needed.
+//
+//////////////////////////////////////////////////////////////////////////////
+
+#pragma once
+
+#include <protect/latch.h>
+
+// Entries in a leaf, and children of an inner node
+#define tr_memtree_fanout 64
+
+// Common node header
+typedef struct {
+
+    trlatch latch;          // Protects the node
+    bool leaf;              // Whether the node is a leaf
+    uint16_t count;         // Number of keys in the node
+
+} trmtnode;
+
+// A leaf: sorted keys and their values
+typedef struct {
+
+    trmtnode node;
+    uint64_t keys[tr_memtree_fanout];
+    uint64_t values[tr_memtree_fanout];
+
+} trmtleaf;
+
+// An inner node: children[i] holds keys up to keys[i], and the last child
+// holds the rest
+//
+typedef struct {
+
+    trmtnode node;
+    uint64_t keys[tr_memtree_fanout - 1];
+    trmtnode *children[tr_memtree_fanout];
+
+} trmtinner;
+
+// Tree statistics
+typedef struct {
+
+    uint64_t nleaves;       // Leaf nodes
+    uint64_t ninner;        // Inner nodes
+    unsigned height;        // Levels, including the leaves
+
+} trmemtreestat;
+
+// A B+tree
+typedef struct {
+
+    _Atomic(trmtnode *) root;   // The root node
+    _Atomic uint64_t nleaves;   // Statistics, kept by writers
+    _Atomic uint64_t ninner;
+    _Atomic unsigned height;
+    tralloctag tag;             // Tag for node allocations
+
+} trmemtree;
+
+// Initializes an empty tree
+trstatus tr_memtree_initialize(trmemtree *tree, tralloctag tag);
+
+// Frees every node. Nobody may be using the tree.
+void tr_memtree_cleanup(trmemtree *tree);
+
+// Looks up a key. Returns trstatus_not_found if it isn't in the tree.
+trstatus tr_memtree_get(trmemtree *tree, uint64_t key, uint64_t *value);
+
+// Inserts a key, or replaces its value if it's already there
+trstatus tr_memtree_put(trmemtree *tree, uint64_t key, uint64_t value);
+
+// Removes a key. Returns trstatus_not_found if it isn't in the tree.
+trstatus tr_memtree_delete(trmemtree *tree, uint64_t key);
+
+// Copies up to `capacity` entries with keys at or after `from` into the
+// given arrays, in key order, and returns how many were copied. Each leaf
+// is read consistently, but the scan as a whole isn't atomic.
+//
+unsigned tr_memtree_scan(trmemtree *tree, uint64_t from,
+        uint64_t *keys, uint64_t *values, unsigned capacity);
+
+// Gets the tree's statistics
+trmemtreestat tr_memtree_stat(trmemtree *tree);
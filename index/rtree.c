@@ -0,0 +1,513 @@
+//////////////////////////////////////////////////////////////////////////////
+//
+// Terrascale
+// Copyright (c) Dave Kilian & Emily Kilian 2023. All rights reserved.
+//
+//////////////////////////////////////////////////////////////////////////////
+
+#include <pch.h>
+#include <index/rtree.h>
+
+static_assert(tr_rtree_fanout <= 32);
+static_assert(2 * tr_rtree_minfill <= tr_rtree_fanout + 1);
+
+// Gets slot i's rectangle
+static inline trrect tr_rtree_rect(const trrtnode *node, unsigned i)
+{
+    return (trrect){ node->minx[i], node->miny[i], node->maxx[i], node->maxy[i] };
+}
+
+static inline void tr_rtree_setrect(trrtnode *node, unsigned i, trrect r)
+{
+    node->minx[i] = r.minx;
+    node->miny[i] = r.miny;
+    node->maxx[i] = r.maxx;
+    node->maxy[i] = r.maxy;
+}
+
+// Gets slot i as an entry, with a child pointer as the value
+static inline trrtentry tr_rtree_slot(const trrtnode *node, unsigned i)
+{
+    uint64_t value = node->level > 0 ? (uint64_t)(uintptr_t)node->children[i] : node->values[i];
+    return (trrtentry){ tr_rtree_rect(node, i), value };
+}
+
+static inline void tr_rtree_setslot(trrtnode *node, unsigned i, const trrtentry *entry)
+{
+    tr_rtree_setrect(node, i, entry->rect);
+    if (node->level > 0) {
+        node->children[i] = (trrtnode *)(uintptr_t)entry->value;
+    } else {
+        node->values[i] = entry->value;
+    }
+}
+
+// Adds an entry to a node which has room
+static inline void tr_rtree_add(trrtnode *node, const trrtentry *entry)
+{
+    tr_rtree_setslot(node, node->count++, entry);
+}
+
+// Gets the bounds of a node's rectangles
+static trrect tr_rtree_bounds(const trrtnode *node)
+{
+    trrect r = tr_rect_empty();
+    for (unsigned i = 0; i < node->count; ++i) {
+        r = tr_rect_union(r, tr_rtree_rect(node, i));
+    }
+    return r;
+}
+
+static trrtnode *tr_rtree_new_node(trrtree *tree, unsigned level)
+{
+    trrtnode *node = tr_alloc_aligned(sizeof(trrtnode), 64, tree->tag);
+    if (node == NULL) {
+        return NULL;
+    }
+
+    for (unsigned i = 0; i < tr_rtree_fanout; ++i) {
+        tr_rtree_setrect(node, i, tr_rect_empty());
+        node->values[i] = 0;
+    }
+    node->level = level;
+    node->count = 0;
+    return node;
+}
+
+// Frees a node and everything under it
+static void tr_rtree_free(trrtnode *node)
+{
+    if (node->level > 0) {
+        for (unsigned i = 0; i < node->count; ++i) {
+            tr_rtree_free(node->children[i]);
+        }
+    }
+    tr_free(node);
+}
+
+trstatus tr_rtree_initialize(trrtree *tree, tralloctag tag)
+{
+    memset(tree, 0, sizeof(*tree));
+    tree->tag = tag;
+
+    tree->root = tr_rtree_new_node(tree, 0);
+    if (tree->root == NULL) {
+        return trstatus_no_mem;
+    }
+
+    tree->nleaves = 1;
+    return trstatus_ok;
+}
+
+void tr_rtree_cleanup(trrtree *tree)
+{
+    tr_rtree_free(tree->root);
+}
+
+//
+// Queries
+//
+
+// Gets a mask of a node's slots whose rectangles intersect the window.
+// Covering every slot, with no early exit, lets the loop be vectorized.
+//
+static inline uint32_t tr_rtree_match(const trrtnode *node, trrect window)
+{
+    uint32_t mask = 0;
+    for (unsigned i = 0; i < tr_rtree_fanout; ++i) {
+        bool hit = (node->minx[i] <= window.maxx) & (window.minx <= node->maxx[i]) &
+            (node->miny[i] <= window.maxy) & (window.miny <= node->maxy[i]);
+        mask |= (uint32_t)hit << i;
+    }
+    return mask;
+}
+
+static bool tr_rtree_search_node(const trrtnode *node, trrect window, trrtsearchfn *fn, void *context)
+{
+    uint32_t mask = tr_rtree_match(node, window);
+    while (mask != 0) {
+        unsigned i = __builtin_ctz(mask);
+        mask &= mask - 1;
+        if (node->level > 0) {
+            if (!tr_rtree_search_node(node->children[i], window, fn, context)) {
+                return false;
+            }
+        } else if (!fn(tr_rtree_rect(node, i), node->values[i], context)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+void tr_rtree_search(const trrtree *tree, trrect window, trrtsearchfn *fn, void *context)
+{
+    if (tr_rect_valid(window)) {
+        tr_rtree_search_node(tree->root, window, fn, context);
+    }
+}
+
+//
+// Inserts
+//
+
+// Chooses the child whose bounds grow least to hold a rectangle, and of
+// those the smallest
+//
+static unsigned tr_rtree_choose(const trrtnode *node, trrect rect)
+{
+    unsigned best = 0;
+    double bestgrowth = INFINITY, bestarea = INFINITY;
+    for (unsigned i = 0; i < node->count; ++i) {
+        trrect r = tr_rtree_rect(node, i);
+        double area = tr_rect_area(r);
+        double growth = tr_rect_area(tr_rect_union(r, rect)) - area;
+        if (growth < bestgrowth || (growth == bestgrowth && area < bestarea)) {
+            best = i;
+            bestgrowth = growth;
+            bestarea = area;
+        }
+    }
+    return best;
+}
+
+// Gets coordinate `key` of a rectangle: minx, miny, maxx, maxy for 0 to 3
+static inline double tr_rtree_coord(trrect r, unsigned key)
+{
+    switch (key) {
+    case 0: return r.minx;
+    case 1: return r.miny;
+    case 2: return r.maxx;
+    default: return r.maxy;
+    }
+}
+
+// Sorts entries by one coordinate; there are only a node's worth
+static void tr_rtree_sort(trrtentry *entries, unsigned count, unsigned key)
+{
+    for (unsigned i = 1; i < count; ++i) {
+        trrtentry e = entries[i];
+        double c = tr_rtree_coord(e.rect, key);
+        unsigned j = i;
+        for (; j > 0 && tr_rtree_coord(entries[j - 1].rect, key) > c; --j) {
+            entries[j] = entries[j - 1];
+        }
+        entries[j] = e;
+    }
+}
+
+// Gets the bounds of each prefix and suffix of sorted entries: lower[k]
+// bounds the first k, and upper[k] the rest
+//
+static void tr_rtree_sweep(const trrtentry *entries, unsigned count, trrect *lower, trrect *upper)
+{
+    lower[0] = tr_rect_empty();
+    for (unsigned k = 0; k < count; ++k) {
+        lower[k + 1] = tr_rect_union(lower[k], entries[k].rect);
+    }
+    upper[count] = tr_rect_empty();
+    for (unsigned k = count; k > 0; --k) {
+        upper[k - 1] = tr_rect_union(upper[k], entries[k - 1].rect);
+    }
+}
+
+// Splits a full node's entries and one more between it and an empty
+// sibling on the same level
+//
+static void tr_rtree_split(trrtnode *node, const trrtentry *entry, trrtnode *sibling)
+{
+    const unsigned count = tr_rtree_fanout + 1;
+    trrtentry entries[tr_rtree_fanout + 1];
+    trrect lower[tr_rtree_fanout + 2], upper[tr_rtree_fanout + 2];
+
+    for (unsigned i = 0; i < node->count; ++i) {
+        entries[i] = tr_rtree_slot(node, i);
+    }
+    entries[count - 1] = *entry;
+
+    // The axis where the possible splits' perimeters are least in total,
+    // sorting by both the minimum and the maximum
+    unsigned axis = 0;
+    double bestmargin = INFINITY;
+    for (unsigned a = 0; a < 2; ++a) {
+        double margin = 0;
+        for (unsigned key = a; key < 4; key += 2) {
+            tr_rtree_sort(entries, count, key);
+            tr_rtree_sweep(entries, count, lower, upper);
+            for (unsigned k = tr_rtree_minfill; k <= count - tr_rtree_minfill; ++k) {
+                margin += tr_rect_margin(lower[k]) + tr_rect_margin(upper[k]);
+            }
+        }
+        if (margin < bestmargin) {
+            axis = a;
+            bestmargin = margin;
+        }
+    }
+
+    // On that axis, the split where the halves overlap least, and of those
+    // the one with the least area
+    unsigned bestkey = axis, bestk = tr_rtree_minfill;
+    double bestoverlap = INFINITY, bestarea = INFINITY;
+    for (unsigned key = axis; key < 4; key += 2) {
+        tr_rtree_sort(entries, count, key);
+        tr_rtree_sweep(entries, count, lower, upper);
+        for (unsigned k = tr_rtree_minfill; k <= count - tr_rtree_minfill; ++k) {
+            double overlap = tr_rect_overlap(lower[k], upper[k]);
+            double area = tr_rect_area(lower[k]) + tr_rect_area(upper[k]);
+            if (overlap < bestoverlap || (overlap == bestoverlap && area < bestarea)) {
+                bestkey = key;
+                bestk = k;
+                bestoverlap = overlap;
+                bestarea = area;
+            }
+        }
+    }
+
+    tr_rtree_sort(entries, count, bestkey);
+    for (unsigned i = 0; i < tr_rtree_fanout; ++i) {
+        tr_rtree_setrect(node, i, tr_rect_empty());
+    }
+    node->count = 0;
+    for (unsigned i = 0; i < count; ++i) {
+        tr_rtree_add(i < bestk ? node : sibling, entries + i);
+    }
+}
+
+trstatus tr_rtree_insert(trrtree *tree, trrect rect, uint64_t value)
+{
+    if (!tr_rect_valid(rect)) {
+        return trstatus_argument;
+    }
+
+    // Find the leaf, remembering the path to it
+    trrtnode *path[tr_rtree_maxheight];
+    unsigned slots[tr_rtree_maxheight];
+    unsigned depth = 0;
+    trrtnode *node = tree->root;
+    while (node->level > 0) {
+        path[depth] = node;
+        slots[depth] = tr_rtree_choose(node, rect);
+        node = node->children[slots[depth++]];
+    }
+
+    // Allocate the nodes any splits need first, so that running out of
+    // memory leaves the tree as it was: a sibling for each full node from
+    // the leaf up, and a new root if they're all full
+    unsigned nsplits = 0;
+    while (nsplits <= depth && (nsplits == 0 ? node : path[depth - nsplits])->count == tr_rtree_fanout) {
+        nsplits++;
+    }
+    unsigned nspares = nsplits + (nsplits == depth + 1);
+    if (nspares > tr_rtree_maxheight) {
+        return trstatus_too_large;
+    }
+
+    trrtnode *spares[tr_rtree_maxheight];
+    for (unsigned i = 0; i < nspares; ++i) {
+        spares[i] = tr_rtree_new_node(tree, i);
+        if (spares[i] == NULL) {
+            while (i-- > 0) {
+                tr_free(spares[i]);
+            }
+            return trstatus_no_mem;
+        }
+    }
+
+    trrtentry entry = { rect, value };
+    unsigned used = 0;
+    bool split = false;
+    for (;;) {
+        if (node->count < tr_rtree_fanout) {
+            tr_rtree_add(node, &entry);
+            split = false;
+        } else {
+            trrtnode *sibling = spares[used++];
+            tr_rtree_split(node, &entry, sibling);
+            if (sibling->level == 0) {
+                tree->nleaves++;
+            } else {
+                tree->ninner++;
+            }
+            entry = (trrtentry){ tr_rtree_bounds(sibling), (uint64_t)(uintptr_t)sibling };
+            split = true;
+        }
+
+        if (depth == 0) {
+            break;
+        }
+
+        // A split node may have shrunk; otherwise it grew by the rectangle
+        trrtnode *parent = path[--depth];
+        unsigned i = slots[depth];
+        if (split) {
+            tr_rtree_setrect(parent, i, tr_rtree_bounds(node));
+            node = parent;
+            continue;
+        }
+
+        for (;;) {
+            tr_rtree_setrect(parent, i, tr_rect_union(tr_rtree_rect(parent, i), rect));
+            if (depth == 0) {
+                break;
+            }
+            parent = path[--depth];
+            i = slots[depth];
+        }
+        break;
+    }
+
+    // A split root gets a new root above it
+    if (split) {
+        trrtnode *root = spares[used++];
+        trrtentry left = { tr_rtree_bounds(node), (uint64_t)(uintptr_t)node };
+        tr_rtree_add(root, &left);
+        tr_rtree_add(root, &entry);
+        tree->root = root;
+        tree->ninner++;
+    }
+
+    tree->nentries++;
+    return trstatus_ok;
+}
+
+//
+// Bulk building
+//
+
+static int tr_rtree_order_x(const void *a, const void *b)
+{
+    const trrect *ra = &((const trrtentry *)a)->rect, *rb = &((const trrtentry *)b)->rect;
+    double ca = ra->minx + ra->maxx, cb = rb->minx + rb->maxx;
+    return ca < cb ? -1 : ca > cb;
+}
+
+static int tr_rtree_order_y(const void *a, const void *b)
+{
+    const trrect *ra = &((const trrtentry *)a)->rect, *rb = &((const trrtentry *)b)->rect;
+    double ca = ra->miny + ra->maxy, cb = rb->miny + rb->maxy;
+    return ca < cb ? -1 : ca > cb;
+}
+
+// Packs one level's entries into full nodes with Sort-Tile-Recursive, and
+// writes an entry for each new node to `packed`. On failure, frees the new
+// nodes, and on levels above the leaves, the nodes the entries point to.
+//
+static trstatus tr_rtree_pack(trrtree *tree, trrtentry *entries, uint64_t count, unsigned level,
+        trrtentry *packed, uint64_t *npacked)
+{
+    uint64_t nnodes = (count + tr_rtree_fanout - 1) / tr_rtree_fanout;
+    uint64_t nslices = 1;
+    while (nslices * nslices < nnodes) {
+        nslices++;
+    }
+
+    // Slices hold whole nodes, so only the last node is short
+    uint64_t slicesize = (nnodes + nslices - 1) / nslices * tr_rtree_fanout;
+    qsort(entries, count, sizeof(trrtentry), tr_rtree_order_x);
+
+    uint64_t n = 0;
+    for (uint64_t first = 0; first < count; first += slicesize) {
+        uint64_t size = min(slicesize, count - first);
+        qsort(entries + first, size, sizeof(trrtentry), tr_rtree_order_y);
+
+        for (uint64_t i = first; i < first + size; i += tr_rtree_fanout) {
+            trrtnode *node = tr_rtree_new_node(tree, level);
+            if (node == NULL) {
+                for (uint64_t j = 0; j < n; ++j) {
+                    tr_rtree_free((trrtnode *)(uintptr_t)packed[j].value);
+                }
+                for (uint64_t j = i; level > 0 && j < count; ++j) {
+                    tr_rtree_free((trrtnode *)(uintptr_t)entries[j].value);
+                }
+                return trstatus_no_mem;
+            }
+
+            uint64_t end = min(i + tr_rtree_fanout, first + size);
+            for (uint64_t j = i; j < end; ++j) {
+                tr_rtree_add(node, entries + j);
+            }
+            packed[n++] = (trrtentry){ tr_rtree_bounds(node), (uint64_t)(uintptr_t)node };
+        }
+    }
+
+    *npacked = n;
+    return trstatus_ok;
+}
+
+trstatus tr_rtree_build(trrtree *tree, trrtentry *entries, uint64_t count)
+{
+    if (tree->nentries != 0) {
+        return trstatus_argument;
+    }
+    for (uint64_t i = 0; i < count; ++i) {
+        if (!tr_rect_valid(entries[i].rect)) {
+            return trstatus_argument;
+        }
+    }
+    if (count == 0) {
+        return trstatus_ok;
+    }
+
+    // Each level has a node per fanout entries of the one below
+    uint64_t nleaves = (count + tr_rtree_fanout - 1) / tr_rtree_fanout;
+    if (nleaves * sizeof(trrtentry) > UINT32_MAX) {
+        return trstatus_too_large;
+    }
+
+    trrtentry *buffers[2];
+    buffers[0] = tr_alloc(nleaves * sizeof(trrtentry), tree->tag);
+    buffers[1] = nleaves > 1 ? tr_alloc(nleaves * sizeof(trrtentry), tree->tag) : NULL;
+    if (buffers[0] == NULL || (nleaves > 1 && buffers[1] == NULL)) {
+        if (buffers[0] != NULL) {
+            tr_free(buffers[0]);
+        }
+        return trstatus_no_mem;
+    }
+
+    // Pack the entries into leaves, then each level into the one above,
+    // until a level fits in one node
+    trrtentry *level = entries;
+    uint64_t n = count;
+    unsigned height = 0;
+    trstatus s = trstatus_ok;
+    uint64_t nleafnodes = 0, ninner = 0;
+    do {
+        trrtentry *packed = buffers[height % 2];
+        s = tr_rtree_pack(tree, level, n, height, packed, &n);
+        if (tr_failed(s)) {
+            break;
+        }
+        if (height == 0) {
+            nleafnodes = n;
+        } else {
+            ninner += n;
+        }
+        level = packed;
+        height++;
+    } while (n > 1);
+
+    if (tr_ok(s)) {
+        tr_rtree_free(tree->root);
+        tree->root = (trrtnode *)(uintptr_t)level[0].value;
+        tree->nentries = count;
+        tree->nleaves = nleafnodes;
+        tree->ninner = ninner;
+    }
+
+    tr_free(buffers[0]);
+    if (buffers[1] != NULL) {
+        tr_free(buffers[1]);
+    }
+    return s;
+}
+
+trrtreestat tr_rtree_stat(const trrtree *tree)
+{
+    trrtreestat stat = {
+        .nentries = tree->nentries,
+        .nleaves = tree->nleaves,
+        .ninner = tree->ninner,
+        .height = tree->root->level + 1u,
+        .leaffill = (double)tree->nentries / ((double)tree->nleaves * tr_rtree_fanout),
+    };
+    return stat;
+}
@@ -0,0 +1,128 @@
+//////////////////////////////////////////////////////////////////////////////
+//
+// Terrascale
+// Copyright (c) Dave Kilian & Emily Kilian 2023. All rights reserved.
+//
+// rtree.h - an in-memory R-tree for window queries
+//
+// The tree maps rectangles (see math/rect.h), such as tile or object
+// bounds, to 64-bit values, and finds every entry whose rectangle
+// intersects a query window. Each node holds up to tr_rtree_fanout
+// rectangles; a leaf's are its entries', and an inner node's are the
+// bounds of its children. A query descends into every child whose bounds
+// intersect the window.
+//
+// Nodes store their rectangles as one array per coordinate, so that a
+// query compares the window against all of a node's rectangles in one
+// loop the compiler vectorizes. Unused slots hold the empty rectangle,
+// which matches nothing, so the loop always covers the whole node.
+//
+// There are two ways to fill a tree:
+//
+// - Bulk building packs a known set of entries with Sort-Tile-Recursive:
+//   entries are sorted by x into vertical slices, each slice by y, and
+//   consecutive runs packed into full leaves; then the leaves' bounds are
+//   packed the same way, level by level. Nodes are full, and siblings
+//   barely overlap, so queries visit few nodes.
+//
+// - Inserts descend to the leaf whose bounds grow least, and split nodes
+//   which overflow as the R*-tree does: along the axis where the two
+//   halves have the least total perimeter, at the point where they overlap
+//   least. Splits propagate up, and a split root adds a level.
+//
+// Inserts may follow a bulk build. Entries can't be removed.
+//
+// Queries cover one set of rectangles; a caller with several zoom levels
+// keeps a tree per level, so each query sees only that level's tiles.
+//
+// The tree isn't synchronized. Queries may run in parallel with each
+// other, but writers must be serialized against everything else.
+//
+//////////////////////////////////////////////////////////////////////////////
+
+#pragma once
+
+#include <math/rect.h>
+
+// Most entries in a node
+#define tr_rtree_fanout 32
+
+// Fewest entries a split leaves in either node (40%)
+#define tr_rtree_minfill 13
+
+// Most levels in a tree, including the leaves
+#define tr_rtree_maxheight 32
+
+// An entry
+typedef struct {
+
+    trrect rect;            // Bounds
+    uint64_t value;         // Caller's value
+
+} trrtentry;
+
+// A node
+typedef struct trrtnode trrtnode;
+struct trrtnode {
+
+    double minx[tr_rtree_fanout];   // Rectangles, by coordinate
+    double miny[tr_rtree_fanout];
+    double maxx[tr_rtree_fanout];
+    double maxy[tr_rtree_fanout];
+    union {
+        trrtnode *children[tr_rtree_fanout];    // Inner nodes: the children
+        uint64_t values[tr_rtree_fanout];       // Leaves: the entries' values
+    };
+    uint16_t level;         // Height above the leaves; 0 for a leaf
+    uint16_t count;         // Number of rectangles
+
+};
+
+// Tree statistics
+typedef struct {
+
+    uint64_t nentries;      // Entries in the leaves
+    uint64_t nleaves;       // Leaf nodes
+    uint64_t ninner;        // Inner nodes
+    unsigned height;        // Levels, including the leaves
+    double leaffill;        // Average fraction of each leaf in use
+
+} trrtreestat;
+
+// An R-tree
+typedef struct {
+
+    trrtnode *root;         // The root, a leaf while the tree is small
+    uint64_t nentries;      // Statistics
+    uint64_t nleaves;
+    uint64_t ninner;
+    tralloctag tag;         // Tag for node allocations
+
+} trrtree;
+
+// Initializes an empty tree
+trstatus tr_rtree_initialize(trrtree *tree, tralloctag tag);
+
+// Frees every node
+void tr_rtree_cleanup(trrtree *tree);
+
+// Inserts an entry. Rectangles may repeat, as may values. Returns
+// trstatus_argument if the rectangle isn't valid.
+//
+trstatus tr_rtree_insert(trrtree *tree, trrect rect, uint64_t value);
+
+// Fills an empty tree with the given entries, which it reorders. Returns
+// trstatus_argument if the tree isn't empty or any rectangle isn't valid.
+//
+trstatus tr_rtree_build(trrtree *tree, trrtentry *entries, uint64_t count);
+
+// A query callback; returns false to stop the query
+typedef bool trrtsearchfn(trrect rect, uint64_t value, void *context);
+
+// Calls `fn` for each entry whose rectangle intersects the window, in no
+// particular order, until it returns false or the entries run out
+//
+void tr_rtree_search(const trrtree *tree, trrect window, trrtsearchfn *fn, void *context);
+
+// Gets the tree's statistics
+trrtreestat tr_rtree_stat(const trrtree *tree);
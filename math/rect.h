@@ -0,0 +1,84 @@
+//////////////////////////////////////////////////////////////////////////////
+//
+// Terrascale
+// Copyright (c) Dave Kilian & Emily Kilian 2023. All rights reserved.
+//
+// rect.h - axis-aligned rectangles
+//
+// Bounds of tiles and objects, shared by the tiler, the editor and the
+// database. Rectangles are closed, so two which only share an edge
+// intersect, and a point is a rectangle with min == max. The empty
+// rectangle has min > max on both axes, so it intersects nothing and is the
+// identity for tr_rect_union().
+//
+//////////////////////////////////////////////////////////////////////////////
+
+#pragma once
+
+#include <math.h>
+
+// A rectangle
+typedef struct {
+
+    double minx, miny;
+    double maxx, maxy;
+
+} trrect;
+
+// Makes a rectangle
+static inline trrect tr_rect_make(double minx, double miny, double maxx, double maxy)
+{
+    return (trrect){ minx, miny, maxx, maxy };
+}
+
+// Gets the empty rectangle
+static inline trrect tr_rect_empty()
+{
+    return (trrect){ INFINITY, INFINITY, -INFINITY, -INFINITY };
+}
+
+// Checks that a rectangle's minimums don't exceed its maximums, which also
+// rejects NaNs
+//
+static inline bool tr_rect_valid(trrect r)
+{
+    return r.minx <= r.maxx && r.miny <= r.maxy;
+}
+
+// Checks whether two rectangles have any point in common
+static inline bool tr_rect_intersects(trrect a, trrect b)
+{
+    return a.minx <= b.maxx && b.minx <= a.maxx && a.miny <= b.maxy && b.miny <= a.maxy;
+}
+
+// Checks whether `outer` holds all of `inner`
+static inline bool tr_rect_contains(trrect outer, trrect inner)
+{
+    return outer.minx <= inner.minx && inner.maxx <= outer.maxx &&
+        outer.miny <= inner.miny && inner.maxy <= outer.maxy;
+}
+
+// Gets the smallest rectangle holding both
+static inline trrect tr_rect_union(trrect a, trrect b)
+{
+    return (trrect){ min(a.minx, b.minx), min(a.miny, b.miny), max(a.maxx, b.maxx), max(a.maxy, b.maxy) };
+}
+
+// Gets a rectangle's area; zero if it's empty
+static inline double tr_rect_area(trrect r)
+{
+    return tr_rect_valid(r) ? (r.maxx - r.minx) * (r.maxy - r.miny) : 0;
+}
+
+// Gets half a rectangle's perimeter; zero if it's empty
+static inline double tr_rect_margin(trrect r)
+{
+    return tr_rect_valid(r) ? (r.maxx - r.minx) + (r.maxy - r.miny) : 0;
+}
+
+// Gets the area two rectangles share
+static inline double tr_rect_overlap(trrect a, trrect b)
+{
+    trrect r = { max(a.minx, b.minx), max(a.miny, b.miny), min(a.maxx, b.maxx), min(a.maxy, b.maxy) };
+    return tr_rect_area(r);
+}
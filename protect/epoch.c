@@ -0,0 +1,224 @@
+//////////////////////////////////////////////////////////////////////////////
+//
+// Terrascale
+// Copyright (c) Dave Kilian & Emily Kilian 2023. All rights reserved.
+//
+//////////////////////////////////////////////////////////////////////////////
+
+#include <pch.h>
+#include <protect/epoch.h>
+
+void tr_epoch_initialize(trepoch *epoch)
+{
+    atomic_init(&epoch->epoch, 0);
+    pthread_mutex_init(&epoch->lock, NULL);
+    tr_list_initialize(&epoch->threads);
+    for (int i = 0; i < tr_epoch_nlimbo; ++i) {
+        tr_slist_initialize(&epoch->orphans[i].nodes);
+        epoch->orphans[i].epoch = 0;
+        epoch->orphans[i].count = 0;
+    }
+    atomic_init(&epoch->advances, 0);
+    atomic_init(&epoch->retired, 0);
+    atomic_init(&epoch->freed, 0);
+}
+
+// Frees every block on a list of retired nodes
+static void tr_epoch_free_list(trepoch *epoch, trslist *nodes)
+{
+    uint64_t count = 0;
+
+    trslist *entry;
+    while ((entry = tr_slist_pop(nodes)) != NULL) {
+        trepochnode *node = container_of(entry, trepochnode, entry);
+        tr_free(node->block);
+        count++;
+    }
+
+    atomic_fetch_add_explicit(&epoch->freed, count, memory_order_relaxed);
+}
+
+void tr_epoch_cleanup(trepoch *epoch)
+{
+    tr_assert(tr_list_empty(&epoch->threads));
+
+    for (int i = 0; i < tr_epoch_nlimbo; ++i) {
+        tr_epoch_free_list(epoch, &epoch->orphans[i].nodes);
+    }
+    pthread_mutex_destroy(&epoch->lock);
+}
+
+void tr_epoch_register(trepoch *epoch, trepochthread *thread)
+{
+    atomic_init(&thread->local, 0);
+    thread->nesting = 0;
+    thread->domain = epoch;
+    thread->pending = 0;
+
+    for (int i = 0; i < tr_epoch_nlimbo; ++i) {
+        tr_slist_initialize(&thread->limbo[i].nodes);
+        thread->limbo[i].epoch = 0;
+        thread->limbo[i].count = 0;
+    }
+
+    pthread_mutex_lock(&epoch->lock);
+    tr_list_append(&epoch->threads, &thread->entry);
+    pthread_mutex_unlock(&epoch->lock);
+}
+
+// Moves every node from one list to another
+static void tr_epoch_move(trslist *from, trslist *to)
+{
+    trslist *entry;
+    while ((entry = tr_slist_pop(from)) != NULL) {
+        tr_slist_push(to, entry);
+    }
+}
+
+// Advances the global epoch if every pinned thread has seen it, and frees
+// the orphans which that has made safe. Gives up at once if another
+// thread holds the domain's lock, since it's probably advancing already.
+//
+static void tr_epoch_advance(trepoch *epoch)
+{
+    if (pthread_mutex_trylock(&epoch->lock) != 0) {
+        return;
+    }
+
+    // Pairs with the fence in tr_epoch_enter: either the pin is visible
+    // here, or the pinning thread will see whatever was unlinked before
+    uint64_t e = atomic_load_explicit(&epoch->epoch, memory_order_relaxed);
+    atomic_thread_fence(memory_order_seq_cst);
+
+    bool behind = false;
+    tr_list_foreach(&epoch->threads, entry) {
+        trepochthread *t = container_of(entry, trepochthread, entry);
+        uint64_t local = atomic_load_explicit(&t->local, memory_order_acquire);
+        if ((local & 1) != 0 && (local >> 1) != e) {
+            behind = true;
+            break;
+        }
+    }
+
+    if (!behind) {
+        atomic_store_explicit(&epoch->epoch, ++e, memory_order_release);
+        atomic_fetch_add_explicit(&epoch->advances, 1, memory_order_relaxed);
+    }
+
+    trslist safe = tr_slist_staticinit;
+    for (int i = 0; i < tr_epoch_nlimbo; ++i) {
+        trepochlimbo *orphans = epoch->orphans + i;
+        if (orphans->count > 0 && e >= orphans->epoch + 2) {
+            tr_epoch_move(&orphans->nodes, &safe);
+            orphans->count = 0;
+        }
+    }
+    pthread_mutex_unlock(&epoch->lock);
+
+    tr_epoch_free_list(epoch, &safe);
+}
+
+void tr_epoch_unregister(trepochthread *thread)
+{
+    trepoch *epoch = thread->domain;
+    tr_assert(thread->nesting == 0);
+
+    // Each limbo list joins the domain's list for the same epoch. The two
+    // epochs can only differ by a multiple of three, and then whichever
+    // list is older is already safe to free.
+    trslist safe = tr_slist_staticinit;
+
+    pthread_mutex_lock(&epoch->lock);
+    tr_list_remove(&thread->entry);
+
+    for (int i = 0; i < tr_epoch_nlimbo; ++i) {
+        trepochlimbo *limbo = thread->limbo + i;
+        trepochlimbo *orphans = epoch->orphans + i;
+        if (limbo->count == 0) {
+            continue;
+        }
+
+        if (orphans->epoch < limbo->epoch) {
+            tr_epoch_move(&orphans->nodes, &safe);
+            orphans->epoch = limbo->epoch;
+            orphans->count = 0;
+        }
+
+        if (orphans->epoch == limbo->epoch) {
+            tr_epoch_move(&limbo->nodes, &orphans->nodes);
+            orphans->count += limbo->count;
+        } else {
+            tr_epoch_move(&limbo->nodes, &safe);
+        }
+        limbo->count = 0;
+    }
+    thread->pending = 0;
+    pthread_mutex_unlock(&epoch->lock);
+
+    tr_epoch_free_list(epoch, &safe);
+
+    // Threads which come and go may never retire enough to reclaim, so
+    // departures move the epoch along too
+    tr_epoch_advance(epoch);
+}
+
+// Frees a limbo list's nodes
+static void tr_epoch_free_limbo(trepochthread *thread, trepochlimbo *limbo)
+{
+    tr_epoch_free_list(thread->domain, &limbo->nodes);
+    thread->pending -= limbo->count;
+    limbo->count = 0;
+}
+
+void tr_epoch_free(trepochthread *thread, void *block, trepochnode *node)
+{
+    trepoch *epoch = thread->domain;
+    node->block = block;
+
+    // Read after the block was unlinked, so any thread which could still
+    // reach it is pinned at this epoch or an earlier one
+    uint64_t e = atomic_load_explicit(&epoch->epoch, memory_order_seq_cst);
+
+    // The list this epoch shares was last used at least three epochs ago,
+    // so whatever is still on it is safe
+    trepochlimbo *limbo = thread->limbo + e % tr_epoch_nlimbo;
+    if (limbo->epoch != e) {
+        tr_epoch_free_limbo(thread, limbo);
+        limbo->epoch = e;
+    }
+
+    tr_slist_push(&limbo->nodes, &node->entry);
+    limbo->count += 1;
+    thread->pending += 1;
+    atomic_fetch_add_explicit(&epoch->retired, 1, memory_order_relaxed);
+
+    if (thread->pending >= tr_epoch_batch) {
+        tr_epoch_reclaim(thread);
+    }
+}
+
+unsigned tr_epoch_reclaim(trepochthread *thread)
+{
+    trepoch *epoch = thread->domain;
+    tr_epoch_advance(epoch);
+
+    uint64_t e = atomic_load_explicit(&epoch->epoch, memory_order_acquire);
+    for (int i = 0; i < tr_epoch_nlimbo; ++i) {
+        trepochlimbo *limbo = thread->limbo + i;
+        if (limbo->count > 0 && e >= limbo->epoch + 2) {
+            tr_epoch_free_limbo(thread, limbo);
+        }
+    }
+
+    return thread->pending;
+}
+
+trepochstat tr_epoch_stat(trepoch *epoch)
+{
+    trepochstat stat;
+    stat.epoch = atomic_load_explicit(&epoch->epoch, memory_order_relaxed);
+    stat.advances = atomic_load_explicit(&epoch->advances, memory_order_relaxed);
+    stat.retired = atomic_load_explicit(&epoch->retired, memory_order_relaxed);
+    stat.freed = atomic_load_explicit(&epoch->freed, memory_order_relaxed);
+    return stat;
+}
@@ -0,0 +1,158 @@
+//////////////////////////////////////////////////////////////////////////////
+//
+// Terrascale
+// Copyright (c) Dave Kilian & Emily Kilian 2023. All rights reserved.
+//
+// epoch.h - epoch-based memory reclamation
+//
+// A lock-free structure can unlink a node at any moment, but can't free it
+// while some other thread may still be reading it. Epoch-based reclamation
+// defers the free until every thread which could have seen the node has
+// finished what it was doing:
+//
+// - A domain (trepoch) keeps a global epoch counter, and every thread which
+//   uses the domain registers a trepochthread record with it.
+//
+// - Before touching the structure, a thread pins itself with
+//   tr_epoch_enter, which records the global epoch it saw; it unpins with
+//   tr_epoch_exit when it holds no more pointers into the structure.
+//
+// - Once a node is unlinked, so that no new reader can reach it, the thread
+//   that unlinked it retires it with tr_epoch_free, which pushes it onto a
+//   per-thread limbo list for the current epoch.
+//
+// - The global epoch only advances once every pinned thread has seen it.
+//   So after it has advanced twice since a node was retired, every thread
+//   which was pinned when the node was unlinked has since unpinned, and the
+//   node can be freed.
+//
+// Retiring is batched: once tr_epoch_batch nodes are waiting on a thread,
+// it tries to advance the epoch and frees whatever has become safe, with
+// tr_free. Pinning and unpinning touch only the calling thread's record (a
+// store and a fence to pin, a store to unpin), so they're cheap enough to
+// wrap every read operation.
+//
+// A thread pinned for a long time holds back reclamation for everybody, so
+// pin around operations, not around whole tasks.
+//
+//////////////////////////////////////////////////////////////////////////////
+
+#pragma once
+
+#include <runtime/list.h>
+
+// Retired nodes per thread which trigger an attempt to reclaim them
+#define tr_epoch_batch 64
+
+// Limbo lists per thread: nodes retired in the current epoch and the two
+// before it, which may still be visible
+#define tr_epoch_nlimbo 3
+
+// Space for deferring the free of a block. Embed one in each block which
+// will be retired; readers must never touch it.
+//
+typedef struct {
+
+    trslist entry;          // Entry in a limbo list
+    void *block;            // The block to free
+
+} trepochnode;
+
+// Nodes retired during one epoch
+typedef struct {
+
+    trslist nodes;          // Retired nodes
+    uint64_t epoch;         // The epoch they were retired in
+    unsigned count;         // Number of nodes
+
+} trepochlimbo;
+
+// Reclamation statistics
+typedef struct {
+
+    uint64_t epoch;         // Current global epoch
+    uint64_t advances;      // Times the global epoch advanced
+    uint64_t retired;       // Blocks retired
+    uint64_t freed;         // Blocks freed
+
+} trepochstat;
+
+// A reclamation domain, shared by the threads using one set of structures
+typedef struct {
+
+    _Atomic uint64_t epoch;     // The global epoch
+    pthread_mutex_t lock;       // Protects the fields below
+    trlist threads;             // Registered trepochthread records
+    trepochlimbo orphans[tr_epoch_nlimbo];  // Nodes left by departed threads
+    _Atomic uint64_t advances;  // Statistics
+    _Atomic uint64_t retired;
+    _Atomic uint64_t freed;
+
+} trepoch;
+
+// A thread's participation in a domain. Only its owning thread may use it.
+typedef struct {
+
+    _Alignas(64)
+    _Atomic uint64_t local;     // (Pinned epoch << 1) | 1, or 0 if unpinned
+    unsigned nesting;           // Depth of nested pins
+    trepoch *domain;            // The domain registered with
+    trlist entry;               // Entry in the domain's list of threads
+    trepochlimbo limbo[tr_epoch_nlimbo];    // Indexed by epoch % nlimbo
+    unsigned pending;           // Nodes across all limbo lists
+
+} trepochthread;
+
+// Initializes a reclamation domain
+void tr_epoch_initialize(trepoch *epoch);
+
+// Frees every block still waiting to be reclaimed and cleans up the domain.
+// Every thread must have unregistered.
+//
+void tr_epoch_cleanup(trepoch *epoch);
+
+// Registers a thread with a domain
+void tr_epoch_register(trepoch *epoch, trepochthread *thread);
+
+// Unregisters a thread, which must not be pinned. Blocks it retired which
+// can't be freed yet are handed to the domain, and freed once safe.
+//
+void tr_epoch_unregister(trepochthread *thread);
+
+// Pins the thread to the current epoch, so nothing it can reach is freed
+// until it unpins. Pins nest.
+//
+static inline void tr_epoch_enter(trepochthread *thread)
+{
+    if (thread->nesting++ == 0) {
+        uint64_t e = atomic_load_explicit(&thread->domain->epoch, memory_order_relaxed);
+        atomic_store_explicit(&thread->local, (e << 1) | 1, memory_order_relaxed);
+
+        // Order the pin before any read of the structure, against the
+        // advancing thread's reads of the pin
+        atomic_thread_fence(memory_order_seq_cst);
+    }
+}
+
+// Unpins the thread
+static inline void tr_epoch_exit(trepochthread *thread)
+{
+    tr_assert(thread->nesting > 0);
+    if (--thread->nesting == 0) {
+        atomic_store_explicit(&thread->local, 0, memory_order_release);
+    }
+}
+
+// Retires a block which has been unlinked from every shared structure, so
+// that it's freed with tr_free once no thread can still be reading it. The
+// node is space inside the block for the deferred free.
+//
+void tr_epoch_free(trepochthread *thread, void *block, trepochnode *node);
+
+// Tries to advance the global epoch, then frees the thread's retired blocks
+// which have become safe. Returns the number of blocks still waiting.
+//
+unsigned tr_epoch_reclaim(trepochthread *thread);
+
+// Gets a snapshot of the domain's statistics
+trepochstat tr_epoch_stat(trepoch *epoch);
@@ -0,0 +1,34 @@
+//////////////////////////////////////////////////////////////////////////////
+//
+// Terrascale
+// Copyright (c) Dave Kilian & Emily Kilian 2023. All rights reserved.
+//
+//////////////////////////////////////////////////////////////////////////////
+
+#include <pch.h>
+#include <protect/latch.h>
+
+#include <immintrin.h>
+#include <sched.h>
+
+// Number of times to spin on a locked latch before yielding the CPU
+#define tr_latch_spins 256
+
+uint64_t tr_latch_wait(trlatch *latch)
+{
+    int spins = 0;
+
+    for (;;) {
+        uint64_t v = atomic_load_explicit(&latch->version, memory_order_acquire);
+        if ((v & tr_latch_locked) == 0) {
+            return v;
+        }
+
+        if (++spins >= tr_latch_spins) {
+            sched_yield();
+            spins = 0;
+        } else {
+            _mm_pause();
+        }
+    }
+}
@@ -0,0 +1,117 @@
+//////////////////////////////////////////////////////////////////////////////
+//
+// Terrascale
+// Copyright (c) Dave Kilian & Emily Kilian 2023. All rights reserved.
+//
+// latch.h - optimistic version latches
+//
+// A reader/writer latch makes every reader write the latch word, so readers
+// of a hot node (like the root of an index) keep stealing its cache line
+// from each other, and read throughput stops scaling with cores. An
+// optimistic latch lets readers get away without writing anything:
+//
+// - The latch is a version counter. Writers take it exclusively by setting
+//   its locked bit, and bump the version when they release it.
+//
+// - A reader notes the version (waiting out any writer), reads what the
+//   latch protects, and then checks that the version hasn't changed. If it
+//   has, what it read may be torn, and it must throw it away and restart.
+//
+// Readers may therefore see a node in the middle of being changed, so they
+// must be careful not to trust what they read (for example, clamp indexes
+// read from the node) until it's validated.
+//
+// A latch can also be marked obsolete, when what it protects has been
+// unlinked; readers which find an obsolete latch restart too.
+//
+// The usual way to use these is optimistic lock coupling: while descending
+// a tree, read the child's pointer from the parent, validate the parent,
+// then note the child's version, so every step is checked against
+// concurrent changes without any reader writing shared memory.
+//
+//////////////////////////////////////////////////////////////////////////////
+
+#pragma once
+
+// Bits of a latch's version word
+#define tr_latch_obsolete 1ull
+#define tr_latch_locked   2ull
+
+// An optimistic latch
+typedef struct {
+
+    _Atomic uint64_t version;   // Version << 2 | locked | obsolete
+
+} trlatch;
+
+// Spins until the latch is unlocked, and returns its version
+uint64_t tr_latch_wait(trlatch *latch);
+
+// Initializes an unlocked latch
+static inline void tr_latch_initialize(trlatch *latch)
+{
+    atomic_init(&latch->version, 0);
+}
+
+// Starts an optimistic read, returning false if the latch is obsolete, in
+// which case the caller must restart. Waits out any writer.
+//
+static inline bool tr_latch_read(trlatch *latch, uint64_t *version)
+{
+    uint64_t v = atomic_load_explicit(&latch->version, memory_order_acquire);
+    if ((v & tr_latch_locked) != 0) {
+        v = tr_latch_wait(latch);
+    }
+
+    *version = v;
+    return (v & tr_latch_obsolete) == 0;
+}
+
+// Checks that nothing has changed since the version was read, returning
+// false if the caller must restart. Valid any number of times during a read.
+//
+static inline bool tr_latch_validate(trlatch *latch, uint64_t version)
+{
+    // Order the protected reads before the check
+    atomic_thread_fence(memory_order_acquire);
+    return atomic_load_explicit(&latch->version, memory_order_relaxed) == version;
+}
+
+// Turns an optimistic read into exclusive ownership, returning false (and
+// leaving the latch alone) if anything has changed since the version was
+// read
+//
+static inline bool tr_latch_upgrade(trlatch *latch, uint64_t version)
+{
+    return atomic_compare_exchange_strong_explicit(&latch->version, &version,
+        version | tr_latch_locked, memory_order_acquire, memory_order_relaxed);
+}
+
+// Takes the latch exclusively, waiting for other writers. Returns false if
+// the latch is obsolete.
+//
+static inline bool tr_latch_lock(trlatch *latch)
+{
+    for (;;) {
+        uint64_t v;
+        if (!tr_latch_read(latch, &v)) {
+            return false;
+        }
+        if (tr_latch_upgrade(latch, v)) {
+            return true;
+        }
+    }
+}
+
+// Releases exclusive ownership, invalidating optimistic reads
+static inline void tr_latch_unlock(trlatch *latch)
+{
+    atomic_fetch_add_explicit(&latch->version, tr_latch_locked, memory_order_release);
+}
+
+// Releases exclusive ownership and marks the latch obsolete
+static inline void tr_latch_unlock_obsolete(trlatch *latch)
+{
+    atomic_fetch_add_explicit(&latch->version, tr_latch_locked | tr_latch_obsolete,
+        memory_order_release);
+}
@@ -0,0 +1,700 @@
+//////////////////////////////////////////////////////////////////////////////
+//
+// Terrascale
+// Copyright (c) Dave Kilian & Emily Kilian 2023. All rights reserved.
+//
+//////////////////////////////////////////////////////////////////////////////
+
+#include <pch.h>
+#include <protect/lockmgr.h>
+#include <runtime/hash.h>
+
+#include <sched.h>
+
+// Number of times to spin on a busy guard before yielding the CPU
+#define tr_lockmgr_spins 1024
+
+// Whether a lock can be granted in one mode while another owner holds it in
+// another
+//
+static const bool tr_lock_compatible[tr_lock_nmodes][tr_lock_nmodes] =
+{
+    //              none   IS     IX     S      SIX    X
+    [trlock_none] = { true, true,  true,  true,  true,  true  },
+    [trlock_is]   = { true, true,  true,  true,  true,  false },
+    [trlock_ix]   = { true, true,  true,  false, false, false },
+    [trlock_s]    = { true, true,  false, true,  false, false },
+    [trlock_six]  = { true, true,  false, false, false, false },
+    [trlock_x]    = { true, false, false, false, false, false },
+};
+
+// The weakest mode at least as strong as both of two modes
+static const trlockmode tr_lock_join[tr_lock_nmodes][tr_lock_nmodes] =
+{
+    [trlock_none] = { trlock_none, trlock_is,  trlock_ix,  trlock_s,   trlock_six, trlock_x },
+    [trlock_is]   = { trlock_is,   trlock_is,  trlock_ix,  trlock_s,   trlock_six, trlock_x },
+    [trlock_ix]   = { trlock_ix,   trlock_ix,  trlock_ix,  trlock_six, trlock_six, trlock_x },
+    [trlock_s]    = { trlock_s,    trlock_s,   trlock_six, trlock_s,   trlock_six, trlock_x },
+    [trlock_six]  = { trlock_six,  trlock_six, trlock_six, trlock_six, trlock_six, trlock_x },
+    [trlock_x]    = { trlock_x,    trlock_x,   trlock_x,   trlock_x,   trlock_x,   trlock_x },
+};
+
+// Whether holding a lock in one mode covers locking anything beneath it in
+// another
+//
+static bool tr_lock_covers(trlockmode held, trlockmode mode)
+{
+    switch (held) {
+    case trlock_x:
+        return true;
+    case trlock_s:
+    case trlock_six:
+        return mode == trlock_is || mode == trlock_s;
+    default:
+        return false;
+    }
+}
+
+static bool tr_lockname_equal(trlockname a, trlockname b)
+{
+    return a.table == b.table && a.page == b.page && a.row == b.row;
+}
+
+static uint64_t tr_lockname_hash(trlockname name)
+{
+    return tr_hash_u64(name.table ^ tr_hash_u64(name.page ^ tr_hash_u64(name.row)));
+}
+
+static trlockpartition *tr_lockmgr_partition(trlockmgr *mgr, uint64_t hash)
+{
+    return mgr->partitions + hash % tr_lockmgr_npartitions;
+}
+
+static trlist *tr_lockmgr_bucket(trlockpartition *p, uint64_t hash)
+{
+    return p->buckets + (hash / tr_lockmgr_npartitions) % tr_lockmgr_nbuckets;
+}
+
+//
+// Partition guards work like sync.c's: critical sections are a few list
+// operations and never wait on anything, so spinning beats a mutex.
+//
+
+static void tr_lockmgr_guard(trlockpartition *p)
+{
+    bool waited = false;
+    int spins = 0;
+
+    while (atomic_exchange_explicit(&p->guard, true, memory_order_acquire)) {
+        waited = true;
+        while (atomic_load_explicit(&p->guard, memory_order_relaxed)) {
+            if (++spins >= tr_lockmgr_spins) {
+                sched_yield();
+                spins = 0;
+            }
+        }
+    }
+
+    if (waited) {
+        p->stat.nguardwaits++;
+    }
+}
+
+static void tr_lockmgr_unguard(trlockpartition *p)
+{
+    atomic_store_explicit(&p->guard, false, memory_order_release);
+}
+
+trstatus tr_lockmgr_initialize(trlockmgr *mgr, unsigned escalation, tralloctag tag)
+{
+    mgr->partitions = tr_alloc_aligned(tr_lockmgr_npartitions * sizeof(trlockpartition),
+        _Alignof(trlockpartition), tag);
+    if (mgr->partitions == NULL) {
+        return trstatus_no_mem;
+    }
+
+    for (int i = 0; i < tr_lockmgr_npartitions; ++i) {
+        trlockpartition *p = mgr->partitions + i;
+        atomic_init(&p->guard, false);
+        for (int j = 0; j < tr_lockmgr_nbuckets; ++j) {
+            tr_list_initialize(p->buckets + j);
+        }
+        tr_list_initialize(&p->spare);
+        memset(&p->stat, 0, sizeof(p->stat));
+    }
+
+    mgr->escalation = escalation != 0 ? escalation : tr_lockmgr_escalation;
+    atomic_init(&mgr->nextage, 0);
+    mgr->tag = tag;
+    return trstatus_ok;
+}
+
+void tr_lockmgr_cleanup(trlockmgr *mgr)
+{
+    for (int i = 0; i < tr_lockmgr_npartitions; ++i) {
+        trlockpartition *p = mgr->partitions + i;
+        for (int j = 0; j < tr_lockmgr_nbuckets; ++j) {
+            tr_assert(tr_list_empty(p->buckets + j));
+        }
+
+        trlist *entry;
+        while ((entry = tr_list_rmhead(&p->spare)) != NULL) {
+            tr_free(container_of(entry, trlockhead, entry));
+        }
+    }
+
+    tr_free(mgr->partitions);
+}
+
+void tr_lockmgr_owner_initialize(trlockmgr *mgr, trlockowner *owner)
+{
+    owner->mgr = mgr;
+    owner->age = atomic_fetch_add_explicit(&mgr->nextage, 1, memory_order_relaxed);
+    tr_list_initialize(&owner->locks);
+    tr_list_initialize(&owner->spare);
+    owner->lasttable = NULL;
+    owner->lastpage = NULL;
+    owner->waiting = NULL;
+    owner->task = NULL;
+    owner->waitstart = 0;
+}
+
+void tr_lockmgr_owner_cleanup(trlockowner *owner)
+{
+    tr_lockmgr_release_all(owner);
+
+    trlist *entry;
+    while ((entry = tr_list_rmhead(&owner->spare)) != NULL) {
+        tr_free(container_of(entry, trlockreq, ownerentry));
+    }
+}
+
+static trlockhead *tr_lockmgr_find(trlist *bucket, trlockname name)
+{
+    tr_list_foreach(bucket, entry) {
+        trlockhead *head = container_of(entry, trlockhead, entry);
+        if (tr_lockname_equal(head->name, name)) {
+            return head;
+        }
+    }
+
+    return NULL;
+}
+
+// Finds the owner's request for a lock, if it has one
+static trlockreq *tr_lockmgr_mine(trlockhead *head, trlockowner *owner)
+{
+    tr_list_foreach(&head->queue, entry) {
+        trlockreq *req = container_of(entry, trlockreq, entry);
+        if (req->owner == owner) {
+            return req;
+        }
+    }
+
+    return NULL;
+}
+
+// Takes a lock head out of the table once nobody holds or wants it
+static void tr_lockmgr_unused(trlockpartition *p, trlockhead *head)
+{
+    if (tr_list_empty(&head->queue)) {
+        tr_assert(head->nwaiting == 0);
+        tr_list_remove(&head->entry);
+        tr_list_append(&p->spare, &head->entry);
+    }
+}
+
+// Puts a request the owner no longer needs back on its spare list
+static void tr_lockmgr_drop(trlockowner *owner, trlockreq *req)
+{
+    if (req->table != NULL) {
+        req->table->nrows--;
+    }
+
+    tr_list_remove(&req->ownerentry);
+    tr_list_append(&owner->spare, &req->ownerentry);
+}
+
+// Indicates whether a request can be granted in the given mode, as far as
+// the locks already granted are concerned
+//
+static bool tr_lockmgr_grantable(trlockhead *head, trlockreq *req, trlockmode mode)
+{
+    for (int m = trlock_is; m < tr_lock_nmodes; ++m) {
+        unsigned others = head->granted[m] - (req->mode == (trlockmode)m);
+        if (others > 0 && !tr_lock_compatible[mode][m]) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+// Indicates whether waiting for the given mode would mean waiting for an
+// older owner, which wait-die forbids. A new request waits for everything
+// queued ahead of it; a conversion only for the locks granted.
+//
+static bool tr_lockmgr_waits_for_older(trlockhead *head, trlockreq *req, trlockmode mode)
+{
+    bool ahead = true;
+
+    tr_list_foreach(&head->queue, entry) {
+        trlockreq *other = container_of(entry, trlockreq, entry);
+        if (other == req) {
+            ahead = false;
+            continue;
+        }
+        if (other->owner->age > req->owner->age) {
+            continue;
+        }
+
+        if (other->mode != trlock_none && !tr_lock_compatible[mode][other->mode]) {
+            return true;
+        }
+        if (req->mode == trlock_none && ahead && other->wanted != trlock_none) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+// Records a grant of a lock a request was waiting for, and queues its
+// owner's task to be resumed
+//
+static void tr_lockmgr_grant(trlockpartition *p, trlockhead *head, trlockreq *req, trlist *woken)
+{
+    if (req->mode != trlock_none) {
+        head->granted[req->mode]--;
+        p->stat.nconversions++;
+    } else {
+        p->stat.nheld++;
+    }
+
+    req->mode = req->wanted;
+    req->wanted = trlock_none;
+    head->granted[req->mode]++;
+    head->nwaiting--;
+
+    trtime waited = tr_clock_now() - req->owner->waitstart;
+    p->stat.locks.nacquire++;
+    p->stat.locks.ncontended++;
+    p->stat.locks.waittime += waited;
+    p->stat.locks.maxwait = max(p->stat.locks.maxwait, waited);
+
+    tr_list_append(woken, &req->owner->task->entry);
+}
+
+// Refuses a waiting request, because it has come to wait for an older
+// owner, and queues its owner's task to be resumed
+//
+static void tr_lockmgr_refuse(trlockpartition *p, trlockhead *head, trlockreq *req, trlist *woken)
+{
+    req->wanted = trlock_none;
+    req->refused = true;
+    head->nwaiting--;
+    p->stat.nconflicts++;
+
+    // The owner may never hold this lock again; its request is dropped when
+    // it finds out
+    if (req->mode == trlock_none) {
+        tr_list_remove(&req->entry);
+    }
+
+    tr_list_append(woken, &req->owner->task->entry);
+}
+
+// Grants whatever waiting requests can be granted after a lock changes:
+// conversions first, then new requests in arrival order. Then refuses
+// whatever is left waiting for an older owner, since grants can change who
+// waits for whom, and repeats until nothing changes.
+//
+static void tr_lockmgr_dispatch(trlockpartition *p, trlockhead *head, trlist *woken)
+{
+    bool changed = true;
+
+    while (changed && head->nwaiting > 0) {
+        changed = false;
+        bool blocked = false;
+
+        tr_list_foreach(&head->queue, entry) {
+            trlockreq *req = container_of(entry, trlockreq, entry);
+            if (req->mode != trlock_none && req->wanted != trlock_none) {
+                if (tr_lockmgr_grantable(head, req, req->wanted)) {
+                    tr_lockmgr_grant(p, head, req, woken);
+                    changed = true;
+                } else {
+                    blocked = true;
+                }
+            }
+        }
+
+        tr_list_foreach(&head->queue, entry) {
+            trlockreq *req = container_of(entry, trlockreq, entry);
+            if (req->mode == trlock_none && req->wanted != trlock_none) {
+                if (!blocked && tr_lockmgr_grantable(head, req, req->wanted)) {
+                    tr_lockmgr_grant(p, head, req, woken);
+                    changed = true;
+                } else {
+                    blocked = true;
+                }
+            }
+        }
+
+        if (changed) {
+            continue;
+        }
+
+        trlist *entry = head->queue.next;
+        while (entry != &head->queue) {
+            trlockreq *req = container_of(entry, trlockreq, entry);
+            entry = entry->next;
+            if (req->wanted != trlock_none &&
+                    tr_lockmgr_waits_for_older(head, req, req->wanted)) {
+                tr_lockmgr_refuse(p, head, req, woken);
+                changed = true;
+            }
+        }
+    }
+
+    tr_lockmgr_unused(p, head);
+}
+
+// Resumes the tasks of owners whose requests were granted or refused.
+// Called after dropping the guard, since resuming touches run queues.
+//
+static void tr_lockmgr_wake(trlist *woken)
+{
+    trlist *entry;
+    while ((entry = tr_list_rmhead(woken)) != NULL) {
+        tr_task_resume(container_of(entry, trtask, entry));
+    }
+}
+
+// Remembers a granted table or page lock, so the owner can find it again
+// without the guard
+//
+static void tr_lockmgr_remember(trlockowner *owner, trlockreq *req)
+{
+    if (req->head->name.row != tr_lock_whole) {
+        return;
+    }
+
+    if (req->head->name.page == tr_lock_whole) {
+        owner->lasttable = req;
+    } else {
+        owner->lastpage = req;
+    }
+}
+
+// Completes the request the owner was parked on
+static trstatus tr_lockmgr_finish(trlockowner *owner)
+{
+    uint64_t hash = tr_lockname_hash(owner->waitname);
+    trlockpartition *p = tr_lockmgr_partition(owner->mgr, hash);
+    trlockreq *req = owner->waiting;
+    trstatus s = trstatus_ok;
+
+    tr_lockmgr_guard(p);
+    if (req->wanted != trlock_none) {
+        s = trstatus_pending;
+    } else if (req->refused) {
+        req->refused = false;
+        if (req->mode == trlock_none) {
+            tr_lockmgr_drop(owner, req);
+        }
+        s = trstatus_conflict;
+    } else {
+        tr_lockmgr_remember(owner, req);
+    }
+    tr_lockmgr_unguard(p);
+
+    if (s != trstatus_pending) {
+        owner->waiting = NULL;
+        owner->task = NULL;
+    }
+    return s;
+}
+
+// Locks one name, without looking at anything above it. A row's lock
+// counts towards the owner's `table` lock.
+//
+static trstatus tr_lockmgr_acquire(trlockowner *owner, trtask *task, trlockname name,
+        trlockmode mode, trlockreq *table, trlockreq **result)
+{
+    trlockmgr *mgr = owner->mgr;
+    uint64_t hash = tr_lockname_hash(name);
+    trlockpartition *p = tr_lockmgr_partition(mgr, hash);
+    trlist *bucket = tr_lockmgr_bucket(p, hash);
+    trstatus s;
+
+    tr_lockmgr_guard(p);
+
+    trlockhead *head = tr_lockmgr_find(bucket, name);
+    trlockreq *req = head != NULL ? tr_lockmgr_mine(head, owner) : NULL;
+    if (req != NULL && tr_lock_join[req->mode][mode] == req->mode) {
+        tr_lockmgr_unguard(p);
+        *result = req;
+        return trstatus_ok;
+    }
+
+    if (head == NULL) {
+        trlist *entry = tr_list_rmhead(&p->spare);
+        head = entry != NULL
+            ? container_of(entry, trlockhead, entry)
+            : tr_alloc(sizeof(trlockhead), mgr->tag);
+        if (head == NULL) {
+            tr_lockmgr_unguard(p);
+            return trstatus_no_mem;
+        }
+
+        head->name = name;
+        tr_list_initialize(&head->queue);
+        memset(head->granted, 0, sizeof(head->granted));
+        head->nwaiting = 0;
+        tr_list_append(bucket, &head->entry);
+    }
+
+    bool fresh = req == NULL;
+    if (fresh) {
+        trlist *entry = tr_list_rmhead(&owner->spare);
+        req = entry != NULL
+            ? container_of(entry, trlockreq, ownerentry)
+            : tr_alloc(sizeof(trlockreq), mgr->tag);
+        if (req == NULL) {
+            tr_lockmgr_unused(p, head);
+            tr_lockmgr_unguard(p);
+            return trstatus_no_mem;
+        }
+
+        req->head = head;
+        req->owner = owner;
+        req->mode = trlock_none;
+        req->wanted = trlock_none;
+        req->refused = false;
+        req->nrows = 0;
+        req->table = table;
+        tr_list_append(&owner->locks, &req->ownerentry);
+        if (table != NULL) {
+            table->nrows++;
+        }
+    }
+
+    trlockmode want = tr_lock_join[req->mode][mode];
+    if (tr_lockmgr_grantable(head, req, want) && (!fresh || head->nwaiting == 0)) {
+        if (fresh) {
+            tr_list_append(&head->queue, &req->entry);
+            p->stat.nheld++;
+        } else {
+            head->granted[req->mode]--;
+            p->stat.nconversions++;
+        }
+
+        req->mode = want;
+        head->granted[want]++;
+        p->stat.locks.nacquire++;
+        tr_lockmgr_remember(owner, req);
+        tr_lockmgr_unguard(p);
+
+        *result = req;
+        return trstatus_ok;
+    }
+
+    if (task == NULL) {
+        s = trstatus_later;
+    } else if (tr_lockmgr_waits_for_older(head, req, want)) {
+        p->stat.nconflicts++;
+        s = trstatus_conflict;
+    } else {
+        req->wanted = want;
+        head->nwaiting++;
+        if (fresh) {
+            tr_list_append(&head->queue, &req->entry);
+        }
+
+        owner->waiting = req;
+        owner->waitname = name;
+        owner->task = task;
+        owner->waitstart = tr_clock_now();
+        tr_lockmgr_unguard(p);
+        return trstatus_pending;
+    }
+
+    if (fresh) {
+        tr_lockmgr_drop(owner, req);
+        tr_lockmgr_unused(p, head);
+    }
+    tr_lockmgr_unguard(p);
+    return s;
+}
+
+// Releases one granted lock
+static void tr_lockmgr_release(trlockowner *owner, trlockreq *req, trlist *woken)
+{
+    trlockhead *head = req->head;
+    trlockpartition *p = tr_lockmgr_partition(owner->mgr, tr_lockname_hash(head->name));
+
+    tr_lockmgr_guard(p);
+    tr_assert(req->mode != trlock_none && req->wanted == trlock_none);
+    head->granted[req->mode]--;
+    p->stat.nheld--;
+    tr_list_remove(&req->entry);
+    tr_lockmgr_dispatch(p, head, woken);
+    tr_lockmgr_unguard(p);
+
+    tr_lockmgr_drop(owner, req);
+}
+
+// Tries to replace the owner's page and row locks under a table with one
+// lock on the whole table, without waiting
+//
+static bool tr_lockmgr_escalate(trlockowner *owner, trlockreq *table, trlockmode mode)
+{
+    bool write = mode != trlock_is && mode != trlock_s;
+    trlockmode target = write || table->mode != trlock_is ? trlock_x : trlock_s;
+    trlockname name = table->head->name;
+
+    trlockreq *req;
+    if (tr_failed(tr_lockmgr_acquire(owner, NULL, name, target, NULL, &req))) {
+        return false;
+    }
+
+    trlist woken = tr_list_staticinit(woken);
+    trlist *entry = owner->locks.next;
+    while (entry != &owner->locks) {
+        trlockreq *r = container_of(entry, trlockreq, ownerentry);
+        entry = entry->next;
+        if (r != table && r->head->name.table == name.table) {
+            tr_lockmgr_release(owner, r, &woken);
+        }
+    }
+    tr_assert(table->nrows == 0);
+    owner->lastpage = NULL;
+
+    trlockpartition *p = tr_lockmgr_partition(owner->mgr, tr_lockname_hash(name));
+    tr_lockmgr_guard(p);
+    p->stat.nescalations++;
+    tr_lockmgr_unguard(p);
+
+    tr_lockmgr_wake(&woken);
+    return true;
+}
+
+// Looks for a table or page lock the owner remembers
+static trlockreq *tr_lockmgr_recall(trlockreq *req, trlockname name)
+{
+    return req != NULL && tr_lockname_equal(req->head->name, name) ? req : NULL;
+}
+
+// Takes one lock above a page or row: an intention lock unless something
+// stronger is already held
+//
+static trstatus tr_lockmgr_intend(trlockowner *owner, trtask *task, trlockname name,
+        trlockmode mode, trlockreq *remembered, trlockreq **result)
+{
+    trlockmode intent = mode == trlock_is || mode == trlock_s ? trlock_is : trlock_ix;
+
+    trlockreq *req = tr_lockmgr_recall(remembered, name);
+    if (req != NULL && tr_lock_join[req->mode][intent] == req->mode) {
+        *result = req;
+        return trstatus_ok;
+    }
+
+    return tr_lockmgr_acquire(owner, task, name, intent, NULL, result);
+}
+
+trstatus tr_lockmgr_lock(trlockowner *owner, trtask *task, trlockname name, trlockmode mode)
+{
+    tr_assert(mode != trlock_none);
+
+    // Every request starts again from the top, so a resumed owner finishes
+    // its wait and then finds the locks it already has
+    if (owner->waiting != NULL) {
+        trstatus s = tr_lockmgr_finish(owner);
+        if (s != trstatus_ok) {
+            return s;
+        }
+    }
+
+    trlockreq *table, *page, *row;
+    if (name.page == tr_lock_whole) {
+        return tr_lockmgr_acquire(owner, task, name, mode, NULL, &table);
+    }
+
+    trlockname tablename = tr_lockname_table(name.table);
+    trstatus s = tr_lockmgr_intend(owner, task, tablename, mode, owner->lasttable, &table);
+    if (s != trstatus_ok || tr_lock_covers(table->mode, mode)) {
+        return s;
+    }
+
+    if (name.row == tr_lock_whole) {
+        return tr_lockmgr_acquire(owner, task, name, mode, NULL, &page);
+    }
+
+    if (table->nrows >= owner->mgr->escalation && tr_lockmgr_escalate(owner, table, mode)) {
+        return trstatus_ok;
+    }
+
+    trlockname pagename = tr_lockname_page(name.table, name.page);
+    s = tr_lockmgr_intend(owner, task, pagename, mode, owner->lastpage, &page);
+    if (s != trstatus_ok || tr_lock_covers(page->mode, mode)) {
+        return s;
+    }
+
+    return tr_lockmgr_acquire(owner, task, name, mode, table, &row);
+}
+
+trlockmode tr_lockmgr_held(trlockowner *owner, trlockname name)
+{
+    uint64_t hash = tr_lockname_hash(name);
+    trlockpartition *p = tr_lockmgr_partition(owner->mgr, hash);
+
+    tr_lockmgr_guard(p);
+    trlockhead *head = tr_lockmgr_find(tr_lockmgr_bucket(p, hash), name);
+    trlockreq *req = head != NULL ? tr_lockmgr_mine(head, owner) : NULL;
+    trlockmode mode = req != NULL ? req->mode : trlock_none;
+    tr_lockmgr_unguard(p);
+
+    return mode;
+}
+
+void tr_lockmgr_release_all(trlockowner *owner)
+{
+    tr_assert(owner->waiting == NULL);
+
+    // Beneath first, so nobody can lock a table while this owner still
+    // holds rows in it
+    trlist woken = tr_list_staticinit(woken);
+    while (!tr_list_empty(&owner->locks)) {
+        trlockreq *req = container_of(owner->locks.prev, trlockreq, ownerentry);
+        tr_lockmgr_release(owner, req, &woken);
+    }
+
+    owner->lasttable = NULL;
+    owner->lastpage = NULL;
+    tr_lockmgr_wake(&woken);
+}
+
+trlockmgrstat tr_lockmgr_stat(trlockmgr *mgr)
+{
+    trlockmgrstat stat;
+    memset(&stat, 0, sizeof(stat));
+
+    for (int i = 0; i < tr_lockmgr_npartitions; ++i) {
+        trlockpartition *p = mgr->partitions + i;
+
+        tr_lockmgr_guard(p);
+        stat.locks.nacquire += p->stat.locks.nacquire;
+        stat.locks.ncontended += p->stat.locks.ncontended;
+        stat.locks.waittime += p->stat.locks.waittime;
+        stat.locks.maxwait = max(stat.locks.maxwait, p->stat.locks.maxwait);
+        stat.nconflicts += p->stat.nconflicts;
+        stat.nconversions += p->stat.nconversions;
+        stat.nescalations += p->stat.nescalations;
+        stat.nheld += p->stat.nheld;
+        stat.nguardwaits += p->stat.nguardwaits;
+        tr_lockmgr_unguard(p);
+    }
+
+    return stat;
+}
@@ -0,0 +1,233 @@
+//////////////////////////////////////////////////////////////////////////////
+//
+// Terrascale
+// Copyright (c) Dave Kilian & Emily Kilian 2023. All rights reserved.
+//
+// lockmgr.h - a hierarchical lock manager
+//
+// Transactions (lock owners, trlockowner) lock tables, pages and rows by
+// name, and hold their locks until they release them all at once (strict
+// two-phase locking). The names form a hierarchy, and locking a page or a
+// row first takes intention locks on everything above it:
+//
+// - IS or IX on a table or page says the owner holds (or is about to take)
+//   S or X locks somewhere beneath it. Intention locks are compatible with
+//   each other, so transactions touching different rows of one table don't
+//   get in each other's way, while a table-wide S or X lock still conflicts
+//   with anybody working beneath it.
+//
+// - SIX is what an owner ends up with when it holds both S and IX on one
+//   name (it reads everything and writes some of it).
+//
+// - A lock covers everything beneath it: once an owner holds S on a table,
+//   reads of its rows need no more locks, and X covers writes too.
+//
+// Row locks are what make a lock table big. Once an owner holds
+// `escalation` row locks under one table, its next row lock tries to
+// escalate: to take S (if it has only read the table) or X on the whole
+// table, and drop its page and row locks there. If that can't be granted
+// without waiting, the owner carries on with row locks and tries again
+// later.
+//
+// The lock table is split into partitions by a hash of the name, each with
+// its own spinlock (the guard), so owners locking different names rarely
+// touch the same cache lines. A lock exists in the table only while
+// somebody holds or waits for it. Owners also remember their latest table
+// and page locks, so locking many rows of one table only visits the
+// table's partition once.
+//
+// Waiting follows sync.h's conventions: the owner's task is parked (the
+// request returns trstatus_pending) and resumed once the lock is granted,
+// at which point it must make the same request again to complete it.
+// Waiting requests queue on the lock through an intrusive list node in the
+// request itself, which is also what records the lock once it's granted,
+// so waiting allocates nothing extra. Requests are granted in FIFO order,
+// except that owners converting a lock they already hold go first.
+//
+// Deadlocks are prevented rather than detected, by wait-die: each owner has
+// an age, and an owner may only wait for younger owners. A request which
+// would wait for an older owner fails with trstatus_conflict instead, and
+// the owner must release everything and retry. An owner keeps its age
+// across retries, so it eventually becomes the oldest and is never refused.
+//
+//////////////////////////////////////////////////////////////////////////////
+
+#pragma once
+
+#include <runtime/list.h>
+#include <taskman/sync.h>
+
+// Partitions of the lock table
+#define tr_lockmgr_npartitions 64
+
+// Hash buckets in each partition
+#define tr_lockmgr_nbuckets 1024
+
+// Default number of row locks under one table which triggers escalation
+#define tr_lockmgr_escalation 1024
+
+// Lock modes, weakest first
+typedef enum {
+
+    trlock_none,        // Not locked
+    trlock_is,          // Intention shared
+    trlock_ix,          // Intention exclusive
+    trlock_s,           // Shared
+    trlock_six,         // Shared and intention exclusive
+    trlock_x,           // Exclusive
+
+} trlockmode;
+
+#define tr_lock_nmodes 6
+
+// Marks the levels a name doesn't go down to
+#define tr_lock_whole UINT64_MAX
+
+// The name of a lockable object: a table, a page of a table, or a row of a
+// page (see tr_lockname_table, etc)
+//
+typedef struct {
+
+    uint64_t table;         // The table
+    uint64_t page;          // The page, or tr_lock_whole for the table
+    uint64_t row;           // The row, or tr_lock_whole for the page
+
+} trlockname;
+
+static inline trlockname tr_lockname_table(uint64_t table)
+{
+    return (trlockname){ table, tr_lock_whole, tr_lock_whole };
+}
+
+static inline trlockname tr_lockname_page(uint64_t table, uint64_t page)
+{
+    return (trlockname){ table, page, tr_lock_whole };
+}
+
+static inline trlockname tr_lockname_row(uint64_t table, uint64_t page, uint64_t row)
+{
+    return (trlockname){ table, page, row };
+}
+
+struct _trlockowner;
+
+// A lockable object which somebody holds or waits for
+typedef struct {
+
+    trlist entry;           // Entry in a hash bucket, or the spare list
+    trlockname name;        // What's locked
+    trlist queue;           // Requests (trlockreq.entry), in arrival order
+    unsigned granted[tr_lock_nmodes]; // Granted requests in each mode
+    unsigned nwaiting;      // Requests waiting for a grant or conversion
+
+} trlockhead;
+
+// An owner's request for a lock, which records the lock once it's granted
+typedef struct _trlockreq {
+
+    trlist entry;           // Entry in head->queue
+    trlist ownerentry;      // Entry in owner->locks, or owner->spare
+    trlockhead *head;       // The lock
+    struct _trlockowner *owner; // Who's asking
+    trlockmode mode;        // Mode granted, or none if not granted yet
+    trlockmode wanted;      // Mode waited for, or none if not waiting
+    bool refused;           // Whether wait-die refused the waiting request
+    unsigned nrows;         // Tables: row locks held beneath
+    struct _trlockreq *table; // Rows: the owner's lock on their table
+
+} trlockreq;
+
+// Lock manager statistics
+typedef struct {
+
+    trlockstat locks;       // Requests granted, and their waits
+    uint64_t nconflicts;    // Requests refused by wait-die
+    uint64_t nconversions;  // Granted locks strengthened
+    uint64_t nescalations;  // Row locks escalated to table locks
+    uint64_t nheld;         // Requests currently granted
+    uint64_t nguardwaits;   // Times a partition guard was found busy
+
+} trlockmgrstat;
+
+// A partition of the lock table
+typedef struct {
+
+    _Alignas(64)
+    _Atomic bool guard;     // Protects the partition
+    trlist buckets[tr_lockmgr_nbuckets]; // Locks, by hash of their names
+    trlist spare;           // Unused lock heads, for reuse
+    trlockmgrstat stat;     // Statistics for locks in the partition
+
+} trlockpartition;
+
+// A lock manager
+typedef struct {
+
+    trlockpartition *partitions; // Array of tr_lockmgr_npartitions
+    unsigned escalation;    // Row locks per table which trigger escalation
+    _Atomic uint64_t nextage; // Age of the next owner
+    tralloctag tag;         // Tag for allocations
+
+} trlockmgr;
+
+// A transaction, as far as locking is concerned. Only one task may use it
+// at a time.
+//
+typedef struct _trlockowner {
+
+    trlockmgr *mgr;         // The lock manager
+    uint64_t age;           // Lower is older, for wait-die
+    trlist locks;           // Requests (trlockreq.ownerentry), oldest first
+    trlist spare;           // Released requests, for reuse
+    trlockreq *lasttable;   // The owner's most recent table and page locks,
+    trlockreq *lastpage;    // which it can check without any guard
+    trlockreq *waiting;     // The request the owner is parked on
+    trlockname waitname;    // Its name
+    trtask *task;           // The task parked on it
+    trtime waitstart;       // When it started waiting
+
+} trlockowner;
+
+// Initializes a lock manager. Owners with `escalation` row locks under one
+// table try to escalate them (0 for tr_lockmgr_escalation).
+//
+trstatus tr_lockmgr_initialize(trlockmgr *mgr, unsigned escalation, tralloctag tag);
+
+// Frees the lock manager. Every owner must have released its locks.
+void tr_lockmgr_cleanup(trlockmgr *mgr);
+
+// Initializes a lock owner, which is younger than every owner before it
+void tr_lockmgr_owner_initialize(trlockmgr *mgr, trlockowner *owner);
+
+// Releases the owner's locks, and frees its resources
+void tr_lockmgr_owner_cleanup(trlockowner *owner);
+
+// Locks the named object in the given mode (or a stronger one), taking
+// intention locks above it first. Returns:
+//
+// - trstatus_ok when the owner holds the lock.
+//
+// - trstatus_pending when the task has been parked; it must make the same
+//   request again when it's resumed (see the top of this file). If `task` is
+//   NULL, the request never waits, and returns trstatus_later instead.
+//
+// - trstatus_conflict when waiting could deadlock (see the top of this
+//   file). The owner must release its locks, and may then retry.
+//
+// - trstatus_no_mem if a lock can't be allocated.
+//
+// A request which fails may leave intention locks behind; they're released
+// with the rest.
+//
+trstatus tr_lockmgr_lock(trlockowner *owner, trtask *task, trlockname name, trlockmode mode);
+
+// Gets the mode the owner holds the named object in, ignoring locks above it
+trlockmode tr_lockmgr_held(trlockowner *owner, trlockname name);
+
+// Releases every lock the owner holds (at commit or abort). The owner keeps
+// its age, so it can retry after a conflict.
+//
+void tr_lockmgr_release_all(trlockowner *owner);
+
+// Gets the lock manager's statistics, summed over its partitions
+trlockmgrstat tr_lockmgr_stat(trlockmgr *mgr);
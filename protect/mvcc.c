@@ -0,0 +1,325 @@
+//////////////////////////////////////////////////////////////////////////////
+//
+// Terrascale
+// Copyright (c) Dave Kilian & Emily Kilian 2023. All rights reserved.
+//
+//////////////////////////////////////////////////////////////////////////////
+
+#include <pch.h>
+#include <protect/mvcc.h>
+
+void tr_mvcc_initialize(trmvcc *mvcc, tralloctag tag)
+{
+    atomic_init(&mvcc->clock, 0);
+    pthread_mutex_init(&mvcc->commitlock, NULL);
+    pthread_mutex_init(&mvcc->lock, NULL);
+    tr_list_initialize(&mvcc->active);
+    mvcc->nextid = 0;
+    tr_epoch_initialize(&mvcc->epoch);
+    mvcc->tag = tag;
+
+    atomic_init(&mvcc->commits, 0);
+    atomic_init(&mvcc->aborts, 0);
+    atomic_init(&mvcc->conflicts, 0);
+    atomic_init(&mvcc->versions, 0);
+    atomic_init(&mvcc->collected, 0);
+}
+
+void tr_mvcc_cleanup(trmvcc *mvcc)
+{
+    tr_assert(tr_list_empty(&mvcc->active));
+
+    tr_epoch_cleanup(&mvcc->epoch);
+    pthread_mutex_destroy(&mvcc->lock);
+    pthread_mutex_destroy(&mvcc->commitlock);
+}
+
+void tr_mvcc_row_initialize(trmvccrow *row)
+{
+    atomic_init(&row->head, NULL);
+    atomic_init(&row->collecting, false);
+}
+
+void tr_mvcc_row_cleanup(trmvccrow *row)
+{
+    trversion *v = atomic_load_explicit(&row->head, memory_order_relaxed);
+    while (v != NULL) {
+        trversion *older = atomic_load_explicit(&v->older, memory_order_relaxed);
+        tr_free(v);
+        v = older;
+    }
+
+    atomic_store_explicit(&row->head, NULL, memory_order_relaxed);
+}
+
+void tr_mvcc_begin(trmvcc *mvcc, trmvcctxn *txn)
+{
+    txn->mvcc = mvcc;
+    txn->writes = NULL;
+    txn->nwrites = 0;
+    tr_epoch_register(&mvcc->epoch, &txn->epoch);
+
+    // Snapshots are taken under the lock, so the active list stays sorted
+    pthread_mutex_lock(&mvcc->lock);
+    txn->snapshot = atomic_load_explicit(&mvcc->clock, memory_order_acquire);
+    txn->id = ++mvcc->nextid;
+    tr_list_append(&mvcc->active, &txn->entry);
+    pthread_mutex_unlock(&mvcc->lock);
+}
+
+// The oldest snapshot. Called with the lock held.
+static trts tr_mvcc_oldest_locked(trmvcc *mvcc)
+{
+    if (tr_list_empty(&mvcc->active)) {
+        return atomic_load_explicit(&mvcc->clock, memory_order_acquire);
+    }
+
+    return container_of(mvcc->active.next, trmvcctxn, entry)->snapshot;
+}
+
+trts tr_mvcc_oldest(trmvcc *mvcc)
+{
+    pthread_mutex_lock(&mvcc->lock);
+    trts oldest = tr_mvcc_oldest_locked(mvcc);
+    pthread_mutex_unlock(&mvcc->lock);
+    return oldest;
+}
+
+// Cuts the versions of a row which no snapshot at or after `oldest` can see
+// off its chain, retiring them through the given epoch thread. Skips the
+// row if another collector holds it. Returns the number collected.
+//
+static uint64_t tr_mvcc_collect(trmvcc *mvcc, trepochthread *thread, trmvccrow *row, trts oldest)
+{
+    bool expected = false;
+    if (!atomic_compare_exchange_strong(&row->collecting, &expected, true)) {
+        return 0;
+    }
+
+    // An abort may unlink and retire the versions in front of the one kept
+    tr_epoch_enter(thread);
+
+    // Find the newest version every snapshot sees (or something newer)
+    trversion *v = atomic_load_explicit(&row->head, memory_order_acquire);
+    while (v != NULL) {
+        trts ts = atomic_load_explicit(&v->ts, memory_order_acquire);
+        if ((ts & tr_mvcc_uncommitted) == 0 && ts <= oldest) {
+            break;
+        }
+        v = atomic_load_explicit(&v->older, memory_order_acquire);
+    }
+
+    uint64_t count = 0;
+    if (v != NULL) {
+        trversion *tail = atomic_exchange_explicit(&v->older, NULL, memory_order_acq_rel);
+        while (tail != NULL) {
+            trversion *older = atomic_load_explicit(&tail->older, memory_order_relaxed);
+            tr_epoch_free(thread, tail, &tail->node);
+            tail = older;
+            count++;
+        }
+
+        // A deletion every snapshot sees leaves nothing to keep, unless a
+        // writer has just put a version in front of it
+        trversion *head = v;
+        if (v->deleted && atomic_compare_exchange_strong(&row->head, &head, NULL)) {
+            tr_epoch_free(thread, v, &v->node);
+            count++;
+        }
+    }
+
+    tr_epoch_exit(thread);
+    atomic_store_explicit(&row->collecting, false, memory_order_release);
+
+    if (count > 0) {
+        atomic_fetch_add_explicit(&mvcc->collected, count, memory_order_relaxed);
+    }
+    return count;
+}
+
+// Takes a finished transaction off the active list, and returns the
+// oldest snapshot left
+//
+static trts tr_mvcc_end(trmvcctxn *txn)
+{
+    trmvcc *mvcc = txn->mvcc;
+
+    pthread_mutex_lock(&mvcc->lock);
+    tr_list_remove(&txn->entry);
+    trts oldest = tr_mvcc_oldest_locked(mvcc);
+    pthread_mutex_unlock(&mvcc->lock);
+
+    return oldest;
+}
+
+void tr_mvcc_commit(trmvcctxn *txn)
+{
+    trmvcc *mvcc = txn->mvcc;
+
+    // Once stamped, the transaction's versions can be collected by other
+    // commits, so stay pinned while walking the write set
+    tr_epoch_enter(&txn->epoch);
+
+    // Every version is stamped before the clock moves, so no snapshot can
+    // see part of the transaction
+    if (txn->nwrites > 0) {
+        pthread_mutex_lock(&mvcc->commitlock);
+        trts ts = atomic_load_explicit(&mvcc->clock, memory_order_relaxed) + 1;
+        for (trversion *v = txn->writes; v != NULL; v = v->nextwrite) {
+            atomic_store_explicit(&v->ts, ts, memory_order_release);
+        }
+        atomic_store_explicit(&mvcc->clock, ts, memory_order_release);
+        pthread_mutex_unlock(&mvcc->commitlock);
+    }
+
+    trts oldest = tr_mvcc_end(txn);
+    for (trversion *v = txn->writes; v != NULL; v = v->nextwrite) {
+        tr_mvcc_collect(mvcc, &txn->epoch, v->row, oldest);
+    }
+    tr_epoch_exit(&txn->epoch);
+
+    tr_epoch_unregister(&txn->epoch);
+    atomic_fetch_add_explicit(&mvcc->commits, 1, memory_order_relaxed);
+}
+
+void tr_mvcc_abort(trmvcctxn *txn)
+{
+    trmvcc *mvcc = txn->mvcc;
+
+    // Nobody can write in front of an uncommitted version, so each of the
+    // transaction's versions is its row's head when its turn comes
+    trversion *v = txn->writes;
+    while (v != NULL) {
+        trversion *next = v->nextwrite;
+        tr_assert(atomic_load(&v->row->head) == v);
+
+        trversion *older = atomic_load_explicit(&v->older, memory_order_relaxed);
+        atomic_store_explicit(&v->row->head, older, memory_order_release);
+        tr_epoch_free(&txn->epoch, v, &v->node);
+        v = next;
+    }
+
+    tr_mvcc_end(txn);
+    tr_epoch_unregister(&txn->epoch);
+    atomic_fetch_add_explicit(&mvcc->aborts, 1, memory_order_relaxed);
+}
+
+trstatus tr_mvcc_read(trmvcctxn *txn, trmvccrow *row,
+        void *buffer, unsigned capacity, unsigned *length)
+{
+    trts mine = tr_mvcc_uncommitted | txn->id;
+    trstatus s = trstatus_not_found;
+    tr_epoch_enter(&txn->epoch);
+
+    trversion *v = atomic_load_explicit(&row->head, memory_order_acquire);
+    while (v != NULL) {
+        trts ts = atomic_load_explicit(&v->ts, memory_order_acquire);
+        if ((ts & tr_mvcc_uncommitted) != 0 ? ts == mine : ts <= txn->snapshot) {
+            break;
+        }
+        v = atomic_load_explicit(&v->older, memory_order_acquire);
+    }
+
+    if (v != NULL && !v->deleted) {
+        *length = v->length;
+        if (v->length > capacity) {
+            s = trstatus_too_small;
+        } else {
+            memcpy(buffer, v->data, v->length);
+            s = trstatus_ok;
+        }
+    }
+
+    tr_epoch_exit(&txn->epoch);
+    return s;
+}
+
+// Pushes a new version onto a row, unless that would overwrite a write the
+// transaction can't see
+//
+static trstatus tr_mvcc_push(trmvcctxn *txn, trmvccrow *row,
+        const void *data, unsigned length, bool deleted)
+{
+    trmvcc *mvcc = txn->mvcc;
+    trts mine = tr_mvcc_uncommitted | txn->id;
+
+    trversion *v = tr_alloc(sizeof(trversion) + length, mvcc->tag);
+    if (v == NULL) {
+        return trstatus_no_mem;
+    }
+
+    atomic_init(&v->ts, mine);
+    v->row = row;
+    v->length = length;
+    v->deleted = deleted;
+    if (length > 0) {
+        memcpy(v->data, data, length);
+    }
+
+    // The head may be aborted or collected while it's being checked
+    tr_epoch_enter(&txn->epoch);
+
+    trversion *head = atomic_load_explicit(&row->head, memory_order_acquire);
+    for (;;) {
+        if (head != NULL) {
+            trts ts = atomic_load_explicit(&head->ts, memory_order_acquire);
+            bool conflict = (ts & tr_mvcc_uncommitted) != 0 ? ts != mine : ts > txn->snapshot;
+            if (conflict) {
+                tr_epoch_exit(&txn->epoch);
+                tr_free(v);
+                atomic_fetch_add_explicit(&mvcc->conflicts, 1, memory_order_relaxed);
+                return trstatus_conflict;
+            }
+        }
+
+        atomic_store_explicit(&v->older, head, memory_order_relaxed);
+        if (atomic_compare_exchange_weak_explicit(&row->head, &head, v,
+                memory_order_release, memory_order_acquire)) {
+            break;
+        }
+    }
+    tr_epoch_exit(&txn->epoch);
+
+    v->nextwrite = txn->writes;
+    txn->writes = v;
+    txn->nwrites++;
+    atomic_fetch_add_explicit(&mvcc->versions, 1, memory_order_relaxed);
+    return trstatus_ok;
+}
+
+trstatus tr_mvcc_write(trmvcctxn *txn, trmvccrow *row, const void *data, unsigned length)
+{
+    return tr_mvcc_push(txn, row, data, length, false);
+}
+
+trstatus tr_mvcc_delete(trmvcctxn *txn, trmvccrow *row)
+{
+    return tr_mvcc_push(txn, row, NULL, 0, true);
+}
+
+uint64_t tr_mvcc_vacuum(trmvcc *mvcc, trmvccrow *rows, size_t nrows)
+{
+    trepochthread thread;
+    tr_epoch_register(&mvcc->epoch, &thread);
+
+    uint64_t count = 0;
+    trts oldest = tr_mvcc_oldest(mvcc);
+    for (size_t i = 0; i < nrows; ++i) {
+        count += tr_mvcc_collect(mvcc, &thread, rows + i, oldest);
+    }
+
+    tr_epoch_unregister(&thread);
+    return count;
+}
+
+trmvccstat tr_mvcc_stat(trmvcc *mvcc)
+{
+    trmvccstat stat;
+    stat.clock = atomic_load_explicit(&mvcc->clock, memory_order_relaxed);
+    stat.commits = atomic_load_explicit(&mvcc->commits, memory_order_relaxed);
+    stat.aborts = atomic_load_explicit(&mvcc->aborts, memory_order_relaxed);
+    stat.conflicts = atomic_load_explicit(&mvcc->conflicts, memory_order_relaxed);
+    stat.versions = atomic_load_explicit(&mvcc->versions, memory_order_relaxed);
+    stat.collected = atomic_load_explicit(&mvcc->collected, memory_order_relaxed);
+    return stat;
+}
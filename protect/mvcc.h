@@ -0,0 +1,173 @@
+//////////////////////////////////////////////////////////////////////////////
+//
+// Terrascale
+// Copyright (c) Dave Kilian & Emily Kilian 2023. All rights reserved.
+//
+// mvcc.h - multi-version concurrency control with snapshot isolation
+//
+// Each row (trmvccrow) holds a chain of versions, newest first. Writing a
+// row never overwrites a version in place; it pushes a new version onto the
+// front of the chain. That lets readers and writers share rows without
+// blocking each other:
+//
+// - A transaction takes a snapshot of the commit clock when it begins, and
+//   reads the newest version of each row committed at or before its
+//   snapshot (or its own uncommitted write). Reads take no locks and never
+//   wait, however long the transaction runs.
+//
+// - Writes push versions marked uncommitted. If a row's newest version was
+//   written by another transaction which is still running, or committed
+//   after this transaction's snapshot, the write fails with
+//   trstatus_conflict (first updater wins), and the transaction must abort.
+//
+// - Commit stamps the transaction's versions with the next commit
+//   timestamp, then advances the clock, so a snapshot sees either all of a
+//   transaction's writes or none of them. Commits are serialized by a short
+//   lock; nothing else is.
+//
+// - Abort unlinks the transaction's versions again.
+//
+// Old versions are garbage collected against the oldest active snapshot:
+// once a row has a version committed at or before it, every older version
+// is invisible to every transaction, and is cut off the chain. Commits
+// collect the rows they wrote; tr_mvcc_vacuum collects any others. So a
+// long-running transaction holds back collection, but not writers.
+//
+// Readers walk chains while collectors and aborts unlink versions, so
+// unlinked versions are freed through an epoch domain (see epoch.h); each
+// transaction registers with it for its lifetime.
+//
+//////////////////////////////////////////////////////////////////////////////
+
+#pragma once
+
+#include <protect/epoch.h>
+
+// A commit timestamp
+typedef uint64_t trts;
+
+// Marks a version's timestamp as uncommitted; the rest is the writer's id
+#define tr_mvcc_uncommitted (1ull << 63)
+
+struct _trmvccrow;
+
+// One version of a row
+typedef struct _trversion {
+
+    _Atomic(struct _trversion *) older; // The next older version
+    _Atomic trts ts;            // Commit timestamp, or uncommitted | txn id
+    struct _trversion *nextwrite; // Next in the writer's write set
+    struct _trmvccrow *row;     // The row the version belongs to
+    trepochnode node;           // For freeing once unlinked
+    unsigned length;            // Length of data
+    bool deleted;               // Whether this version deletes the row
+    char data[];                // The row's contents
+
+} trversion;
+
+// A row, identified by its address. Rows start out absent.
+typedef struct _trmvccrow {
+
+    _Atomic(trversion *) head;  // The newest version, or NULL
+    _Atomic bool collecting;    // Whether a collector holds the row
+
+} trmvccrow;
+
+// Statistics
+typedef struct {
+
+    trts clock;                 // Last commit timestamp
+    uint64_t commits;           // Transactions committed
+    uint64_t aborts;            // Transactions aborted
+    uint64_t conflicts;         // Writes refused for conflicts
+    uint64_t versions;          // Versions written
+    uint64_t collected;         // Versions garbage collected
+
+} trmvccstat;
+
+// A set of rows under one commit clock
+typedef struct {
+
+    _Atomic trts clock;         // Last commit timestamp
+    pthread_mutex_t commitlock; // Serializes commits
+    pthread_mutex_t lock;       // Protects the fields below
+    trlist active;              // Running transactions, oldest snapshot first
+    uint64_t nextid;            // Id of the next transaction
+    trepoch epoch;              // Frees unlinked versions
+    tralloctag tag;             // Tag for version allocations
+
+    _Atomic uint64_t commits;   // Statistics
+    _Atomic uint64_t aborts;
+    _Atomic uint64_t conflicts;
+    _Atomic uint64_t versions;
+    _Atomic uint64_t collected;
+
+} trmvcc;
+
+// A transaction. Only one thread may use it at a time.
+typedef struct {
+
+    trmvcc *mvcc;               // The rows' concurrency control
+    trts snapshot;              // Commits visible to the transaction
+    uint64_t id;                // Marks the transaction's uncommitted versions
+    trlist entry;               // Entry in mvcc->active
+    trepochthread epoch;        // Pins versions while reading them
+    trversion *writes;          // Versions written, newest first
+    unsigned nwrites;           // Number of versions written
+
+} trmvcctxn;
+
+// Initializes concurrency control for a set of rows
+void tr_mvcc_initialize(trmvcc *mvcc, tralloctag tag);
+
+// Cleans up. No transactions may be running, and the rows must have been
+// cleaned up first.
+//
+void tr_mvcc_cleanup(trmvcc *mvcc);
+
+// Initializes an absent row
+void tr_mvcc_row_initialize(trmvccrow *row);
+
+// Frees every version of a row which no transaction is using any more
+void tr_mvcc_row_cleanup(trmvccrow *row);
+
+// Begins a transaction, taking its snapshot
+void tr_mvcc_begin(trmvcc *mvcc, trmvcctxn *txn);
+
+// Commits a transaction, making its writes visible to later snapshots, and
+// collects old versions of the rows it wrote
+//
+void tr_mvcc_commit(trmvcctxn *txn);
+
+// Aborts a transaction, discarding its writes
+void tr_mvcc_abort(trmvcctxn *txn);
+
+// Reads the version of a row visible to a transaction, copying it into the
+// given buffer and setting *length to its length.
+//
+// Returns trstatus_not_found if the row is absent or deleted in the
+// snapshot, or trstatus_too_small if the buffer can't hold the row, with
+// *length set to the size needed.
+//
+trstatus tr_mvcc_read(trmvcctxn *txn, trmvccrow *row,
+        void *buffer, unsigned capacity, unsigned *length);
+
+// Writes a row. Returns trstatus_conflict if another transaction has written
+// the row since the snapshot, or is writing it now; the transaction must
+// then abort.
+//
+trstatus tr_mvcc_write(trmvcctxn *txn, trmvccrow *row, const void *data, unsigned length);
+
+// Deletes a row; otherwise like tr_mvcc_write
+trstatus tr_mvcc_delete(trmvcctxn *txn, trmvccrow *row);
+
+// Collects versions of the given rows which no snapshot can see any more.
+// Returns the number of versions collected.
+//
+uint64_t tr_mvcc_vacuum(trmvcc *mvcc, trmvccrow *rows, size_t nrows);
+
+// Gets the oldest snapshot still in use, or the clock if there is none
+trts tr_mvcc_oldest(trmvcc *mvcc);
+
+// Gets a snapshot of the statistics
+trmvccstat tr_mvcc_stat(trmvcc *mvcc);
@@ -0,0 +1,446 @@
+//////////////////////////////////////////////////////////////////////////////
+//
+// Terrascale
+// Copyright (c) Dave Kilian & Emily Kilian 2023. All rights reserved.
+//
+//////////////////////////////////////////////////////////////////////////////
+
+#include <pch.h>
+#include <query/query.h>
+#include <runtime/hash.h>
+
+#include <math.h>
+
+// An empty hash slot, or no group
+#define tr_qagg_none UINT32_MAX
+
+// An aggregation
+typedef struct {
+
+    trqop op;
+    trquery *query;         // For heap allocations
+    trqop *input;           // Where rows come from
+    unsigned group;         // Group column, or tr_query_nogroup
+    const trqagg *aggs;     // The aggregates
+    unsigned naggs;
+
+    // Groups, with values and counts at [group * naggs + aggregate]
+    int64_t *keys;          // Each group's key
+    trcolvalue *values;     // Aggregate values
+    uint64_t *counts;       // Non-null inputs to each aggregate value
+    unsigned ngroups;
+    unsigned capacity;
+    uint32_t nullgroup;     // The group of null keys, or tr_qagg_none
+    uint32_t *slots;        // Hash table of groups, open addressed
+    unsigned nslots;        // A power of two, over twice ngroups
+
+    // Per batch
+    uint16_t *all;          // Every row number
+    uint32_t *groups;       // Each live row's group
+    uint16_t *live;         // Live rows where a column isn't null
+    uint32_t *livegroups;   // Their groups
+
+    // Output
+    bool done;              // Whether the input's been consumed
+    unsigned emitted;       // Groups produced so far
+    trbatch *batch;
+
+} trqaggregate;
+
+// Gets an aggregate's value before it's seen any input
+static trcolvalue tr_qagg_initial(trqaggfn fn, trcoltype type)
+{
+    trcolvalue v;
+    if (type == trcol_f64) {
+        v.f = fn == trqagg_min ? INFINITY : fn == trqagg_max ? -INFINITY : 0.0;
+    } else {
+        v.i = fn == trqagg_min ? INT64_MAX : fn == trqagg_max ? INT64_MIN : 0;
+    }
+    return v;
+}
+
+// Inserts every group with a key into a hash table
+static void tr_qagg_rehash(trqaggregate *agg, uint32_t *slots, unsigned nslots)
+{
+    memset(slots, 0xff, nslots * sizeof(uint32_t));
+    for (unsigned g = 0; g < agg->ngroups; ++g) {
+        if (g == agg->nullgroup) {
+            continue;
+        }
+        unsigned s = tr_hash_u64(agg->keys[g]) & (nslots - 1);
+        while (slots[s] != tr_qagg_none) {
+            s = (s + 1) & (nslots - 1);
+        }
+        slots[s] = g;
+    }
+}
+
+// Adds a group, growing the group arrays and hash table if need be.
+// Returns tr_qagg_none if there's no memory.
+//
+static uint32_t tr_qagg_add(trqaggregate *agg, int64_t key)
+{
+    unsigned naggs = agg->naggs;
+
+    if (agg->ngroups == agg->capacity) {
+        // Each array grows in turn; a failure part way leaves some larger
+        // than they need to be, which is harmless
+        unsigned capacity = max(agg->capacity * 2, 64u);
+        size_t n = agg->ngroups;
+        int64_t *keys = tr_query_grow(agg->query, agg->keys, n * sizeof(int64_t),
+            capacity * sizeof(int64_t));
+        if (keys == NULL) {
+            return tr_qagg_none;
+        }
+        agg->keys = keys;
+        trcolvalue *values = tr_query_grow(agg->query, agg->values, n * naggs * sizeof(trcolvalue),
+            (size_t)capacity * naggs * sizeof(trcolvalue));
+        if (values == NULL) {
+            return tr_qagg_none;
+        }
+        agg->values = values;
+        uint64_t *counts = tr_query_grow(agg->query, agg->counts, n * naggs * sizeof(uint64_t),
+            (size_t)capacity * naggs * sizeof(uint64_t));
+        if (counts == NULL) {
+            return tr_qagg_none;
+        }
+        agg->counts = counts;
+        agg->capacity = capacity;
+    }
+
+    if (agg->group != tr_query_nogroup && (agg->ngroups + 1) * 2 >= agg->nslots) {
+        unsigned nslots = agg->nslots * 2;
+        uint32_t *slots = tr_alloc(nslots * sizeof(uint32_t), agg->query->tag);
+        if (slots == NULL) {
+            return tr_qagg_none;
+        }
+        tr_qagg_rehash(agg, slots, nslots);
+        if (agg->slots != NULL) {
+            tr_free(agg->slots);
+        }
+        agg->slots = slots;
+        agg->nslots = nslots;
+    }
+
+    uint32_t g = agg->ngroups++;
+    agg->keys[g] = key;
+    for (unsigned a = 0; a < naggs; ++a) {
+        const trqagg *spec = agg->aggs + a;
+        agg->values[g * naggs + a] = tr_qagg_initial(spec->fn, agg->input->types[spec->column]);
+        agg->counts[g * naggs + a] = 0;
+    }
+    return g;
+}
+
+// Finds (or adds) the group of each live row
+static trstatus tr_qagg_group(trqaggregate *agg, const trvector *v, const uint16_t *rows, unsigned n)
+{
+    for (unsigned k = 0; k < n; ++k) {
+        unsigned row = rows[k];
+        uint32_t g;
+
+        if (tr_vector_null(v, row)) {
+            if (agg->nullgroup == tr_qagg_none) {
+                agg->nullgroup = tr_qagg_add(agg, 0);
+                if (agg->nullgroup == tr_qagg_none) {
+                    return trstatus_no_mem;
+                }
+            }
+            g = agg->nullgroup;
+        } else {
+            int64_t key = tr_vector_get(v, row).i;
+            unsigned s = tr_hash_u64(key) & (agg->nslots - 1);
+            while ((g = agg->slots[s]) != tr_qagg_none && agg->keys[g] != key) {
+                s = (s + 1) & (agg->nslots - 1);
+            }
+            if (g == tr_qagg_none) {
+                g = tr_qagg_add(agg, key);
+                if (g == tr_qagg_none) {
+                    return trstatus_no_mem;
+                }
+
+                // Adding may have rehashed
+                s = tr_hash_u64(key) & (agg->nslots - 1);
+                while (agg->slots[s] != tr_qagg_none) {
+                    s = (s + 1) & (agg->nslots - 1);
+                }
+                agg->slots[s] = g;
+            }
+        }
+
+        agg->groups[k] = g;
+    }
+
+    return trstatus_ok;
+}
+
+// Folds a column's values into an aggregate, for each row and its group
+// (group 0 if `groups` is NULL)
+//
+#define tr_qagg_fold(ctype, field, fold) \
+    do { \
+        const ctype *x = v->values; \
+        if (groups == NULL) { \
+            trcolvalue *acc = values; \
+            for (unsigned k = 0; k < n; ++k) { \
+                ctype value = x[rows[k]]; \
+                fold(acc->field, value); \
+            } \
+        } else { \
+            for (unsigned k = 0; k < n; ++k) { \
+                ctype value = x[rows[k]]; \
+                fold(values[(size_t)groups[k] * naggs].field, value); \
+            } \
+        } \
+    } while (0)
+
+#define tr_qagg_sum_i(acc, value) (acc) = (int64_t)((uint64_t)(acc) + (uint64_t)(value))
+#define tr_qagg_sum_f(acc, value) (acc) += (value)
+#define tr_qagg_min(acc, value) (acc) = (value) < (acc) ? (value) : (acc)
+#define tr_qagg_max(acc, value) (acc) = (value) > (acc) ? (value) : (acc)
+
+// Folds one aggregate over a batch's rows, nulls already removed
+static void tr_qagg_update(trqaggregate *agg, unsigned a, const trvector *v, const uint16_t *rows,
+        const uint32_t *groups, unsigned n)
+{
+    unsigned naggs = agg->naggs;
+    trcolvalue *values = agg->values + a;
+    uint64_t *counts = agg->counts + a;
+
+    if (groups == NULL) {
+        counts[0] += n;
+    } else {
+        for (unsigned k = 0; k < n; ++k) {
+            counts[(size_t)groups[k] * naggs]++;
+        }
+    }
+
+    switch (agg->aggs[a].fn * 3 + v->type) {
+    case trqagg_sum * 3 + trcol_i32: tr_qagg_fold(int32_t, i, tr_qagg_sum_i); break;
+    case trqagg_sum * 3 + trcol_i64: tr_qagg_fold(int64_t, i, tr_qagg_sum_i); break;
+    case trqagg_sum * 3 + trcol_f64: tr_qagg_fold(double, f, tr_qagg_sum_f); break;
+    case trqagg_min * 3 + trcol_i32: tr_qagg_fold(int32_t, i, tr_qagg_min); break;
+    case trqagg_min * 3 + trcol_i64: tr_qagg_fold(int64_t, i, tr_qagg_min); break;
+    case trqagg_min * 3 + trcol_f64: tr_qagg_fold(double, f, tr_qagg_min); break;
+    case trqagg_max * 3 + trcol_i32: tr_qagg_fold(int32_t, i, tr_qagg_max); break;
+    case trqagg_max * 3 + trcol_i64: tr_qagg_fold(int64_t, i, tr_qagg_max); break;
+    case trqagg_max * 3 + trcol_f64: tr_qagg_fold(double, f, tr_qagg_max); break;
+    default: break;
+    }
+}
+
+#undef tr_qagg_fold
+#undef tr_qagg_sum_i
+#undef tr_qagg_sum_f
+#undef tr_qagg_min
+#undef tr_qagg_max
+
+// Folds a batch into the groups
+static trstatus tr_qagg_consume(trqaggregate *agg, const trbatch *in)
+{
+    const uint16_t *rows = in->sel != NULL ? in->sel : agg->all;
+    unsigned n = in->nsel;
+
+    const uint32_t *groups = NULL;
+    if (agg->group != tr_query_nogroup) {
+        trstatus status = tr_qagg_group(agg, in->columns + agg->group, rows, n);
+        if (!tr_ok(status)) {
+            return status;
+        }
+        groups = agg->groups;
+    }
+
+    for (unsigned a = 0; a < agg->naggs; ++a) {
+        const trvector *v = in->columns + agg->aggs[a].column;
+        if (v->nulls == NULL) {
+            tr_qagg_update(agg, a, v, rows, groups, n);
+            continue;
+        }
+
+        // Drop rows where this column is null
+        unsigned m = 0;
+        for (unsigned k = 0; k < n; ++k) {
+            unsigned row = rows[k];
+            agg->live[m] = row;
+            if (groups != NULL) {
+                agg->livegroups[m] = groups[k];
+            }
+            m += !(v->nulls[row / 64] >> (row % 64) & 1);
+        }
+        tr_qagg_update(agg, a, v, agg->live, groups != NULL ? agg->livegroups : NULL, m);
+    }
+
+    return trstatus_ok;
+}
+
+// Writes groups [first, first + count) to the output batch
+static void tr_qagg_emit(trqaggregate *agg, unsigned first, unsigned count)
+{
+    trbatch *out = agg->batch;
+    unsigned naggs = agg->naggs;
+    unsigned column = 0;
+
+    if (agg->group != tr_query_nogroup) {
+        trvector *v = out->columns + column++;
+        memcpy(v->values, agg->keys + first, count * sizeof(int64_t));
+        v->nulls = NULL;
+        if (agg->nullgroup >= first && agg->nullgroup < first + count) {
+            unsigned row = agg->nullgroup - first;
+            memset(v->nullbuf, 0, tr_batch_rows / 8);
+            v->nullbuf[row / 64] |= 1ull << row % 64;
+            v->nulls = v->nullbuf;
+        }
+    }
+
+    for (unsigned a = 0; a < naggs; ++a) {
+        trvector *v = out->columns + column++;
+        int64_t *values = v->values;
+        const uint64_t *counts = agg->counts + (size_t)first * naggs + a;
+
+        if (agg->aggs[a].fn == trqagg_count) {
+            for (unsigned i = 0; i < count; ++i) {
+                values[i] = counts[(size_t)i * naggs];
+            }
+            v->nulls = NULL;
+            continue;
+        }
+
+        // Groups with no values are null
+        const trcolvalue *accs = agg->values + (size_t)first * naggs + a;
+        v->nulls = NULL;
+        memset(v->nullbuf, 0, tr_batch_rows / 8);
+        for (unsigned i = 0; i < count; ++i) {
+            bool null = counts[(size_t)i * naggs] == 0;
+            values[i] = null ? 0 : accs[(size_t)i * naggs].i;
+            if (null) {
+                v->nullbuf[i / 64] |= 1ull << i % 64;
+                v->nulls = v->nullbuf;
+            }
+        }
+    }
+
+    out->count = count;
+    out->sel = NULL;
+    out->nsel = count;
+}
+
+static trstatus tr_qagg_next(trqop *op, trbatch **batch)
+{
+    trqaggregate *agg = (trqaggregate *)op;
+
+    while (!agg->done) {
+        trbatch *in;
+        trstatus status = tr_query_next(agg->input, &in);
+        if (!tr_ok(status)) {
+            *batch = NULL;
+            return status;
+        }
+        if (in == NULL) {
+            agg->done = true;
+            break;
+        }
+        status = tr_qagg_consume(agg, in);
+        if (!tr_ok(status)) {
+            *batch = NULL;
+            return status;
+        }
+    }
+
+    if (agg->emitted == agg->ngroups) {
+        *batch = NULL;
+        return trstatus_ok;
+    }
+
+    unsigned count = min(agg->ngroups - agg->emitted, tr_batch_rows);
+    tr_qagg_emit(agg, agg->emitted, count);
+    agg->emitted += count;
+    *batch = agg->batch;
+    return trstatus_ok;
+}
+
+static void tr_qagg_close(trqop *op)
+{
+    trqaggregate *agg = (trqaggregate *)op;
+    if (agg->keys != NULL) {
+        tr_free(agg->keys);
+    }
+    if (agg->values != NULL) {
+        tr_free(agg->values);
+    }
+    if (agg->counts != NULL) {
+        tr_free(agg->counts);
+    }
+    if (agg->slots != NULL) {
+        tr_free(agg->slots);
+    }
+}
+
+trstatus tr_query_aggregate(trquery *query, trqop *input, unsigned group, const trqagg *aggs,
+        unsigned naggs, trqop **aggregate)
+{
+    bool grouped = group != tr_query_nogroup;
+    if (grouped && (group >= input->ncolumns || input->types[group] == trcol_f64)) {
+        return trstatus_argument;
+    }
+
+    unsigned ncolumns = naggs + grouped;
+    trcoltype *types = tr_query_alloc(query, max(ncolumns, 1u) * sizeof(trcoltype));
+    trqagg *copy = tr_query_alloc(query, max(naggs, 1u) * sizeof(trqagg));
+    if (types == NULL || copy == NULL) {
+        return trstatus_no_mem;
+    }
+
+    if (grouped) {
+        types[0] = trcol_i64;
+    }
+    for (unsigned a = 0; a < naggs; ++a) {
+        if (aggs[a].column >= input->ncolumns) {
+            return trstatus_argument;
+        }
+        trcoltype type = input->types[aggs[a].column];
+        types[grouped + a] = aggs[a].fn == trqagg_count || type == trcol_i32 ? trcol_i64 : type;
+    }
+    memcpy(copy, aggs, naggs * sizeof(trqagg));
+
+    trqaggregate *agg = (trqaggregate *)tr_query_op(query, sizeof(trqaggregate), tr_qagg_next,
+        tr_qagg_close, types, ncolumns);
+    if (agg == NULL) {
+        return trstatus_no_mem;
+    }
+    agg->query = query;
+    agg->input = input;
+    agg->group = group;
+    agg->aggs = copy;
+    agg->naggs = naggs;
+    agg->nullgroup = tr_qagg_none;
+
+    agg->all = tr_query_alloc(query, tr_batch_rows * sizeof(uint16_t));
+    agg->groups = tr_query_alloc(query, tr_batch_rows * sizeof(uint32_t));
+    agg->live = tr_query_alloc(query, tr_batch_rows * sizeof(uint16_t));
+    agg->livegroups = tr_query_alloc(query, tr_batch_rows * sizeof(uint32_t));
+    agg->batch = tr_query_batch(query, types, ncolumns);
+    if (agg->all == NULL || agg->groups == NULL || agg->live == NULL || agg->livegroups == NULL ||
+            agg->batch == NULL) {
+        return trstatus_no_mem;
+    }
+    for (unsigned i = 0; i < tr_batch_rows; ++i) {
+        agg->all[i] = i;
+    }
+
+    // Without grouping, there's always exactly one group
+    if (!grouped) {
+        if (tr_qagg_add(agg, 0) == tr_qagg_none) {
+            return trstatus_no_mem;
+        }
+    } else {
+        agg->nslots = 128;
+        agg->slots = tr_alloc(agg->nslots * sizeof(uint32_t), query->tag);
+        if (agg->slots == NULL) {
+            return trstatus_no_mem;
+        }
+        memset(agg->slots, 0xff, agg->nslots * sizeof(uint32_t));
+    }
+
+    *aggregate = &agg->op;
+    return trstatus_ok;
+}
@@ -0,0 +1,113 @@
+//////////////////////////////////////////////////////////////////////////////
+//
+// Terrascale
+// Copyright (c) Dave Kilian & Emily Kilian 2023. All rights reserved.
+//
+//////////////////////////////////////////////////////////////////////////////
+
+#include <pch.h>
+#include <query/query.h>
+
+// Words in a batch's bitmaps
+#define tr_qfilter_words (tr_batch_rows / 64)
+
+// A filter
+typedef struct {
+
+    trqop op;
+    trqop *input;           // Where rows come from
+    unsigned column;        // Column compared
+    trcolpred pred;         // The comparison
+
+} trqfilter;
+
+// Narrows a batch's selection to the rows whose bits are set
+static void tr_qfilter_select(trbatch *batch, const uint64_t *bits)
+{
+    unsigned n = 0;
+
+    if (batch->sel == NULL) {
+        // Gather the set bits' positions a word at a time
+        uint16_t *sel = batch->selbuf;
+        for (unsigned w = 0; w < tr_qfilter_words; ++w) {
+            for (uint64_t word = bits[w]; word != 0; word &= word - 1) {
+                sel[n++] = w * 64 + __builtin_ctzll(word);
+            }
+        }
+        batch->sel = sel;
+    } else {
+        // Compact the selection in place, without branches
+        uint16_t *sel = batch->sel;
+        for (unsigned k = 0; k < batch->nsel; ++k) {
+            unsigned row = sel[k];
+            sel[n] = row;
+            n += bits[row / 64] >> (row % 64) & 1;
+        }
+    }
+
+    batch->nsel = n;
+}
+
+static trstatus tr_qfilter_next(trqop *op, trbatch **batch)
+{
+    trqfilter *filter = (trqfilter *)op;
+    const trcolpred *pred = &filter->pred;
+
+    for (;;) {
+        trbatch *in;
+        trstatus status = tr_query_next(filter->input, &in);
+        if (!tr_ok(status) || in == NULL) {
+            *batch = NULL;
+            return status;
+        }
+        if (pred->none) {
+            continue;
+        }
+
+        // Test whole words, then drop what's past the end, negated or null
+        const trvector *v = in->columns + filter->column;
+        unsigned nwords = (in->count + 63) / 64;
+        uint64_t bits[tr_qfilter_words];
+        pred->kernel(v->values, nwords, pred->lo, pred->hi, bits);
+
+        uint64_t flip = pred->negate ? ~0ull : 0;
+        for (unsigned w = 0; w < nwords; ++w) {
+            bits[w] ^= flip;
+            if (v->nulls != NULL) {
+                bits[w] &= ~v->nulls[w];
+            }
+        }
+        if (in->count % 64 != 0) {
+            bits[nwords - 1] &= (1ull << in->count % 64) - 1;
+        }
+        for (unsigned w = nwords; w < tr_qfilter_words; ++w) {
+            bits[w] = 0;
+        }
+
+        tr_qfilter_select(in, bits);
+        if (in->nsel != 0) {
+            *batch = in;
+            return trstatus_ok;
+        }
+    }
+}
+
+trstatus tr_query_filter(trquery *query, trqop *input, unsigned column, trcolop op,
+        trcolvalue a, trcolvalue b, trqop **filter)
+{
+    if (column >= input->ncolumns) {
+        return trstatus_argument;
+    }
+
+    trqfilter *f = (trqfilter *)tr_query_op(query, sizeof(trqfilter), tr_qfilter_next, NULL,
+        input->types, input->ncolumns);
+    if (f == NULL) {
+        return trstatus_no_mem;
+    }
+    f->input = input;
+    f->column = column;
+    tr_colpred_compile(&f->pred, input->types[column], op, a, b);
+
+    *filter = &f->op;
+    return trstatus_ok;
+}
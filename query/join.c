@@ -0,0 +1,391 @@
+//////////////////////////////////////////////////////////////////////////////
+//
+// Terrascale
+// Copyright (c) Dave Kilian & Emily Kilian 2023. All rights reserved.
+//
+//////////////////////////////////////////////////////////////////////////////
+
+#include <pch.h>
+#include <query/query.h>
+#include <runtime/hash.h>
+
+// End of a hash chain
+#define tr_qjoin_none UINT32_MAX
+
+// A hash join
+typedef struct {
+
+    trqop op;
+    trquery *query;         // For heap allocations
+    trqop *build;           // Rows to hash
+    trqop *probe;           // Rows to look up
+    unsigned buildkey;      // Key columns
+    unsigned probekey;
+
+    // Build rows, a column at a time
+    void **columns;         // Each column's values, at its width
+    uint64_t **nulls;       // Each column's null bitmap
+    int64_t *keys;          // Each row's key
+    uint32_t *chains;       // The next row in each row's bucket
+    unsigned nrows;
+    unsigned capacity;
+    uint32_t *buckets;      // Each bucket's first row
+    unsigned nbuckets;      // A power of two
+    bool built;             // Whether the build rows are all in
+
+    // Probing
+    trbatch *in;            // Batch being probed, or NULL
+    unsigned pos;           // Its live row being probed
+    uint32_t chain;         // The next build row to compare it against
+    int64_t *probekeys;     // Each live row's key
+    uint32_t *heads;        // Each live row's bucket
+    uint16_t *all;          // Every row number
+
+    // Output
+    uint32_t *probed;       // Probe and build rows of each match
+    uint32_t *matched;
+    trbatch *batch;
+
+} trqjoin;
+
+// Copies values[rows[i]] to out[i] for each of `count` rows
+static void tr_qjoin_gather(void *out, const void *values, unsigned width, const uint32_t *rows,
+        unsigned count)
+{
+    if (width == 4) {
+        const int32_t *v = values;
+        int32_t *o = out;
+        for (unsigned i = 0; i < count; ++i) {
+            o[i] = v[rows[i]];
+        }
+    } else {
+        const int64_t *v = values;
+        int64_t *o = out;
+        for (unsigned i = 0; i < count; ++i) {
+            o[i] = v[rows[i]];
+        }
+    }
+}
+
+// Copies null bits like tr_qjoin_gather. Returns whether any were set.
+static bool tr_qjoin_gather_nulls(uint64_t *out, const uint64_t *nulls, const uint32_t *rows,
+        unsigned count)
+{
+    uint64_t any = 0;
+    memset(out, 0, (count + 63) / 64 * sizeof(uint64_t));
+    for (unsigned i = 0; i < count; ++i) {
+        uint64_t bit = nulls[rows[i] / 64] >> (rows[i] % 64) & 1;
+        out[i / 64] |= bit << i % 64;
+        any |= bit;
+    }
+    return any != 0;
+}
+
+// Makes room for `count` more build rows
+static trstatus tr_qjoin_reserve(trqjoin *join, unsigned count)
+{
+    if (join->nrows + count <= join->capacity) {
+        return trstatus_ok;
+    }
+    if (join->nrows + (uint64_t)count > tr_qjoin_none) {
+        return trstatus_too_large;
+    }
+
+    // Each array grows in turn; a failure part way leaves some larger than
+    // they need to be, which is harmless
+    unsigned capacity = max(join->capacity * 2, join->nrows + count);
+    capacity = (capacity + 63) & ~63u;
+    size_t n = join->nrows;
+    const trqop *build = join->build;
+    for (unsigned c = 0; c < build->ncolumns; ++c) {
+        unsigned width = tr_coltype_width(build->types[c]);
+        void *values = tr_query_grow(join->query, join->columns[c], n * width, (size_t)capacity * width);
+        if (values == NULL) {
+            return trstatus_no_mem;
+        }
+        join->columns[c] = values;
+
+        size_t used = join->capacity / 8;
+        uint64_t *nulls = tr_query_grow(join->query, join->nulls[c], used, capacity / 8);
+        if (nulls == NULL) {
+            return trstatus_no_mem;
+        }
+        memset(ptr_add(nulls, used), 0, capacity / 8 - used);
+        join->nulls[c] = nulls;
+    }
+
+    int64_t *keys = tr_query_grow(join->query, join->keys, n * sizeof(int64_t), capacity * sizeof(int64_t));
+    if (keys == NULL) {
+        return trstatus_no_mem;
+    }
+    join->keys = keys;
+    uint32_t *chains = tr_query_grow(join->query, join->chains, n * sizeof(uint32_t),
+        capacity * sizeof(uint32_t));
+    if (chains == NULL) {
+        return trstatus_no_mem;
+    }
+    join->chains = chains;
+
+    join->capacity = capacity;
+    return trstatus_ok;
+}
+
+// Appends a batch's live rows to the build rows
+static trstatus tr_qjoin_append(trqjoin *join, const trbatch *in)
+{
+    trstatus status = tr_qjoin_reserve(join, in->nsel);
+    if (!tr_ok(status)) {
+        return status;
+    }
+
+    // Widen the live row numbers to gather with
+    uint32_t *rows = join->probed;
+    for (unsigned k = 0; k < in->nsel; ++k) {
+        rows[k] = in->sel != NULL ? in->sel[k] : k;
+    }
+
+    unsigned n = in->nsel;
+    unsigned base = join->nrows;
+    for (unsigned c = 0; c < in->ncolumns; ++c) {
+        const trvector *v = in->columns + c;
+        unsigned width = tr_coltype_width(v->type);
+        tr_qjoin_gather(ptr_add(join->columns[c], (size_t)base * width), v->values, width, rows, n);
+        if (v->nulls != NULL) {
+            uint64_t *nulls = join->nulls[c];
+            for (unsigned k = 0; k < n; ++k) {
+                uint64_t bit = v->nulls[rows[k] / 64] >> (rows[k] % 64) & 1;
+                nulls[(base + k) / 64] |= bit << (base + k) % 64;
+            }
+        }
+
+        if (c == join->buildkey) {
+            for (unsigned k = 0; k < n; ++k) {
+                join->keys[base + k] = tr_vector_get(v, rows[k]).i;
+            }
+        }
+    }
+
+    join->nrows += n;
+    return trstatus_ok;
+}
+
+// Reads in the build rows and hashes them
+static trstatus tr_qjoin_hash(trqjoin *join)
+{
+    for (;;) {
+        trbatch *in;
+        trstatus status = tr_query_next(join->build, &in);
+        if (!tr_ok(status)) {
+            return status;
+        }
+        if (in == NULL) {
+            break;
+        }
+        status = tr_qjoin_append(join, in);
+        if (!tr_ok(status)) {
+            return status;
+        }
+    }
+
+    // At most two rows per bucket, on average
+    unsigned nbuckets = 64;
+    while (nbuckets < join->nrows / 2) {
+        nbuckets *= 2;
+    }
+    join->buckets = tr_alloc(nbuckets * sizeof(uint32_t), join->query->tag);
+    if (join->buckets == NULL) {
+        return trstatus_no_mem;
+    }
+    memset(join->buckets, 0xff, nbuckets * sizeof(uint32_t));
+    join->nbuckets = nbuckets;
+
+    // Insert in reverse, so each chain lists its rows in build order
+    const uint64_t *nulls = join->nulls[join->buildkey];
+    for (unsigned r = join->nrows; r-- > 0;) {
+        if (nulls != NULL && (nulls[r / 64] >> (r % 64) & 1)) {
+            continue;
+        }
+        unsigned b = tr_hash_u64(join->keys[r]) & (nbuckets - 1);
+        join->chains[r] = join->buckets[b];
+        join->buckets[b] = r;
+    }
+
+    join->built = true;
+    return trstatus_ok;
+}
+
+// Starts probing a batch: finds the bucket of each live row
+static void tr_qjoin_start(trqjoin *join, trbatch *in)
+{
+    const trvector *v = in->columns + join->probekey;
+    const uint16_t *rows = in->sel != NULL ? in->sel : join->all;
+    unsigned mask = join->nbuckets - 1;
+
+    for (unsigned k = 0; k < in->nsel; ++k) {
+        unsigned row = rows[k];
+        int64_t key = tr_vector_get(v, row).i;
+        join->probekeys[k] = key;
+        join->heads[k] = tr_vector_null(v, row) ? tr_qjoin_none : join->buckets[tr_hash_u64(key) & mask];
+    }
+
+    join->in = in;
+    join->pos = 0;
+    join->chain = join->heads[0];
+}
+
+// Walks the current batch's chains, collecting matches until the output's
+// full or the batch is done. Returns the number of matches.
+//
+static unsigned tr_qjoin_match(trqjoin *join)
+{
+    const trbatch *in = join->in;
+    const uint16_t *rows = in->sel != NULL ? in->sel : join->all;
+    unsigned n = 0;
+
+    while (join->pos < in->nsel) {
+        int64_t key = join->probekeys[join->pos];
+        uint32_t r = join->chain;
+        while (r != tr_qjoin_none && n < tr_batch_rows) {
+            if (join->keys[r] == key) {
+                join->probed[n] = rows[join->pos];
+                join->matched[n] = r;
+                n++;
+            }
+            r = join->chains[r];
+        }
+
+        if (r != tr_qjoin_none) {
+            // Pick up from here next time
+            join->chain = r;
+            return n;
+        }
+        if (++join->pos < in->nsel) {
+            join->chain = join->heads[join->pos];
+        }
+    }
+
+    join->in = NULL;
+    return n;
+}
+
+static trstatus tr_qjoin_next(trqop *op, trbatch **batch)
+{
+    trqjoin *join = (trqjoin *)op;
+    *batch = NULL;
+
+    if (!join->built) {
+        trstatus status = tr_qjoin_hash(join);
+        if (!tr_ok(status)) {
+            return status;
+        }
+    }
+
+    // Matches refer to rows of the current probe batch, so they're produced
+    // before moving on to the next
+    trbatch *in = NULL;
+    unsigned n = 0;
+    while (n == 0) {
+        if (join->in == NULL) {
+            trstatus status = tr_query_next(join->probe, &in);
+            if (!tr_ok(status) || in == NULL) {
+                return status;
+            }
+            tr_qjoin_start(join, in);
+        }
+        in = join->in;
+        n = tr_qjoin_match(join);
+    }
+
+    // The probe batch stays valid until the probe is asked for another
+    trbatch *out = join->batch;
+    for (unsigned c = 0; c < in->ncolumns; ++c) {
+        const trvector *v = in->columns + c;
+        trvector *o = out->columns + c;
+        tr_qjoin_gather(o->values, v->values, tr_coltype_width(v->type), join->probed, n);
+        bool nulls = v->nulls != NULL && tr_qjoin_gather_nulls(o->nullbuf, v->nulls, join->probed, n);
+        o->nulls = nulls ? o->nullbuf : NULL;
+    }
+    for (unsigned c = 0; c < join->build->ncolumns; ++c) {
+        trvector *o = out->columns + in->ncolumns + c;
+        tr_qjoin_gather(o->values, join->columns[c], tr_coltype_width(o->type), join->matched, n);
+        bool nulls = tr_qjoin_gather_nulls(o->nullbuf, join->nulls[c], join->matched, n);
+        o->nulls = nulls ? o->nullbuf : NULL;
+    }
+
+    out->count = n;
+    out->sel = NULL;
+    out->nsel = n;
+    *batch = out;
+    return trstatus_ok;
+}
+
+static void tr_qjoin_close(trqop *op)
+{
+    trqjoin *join = (trqjoin *)op;
+    for (unsigned c = 0; c < join->build->ncolumns; ++c) {
+        if (join->columns[c] != NULL) {
+            tr_free(join->columns[c]);
+        }
+        if (join->nulls[c] != NULL) {
+            tr_free(join->nulls[c]);
+        }
+    }
+    if (join->keys != NULL) {
+        tr_free(join->keys);
+    }
+    if (join->chains != NULL) {
+        tr_free(join->chains);
+    }
+    if (join->buckets != NULL) {
+        tr_free(join->buckets);
+    }
+}
+
+trstatus tr_query_join(trquery *query, trqop *build, unsigned buildkey, trqop *probe,
+        unsigned probekey, trqop **join)
+{
+    if (buildkey >= build->ncolumns || build->types[buildkey] == trcol_f64 ||
+            probekey >= probe->ncolumns || probe->types[probekey] == trcol_f64) {
+        return trstatus_argument;
+    }
+
+    unsigned ncolumns = probe->ncolumns + build->ncolumns;
+    trcoltype *types = tr_query_alloc(query, ncolumns * sizeof(trcoltype));
+    if (types == NULL) {
+        return trstatus_no_mem;
+    }
+    memcpy(types, probe->types, probe->ncolumns * sizeof(trcoltype));
+    memcpy(types + probe->ncolumns, build->types, build->ncolumns * sizeof(trcoltype));
+
+    trqjoin *j = (trqjoin *)tr_query_op(query, sizeof(trqjoin), tr_qjoin_next, tr_qjoin_close,
+        types, ncolumns);
+    if (j == NULL) {
+        return trstatus_no_mem;
+    }
+    j->query = query;
+    j->build = build;
+    j->probe = probe;
+    j->buildkey = buildkey;
+    j->probekey = probekey;
+
+    j->columns = tr_query_alloc(query, build->ncolumns * sizeof(void *));
+    j->nulls = tr_query_alloc(query, build->ncolumns * sizeof(uint64_t *));
+    j->probekeys = tr_query_alloc(query, tr_batch_rows * sizeof(int64_t));
+    j->heads = tr_query_alloc(query, tr_batch_rows * sizeof(uint32_t));
+    j->all = tr_query_alloc(query, tr_batch_rows * sizeof(uint16_t));
+    j->probed = tr_query_alloc(query, tr_batch_rows * sizeof(uint32_t));
+    j->matched = tr_query_alloc(query, tr_batch_rows * sizeof(uint32_t));
+    j->batch = tr_query_batch(query, types, ncolumns);
+    if (j->columns == NULL || j->nulls == NULL || j->probekeys == NULL || j->heads == NULL ||
+            j->all == NULL || j->probed == NULL || j->matched == NULL || j->batch == NULL) {
+        return trstatus_no_mem;
+    }
+    memset(j->columns, 0, build->ncolumns * sizeof(void *));
+    memset(j->nulls, 0, build->ncolumns * sizeof(uint64_t *));
+    for (unsigned i = 0; i < tr_batch_rows; ++i) {
+        j->all[i] = i;
+    }
+
+    *join = &j->op;
+    return trstatus_ok;
+}
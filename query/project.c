@@ -0,0 +1,218 @@
+//////////////////////////////////////////////////////////////////////////////
+//
+// Terrascale
+// Copyright (c) Dave Kilian & Emily Kilian 2023. All rights reserved.
+//
+//////////////////////////////////////////////////////////////////////////////
+
+#include <pch.h>
+#include <query/query.h>
+
+// A projection
+typedef struct {
+
+    trqop op;
+    trqop *input;           // Where rows come from
+    const trqexpr *exprs;   // An expression per output column
+    trbatch *batch;         // Output
+    void *left;             // Widened operands
+    void *right;
+
+} trqproject;
+
+// Gets a vector's values as `type`, widening them into `scratch` if need be
+static const void *tr_qproject_widen(const trvector *v, trcoltype type, unsigned count, void *scratch)
+{
+    if (v->type == type) {
+        return v->values;
+    }
+
+    const int32_t *i32 = v->values;
+    const int64_t *i64 = v->values;
+    if (type == trcol_i64) {
+        int64_t *out = scratch;
+        for (unsigned i = 0; i < count; ++i) {
+            out[i] = i32[i];
+        }
+    } else if (v->type == trcol_i32) {
+        double *out = scratch;
+        for (unsigned i = 0; i < count; ++i) {
+            out[i] = i32[i];
+        }
+    } else {
+        double *out = scratch;
+        for (unsigned i = 0; i < count; ++i) {
+            out[i] = (double)i64[i];
+        }
+    }
+    return scratch;
+}
+
+// Applies an operator to each pair of operands, or to each left operand and
+// a constant
+//
+#define tr_qproject_arith(ctype, a, b, out, expr) \
+    do { \
+        ctype *o = out; \
+        const ctype *x = a; \
+        const ctype *y = b; \
+        for (unsigned i = 0; i < count; ++i) { \
+            ctype l = x[i], r = y[i]; \
+            o[i] = (expr); \
+        } \
+    } while (0)
+
+#define tr_qproject_arith_const(ctype, a, c, out, expr) \
+    do { \
+        ctype *o = out; \
+        const ctype *x = a; \
+        ctype r = c; \
+        for (unsigned i = 0; i < count; ++i) { \
+            ctype l = x[i]; \
+            o[i] = (expr); \
+        } \
+    } while (0)
+
+// Computes an arithmetic expression over every row, live or not
+static void tr_qproject_compute(trqproject *project, const trqexpr *expr, const trbatch *in, trvector *out)
+{
+    unsigned count = in->count;
+    const trvector *lv = in->columns + expr->left;
+    const trvector *rv = expr->constant ? NULL : in->columns + expr->right;
+    const void *a = tr_qproject_widen(lv, out->type, count, project->left);
+
+    if (out->type == trcol_f64) {
+        if (rv == NULL) {
+            double c = expr->value.f;
+            switch (expr->op) {
+            case trqexpr_add: tr_qproject_arith_const(double, a, c, out->values, l + r); break;
+            case trqexpr_sub: tr_qproject_arith_const(double, a, c, out->values, l - r); break;
+            default: tr_qproject_arith_const(double, a, c, out->values, l * r); break;
+            }
+        } else {
+            const void *b = tr_qproject_widen(rv, out->type, count, project->right);
+            switch (expr->op) {
+            case trqexpr_add: tr_qproject_arith(double, a, b, out->values, l + r); break;
+            case trqexpr_sub: tr_qproject_arith(double, a, b, out->values, l - r); break;
+            default: tr_qproject_arith(double, a, b, out->values, l * r); break;
+            }
+        }
+    } else {
+        // Unsigned, so overflow wraps
+        if (rv == NULL) {
+            uint64_t c = expr->value.i;
+            switch (expr->op) {
+            case trqexpr_add: tr_qproject_arith_const(uint64_t, a, c, out->values, l + r); break;
+            case trqexpr_sub: tr_qproject_arith_const(uint64_t, a, c, out->values, l - r); break;
+            default: tr_qproject_arith_const(uint64_t, a, c, out->values, l * r); break;
+            }
+        } else {
+            const void *b = tr_qproject_widen(rv, out->type, count, project->right);
+            switch (expr->op) {
+            case trqexpr_add: tr_qproject_arith(uint64_t, a, b, out->values, l + r); break;
+            case trqexpr_sub: tr_qproject_arith(uint64_t, a, b, out->values, l - r); break;
+            default: tr_qproject_arith(uint64_t, a, b, out->values, l * r); break;
+            }
+        }
+    }
+
+    // A result is null if either operand is, and zero like any null slot
+    const uint64_t *ln = lv->nulls;
+    const uint64_t *rn = rv != NULL ? rv->nulls : NULL;
+    if (ln == NULL && rn == NULL) {
+        out->nulls = NULL;
+        return;
+    }
+
+    unsigned nwords = (count + 63) / 64;
+    for (unsigned w = 0; w < nwords; ++w) {
+        out->nullbuf[w] = (ln != NULL ? ln[w] : 0) | (rn != NULL ? rn[w] : 0);
+    }
+    unsigned width = tr_coltype_width(out->type);
+    for (unsigned i = 0; i < count; ++i) {
+        if (out->nullbuf[i / 64] >> (i % 64) & 1) {
+            memset(ptr_add(out->values, i * width), 0, width);
+        }
+    }
+    out->nulls = out->nullbuf;
+}
+
+#undef tr_qproject_arith
+#undef tr_qproject_arith_const
+
+static trstatus tr_qproject_next(trqop *op, trbatch **batch)
+{
+    trqproject *project = (trqproject *)op;
+
+    trbatch *in;
+    trstatus status = tr_query_next(project->input, &in);
+    if (!tr_ok(status) || in == NULL) {
+        *batch = NULL;
+        return status;
+    }
+
+    trbatch *out = project->batch;
+    for (unsigned i = 0; i < op->ncolumns; ++i) {
+        const trqexpr *expr = project->exprs + i;
+        if (expr->op == trqexpr_column) {
+            // Pass the input's vector along without copying it
+            out->columns[i] = in->columns[expr->left];
+        } else {
+            tr_qproject_compute(project, expr, in, out->columns + i);
+        }
+    }
+
+    out->count = in->count;
+    out->sel = in->sel;
+    out->nsel = in->nsel;
+    *batch = out;
+    return trstatus_ok;
+}
+
+trstatus tr_query_project(trquery *query, trqop *input, const trqexpr *exprs, unsigned nexprs,
+        trqop **project)
+{
+    if (nexprs == 0) {
+        return trstatus_argument;
+    }
+
+    trcoltype *types = tr_query_alloc(query, nexprs * sizeof(trcoltype));
+    trqexpr *copy = tr_query_alloc(query, nexprs * sizeof(trqexpr));
+    if (types == NULL || copy == NULL) {
+        return trstatus_no_mem;
+    }
+
+    for (unsigned i = 0; i < nexprs; ++i) {
+        const trqexpr *e = exprs + i;
+        if (e->left >= input->ncolumns || (e->op != trqexpr_column && !e->constant && e->right >= input->ncolumns)) {
+            return trstatus_argument;
+        }
+
+        trcoltype left = input->types[e->left];
+        if (e->op == trqexpr_column) {
+            types[i] = left;
+        } else if (left == trcol_f64 || (!e->constant && input->types[e->right] == trcol_f64)) {
+            types[i] = trcol_f64;
+        } else {
+            types[i] = trcol_i64;
+        }
+    }
+    memcpy(copy, exprs, nexprs * sizeof(trqexpr));
+
+    trqproject *p = (trqproject *)tr_query_op(query, sizeof(trqproject), tr_qproject_next, NULL,
+        types, nexprs);
+    if (p == NULL) {
+        return trstatus_no_mem;
+    }
+    p->input = input;
+    p->exprs = copy;
+    p->batch = tr_query_batch(query, types, nexprs);
+    p->left = tr_query_alloc(query, tr_batch_rows * sizeof(int64_t));
+    p->right = tr_query_alloc(query, tr_batch_rows * sizeof(int64_t));
+    if (p->batch == NULL || p->left == NULL || p->right == NULL) {
+        return trstatus_no_mem;
+    }
+
+    *project = &p->op;
+    return trstatus_ok;
+}
@@ -0,0 +1,105 @@
+//////////////////////////////////////////////////////////////////////////////
+//
+// Terrascale
+// Copyright (c) Dave Kilian & Emily Kilian 2023. All rights reserved.
+//
+//////////////////////////////////////////////////////////////////////////////
+
+#include <pch.h>
+#include <query/query.h>
+
+// Size of the query's stack segments
+#define tr_query_stack_bytes (256 * 1024)
+
+trstatus tr_query_initialize(trquery *query, tralloctag tag)
+{
+    query->ops = NULL;
+    query->tag = tag;
+    return tr_stack_initialize(&query->stack, tr_query_stack_bytes, tag);
+}
+
+void tr_query_cleanup(trquery *query)
+{
+    for (trqop *op = query->ops; op != NULL; op = op->link) {
+        if (op->close != NULL) {
+            op->close(op);
+        }
+    }
+    query->ops = NULL;
+    tr_stack_cleanup(&query->stack);
+}
+
+void *tr_query_alloc(trquery *query, unsigned bytes)
+{
+    // The stack doesn't align, so leave room to align within the allocation
+    bytes = (bytes + 63) & ~63u;
+    void *p = tr_stack_alloc(&query->stack, bytes + 64);
+    if (p == NULL) {
+        return NULL;
+    }
+    return (void *)(((uintptr_t)p + 63) & ~(uintptr_t)63);
+}
+
+trqop *tr_query_op(trquery *query, unsigned size, trqnextfn *next, trqclosefn *close,
+        const trcoltype *types, unsigned ncolumns)
+{
+    tr_assert(size >= sizeof(trqop));
+
+    trqop *op = tr_query_alloc(query, size);
+    if (op == NULL) {
+        return NULL;
+    }
+    memset(op, 0, size);
+
+    op->next = next;
+    op->close = close;
+    op->types = types;
+    op->ncolumns = ncolumns;
+    op->link = query->ops;
+    query->ops = op;
+    return op;
+}
+
+trbatch *tr_query_batch(trquery *query, const trcoltype *types, unsigned ncolumns)
+{
+    trbatch *batch = tr_query_alloc(query, sizeof(trbatch));
+    trvector *columns = tr_query_alloc(query, max(ncolumns, 1) * sizeof(trvector));
+    uint16_t *selbuf = tr_query_alloc(query, tr_batch_rows * sizeof(uint16_t));
+    if (batch == NULL || columns == NULL || selbuf == NULL) {
+        return NULL;
+    }
+
+    for (unsigned i = 0; i < ncolumns; ++i) {
+        trvector *v = columns + i;
+        v->type = types[i];
+        v->values = tr_query_alloc(query, tr_batch_rows * tr_coltype_width(types[i]));
+        v->nullbuf = tr_query_alloc(query, tr_batch_rows / 8);
+        v->nulls = NULL;
+        if (v->values == NULL || v->nullbuf == NULL) {
+            return NULL;
+        }
+    }
+
+    batch->columns = columns;
+    batch->ncolumns = ncolumns;
+    batch->count = 0;
+    batch->sel = NULL;
+    batch->nsel = 0;
+    batch->selbuf = selbuf;
+    return batch;
+}
+
+void *tr_query_grow(trquery *query, void *array, size_t used, size_t bytes)
+{
+    tr_assert(used <= bytes);
+
+    void *grown = tr_alloc(bytes, query->tag);
+    if (grown == NULL) {
+        return NULL;
+    }
+    if (array != NULL) {
+        memcpy(grown, array, used);
+        tr_free(array);
+    }
+    return grown;
+}
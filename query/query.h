@@ -0,0 +1,237 @@
+//////////////////////////////////////////////////////////////////////////////
+//
+// Terrascale
+// Copyright (c) Dave Kilian & Emily Kilian 2023. All rights reserved.
+//
+// query.h - vectorized query execution
+//
+// A query is a tree of operators, each pulling batches of rows from the
+// operators below it and producing batches of its own. A batch holds up to
+// tr_batch_rows rows as one vector per column, so an operator's work is a
+// tight loop over a vector rather than a call per row, and the interpretive
+// overhead of the tree is paid once per batch.
+//
+// A vector holds its values at their natural width (see column.h) in a
+// 64-byte aligned buffer sized for a whole batch, and a null bitmap when
+// some row of the batch is null. Null slots hold zero.
+//
+// Rather than copy the rows that survive a filter, a batch carries a
+// selection vector: the indices of its live rows, in order. Operators only
+// look at selected rows, or compute over every row when that's cheaper and
+// the extra results are harmless (as for arithmetic). A batch without a
+// selection vector has every row live.
+//
+// Operators and their batches are allocated from the query's trstack when
+// the query is built, and each call to next() overwrites the batch it
+// returned last time; nothing is allocated per batch. A batch is valid only
+// until the next call to the operator which produced it. Operators which
+// must hold on to all of their input (aggregates and the build side of a
+// join) keep it on the heap, under the query's tag.
+//
+// Operators are:
+//
+// - Scan: reads columns a batch at a time, decoding encoded chunks.
+// - Filter: compares a column against constants (as colpred.h does), and
+//   narrows the selection vector of its input's batches, passing them up.
+// - Project: passes on some of its input's columns, and computes others by
+//   arithmetic on them.
+// - Aggregate: counts, sums, minima and maxima, either over all rows or
+//   grouped by an integer column.
+// - Join: an inner hash join on integer keys.
+//
+// Other operators can be plugged in by embedding a trqop at the start of
+// a struct allocated with tr_query_op.
+//
+// Queries aren't synchronized; a query runs on one thread at a time.
+//
+//////////////////////////////////////////////////////////////////////////////
+
+#pragma once
+
+#include <runtime/stack.h>
+#include <table/colpred.h>
+
+// Rows in a batch (a multiple of 64)
+#define tr_batch_rows 1024
+
+// Passed as an aggregate's group column when there's no grouping
+#define tr_query_nogroup UINT32_MAX
+
+// One column of a batch
+typedef struct {
+
+    trcoltype type;         // Type of the values
+    void *values;           // tr_batch_rows values, at the type's width
+    uint64_t *nulls;        // Null bitmap, or NULL if no row is null
+    uint64_t *nullbuf;      // Storage for a null bitmap
+
+} trvector;
+
+// A batch of rows
+typedef struct {
+
+    trvector *columns;      // A vector per column
+    unsigned ncolumns;
+    unsigned count;         // Rows in the batch
+    uint16_t *sel;          // Live rows, in order, or NULL if all are live
+    unsigned nsel;          // Live rows
+    uint16_t *selbuf;       // Storage for a selection vector
+
+} trbatch;
+
+typedef struct trqop trqop;
+
+// Produces an operator's next batch, or sets `batch` to NULL once there are
+// no more. A batch always has a live row.
+//
+typedef trstatus trqnextfn(trqop *op, trbatch **batch);
+
+// Frees an operator's heap state
+typedef void trqclosefn(trqop *op);
+
+// An operator
+struct trqop {
+
+    trqnextfn *next;        // Produces batches
+    trqclosefn *close;      // Frees heap state, or NULL
+    trqop *link;            // Next operator of the query
+    const trcoltype *types; // Types of the output columns
+    unsigned ncolumns;
+
+};
+
+// A query
+typedef struct {
+
+    trstack stack;          // Operators and batches
+    trqop *ops;             // Every operator, newest first
+    tralloctag tag;         // Tag for allocations
+
+} trquery;
+
+// Arithmetic for projections
+typedef enum {
+
+    trqexpr_column,     // The left column itself
+    trqexpr_add,        // left + right
+    trqexpr_sub,        // left - right
+    trqexpr_mul,        // left * right
+
+} trqexprop;
+
+// A projected column. Arithmetic is on doubles if either operand is a
+// double column, and otherwise on 64-bit integers, wrapping on overflow. A
+// constant right operand has the type of the left column, widened.
+//
+typedef struct {
+
+    trqexprop op;           // What to compute
+    unsigned left;          // Input column
+    unsigned right;         // Input column, unless `constant` is set
+    bool constant;          // Whether the right operand is `value`
+    trcolvalue value;
+
+} trqexpr;
+
+// Aggregate functions
+typedef enum {
+
+    trqagg_count,       // Non-null values
+    trqagg_sum,         // Sum of the values
+    trqagg_min,         // Least value
+    trqagg_max,         // Greatest value
+
+} trqaggfn;
+
+// An aggregate. Counts are 64-bit integers; other results have the type of
+// their column, widened, and are null for groups with no non-null values.
+//
+typedef struct {
+
+    trqaggfn fn;            // Function
+    unsigned column;        // Input column
+
+} trqagg;
+
+// Initializes an empty query
+trstatus tr_query_initialize(trquery *query, tralloctag tag);
+
+// Closes every operator, and frees their memory
+void tr_query_cleanup(trquery *query);
+
+// Allocates 64-byte aligned memory for the query's lifetime
+void *tr_query_alloc(trquery *query, unsigned bytes);
+
+// Allocates a zeroed operator `size` bytes long, which begins with a trqop,
+// and adds it to the query. `types` must last as long as the query.
+//
+trqop *tr_query_op(trquery *query, unsigned size, trqnextfn *next, trqclosefn *close,
+        const trcoltype *types, unsigned ncolumns);
+
+// Allocates a batch with empty vectors of the given types
+trbatch *tr_query_batch(trquery *query, const trcoltype *types, unsigned ncolumns);
+
+// Resizes a heap array of operator state, allocated under the query's tag,
+// keeping its first `used` bytes. `array` may be NULL.
+//
+void *tr_query_grow(trquery *query, void *array, size_t used, size_t bytes);
+
+// Produces an operator's next batch
+static inline trstatus tr_query_next(trqop *op, trbatch **batch)
+{
+    return op->next(op, batch);
+}
+
+// Reads a set of columns of equal length, a batch at a time
+trstatus tr_query_scan(trquery *query, const trcolumn *const *columns, unsigned ncolumns,
+        trqop **scan);
+
+// Passes on the input rows in which a column compares true against `a` (and
+// for trcolop_between, `b`), as tr_colpred_compile does
+//
+trstatus tr_query_filter(trquery *query, trqop *input, unsigned column, trcolop op,
+        trcolvalue a, trcolvalue b, trqop **filter);
+
+// Computes a column for each expression from the input rows
+trstatus tr_query_project(trquery *query, trqop *input, const trqexpr *exprs, unsigned nexprs,
+        trqop **project);
+
+// Computes aggregates over the input rows, in one row per distinct value of
+// an integer column `group` (nulls forming a group of their own), in no
+// particular order, or with tr_query_nogroup, in one row in all. Grouped
+// results begin with the group's value.
+//
+trstatus tr_query_aggregate(trquery *query, trqop *input, unsigned group, const trqagg *aggs,
+        unsigned naggs, trqop **aggregate);
+
+// Joins the rows of `probe` and `build` whose integer key columns are
+// equal, each result being the probe row's columns followed by the build
+// row's. Null keys never match. All of `build` is read in before the first
+// batch is produced; batches then follow the order of `probe`.
+//
+trstatus tr_query_join(trquery *query, trqop *build, unsigned buildkey, trqop *probe,
+        unsigned probekey, trqop **join);
+
+// Indicates whether a vector's row is null
+static inline bool tr_vector_null(const trvector *vector, unsigned row)
+{
+    return vector->nulls != NULL && (vector->nulls[row / 64] >> (row % 64) & 1) != 0;
+}
+
+// Reads a vector's value, widened to a trcolvalue
+static inline trcolvalue tr_vector_get(const trvector *vector, unsigned row)
+{
+    trcolvalue v;
+    switch (vector->type) {
+    case trcol_i32:
+        v.i = ((const int32_t *)vector->values)[row];
+        break;
+    case trcol_i64:
+        v.i = ((const int64_t *)vector->values)[row];
+        break;
+    default:
+        v.f = ((const double *)vector->values)[row];
+        break;
+    }
+    return v;
+}
@@ -0,0 +1,78 @@
+//////////////////////////////////////////////////////////////////////////////
+//
+// Terrascale
+// Copyright (c) Dave Kilian & Emily Kilian 2023. All rights reserved.
+//
+//////////////////////////////////////////////////////////////////////////////
+
+#include <pch.h>
+#include <query/query.h>
+
+// A scan over columns
+typedef struct {
+
+    trqop op;
+    const trcolumn **columns;   // The columns
+    uint64_t nrows;             // Rows in each
+    uint64_t row;               // Next row to read
+    trbatch *batch;             // Output
+
+} trqscan;
+
+static trstatus tr_qscan_next(trqop *op, trbatch **batch)
+{
+    trqscan *scan = (trqscan *)op;
+    if (scan->row == scan->nrows) {
+        *batch = NULL;
+        return trstatus_ok;
+    }
+
+    trbatch *out = scan->batch;
+    unsigned count = min(scan->nrows - scan->row, tr_batch_rows);
+    for (unsigned i = 0; i < out->ncolumns; ++i) {
+        trvector *v = out->columns + i;
+        unsigned nnulls = tr_column_read(scan->columns[i], scan->row, count, v->values, v->nullbuf);
+        v->nulls = nnulls != 0 ? v->nullbuf : NULL;
+    }
+
+    out->count = count;
+    out->sel = NULL;
+    out->nsel = count;
+    scan->row += count;
+    *batch = out;
+    return trstatus_ok;
+}
+
+trstatus tr_query_scan(trquery *query, const trcolumn *const *columns, unsigned ncolumns,
+        trqop **scan)
+{
+    if (ncolumns == 0) {
+        return trstatus_argument;
+    }
+
+    trcoltype *types = tr_query_alloc(query, ncolumns * sizeof(trcoltype));
+    if (types == NULL) {
+        return trstatus_no_mem;
+    }
+    for (unsigned i = 0; i < ncolumns; ++i) {
+        if (columns[i]->nrows != columns[0]->nrows) {
+            return trstatus_argument;
+        }
+        types[i] = columns[i]->type;
+    }
+
+    trqscan *s = (trqscan *)tr_query_op(query, sizeof(trqscan), tr_qscan_next, NULL, types, ncolumns);
+    if (s == NULL) {
+        return trstatus_no_mem;
+    }
+    s->columns = tr_query_alloc(query, ncolumns * sizeof(trcolumn *));
+    s->batch = tr_query_batch(query, types, ncolumns);
+    if (s->columns == NULL || s->batch == NULL) {
+        return trstatus_no_mem;
+    }
+    memcpy(s->columns, columns, ncolumns * sizeof(trcolumn *));
+    s->nrows = columns[0]->nrows;
+
+    *scan = &s->op;
+    return trstatus_ok;
+}
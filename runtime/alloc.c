@@ -97,7 +97,7 @@ typedef struct {
 
     tralloctag tag;   // User-provided allocation tag
     unsigned bytes;   // Number of bytes allocated
-    char reserved[8]; // For alignment
+    void *base;       // Start of the underlying malloc() block
 
 } allochdr;
 
@@ -106,23 +106,19 @@ typedef struct {
 // 16-byte-aligned memory, in order to support CPU instructions that involve
 // 32-bit half-words, 64-bit full words, and 128-bit double-words. Beyond that,
 // for very-wide alignment needs as seen in SIMD instructions, callers usually
-// expect to need to align memory themselves.
+// expect to need to align memory themselves (or to use tr_alloc_aligned).
 //
 // Our allocation headers should be exactly 16 bytes long so we can preserve
 // 16-byte alignment guarantees callers reasonably expect from malloc().
 //
 static_assert(sizeof(allochdr) == 16);
 
-void *tr_alloc(unsigned bytes, tralloctag tag)
+// Fills in the header for a new allocation and updates its tag's statistics
+static void *tr_alloc_track(allochdr *hdr, void *base, unsigned bytes, tralloctag tag)
 {
-    void *mem = malloc(bytes + sizeof(allochdr));
-    if (mem == NULL) {
-        return NULL;
-    }
-
-    allochdr *hdr = mem;
     hdr->tag = tag;
     hdr->bytes = bytes;
+    hdr->base = base;
 
     tr_require(0 == pthread_once(&statinit, &tr_alloc_init_stats));
 
@@ -135,6 +131,36 @@ void *tr_alloc(unsigned bytes, tralloctag tag)
     return hdr + 1;
 }
 
+void *tr_alloc(unsigned bytes, tralloctag tag)
+{
+    void *mem = malloc(bytes + sizeof(allochdr));
+    if (mem == NULL) {
+        return NULL;
+    }
+
+    return tr_alloc_track(mem, mem, bytes, tag);
+}
+
+void *tr_alloc_aligned(unsigned bytes, unsigned align, tralloctag tag)
+{
+    tr_assert(align != 0 && (align & (align - 1)) == 0);
+
+    if (align <= sizeof(allochdr)) {
+        return tr_alloc(bytes, tag);
+    }
+
+    void *mem = malloc(bytes + align + sizeof(allochdr));
+    if (mem == NULL) {
+        return NULL;
+    }
+
+    uintptr_t user = (uintptr_t)ptr_add(mem, sizeof(allochdr));
+    user = (user + align - 1) & ~((uintptr_t)align - 1);
+
+    allochdr *hdr = (allochdr *)user - 1;
+    return tr_alloc_track(hdr, mem, bytes, tag);
+}
+
 void tr_free(void *block)
 {
     allochdr *hdr = ptr_sub(block, sizeof(allochdr));
@@ -151,7 +177,7 @@ void tr_free(void *block)
     stat->stat.nbytes -= hdr->bytes;
 
     tr_alloc_unlock_tag(bucket, stat);
-    free(hdr);
+    free(hdr->base);
 }
 
 trallocstat tr_alloc_stat(tralloctag tag)
@@ -23,6 +23,12 @@ void tr_alloctag_tostr(tralloctag tag, char str[5]);
 // A malloc() replacement that tags memory
 void *tr_alloc(unsigned bytes, tralloctag tag);
 
+// Like tr_alloc, but the returned block is aligned to a multiple of `align`
+// bytes, which must be a power of two. Useful for SIMD data, cache-line
+// isolation and direct I/O buffers. Free the block with tr_free().
+//
+void *tr_alloc_aligned(unsigned bytes, unsigned align, tralloctag tag);
+
 // Frees tr_alloc-allocated memory
 void tr_free(void *block);
 
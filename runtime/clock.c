@@ -0,0 +1,19 @@
+//////////////////////////////////////////////////////////////////////////////
+//
+// Terrascale
+// Copyright (c) Dave Kilian & Emily Kilian 2023. All rights reserved.
+//
+//////////////////////////////////////////////////////////////////////////////
+
+#include <pch.h>
+#include <runtime/clock.h>
+
+#include <time.h>
+
+trtime tr_clock_now()
+{
+    struct timespec ts;
+    tr_require(0 == clock_gettime(CLOCK_MONOTONIC, &ts));
+
+    return tr_sec(ts.tv_sec) + tr_ns(ts.tv_nsec);
+}
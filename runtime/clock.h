@@ -0,0 +1,28 @@
+//////////////////////////////////////////////////////////////////////////////
+//
+// Terrascale
+// Copyright (c) Dave Kilian & Emily Kilian 2023. All rights reserved.
+//
+// clock.h - monotonic timestamps for scheduling and measurement
+//
+//////////////////////////////////////////////////////////////////////////////
+
+#pragma once
+
+// A point in time, in nanoseconds since an arbitrary fixed epoch
+typedef uint64_t trtime;
+
+#define tr_ns(n)  ((trtime)(n))
+#define tr_us(n)  ((trtime)(n) * 1000ull)
+#define tr_ms(n)  ((trtime)(n) * 1000000ull)
+#define tr_sec(n) ((trtime)(n) * 1000000000ull)
+
+// Reads the system's monotonic clock.
+//
+// Timestamps returned by this routine never go backwards, and are
+// comparable across threads, but have no relationship to wall-clock time.
+//
+trtime tr_clock_now();
+
+// Converts a time interval to (fractional) seconds, for reporting
+#define tr_clock_seconds(t) ((double)(t) / 1e9)
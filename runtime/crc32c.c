@@ -0,0 +1,286 @@
+//////////////////////////////////////////////////////////////////////////////
+//
+// Terrascale
+// Copyright (c) Dave Kilian & Emily Kilian 2023. All rights reserved.
+//
+//////////////////////////////////////////////////////////////////////////////
+
+#include <pch.h>
+#include <runtime/crc32c.h>
+
+#if defined(__x86_64__)
+#include <nmmintrin.h>
+#include <wmmintrin.h>
+#endif
+
+static_assert(__BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__);
+
+//
+// CRCs are kept in the usual bit-reflected form: bit 31 of a 32-bit value
+// is the coefficient of x^0, and bit 0 the coefficient of x^31. Internally
+// CRCs are "raw", without the initial and final inversion, which only the
+// public entry points apply.
+//
+
+// The Castagnoli polynomial, reflected
+#define tr_crc_poly 0x82f63b78u
+
+// Bytes per stream in the hardware implementation's long and short blocks
+#define tr_crc_long  8192
+#define tr_crc_short 256
+
+static pthread_once_t tr_crc_once = PTHREAD_ONCE_INIT;
+static trcrcimpl tr_crc_best;
+
+// Slicing-by-8 tables: tr_crc_table[k][b] is the CRC of byte b followed by
+// k zero bytes
+//
+static uint32_t tr_crc_table[8][256];
+
+// tr_crc_x2n[k] is x^(2^k) modulo the polynomial
+static uint32_t tr_crc_x2n[64];
+
+// Constants for combining streams: x^(8n) for software shifting, and
+// x^(8n - 33) for PCLMULQDQ shifting (see tr_crc_shift_clmul). Indexed by
+// long block, twice the long block, short block, twice the short block.
+//
+static uint32_t tr_crc_kshift[4];
+static uint32_t tr_crc_kclmul[4];
+
+// Multiplies two polynomials modulo the CRC polynomial
+static uint32_t tr_crc_multmodp(uint32_t a, uint32_t b)
+{
+    uint32_t m = 1u << 31;
+    uint32_t p = 0;
+
+    for (;;) {
+        if (a & m) {
+            p ^= b;
+            if ((a & (m - 1)) == 0) {
+                break;
+            }
+        }
+        m >>= 1;
+        b = (b & 1) ? (b >> 1) ^ tr_crc_poly : b >> 1;
+    }
+
+    return p;
+}
+
+// Computes x^n modulo the CRC polynomial
+static uint32_t tr_crc_xpow(uint64_t n)
+{
+    uint32_t p = 1u << 31;
+    for (int k = 0; n != 0; n >>= 1, ++k) {
+        if (n & 1) {
+            p = tr_crc_multmodp(tr_crc_x2n[k], p);
+        }
+    }
+
+    return p;
+}
+
+static void tr_crc_initialize()
+{
+    for (uint32_t b = 0; b < 256; ++b) {
+        uint32_t crc = b;
+        for (int i = 0; i < 8; ++i) {
+            crc = (crc & 1) ? (crc >> 1) ^ tr_crc_poly : crc >> 1;
+        }
+        tr_crc_table[0][b] = crc;
+    }
+
+    for (uint32_t b = 0; b < 256; ++b) {
+        for (int k = 1; k < 8; ++k) {
+            uint32_t prev = tr_crc_table[k - 1][b];
+            tr_crc_table[k][b] = (prev >> 8) ^ tr_crc_table[0][prev & 0xff];
+        }
+    }
+
+    tr_crc_x2n[0] = 1u << 30;
+    for (int k = 1; k < arraysize(tr_crc_x2n); ++k) {
+        tr_crc_x2n[k] = tr_crc_multmodp(tr_crc_x2n[k - 1], tr_crc_x2n[k - 1]);
+    }
+
+    uint64_t blocks[4] = { tr_crc_long, 2 * tr_crc_long, tr_crc_short, 2 * tr_crc_short };
+    for (int i = 0; i < 4; ++i) {
+        tr_crc_kshift[i] = tr_crc_xpow(8 * blocks[i]);
+        tr_crc_kclmul[i] = tr_crc_xpow(8 * blocks[i] - 33);
+    }
+
+    tr_crc_best = trcrc_software;
+
+#if defined(__x86_64__)
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("sse4.2")) {
+        tr_crc_best = __builtin_cpu_supports("pclmul") ? trcrc_pclmul : trcrc_sse42;
+    }
+#endif
+}
+
+static uint32_t tr_crc_software(uint32_t crc, const uint8_t *p, size_t n)
+{
+    while (n > 0 && ((uintptr_t)p & 7) != 0) {
+        crc = tr_crc_table[0][(crc ^ *p++) & 0xff] ^ (crc >> 8);
+        n -= 1;
+    }
+
+    while (n >= 8) {
+        uint64_t w;
+        memcpy(&w, p, sizeof(w));
+        w ^= crc;
+
+        crc = tr_crc_table[7][w & 0xff] ^
+              tr_crc_table[6][(w >> 8) & 0xff] ^
+              tr_crc_table[5][(w >> 16) & 0xff] ^
+              tr_crc_table[4][(w >> 24) & 0xff] ^
+              tr_crc_table[3][(w >> 32) & 0xff] ^
+              tr_crc_table[2][(w >> 40) & 0xff] ^
+              tr_crc_table[1][(w >> 48) & 0xff] ^
+              tr_crc_table[0][w >> 56];
+
+        p += 8;
+        n -= 8;
+    }
+
+    while (n > 0) {
+        crc = tr_crc_table[0][(crc ^ *p++) & 0xff] ^ (crc >> 8);
+        n -= 1;
+    }
+
+    return crc;
+}
+
+#if defined(__x86_64__)
+
+// Shifts a CRC forward over zeros, by multiplying it by x^(8n)
+typedef uint32_t trcrcshift(uint32_t crc, uint32_t k);
+
+static uint32_t tr_crc_shift_software(uint32_t crc, uint32_t k)
+{
+    return tr_crc_multmodp(k, crc);
+}
+
+// The carry-less product of two reflected 32-bit values, read as 64 bits
+// of message, is crc * k * x; running that through crc32 multiplies by a
+// further x^32. So with k = x^(8n - 33), the result is crc * x^(8n).
+//
+__attribute__((target("sse4.2,pclmul")))
+static uint32_t tr_crc_shift_clmul(uint32_t crc, uint32_t k)
+{
+    __m128i product = _mm_clmulepi64_si128(_mm_cvtsi32_si128(crc), _mm_cvtsi32_si128(k), 0);
+    return _mm_crc32_u64(0, _mm_cvtsi128_si64(product));
+}
+
+static inline uint64_t tr_crc_load(const uint8_t *p)
+{
+    uint64_t w;
+    memcpy(&w, p, sizeof(w));
+    return w;
+}
+
+// Checksums as many whole groups of three blocks of the given size as fit,
+// as three interleaved streams
+//
+__attribute__((target("sse4.2"), always_inline))
+static inline uint32_t tr_crc_hw3(uint32_t crc, const uint8_t **data, size_t *length,
+        size_t block, trcrcshift *shift, uint32_t kone, uint32_t ktwo)
+{
+    const uint8_t *p = *data;
+    size_t n = *length;
+
+    while (n >= 3 * block) {
+        uint64_t c0 = crc, c1 = 0, c2 = 0;
+        for (size_t i = 0; i < block; i += 8) {
+            c0 = _mm_crc32_u64(c0, tr_crc_load(p + i));
+            c1 = _mm_crc32_u64(c1, tr_crc_load(p + block + i));
+            c2 = _mm_crc32_u64(c2, tr_crc_load(p + 2 * block + i));
+        }
+
+        crc = shift(c0, ktwo) ^ shift(c1, kone) ^ (uint32_t)c2;
+        p += 3 * block;
+        n -= 3 * block;
+    }
+
+    *data = p;
+    *length = n;
+    return crc;
+}
+
+__attribute__((target("sse4.2"), always_inline))
+static inline uint32_t tr_crc_hw(uint32_t crc, const uint8_t *p, size_t n,
+        trcrcshift *shift, const uint32_t *k)
+{
+    while (n > 0 && ((uintptr_t)p & 7) != 0) {
+        crc = _mm_crc32_u8(crc, *p++);
+        n -= 1;
+    }
+
+    crc = tr_crc_hw3(crc, &p, &n, tr_crc_long, shift, k[0], k[1]);
+    crc = tr_crc_hw3(crc, &p, &n, tr_crc_short, shift, k[2], k[3]);
+
+    uint64_t crc64 = crc;
+    while (n >= 8) {
+        crc64 = _mm_crc32_u64(crc64, tr_crc_load(p));
+        p += 8;
+        n -= 8;
+    }
+    crc = (uint32_t)crc64;
+
+    while (n > 0) {
+        crc = _mm_crc32_u8(crc, *p++);
+        n -= 1;
+    }
+
+    return crc;
+}
+
+__attribute__((target("sse4.2")))
+static uint32_t tr_crc_sse42(uint32_t crc, const uint8_t *p, size_t n)
+{
+    return tr_crc_hw(crc, p, n, &tr_crc_shift_software, tr_crc_kshift);
+}
+
+__attribute__((target("sse4.2,pclmul")))
+static uint32_t tr_crc_pclmul(uint32_t crc, const uint8_t *p, size_t n)
+{
+    return tr_crc_hw(crc, p, n, &tr_crc_shift_clmul, tr_crc_kclmul);
+}
+
+#endif
+
+uint32_t tr_crc32c_with(trcrcimpl impl, uint32_t crc, const void *data, size_t length)
+{
+    pthread_once(&tr_crc_once, &tr_crc_initialize);
+    tr_assert(impl <= tr_crc_best);
+
+    crc = ~crc;
+
+    switch (impl) {
+#if defined(__x86_64__)
+    case trcrc_pclmul:
+        crc = tr_crc_pclmul(crc, data, length);
+        break;
+    case trcrc_sse42:
+        crc = tr_crc_sse42(crc, data, length);
+        break;
+#endif
+    default:
+        crc = tr_crc_software(crc, data, length);
+        break;
+    }
+
+    return ~crc;
+}
+
+uint32_t tr_crc32c(uint32_t crc, const void *data, size_t length)
+{
+    pthread_once(&tr_crc_once, &tr_crc_initialize);
+    return tr_crc32c_with(tr_crc_best, crc, data, length);
+}
+
+trcrcimpl tr_crc32c_best()
+{
+    pthread_once(&tr_crc_once, &tr_crc_initialize);
+    return tr_crc_best;
+}
@@ -0,0 +1,50 @@
+//////////////////////////////////////////////////////////////////////////////
+//
+// Terrascale
+// Copyright (c) Dave Kilian & Emily Kilian 2023. All rights reserved.
+//
+// crc32c.h - CRC-32C (Castagnoli) checksums
+//
+// CRC-32C is the checksum used to detect corruption in pages and other
+// on-disk structures. It's chosen over other CRCs because x86 CPUs since
+// SSE4.2 compute it in hardware, at one 8-byte word per cycle per stream.
+//
+// A single stream of crc32 instructions is limited by the instruction's
+// three-cycle latency, so the hardware implementation splits large buffers
+// into three equal blocks, checksums them as three independent streams,
+// and then combines the three results. Combining means multiplying a CRC by
+// a constant power of x modulo the CRC polynomial; with PCLMULQDQ that's a
+// carry-less multiply followed by one more crc32 instruction, and without
+// it, a short loop in software.
+//
+// The implementation is chosen at runtime from what the CPU supports, with
+// a portable slicing-by-8 table implementation as the fallback.
+//
+//////////////////////////////////////////////////////////////////////////////
+
+#pragma once
+
+// Available CRC-32C implementations
+typedef enum {
+
+    trcrc_software,     // Portable slicing-by-8 tables
+    trcrc_sse42,        // crc32 instruction, software combining
+    trcrc_pclmul,       // crc32 instruction, PCLMULQDQ combining
+
+} trcrcimpl;
+
+// Extends a CRC-32C over more data. Pass 0 to start a new checksum, and
+// the previous result to continue one, so that checksumming A and then B
+// gives the same result as checksumming A and B concatenated.
+//
+uint32_t tr_crc32c(uint32_t crc, const void *data, size_t length);
+
+// Same as tr_crc32c, but using a particular implementation, which must be
+// supported by this CPU
+//
+uint32_t tr_crc32c_with(trcrcimpl impl, uint32_t crc, const void *data, size_t length);
+
+// Returns the fastest implementation this CPU supports, which is the one
+// tr_crc32c uses
+//
+trcrcimpl tr_crc32c_best();
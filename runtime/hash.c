@@ -0,0 +1,49 @@
+//////////////////////////////////////////////////////////////////////////////
+//
+// Terrascale
+// Copyright (c) Dave Kilian & Emily Kilian 2023. All rights reserved.
+//
+//////////////////////////////////////////////////////////////////////////////
+
+#include <pch.h>
+#include <runtime/hash.h>
+
+static_assert(__BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__);
+
+static inline uint64_t tr_hash_rotl(uint64_t x, int r)
+{
+    return (x << r) | (x >> (64 - r));
+}
+
+// Mixes one 8-byte word into the hash state
+static inline uint64_t tr_hash_word(uint64_t h, uint64_t k)
+{
+    k *= 0x87c37b91114253d5ull;
+    k = tr_hash_rotl(k, 31);
+    k *= 0x4cf5ad432745937full;
+
+    h ^= k;
+    return tr_hash_rotl(h, 27) * 5 + 0x52dce729;
+}
+
+uint64_t tr_hash_bytes(const void *data, size_t length, uint64_t seed)
+{
+    const uint8_t *p = data;
+    uint64_t h = seed ^ (length * 0x9e3779b97f4a7c15ull);
+
+    while (length >= 8) {
+        uint64_t k;
+        memcpy(&k, p, sizeof(k));
+        h = tr_hash_word(h, k);
+        p += 8;
+        length -= 8;
+    }
+
+    if (length > 0) {
+        uint64_t k = 0;
+        memcpy(&k, p, length);
+        h = tr_hash_word(h, k);
+    }
+
+    return tr_hash_u64(h);
+}
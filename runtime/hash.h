@@ -0,0 +1,32 @@
+//////////////////////////////////////////////////////////////////////////////
+//
+// Terrascale
+// Copyright (c) Dave Kilian & Emily Kilian 2023. All rights reserved.
+//
+// hash.h - fast non-cryptographic hashing
+//
+// Hashes for hash tables and filters, not for anything which must resist a
+// deliberate attacker. The byte hash consumes eight bytes per step in the
+// style of MurmurHash3, and every hash ends with MurmurHash3's 64-bit
+// finalizer, so that all output bits depend on all input bits and any
+// subset of them can be used as a hash of its own.
+//
+//////////////////////////////////////////////////////////////////////////////
+
+#pragma once
+
+// Scrambles a 64-bit value (MurmurHash3's fmix64); a bijection, so distinct
+// integers always hash differently
+//
+static inline uint64_t tr_hash_u64(uint64_t x)
+{
+    x ^= x >> 33;
+    x *= 0xff51afd7ed558ccdull;
+    x ^= x >> 33;
+    x *= 0xc4ceb9fe1a85ec53ull;
+    x ^= x >> 33;
+    return x;
+}
+
+// Hashes a string of bytes. Different seeds give independent hashes.
+uint64_t tr_hash_bytes(const void *data, size_t length, uint64_t seed);
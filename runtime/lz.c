@@ -0,0 +1,292 @@
+//////////////////////////////////////////////////////////////////////////////
+//
+// Terrascale
+// Copyright (c) Dave Kilian & Emily Kilian 2023. All rights reserved.
+//
+//////////////////////////////////////////////////////////////////////////////
+
+#include <pch.h>
+#include <runtime/lz.h>
+
+#define tr_lz_hashbits     12       // log2 of the match finder's table size
+#define tr_lz_minmatch     4        // Shortest match worth encoding
+#define tr_lz_lastliterals 5        // Bytes at the end which are always literal
+#define tr_lz_mflimit      12       // No match may start closer to the end
+#define tr_lz_maxoffset    65535    // Furthest back a match may refer
+
+static inline uint32_t tr_lz_read32(const uint8_t *p)
+{
+    uint32_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+static inline uint64_t tr_lz_read64(const uint8_t *p)
+{
+    uint64_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+static inline unsigned tr_lz_hash(uint32_t v)
+{
+    return (v * 2654435761u) >> (32 - tr_lz_hashbits);
+}
+
+// Counts how many bytes match at a and b, stopping at limit
+static unsigned tr_lz_count(const uint8_t *a, const uint8_t *b, const uint8_t *limit)
+{
+    const uint8_t *start = a;
+
+    while (a + 8 <= limit) {
+        uint64_t diff = tr_lz_read64(a) ^ tr_lz_read64(b);
+        if (diff != 0) {
+            return (a - start) + (__builtin_ctzll(diff) >> 3);
+        }
+        a += 8;
+        b += 8;
+    }
+
+    while (a < limit && *a == *b) {
+        a++;
+        b++;
+    }
+
+    return a - start;
+}
+
+// Writes the extra bytes of a literal count or match length
+static uint8_t *tr_lz_putlen(uint8_t *op, size_t len)
+{
+    while (len >= 255) {
+        *op++ = 255;
+        len -= 255;
+    }
+    *op++ = (uint8_t)len;
+    return op;
+}
+
+// Reads the extra bytes of a literal count or match length, or returns
+// SIZE_MAX if they run off the end of the input
+//
+static size_t tr_lz_getlen(const uint8_t **ip, const uint8_t *iend)
+{
+    size_t len = 0;
+    unsigned b;
+
+    do {
+        if (*ip >= iend) {
+            return SIZE_MAX;
+        }
+        b = *(*ip)++;
+        len += b;
+    } while (b == 255);
+
+    return len;
+}
+
+// Most bytes a sequence with the given literal and match lengths can take
+static size_t tr_lz_seqbound(size_t litlen, size_t matchlen)
+{
+    return 1 + litlen + litlen / 255 + 1 + 2 + matchlen / 255 + 1;
+}
+
+// Emits the final, literal-only sequence
+static uint8_t *tr_lz_lastseq(uint8_t *op, const uint8_t *anchor, size_t litlen)
+{
+    if (litlen >= 15) {
+        *op++ = 15 << 4;
+        op = tr_lz_putlen(op, litlen - 15);
+    } else {
+        *op++ = (uint8_t)(litlen << 4);
+    }
+
+    memcpy(op, anchor, litlen);
+    return op + litlen;
+}
+
+trstatus tr_lz_compress(const void *src, unsigned srclen, void *dst, unsigned capacity, unsigned *dstlen)
+{
+    const uint8_t *base = src;
+    const uint8_t *ip = base;
+    const uint8_t *anchor = base;
+    const uint8_t *end = base + srclen;
+    uint8_t *op = dst;
+    uint8_t *oend = op + capacity;
+
+    if (srclen > tr_lz_mflimit) {
+        const uint8_t *mflimit = end - tr_lz_mflimit;
+        const uint8_t *matchlimit = end - tr_lz_lastliterals;
+
+        // Positions of recently seen 4-byte sequences, by hash
+        uint32_t table[1 << tr_lz_hashbits];
+        memset(table, 0, sizeof(table));
+
+        ip++;
+        while (ip < mflimit) {
+            uint32_t seq = tr_lz_read32(ip);
+            unsigned h = tr_lz_hash(seq);
+            const uint8_t *ref = base + table[h];
+            table[h] = ip - base;
+
+            if (ref >= ip || ip - ref > tr_lz_maxoffset || tr_lz_read32(ref) != seq) {
+                // Step faster through data which isn't matching
+                ip += 1 + ((ip - anchor) >> 6);
+                continue;
+            }
+
+            while (ip > anchor && ref > base && ip[-1] == ref[-1]) {
+                ip--;
+                ref--;
+            }
+
+            size_t matchlen = tr_lz_minmatch +
+                tr_lz_count(ip + tr_lz_minmatch, ref + tr_lz_minmatch, matchlimit);
+            size_t litlen = ip - anchor;
+
+            if ((size_t)(oend - op) < tr_lz_seqbound(litlen, matchlen)) {
+                return trstatus_too_small;
+            }
+
+            uint8_t *token = op++;
+            if (litlen >= 15) {
+                *token = 15 << 4;
+                op = tr_lz_putlen(op, litlen - 15);
+            } else {
+                *token = (uint8_t)(litlen << 4);
+            }
+
+            memcpy(op, anchor, litlen);
+            op += litlen;
+
+            unsigned offset = ip - ref;
+            *op++ = (uint8_t)offset;
+            *op++ = (uint8_t)(offset >> 8);
+
+            size_t extra = matchlen - tr_lz_minmatch;
+            if (extra >= 15) {
+                *token |= 15;
+                op = tr_lz_putlen(op, extra - 15);
+            } else {
+                *token |= (uint8_t)extra;
+            }
+
+            ip += matchlen;
+            anchor = ip;
+
+            if (ip < mflimit) {
+                table[tr_lz_hash(tr_lz_read32(ip - 2))] = ip - 2 - base;
+            }
+        }
+    }
+
+    size_t litlen = end - anchor;
+    if ((size_t)(oend - op) < 1 + litlen + litlen / 255 + 1) {
+        return trstatus_too_small;
+    }
+
+    op = tr_lz_lastseq(op, anchor, litlen);
+    *dstlen = op - (uint8_t *)dst;
+    return trstatus_ok;
+}
+
+trstatus tr_lz_decompress(const void *src, unsigned srclen, void *dst, unsigned capacity, unsigned *dstlen)
+{
+    const uint8_t *ip = src;
+    const uint8_t *iend = ip + srclen;
+    uint8_t *ostart = dst;
+    uint8_t *op = ostart;
+    uint8_t *oend = op + capacity;
+
+    for (;;) {
+        if (ip >= iend) {
+            return trstatus_overrun;
+        }
+
+        unsigned token = *ip++;
+
+        size_t litlen = token >> 4;
+        if (litlen == 15) {
+            size_t extra = tr_lz_getlen(&ip, iend);
+            if (extra == SIZE_MAX) {
+                return trstatus_overrun;
+            }
+            litlen += extra;
+        }
+
+        if (litlen > (size_t)(iend - ip) || litlen > (size_t)(oend - op)) {
+            return trstatus_overrun;
+        }
+
+        // Short literal runs are the common case; copy a fixed 16 bytes
+        // when there's room, rather than an exact-length memcpy
+        if (litlen <= 16 && iend - ip >= 16 && oend - op >= 16) {
+            memcpy(op, ip, 16);
+        } else {
+            memcpy(op, ip, litlen);
+        }
+        op += litlen;
+        ip += litlen;
+
+        if (ip == iend) {
+            break;
+        }
+
+        if (iend - ip < 2) {
+            return trstatus_overrun;
+        }
+
+        size_t offset = ip[0] | ((size_t)ip[1] << 8);
+        ip += 2;
+        if (offset == 0 || offset > (size_t)(op - ostart)) {
+            return trstatus_overrun;
+        }
+
+        size_t matchlen = token & 15;
+        if (matchlen == 15) {
+            size_t extra = tr_lz_getlen(&ip, iend);
+            if (extra == SIZE_MAX) {
+                return trstatus_overrun;
+            }
+            matchlen += extra;
+        }
+        matchlen += tr_lz_minmatch;
+
+        if (matchlen > (size_t)(oend - op)) {
+            return trstatus_overrun;
+        }
+
+        const uint8_t *ref = op - offset;
+        if ((size_t)(oend - op) >= matchlen + 15) {
+
+            // A match closer than 8 bytes repeats a short pattern. Lay down
+            // the first 8 bytes one at a time, then copy from an earlier
+            // repeat of the pattern at least 8 bytes back, which is still
+            // within the output since it's less than offset + 8 bytes back.
+            if (offset < 8) {
+                for (int i = 0; i < 8; ++i) {
+                    op[i] = ref[i];
+                }
+                ref = op - (8 + offset - 1) / offset * offset;
+            } else {
+                memcpy(op, ref, 8);
+            }
+
+            // Chunks never overlap their own source, and may run up to 15
+            // bytes past the match, which the check above left room for.
+            // Most matches are short, so the first two are unconditional.
+            memcpy(op + 8, ref + 8, 8);
+            for (size_t i = 16; i < matchlen; i += 8) {
+                memcpy(op + i, ref + i, 8);
+            }
+        } else {
+            for (size_t i = 0; i < matchlen; ++i) {
+                op[i] = ref[i];
+            }
+        }
+        op += matchlen;
+    }
+
+    *dstlen = op - ostart;
+    return trstatus_ok;
+}
@@ -0,0 +1,47 @@
+//////////////////////////////////////////////////////////////////////////////
+//
+// Terrascale
+// Copyright (c) Dave Kilian & Emily Kilian 2023. All rights reserved.
+//
+// lz.h - a fast LZ77-family block codec
+//
+// Compresses independent blocks (pages, tiles) with no dictionary carried
+// between them, in the style of LZ4: greedy matching through a small hash
+// table on the compression side, and a decompressor that does little more
+// than copy bytes, so decompression runs at memory speed.
+//
+// A compressed block is a series of sequences. Each sequence is:
+//
+//     token                   1 byte: literal count (high 4 bits) and
+//                             match length - 4 (low 4 bits)
+//     [literal count extra]   if the count is 15: bytes added to it until
+//                             one is not 255
+//     literals                raw bytes copied to the output
+//     offset                  2 bytes, little-endian: distance back to the
+//                             match, 1 to 65535
+//     [match length extra]    as for literal count
+//
+// The last sequence has literals only, and ends the block. Decompression
+// checks every length and offset against the input and output buffers, so
+// malformed or malicious input fails with trstatus_overrun instead of
+// reading or writing out of bounds.
+//
+//////////////////////////////////////////////////////////////////////////////
+
+#pragma once
+
+// The largest compressed size of an input of the given size, for sizing
+// output buffers which must never be too small
+//
+#define tr_lz_bound(bytes) ((bytes) + (bytes) / 255 + 16)
+
+// Compresses a block. Returns trstatus_too_small if the output didn't fit
+// in the given capacity, which callers storing data compressed only when
+// it's worthwhile can use to give up early.
+//
+trstatus tr_lz_compress(const void *src, unsigned srclen, void *dst, unsigned capacity, unsigned *dstlen);
+
+// Decompresses a block. Returns trstatus_overrun if the block is malformed
+// or decompresses to more than the given capacity.
+//
+trstatus tr_lz_decompress(const void *src, unsigned srclen, void *dst, unsigned capacity, unsigned *dstlen);
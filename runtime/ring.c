@@ -0,0 +1,74 @@
+//////////////////////////////////////////////////////////////////////////////
+//
+// Terrascale
+// Copyright (c) Dave Kilian & Emily Kilian 2023. All rights reserved.
+//
+//////////////////////////////////////////////////////////////////////////////
+
+#include <pch.h>
+#include <runtime/ring.h>
+
+trstatus tr_ring_initialize(trring *ring, unsigned capacity, tralloctag tag)
+{
+    if (capacity == 0 || (capacity & (capacity - 1)) != 0) {
+        return trstatus_argument;
+    }
+
+    ring->slots = tr_alloc(capacity * sizeof(void *), tag);
+    if (ring->slots == NULL) {
+        return trstatus_no_mem;
+    }
+
+    atomic_init(&ring->head, 0);
+    atomic_init(&ring->tail, 0);
+    ring->tailcache = 0;
+    ring->headcache = 0;
+    ring->mask = capacity - 1;
+
+    return trstatus_ok;
+}
+
+void tr_ring_cleanup(trring *ring)
+{
+    tr_free(ring->slots);
+    ring->slots = NULL;
+}
+
+bool tr_ring_push(trring *ring, void *item)
+{
+    unsigned tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+
+    if (tail - ring->headcache > ring->mask) {
+        ring->headcache = atomic_load_explicit(&ring->head, memory_order_acquire);
+        if (tail - ring->headcache > ring->mask) {
+            return false;
+        }
+    }
+
+    ring->slots[tail & ring->mask] = item;
+    atomic_store_explicit(&ring->tail, tail + 1, memory_order_release);
+    return true;
+}
+
+void *tr_ring_pop(trring *ring)
+{
+    unsigned head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+
+    if (head == ring->tailcache) {
+        ring->tailcache = atomic_load_explicit(&ring->tail, memory_order_acquire);
+        if (head == ring->tailcache) {
+            return NULL;
+        }
+    }
+
+    void *item = ring->slots[head & ring->mask];
+    atomic_store_explicit(&ring->head, head + 1, memory_order_release);
+    return item;
+}
+
+bool tr_ring_empty(trring *ring)
+{
+    unsigned head = atomic_load_explicit(&ring->head, memory_order_acquire);
+    unsigned tail = atomic_load_explicit(&ring->tail, memory_order_acquire);
+    return head == tail;
+}
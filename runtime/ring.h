@@ -0,0 +1,66 @@
+//////////////////////////////////////////////////////////////////////////////
+//
+// Terrascale
+// Copyright (c) Dave Kilian & Emily Kilian 2023. All rights reserved.
+//
+// ring.h - bounded single-producer, single-consumer message ring
+//
+// A trring passes pointers from exactly one producer thread to exactly one
+// consumer thread without locks. The producer only ever writes the tail
+// index and the consumer only ever writes the head index, so the two sides
+// never contend on the same cache line except to observe each other's
+// progress. Each side also keeps a private cached copy of the other side's
+// index, and only re-reads the shared one when the cached copy says the ring
+// is full (producer) or empty (consumer).
+//
+// If more than one thread may push, or more than one thread may pop, you
+// must provide your own synchronization, or use one ring per pair of
+// threads.
+//
+//////////////////////////////////////////////////////////////////////////////
+
+#pragma once
+
+#define tr_cacheline 64
+
+// A single-producer, single-consumer ring of pointers
+typedef struct {
+
+    // Consumer-owned
+    _Atomic unsigned head;      // Index of the next slot to pop
+    unsigned tailcache;         // Consumer's last observed tail
+    char pad1[tr_cacheline - 2 * sizeof(unsigned)];
+
+    // Producer-owned
+    _Atomic unsigned tail;      // Index of the next slot to push
+    unsigned headcache;         // Producer's last observed head
+    char pad2[tr_cacheline - 2 * sizeof(unsigned)];
+
+    // Read-only after initialization
+    unsigned mask;              // Capacity - 1
+    void **slots;               // Storage for the ring's entries
+
+} trring;
+
+// Initializes a ring which can hold up to `capacity` entries.
+// The capacity must be a nonzero power of two.
+//
+trstatus tr_ring_initialize(trring *ring, unsigned capacity, tralloctag tag);
+
+// Frees the ring's storage. Entries still in the ring are dropped.
+void tr_ring_cleanup(trring *ring);
+
+// Pushes an item onto the tail of the ring. Producer only.
+// Returns false without modifying the ring if the ring is full.
+//
+bool tr_ring_push(trring *ring, void *item);
+
+// Pops an item from the head of the ring. Consumer only.
+// Returns NULL if the ring is empty.
+//
+void *tr_ring_pop(trring *ring);
+
+// Indicates whether the ring currently appears empty.
+// Safe to call from any thread, but the answer may be stale on return.
+//
+bool tr_ring_empty(trring *ring);
@@ -100,3 +100,5 @@ typedef enum {
 #define trstatus_support   tr_status(0, trstatus_native, 17) /* feature not supported */
 #define trstatus_overrun   tr_status(0, trstatus_native, 18) /* I/O access out of bounds */
 #define trstatus_async     tr_status(0, trstatus_native, 19) /* operation in progress */
+#define trstatus_corrupt   tr_status(0, trstatus_native, 20) /* data failed integrity check */
+#define trstatus_conflict  tr_status(0, trstatus_native, 21) /* concurrent update conflicts */
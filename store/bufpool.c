@@ -0,0 +1,736 @@
+//////////////////////////////////////////////////////////////////////////////
+//
+// Terrascale
+// Copyright (c) Dave Kilian & Emily Kilian 2023. All rights reserved.
+//
+//////////////////////////////////////////////////////////////////////////////
+
+#include <pch.h>
+#include <store/bufpool.h>
+
+static trstatus tr_bufpool_writeback_run(trtask *task);
+static void tr_bufpool_writeback_done(trtask *task, trstatus status);
+static trstatus tr_bufpool_readahead_run(trtask *task);
+static void tr_bufpool_readahead_done(trtask *task, trstatus status);
+
+trstatus tr_bufpool_initialize(trbufpool *pool, unsigned nframes, tralloctag tag)
+{
+    if (nframes == 0 || nframes > UINT32_MAX / tr_pagesize) {
+        return trstatus_argument;
+    }
+
+    unsigned nbuckets = 1;
+    while (nbuckets < nframes) {
+        nbuckets <<= 1;
+    }
+
+    pool->memory = tr_alloc_aligned(nframes * tr_pagesize, tr_pagesize, tag);
+    pool->frames = tr_alloc(nframes * sizeof(trframe), tag);
+    pool->buckets = tr_alloc(nbuckets * sizeof(trlist), tag);
+    pool->wbpage = tr_alloc_aligned(tr_pagesize, tr_pagesize, tag);
+
+    if (pool->memory == NULL || pool->frames == NULL ||
+        pool->buckets == NULL || pool->wbpage == NULL) {
+
+        if (pool->memory != NULL) tr_free(pool->memory);
+        if (pool->frames != NULL) tr_free(pool->frames);
+        if (pool->buckets != NULL) tr_free(pool->buckets);
+        if (pool->wbpage != NULL) tr_free(pool->wbpage);
+        return trstatus_no_mem;
+    }
+
+    pthread_mutex_init(&pool->lock, NULL);
+    pthread_cond_init(&pool->iodone, NULL);
+
+    pool->nframes = nframes;
+    pool->nbuckets = nbuckets;
+    for (unsigned i = 0; i < nbuckets; ++i) {
+        tr_list_initialize(pool->buckets + i);
+    }
+
+    tr_list_initialize(&pool->clock);
+    for (unsigned i = 0; i < nframes; ++i) {
+        trframe *f = pool->frames + i;
+        memset(f, 0, sizeof(*f));
+        tr_list_initialize(&f->hashentry);
+        tr_list_append(&pool->clock, &f->clockentry);
+        f->data = ptr_add(pool->memory, (size_t)i * tr_pagesize);
+        tr_latch_initialize(&f->latch);
+    }
+    pool->hand = pool->clock.next;
+
+    // A scan's ring must hold a couple of readahead windows, or readahead
+    // would evict its own pages before the scan reached them
+    tr_list_initialize(&pool->probation);
+    pool->nprobation = 0;
+    pool->ringsize = max(nframes / 8, 4u);
+    pool->maxwindow = min(pool->ringsize / 2, (unsigned)tr_bufpool_maxreadahead);
+
+    for (int i = 0; i < tr_bufpool_nstreams; ++i) {
+        trbufstream *st = pool->streams + i;
+        memset(st, 0, sizeof(*st));
+        st->pool = pool;
+        tr_task_initialize(&st->task, &tr_bufpool_readahead_run, st);
+        st->task.done = &tr_bufpool_readahead_done;
+    }
+    pool->streamclock = 0;
+    pool->readahead = NULL;
+
+    memset(&pool->stat, 0, sizeof(pool->stat));
+    pool->taskman = NULL;
+    pool->wbrunning = false;
+    pool->wbcursor = 0;
+    pool->tag = tag;
+
+    return trstatus_ok;
+}
+
+void tr_bufpool_cleanup(trbufpool *pool)
+{
+    tr_assert(!pool->wbrunning);
+    for (int i = 0; i < tr_bufpool_nstreams; ++i) {
+        tr_assert(!pool->streams[i].running);
+    }
+
+    pthread_cond_destroy(&pool->iodone);
+    pthread_mutex_destroy(&pool->lock);
+
+    tr_free(pool->wbpage);
+    tr_free(pool->buckets);
+    tr_free(pool->frames);
+    tr_free(pool->memory);
+}
+
+static trlist *tr_bufpool_bucket(trbufpool *pool, uint32_t fileid, trpageno pageno)
+{
+    uint64_t key = ((uint64_t)fileid << 32) | pageno;
+    key *= 0x9e3779b97f4a7c15ull;
+    return pool->buckets + ((key >> 32) & (pool->nbuckets - 1));
+}
+
+// Finds the frame caching the given page. Called with the lock held.
+//
+// Pages are identified by their file's id rather than the trfile's address,
+// since a closed file's trfile may be reused for another file.
+//
+static trframe *tr_bufpool_lookup(trbufpool *pool, trfile *file, trpageno pageno)
+{
+    trlist *bucket = tr_bufpool_bucket(pool, file->id, pageno);
+
+    tr_list_foreach(bucket, entry) {
+        trframe *f = container_of(entry, trframe, hashentry);
+        if (f->fileid == file->id && f->pageno == pageno) {
+            return f;
+        }
+    }
+
+    return NULL;
+}
+
+// Advances the clock hand to find a frame to reuse. Called with the lock
+// held. Returns NULL if every frame is pinned or busy.
+//
+static trframe *tr_bufpool_victim(trbufpool *pool)
+{
+    // Once scans have filled their ring, they recycle it
+    if (pool->nprobation >= pool->ringsize) {
+        tr_list_foreach(&pool->probation, entry) {
+            trframe *f = container_of(entry, trframe, scanentry);
+            if (f->pins == 0 && !f->busy && !f->writing) {
+                return f;
+            }
+        }
+    }
+
+    // Two full sweeps: the first may only clear reference bits
+    for (unsigned i = 0; i < 2 * (pool->nframes + 1); ++i) {
+
+        trlist *entry = pool->hand;
+        pool->hand = entry->next;
+        if (entry == &pool->clock) {
+            continue;
+        }
+
+        trframe *f = container_of(entry, trframe, clockentry);
+        if (f->pins > 0 || f->busy || f->writing) {
+            continue;
+        }
+
+        if (!f->valid) {
+            return f;
+        }
+
+        if (f->referenced) {
+            f->referenced = false;
+            continue;
+        }
+
+        return f;
+    }
+
+    return NULL;
+}
+
+// Puts a frame on probation. Called with the lock held.
+static void tr_bufpool_probation(trbufpool *pool, trframe *f)
+{
+    if (!f->scan) {
+        f->scan = true;
+        f->referenced = false;
+        tr_list_append(&pool->probation, &f->scanentry);
+        pool->nprobation += 1;
+    }
+}
+
+// Takes a frame off probation. Called with the lock held.
+static void tr_bufpool_unprobation(trbufpool *pool, trframe *f)
+{
+    if (f->scan) {
+        f->scan = false;
+        tr_list_remove(&f->scanentry);
+        pool->nprobation -= 1;
+    }
+}
+
+// Writes a dirty frame's page back to disk through the given private buffer.
+// Called with the lock held; drops it during the write.
+//
+// The page is copied first, so that pinners can keep modifying the frame
+// while the copy is being written; any such change re-dirties the frame.
+// While writing, the frame can't be evicted, so nobody can re-read the page
+// from disk before the write lands.
+//
+static trstatus tr_bufpool_write_frame(trbufpool *pool, trframe *f, void *buffer)
+{
+    tr_assert(f->valid && f->dirty && !f->writing);
+
+    memcpy(buffer, f->data, tr_pagesize);
+    f->dirty = false;
+    f->writing = true;
+
+    pthread_mutex_unlock(&pool->lock);
+    trstatus s = tr_file_write(f->file, f->pageno, buffer);
+    pthread_mutex_lock(&pool->lock);
+
+    f->writing = false;
+    if (tr_failed(s)) {
+        f->dirty = true;
+    } else {
+        pool->stat.writes += 1;
+    }
+
+    return s;
+}
+
+// Finds a frame to reuse and detaches it from the page it holds, writing
+// the page back first if it's dirty. Called with the lock held; may drop it
+// while writing. On success, the frame is busy and not in the page table.
+//
+static trstatus tr_bufpool_claim(trbufpool *pool, trframe **frame)
+{
+    trframe *f = tr_bufpool_victim(pool);
+    if (f == NULL) {
+        return trstatus_no_mem;
+    }
+
+    f->busy = true;
+    tr_bufpool_unprobation(pool, f);
+
+    if (f->valid) {
+        pool->stat.evictions += 1;
+
+        if (f->dirty) {
+            pthread_mutex_unlock(&pool->lock);
+            trstatus s = tr_file_write(f->file, f->pageno, f->data);
+            pthread_mutex_lock(&pool->lock);
+
+            if (tr_failed(s)) {
+                f->busy = false;
+                pthread_cond_broadcast(&pool->iodone);
+                return s;
+            }
+
+            f->dirty = false;
+            pool->stat.writes += 1;
+        }
+
+        tr_list_remove(&f->hashentry);
+        f->valid = false;
+        pthread_cond_broadcast(&pool->iodone);
+    }
+
+    *frame = f;
+    return trstatus_ok;
+}
+
+// Gives a claimed frame to the given page. Called with the lock held.
+static void tr_bufpool_assign(trbufpool *pool, trframe *f, trfile *file, trpageno pageno)
+{
+    f->file = file;
+    f->fileid = file->id;
+    f->pageno = pageno;
+    f->valid = true;
+    f->dirty = false;
+    f->referenced = true;
+    f->pins = 1;
+    tr_list_append(tr_bufpool_bucket(pool, file->id, pageno), &f->hashentry);
+}
+
+// Returns a claimed frame to the pool unused. Called with the lock held.
+static void tr_bufpool_release(trbufpool *pool, trframe *f)
+{
+    if (f->valid) {
+        tr_list_remove(&f->hashentry);
+        f->valid = false;
+    }
+
+    tr_bufpool_unprobation(pool, f);
+    f->pins = 0;
+    f->busy = false;
+    pthread_cond_broadcast(&pool->iodone);
+}
+
+// Finds the stream tracking a file, or reuses the least recently used one
+// for it. Called with the lock held. Returns NULL if every stream is busy
+// reading ahead.
+//
+static trbufstream *tr_bufpool_stream(trbufpool *pool, trfile *file)
+{
+    trbufstream *victim = NULL;
+
+    for (int i = 0; i < tr_bufpool_nstreams; ++i) {
+        trbufstream *st = pool->streams + i;
+        if (st->fileid == file->id) {
+            st->used = ++pool->streamclock;
+            return st;
+        }
+
+        if (!st->running && (victim == NULL || st->used < victim->used)) {
+            victim = st;
+        }
+    }
+
+    if (victim != NULL) {
+        victim->file = file;
+        victim->fileid = file->id;
+        victim->next = 0;
+        victim->run = 0;
+        victim->ahead = 0;
+        victim->window = 0;
+        victim->used = ++pool->streamclock;
+    }
+
+    return victim;
+}
+
+// Starts reading ahead of a sequential pin, unless enough pages are already
+// on their way. Called with the lock held.
+//
+static void tr_bufpool_prefetch(trbufpool *pool, trbufstream *st, trpageno pageno)
+{
+    if (pool->readahead == NULL || pool->maxwindow < 2 || st->running ||
+        st->ahead > pageno + st->window / 2) {
+        return;
+    }
+
+    trpageno from = max(st->ahead, pageno + 1);
+    trpageno npages = tr_file_npages(st->file);
+    if (from >= npages) {
+        return;
+    }
+
+    st->window = st->window == 0 ?
+        min((unsigned)tr_bufpool_minreadahead, pool->maxwindow) :
+        min(st->window * 2, pool->maxwindow);
+    st->from = from;
+    st->to = min(from + st->window, npages);
+    st->ahead = st->to;
+    st->running = true;
+
+    tr_taskman_submit(pool->readahead, &st->task);
+}
+
+// Notes a pin in its file's stream, and returns whether it continues a
+// sequential run. Called with the lock held.
+//
+static bool tr_bufpool_sequential(trbufpool *pool, trfile *file, trpageno pageno)
+{
+    trbufstream *st = tr_bufpool_stream(pool, file);
+    if (st == NULL) {
+        return false;
+    }
+
+    // Pinning the same page again neither continues nor breaks the run
+    if (pageno == st->next) {
+        st->run += 1;
+    } else if (pageno + 1 != st->next) {
+        st->run = 1;
+        st->ahead = 0;
+        st->window = 0;
+    }
+    st->next = pageno + 1;
+
+    if (st->run < tr_bufpool_seqrun) {
+        return false;
+    }
+
+    pool->stat.sequential += 1;
+    tr_bufpool_prefetch(pool, st, pageno);
+    return true;
+}
+
+trstatus tr_bufpool_pin(trbufpool *pool, trfile *file, trpageno pageno, trframe **frame)
+{
+    pthread_mutex_lock(&pool->lock);
+    bool sequential = tr_bufpool_sequential(pool, file, pageno);
+
+    for (;;) {
+        trframe *f = tr_bufpool_lookup(pool, file, pageno);
+        if (f != NULL) {
+            if (f->busy) {
+                pthread_cond_wait(&pool->iodone, &pool->lock);
+                continue;
+            }
+
+            // Only a pin from outside a scan shows the page is worth keeping
+            f->pins += 1;
+            if (!sequential) {
+                tr_bufpool_unprobation(pool, f);
+                f->referenced = true;
+            }
+            pool->stat.hits += 1;
+            pthread_mutex_unlock(&pool->lock);
+
+            *frame = f;
+            return trstatus_ok;
+        }
+
+        trstatus s = tr_bufpool_claim(pool, &f);
+        if (tr_failed(s)) {
+            pthread_mutex_unlock(&pool->lock);
+            return s;
+        }
+
+        // The lock may have been dropped, so somebody else may have loaded
+        // the page in the meantime
+        if (tr_bufpool_lookup(pool, file, pageno) != NULL) {
+            tr_bufpool_release(pool, f);
+            continue;
+        }
+
+        tr_bufpool_assign(pool, f, file, pageno);
+        if (sequential) {
+            tr_bufpool_probation(pool, f);
+        }
+        pool->stat.misses += 1;
+        pthread_mutex_unlock(&pool->lock);
+
+        s = tr_file_read(file, pageno, f->data);
+
+        pthread_mutex_lock(&pool->lock);
+        if (tr_failed(s)) {
+            tr_bufpool_release(pool, f);
+            pthread_mutex_unlock(&pool->lock);
+            return s;
+        }
+
+        f->busy = false;
+        pthread_cond_broadcast(&pool->iodone);
+        pthread_mutex_unlock(&pool->lock);
+
+        *frame = f;
+        return trstatus_ok;
+    }
+}
+
+trstatus tr_bufpool_pin_new(trbufpool *pool, trfile *file, trpageno *pageno, trframe **frame)
+{
+    pthread_mutex_lock(&pool->lock);
+
+    trframe *f;
+    trstatus s = tr_bufpool_claim(pool, &f);
+    if (tr_failed(s)) {
+        pthread_mutex_unlock(&pool->lock);
+        return s;
+    }
+
+    trpageno newpage = tr_file_extend(file);
+    memset(f->data, 0, tr_pagesize);
+    tr_bufpool_assign(pool, f, file, newpage);
+    f->dirty = true;
+    f->busy = false;
+
+    pthread_cond_broadcast(&pool->iodone);
+    pthread_mutex_unlock(&pool->lock);
+
+    *pageno = newpage;
+    *frame = f;
+    return trstatus_ok;
+}
+
+void tr_bufpool_unpin(trbufpool *pool, trframe *frame, bool dirty)
+{
+    pthread_mutex_lock(&pool->lock);
+
+    tr_assert(frame->pins > 0);
+    frame->pins -= 1;
+    if (dirty) {
+        frame->dirty = true;
+    }
+
+    pthread_mutex_unlock(&pool->lock);
+}
+
+// Checks that the calling thread may block waiting for readahead. A worker
+// of the readahead task manager may not: in sharded mode, the readahead it
+// waits for could be queued on that very worker. Called with the lock held.
+//
+static void tr_bufpool_assert_blockable(trbufpool *pool)
+{
+    tr_assert(pool->readahead == NULL || tr_taskman_current(pool->readahead) < 0);
+    (void)pool;
+}
+
+trstatus tr_bufpool_flush(trbufpool *pool, trfile *file)
+{
+    void *buffer = tr_alloc_aligned(tr_pagesize, tr_pagesize, pool->tag);
+    if (buffer == NULL) {
+        return trstatus_no_mem;
+    }
+
+    trstatus status = trstatus_ok;
+    pthread_mutex_lock(&pool->lock);
+    tr_bufpool_assert_blockable(pool);
+
+    for (int i = 0; i < tr_bufpool_nstreams; ++i) {
+        trbufstream *st = pool->streams + i;
+        while (st->fileid == file->id && st->running) {
+            pthread_cond_wait(&pool->iodone, &pool->lock);
+        }
+    }
+
+    for (unsigned i = 0; i < pool->nframes; ++i) {
+        trframe *f = pool->frames + i;
+
+        // Wait out evictions and concurrent write-backs of this file's pages,
+        // so that everything written before the flush is on disk after it
+        while (f->fileid == file->id && (f->busy || f->writing)) {
+            pthread_cond_wait(&pool->iodone, &pool->lock);
+        }
+
+        if (f->valid && f->fileid == file->id && f->dirty) {
+            trstatus s = tr_bufpool_write_frame(pool, f, buffer);
+            pthread_cond_broadcast(&pool->iodone);
+            if (tr_failed(s)) {
+                status = s;
+            }
+        }
+    }
+
+    pthread_mutex_unlock(&pool->lock);
+    tr_free(buffer);
+
+    if (tr_ok(status)) {
+        status = tr_file_sync(file);
+    }
+
+    return status;
+}
+
+void tr_bufpool_invalidate(trbufpool *pool, trfile *file)
+{
+    pthread_mutex_lock(&pool->lock);
+    tr_bufpool_assert_blockable(pool);
+
+    for (int i = 0; i < tr_bufpool_nstreams; ++i) {
+        trbufstream *st = pool->streams + i;
+        while (st->fileid == file->id && st->running) {
+            pthread_cond_wait(&pool->iodone, &pool->lock);
+        }
+        if (st->fileid == file->id) {
+            st->file = NULL;
+            st->fileid = 0;
+            st->used = 0;
+        }
+    }
+
+    for (unsigned i = 0; i < pool->nframes; ++i) {
+        trframe *f = pool->frames + i;
+        while (f->fileid == file->id && (f->busy || f->writing)) {
+            pthread_cond_wait(&pool->iodone, &pool->lock);
+        }
+
+        if (f->valid && f->fileid == file->id) {
+            tr_assert(f->pins == 0);
+            tr_list_remove(&f->hashentry);
+            tr_bufpool_unprobation(pool, f);
+            f->file = NULL;
+            f->fileid = 0;
+            f->valid = false;
+            f->dirty = false;
+            f->referenced = false;
+        }
+    }
+
+    pthread_mutex_unlock(&pool->lock);
+}
+
+void tr_bufpool_writeback(trbufpool *pool, trtaskman *tm)
+{
+    pthread_mutex_lock(&pool->lock);
+    if (pool->wbrunning) {
+        pthread_mutex_unlock(&pool->lock);
+        return;
+    }
+
+    pool->wbrunning = true;
+    pool->wbcursor = 0;
+    pool->taskman = tm;
+    pthread_mutex_unlock(&pool->lock);
+
+    tr_task_initialize(&pool->writeback, &tr_bufpool_writeback_run, pool);
+    tr_task_set_priority(&pool->writeback, trtask_background, 0);
+    pool->writeback.done = &tr_bufpool_writeback_done;
+
+    tr_taskman_submit(tm, &pool->writeback);
+}
+
+static trstatus tr_bufpool_writeback_run(trtask *task)
+{
+    trbufpool *pool = task->context;
+
+    pthread_mutex_lock(&pool->lock);
+
+    while (pool->wbcursor < pool->nframes) {
+        trframe *f = pool->frames + pool->wbcursor++;
+
+        if (f->valid && f->dirty && f->pins == 0 && !f->busy && !f->writing) {
+            tr_bufpool_write_frame(pool, f, pool->wbpage);
+            pthread_cond_broadcast(&pool->iodone);
+        }
+
+        if (tr_task_should_yield(task)) {
+            pthread_mutex_unlock(&pool->lock);
+            return trstatus_later;
+        }
+    }
+
+    pthread_mutex_unlock(&pool->lock);
+    return trstatus_ok;
+}
+
+// Runs after the task manager is completely done with the write-back task,
+// so only now is it safe to start another pass
+//
+static void tr_bufpool_writeback_done(trtask *task, trstatus status)
+{
+    trbufpool *pool = task->context;
+
+    pthread_mutex_lock(&pool->lock);
+    pool->wbrunning = false;
+    pthread_mutex_unlock(&pool->lock);
+
+    (void)status;
+}
+
+void tr_bufpool_readahead(trbufpool *pool, trtaskman *tm)
+{
+    pthread_mutex_lock(&pool->lock);
+    pool->readahead = tm;
+    pthread_mutex_unlock(&pool->lock);
+}
+
+// Reads a stream's window of pages into frames on probation
+static trstatus tr_bufpool_readahead_run(trtask *task)
+{
+    trbufstream *st = task->context;
+    trbufpool *pool = st->pool;
+    trframe *frames[tr_bufpool_maxreadahead];
+    unsigned n = 0;
+
+    pthread_mutex_lock(&pool->lock);
+    trfile *file = st->file;
+    trpageno first = st->from;
+    trpageno end = st->to;
+
+    // Skip pages already cached, then claim frames for the run of pages
+    // after them which aren't. Claimed frames are busy in the page table,
+    // so a pin of one of them waits for the read.
+    while (first < end && tr_bufpool_lookup(pool, file, first) != NULL) {
+        first++;
+    }
+
+    while (first + n < end && n < arraysize(frames)) {
+        trframe *f;
+        if (tr_bufpool_lookup(pool, file, first + n) != NULL ||
+            tr_failed(tr_bufpool_claim(pool, &f))) {
+            break;
+        }
+
+        // The lock may have been dropped while claiming
+        if (tr_bufpool_lookup(pool, file, first + n) != NULL) {
+            tr_bufpool_release(pool, f);
+            break;
+        }
+
+        tr_bufpool_assign(pool, f, file, first + n);
+        tr_bufpool_probation(pool, f);
+        f->pins = 0;
+        frames[n++] = f;
+    }
+    pthread_mutex_unlock(&pool->lock);
+
+    if (n == 0) {
+        return trstatus_ok;
+    }
+
+    // One read for the whole run
+    void *buffer = tr_alloc_aligned((size_t)n * tr_pagesize, tr_pagesize, pool->tag);
+    trstatus s = buffer != NULL ? tr_file_readv(file, first, n, buffer) : trstatus_no_mem;
+
+    pthread_mutex_lock(&pool->lock);
+    for (unsigned i = 0; i < n; ++i) {
+        trframe *f = frames[i];
+        if (tr_ok(s)) {
+            memcpy(f->data, ptr_add(buffer, (size_t)i * tr_pagesize), tr_pagesize);
+            f->busy = false;
+            pool->stat.prefetches += 1;
+        } else {
+            tr_bufpool_release(pool, f);
+        }
+    }
+    pthread_cond_broadcast(&pool->iodone);
+    pthread_mutex_unlock(&pool->lock);
+
+    if (buffer != NULL) {
+        tr_free(buffer);
+    }
+
+    return s;
+}
+
+// Lets the stream read ahead again, and wakes anybody flushing its file
+static void tr_bufpool_readahead_done(trtask *task, trstatus status)
+{
+    trbufstream *st = task->context;
+    trbufpool *pool = st->pool;
+
+    pthread_mutex_lock(&pool->lock);
+    st->running = false;
+
+    // A failed readahead leaves the pages to be read on demand
+    if (tr_failed(status)) {
+        st->ahead = 0;
+    }
+    pthread_cond_broadcast(&pool->iodone);
+    pthread_mutex_unlock(&pool->lock);
+}
+
+trbufpoolstat tr_bufpool_stat(trbufpool *pool)
+{
+    pthread_mutex_lock(&pool->lock);
+    trbufpoolstat stat = pool->stat;
+    pthread_mutex_unlock(&pool->lock);
+
+    return stat;
+}
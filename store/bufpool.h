@@ -0,0 +1,214 @@
+//////////////////////////////////////////////////////////////////////////////
+//
+// Terrascale
+// Copyright (c) Dave Kilian & Emily Kilian 2023. All rights reserved.
+//
+// bufpool.h - a buffer pool which caches file pages in memory
+//
+// The buffer pool owns a fixed number of page-sized frames, carved out of
+// one large page-aligned allocation. To access a page, pin it: the pool
+// finds the frame caching that page, or reads the page from disk into a
+// free or evicted frame. A pinned frame stays put until it's unpinned, and
+// the caller may read (or, if it has arranged its own exclusion, modify) the
+// page while it's pinned. Unpinning with dirty=true marks the page as
+// modified, so it's written back to disk before its frame is reused.
+//
+// Frames are replaced using the CLOCK algorithm. All frames sit on a ring (an
+// intrusive trlist); each has a reference bit set whenever it's pinned. To
+// find a victim, the clock hand sweeps the ring, clearing reference bits,
+// and takes the first unpinned frame whose bit was already clear. This
+// approximates LRU at a fraction of its bookkeeping cost.
+//
+// Large scans would otherwise sweep the hot working set out of the pool, so
+// the pool watches each file's access pattern. Once a file has been pinned
+// at tr_bufpool_seqrun consecutive pages, further pins which continue the
+// run are sequential: their pages go on a probation list instead of being
+// marked referenced, and once the probation list holds a ring's worth of
+// frames, new pages reuse probation frames (oldest first) rather than
+// taking the clock's victims. A scan therefore cycles through a small ring
+// of frames. A page on probation which is pinned again by anything but the
+// scan is promoted to the clock as usual.
+//
+// With readahead enabled (see tr_bufpool_readahead), sequential pins also
+// keep a window of pages ahead of the cursor being read by a task on the
+// given task manager, doubling the window each time up to
+// tr_bufpool_maxreadahead pages, so that the scan mostly finds its pages
+// already in memory.
+//
+// Dirty pages are written back either when their frame is evicted, by an
+// explicit tr_bufpool_flush(), or in the background by the pool's
+// write-back task, which runs at background priority on a task manager
+// (see tr_bufpool_writeback).
+//
+// Pin and unpin are thread-safe. The pool does not latch page contents
+// itself, but each frame carries an optimistic latch (see latch.h) which
+// callers can use to coordinate access to the page while it's pinned.
+//
+//////////////////////////////////////////////////////////////////////////////
+
+#pragma once
+
+#include <protect/latch.h>
+#include <runtime/list.h>
+#include <store/file.h>
+#include <taskman/taskman.h>
+
+// Consecutive pages which make a file's access sequential
+#define tr_bufpool_seqrun 4
+
+// Pages in the first and largest readahead windows
+#define tr_bufpool_minreadahead 4
+#define tr_bufpool_maxreadahead 64
+
+// Files whose access patterns the pool tracks at once
+#define tr_bufpool_nstreams 8
+
+// A buffer pool frame, which caches a single page
+typedef struct {
+
+    trlist hashentry;       // Entry in the pool's page table
+    trlist clockentry;      // Entry in the pool's clock ring
+    trlist scanentry;       // Entry in the probation list, if scan is set
+    trfile *file;           // File the cached page belongs to
+    uint32_t fileid;        // That file's id, which identifies the page
+    trpageno pageno;        // Which page of the file is cached
+    void *data;             // The cached page (tr_pagesize bytes)
+    trlatch latch;          // Guards the page's contents, for its users
+    unsigned pins;          // Number of outstanding pins
+    bool valid;             // Whether the frame holds a page at all
+    bool dirty;             // Whether the page was modified since written
+    bool referenced;        // CLOCK reference bit
+    bool busy;              // Page is being read in or evicted; don't touch
+    bool writing;           // Write-back in progress; don't evict
+    bool scan;              // On probation, having only been read sequentially
+
+} trframe;
+
+// The access pattern of one file
+typedef struct {
+
+    trfile *file;           // The file, or NULL if the stream is unused
+    uint32_t fileid;        // That file's id, which identifies the stream
+    struct _trbufpool *pool; // The pool the stream belongs to
+    trpageno next;          // The page which would continue the run
+    unsigned run;           // Consecutive pages pinned so far
+    trpageno ahead;         // End of the pages read ahead
+    unsigned window;        // Pages in the last readahead
+    uint64_t used;          // When the stream was last used, for reuse
+    trtask task;            // Reads pages [from, to) ahead
+    trpageno from;
+    trpageno to;
+    bool running;           // Whether the readahead task is queued
+
+} trbufstream;
+
+// Buffer pool statistics
+typedef struct {
+
+    uint64_t hits;          // Pins satisfied from memory
+    uint64_t misses;        // Pins which had to read from disk
+    uint64_t evictions;     // Valid pages evicted to make room
+    uint64_t writes;        // Dirty pages written to disk
+    uint64_t sequential;    // Pins recognized as part of a sequential run
+    uint64_t prefetches;    // Pages read ahead
+
+} trbufpoolstat;
+
+// A cache of file pages
+typedef struct _trbufpool {
+
+    pthread_mutex_t lock;   // Protects everything below
+    pthread_cond_t iodone;  // Signaled when a frame stops being busy
+
+    void *memory;           // Page storage for all frames
+    trframe *frames;        // Array of nframes frames
+    unsigned nframes;       // Number of frames in the pool
+
+    trlist *buckets;        // Page table, hashed by file and page number
+    unsigned nbuckets;      // Number of buckets (a power of two)
+
+    trlist clock;           // Ring of all frames, for CLOCK replacement
+    trlist *hand;           // The clock hand: next entry to examine
+
+    trlist probation;       // Frames read sequentially, oldest first
+    unsigned nprobation;    // Number of frames on probation
+    unsigned ringsize;      // Probation frames a scan cycles through
+
+    trbufstream streams[tr_bufpool_nstreams];   // Tracked files
+    uint64_t streamclock;   // Ticks on each stream use
+    trtaskman *readahead;   // Task manager for readahead, or NULL if off
+    unsigned maxwindow;     // Largest readahead window, in pages
+
+    trbufpoolstat stat;     // Statistics
+
+    trtask writeback;       // The background write-back task
+    trtaskman *taskman;     // Task manager running the write-back task
+    bool wbrunning;         // Whether the write-back task is queued
+    unsigned wbcursor;      // Next frame the write-back task will examine
+    void *wbpage;           // Write-back task's private page buffer
+
+    tralloctag tag;         // Tag for the pool's heap allocations
+
+} trbufpool;
+
+// Initializes a buffer pool with the given number of frames
+trstatus tr_bufpool_initialize(trbufpool *pool, unsigned nframes, tralloctag tag);
+
+// Frees the buffer pool's memory. Dirty pages are discarded, so flush
+// first. No frames may be pinned, and neither write-back nor readahead may
+// be running.
+//
+void tr_bufpool_cleanup(trbufpool *pool);
+
+// Pins the given page of the given file, reading it from disk if necessary.
+//
+// Returns trstatus_no_mem if every frame in the pool is pinned, or the
+// status of the failed read if the page couldn't be read.
+//
+trstatus tr_bufpool_pin(trbufpool *pool, trfile *file, trpageno pageno, trframe **frame);
+
+// Adds a new page to the end of the given file and pins a frame for it.
+//
+// The page is zero-filled and marked dirty; it reaches the disk by the
+// usual write-back paths. The new page's number is returned in *pageno.
+//
+trstatus tr_bufpool_pin_new(trbufpool *pool, trfile *file, trpageno *pageno, trframe **frame);
+
+// Releases a pin. Pass dirty=true if the page was modified while pinned.
+void tr_bufpool_unpin(trbufpool *pool, trframe *frame, bool dirty);
+
+// Synchronously writes every dirty page of the given file and syncs the
+// file to stable storage. Also waits for any readahead of the file, so the
+// file may be closed afterwards.
+//
+// This blocks the calling thread until readahead tasks finish, and those may
+// be queued behind the caller, so it must not be called from a worker of
+// the readahead task manager.
+//
+trstatus tr_bufpool_flush(trbufpool *pool, trfile *file);
+
+// Drops every page of the given file from the pool, discarding changes,
+// and forgets the file's access pattern. Waits for any readahead of the
+// file and any write-back of its pages first. Call this before closing a
+// file the pool has cached (after tr_bufpool_flush, if the changes matter),
+// so that its frames don't linger until evicted. None of its pages may be
+// pinned, and like tr_bufpool_flush, it must not be called from a worker of
+// the readahead task manager.
+//
+void tr_bufpool_invalidate(trbufpool *pool, trfile *file);
+
+// Starts the pool's write-back task on the given task manager, if it isn't
+// already running. The task makes one pass over the pool at background
+// priority, writing dirty pages which aren't pinned, and yields whenever
+// more important work is waiting. Pages written this way are not synced;
+// use tr_bufpool_flush() where durability matters.
+//
+void tr_bufpool_writeback(trbufpool *pool, trtaskman *tm);
+
+// Gets a snapshot of the pool's statistics
+trbufpoolstat tr_bufpool_stat(trbufpool *pool);
+
+// Enables readahead of sequentially read files, run as tasks on the given
+// task manager
+//
+void tr_bufpool_readahead(trbufpool *pool, trtaskman *tm);
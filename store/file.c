@@ -0,0 +1,451 @@
+//////////////////////////////////////////////////////////////////////////////
+//
+// Terrascale
+// Copyright (c) Dave Kilian & Emily Kilian 2023. All rights reserved.
+//
+//////////////////////////////////////////////////////////////////////////////
+
+#include <pch.h>
+#include <runtime/crc32c.h>
+#include <runtime/lz.h>
+#include <store/file.h>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+static _Atomic uint32_t tr_file_nextid = 1;
+
+// Most bytes a compressed payload may take, so that the page's header and
+// payload leave at least one whole block of its slot unwritten
+//
+#define tr_file_zcapacity (tr_pagesize - tr_file_blocksize - sizeof(trpagehdr))
+
+// Per-thread buffer for compressing and decompressing pages
+static _Thread_local _Alignas(tr_file_blocksize) uint8_t tr_file_scratch[tr_pagesize];
+
+trstatus tr_file_open(trfile *file, const char *path, unsigned flags)
+{
+    int oflags = (flags & tr_file_readonly) ? O_RDONLY : O_RDWR;
+    if (flags & tr_file_create) {
+        oflags |= O_CREAT;
+    }
+    if (flags & tr_file_truncate) {
+        oflags |= O_TRUNC;
+    }
+
+    int fd = -1;
+    bool direct = false;
+
+#if defined(O_DIRECT)
+    if (flags & tr_file_direct) {
+        fd = open(path, oflags | O_CLOEXEC | O_DIRECT, 0644);
+        if (fd < 0 && errno != EINVAL) {
+            return tr_status_from_errno();
+        }
+        direct = fd >= 0;
+    }
+#endif
+
+    if (fd < 0) {
+        fd = open(path, oflags | O_CLOEXEC, 0644);
+        if (fd < 0) {
+            return tr_status_from_errno();
+        }
+    }
+
+#if !defined(O_DIRECT) && defined(F_NOCACHE)
+    // macOS has no O_DIRECT, but can turn caching off per descriptor
+    if (flags & tr_file_direct) {
+        direct = fcntl(fd, F_NOCACHE, 1) == 0;
+    }
+#endif
+
+    struct stat st;
+    if (fstat(fd, &st) < 0) {
+        trstatus s = tr_status_from_errno();
+        close(fd);
+        return s;
+    }
+
+    file->fd = fd;
+    file->id = atomic_fetch_add(&tr_file_nextid, 1);
+    file->compress = (flags & tr_file_compress) != 0;
+    atomic_init(&file->direct, direct);
+
+    // A compressed last page may leave the file ending part way into it
+    atomic_init(&file->npages, (trpageno)((st.st_size + tr_pagesize - 1) / tr_pagesize));
+
+    return trstatus_ok;
+}
+
+void tr_file_close(trfile *file)
+{
+    close(file->fd);
+    file->fd = -1;
+}
+
+trpageno tr_file_npages(trfile *file)
+{
+    return atomic_load(&file->npages);
+}
+
+trpageno tr_file_extend(trfile *file)
+{
+    return atomic_fetch_add(&file->npages, 1);
+}
+
+bool tr_file_isdirect(trfile *file)
+{
+    return atomic_load(&file->direct);
+}
+
+// Handles EINVAL from an I/O, which on a direct file may mean the
+// filesystem accepted O_DIRECT when opening but can't do it after all.
+// Returns whether the file fell back to buffered I/O, in which case the
+// I/O should be retried.
+//
+static bool tr_file_undirect(trfile *file)
+{
+#if defined(O_DIRECT)
+    if (atomic_exchange(&file->direct, false)) {
+        int oflags = fcntl(file->fd, F_GETFL);
+        return oflags >= 0 && fcntl(file->fd, F_SETFL, oflags & ~O_DIRECT) == 0;
+    }
+#else
+    (void)file;
+#endif
+
+    return false;
+}
+
+// Reads `bytes` bytes at the given offset. The file may end early, but
+// only after at least `required` bytes, in which case the rest reads as
+// zeros.
+//
+static trstatus tr_file_pread(trfile *file, void *buffer, size_t bytes, size_t required, off_t offset)
+{
+    while (bytes > 0) {
+        ssize_t nread = pread(file->fd, buffer, bytes, offset);
+        if (nread < 0) {
+            if (errno == EINTR || (errno == EINVAL && tr_file_undirect(file))) {
+                continue;
+            }
+            return tr_status_from_errno();
+        }
+        if (nread == 0) {
+            if (required > 0) {
+                return trstatus_overrun;
+            }
+            memset(buffer, 0, bytes);
+            break;
+        }
+
+        buffer = ptr_add(buffer, nread);
+        bytes -= nread;
+        offset += nread;
+        required = (size_t)nread < required ? required - nread : 0;
+    }
+
+    return trstatus_ok;
+}
+
+// Writes exactly `bytes` bytes at the given offset, or fails
+static trstatus tr_file_pwrite(trfile *file, const void *buffer, size_t bytes, off_t offset)
+{
+    while (bytes > 0) {
+        ssize_t nwrite = pwrite(file->fd, buffer, bytes, offset);
+        if (nwrite < 0) {
+            if (errno == EINTR || (errno == EINVAL && tr_file_undirect(file))) {
+                continue;
+            }
+            return tr_status_from_errno();
+        }
+
+        buffer = ptr_add(buffer, nwrite);
+        bytes -= nwrite;
+        offset += nwrite;
+    }
+
+    return trstatus_ok;
+}
+
+trstatus tr_file_read(trfile *file, trpageno pageno, void *page)
+{
+    return tr_file_readv(file, pageno, 1, page);
+}
+
+// Computes the checksum of the first `bytes` bytes of a page as stored on
+// disk, as if its checksum field were zero
+//
+static uint32_t tr_file_checksum(void *page, size_t bytes)
+{
+    trpagehdr *hdr = page;
+    uint32_t saved = hdr->checksum;
+
+    hdr->checksum = 0;
+    uint32_t crc = tr_crc32c(0, page, bytes);
+    hdr->checksum = saved;
+
+    return crc;
+}
+
+static bool tr_file_iszero(const void *page)
+{
+    const uint64_t *words = page;
+    for (unsigned i = 0; i < tr_pagesize / sizeof(uint64_t); ++i) {
+        if (words[i] != 0) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+// Checks a page read from disk, and decompresses it in place if it was
+// stored compressed. A page which was never written reads back as all
+// zeros, which is fine.
+//
+static trstatus tr_file_verify(void *page)
+{
+    trpagehdr *hdr = page;
+    bool compressed = (hdr->flags & tr_page_compressed) != 0;
+
+    size_t bytes = tr_pagesize;
+    if (compressed) {
+        if (hdr->zlength > tr_file_zcapacity) {
+            return trstatus_corrupt;
+        }
+        bytes = sizeof(trpagehdr) + hdr->zlength;
+    }
+
+    if (tr_file_checksum(page, bytes) != hdr->checksum) {
+        return tr_file_iszero(page) ? trstatus_ok : trstatus_corrupt;
+    }
+
+    if (compressed) {
+        unsigned length;
+        trstatus s = tr_lz_decompress(
+                tr_page_data(page),
+                hdr->zlength,
+                tr_file_scratch,
+                tr_page_payload,
+                &length);
+
+        // The checksum matched, so this is a bug rather than bad media,
+        // but the page is no more usable for that
+        if (tr_failed(s) || length != tr_page_payload) {
+            return trstatus_corrupt;
+        }
+
+        memcpy(tr_page_data(page), tr_file_scratch, tr_page_payload);
+    }
+
+    return trstatus_ok;
+}
+
+trstatus tr_file_readv(trfile *file, trpageno first, unsigned count, void *pages)
+{
+    if (count == 0) {
+        return trstatus_ok;
+    }
+
+    // Every page must exist, but the last may be cut short
+    trstatus s = tr_file_pread(
+            file,
+            pages,
+            (size_t)count * tr_pagesize,
+            (size_t)(count - 1) * tr_pagesize + 1,
+            (off_t)first * tr_pagesize);
+
+    for (unsigned i = 0; i < count && tr_ok(s); ++i) {
+        s = tr_file_verify(ptr_add(pages, (size_t)i * tr_pagesize));
+    }
+
+    return s;
+}
+
+// Compresses a page into the scratch buffer, laid out as it will be
+// written, returning how many bytes to write or zero if it's not worth it
+//
+static size_t tr_file_pack(trpagehdr *hdr)
+{
+    unsigned zlength;
+    trstatus s = tr_lz_compress(
+            tr_page_data(hdr),
+            tr_page_payload,
+            tr_file_scratch + sizeof(trpagehdr),
+            tr_file_zcapacity,
+            &zlength);
+
+    if (tr_failed(s)) {
+        return 0;
+    }
+
+    hdr->flags = tr_page_compressed;
+    hdr->zlength = zlength;
+    memcpy(tr_file_scratch, hdr, sizeof(trpagehdr));
+
+    // Pad out the last block with zeros
+    size_t used = sizeof(trpagehdr) + zlength;
+    size_t bytes = (used + tr_file_blocksize - 1) / tr_file_blocksize * tr_file_blocksize;
+    memset(tr_file_scratch + used, 0, bytes - used);
+
+    return bytes;
+}
+
+// Frees the unused tail of a compressed page's slot. Filesystems which
+// can't punch holes just keep the stale bytes, which are never read.
+//
+static trstatus tr_file_punch(trfile *file, off_t offset, size_t bytes)
+{
+#if defined(FALLOC_FL_PUNCH_HOLE)
+    if (fallocate(file->fd, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE, offset, bytes) < 0 &&
+        errno != EOPNOTSUPP && errno != ENOSYS) {
+        return tr_status_from_errno();
+    }
+#endif
+
+    return trstatus_ok;
+}
+
+trstatus tr_file_write(trfile *file, trpageno pageno, void *page)
+{
+    trpagehdr *hdr = page;
+    hdr->pageno = pageno;
+    hdr->flags = 0;
+    hdr->zlength = 0;
+
+    void *buffer = page;
+    size_t bytes = tr_pagesize;
+
+    if (file->compress) {
+        size_t packed = tr_file_pack(hdr);
+        if (packed > 0) {
+            buffer = tr_file_scratch;
+            bytes = packed;
+        }
+    }
+
+    hdr->checksum = tr_file_checksum(buffer, (hdr->flags & tr_page_compressed) ?
+            sizeof(trpagehdr) + hdr->zlength : tr_pagesize);
+    ((trpagehdr *)buffer)->checksum = hdr->checksum;
+
+    off_t offset = (off_t)pageno * tr_pagesize;
+    trstatus s = tr_file_pwrite(file, buffer, bytes, offset);
+    if (tr_ok(s) && bytes < tr_pagesize) {
+        s = tr_file_punch(file, offset + bytes, tr_pagesize - bytes);
+    }
+    if (tr_failed(s)) {
+        return s;
+    }
+
+    // Account for pages written past the end without tr_file_extend()
+    trpageno npages = atomic_load(&file->npages);
+    while (npages <= pageno &&
+           !atomic_compare_exchange_weak(&file->npages, &npages, pageno + 1)) {
+    }
+
+    return trstatus_ok;
+}
+
+trstatus tr_file_sync(trfile *file)
+{
+    if (fdatasync(file->fd) < 0) {
+        return tr_status_from_errno();
+    }
+
+    return trstatus_ok;
+}
+
+//
+// Sequential scans
+//
+
+trstatus tr_filescan_open(trfilescan *scan, trfile *file, trpageno first, trpageno end,
+        unsigned maxwindow, tralloctag tag)
+{
+    if (maxwindow == 0) {
+        maxwindow = tr_filescan_maxwindow;
+    }
+    if (maxwindow > UINT32_MAX / tr_pagesize) {
+        return trstatus_too_large;
+    }
+
+    scan->buffer = tr_alloc_aligned(maxwindow * tr_pagesize, tr_pagesize, tag);
+    if (scan->buffer == NULL) {
+        return trstatus_no_mem;
+    }
+
+    trpageno npages = tr_file_npages(file);
+    scan->file = file;
+    scan->end = min(end, npages);
+    scan->next = min(first, scan->end);
+    scan->window = min(tr_filescan_minwindow, maxwindow);
+    scan->maxwindow = maxwindow;
+    scan->pos = 0;
+    scan->count = 0;
+
+    return trstatus_ok;
+}
+
+// Passes hints about a buffered scan to the kernel: the pages just read
+// won't be wanted again, and the next window will be
+//
+static void tr_filescan_advise(trfilescan *scan, trpageno first, unsigned count)
+{
+#if defined(POSIX_FADV_WILLNEED)
+    if (tr_file_isdirect(scan->file)) {
+        return;
+    }
+
+    posix_fadvise(scan->file->fd, (off_t)first * tr_pagesize,
+            (off_t)count * tr_pagesize, POSIX_FADV_DONTNEED);
+
+    unsigned ahead = min(scan->window, scan->end - scan->next);
+    if (ahead > 0) {
+        posix_fadvise(scan->file->fd, (off_t)scan->next * tr_pagesize,
+                (off_t)ahead * tr_pagesize, POSIX_FADV_WILLNEED);
+    }
+#else
+    (void)scan;
+    (void)first;
+    (void)count;
+#endif
+}
+
+trstatus tr_filescan_next(trfilescan *scan, const void **page, trpageno *pageno)
+{
+    if (scan->pos == scan->count) {
+        if (scan->next == scan->end) {
+            return trstatus_not_found;
+        }
+
+        unsigned count = min(scan->window, scan->end - scan->next);
+        trstatus s = tr_file_readv(scan->file, scan->next, count, scan->buffer);
+        if (tr_failed(s)) {
+            return s;
+        }
+
+        trpageno first = scan->next;
+        scan->next += count;
+        scan->pos = 0;
+        scan->count = count;
+        scan->window = min(scan->window * 2, scan->maxwindow);
+
+        tr_filescan_advise(scan, first, count);
+    }
+
+    *pageno = scan->next - scan->count + scan->pos;
+    *page = ptr_add(scan->buffer, (size_t)scan->pos * tr_pagesize);
+    scan->pos++;
+
+    return trstatus_ok;
+}
+
+void tr_filescan_close(trfilescan *scan)
+{
+    tr_free(scan->buffer);
+    scan->buffer = NULL;
+}
@@ -0,0 +1,185 @@
+//////////////////////////////////////////////////////////////////////////////
+//
+// Terrascale
+// Copyright (c) Dave Kilian & Emily Kilian 2023. All rights reserved.
+//
+// file.h - page-oriented data files
+//
+// A trfile is a file made of fixed-size pages, numbered from zero. Every
+// page begins with a small trpagehdr which the store maintains; the rest of
+// the page belongs to whoever owns the page. Pages are read and written
+// whole, at offsets which are multiples of the page size.
+//
+// Every page is checksummed with CRC-32C when written, and verified when
+// read, so corruption on disk (or a torn write) is reported as
+// trstatus_corrupt rather than handed to the page's owner.
+//
+// Files opened with tr_file_compress store each page's payload compressed
+// with tr_lz_compress (see runtime/lz.h) when it shrinks to fit in half a
+// page or less. The page still occupies its whole slot in the file, but
+// only the blocks holding the compressed form are written and the rest of
+// the slot is a hole, so the disk and the page cache only hold what's
+// used. Pages which don't compress well enough are stored as they are.
+// Compression is invisible above this level: reads always return the
+// whole page, decompressed.
+//
+// Files opened with tr_file_direct bypass the kernel's page cache, so that
+// large scans don't push the buffer pool's pages out of memory only to
+// keep a second copy of pages which won't be read again. Direct I/O needs
+// buffers, offsets and lengths aligned to the device's block size; page
+// buffers from tr_alloc_aligned(tr_pagesize, tr_pagesize, ...) always are.
+// Filesystems which don't support direct I/O (tmpfs on older kernels,
+// some network filesystems) reject it with EINVAL, either when opening or
+// on the first I/O, and the file quietly falls back to buffered I/O.
+//
+// Long sequential reads should use a trfilescan, which reads ahead of its
+// caller with large reads, in a window which grows as the scan goes on.
+//
+// Most code should not read and write pages directly, but instead access
+// them through a trbufpool (see bufpool.h), which caches pages in memory.
+//
+//////////////////////////////////////////////////////////////////////////////
+
+#pragma once
+
+// Size of a single page, in bytes
+#define tr_pagesize 8192
+
+// Granularity at which compressed pages are written, which should be the
+// filesystem's block size
+//
+#define tr_file_blocksize 4096
+
+// Identifies a page within a file
+typedef uint32_t trpageno;
+
+// Header stored at the beginning of every page
+typedef struct {
+
+    trpageno pageno;    // The page's own number, stamped on write
+    uint32_t checksum;  // CRC-32C of the page with this field zeroed
+    uint64_t lsn;       // Log sequence number of the last change
+    uint32_t flags;     // trpageflags describing how the page is stored
+    uint32_t zlength;   // Length of the compressed payload, if compressed
+
+} trpagehdr;
+
+static_assert(sizeof(trpagehdr) == 24);
+
+// Flags in a page header
+typedef enum {
+
+    tr_page_compressed = 0x01,  // The payload is stored compressed
+
+} trpageflags;
+
+// Number of bytes in a page available after the header
+#define tr_page_payload (tr_pagesize - sizeof(trpagehdr))
+
+// Gets a pointer to a page's payload, just after its header
+#define tr_page_data(page) ((void *)((trpagehdr *)(page) + 1))
+
+// Options for opening a file
+typedef enum {
+
+    tr_file_create   = 0x01, // Create the file if it doesn't exist
+    tr_file_truncate = 0x02, // Discard the file's existing contents
+    tr_file_readonly = 0x04, // Open for reading only
+    tr_file_compress = 0x08, // Compress pages when writing them
+    tr_file_direct   = 0x10, // Bypass the page cache, where supported
+
+} trfileflags;
+
+// An open page file
+typedef struct {
+
+    int fd;                     // Underlying file descriptor
+    uint32_t id;                // Process-unique identifier for this file
+    bool compress;              // Whether to compress pages on write
+    _Atomic bool direct;        // Whether I/O currently bypasses the cache
+    _Atomic trpageno npages;    // Number of pages in the file
+
+} trfile;
+
+// Opens a page file with the given trfileflags
+trstatus tr_file_open(trfile *file, const char *path, unsigned flags);
+
+// Closes a page file
+void tr_file_close(trfile *file);
+
+// Gets the number of pages currently in the file
+trpageno tr_file_npages(trfile *file);
+
+// Checks whether the file's I/O bypasses the page cache. This can change
+// from true to false if the filesystem turns out not to support it.
+//
+bool tr_file_isdirect(trfile *file);
+
+// Reserves a new page number at the end of the file.
+//
+// The page doesn't exist on disk until it's written; reading it before then
+// fails with trstatus_overrun.
+//
+trpageno tr_file_extend(trfile *file);
+
+// Reads a whole page into the given tr_pagesize-byte buffer.
+// Returns trstatus_overrun if the page is past the end of the file, or
+// trstatus_corrupt if its checksum doesn't match or it fails to decompress.
+//
+trstatus tr_file_read(trfile *file, trpageno pageno, void *page);
+
+// Reads `count` consecutive pages into the given buffer in a single I/O.
+// Returns trstatus_overrun if any of the pages is past the end of the file,
+// or trstatus_corrupt if any of their checksums don't match.
+//
+trstatus tr_file_readv(trfile *file, trpageno first, unsigned count, void *pages);
+
+// Writes a whole page from the given tr_pagesize-byte buffer, stamping its
+// header with the page number and checksum. The page is compressed on the
+// way out if the file was opened with tr_file_compress; the buffer itself
+// is left as it was, apart from its header.
+//
+trstatus tr_file_write(trfile *file, trpageno pageno, void *page);
+
+// Flushes the file's data to stable storage
+trstatus tr_file_sync(trfile *file);
+
+// Smallest and default largest number of pages read at once by a scan
+#define tr_filescan_minwindow 4
+#define tr_filescan_maxwindow 256
+
+// A sequential scan over a range of a file's pages
+typedef struct {
+
+    trfile *file;           // The file being scanned
+    void *buffer;           // Pages read so far, tr_pagesize-aligned
+    trpageno next;          // Next page to read from the file
+    trpageno end;           // Page after the last to scan
+    unsigned window;        // Pages to read next time
+    unsigned maxwindow;     // Most pages to read at once
+    unsigned pos;           // Next page in the buffer to hand out
+    unsigned count;         // Pages in the buffer
+
+} trfilescan;
+
+// Starts a scan over pages [first, end) of a file, clipped to the file's
+// current size, reading at most `maxwindow` pages at a time (or
+// tr_filescan_maxwindow if zero).
+//
+// The scan reads tr_filescan_minwindow pages first and doubles its window
+// with each read after that, so short scans don't read much further than
+// they need, and long ones settle into large reads. On buffered files it
+// also asks the kernel to read the next window ahead, and to drop pages the
+// scan has finished with from the page cache.
+//
+trstatus tr_filescan_open(trfilescan *scan, trfile *file, trpageno first, trpageno end,
+        unsigned maxwindow, tralloctag tag);
+
+// Gets the next page of a scan, which stays valid until the next call.
+// Returns trstatus_not_found when the scan is finished, or fails as for
+// tr_file_readv.
+//
+trstatus tr_filescan_next(trfilescan *scan, const void **page, trpageno *pageno);
+
+// Ends a scan and frees its buffer
+void tr_filescan_close(trfilescan *scan);
@@ -0,0 +1,138 @@
+//////////////////////////////////////////////////////////////////////////////
+//
+// Terrascale
+// Copyright (c) Dave Kilian & Emily Kilian 2023. All rights reserved.
+//
+//////////////////////////////////////////////////////////////////////////////
+
+#include <pch.h>
+#include <store/filter.h>
+
+// Most probes per key; more costs more than it saves
+#define tr_filter_maxprobes 30
+
+// Trailer bit marking the blocked layout
+#define tr_filter_blockedbit 0x80
+
+// Bits in each block of a blocked filter
+#define tr_filter_blockbits (tr_filter_blocksize * 8)
+
+size_t tr_filter_size(uint64_t nkeys, unsigned bitsperkey, trfilterlayout layout)
+{
+    if (layout == trfilter_blocked) {
+        uint64_t bits = max(nkeys * bitsperkey, (uint64_t)tr_filter_blockbits);
+        return (bits + tr_filter_blockbits - 1) / tr_filter_blockbits * tr_filter_blocksize + 1;
+    }
+
+    // Very small filters have too high a false positive rate
+    uint64_t bits = max(nkeys * bitsperkey, 64u);
+    return (bits + 7) / 8 + 1;
+}
+
+// The second hash for double hashing, which must not be zero
+static inline uint64_t tr_filter_delta(uint64_t hash)
+{
+    return (hash >> 33) | (hash << 31) | 1;
+}
+
+// The block for a hash, from its high bits, which the probes within the
+// block don't use. Multiplying rather than dividing spreads the hashes over
+// any number of blocks.
+//
+static inline uint64_t tr_filter_block(uint64_t hash, uint64_t nblocks)
+{
+    return (hash >> 32) * nblocks >> 32;
+}
+
+// The second hash within a block, from bits the first probe doesn't use.
+// Being odd, it visits every bit of the block before repeating one.
+//
+static inline uint64_t tr_filter_blockdelta(uint64_t hash)
+{
+    return (hash >> 9) | 1;
+}
+
+void tr_filter_build(void *filter, size_t size, unsigned bitsperkey, trfilterlayout layout,
+        const uint64_t *hashes, uint64_t nkeys)
+{
+    uint8_t *bytes = filter;
+    uint64_t nbits = (uint64_t)(size - 1) * 8;
+
+    // k = ln 2 * bits per key minimizes the false positive rate
+    unsigned nprobes = bitsperkey * 69 / 100;
+    nprobes = max(nprobes, 1u);
+    nprobes = min(nprobes, (unsigned)tr_filter_maxprobes);
+
+    memset(bytes, 0, size);
+
+    if (layout == trfilter_blocked) {
+        bytes[size - 1] = (uint8_t)(nprobes | tr_filter_blockedbit);
+        uint64_t nblocks = (size - 1) / tr_filter_blocksize;
+        for (uint64_t i = 0; i < nkeys; ++i) {
+            uint64_t h = hashes[i];
+            uint64_t delta = tr_filter_blockdelta(h);
+            uint8_t *block = bytes + tr_filter_block(h, nblocks) * tr_filter_blocksize;
+            for (unsigned j = 0; j < nprobes; ++j) {
+                unsigned bit = h % tr_filter_blockbits;
+                block[bit / 8] |= 1 << (bit % 8);
+                h += delta;
+            }
+        }
+        return;
+    }
+
+    bytes[size - 1] = (uint8_t)nprobes;
+    for (uint64_t i = 0; i < nkeys; ++i) {
+        uint64_t h = hashes[i];
+        uint64_t delta = tr_filter_delta(h);
+        for (unsigned j = 0; j < nprobes; ++j) {
+            uint64_t bit = h % nbits;
+            bytes[bit / 8] |= 1 << (bit % 8);
+            h += delta;
+        }
+    }
+}
+
+bool tr_filter_check(const void *filter, size_t size, uint64_t hash)
+{
+    const uint8_t *bytes = filter;
+    if (size < 2) {
+        return true;
+    }
+
+    unsigned nprobes = bytes[size - 1] & ~tr_filter_blockedbit;
+    if (nprobes == 0 || nprobes > tr_filter_maxprobes) {
+        return true;
+    }
+
+    if (bytes[size - 1] & tr_filter_blockedbit) {
+        uint64_t nblocks = (size - 1) / tr_filter_blocksize;
+        if (nblocks == 0 || (size - 1) % tr_filter_blocksize != 0) {
+            return true;
+        }
+
+        uint64_t delta = tr_filter_blockdelta(hash);
+        const uint8_t *block = bytes + tr_filter_block(hash, nblocks) * tr_filter_blocksize;
+        for (unsigned j = 0; j < nprobes; ++j) {
+            unsigned bit = hash % tr_filter_blockbits;
+            if ((block[bit / 8] & (1 << (bit % 8))) == 0) {
+                return false;
+            }
+            hash += delta;
+        }
+
+        return true;
+    }
+
+    uint64_t nbits = (uint64_t)(size - 1) * 8;
+    uint64_t delta = tr_filter_delta(hash);
+    for (unsigned j = 0; j < nprobes; ++j) {
+        uint64_t bit = hash % nbits;
+        if ((bytes[bit / 8] & (1 << (bit % 8))) == 0) {
+            return false;
+        }
+        hash += delta;
+    }
+
+    return true;
+}
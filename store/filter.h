@@ -0,0 +1,64 @@
+//////////////////////////////////////////////////////////////////////////////
+//
+// Terrascale
+// Copyright (c) Dave Kilian & Emily Kilian 2023. All rights reserved.
+//
+// filter.h - Bloom filters for skipping lookups
+//
+// A filter summarizes a set of keys in a few bits per key, and answers
+// whether a key might be in the set: a "no" is always right, and a "yes"
+// is wrong for a small fraction of keys which aren't in the set (the false
+// positive rate). Stores keep a filter alongside each immutable table, so
+// most lookups for keys a table doesn't hold never touch the table.
+//
+// Filters are built from and probed with 64-bit key hashes (see
+// runtime/hash.h) rather than keys, so each key is hashed once per lookup
+// however many filters it's checked against. Probe positions are derived
+// from the one hash by double hashing.
+//
+// There are two layouts:
+//
+// - Flat filters spread each key's probes over the whole filter, so a
+//   check of a key the filter holds touches a different cache line for
+//   almost every probe.
+//
+// - Blocked filters divide the bits into 64-byte blocks and confine each
+//   key's probes to one block chosen by its hash, so a check touches one
+//   cache line. Keys are spread less evenly over blocks than bits, which
+//   costs a somewhat higher false positive rate for the same bits per key.
+//
+// A filter is a flat array of bytes which can be stored as is: the bits,
+// followed by one byte giving the number of probes per key, with the top
+// bit set for the blocked layout. Blocks are only aligned to cache lines
+// if the filter itself is.
+//
+//////////////////////////////////////////////////////////////////////////////
+
+#pragma once
+
+// Bytes in each block of a blocked filter
+#define tr_filter_blocksize 64
+
+// Filter layouts
+typedef enum {
+
+    trfilter_flat,          // Probes anywhere in the filter
+    trfilter_blocked,       // Probes within one block per key
+
+} trfilterlayout;
+
+// Gets the size in bytes of a filter for the given number of keys. Blocked
+// filters are rounded up to whole blocks.
+//
+size_t tr_filter_size(uint64_t nkeys, unsigned bitsperkey, trfilterlayout layout);
+
+// Builds a filter over the given key hashes into a tr_filter_size()-byte
+// buffer
+//
+void tr_filter_build(void *filter, size_t size, unsigned bitsperkey, trfilterlayout layout,
+        const uint64_t *hashes, uint64_t nkeys);
+
+// Checks whether a key with the given hash might be in the filter.
+// A malformed filter admits every key.
+//
+bool tr_filter_check(const void *filter, size_t size, uint64_t hash);
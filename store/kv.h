@@ -0,0 +1,48 @@
+//////////////////////////////////////////////////////////////////////////////
+//
+// Terrascale
+// Copyright (c) Dave Kilian & Emily Kilian 2023. All rights reserved.
+//
+// kv.h - keys and versioned entries for the key/value store
+//
+// Keys are arbitrary byte strings, ordered by memcmp with shorter keys
+// first on a tie. Every write to a key is a new entry carrying a sequence
+// number, and the entry with the highest sequence number is the key's
+// current value. Deleting a key writes a tombstone entry, which hides
+// older entries until compaction can drop them all.
+//
+// Wherever entries are sorted (memtables, SSTables, merges), they're in
+// key order, and newest first among entries for the same key.
+//
+//////////////////////////////////////////////////////////////////////////////
+
+#pragma once
+
+// Longest key the store accepts
+#define tr_kv_maxkey 4096
+
+// A sequence number, ordering writes
+typedef uint64_t trseqno;
+
+// A single versioned entry
+typedef struct {
+
+    const void *key;        // The key's bytes
+    unsigned keylen;        // Length of the key
+    const void *value;      // The value's bytes (none for a tombstone)
+    unsigned vallen;        // Length of the value
+    trseqno seq;            // When the entry was written
+    bool tombstone;         // Whether this entry deletes the key
+
+} trkvitem;
+
+// Compares two keys, returning <0, 0 or >0 like memcmp
+static inline int tr_kv_compare(const void *a, unsigned alen, const void *b, unsigned blen)
+{
+    int c = memcmp(a, b, min(alen, blen));
+    if (c != 0) {
+        return c;
+    }
+
+    return alen < blen ? -1 : alen > blen ? 1 : 0;
+}
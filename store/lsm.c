@@ -0,0 +1,1548 @@
+//////////////////////////////////////////////////////////////////////////////
+//
+// Terrascale
+// Copyright (c) Dave Kilian & Emily Kilian 2023. All rights reserved.
+//
+//////////////////////////////////////////////////////////////////////////////
+
+#include <pch.h>
+#include <runtime/crc32c.h>
+#include <runtime/hash.h>
+#include <store/lsm.h>
+
+#include <ctype.h>
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// Identifies the manifest ('TRLM')
+#define tr_lsm_magic 0x4d4c5254
+#define tr_lsm_version 1
+
+#define tr_lsm_manifest "MANIFEST"
+#define tr_lsm_manifest_temp "MANIFEST.tmp"
+
+// Entries a compaction merges between checks for whether to yield
+#define tr_lsm_yieldcheck 256
+
+// Header of the manifest, followed by a trlsmfile for each table
+typedef struct {
+
+    uint32_t magic;     // tr_lsm_magic
+    uint32_t version;   // tr_lsm_version
+    uint32_t ntables;   // Number of tables
+    uint32_t nextfile;  // Number of the next table file
+    trseqno maxseq;     // Highest sequence number ever in a table
+    trlsn logged;       // Log records before this are in tables
+    uint32_t checksum;  // CRC-32C of the manifest, with this field zero
+    uint32_t reserved;
+
+} trlsmmanifest;
+
+static_assert(sizeof(trlsmmanifest) == 40);
+
+// A table in the manifest
+typedef struct {
+
+    uint32_t number;    // The table's file number
+    uint32_t level;     // The level it's in
+
+} trlsmfile;
+
+// Log record operations
+typedef enum {
+
+    tr_lsm_op_put = 1,
+    tr_lsm_op_delete = 2,
+
+} trlsmop;
+
+// Header of a log record, followed by the key and then the value
+typedef struct {
+
+    uint8_t op;         // trlsmop
+    uint8_t reserved;
+    uint16_t keylen;    // Length of the key
+
+} trlsmrecord;
+
+static_assert(tr_kv_maxkey <= UINT16_MAX);
+
+// One sorted input to a compaction's merge: a single level 0 table, or the
+// overlapping tables of the lower level, read one after another
+//
+typedef struct _trlsmsource {
+
+    trsstable **tables;     // Tables to read, in order
+    unsigned ntables;       // Number of tables
+    unsigned next;          // Next table to start reading
+    trsstiter iter;         // Iterator over the current table
+    trkvitem item;          // Current entry
+    bool valid;             // Whether item is set (false at the end)
+
+} trlsmsource;
+
+static void tr_lsm_maybe_compact(trlsm *lsm);
+static trstatus tr_lsm_flush_run(trtask *task);
+static void tr_lsm_flush_done(trtask *task, trstatus status);
+static trstatus tr_lsm_compact_run(trtask *task);
+static void tr_lsm_compact_done(trtask *task, trstatus status);
+
+void tr_lsm_defaults(trlsmconfig *config, const char *dir, trtaskman *taskman)
+{
+    config->dir = dir;
+    config->taskman = taskman;
+    config->memtablesize = 4 << 20;
+    config->blocksize = 4096;
+    config->tablesize = 2 << 20;
+    config->bitsperkey = 10;
+    config->l0trigger = 4;
+    config->l0stop = 12;
+    config->levelbase = 10 << 20;
+    config->multiplier = 10;
+    config->tag = 'lsm ';
+}
+
+// Formats the path of a table file
+static trstatus tr_lsm_path(trlsm *lsm, uint32_t number, char *path)
+{
+    int n = snprintf(path, PATH_MAX, "%s/%06u.sst", lsm->dir, number);
+    return n < 0 || n >= PATH_MAX ? trstatus_too_large : trstatus_ok;
+}
+
+// Raises an atomic LSN to at least the given value
+static void tr_lsm_advance(_Atomic trlsn *lsn, trlsn to)
+{
+    trlsn cur = atomic_load(lsn);
+    while (cur < to && !atomic_compare_exchange_weak(lsn, &cur, to)) {
+    }
+}
+
+// Records the first background failure
+static void tr_lsm_fail(trlsm *lsm, trstatus status)
+{
+    trstatus expected = trstatus_ok;
+    atomic_compare_exchange_strong(&lsm->error, &expected, status);
+}
+
+// Wakes the threads and tasks waiting for background work. Called with the
+// lock held.
+//
+static void tr_lsm_changed(trlsm *lsm)
+{
+    pthread_cond_broadcast(&lsm->changed);
+
+    trlist *entry;
+    while ((entry = tr_list_rmhead(&lsm->stalled)) != NULL) {
+        tr_task_resume(container_of(entry, trtask, entry));
+    }
+}
+
+// Gets the size limit of a level (1 and up)
+static uint64_t tr_lsm_limit(trlsm *lsm, int level)
+{
+    uint64_t limit = lsm->config.levelbase;
+    for (int i = 1; i < level; ++i) {
+        limit *= lsm->config.multiplier;
+    }
+
+    return limit;
+}
+
+//
+// Levels
+//
+
+// Makes room in a level for more tables, so that adding them can't fail
+static trstatus tr_lsm_reserve(trlsm *lsm, trlsmlevel *level, unsigned more)
+{
+    if (level->count + more <= level->capacity) {
+        return trstatus_ok;
+    }
+
+    unsigned capacity = max(level->capacity * 2, level->count + more);
+    capacity = max(capacity, 16u);
+
+    trsstable **tables = tr_alloc(capacity * sizeof(*tables), lsm->config.tag);
+    if (tables == NULL) {
+        return trstatus_no_mem;
+    }
+
+    if (level->tables != NULL) {
+        memcpy(tables, level->tables, level->count * sizeof(*tables));
+        tr_free(level->tables);
+    }
+
+    level->tables = tables;
+    level->capacity = capacity;
+    return trstatus_ok;
+}
+
+// Inserts a table at the given position in a level with room for it
+static void tr_lsm_insert(trlsmlevel *level, unsigned pos, trsstable *table)
+{
+    memmove(level->tables + pos + 1, level->tables + pos, (level->count - pos) * sizeof(table));
+    level->tables[pos] = table;
+    level->count++;
+    level->bytes += table->size;
+}
+
+// Inserts a table into a level other than 0, in key order
+static void tr_lsm_insert_sorted(trlsmlevel *level, trsstable *table)
+{
+    unsigned pos = 0;
+    while (pos < level->count &&
+        tr_kv_compare(level->tables[pos]->smallest, level->tables[pos]->smallestlen,
+            table->smallest, table->smallestlen) < 0) {
+        pos++;
+    }
+
+    tr_lsm_insert(level, pos, table);
+}
+
+// Removes a table from a level, if it's there
+static void tr_lsm_remove(trlsmlevel *level, trsstable *table)
+{
+    for (unsigned i = 0; i < level->count; ++i) {
+        if (level->tables[i] == table) {
+            memmove(level->tables + i, level->tables + i + 1, (level->count - i - 1) * sizeof(table));
+            level->count--;
+            level->bytes -= table->size;
+            return;
+        }
+    }
+}
+
+static int tr_lsm_compare_tables(const void *a, const void *b)
+{
+    const trsstable *x = *(trsstable *const *)a;
+    const trsstable *y = *(trsstable *const *)b;
+    return tr_kv_compare(x->smallest, x->smallestlen, y->smallest, y->smallestlen);
+}
+
+//
+// The manifest
+//
+
+// Writes the manifest for the current set of tables. Called with the lock
+// held.
+//
+static trstatus tr_lsm_save(trlsm *lsm)
+{
+    trlsmmanifest hdr = {
+        .magic = tr_lsm_magic,
+        .version = tr_lsm_version,
+        .nextfile = lsm->nextfile,
+        .maxseq = lsm->seqbase - 1,
+        .logged = lsm->logged,
+    };
+
+    for (int i = 0; i < tr_lsm_nlevels; ++i) {
+        hdr.ntables += lsm->levels[i].count;
+        for (unsigned j = 0; j < lsm->levels[i].count; ++j) {
+            hdr.maxseq = max(hdr.maxseq, lsm->levels[i].tables[j]->maxseq);
+        }
+    }
+
+    size_t size = sizeof(hdr) + hdr.ntables * sizeof(trlsmfile);
+    uint8_t *buffer = tr_alloc(size, lsm->config.tag);
+    if (buffer == NULL) {
+        return trstatus_no_mem;
+    }
+
+    trlsmfile *files = (trlsmfile *)(buffer + sizeof(hdr));
+    for (int i = 0; i < tr_lsm_nlevels; ++i) {
+        for (unsigned j = 0; j < lsm->levels[i].count; ++j) {
+            *files++ = (trlsmfile){ lsm->levels[i].tables[j]->number, i };
+        }
+    }
+
+    memcpy(buffer, &hdr, sizeof(hdr));
+    hdr.checksum = tr_crc32c(0, buffer, size);
+    memcpy(buffer, &hdr, sizeof(hdr));
+
+    trstatus s = trstatus_ok;
+    int fd = openat(lsm->dirfd, tr_lsm_manifest_temp, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0) {
+        s = tr_status_from_errno();
+    } else {
+        ssize_t nwrite = write(fd, buffer, size);
+        if (nwrite < 0 || fsync(fd) < 0) {
+            s = tr_status_from_errno();
+        } else if ((size_t)nwrite != size) {
+            s = trstatus_fail;
+        }
+        close(fd);
+    }
+
+    if (tr_ok(s) &&
+        (renameat(lsm->dirfd, tr_lsm_manifest_temp, lsm->dirfd, tr_lsm_manifest) < 0 ||
+         fsync(lsm->dirfd) < 0)) {
+        s = tr_status_from_errno();
+    }
+
+    tr_free(buffer);
+    return s;
+}
+
+// Reads the manifest and opens its tables. A missing manifest is an empty
+// store.
+//
+static trstatus tr_lsm_load(trlsm *lsm, trseqno *maxseq)
+{
+    lsm->nextfile = 1;
+    lsm->logged = 0;
+    *maxseq = 0;
+
+    int fd = openat(lsm->dirfd, tr_lsm_manifest, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return errno == ENOENT ? trstatus_ok : tr_status_from_errno();
+    }
+
+    trstatus s = trstatus_ok;
+    uint8_t *buffer = NULL;
+    trlsmmanifest hdr = {0};
+
+    struct stat st;
+    if (fstat(fd, &st) < 0) {
+        s = tr_status_from_errno();
+    } else if ((size_t)st.st_size < sizeof(hdr)) {
+        s = trstatus_parse;
+    } else if ((buffer = tr_alloc(st.st_size, lsm->config.tag)) == NULL) {
+        s = trstatus_no_mem;
+    } else {
+        ssize_t nread = pread(fd, buffer, st.st_size, 0);
+        s = nread < 0 ? tr_status_from_errno() : nread != st.st_size ? trstatus_overrun : trstatus_ok;
+    }
+    close(fd);
+
+    if (tr_ok(s)) {
+        memcpy(&hdr, buffer, sizeof(hdr));
+        if (hdr.magic != tr_lsm_magic) {
+            s = trstatus_parse;
+        } else if (hdr.version != tr_lsm_version) {
+            s = trstatus_version;
+        } else if (sizeof(hdr) + (uint64_t)hdr.ntables * sizeof(trlsmfile) != (uint64_t)st.st_size) {
+            s = trstatus_corrupt;
+        } else {
+            uint32_t checksum = hdr.checksum;
+            hdr.checksum = 0;
+            memcpy(buffer, &hdr, sizeof(hdr));
+            if (tr_crc32c(0, buffer, st.st_size) != checksum) {
+                s = trstatus_corrupt;
+            }
+        }
+    }
+
+    for (uint32_t i = 0; tr_ok(s) && i < hdr.ntables; ++i) {
+        const trlsmfile *files = (const trlsmfile *)(buffer + sizeof(hdr));
+        if (files[i].level >= tr_lsm_nlevels || files[i].number >= hdr.nextfile) {
+            s = trstatus_corrupt;
+            break;
+        }
+
+        trlsmlevel *level = lsm->levels + files[i].level;
+        char path[PATH_MAX];
+        trsstable *table = NULL;
+
+        s = tr_lsm_reserve(lsm, level, 1);
+        if (tr_ok(s)) {
+            s = tr_lsm_path(lsm, files[i].number, path);
+        }
+        if (tr_ok(s)) {
+            table = tr_alloc(sizeof(*table), lsm->config.tag);
+            s = table != NULL ?
+                tr_sstable_open(table, path, files[i].number, lsm->config.tag) : trstatus_no_mem;
+        }
+
+        if (tr_ok(s)) {
+            tr_lsm_insert(level, level->count, table);
+        } else if (table != NULL) {
+            tr_free(table);
+        }
+    }
+
+    if (tr_ok(s)) {
+        lsm->nextfile = hdr.nextfile;
+        lsm->logged = hdr.logged;
+        *maxseq = hdr.maxseq;
+
+        for (int i = 1; i < tr_lsm_nlevels; ++i) {
+            qsort(lsm->levels[i].tables, lsm->levels[i].count, sizeof(trsstable *), &tr_lsm_compare_tables);
+        }
+    }
+
+    if (buffer != NULL) {
+        tr_free(buffer);
+    }
+    return s;
+}
+
+// Checks whether a table file is in the manifest
+static bool tr_lsm_known(trlsm *lsm, uint32_t number)
+{
+    for (int i = 0; i < tr_lsm_nlevels; ++i) {
+        for (unsigned j = 0; j < lsm->levels[i].count; ++j) {
+            if (lsm->levels[i].tables[j]->number == number) {
+                return true;
+            }
+        }
+    }
+
+    return false;
+}
+
+// Deletes tables which aren't in the manifest, and unfinished files, left
+// behind by a crash
+//
+static trstatus tr_lsm_sweep(trlsm *lsm)
+{
+    int fd = dup(lsm->dirfd);
+    DIR *dir = fd < 0 ? NULL : fdopendir(fd);
+    if (dir == NULL) {
+        trstatus s = tr_status_from_errno();
+        if (fd >= 0) {
+            close(fd);
+        }
+        return s;
+    }
+
+    struct dirent *entry;
+    while ((entry = readdir(dir)) != NULL) {
+        const char *name = entry->d_name;
+
+        // Only touch files named exactly <number>.sst or <number>.sst.tmp
+        unsigned number;
+        int end = -1;
+        bool table = false, temp = false;
+        if (isdigit((unsigned char)name[0]) &&
+            sscanf(name, "%u.sst%n", &number, &end) == 1 && end > 0) {
+
+            table = name[end] == '\0';
+            temp = strcmp(name + end, ".tmp") == 0;
+        }
+
+        if (temp || (table && !tr_lsm_known(lsm, number)) ||
+            strcmp(name, tr_lsm_manifest_temp) == 0) {
+            unlinkat(lsm->dirfd, name, 0);
+        }
+    }
+
+    closedir(dir);
+    return trstatus_ok;
+}
+
+//
+// Opening and closing
+//
+
+// Closes every table and frees the store's memory
+static void tr_lsm_free(trlsm *lsm)
+{
+    for (int i = 0; i < tr_lsm_nlevels; ++i) {
+        trlsmlevel *level = lsm->levels + i;
+        for (unsigned j = 0; j < level->count; ++j) {
+            tr_sstable_close(level->tables[j]);
+            tr_free(level->tables[j]);
+        }
+        if (level->tables != NULL) {
+            tr_free(level->tables);
+        }
+    }
+
+    if (lsm->active != NULL) {
+        tr_memtable_cleanup(lsm->active);
+        tr_free(lsm->active);
+    }
+    if (lsm->immutable != NULL) {
+        tr_memtable_cleanup(lsm->immutable);
+        tr_free(lsm->immutable);
+    }
+
+    if (lsm->dirfd >= 0) {
+        close(lsm->dirfd);
+    }
+    tr_free(lsm->dir);
+}
+
+// Allocates an empty memtable
+static trmemtable *tr_lsm_memtable(trlsm *lsm)
+{
+    trmemtable *mt = tr_alloc(sizeof(*mt), lsm->config.tag);
+    if (mt != NULL && tr_failed(tr_memtable_initialize(mt, lsm->config.tag))) {
+        tr_free(mt);
+        mt = NULL;
+    }
+
+    return mt;
+}
+
+trstatus tr_lsm_open(trlsm *lsm, const trlsmconfig *config)
+{
+    if (config->dir == NULL || config->taskman == NULL || config->memtablesize == 0 ||
+        config->blocksize == 0 || config->tablesize == 0 || config->l0trigger == 0 ||
+        config->l0stop < config->l0trigger || config->levelbase == 0 || config->multiplier < 2) {
+        return trstatus_argument;
+    }
+
+    memset(lsm, 0, sizeof(*lsm));
+    lsm->config = *config;
+    lsm->dirfd = -1;
+
+    size_t dirlen = strlen(config->dir);
+    lsm->dir = tr_alloc(dirlen + 1, config->tag);
+    if (lsm->dir == NULL) {
+        return trstatus_no_mem;
+    }
+    memcpy(lsm->dir, config->dir, dirlen + 1);
+
+    trstatus s = trstatus_ok;
+    if (mkdir(config->dir, 0755) < 0 && errno != EEXIST) {
+        s = tr_status_from_errno();
+    }
+
+    if (tr_ok(s)) {
+        lsm->dirfd = open(config->dir, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+        if (lsm->dirfd < 0) {
+            s = tr_status_from_errno();
+        }
+    }
+
+    trseqno maxseq = 0;
+    if (tr_ok(s)) {
+        s = tr_lsm_load(lsm, &maxseq);
+    }
+    if (tr_ok(s)) {
+        s = tr_lsm_sweep(lsm);
+    }
+    if (tr_ok(s)) {
+        lsm->active = tr_lsm_memtable(lsm);
+        s = lsm->active != NULL ? trstatus_ok : trstatus_no_mem;
+    }
+
+    if (tr_failed(s)) {
+        tr_lsm_free(lsm);
+        return s;
+    }
+
+    // Sequence numbers continue after every one already in a table, whether
+    // they come from the counter or from log positions
+    lsm->seqbase = maxseq + 1;
+    atomic_init(&lsm->seq, maxseq);
+    atomic_init(&lsm->lastlsn, lsm->logged);
+    atomic_init(&lsm->userbytes, 0);
+    atomic_init(&lsm->error, trstatus_ok);
+
+    // Prefer writers, so installing a memtable isn't starved by a steady
+    // stream of operations
+    pthread_rwlockattr_t attr;
+    pthread_rwlockattr_init(&attr);
+#if defined(__GLIBC__)
+    pthread_rwlockattr_setkind_np(&attr, PTHREAD_RWLOCK_PREFER_WRITER_NONRECURSIVE_NP);
+#endif
+    pthread_rwlock_init(&lsm->statelock, &attr);
+    pthread_rwlockattr_destroy(&attr);
+
+    pthread_mutex_init(&lsm->lock, NULL);
+    pthread_cond_init(&lsm->changed, NULL);
+    tr_list_initialize(&lsm->stalled);
+
+    tr_task_initialize(&lsm->flushtask, &tr_lsm_flush_run, lsm);
+    tr_task_set_priority(&lsm->flushtask, trtask_background, 0);
+    lsm->flushtask.done = &tr_lsm_flush_done;
+
+    tr_task_initialize(&lsm->compacttask, &tr_lsm_compact_run, lsm);
+    tr_task_set_priority(&lsm->compacttask, trtask_background, 0);
+    lsm->compacttask.done = &tr_lsm_compact_done;
+
+    pthread_mutex_lock(&lsm->lock);
+    tr_lsm_maybe_compact(lsm);
+    pthread_mutex_unlock(&lsm->lock);
+
+    return trstatus_ok;
+}
+
+void tr_lsm_attach(trlsm *lsm, trwal *wal)
+{
+    pthread_mutex_lock(&lsm->lock);
+    lsm->wal = wal;
+    trlsn logged = lsm->logged;
+    pthread_mutex_unlock(&lsm->lock);
+
+    tr_wal_truncate(wal, logged);
+}
+
+trstatus tr_lsm_close(trlsm *lsm)
+{
+    trstatus s = tr_lsm_flush(lsm);
+
+    pthread_mutex_lock(&lsm->lock);
+    lsm->closing = true;
+    while (lsm->flushing || lsm->compacting) {
+        pthread_cond_wait(&lsm->changed, &lsm->lock);
+    }
+    pthread_mutex_unlock(&lsm->lock);
+
+    if (tr_ok(s)) {
+        s = atomic_load(&lsm->error);
+    }
+
+    pthread_cond_destroy(&lsm->changed);
+    pthread_mutex_destroy(&lsm->lock);
+    pthread_rwlock_destroy(&lsm->statelock);
+    tr_lsm_free(lsm);
+    return s;
+}
+
+//
+// Writing
+//
+
+// Makes the active memtable immutable and starts flushing it. Called with
+// the lock held, when no flush is running.
+//
+static trstatus tr_lsm_switch(trlsm *lsm)
+{
+    trmemtable *mt = tr_lsm_memtable(lsm);
+    if (mt == NULL) {
+        return trstatus_no_mem;
+    }
+
+    // Once no write is in progress, every logged write is in the memtable
+    pthread_rwlock_wrlock(&lsm->statelock);
+    lsm->immutable = lsm->active;
+    lsm->immutablelsn = atomic_load(&lsm->lastlsn);
+    lsm->active = mt;
+    pthread_rwlock_unlock(&lsm->statelock);
+
+    lsm->flushing = true;
+    tr_taskman_submit(lsm->config.taskman, &lsm->flushtask);
+    return trstatus_ok;
+}
+
+// Waits until the active memtable has room, switching memtables when it can.
+// Given a task, parks it instead of waiting, and returns trstatus_pending.
+//
+static trstatus tr_lsm_makeroom(trlsm *lsm, trtask *task)
+{
+    trstatus s;
+    bool stalled = false;
+
+    pthread_mutex_lock(&lsm->lock);
+    for (;;) {
+        s = atomic_load(&lsm->error);
+        if (tr_failed(s) || tr_memtable_size(lsm->active) < lsm->config.memtablesize) {
+            break;
+        }
+
+        if (!lsm->flushing && lsm->immutable == NULL && lsm->levels[0].count < lsm->config.l0stop) {
+            s = tr_lsm_switch(lsm);
+            break;
+        }
+
+        if (!stalled) {
+            lsm->stat.nstalls++;
+            stalled = true;
+        }
+
+        if (task != NULL) {
+            tr_list_append(&lsm->stalled, &task->entry);
+            s = trstatus_pending;
+            break;
+        }
+        pthread_cond_wait(&lsm->changed, &lsm->lock);
+    }
+    pthread_mutex_unlock(&lsm->lock);
+
+    return s;
+}
+
+// Takes the state lock shared, once the active memtable has room
+static trstatus tr_lsm_lockactive(trlsm *lsm, trtask *task)
+{
+    for (;;) {
+        pthread_rwlock_rdlock(&lsm->statelock);
+        if (tr_memtable_size(lsm->active) < lsm->config.memtablesize) {
+            return trstatus_ok;
+        }
+        pthread_rwlock_unlock(&lsm->statelock);
+
+        trstatus s = tr_lsm_makeroom(lsm, task);
+        if (s != trstatus_ok) {
+            return s;
+        }
+    }
+}
+
+static trstatus tr_lsm_write(trlsm *lsm, const void *key, unsigned keylen,
+        const void *value, unsigned vallen, bool tombstone, trlsn *lsn, trtask *task)
+{
+    if (keylen > tr_kv_maxkey || vallen > UINT32_MAX - sizeof(trlsmrecord) - tr_kv_maxkey) {
+        return trstatus_too_large;
+    }
+
+    trstatus s = atomic_load(&lsm->error);
+    if (tr_failed(s)) {
+        return s;
+    }
+
+    // Build the log record before taking any lock
+    trwal *wal = lsm->wal;
+    uint8_t local[256];
+    uint8_t *record = NULL;
+    unsigned reclen = 0;
+
+    if (wal != NULL) {
+        reclen = sizeof(trlsmrecord) + keylen + vallen;
+        record = reclen <= sizeof(local) ? local : tr_alloc(reclen, lsm->config.tag);
+        if (record == NULL) {
+            return trstatus_no_mem;
+        }
+
+        trlsmrecord hdr = { tombstone ? tr_lsm_op_delete : tr_lsm_op_put, 0, keylen };
+        memcpy(record, &hdr, sizeof(hdr));
+        memcpy(record + sizeof(hdr), key, keylen);
+        if (vallen > 0) {
+            memcpy(record + sizeof(hdr) + keylen, value, vallen);
+        }
+    }
+
+    trkvitem item = {
+        .key = key,
+        .keylen = keylen,
+        .value = value,
+        .vallen = vallen,
+        .tombstone = tombstone,
+    };
+
+    s = tr_lsm_lockactive(lsm, task);
+    if (tr_ok(s)) {
+        // With a log, the record's position orders the write, so replay
+        // gives it the same place among the writes to its key
+        if (wal != NULL) {
+            trlsn end;
+            s = tr_wal_append(wal, record, reclen, &end);
+            if (tr_ok(s)) {
+                item.seq = lsm->seqbase + end - tr_wal_recordsize(reclen);
+                tr_lsm_advance(&lsm->lastlsn, end);
+                if (lsn != NULL) {
+                    *lsn = end;
+                }
+            }
+        } else {
+            item.seq = atomic_fetch_add(&lsm->seq, 1) + 1;
+        }
+
+        if (tr_ok(s)) {
+            s = tr_memtable_insert(lsm->active, &item);
+        }
+        pthread_rwlock_unlock(&lsm->statelock);
+    }
+
+    if (tr_ok(s)) {
+        atomic_fetch_add_explicit(&lsm->userbytes, keylen + vallen, memory_order_relaxed);
+    }
+
+    if (record != NULL && record != local) {
+        tr_free(record);
+    }
+    return s;
+}
+
+trstatus tr_lsm_put(trlsm *lsm, const void *key, unsigned keylen,
+        const void *value, unsigned vallen, trlsn *lsn)
+{
+    return tr_lsm_write(lsm, key, keylen, value, vallen, false, lsn, NULL);
+}
+
+trstatus tr_lsm_delete(trlsm *lsm, const void *key, unsigned keylen, trlsn *lsn)
+{
+    return tr_lsm_write(lsm, key, keylen, NULL, 0, true, lsn, NULL);
+}
+
+trstatus tr_lsm_put_task(trlsm *lsm, const void *key, unsigned keylen,
+        const void *value, unsigned vallen, trlsn *lsn, trtask *task)
+{
+    return tr_lsm_write(lsm, key, keylen, value, vallen, false, lsn, task);
+}
+
+trstatus tr_lsm_delete_task(trlsm *lsm, const void *key, unsigned keylen, trlsn *lsn,
+        trtask *task)
+{
+    return tr_lsm_write(lsm, key, keylen, NULL, 0, true, lsn, task);
+}
+
+trstatus tr_lsm_replay(void *context, trlsn lsn, const void *data, unsigned length)
+{
+    trlsm *lsm = context;
+
+    pthread_mutex_lock(&lsm->lock);
+    bool flushed = lsn < lsm->logged;
+    pthread_mutex_unlock(&lsm->lock);
+
+    if (flushed) {
+        return trstatus_ok;
+    }
+
+    trlsmrecord hdr;
+    if (length < sizeof(hdr)) {
+        return trstatus_corrupt;
+    }
+
+    memcpy(&hdr, data, sizeof(hdr));
+    if ((hdr.op != tr_lsm_op_put && hdr.op != tr_lsm_op_delete) ||
+        hdr.keylen > tr_kv_maxkey || hdr.keylen > length - sizeof(hdr) ||
+        (hdr.op == tr_lsm_op_delete && hdr.keylen != length - sizeof(hdr))) {
+        return trstatus_corrupt;
+    }
+
+    trkvitem item = {
+        .key = ptr_add(data, sizeof(hdr)),
+        .keylen = hdr.keylen,
+        .value = ptr_add(data, sizeof(hdr) + hdr.keylen),
+        .vallen = length - sizeof(hdr) - hdr.keylen,
+        .seq = lsm->seqbase + lsn,
+        .tombstone = hdr.op == tr_lsm_op_delete,
+    };
+
+    trstatus s = tr_lsm_lockactive(lsm, NULL);
+    if (tr_ok(s)) {
+        tr_lsm_advance(&lsm->lastlsn, lsn + tr_wal_recordsize(length));
+        s = tr_memtable_insert(lsm->active, &item);
+        pthread_rwlock_unlock(&lsm->statelock);
+    }
+
+    return s;
+}
+
+//
+// Reading
+//
+
+// Finds the newest entry for a key. Called with the state lock held.
+static trstatus tr_lsm_find(trlsm *lsm, const void *key, unsigned keylen, uint64_t hash, trkvitem *item)
+{
+    trstatus s = tr_memtable_get(lsm->active, key, keylen, item);
+    if (s == trstatus_not_found && lsm->immutable != NULL) {
+        s = tr_memtable_get(lsm->immutable, key, keylen, item);
+    }
+
+    // Level 0 tables may overlap, so check them all, newest first
+    trlsmlevel *level = lsm->levels;
+    for (unsigned i = 0; s == trstatus_not_found && i < level->count; ++i) {
+        s = tr_sstable_get(level->tables[i], key, keylen, hash, item);
+    }
+
+    // In deeper levels, only the first table which ends at or after the
+    // key could hold it
+    for (int l = 1; s == trstatus_not_found && l < tr_lsm_nlevels; ++l) {
+        level = lsm->levels + l;
+
+        unsigned lo = 0, hi = level->count;
+        while (lo < hi) {
+            unsigned mid = lo + (hi - lo) / 2;
+            trsstable *t = level->tables[mid];
+            if (tr_kv_compare(t->largest, t->largestlen, key, keylen) < 0) {
+                lo = mid + 1;
+            } else {
+                hi = mid;
+            }
+        }
+
+        if (lo < level->count) {
+            s = tr_sstable_get(level->tables[lo], key, keylen, hash, item);
+        }
+    }
+
+    return s;
+}
+
+trstatus tr_lsm_get(trlsm *lsm, const void *key, unsigned keylen,
+        void *value, unsigned capacity, unsigned *vallen)
+{
+    if (keylen > tr_kv_maxkey) {
+        return trstatus_not_found;
+    }
+
+    uint64_t hash = tr_hash_bytes(key, keylen, 0);
+    trkvitem item;
+
+    pthread_rwlock_rdlock(&lsm->statelock);
+    trstatus s = tr_lsm_find(lsm, key, keylen, hash, &item);
+    if (tr_ok(s)) {
+        if (item.tombstone) {
+            s = trstatus_not_found;
+        } else {
+            *vallen = item.vallen;
+            if (item.vallen > capacity) {
+                s = trstatus_too_small;
+            } else if (item.vallen > 0) {
+                memcpy(value, item.value, item.vallen);
+            }
+        }
+    }
+    pthread_rwlock_unlock(&lsm->statelock);
+
+    return s;
+}
+
+//
+// Flushing
+//
+
+// Allocates a table file number
+static uint32_t tr_lsm_number(trlsm *lsm)
+{
+    pthread_mutex_lock(&lsm->lock);
+    uint32_t number = lsm->nextfile++;
+    pthread_mutex_unlock(&lsm->lock);
+
+    return number;
+}
+
+// Finishes building a table and opens it
+static trstatus tr_lsm_finish(trlsm *lsm, trsstbuilder *builder, uint32_t number, trsstable **table)
+{
+    char path[PATH_MAX];
+    trstatus s = tr_lsm_path(lsm, number, path);
+    if (tr_failed(s)) {
+        tr_sstbuilder_abort(builder);
+        return s;
+    }
+
+    s = tr_sstbuilder_finish(builder);
+    if (tr_failed(s)) {
+        return s;
+    }
+
+    *table = tr_alloc(sizeof(**table), lsm->config.tag);
+    s = *table != NULL ? tr_sstable_open(*table, path, number, lsm->config.tag) : trstatus_no_mem;
+    if (tr_failed(s)) {
+        if (*table != NULL) {
+            tr_free(*table);
+        }
+        unlink(path);
+    }
+
+    return s;
+}
+
+// Closes a table which isn't in any level, and deletes its file
+static void tr_lsm_discard(trlsm *lsm, trsstable *table)
+{
+    char path[PATH_MAX];
+    if (tr_ok(tr_lsm_path(lsm, table->number, path))) {
+        unlink(path);
+    }
+
+    tr_sstable_close(table);
+    tr_free(table);
+}
+
+// Writes a memtable out as a table, keeping only the newest entry for each
+// key. Sets *table to NULL if the memtable is empty.
+//
+static trstatus tr_lsm_build(trlsm *lsm, trmemtable *mt, trsstable **table)
+{
+    *table = NULL;
+
+    trmemnode *node = tr_memtable_first(mt);
+    if (node == NULL) {
+        return trstatus_ok;
+    }
+
+    uint32_t number = tr_lsm_number(lsm);
+    char path[PATH_MAX];
+    trstatus s = tr_lsm_path(lsm, number, path);
+    if (tr_failed(s)) {
+        return s;
+    }
+
+    trsstbuilder builder;
+    s = tr_sstbuilder_create(&builder, path, lsm->config.blocksize, lsm->config.bitsperkey, lsm->config.tag);
+    if (tr_failed(s)) {
+        return s;
+    }
+
+    trkvitem prev = {0};
+    for (; node != NULL; node = tr_memtable_next(node)) {
+        trkvitem item;
+        tr_memtable_item(node, &item);
+
+        if (prev.key != NULL && tr_kv_compare(item.key, item.keylen, prev.key, prev.keylen) == 0) {
+            continue;
+        }
+
+        s = tr_sstbuilder_add(&builder, &item);
+        if (tr_failed(s)) {
+            tr_sstbuilder_abort(&builder);
+            return s;
+        }
+        prev = item;
+    }
+
+    return tr_lsm_finish(lsm, &builder, number, table);
+}
+
+static trstatus tr_lsm_flush_run(trtask *task)
+{
+    trlsm *lsm = task->context;
+    trmemtable *mt = lsm->immutable;
+
+    trsstable *table;
+    trstatus s = tr_lsm_build(lsm, mt, &table);
+
+    pthread_mutex_lock(&lsm->lock);
+    if (tr_ok(s) && table != NULL) {
+        s = tr_lsm_reserve(lsm, lsm->levels, 1);
+        if (tr_failed(s)) {
+            tr_lsm_discard(lsm, table);
+        }
+    }
+
+    if (tr_failed(s)) {
+        pthread_mutex_unlock(&lsm->lock);
+        return s;
+    }
+
+    // The table replaces the memtable in one step for readers
+    pthread_rwlock_wrlock(&lsm->statelock);
+    if (table != NULL) {
+        tr_lsm_insert(lsm->levels, 0, table);
+    }
+    lsm->immutable = NULL;
+    pthread_rwlock_unlock(&lsm->statelock);
+
+    lsm->logged = max(lsm->logged, lsm->immutablelsn);
+    lsm->stat.nflushes++;
+    lsm->stat.flushbytes += table != NULL ? table->size : 0;
+    s = tr_lsm_save(lsm);
+
+    trwal *wal = lsm->wal;
+    trlsn logged = lsm->logged;
+    pthread_mutex_unlock(&lsm->lock);
+
+    tr_memtable_cleanup(mt);
+    tr_free(mt);
+
+    if (tr_ok(s) && wal != NULL) {
+        s = tr_wal_truncate(wal, logged);
+    }
+
+    return s;
+}
+
+static void tr_lsm_flush_done(trtask *task, trstatus status)
+{
+    trlsm *lsm = task->context;
+
+    pthread_mutex_lock(&lsm->lock);
+    if (tr_failed(status)) {
+        tr_lsm_fail(lsm, status);
+    }
+    lsm->flushing = false;
+    tr_lsm_maybe_compact(lsm);
+    tr_lsm_changed(lsm);
+    pthread_mutex_unlock(&lsm->lock);
+}
+
+trstatus tr_lsm_flush(trlsm *lsm)
+{
+    trstatus s;
+
+    pthread_mutex_lock(&lsm->lock);
+    while (lsm->flushing) {
+        pthread_cond_wait(&lsm->changed, &lsm->lock);
+    }
+
+    s = atomic_load(&lsm->error);
+    if (tr_ok(s) && tr_memtable_first(lsm->active) != NULL) {
+        s = tr_lsm_switch(lsm);
+    }
+
+    while (lsm->flushing) {
+        pthread_cond_wait(&lsm->changed, &lsm->lock);
+    }
+    pthread_mutex_unlock(&lsm->lock);
+
+    return tr_ok(s) ? atomic_load(&lsm->error) : s;
+}
+
+//
+// Compaction
+//
+
+// Picks the level most in need of compaction, or returns -1 if none is
+static int tr_lsm_pick_level(trlsm *lsm)
+{
+    if (lsm->levels[0].count >= lsm->config.l0trigger) {
+        return 0;
+    }
+
+    // The level furthest over its limit; the last level has none
+    int best = -1;
+    double bestscore = 1.0;
+    for (int i = 1; i < tr_lsm_nlevels - 1; ++i) {
+        double score = (double)lsm->levels[i].bytes / tr_lsm_limit(lsm, i);
+        if (score >= bestscore) {
+            best = i;
+            bestscore = score;
+        }
+    }
+
+    return best;
+}
+
+// Adds an input table to the compaction
+static trstatus tr_lsm_add_input(trlsm *lsm, trsstable *table)
+{
+    trlsmcompaction *c = &lsm->compaction;
+
+    trsstable **inputs = tr_alloc((c->ninputs + 1) * sizeof(*inputs), lsm->config.tag);
+    if (inputs == NULL) {
+        return trstatus_no_mem;
+    }
+
+    if (c->inputs != NULL) {
+        memcpy(inputs, c->inputs, c->ninputs * sizeof(*inputs));
+        tr_free(c->inputs);
+    }
+
+    inputs[c->ninputs++] = table;
+    c->inputs = inputs;
+    return trstatus_ok;
+}
+
+// Moves a table down a level without rewriting it
+static trstatus tr_lsm_move(trlsm *lsm, int level, trsstable *table)
+{
+    trstatus s = tr_lsm_reserve(lsm, lsm->levels + level + 1, 1);
+    if (tr_failed(s)) {
+        return s;
+    }
+
+    pthread_rwlock_wrlock(&lsm->statelock);
+    tr_lsm_remove(lsm->levels + level, table);
+    tr_lsm_insert_sorted(lsm->levels + level + 1, table);
+    pthread_rwlock_unlock(&lsm->statelock);
+
+    lsm->stat.nmoves++;
+    return tr_lsm_save(lsm);
+}
+
+// Chooses the next compaction, doing it straight away if it only moves a
+// table. Returns trstatus_not_found if none is needed. Called with the lock
+// held.
+//
+static trstatus tr_lsm_pick(trlsm *lsm)
+{
+    trlsmcompaction *c = &lsm->compaction;
+
+    for (;;) {
+        trstatus s = atomic_load(&lsm->error);
+        if (tr_failed(s)) {
+            return s;
+        }
+
+        int level = lsm->closing ? -1 : tr_lsm_pick_level(lsm);
+        if (level < 0) {
+            return trstatus_not_found;
+        }
+
+        memset(c, 0, sizeof(*c));
+        c->level = level;
+
+        // All of level 0, since its tables overlap, or the next table of a
+        // deeper level in turn
+        trlsmlevel *upper = lsm->levels + level;
+        if (level == 0) {
+            for (unsigned i = upper->count; tr_ok(s) && i > 0; --i) {
+                s = tr_lsm_add_input(lsm, upper->tables[i - 1]);
+            }
+        } else {
+            unsigned pos = upper->cursor % upper->count;
+            upper->cursor = pos + 1;
+            s = tr_lsm_add_input(lsm, upper->tables[pos]);
+        }
+        c->nupper = c->ninputs;
+
+        // The key range of the inputs
+        const void *smallest = NULL, *largest = NULL;
+        unsigned smallestlen = 0, largestlen = 0;
+        for (unsigned i = 0; tr_ok(s) && i < c->nupper; ++i) {
+            trsstable *t = c->inputs[i];
+            if (smallest == NULL || tr_kv_compare(t->smallest, t->smallestlen, smallest, smallestlen) < 0) {
+                smallest = t->smallest;
+                smallestlen = t->smallestlen;
+            }
+            if (largest == NULL || tr_kv_compare(t->largest, t->largestlen, largest, largestlen) > 0) {
+                largest = t->largest;
+                largestlen = t->largestlen;
+            }
+        }
+
+        // Tables below which overlap it, in key order
+        trlsmlevel *lower = lsm->levels + level + 1;
+        for (unsigned i = 0; tr_ok(s) && i < lower->count; ++i) {
+            trsstable *t = lower->tables[i];
+            if (tr_kv_compare(t->largest, t->largestlen, smallest, smallestlen) >= 0 &&
+                tr_kv_compare(t->smallest, t->smallestlen, largest, largestlen) <= 0) {
+                s = tr_lsm_add_input(lsm, t);
+            }
+        }
+
+        if (tr_ok(s) && c->ninputs == 1) {
+            s = tr_lsm_move(lsm, level, c->inputs[0]);
+            tr_free(c->inputs);
+            c->inputs = NULL;
+            c->ninputs = 0;
+            if (tr_ok(s)) {
+                continue;
+            }
+        }
+
+        if (tr_failed(s)) {
+            if (c->inputs != NULL) {
+                tr_free(c->inputs);
+            }
+            memset(c, 0, sizeof(*c));
+            return s;
+        }
+
+        // Tombstones are only needed to hide entries in deeper levels
+        c->dropdeletes = true;
+        for (int i = level + 2; i < tr_lsm_nlevels; ++i) {
+            c->dropdeletes &= lsm->levels[i].count == 0;
+        }
+
+        return trstatus_ok;
+    }
+}
+
+// Moves a merge source to its next entry
+static trstatus tr_lsm_source_next(trlsmsource *src)
+{
+    for (;;) {
+        if (src->next > 0) {
+            trstatus s = tr_sstiter_next(&src->iter, &src->item);
+            if (s != trstatus_not_found) {
+                src->valid = tr_ok(s);
+                return s;
+            }
+        }
+
+        if (src->next == src->ntables) {
+            src->valid = false;
+            return trstatus_ok;
+        }
+
+        tr_sstiter_initialize(&src->iter, src->tables[src->next++]);
+    }
+}
+
+// Sets up the merge sources for the picked compaction
+static trstatus tr_lsm_compact_start(trlsm *lsm)
+{
+    trlsmcompaction *c = &lsm->compaction;
+
+    unsigned nsources = c->nupper + (c->ninputs > c->nupper ? 1 : 0);
+    c->sources = tr_alloc(nsources * sizeof(trlsmsource), lsm->config.tag);
+    if (c->sources == NULL) {
+        return trstatus_no_mem;
+    }
+
+    c->nsources = nsources;
+    for (unsigned i = 0; i < nsources; ++i) {
+        trlsmsource *src = c->sources + i;
+        src->tables = c->inputs + i;
+        src->ntables = i < c->nupper ? 1 : c->ninputs - c->nupper;
+        src->next = 0;
+        src->valid = false;
+
+        trstatus s = tr_lsm_source_next(src);
+        if (tr_failed(s)) {
+            return s;
+        }
+    }
+
+    return trstatus_ok;
+}
+
+// Adds a finished output table to the compaction
+static trstatus tr_lsm_add_output(trlsm *lsm, trsstable *table)
+{
+    trlsmcompaction *c = &lsm->compaction;
+
+    if (c->noutputs == c->outcapacity) {
+        unsigned capacity = max(c->outcapacity * 2, 8u);
+        trsstable **outputs = tr_alloc(capacity * sizeof(*outputs), lsm->config.tag);
+        if (outputs == NULL) {
+            tr_lsm_discard(lsm, table);
+            return trstatus_no_mem;
+        }
+
+        if (c->outputs != NULL) {
+            memcpy(outputs, c->outputs, c->noutputs * sizeof(*outputs));
+            tr_free(c->outputs);
+        }
+
+        c->outputs = outputs;
+        c->outcapacity = capacity;
+    }
+
+    c->outputs[c->noutputs++] = table;
+    return trstatus_ok;
+}
+
+// Finishes the output table being built
+static trstatus tr_lsm_end_output(trlsm *lsm)
+{
+    trlsmcompaction *c = &lsm->compaction;
+
+    trsstable *table;
+    c->building = false;
+    trstatus s = tr_lsm_finish(lsm, &c->builder, c->building_number, &table);
+    if (tr_ok(s)) {
+        s = tr_lsm_add_output(lsm, table);
+    }
+
+    return s;
+}
+
+// Merges the inputs into new tables, returning trstatus_later when the
+// task should yield
+//
+static trstatus tr_lsm_merge(trlsm *lsm, trtask *task)
+{
+    trlsmcompaction *c = &lsm->compaction;
+
+    for (unsigned n = 1; ; ++n) {
+        // The smallest key, and the newest entry for it
+        trlsmsource *best = NULL;
+        for (unsigned i = 0; i < c->nsources; ++i) {
+            trlsmsource *src = c->sources + i;
+            if (!src->valid) {
+                continue;
+            }
+
+            int cmp = best == NULL ? -1 :
+                tr_kv_compare(src->item.key, src->item.keylen, best->item.key, best->item.keylen);
+            if (cmp < 0 || (cmp == 0 && src->item.seq > best->item.seq)) {
+                best = src;
+            }
+        }
+
+        if (best == NULL) {
+            break;
+        }
+
+        trkvitem *item = &best->item;
+        bool newest = !c->haveprev ||
+            tr_kv_compare(item->key, item->keylen, c->prevkey, c->prevkeylen) != 0;
+
+        trstatus s = trstatus_ok;
+        if (newest) {
+            c->prevkey = item->key;
+            c->prevkeylen = item->keylen;
+            c->haveprev = true;
+
+            if (!item->tombstone || !c->dropdeletes) {
+                if (!c->building) {
+                    c->building_number = tr_lsm_number(lsm);
+                    char path[PATH_MAX];
+                    s = tr_lsm_path(lsm, c->building_number, path);
+                    if (tr_ok(s)) {
+                        s = tr_sstbuilder_create(&c->builder, path, lsm->config.blocksize,
+                                lsm->config.bitsperkey, lsm->config.tag);
+                    }
+                    c->building = tr_ok(s);
+                }
+
+                if (tr_ok(s)) {
+                    s = tr_sstbuilder_add(&c->builder, item);
+                }
+                if (tr_ok(s) && tr_sstbuilder_size(&c->builder) >= lsm->config.tablesize) {
+                    s = tr_lsm_end_output(lsm);
+                }
+            }
+        }
+
+        if (tr_ok(s)) {
+            s = tr_lsm_source_next(best);
+        }
+        if (tr_failed(s)) {
+            return s;
+        }
+
+        if (n % tr_lsm_yieldcheck == 0 && tr_task_should_yield(task)) {
+            return trstatus_later;
+        }
+    }
+
+    return c->building ? tr_lsm_end_output(lsm) : trstatus_ok;
+}
+
+// Replaces the inputs with the outputs. Called with the lock held.
+static trstatus tr_lsm_install(trlsm *lsm)
+{
+    trlsmcompaction *c = &lsm->compaction;
+    trlsmlevel *upper = lsm->levels + c->level;
+    trlsmlevel *lower = upper + 1;
+
+    trstatus s = tr_lsm_reserve(lsm, lower, c->noutputs);
+    if (tr_failed(s)) {
+        return s;
+    }
+
+    pthread_rwlock_wrlock(&lsm->statelock);
+    for (unsigned i = 0; i < c->ninputs; ++i) {
+        tr_lsm_remove(i < c->nupper ? upper : lower, c->inputs[i]);
+    }
+    for (unsigned i = 0; i < c->noutputs; ++i) {
+        tr_lsm_insert_sorted(lower, c->outputs[i]);
+        lsm->stat.compactbytes += c->outputs[i]->size;
+    }
+    pthread_rwlock_unlock(&lsm->statelock);
+
+    lsm->stat.ncompactions++;
+    c->noutputs = 0;
+    s = tr_lsm_save(lsm);
+
+    // Nothing can be reading the inputs now. If the manifest couldn't be
+    // saved, the old one still refers to them, so leave the files.
+    for (unsigned i = 0; i < c->ninputs; ++i) {
+        if (tr_ok(s)) {
+            tr_lsm_discard(lsm, c->inputs[i]);
+        } else {
+            tr_sstable_close(c->inputs[i]);
+            tr_free(c->inputs[i]);
+        }
+    }
+    c->ninputs = 0;
+
+    return s;
+}
+
+// Frees the compaction's state, discarding any outputs not installed
+static void tr_lsm_compact_cleanup(trlsm *lsm)
+{
+    trlsmcompaction *c = &lsm->compaction;
+
+    if (c->building) {
+        tr_sstbuilder_abort(&c->builder);
+    }
+    for (unsigned i = 0; i < c->noutputs; ++i) {
+        tr_lsm_discard(lsm, c->outputs[i]);
+    }
+
+    if (c->outputs != NULL) tr_free(c->outputs);
+    if (c->sources != NULL) tr_free(c->sources);
+    if (c->inputs != NULL) tr_free(c->inputs);
+    memset(c, 0, sizeof(*c));
+}
+
+static trstatus tr_lsm_compact_run(trtask *task)
+{
+    trlsm *lsm = task->context;
+    trlsmcompaction *c = &lsm->compaction;
+
+    for (;;) {
+        trstatus s;
+
+        // Pick a compaction unless resuming one
+        if (c->sources == NULL) {
+            pthread_mutex_lock(&lsm->lock);
+            s = tr_lsm_pick(lsm);
+            pthread_mutex_unlock(&lsm->lock);
+
+            if (s == trstatus_not_found) {
+                return trstatus_ok;
+            }
+            if (tr_ok(s)) {
+                s = tr_lsm_compact_start(lsm);
+            }
+            if (tr_failed(s)) {
+                tr_lsm_compact_cleanup(lsm);
+                return s;
+            }
+        }
+
+        s = tr_lsm_merge(lsm, task);
+        if (s == trstatus_later) {
+            return s;
+        }
+
+        if (tr_ok(s)) {
+            pthread_mutex_lock(&lsm->lock);
+            s = tr_lsm_install(lsm);
+            pthread_mutex_unlock(&lsm->lock);
+        }
+
+        tr_lsm_compact_cleanup(lsm);
+        if (tr_failed(s)) {
+            return s;
+        }
+
+        // Writes may be waiting for level 0 to shrink
+        pthread_mutex_lock(&lsm->lock);
+        tr_lsm_changed(lsm);
+        pthread_mutex_unlock(&lsm->lock);
+    }
+}
+
+static void tr_lsm_compact_done(trtask *task, trstatus status)
+{
+    trlsm *lsm = task->context;
+
+    pthread_mutex_lock(&lsm->lock);
+    if (tr_failed(status)) {
+        tr_lsm_fail(lsm, status);
+    }
+    lsm->compacting = false;
+
+    // A flush may have finished after the last pick
+    tr_lsm_maybe_compact(lsm);
+    tr_lsm_changed(lsm);
+    pthread_mutex_unlock(&lsm->lock);
+}
+
+// Starts the compaction task if it isn't running and there's work for it.
+// Called with the lock held.
+//
+static void tr_lsm_maybe_compact(trlsm *lsm)
+{
+    if (!lsm->compacting && !lsm->closing && tr_ok(atomic_load(&lsm->error)) &&
+        tr_lsm_pick_level(lsm) >= 0) {
+        lsm->compacting = true;
+        tr_taskman_submit(lsm->config.taskman, &lsm->compacttask);
+    }
+}
+
+trstatus tr_lsm_settle(trlsm *lsm)
+{
+    pthread_mutex_lock(&lsm->lock);
+    tr_lsm_maybe_compact(lsm);
+    while ((lsm->flushing || lsm->compacting) && tr_ok(atomic_load(&lsm->error))) {
+        pthread_cond_wait(&lsm->changed, &lsm->lock);
+    }
+    pthread_mutex_unlock(&lsm->lock);
+
+    return atomic_load(&lsm->error);
+}
+
+trlsmstat tr_lsm_stat(trlsm *lsm)
+{
+    pthread_mutex_lock(&lsm->lock);
+    trlsmstat stat = lsm->stat;
+    for (int i = 0; i < tr_lsm_nlevels; ++i) {
+        stat.ntables[i] = lsm->levels[i].count;
+        stat.nbytes[i] = lsm->levels[i].bytes;
+    }
+    pthread_mutex_unlock(&lsm->lock);
+
+    stat.userbytes = atomic_load(&lsm->userbytes);
+    return stat;
+}
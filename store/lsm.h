@@ -0,0 +1,232 @@
+//////////////////////////////////////////////////////////////////////////////
+//
+// Terrascale
+// Copyright (c) Dave Kilian & Emily Kilian 2023. All rights reserved.
+//
+// lsm.h - a log-structured merge-tree key/value store
+//
+// For write-heavy data, such as edit logs and tile updates, updating pages
+// in place costs a random write per change. An LSM tree instead turns
+// writes into sequential I/O:
+//
+// - Writes go into the active memtable (see memtable.h), and optionally
+//   into a write-ahead log (see wal.h) for durability.
+//
+// - When the active memtable fills up, it becomes immutable, a fresh one
+//   takes its place, and a background task flushes the immutable one to a
+//   new SSTable (see sstable.h) in level 0.
+//
+// - Level 0 tables may overlap each other. Every other level is a sorted
+//   run of non-overlapping tables, each level allowed `multiplier` times
+//   the bytes of the one above. A background compaction task merges
+//   tables down a level when level 0 has too many tables or a level is
+//   over its size, keeping only the newest entry for each key, and dropping
+//   tombstones once no deeper level could hold an older entry.
+//
+// - Lookups check the memtables, then level 0's tables from newest to
+//   oldest, then the one table in each deeper level whose key range could
+//   hold the key. Each table keeps a Bloom filter (see filter.h) in memory,
+//   so tables which don't hold the key are almost always skipped without
+//   reading them.
+//
+// The set of tables is recorded in a manifest file, which is rewritten and
+// atomically renamed into place whenever a flush or compaction finishes.
+//
+// Flushes and compactions run as trtask_background tasks on the caller's
+// task manager; compactions yield whenever tr_task_should_yield() says to.
+// Writes are applied by the calling thread, and stall when the store falls
+// behind: when the active memtable is full while the last one is still
+// being flushed, or when level 0 has l0stop tables. tr_lsm_put and
+// tr_lsm_delete block the thread for the stall, so they must not be called
+// from task manager workers: in sharded mode, the background task which
+// would end the stall may be queued on the very worker that's blocked.
+// Tasks write with tr_lsm_put_task and tr_lsm_delete_task instead, which
+// park the task for the stall (as sync.h does) and leave the worker free.
+//
+// Concurrency: any number of threads may put, delete and get at once. They
+// share a reader/writer lock with the background tasks, which only take it
+// exclusively for the moment it takes to install a new memtable or a new
+// set of tables. Since lookups hold the lock shared throughout, a table
+// replaced by compaction can be closed as soon as the new set is installed.
+//
+//////////////////////////////////////////////////////////////////////////////
+
+#pragma once
+
+#include <store/memtable.h>
+#include <store/sstable.h>
+#include <store/wal.h>
+#include <taskman/taskman.h>
+
+// Number of levels, including level 0
+#define tr_lsm_nlevels 7
+
+// Store configuration
+typedef struct {
+
+    const char *dir;            // Directory for the manifest and tables
+    trtaskman *taskman;         // Runs flushes and compactions
+    size_t memtablesize;        // Memtable size which triggers a flush (default 4M)
+    unsigned blocksize;         // SSTable data block size (default 4K)
+    uint64_t tablesize;         // Target size of compacted tables (default 2M)
+    unsigned bitsperkey;        // Filter bits per key (default 10)
+    unsigned l0trigger;         // Level 0 tables which trigger compaction (default 4)
+    unsigned l0stop;            // Level 0 tables which stall writes (default 12)
+    uint64_t levelbase;         // Size limit of level 1 (default 10M)
+    unsigned multiplier;        // Size ratio between levels (default 10)
+    tralloctag tag;             // Tag for the store's heap allocations
+
+} trlsmconfig;
+
+// Fills in the default configuration for a store in the given directory
+void tr_lsm_defaults(trlsmconfig *config, const char *dir, trtaskman *taskman);
+
+// One level of the tree
+typedef struct {
+
+    trsstable **tables;     // Tables; level 0 newest first, others by key
+    unsigned count;         // Number of tables
+    unsigned capacity;      // Capacity of tables
+    uint64_t bytes;         // Total size of the tables
+    unsigned cursor;        // Where the next compaction of the level starts
+
+} trlsmlevel;
+
+// Store statistics
+typedef struct {
+
+    uint64_t userbytes;     // Key and value bytes written by callers
+    uint64_t flushbytes;    // Bytes written by flushes
+    uint64_t compactbytes;  // Bytes written by compactions
+    uint64_t nflushes;      // Memtables flushed
+    uint64_t ncompactions;  // Compactions which rewrote tables
+    uint64_t nmoves;        // Compactions which only moved a table down
+    uint64_t nstalls;       // Times a write waited for background work
+    unsigned ntables[tr_lsm_nlevels];   // Tables in each level
+    uint64_t nbytes[tr_lsm_nlevels];    // Bytes in each level
+
+} trlsmstat;
+
+// The state of a compaction, kept across yields
+typedef struct {
+
+    int level;                  // Input level; output goes to level + 1
+    trsstable **inputs;         // Input tables, from both levels
+    unsigned ninputs;           // Number of inputs
+    unsigned nupper;            // Inputs from `level` (the rest are below)
+    struct _trlsmsource *sources; // Merge sources
+    unsigned nsources;          // Number of sources
+    bool dropdeletes;           // Whether tombstones can be dropped
+    const void *prevkey;        // Last key seen, to skip older entries
+    unsigned prevkeylen;
+    bool haveprev;              // Whether prevkey is set
+    trsstbuilder builder;       // Output table being built
+    bool building;              // Whether builder is in use
+    uint32_t building_number;   // File number of the output being built
+    trsstable **outputs;        // Finished output tables
+    unsigned noutputs;          // Number of outputs
+    unsigned outcapacity;       // Capacity of outputs
+
+} trlsmcompaction;
+
+// A key/value store
+typedef struct {
+
+    trlsmconfig config;         // Configuration, with defaults filled in
+    char *dir;                  // Copy of config.dir
+    int dirfd;                  // The store's directory
+    trwal *wal;                 // Log which writes go to, or NULL
+
+    pthread_rwlock_t statelock; // Shared by operations; exclusive to install
+    trmemtable *active;         // Memtable taking writes
+    trmemtable *immutable;      // Memtable being flushed, or NULL
+    trlsn immutablelsn;         // Log position covered by the immutable memtable
+    trlsmlevel levels[tr_lsm_nlevels];
+
+    _Atomic trseqno seq;        // Last sequence number assigned
+    trseqno seqbase;            // Added to log positions to make sequence numbers
+    _Atomic trlsn lastlsn;      // End of the last record logged
+    _Atomic uint64_t userbytes; // Bytes written by callers
+    _Atomic trstatus error;     // First background failure, which stops writes
+
+    pthread_mutex_t lock;       // Protects the fields below, and the manifest
+    pthread_cond_t changed;     // Signaled when background work finishes
+    trlist stalled;             // Writing tasks parked until then
+    bool flushing;              // Whether the flush task is running
+    bool compacting;            // Whether the compaction task is running
+    bool closing;               // Set once no new compactions should start
+    uint32_t nextfile;          // Number of the next table file
+    trlsn logged;               // Log records before this are in tables
+    trlsmstat stat;             // Statistics (those under this lock)
+    trtask flushtask;           // Flushes the immutable memtable
+    trtask compacttask;         // Runs compactions
+    trlsmcompaction compaction; // The running compaction
+
+} trlsm;
+
+// Opens the store in the given directory, creating it if necessary, and
+// starts any compaction the existing tables need.
+//
+// To make writes durable, open the store first, then open a log with
+// tr_lsm_replay as its replay routine and the store as context, which
+// recovers writes which weren't yet in tables, and then attach the log
+// with tr_lsm_attach before writing.
+//
+trstatus tr_lsm_open(trlsm *lsm, const trlsmconfig *config);
+
+// Replays a log record into the store (see tr_lsm_open)
+trstatus tr_lsm_replay(void *context, trlsn lsn, const void *data, unsigned length);
+
+// Starts logging writes to the given log, once it has been replayed
+void tr_lsm_attach(trlsm *lsm, trwal *wal);
+
+// Flushes the active memtable, waits for background work to finish, and
+// closes the store. With a log attached, writes since the last flush are
+// also in the log, but the flush saves replaying them.
+//
+trstatus tr_lsm_close(trlsm *lsm);
+
+// Sets a key's value. With a log attached, returns in *lsn (which may be
+// NULL) the log position the write is durable at (see tr_wal_wait).
+//
+// Returns trstatus_too_large if the key is longer than tr_kv_maxkey, or the
+// first background failure if flushing or compaction has failed.
+//
+trstatus tr_lsm_put(trlsm *lsm, const void *key, unsigned keylen,
+        const void *value, unsigned vallen, trlsn *lsn);
+
+// Deletes a key, which needn't exist; otherwise like tr_lsm_put
+trstatus tr_lsm_delete(trlsm *lsm, const void *key, unsigned keylen, trlsn *lsn);
+
+// Sets a key's value from a task, or parks the task if writes are stalled.
+// Like the acquire routines in sync.h, returns trstatus_pending after
+// parking, and the task must call this again, with the same arguments, once
+// it's resumed. Otherwise like tr_lsm_put.
+//
+trstatus tr_lsm_put_task(trlsm *lsm, const void *key, unsigned keylen,
+        const void *value, unsigned vallen, trlsn *lsn, trtask *task);
+
+// Deletes a key from a task; otherwise like tr_lsm_put_task
+trstatus tr_lsm_delete_task(trlsm *lsm, const void *key, unsigned keylen, trlsn *lsn,
+        trtask *task);
+
+// Gets a key's value, copying it into the given buffer and setting *vallen
+// to its length.
+//
+// Returns trstatus_not_found if the key has no value, or trstatus_too_small
+// if the buffer can't hold the value, with *vallen set to the size needed.
+//
+trstatus tr_lsm_get(trlsm *lsm, const void *key, unsigned keylen,
+        void *value, unsigned capacity, unsigned *vallen);
+
+// Makes the active memtable immutable and waits until it's been flushed.
+// Blocks the thread, so like tr_lsm_settle and tr_lsm_close, this must not
+// be called from a task manager worker.
+//
+trstatus tr_lsm_flush(trlsm *lsm);
+
+// Waits until no compaction is needed
+trstatus tr_lsm_settle(trlsm *lsm);
+
+// Gets a snapshot of the store's statistics
+trlsmstat tr_lsm_stat(trlsm *lsm);
@@ -0,0 +1,256 @@
+//////////////////////////////////////////////////////////////////////////////
+//
+// Terrascale
+// Copyright (c) Dave Kilian & Emily Kilian 2023. All rights reserved.
+//
+//////////////////////////////////////////////////////////////////////////////
+
+#include <pch.h>
+#include <store/memtable.h>
+
+// Size of each chunk entries are allocated from
+#define tr_memtable_chunksize (1u << 20)
+
+static_assert(offsetof(trmemchunk, data) % 16 == 0);
+
+// Per-thread state for choosing entry heights
+static _Thread_local uint64_t tr_memtable_random;
+
+// Chooses a height, where each level is a quarter as likely as the last
+static int tr_memtable_height()
+{
+    uint64_t x = tr_memtable_random;
+    if (x == 0) {
+        x = (uintptr_t)&tr_memtable_random | 1;
+    }
+
+    // xorshift64
+    x ^= x << 13;
+    x ^= x >> 7;
+    x ^= x << 17;
+    tr_memtable_random = x;
+
+    int height = 1;
+    while (height < tr_memtable_maxheight && (x & 3) == 0) {
+        height++;
+        x >>= 2;
+    }
+
+    return height;
+}
+
+static inline void *tr_memnode_key(trmemnode *node)
+{
+    return &node->next[node->height];
+}
+
+// Compares an entry with a key and sequence number, in memtable order
+static inline int tr_memnode_compare(trmemnode *node, const void *key, unsigned keylen, trseqno seq)
+{
+    int c = tr_kv_compare(tr_memnode_key(node), node->keylen, key, keylen);
+    if (c != 0) {
+        return c;
+    }
+
+    return node->seq > seq ? -1 : node->seq < seq ? 1 : 0;
+}
+
+// Adds a chunk big enough for an allocation of the given size, unless
+// another thread already replaced the given full chunk
+//
+static trstatus tr_memtable_grow(trmemtable *mt, trmemchunk *full, size_t bytes)
+{
+    trstatus s = trstatus_ok;
+
+    pthread_mutex_lock(&mt->lock);
+    if (atomic_load(&mt->chunk) == full) {
+        size_t size = max(bytes, (size_t)tr_memtable_chunksize);
+        trmemchunk *chunk = size <= UINT32_MAX - sizeof(trmemchunk) ?
+            tr_alloc(sizeof(trmemchunk) + size, mt->tag) : NULL;
+
+        if (chunk != NULL) {
+            chunk->next = full;
+            chunk->size = size;
+            atomic_init(&chunk->used, 0);
+            atomic_fetch_add(&mt->size, sizeof(trmemchunk) + size);
+            atomic_store(&mt->chunk, chunk);
+        } else {
+            s = trstatus_no_mem;
+        }
+    }
+    pthread_mutex_unlock(&mt->lock);
+
+    return s;
+}
+
+static void *tr_memtable_alloc(trmemtable *mt, size_t bytes)
+{
+    bytes = (bytes + 15) & ~(size_t)15;
+
+    for (;;) {
+        trmemchunk *chunk = atomic_load(&mt->chunk);
+        if (chunk != NULL) {
+            size_t offset = atomic_fetch_add(&chunk->used, bytes);
+            if (offset + bytes <= chunk->size) {
+                return chunk->data + offset;
+            }
+        }
+
+        if (tr_failed(tr_memtable_grow(mt, chunk, bytes))) {
+            return NULL;
+        }
+    }
+}
+
+trstatus tr_memtable_initialize(trmemtable *mt, tralloctag tag)
+{
+    atomic_init(&mt->chunk, NULL);
+    atomic_init(&mt->size, 0);
+    pthread_mutex_init(&mt->lock, NULL);
+    mt->tag = tag;
+
+    size_t headsize = sizeof(trmemnode) + tr_memtable_maxheight * sizeof(mt->head->next[0]);
+    mt->head = tr_memtable_alloc(mt, headsize);
+    if (mt->head == NULL) {
+        pthread_mutex_destroy(&mt->lock);
+        return trstatus_no_mem;
+    }
+
+    memset(mt->head, 0, headsize);
+    mt->head->height = tr_memtable_maxheight;
+    return trstatus_ok;
+}
+
+void tr_memtable_cleanup(trmemtable *mt)
+{
+    trmemchunk *chunk = atomic_load(&mt->chunk);
+    while (chunk != NULL) {
+        trmemchunk *next = chunk->next;
+        tr_free(chunk);
+        chunk = next;
+    }
+
+    pthread_mutex_destroy(&mt->lock);
+    mt->head = NULL;
+}
+
+// Finds the last entry before the given position at each level, and the
+// entry after it
+//
+static void tr_memtable_find(trmemtable *mt, const void *key, unsigned keylen, trseqno seq,
+        trmemnode **preds, trmemnode **succs)
+{
+    trmemnode *x = mt->head;
+
+    for (int level = tr_memtable_maxheight - 1; level >= 0; --level) {
+        trmemnode *next = atomic_load_explicit(&x->next[level], memory_order_acquire);
+        while (next != NULL && tr_memnode_compare(next, key, keylen, seq) < 0) {
+            x = next;
+            next = atomic_load_explicit(&x->next[level], memory_order_acquire);
+        }
+
+        preds[level] = x;
+        succs[level] = next;
+    }
+}
+
+trstatus tr_memtable_insert(trmemtable *mt, const trkvitem *item)
+{
+    int height = tr_memtable_height();
+    trmemnode *node = tr_memtable_alloc(mt,
+            sizeof(trmemnode) + height * sizeof(node->next[0]) + item->keylen + item->vallen);
+    if (node == NULL) {
+        return trstatus_no_mem;
+    }
+
+    node->seq = item->seq;
+    node->keylen = item->keylen;
+    node->vallen = item->tombstone ? 0 : item->vallen;
+    node->height = height;
+    node->tombstone = item->tombstone;
+    memcpy(tr_memnode_key(node), item->key, item->keylen);
+    if (node->vallen > 0) {
+        memcpy(ptr_add(tr_memnode_key(node), item->keylen), item->value, node->vallen);
+    }
+
+    trmemnode *preds[tr_memtable_maxheight];
+    trmemnode *succs[tr_memtable_maxheight];
+    tr_memtable_find(mt, item->key, item->keylen, item->seq, preds, succs);
+
+    // Link in bottom-up, so the entry is in the list before it can be
+    // reached from above
+    for (int level = 0; level < height; ++level) {
+        for (;;) {
+            atomic_store_explicit(&node->next[level], succs[level], memory_order_relaxed);
+            if (atomic_compare_exchange_strong_explicit(&preds[level]->next[level], &succs[level], node,
+                    memory_order_release, memory_order_relaxed)) {
+                break;
+            }
+
+            // Lost a race with another insert; entries are never removed,
+            // so the predecessor is still before this entry
+            trmemnode *x = preds[level];
+            trmemnode *next = atomic_load_explicit(&x->next[level], memory_order_acquire);
+            while (next != NULL && tr_memnode_compare(next, item->key, item->keylen, item->seq) < 0) {
+                x = next;
+                next = atomic_load_explicit(&x->next[level], memory_order_acquire);
+            }
+
+            preds[level] = x;
+            succs[level] = next;
+        }
+    }
+
+    return trstatus_ok;
+}
+
+void tr_memtable_item(trmemnode *node, trkvitem *item)
+{
+    item->key = tr_memnode_key(node);
+    item->keylen = node->keylen;
+    item->value = ptr_add(item->key, node->keylen);
+    item->vallen = node->vallen;
+    item->seq = node->seq;
+    item->tombstone = node->tombstone;
+}
+
+trstatus tr_memtable_get(trmemtable *mt, const void *key, unsigned keylen, trkvitem *item)
+{
+    trmemnode *x = mt->head;
+
+    // The newest entry for the key sorts first, as if its sequence number
+    // were the highest possible
+    for (int level = tr_memtable_maxheight - 1; level >= 0; --level) {
+        trmemnode *next = atomic_load_explicit(&x->next[level], memory_order_acquire);
+        while (next != NULL && tr_memnode_compare(next, key, keylen, UINT64_MAX) < 0) {
+            x = next;
+            next = atomic_load_explicit(&x->next[level], memory_order_acquire);
+        }
+    }
+
+    trmemnode *node = atomic_load_explicit(&x->next[0], memory_order_acquire);
+    if (node == NULL || tr_kv_compare(tr_memnode_key(node), node->keylen, key, keylen) != 0) {
+        return trstatus_not_found;
+    }
+
+    tr_memtable_item(node, item);
+    return trstatus_ok;
+}
+
+size_t tr_memtable_size(trmemtable *mt)
+{
+    // The chunk being allocated from only counts as far as it's used
+    trmemchunk *chunk = atomic_load(&mt->chunk);
+    size_t used = min(atomic_load(&chunk->used), chunk->size);
+    return atomic_load(&mt->size) - chunk->size + used;
+}
+
+trmemnode *tr_memtable_first(trmemtable *mt)
+{
+    return atomic_load_explicit(&mt->head->next[0], memory_order_acquire);
+}
+
+trmemnode *tr_memtable_next(trmemnode *node)
+{
+    return atomic_load_explicit(&node->next[0], memory_order_acquire);
+}
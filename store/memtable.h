@@ -0,0 +1,96 @@
+//////////////////////////////////////////////////////////////////////////////
+//
+// Terrascale
+// Copyright (c) Dave Kilian & Emily Kilian 2023. All rights reserved.
+//
+// memtable.h - a concurrent in-memory table of recent writes
+//
+// A memtable collects writes in memory, sorted, until there are enough to
+// write out as an SSTable. It's a skiplist: a sorted linked list of
+// entries, where each entry is also linked into a random number of higher
+// levels, each level skipping over about three quarters of the entries of
+// the level below, so searches take logarithmic time.
+//
+// Entries are only ever added, never changed or removed, which lets
+// inserts be lock-free: a new entry is linked in level by level, with a
+// compare-and-swap on its predecessor's link at each level, and an insert
+// which loses a race re-searches from its predecessor and tries again.
+// Readers need no synchronization at all; they may just not see entries
+// which are being inserted while they look. Every write to a key, delete
+// included, is a separate entry (see kv.h).
+//
+// Entries are bump-allocated from large chunks, which are freed all at
+// once with the memtable.
+//
+//////////////////////////////////////////////////////////////////////////////
+
+#pragma once
+
+#include <store/kv.h>
+
+// Most levels in a memtable's skiplist
+#define tr_memtable_maxheight 12
+
+// A memtable entry. The key and value follow the links.
+typedef struct _trmemnode {
+
+    trseqno seq;            // Sequence number of the write
+    uint32_t keylen;        // Length of the key
+    uint32_t vallen;        // Length of the value
+    uint8_t height;         // Number of levels the entry is linked into
+    bool tombstone;         // Whether this entry deletes the key
+    _Atomic(struct _trmemnode *) next[];    // Next entry at each level
+
+} trmemnode;
+
+// A chunk of memory which entries are allocated from
+typedef struct _trmemchunk {
+
+    struct _trmemchunk *next;   // Previously filled chunk
+    size_t size;                // Bytes available in data
+    _Atomic size_t used;        // Bytes handed out (may overshoot size)
+    char pad[8];                // Keeps data 16-byte aligned
+    char data[];
+
+} trmemchunk;
+
+// A memtable
+typedef struct {
+
+    trmemnode *head;                // Sentinel before the first entry
+    _Atomic(trmemchunk *) chunk;    // Chunk currently being allocated from
+    _Atomic size_t size;            // Bytes of chunks allocated
+    pthread_mutex_t lock;           // Serializes adding chunks
+    tralloctag tag;                 // Tag for the memtable's chunks
+
+} trmemtable;
+
+// Initializes an empty memtable
+trstatus tr_memtable_initialize(trmemtable *mt, tralloctag tag);
+
+// Frees a memtable and all its entries
+void tr_memtable_cleanup(trmemtable *mt);
+
+// Adds an entry. The key and value are copied. Sequence numbers must be
+// unique within a key. Safe to call from several threads at once.
+//
+trstatus tr_memtable_insert(trmemtable *mt, const trkvitem *item);
+
+// Finds the newest entry for a key, including a tombstone, or returns
+// trstatus_not_found. The item points into the memtable.
+//
+trstatus tr_memtable_get(trmemtable *mt, const void *key, unsigned keylen, trkvitem *item);
+
+// Gets the memory the memtable's entries take up, in bytes (approximate
+// while inserts are running)
+//
+size_t tr_memtable_size(trmemtable *mt);
+
+// Gets the first entry in order, or NULL if the memtable is empty
+trmemnode *tr_memtable_first(trmemtable *mt);
+
+// Gets the entry after the given one, or NULL at the end
+trmemnode *tr_memtable_next(trmemnode *node);
+
+// Describes an entry as a trkvitem pointing into the memtable
+void tr_memtable_item(trmemnode *node, trkvitem *item);
@@ -0,0 +1,398 @@
+//////////////////////////////////////////////////////////////////////////////
+//
+// Terrascale
+// Copyright (c) Dave Kilian & Emily Kilian 2023. All rights reserved.
+//
+//////////////////////////////////////////////////////////////////////////////
+
+#include <pch.h>
+#include <runtime/lz.h>
+#include <store/segment.h>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <libgen.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+static int tr_segment_advice(trsegaccess access)
+{
+    switch (access) {
+    case trsegment_sequential: return MADV_SEQUENTIAL;
+    case trsegment_random: return MADV_RANDOM;
+    case trsegment_willneed: return MADV_WILLNEED;
+    default: return MADV_NORMAL;
+    }
+}
+
+trstatus tr_segment_open(trsegment *seg, const char *path, trsegaccess access)
+{
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return tr_status_from_errno();
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) < 0) {
+        trstatus s = tr_status_from_errno();
+        close(fd);
+        return s;
+    }
+
+    if ((size_t)st.st_size < sizeof(trseghdr)) {
+        close(fd);
+        return trstatus_parse;
+    }
+
+    // The mapping keeps the file open, so the descriptor isn't needed
+    void *base = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    trstatus s = base == MAP_FAILED ? tr_status_from_errno() : trstatus_ok;
+    close(fd);
+    if (tr_failed(s)) {
+        return s;
+    }
+
+    const trseghdr *hdr = base;
+    if (hdr->magic != tr_segment_magic) {
+        s = trstatus_parse;
+    } else if (hdr->version != tr_segment_version) {
+        s = trstatus_version;
+    } else if (hdr->size != (uint64_t)st.st_size ||
+               hdr->index > hdr->size ||
+               (hdr->size - hdr->index) / sizeof(trsegentry) < hdr->count) {
+        s = trstatus_overrun;
+    }
+
+    if (tr_failed(s)) {
+        munmap(base, st.st_size);
+        return s;
+    }
+
+    seg->base = base;
+    seg->size = st.st_size;
+    seg->count = hdr->count;
+    seg->index = ptr_add(base, hdr->index);
+
+    // Hints are only advice, so failing to give them isn't an error
+    tr_segment_advise(seg, access);
+    return trstatus_ok;
+}
+
+void tr_segment_close(trsegment *seg)
+{
+    munmap((void *)seg->base, seg->size);
+    seg->base = NULL;
+    seg->size = 0;
+}
+
+trstatus tr_segment_advise(trsegment *seg, trsegaccess access)
+{
+    if (madvise((void *)seg->base, seg->size, tr_segment_advice(access)) < 0) {
+        return tr_status_from_errno();
+    }
+
+    return trstatus_ok;
+}
+
+// Finds and checks a blob's index entry
+static trstatus tr_segment_entry(const trsegment *seg, uint32_t index, const trsegentry **entry)
+{
+    if (index >= seg->count) {
+        return trstatus_not_found;
+    }
+
+    const trsegentry *e = seg->index + index;
+    if (e->offset < sizeof(trseghdr) ||
+        e->offset > seg->size ||
+        e->length > seg->size - e->offset) {
+        return trstatus_overrun;
+    }
+    if (e->length > e->rawlength) {
+        return trstatus_corrupt;
+    }
+
+    *entry = e;
+    return trstatus_ok;
+}
+
+trstatus tr_segment_get(const trsegment *seg, uint32_t index, const void **data, uint64_t *length)
+{
+    const trsegentry *entry;
+    trstatus s = tr_segment_entry(seg, index, &entry);
+    if (tr_failed(s)) {
+        return s;
+    }
+
+    if (entry->length < entry->rawlength) {
+        return trstatus_support;
+    }
+
+    *data = ptr_add(seg->base, entry->offset);
+    *length = entry->length;
+    return trstatus_ok;
+}
+
+trstatus tr_segment_read(const trsegment *seg, uint32_t index, void *buffer, uint64_t capacity, uint64_t *length)
+{
+    const trsegentry *entry;
+    trstatus s = tr_segment_entry(seg, index, &entry);
+    if (tr_failed(s)) {
+        return s;
+    }
+
+    *length = entry->rawlength;
+    if (capacity < entry->rawlength) {
+        return trstatus_too_small;
+    }
+
+    const void *data = ptr_add(seg->base, entry->offset);
+    if (entry->length == entry->rawlength) {
+        memcpy(buffer, data, entry->length);
+        return trstatus_ok;
+    }
+
+    unsigned rawlength;
+    s = tr_lz_decompress(data, entry->length, buffer, entry->rawlength, &rawlength);
+    if (tr_failed(s) || rawlength != entry->rawlength) {
+        return trstatus_corrupt;
+    }
+
+    return trstatus_ok;
+}
+
+//
+// Writing segments
+//
+
+trstatus tr_segwriter_create(trsegwriter *writer, const char *path, tralloctag tag)
+{
+    size_t pathlen = strlen(path);
+    writer->path = tr_alloc(pathlen + 1, tag);
+    writer->temppath = tr_alloc(pathlen + 5, tag);
+    if (writer->path == NULL || writer->temppath == NULL) {
+        if (writer->path != NULL) tr_free(writer->path);
+        if (writer->temppath != NULL) tr_free(writer->temppath);
+        return trstatus_no_mem;
+    }
+
+    memcpy(writer->path, path, pathlen + 1);
+    memcpy(writer->temppath, path, pathlen);
+    memcpy(writer->temppath + pathlen, ".tmp", 5);
+
+    writer->file = fopen(writer->temppath, "wbe");
+    if (writer->file == NULL) {
+        trstatus s = tr_status_from_errno();
+        tr_free(writer->temppath);
+        tr_free(writer->path);
+        return s;
+    }
+
+    writer->index = NULL;
+    writer->count = 0;
+    writer->capacity = 0;
+    writer->tag = tag;
+
+    // Leave room for the header, which is written last
+    trseghdr hdr = {0};
+    if (fwrite(&hdr, sizeof(hdr), 1, writer->file) != 1) {
+        trstatus s = tr_status_from_errno();
+        tr_segwriter_abort(writer);
+        return s;
+    }
+
+    writer->offset = sizeof(hdr);
+    return trstatus_ok;
+}
+
+// Pads the file with zeros up to the given alignment
+static trstatus tr_segwriter_pad(trsegwriter *writer, unsigned align)
+{
+    static const char zeros[tr_segment_align];
+
+    unsigned pad = (align - writer->offset % align) % align;
+    if (pad > 0) {
+        if (fwrite(zeros, 1, pad, writer->file) != pad) {
+            return tr_status_from_errno();
+        }
+        writer->offset += pad;
+    }
+
+    return trstatus_ok;
+}
+
+// Appends a blob as stored, with the length it has once decompressed
+static trstatus tr_segwriter_put(trsegwriter *writer, const void *data, uint32_t length, uint32_t rawlength, uint32_t *index)
+{
+    if (writer->count == UINT32_MAX) {
+        return trstatus_too_large;
+    }
+
+    if (writer->count == writer->capacity) {
+        uint32_t capacity = max(writer->capacity * 2, 256u);
+        if (capacity * sizeof(trsegentry) > UINT32_MAX) {
+            return trstatus_too_large;
+        }
+
+        trsegentry *grown = tr_alloc(capacity * sizeof(trsegentry), writer->tag);
+        if (grown == NULL) {
+            return trstatus_no_mem;
+        }
+
+        if (writer->index != NULL) {
+            memcpy(grown, writer->index, writer->count * sizeof(trsegentry));
+            tr_free(writer->index);
+        }
+
+        writer->index = grown;
+        writer->capacity = capacity;
+    }
+
+    trstatus s = tr_segwriter_pad(writer, tr_segment_align);
+    if (tr_failed(s)) {
+        return s;
+    }
+
+    if (length > 0 && fwrite(data, 1, length, writer->file) != length) {
+        return tr_status_from_errno();
+    }
+
+    writer->index[writer->count] = (trsegentry){
+        .offset = writer->offset,
+        .length = length,
+        .rawlength = rawlength,
+    };
+    writer->offset += length;
+
+    *index = writer->count++;
+    return trstatus_ok;
+}
+
+trstatus tr_segwriter_add(trsegwriter *writer, const void *data, uint64_t length, uint32_t *index)
+{
+    if (length > UINT32_MAX) {
+        return trstatus_too_large;
+    }
+
+    return tr_segwriter_put(writer, data, length, length, index);
+}
+
+trstatus tr_segwriter_add_compressed(trsegwriter *writer, const void *data, uint64_t length, uint32_t *index)
+{
+    if (length > UINT32_MAX) {
+        return trstatus_too_large;
+    }
+
+    if (length <= 1) {
+        return tr_segwriter_put(writer, data, length, length, index);
+    }
+
+    // Only worth keeping if it saves something
+    void *compressed = tr_alloc(length - 1, writer->tag);
+    if (compressed == NULL) {
+        return trstatus_no_mem;
+    }
+
+    unsigned zlength;
+    trstatus s = tr_lz_compress(data, length, compressed, length - 1, &zlength);
+    if (tr_ok(s)) {
+        s = tr_segwriter_put(writer, compressed, zlength, length, index);
+    } else {
+        s = tr_segwriter_put(writer, data, length, length, index);
+    }
+
+    tr_free(compressed);
+    return s;
+}
+
+// Writes out the index and header and syncs the temporary file
+static trstatus tr_segwriter_complete(trsegwriter *writer)
+{
+    trstatus s = tr_segwriter_pad(writer, sizeof(trsegentry));
+    if (tr_failed(s)) {
+        return s;
+    }
+
+    trseghdr hdr = {
+        .magic = tr_segment_magic,
+        .version = tr_segment_version,
+        .count = writer->count,
+        .index = writer->offset,
+        .size = writer->offset + (uint64_t)writer->count * sizeof(trsegentry),
+    };
+
+    if (fwrite(writer->index, sizeof(trsegentry), writer->count, writer->file) != writer->count ||
+        fseek(writer->file, 0, SEEK_SET) < 0 ||
+        fwrite(&hdr, sizeof(hdr), 1, writer->file) != 1 ||
+        fflush(writer->file) != 0 ||
+        fsync(fileno(writer->file)) < 0) {
+
+        return tr_status_from_errno();
+    }
+
+    return trstatus_ok;
+}
+
+// Syncs the directory containing the given path, so a rename is durable
+static trstatus tr_segwriter_syncdir(const char *path, tralloctag tag)
+{
+    size_t pathlen = strlen(path);
+    char *copy = tr_alloc(pathlen + 1, tag);
+    if (copy == NULL) {
+        return trstatus_no_mem;
+    }
+    memcpy(copy, path, pathlen + 1);
+
+    trstatus s = trstatus_ok;
+    int fd = open(dirname(copy), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (fd < 0 || fsync(fd) < 0) {
+        s = tr_status_from_errno();
+    }
+    if (fd >= 0) {
+        close(fd);
+    }
+
+    tr_free(copy);
+    return s;
+}
+
+trstatus tr_segwriter_finish(trsegwriter *writer)
+{
+    trstatus s = tr_segwriter_complete(writer);
+    if (tr_failed(s)) {
+        tr_segwriter_abort(writer);
+        return s;
+    }
+
+    fclose(writer->file);
+    writer->file = NULL;
+
+    if (rename(writer->temppath, writer->path) < 0) {
+        s = tr_status_from_errno();
+        unlink(writer->temppath);
+    } else {
+        s = tr_segwriter_syncdir(writer->path, writer->tag);
+    }
+
+    if (writer->index != NULL) {
+        tr_free(writer->index);
+    }
+    tr_free(writer->temppath);
+    tr_free(writer->path);
+
+    return s;
+}
+
+void tr_segwriter_abort(trsegwriter *writer)
+{
+    if (writer->file != NULL) {
+        fclose(writer->file);
+        unlink(writer->temppath);
+    }
+
+    if (writer->index != NULL) {
+        tr_free(writer->index);
+    }
+    tr_free(writer->temppath);
+    tr_free(writer->path);
+}
@@ -0,0 +1,156 @@
+//////////////////////////////////////////////////////////////////////////////
+//
+// Terrascale
+// Copyright (c) Dave Kilian & Emily Kilian 2023. All rights reserved.
+//
+// segment.h - immutable, memory-mapped segment files
+//
+// A segment is a write-once file holding a numbered sequence of blobs, such
+// as the tiles of a tile archive or the chunks of a frozen table. Since
+// segments never change once written, they don't need the buffer pool:
+// readers map the whole file read-only and get pointers straight into the
+// mapping, so a read costs no copy and no cache memory beyond the kernel's
+// page cache. Opening a segment only maps it and checks its header, so it
+// takes the same time whatever the segment's size, and nothing has to be
+// loaded after a restart.
+//
+// The file layout is:
+//
+//     trseghdr                  (at offset 0)
+//     blob 0, blob 1, ...       (each aligned to tr_segment_align)
+//     trsegentry[count]         (the offset index, at trseghdr.index)
+//
+// Blobs may be stored compressed with tr_lz_compress (see runtime/lz.h),
+// for data such as heightfield tiles where disk and page cache space
+// matter more than the copy. Compressed blobs are read with
+// tr_segment_read, which decompresses into the caller's buffer.
+//
+// Segments are built with a trsegwriter, which writes to a temporary file
+// and renames it into place when finished, so a segment file which exists
+// under its final name is always complete.
+//
+//////////////////////////////////////////////////////////////////////////////
+
+#pragma once
+
+// Identifies a segment file ('TRSG')
+#define tr_segment_magic 0x47535254
+
+// The segment format version written by this code
+#define tr_segment_version 2
+
+// Alignment of every blob within a segment
+#define tr_segment_align 16
+
+// Header at the beginning of every segment file
+typedef struct {
+
+    uint32_t magic;     // tr_segment_magic
+    uint16_t version;   // tr_segment_version
+    uint16_t flags;     // Reserved; zero
+    uint32_t count;     // Number of blobs
+    uint32_t reserved;  // Reserved; zero
+    uint64_t index;     // File offset of the offset index
+    uint64_t size;      // Size of the whole file, to detect truncation
+
+} trseghdr;
+
+static_assert(sizeof(trseghdr) == 32);
+
+// An entry in a segment's offset index
+typedef struct {
+
+    uint64_t offset;    // File offset of the blob
+    uint32_t length;    // Length of the blob in bytes, as stored
+    uint32_t rawlength; // Length once decompressed; larger if compressed
+
+} trsegentry;
+
+// Access pattern hints, passed on to the kernel with madvise()
+typedef enum {
+
+    trsegment_normal,       // No particular pattern
+    trsegment_sequential,   // Blobs are read in order; read ahead aggressively
+    trsegment_random,       // Blobs are read at random; don't read ahead
+    trsegment_willneed,     // The whole segment is needed soon; prefetch it
+
+} trsegaccess;
+
+// An open, mapped segment
+typedef struct {
+
+    const void *base;           // The mapping
+    size_t size;                // Size of the mapping
+    uint32_t count;             // Number of blobs
+    const trsegentry *index;    // The offset index, inside the mapping
+
+} trsegment;
+
+// Maps a segment file and checks its header.
+//
+// Returns trstatus_parse if the file isn't a segment, trstatus_version if
+// it was written in an unsupported format, or trstatus_overrun if the file
+// is truncated.
+//
+trstatus tr_segment_open(trsegment *seg, const char *path, trsegaccess access);
+
+// Unmaps a segment. Pointers obtained from it become invalid.
+void tr_segment_close(trsegment *seg);
+
+// Changes the access pattern hint for an open segment
+trstatus tr_segment_advise(trsegment *seg, trsegaccess access);
+
+// Gets a pointer to a blob, which stays valid until the segment is closed.
+//
+// Returns trstatus_not_found if there's no blob with that index,
+// trstatus_overrun if the index entry points outside the file,
+// trstatus_corrupt if the entry is inconsistent, or trstatus_support if the
+// blob is compressed. Entries are checked here rather than when opening, so
+// that opening never has to touch the whole index.
+//
+trstatus tr_segment_get(const trsegment *seg, uint32_t index, const void **data, uint64_t *length);
+
+// Copies a blob into the given buffer, decompressing it if need be, and
+// sets *length to its length.
+//
+// Returns trstatus_too_small if the buffer can't hold the blob, with
+// *length set to the size needed, or trstatus_corrupt if a compressed blob
+// doesn't decompress to its recorded length. Otherwise fails as for
+// tr_segment_get.
+//
+trstatus tr_segment_read(const trsegment *seg, uint32_t index, void *buffer, uint64_t capacity, uint64_t *length);
+
+// Builds a new segment file
+typedef struct {
+
+    FILE *file;             // The temporary file being written
+    char *path;             // Final path of the segment
+    char *temppath;         // Path of the temporary file
+    uint64_t offset;        // Where the next blob goes
+    trsegentry *index;      // Index entries so far
+    uint32_t count;         // Number of entries in the index
+    uint32_t capacity;      // Capacity of the index array
+    tralloctag tag;         // Tag for the writer's heap allocations
+
+} trsegwriter;
+
+// Starts writing a new segment which will be created at the given path
+trstatus tr_segwriter_create(trsegwriter *writer, const char *path, tralloctag tag);
+
+// Appends a blob to the segment, returning its index in *index. Blobs are
+// limited to 4GB.
+//
+trstatus tr_segwriter_add(trsegwriter *writer, const void *data, uint64_t length, uint32_t *index);
+
+// Appends a blob to the segment compressed, or as it is if it doesn't get
+// any smaller
+//
+trstatus tr_segwriter_add_compressed(trsegwriter *writer, const void *data, uint64_t length, uint32_t *index);
+
+// Writes the offset index and header, syncs the file and moves it into
+// place. The writer is cleaned up whether or not this succeeds.
+//
+trstatus tr_segwriter_finish(trsegwriter *writer);
+
+// Abandons a segment, deleting the temporary file
+void tr_segwriter_abort(trsegwriter *writer);
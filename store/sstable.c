@@ -0,0 +1,541 @@
+//////////////////////////////////////////////////////////////////////////////
+//
+// Terrascale
+// Copyright (c) Dave Kilian & Emily Kilian 2023. All rights reserved.
+//
+//////////////////////////////////////////////////////////////////////////////
+
+#include <pch.h>
+#include <runtime/hash.h>
+#include <store/filter.h>
+#include <store/sstable.h>
+
+// Blobs after the data blocks
+#define tr_sstable_filterblob(nblocks) (nblocks)
+#define tr_sstable_indexblob(nblocks)  ((nblocks) + 1)
+#define tr_sstable_metablob(nblocks)   ((nblocks) + 2)
+
+static inline uint32_t tr_sstable_load32(const void *p)
+{
+    uint32_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+// Gets the key of block i from the index
+static inline const void *tr_sstable_indexkey(const trsstable *table, uint32_t i, unsigned *keylen)
+{
+    uint32_t start = table->index[1 + i];
+    *keylen = table->index[2 + i] - start;
+    return ptr_add(table->index, start);
+}
+
+// Checks the index blob's structure, so that lookups can trust it
+static trstatus tr_sstable_checkindex(const uint32_t *index, uint64_t length, uint32_t nblocks)
+{
+    uint64_t header = 4 + 4 * ((uint64_t)nblocks + 1);
+    if (length < header || index[0] != nblocks) {
+        return trstatus_overrun;
+    }
+
+    uint32_t prev = header;
+    for (uint32_t i = 0; i <= nblocks; ++i) {
+        if (index[1 + i] < prev || index[1 + i] > length) {
+            return trstatus_overrun;
+        }
+        prev = index[1 + i];
+    }
+
+    return trstatus_ok;
+}
+
+// A data block, split into its entries and their offsets
+typedef struct {
+
+    const uint8_t *data;        // The entries
+    uint32_t datalen;           // Bytes of entries (and padding)
+    const uint8_t *offsets;     // The entries' offsets
+    uint32_t count;             // Number of entries
+
+} trsstblock;
+
+static trstatus tr_sstable_block(const trsstable *table, uint32_t index, trsstblock *block)
+{
+    const void *data;
+    uint64_t length;
+    trstatus s = tr_segment_get(&table->seg, index, &data, &length);
+    if (tr_failed(s)) {
+        return s;
+    }
+
+    if (length < 4) {
+        return trstatus_overrun;
+    }
+
+    uint32_t count = tr_sstable_load32(ptr_add(data, length - 4));
+    if ((length - 4) / 4 < count) {
+        return trstatus_overrun;
+    }
+
+    block->data = data;
+    block->datalen = length - 4 - 4 * (uint64_t)count;
+    block->offsets = block->data + block->datalen;
+    block->count = count;
+    return trstatus_ok;
+}
+
+// Decodes entry i of a block
+static trstatus tr_sstable_entry(const uint8_t *data, uint32_t datalen, const uint8_t *offsets,
+        uint32_t i, trkvitem *item)
+{
+    uint32_t offset = tr_sstable_load32(offsets + 4 * i);
+    if (offset > datalen || datalen - offset < sizeof(trsstentry)) {
+        return trstatus_overrun;
+    }
+
+    trsstentry entry;
+    memcpy(&entry, data + offset, sizeof(entry));
+
+    uint64_t vallen = entry.vallen == tr_sstable_tombstone ? 0 : entry.vallen;
+    if ((uint64_t)entry.keylen + vallen > datalen - offset - sizeof(trsstentry)) {
+        return trstatus_overrun;
+    }
+
+    item->key = data + offset + sizeof(trsstentry);
+    item->keylen = entry.keylen;
+    item->value = data + offset + sizeof(trsstentry) + entry.keylen;
+    item->vallen = vallen;
+    item->seq = entry.seq;
+    item->tombstone = entry.vallen == tr_sstable_tombstone;
+    return trstatus_ok;
+}
+
+trstatus tr_sstable_open(trsstable *table, const char *path, uint32_t number, tralloctag tag)
+{
+    trstatus s = tr_segment_open(&table->seg, path, trsegment_random);
+    if (tr_failed(s)) {
+        return s;
+    }
+
+    const void *data;
+    uint64_t length;
+    trsstmeta meta;
+
+    if (table->seg.count < 3 ||
+        tr_failed(tr_segment_get(&table->seg, table->seg.count - 1, &data, &length)) ||
+        length != sizeof(meta)) {
+        tr_segment_close(&table->seg);
+        return trstatus_parse;
+    }
+
+    memcpy(&meta, data, sizeof(meta));
+    if (meta.magic != tr_sstable_magic || meta.nblocks != table->seg.count - 3) {
+        tr_segment_close(&table->seg);
+        return trstatus_parse;
+    }
+
+    table->number = number;
+    table->nblocks = meta.nblocks;
+    table->nentries = meta.nentries;
+    table->maxseq = meta.maxseq;
+    table->size = table->seg.size;
+    table->smallest = NULL;
+    table->smallestlen = 0;
+    table->largest = NULL;
+    table->largestlen = 0;
+    table->filter = NULL;
+
+    // The mapping is read at random, so a filter left in it could be paged
+    // out and read back one page per lookup
+    s = tr_segment_get(&table->seg, tr_sstable_filterblob(meta.nblocks), &data, &table->filtersize);
+    if (tr_ok(s) && table->filtersize > UINT32_MAX) {
+        s = trstatus_too_large;
+    }
+    if (tr_ok(s) && table->filtersize > 0) {
+        table->filter = tr_alloc_aligned(table->filtersize, tr_filter_blocksize, tag);
+        if (table->filter != NULL) {
+            memcpy(table->filter, data, table->filtersize);
+        } else {
+            s = trstatus_no_mem;
+        }
+    }
+    if (tr_ok(s)) {
+        s = tr_segment_get(&table->seg, tr_sstable_indexblob(meta.nblocks), &data, &length);
+    }
+    if (tr_ok(s)) {
+        table->index = data;
+        s = tr_sstable_checkindex(table->index, length, meta.nblocks);
+    }
+
+    // The key range comes from the first entry and the last index key
+    if (tr_ok(s) && meta.nblocks > 0) {
+        trsstblock block;
+        trkvitem item;
+        s = tr_sstable_block(table, 0, &block);
+        if (tr_ok(s)) {
+            s = block.count > 0 ?
+                tr_sstable_entry(block.data, block.datalen, block.offsets, 0, &item) :
+                trstatus_overrun;
+        }
+        if (tr_ok(s)) {
+            table->smallest = item.key;
+            table->smallestlen = item.keylen;
+            table->largest = tr_sstable_indexkey(table, meta.nblocks - 1, &table->largestlen);
+        }
+    }
+
+    if (tr_failed(s)) {
+        tr_sstable_close(table);
+        return s;
+    }
+
+    return trstatus_ok;
+}
+
+void tr_sstable_close(trsstable *table)
+{
+    if (table->filter != NULL) {
+        tr_free(table->filter);
+    }
+    tr_segment_close(&table->seg);
+}
+
+bool tr_sstable_covers(const trsstable *table, const void *key, unsigned keylen)
+{
+    return table->nblocks > 0 &&
+        tr_kv_compare(key, keylen, table->smallest, table->smallestlen) >= 0 &&
+        tr_kv_compare(key, keylen, table->largest, table->largestlen) <= 0;
+}
+
+trstatus tr_sstable_get(const trsstable *table, const void *key, unsigned keylen,
+        uint64_t hash, trkvitem *item)
+{
+    if (!tr_sstable_covers(table, key, keylen) ||
+        !tr_filter_check(table->filter, table->filtersize, hash)) {
+        return trstatus_not_found;
+    }
+
+    // Find the first block whose last key isn't before the key
+    uint32_t lo = 0, hi = table->nblocks;
+    while (lo < hi) {
+        uint32_t mid = lo + (hi - lo) / 2;
+        unsigned midlen;
+        const void *midkey = tr_sstable_indexkey(table, mid, &midlen);
+        if (tr_kv_compare(midkey, midlen, key, keylen) < 0) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+
+    if (lo == table->nblocks) {
+        return trstatus_not_found;
+    }
+
+    trsstblock block;
+    trstatus s = tr_sstable_block(table, lo, &block);
+    if (tr_failed(s)) {
+        return s;
+    }
+
+    // Then the first entry in the block which isn't before the key
+    lo = 0;
+    hi = block.count;
+    while (lo < hi) {
+        uint32_t mid = lo + (hi - lo) / 2;
+        s = tr_sstable_entry(block.data, block.datalen, block.offsets, mid, item);
+        if (tr_failed(s)) {
+            return s;
+        }
+        if (tr_kv_compare(item->key, item->keylen, key, keylen) < 0) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+
+    if (lo == block.count) {
+        return trstatus_not_found;
+    }
+
+    s = tr_sstable_entry(block.data, block.datalen, block.offsets, lo, item);
+    if (tr_failed(s)) {
+        return s;
+    }
+
+    return tr_kv_compare(item->key, item->keylen, key, keylen) == 0 ? trstatus_ok : trstatus_not_found;
+}
+
+//
+// Iterating
+//
+
+void tr_sstiter_initialize(trsstiter *iter, const trsstable *table)
+{
+    iter->table = table;
+    iter->block = 0;
+    iter->pos = 0;
+    iter->count = 0;
+    iter->data = NULL;
+    iter->datalen = 0;
+    iter->offsets = NULL;
+}
+
+trstatus tr_sstiter_next(trsstiter *iter, trkvitem *item)
+{
+    while (iter->pos == iter->count) {
+        if (iter->block == iter->table->nblocks) {
+            return trstatus_not_found;
+        }
+
+        trsstblock block;
+        trstatus s = tr_sstable_block(iter->table, iter->block, &block);
+        if (tr_failed(s)) {
+            return s;
+        }
+
+        iter->block++;
+        iter->pos = 0;
+        iter->count = block.count;
+        iter->data = block.data;
+        iter->datalen = block.datalen;
+        iter->offsets = block.offsets;
+    }
+
+    return tr_sstable_entry(iter->data, iter->datalen, iter->offsets, iter->pos++, item);
+}
+
+//
+// Building
+//
+
+// Makes sure a growable buffer has room for `needed` bytes
+static trstatus tr_sstbuilder_reserve(trsstbuilder *builder, void **buffer, size_t *capacity, size_t needed)
+{
+    if (needed <= *capacity) {
+        return trstatus_ok;
+    }
+
+    size_t grown = max(*capacity * 2, (size_t)4096);
+    grown = max(grown, needed);
+    if (grown > UINT32_MAX) {
+        return trstatus_too_large;
+    }
+
+    void *buf = tr_alloc(grown, builder->tag);
+    if (buf == NULL) {
+        return trstatus_no_mem;
+    }
+
+    if (*buffer != NULL) {
+        memcpy(buf, *buffer, *capacity);
+        tr_free(*buffer);
+    }
+
+    *buffer = buf;
+    *capacity = grown;
+    return trstatus_ok;
+}
+
+static void tr_sstbuilder_free(trsstbuilder *builder)
+{
+    if (builder->block != NULL) tr_free(builder->block);
+    if (builder->offsets != NULL) tr_free(builder->offsets);
+    if (builder->index != NULL) tr_free(builder->index);
+    if (builder->indexoffs != NULL) tr_free(builder->indexoffs);
+    if (builder->hashes != NULL) tr_free(builder->hashes);
+}
+
+trstatus tr_sstbuilder_create(trsstbuilder *builder, const char *path,
+        unsigned blocksize, unsigned bitsperkey, tralloctag tag)
+{
+    memset(builder, 0, sizeof(*builder));
+    builder->blocksize = blocksize;
+    builder->bitsperkey = bitsperkey;
+    builder->tag = tag;
+
+    return tr_segwriter_create(&builder->writer, path, tag);
+}
+
+// Writes out the block being built and notes its last key in the index
+static trstatus tr_sstbuilder_endblock(trsstbuilder *builder)
+{
+    size_t padded = (builder->blocklen + 3) & ~(size_t)3;
+    size_t total = padded + 4 * (size_t)builder->nblockentries + 4;
+
+    trstatus s = tr_sstbuilder_reserve(builder, (void **)&builder->block, &builder->blockcap, total);
+    if (tr_failed(s)) {
+        return s;
+    }
+
+    // Remember the last key before the block's tail overwrites anything
+    uint32_t lastoff = builder->offsets[builder->nblockentries - 1];
+    trsstentry last;
+    memcpy(&last, builder->block + lastoff, sizeof(last));
+
+    size_t indexneeded = builder->indexlen + last.keylen;
+    s = tr_sstbuilder_reserve(builder, (void **)&builder->index, &builder->indexcap, indexneeded);
+    if (tr_ok(s)) {
+        s = tr_sstbuilder_reserve(builder, (void **)&builder->indexoffs, &builder->indexoffcap,
+                4 * ((size_t)builder->nblocks + 1));
+    }
+    if (tr_failed(s)) {
+        return s;
+    }
+
+    memcpy(builder->index + builder->indexlen, builder->block + lastoff + sizeof(trsstentry), last.keylen);
+    builder->indexoffs[builder->nblocks] = builder->indexlen;
+    builder->indexlen += last.keylen;
+
+    memset(builder->block + builder->blocklen, 0, padded - builder->blocklen);
+    memcpy(builder->block + padded, builder->offsets, 4 * (size_t)builder->nblockentries);
+    memcpy(builder->block + padded + 4 * (size_t)builder->nblockentries, &builder->nblockentries, 4);
+
+    uint32_t index;
+    s = tr_segwriter_add(&builder->writer, builder->block, total, &index);
+    if (tr_failed(s)) {
+        return s;
+    }
+
+    builder->nblocks++;
+    builder->size += total;
+    builder->blocklen = 0;
+    builder->nblockentries = 0;
+    return trstatus_ok;
+}
+
+trstatus tr_sstbuilder_add(trsstbuilder *builder, const trkvitem *item)
+{
+    unsigned vallen = item->tombstone ? 0 : item->vallen;
+    size_t bytes = sizeof(trsstentry) + item->keylen + vallen;
+
+    trstatus s = tr_sstbuilder_reserve(builder, (void **)&builder->block, &builder->blockcap,
+            builder->blocklen + bytes);
+    if (tr_ok(s)) {
+        s = tr_sstbuilder_reserve(builder, (void **)&builder->offsets, &builder->offsetcap,
+                4 * ((size_t)builder->nblockentries + 1));
+    }
+    if (tr_ok(s)) {
+        s = tr_sstbuilder_reserve(builder, (void **)&builder->hashes, &builder->hashcap,
+                8 * (builder->nentries + 1));
+    }
+    if (tr_failed(s)) {
+        return s;
+    }
+
+    trsstentry entry = {
+        .keylen = item->keylen,
+        .vallen = item->tombstone ? tr_sstable_tombstone : item->vallen,
+        .seq = item->seq,
+    };
+
+    uint8_t *p = builder->block + builder->blocklen;
+    memcpy(p, &entry, sizeof(entry));
+    memcpy(p + sizeof(entry), item->key, item->keylen);
+    if (vallen > 0) {
+        memcpy(p + sizeof(entry) + item->keylen, item->value, vallen);
+    }
+
+    builder->offsets[builder->nblockentries++] = builder->blocklen;
+    builder->blocklen += bytes;
+    builder->hashes[builder->nentries++] = tr_hash_bytes(item->key, item->keylen, 0);
+    builder->maxseq = max(builder->maxseq, item->seq);
+
+    if (builder->blocklen >= builder->blocksize) {
+        return tr_sstbuilder_endblock(builder);
+    }
+
+    return trstatus_ok;
+}
+
+uint64_t tr_sstbuilder_size(const trsstbuilder *builder)
+{
+    return builder->size + builder->blocklen + builder->indexlen +
+        builder->nentries * builder->bitsperkey / 8;
+}
+
+// Writes the filter, index and meta blobs
+static trstatus tr_sstbuilder_tail(trsstbuilder *builder)
+{
+    uint32_t index;
+
+    size_t filtersize = tr_filter_size(builder->nentries, builder->bitsperkey, trfilter_blocked);
+    if (filtersize > UINT32_MAX) {
+        return trstatus_too_large;
+    }
+
+    void *filter = tr_alloc(filtersize, builder->tag);
+    if (filter == NULL) {
+        return trstatus_no_mem;
+    }
+
+    tr_filter_build(filter, filtersize, builder->bitsperkey, trfilter_blocked,
+        builder->hashes, builder->nentries);
+    trstatus s = tr_segwriter_add(&builder->writer, filter, filtersize, &index);
+    tr_free(filter);
+    if (tr_failed(s)) {
+        return s;
+    }
+
+    // Rebase the key offsets onto the start of the blob
+    size_t header = 4 + 4 * ((size_t)builder->nblocks + 1);
+    size_t indexsize = header + builder->indexlen;
+    if (indexsize > UINT32_MAX) {
+        return trstatus_too_large;
+    }
+
+    uint32_t *blob = tr_alloc(indexsize, builder->tag);
+    if (blob == NULL) {
+        return trstatus_no_mem;
+    }
+
+    blob[0] = builder->nblocks;
+    for (unsigned i = 0; i < builder->nblocks; ++i) {
+        blob[1 + i] = header + builder->indexoffs[i];
+    }
+    blob[1 + builder->nblocks] = indexsize;
+    if (builder->indexlen > 0) {
+        memcpy(ptr_add(blob, header), builder->index, builder->indexlen);
+    }
+
+    s = tr_segwriter_add(&builder->writer, blob, indexsize, &index);
+    tr_free(blob);
+    if (tr_failed(s)) {
+        return s;
+    }
+
+    trsstmeta meta = {
+        .magic = tr_sstable_magic,
+        .nblocks = builder->nblocks,
+        .nentries = builder->nentries,
+        .maxseq = builder->maxseq,
+    };
+
+    return tr_segwriter_add(&builder->writer, &meta, sizeof(meta), &index);
+}
+
+trstatus tr_sstbuilder_finish(trsstbuilder *builder)
+{
+    trstatus s = trstatus_ok;
+    if (builder->nblockentries > 0) {
+        s = tr_sstbuilder_endblock(builder);
+    }
+    if (tr_ok(s)) {
+        s = tr_sstbuilder_tail(builder);
+    }
+
+    tr_sstbuilder_free(builder);
+
+    if (tr_failed(s)) {
+        tr_segwriter_abort(&builder->writer);
+        return s;
+    }
+
+    return tr_segwriter_finish(&builder->writer);
+}
+
+void tr_sstbuilder_abort(trsstbuilder *builder)
+{
+    tr_sstbuilder_free(builder);
+    tr_segwriter_abort(&builder->writer);
+}
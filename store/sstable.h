@@ -0,0 +1,166 @@
+//////////////////////////////////////////////////////////////////////////////
+//
+// Terrascale
+// Copyright (c) Dave Kilian & Emily Kilian 2023. All rights reserved.
+//
+// sstable.h - immutable sorted tables of key/value entries
+//
+// An SSTable holds a sorted run of entries (see kv.h), at most one per key.
+// SSTables are written once, by flushing a memtable or by compaction, and
+// never changed, so they're stored as segments (see segment.h) and read
+// straight out of the mapping. A table's blobs are:
+//
+//     data blocks         entries, split into blocks of about blocksize
+//     filter              a blocked Bloom filter over the table's keys
+//     index               the last key of each data block
+//     meta                a trsstmeta, describing the table
+//
+// A data block is the block's entries, each a trsstentry followed by the
+// key and value, and then the offset of each entry within the block (a
+// uint32_t each) and the number of entries (a uint32_t). The index is the
+// number of blocks, the offset of each block's key within the index, one
+// more offset for the end of the last key (all uint32_t), and then the keys.
+//
+// A point lookup checks the filter, binary searches the index for the one
+// block which could hold the key, and binary searches that block's entries.
+// Opening a table copies its filter to the heap, so that checking it never
+// waits for the file, and most lookups of keys the table doesn't hold do
+// no I/O at all.
+//
+//////////////////////////////////////////////////////////////////////////////
+
+#pragma once
+
+#include <store/kv.h>
+#include <store/segment.h>
+
+// Identifies a table's meta blob ('TRSS')
+#define tr_sstable_magic 0x53535254
+
+// Header of each entry in a data block
+typedef struct {
+
+    uint32_t keylen;    // Length of the key
+    uint32_t vallen;    // Length of the value, or tr_sstable_tombstone
+    trseqno seq;        // Sequence number of the write
+
+} trsstentry;
+
+static_assert(sizeof(trsstentry) == 16);
+
+// Value length which marks a tombstone
+#define tr_sstable_tombstone UINT32_MAX
+
+// Describes a whole table; the last blob
+typedef struct {
+
+    uint32_t magic;     // tr_sstable_magic
+    uint32_t nblocks;   // Number of data blocks
+    uint64_t nentries;  // Number of entries
+    trseqno maxseq;     // Highest sequence number of any entry
+
+} trsstmeta;
+
+// An open SSTable
+typedef struct {
+
+    trsegment seg;          // The mapped file
+    uint32_t number;        // Caller's identifier for the table
+    uint32_t nblocks;       // Number of data blocks
+    uint64_t nentries;      // Number of entries
+    trseqno maxseq;         // Highest sequence number of any entry
+    uint64_t size;          // Size of the file
+    void *filter;           // Copy of the filter blob, aligned to cache lines
+    uint64_t filtersize;    // Size of the filter
+    const uint32_t *index;  // The index blob
+    const void *smallest;   // First key in the table (NULL if empty)
+    unsigned smallestlen;
+    const void *largest;    // Last key in the table (NULL if empty)
+    unsigned largestlen;
+
+} trsstable;
+
+// Opens an SSTable, allocating its filter's copy with the given tag.
+// Returns trstatus_parse if the file isn't one, or trstatus_overrun if its
+// structure points outside the file.
+//
+trstatus tr_sstable_open(trsstable *table, const char *path, uint32_t number, tralloctag tag);
+
+// Closes an SSTable and frees its filter
+void tr_sstable_close(trsstable *table);
+
+// Checks whether a key is within the table's key range
+bool tr_sstable_covers(const trsstable *table, const void *key, unsigned keylen);
+
+// Finds a key's entry, including a tombstone, given its hash from
+// tr_hash_bytes with seed 0. Returns trstatus_not_found if the table has no
+// entry for the key. The item points into the table's mapping.
+//
+trstatus tr_sstable_get(const trsstable *table, const void *key, unsigned keylen,
+        uint64_t hash, trkvitem *item);
+
+// Iterates over all of a table's entries in order
+typedef struct {
+
+    const trsstable *table;     // The table being iterated
+    uint32_t block;             // Current data block
+    uint32_t pos;               // Next entry in the block
+    uint32_t count;             // Number of entries in the block
+    const uint8_t *data;        // The block's entries
+    uint32_t datalen;           // Length of the block before its offsets
+    const uint8_t *offsets;     // The block's entry offsets
+
+} trsstiter;
+
+// Starts iterating over a table
+void tr_sstiter_initialize(trsstiter *iter, const trsstable *table);
+
+// Gets the next entry, or returns trstatus_not_found at the end. Fails with
+// trstatus_overrun if a block is malformed.
+//
+trstatus tr_sstiter_next(trsstiter *iter, trkvitem *item);
+
+// Builds a new SSTable from entries added in order
+typedef struct {
+
+    trsegwriter writer;     // Writes the table's segment
+    unsigned blocksize;     // Target size of each data block
+    unsigned bitsperkey;    // Filter size per key
+    uint8_t *block;         // The data block being built
+    size_t blocklen;        // Bytes in block
+    size_t blockcap;        // Capacity of block, in bytes
+    uint32_t *offsets;      // Entry offsets within the block being built
+    unsigned nblockentries; // Entries in the block being built
+    size_t offsetcap;       // Capacity of offsets, in bytes
+    uint8_t *index;         // Last key of each finished block
+    size_t indexlen;        // Bytes in index
+    size_t indexcap;        // Capacity of index, in bytes
+    uint32_t *indexoffs;    // Offset of each key in index
+    unsigned nblocks;       // Number of finished blocks
+    size_t indexoffcap;     // Capacity of indexoffs, in bytes
+    uint64_t *hashes;       // Hash of every key added
+    uint64_t nentries;      // Number of entries added
+    size_t hashcap;         // Capacity of hashes, in bytes
+    trseqno maxseq;         // Highest sequence number added
+    uint64_t size;          // Bytes of finished blocks
+    tralloctag tag;         // Tag for heap allocations
+
+} trsstbuilder;
+
+// Starts building a table which will be created at the given path
+trstatus tr_sstbuilder_create(trsstbuilder *builder, const char *path,
+        unsigned blocksize, unsigned bitsperkey, tralloctag tag);
+
+// Adds an entry, whose key must sort after every key added so far
+trstatus tr_sstbuilder_add(trsstbuilder *builder, const trkvitem *item);
+
+// Gets the approximate size the table would be if finished now
+uint64_t tr_sstbuilder_size(const trsstbuilder *builder);
+
+// Writes the table's filter, index and meta, and moves it into place. The
+// builder is cleaned up whether or not this succeeds.
+//
+trstatus tr_sstbuilder_finish(trsstbuilder *builder);
+
+// Abandons a table, deleting the partial file
+void tr_sstbuilder_abort(trsstbuilder *builder);
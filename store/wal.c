@@ -0,0 +1,747 @@
+//////////////////////////////////////////////////////////////////////////////
+//
+// Terrascale
+// Copyright (c) Dave Kilian & Emily Kilian 2023. All rights reserved.
+//
+//////////////////////////////////////////////////////////////////////////////
+
+#include <pch.h>
+#include <store/wal.h>
+#include <runtime/crc32c.h>
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sched.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+// Number of times a committer spins waiting to publish before yielding
+#define tr_wal_spins 256
+
+static void *tr_wal_flusher(void *arg);
+
+void tr_wal_defaults(trwalconfig *config, const char *dir)
+{
+    config->dir = dir;
+    config->segsize = 16 << 20;
+    config->buffersize = 4 << 20;
+    config->prealloc = 2;
+    config->interval = tr_ms(10);
+    config->tag = 'wal ';
+}
+
+// Computes a record's checksum. The payload is the `length` bytes after the
+// header, or nothing for a skip record, whose gap holds no data.
+//
+static uint32_t tr_wal_checksum(const trwalrecord *hdr, const void *data)
+{
+    trwalrecord copy = *hdr;
+    copy.crc = 0;
+
+    uint32_t crc = tr_crc32c(0, &copy, sizeof(copy));
+    if (hdr->flags == tr_walrecord_data) {
+        crc = tr_crc32c(crc, data, hdr->length);
+    }
+    return crc;
+}
+
+static void tr_wal_segname(char *name, size_t size, uint32_t seg)
+{
+    snprintf(name, size, "wal-%08x", seg);
+}
+
+// Writes exactly `bytes` bytes at the given offset, or fails
+static trstatus tr_wal_pwrite(int fd, const void *buffer, size_t bytes, off_t offset)
+{
+    while (bytes > 0) {
+        ssize_t nwrite = pwrite(fd, buffer, bytes, offset);
+        if (nwrite < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return tr_status_from_errno();
+        }
+
+        buffer = ptr_add(buffer, nwrite);
+        bytes -= nwrite;
+        offset += nwrite;
+    }
+
+    return trstatus_ok;
+}
+
+// Overwrites the bytes [from, to) of a file with zeros
+static trstatus tr_wal_zero(int fd, unsigned from, unsigned to)
+{
+    static const char zeros[64 * 1024];
+    trstatus s = trstatus_ok;
+    for (unsigned off = from; off < to && tr_ok(s); off += sizeof(zeros)) {
+        s = tr_wal_pwrite(fd, zeros, min(sizeof(zeros), to - off), off);
+    }
+
+    return s;
+}
+
+// Opens a segment file, creating and zero-filling it if it doesn't exist
+static trstatus tr_wal_segopen(trwal *wal, uint32_t seg, int *fd)
+{
+    char name[32];
+    tr_wal_segname(name, sizeof(name), seg);
+
+    int segfd = openat(wal->dirfd, name, O_RDWR | O_CLOEXEC);
+    if (segfd >= 0) {
+        *fd = segfd;
+        return trstatus_ok;
+    }
+    if (errno != ENOENT) {
+        return tr_status_from_errno();
+    }
+
+    // Write zeros rather than fallocate: later syncs then only have to
+    // flush data, not convert unwritten extents
+    segfd = openat(wal->dirfd, name, O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+    if (segfd < 0) {
+        return tr_status_from_errno();
+    }
+
+    trstatus s = tr_wal_zero(segfd, 0, wal->config.segsize);
+    if (tr_ok(s) && (fsync(segfd) < 0 || fsync(wal->dirfd) < 0)) {
+        s = tr_status_from_errno();
+    }
+
+    if (tr_failed(s)) {
+        close(segfd);
+        unlinkat(wal->dirfd, name, 0);
+        return s;
+    }
+
+    wal->stat.nsegments += 1;
+    *fd = segfd;
+    return trstatus_ok;
+}
+
+// Finds the range of segment files in the log directory
+static trstatus tr_wal_scan(trwal *wal, bool *found)
+{
+    int fd = dup(wal->dirfd);
+    DIR *dir = fd < 0 ? NULL : fdopendir(fd);
+    if (dir == NULL) {
+        trstatus s = tr_status_from_errno();
+        if (fd >= 0) {
+            close(fd);
+        }
+        return s;
+    }
+
+    *found = false;
+    struct dirent *entry;
+    while ((entry = readdir(dir)) != NULL) {
+        unsigned seg;
+        char extra;
+        if (sscanf(entry->d_name, "wal-%8x%c", &seg, &extra) != 1) {
+            continue;
+        }
+
+        if (!*found) {
+            wal->firstseg = wal->lastseg = seg;
+            *found = true;
+        } else {
+            wal->firstseg = min(wal->firstseg, seg);
+            wal->lastseg = max(wal->lastseg, seg);
+        }
+    }
+
+    closedir(dir);
+    return trstatus_ok;
+}
+
+// Reads the log from its first segment, passing each record to replay,
+// and returns the LSN at which the log ends
+//
+static trstatus tr_wal_replay(trwal *wal, trwalreplayfn *replay, void *context, trlsn *end)
+{
+    unsigned segsize = wal->config.segsize;
+    char *buffer = tr_alloc(segsize, wal->config.tag);
+    if (buffer == NULL) {
+        return trstatus_no_mem;
+    }
+
+    trstatus s = trstatus_ok;
+    uint32_t seg = wal->firstseg;
+    unsigned off = 0;
+
+    for (; seg <= wal->lastseg; ++seg) {
+        int fd;
+        s = tr_wal_segopen(wal, seg, &fd);
+        if (tr_failed(s)) {
+            break;
+        }
+
+        memset(buffer, 0, segsize);
+        ssize_t nread = pread(fd, buffer, segsize, 0);
+        s = nread < 0 ? tr_status_from_errno() : trstatus_ok;
+        close(fd);
+        if (tr_failed(s)) {
+            break;
+        }
+
+        trlsn base = (trlsn)seg * segsize;
+        for (off = 0; off + sizeof(trwalrecord) <= segsize;) {
+            trwalrecord *hdr = (trwalrecord *)(buffer + off);
+            if (hdr->lsn != base + off ||
+                (hdr->flags != tr_walrecord_data && hdr->flags != tr_walrecord_skip) ||
+                hdr->length > segsize - off - sizeof(trwalrecord) ||
+                hdr->crc != tr_wal_checksum(hdr, hdr + 1)) {
+                break;
+            }
+
+            if (hdr->flags == tr_walrecord_data && replay != NULL) {
+                s = replay(context, hdr->lsn, hdr + 1, hdr->length);
+                if (tr_failed(s)) {
+                    break;
+                }
+            }
+
+            off += tr_wal_recordsize(hdr->length);
+        }
+
+        // A record which isn't where it should be marks the end of the log
+        if (tr_failed(s) || off + sizeof(trwalrecord) <= segsize) {
+            break;
+        }
+    }
+
+    if (seg > wal->lastseg) {
+        off = 0;
+    }
+
+    *end = (trlsn)seg * segsize + off;
+    tr_free(buffer);
+    return s;
+}
+
+// Erases everything after the end of the log: the rest of the segment the
+// log ends in, and any later segments. Replay stopped at the first record
+// that was missing or damaged, but records past it may still be intact; if
+// they were left, new records could end right where one of them starts,
+// and a crash before the next write would bring it back to life.
+//
+static trstatus tr_wal_erase(trwal *wal, trlsn end)
+{
+    unsigned segsize = wal->config.segsize;
+    uint32_t seg = end / segsize;
+
+    if (seg <= wal->lastseg && end % segsize != 0) {
+        int fd;
+        trstatus s = tr_wal_segopen(wal, seg, &fd);
+        if (tr_failed(s)) {
+            return s;
+        }
+
+        s = tr_wal_zero(fd, end % segsize, segsize);
+        if (tr_ok(s) && fdatasync(fd) < 0) {
+            s = tr_status_from_errno();
+        }
+        close(fd);
+        if (tr_failed(s)) {
+            return s;
+        }
+
+        seg += 1;
+    }
+
+    // Later segments are simply removed; the flusher creates fresh ones
+    if (seg <= wal->lastseg) {
+        for (uint32_t n = seg; n <= wal->lastseg; ++n) {
+            char name[32];
+            tr_wal_segname(name, sizeof(name), n);
+            if (unlinkat(wal->dirfd, name, 0) < 0 && errno != ENOENT) {
+                return tr_status_from_errno();
+            }
+        }
+
+        wal->lastseg = max(seg, 1u) - 1;
+        if (fsync(wal->dirfd) < 0) {
+            return tr_status_from_errno();
+        }
+    }
+
+    return trstatus_ok;
+}
+
+trstatus tr_wal_open(trwal *wal, const trwalconfig *config, trwalreplayfn *replay, void *context)
+{
+    if (config->segsize < 4096 || config->segsize % 8 != 0 ||
+        config->buffersize < 4096 || (config->buffersize & (config->buffersize - 1)) != 0) {
+        return trstatus_argument;
+    }
+
+    wal->config = *config;
+    memset(&wal->stat, 0, sizeof(wal->stat));
+
+    if (mkdir(config->dir, 0755) < 0 && errno != EEXIST) {
+        return tr_status_from_errno();
+    }
+
+    wal->dirfd = open(config->dir, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (wal->dirfd < 0) {
+        return tr_status_from_errno();
+    }
+
+    bool found;
+    trstatus s = tr_wal_scan(wal, &found);
+    if (tr_ok(s) && !found) {
+        wal->firstseg = wal->lastseg = 0;
+    }
+
+    trlsn end = 0;
+    if (tr_ok(s)) {
+        s = tr_wal_replay(wal, replay, context, &end);
+    }
+    if (tr_ok(s)) {
+        s = tr_wal_erase(wal, end);
+    }
+
+    wal->ring = tr_ok(s) ? tr_alloc_aligned(config->buffersize, tr_cacheline, config->tag) : NULL;
+    if (tr_ok(s) && wal->ring == NULL) {
+        s = trstatus_no_mem;
+    }
+
+    if (tr_failed(s)) {
+        close(wal->dirfd);
+        return s;
+    }
+
+    wal->start = end;
+    atomic_init(&wal->reserved, end);
+    atomic_init(&wal->published, end);
+    atomic_init(&wal->durable, end);
+    atomic_init(&wal->nrecords, 0);
+    atomic_init(&wal->error, trstatus_ok);
+    atomic_init(&wal->waiters, NULL);
+    atomic_init(&wal->sleeping, false);
+    atomic_init(&wal->nthreads, 0);
+
+    wal->curseg = end / config->segsize;
+    wal->curfd = -1;
+    wal->lastseg = max(wal->lastseg, wal->curseg);
+    wal->stopping = false;
+
+    pthread_condattr_t attr;
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&wal->wake, &attr);
+    pthread_condattr_destroy(&attr);
+    pthread_cond_init(&wal->synced, NULL);
+    pthread_mutex_init(&wal->lock, NULL);
+
+    int err = pthread_create(&wal->flusher, NULL, &tr_wal_flusher, wal);
+    if (err != 0) {
+        pthread_mutex_destroy(&wal->lock);
+        pthread_cond_destroy(&wal->synced);
+        pthread_cond_destroy(&wal->wake);
+        tr_free(wal->ring);
+        close(wal->dirfd);
+        return tr_status_from_errno_value(err);
+    }
+
+    return trstatus_ok;
+}
+
+void tr_wal_close(trwal *wal)
+{
+    pthread_mutex_lock(&wal->lock);
+    wal->stopping = true;
+    pthread_cond_signal(&wal->wake);
+    pthread_mutex_unlock(&wal->lock);
+
+    pthread_join(wal->flusher, NULL);
+
+    if (wal->curfd >= 0) {
+        close(wal->curfd);
+    }
+
+    pthread_mutex_destroy(&wal->lock);
+    pthread_cond_destroy(&wal->synced);
+    pthread_cond_destroy(&wal->wake);
+    tr_free(wal->ring);
+    close(wal->dirfd);
+}
+
+// Copies bytes into the ring at the position for the given LSN, wrapping
+// around the end of the ring as necessary
+//
+static void tr_wal_ring_copy(trwal *wal, trlsn lsn, const void *data, unsigned bytes)
+{
+    unsigned mask = wal->config.buffersize - 1;
+    unsigned pos = lsn & mask;
+    unsigned first = min(bytes, wal->config.buffersize - pos);
+
+    memcpy(wal->ring + pos, data, first);
+    memcpy(wal->ring, ptr_add(data, first), bytes - first);
+}
+
+// Wakes the flusher if it's sleeping. The caller must already have made
+// whatever the flusher needs to see visible.
+//
+static void tr_wal_kick(trwal *wal)
+{
+    atomic_thread_fence(memory_order_seq_cst);
+    if (atomic_load_explicit(&wal->sleeping, memory_order_relaxed)) {
+        pthread_mutex_lock(&wal->lock);
+        pthread_cond_signal(&wal->wake);
+        pthread_mutex_unlock(&wal->lock);
+    }
+}
+
+trstatus tr_wal_append(trwal *wal, const void *data, unsigned length, trlsn *end)
+{
+    unsigned segsize = wal->config.segsize;
+    unsigned size = tr_wal_recordsize(length);
+    if (length > segsize || size > segsize || size > wal->config.buffersize / 2) {
+        return trstatus_too_large;
+    }
+
+    // Reserve space, starting a new segment if the record doesn't fit in
+    // this one. The reservation may not run more than a ring's length ahead
+    // of the durable LSN, or it would overwrite records not yet written.
+    trlsn start = atomic_load_explicit(&wal->reserved, memory_order_relaxed);
+    trlsn recstart, recend;
+    for (;;) {
+        unsigned off = start % segsize;
+        recstart = off + size > segsize ? start + (segsize - off) : start;
+        recend = recstart + size;
+
+        if (recend - atomic_load_explicit(&wal->durable, memory_order_acquire) >
+                wal->config.buffersize) {
+
+            trstatus error = atomic_load(&wal->error);
+            if (tr_failed(error)) {
+                return error;
+            }
+
+            tr_wal_kick(wal);
+            sched_yield();
+            start = atomic_load_explicit(&wal->reserved, memory_order_relaxed);
+            continue;
+        }
+
+        if (atomic_compare_exchange_weak_explicit(&wal->reserved, &start, recend,
+                memory_order_relaxed, memory_order_relaxed)) {
+            break;
+        }
+    }
+
+    // Mark any gap at the end of the previous segment, if there's room to
+    if (recstart - start >= sizeof(trwalrecord)) {
+        trwalrecord skip = {
+            .lsn = start,
+            .length = (uint32_t)(recstart - start - sizeof(trwalrecord)),
+            .flags = tr_walrecord_skip,
+        };
+        skip.crc = tr_wal_checksum(&skip, NULL);
+        tr_wal_ring_copy(wal, start, &skip, sizeof(skip));
+    }
+
+    static const char zeros[8];
+    trwalrecord hdr = { .lsn = recstart, .length = length, .flags = tr_walrecord_data };
+    hdr.crc = tr_wal_checksum(&hdr, data);
+    tr_wal_ring_copy(wal, recstart, &hdr, sizeof(hdr));
+    tr_wal_ring_copy(wal, recstart + sizeof(hdr), data, length);
+    tr_wal_ring_copy(wal, recstart + sizeof(hdr) + length, zeros,
+            size - sizeof(hdr) - length);
+
+    // Publish in LSN order, once every earlier reservation is published
+    int spins = 0;
+    while (atomic_load_explicit(&wal->published, memory_order_acquire) != start) {
+        if (++spins >= tr_wal_spins) {
+            sched_yield();
+            spins = 0;
+        }
+    }
+    atomic_store_explicit(&wal->published, recend, memory_order_release);
+    atomic_fetch_add_explicit(&wal->nrecords, 1, memory_order_relaxed);
+
+    *end = recend;
+    return trstatus_ok;
+}
+
+trstatus tr_wal_wait(trwal *wal, trwalwaiter *waiter, trlsn lsn, trtask *task)
+{
+    if (atomic_load_explicit(&wal->durable, memory_order_acquire) >= lsn) {
+        return trstatus_ok;
+    }
+
+    trstatus error = atomic_load(&wal->error);
+    if (tr_failed(error)) {
+        return error;
+    }
+
+    waiter->task = task;
+    waiter->lsn = lsn;
+
+    trwalwaiter *head = atomic_load_explicit(&wal->waiters, memory_order_relaxed);
+    do {
+        waiter->next = head;
+    } while (!atomic_compare_exchange_weak_explicit(&wal->waiters, &head, waiter,
+                memory_order_release, memory_order_relaxed));
+
+    tr_wal_kick(wal);
+    return trstatus_pending;
+}
+
+trstatus tr_wal_commit(trwal *wal, const void *data, unsigned length)
+{
+    trlsn end;
+    trstatus s = tr_wal_append(wal, data, length, &end);
+    if (tr_failed(s)) {
+        return s;
+    }
+
+    atomic_fetch_add(&wal->nthreads, 1);
+    tr_wal_kick(wal);
+
+    pthread_mutex_lock(&wal->lock);
+    while (atomic_load(&wal->durable) < end && tr_ok(atomic_load(&wal->error))) {
+        pthread_cond_wait(&wal->synced, &wal->lock);
+    }
+    pthread_mutex_unlock(&wal->lock);
+
+    atomic_fetch_sub(&wal->nthreads, 1);
+
+    return atomic_load(&wal->durable) >= end ? trstatus_ok : atomic_load(&wal->error);
+}
+
+trlsn tr_wal_durable(trwal *wal)
+{
+    return atomic_load_explicit(&wal->durable, memory_order_acquire);
+}
+
+trstatus tr_wal_truncate(trwal *wal, trlsn lsn)
+{
+    trstatus s = trstatus_ok;
+
+    pthread_mutex_lock(&wal->lock);
+
+    // Never recycle the segment being written, or anything not yet durable
+    trlsn limit = min(lsn, atomic_load(&wal->durable));
+    uint32_t end = limit / wal->config.segsize;
+
+    while (wal->firstseg < end) {
+        char from[32], to[32];
+        tr_wal_segname(from, sizeof(from), wal->firstseg);
+        tr_wal_segname(to, sizeof(to), wal->lastseg + 1);
+
+        if (renameat(wal->dirfd, from, wal->dirfd, to) < 0) {
+            s = tr_status_from_errno();
+            break;
+        }
+
+        wal->firstseg += 1;
+        wal->lastseg += 1;
+        wal->stat.nrecycled += 1;
+    }
+
+    if (fsync(wal->dirfd) < 0 && tr_ok(s)) {
+        s = tr_status_from_errno();
+    }
+
+    pthread_mutex_unlock(&wal->lock);
+    return s;
+}
+
+trwalstat tr_wal_stat(trwal *wal)
+{
+    pthread_mutex_lock(&wal->lock);
+    trwalstat stat = wal->stat;
+    pthread_mutex_unlock(&wal->lock);
+
+    stat.nrecords = atomic_load(&wal->nrecords);
+    stat.nbytes = atomic_load(&wal->reserved) - wal->start;
+    return stat;
+}
+
+//
+// The flusher
+//
+
+// Whether the flusher has work to do right away
+static bool tr_wal_needflush(trwal *wal)
+{
+    if (atomic_load(&wal->waiters) != NULL) {
+        return true;
+    }
+
+    if (tr_failed(atomic_load(&wal->error))) {
+        return false;
+    }
+
+    trlsn published = atomic_load(&wal->published);
+    trlsn durable = atomic_load(&wal->durable);
+
+    return published > durable &&
+        (atomic_load(&wal->nthreads) > 0 ||
+         published - durable >= wal->config.buffersize / 2);
+}
+
+// Writes the ring's contents for the LSNs [from, to) to their segments
+static trstatus tr_wal_write(trwal *wal, trlsn from, trlsn to)
+{
+    unsigned segsize = wal->config.segsize;
+    unsigned buffersize = wal->config.buffersize;
+
+    while (from < to) {
+        uint32_t seg = from / segsize;
+        unsigned off = from % segsize;
+        unsigned pos = from & (buffersize - 1);
+        unsigned bytes = min(to - from, min(segsize - off, buffersize - pos));
+
+        if (seg != wal->curseg || wal->curfd < 0) {
+            if (wal->curfd >= 0) {
+                if (fdatasync(wal->curfd) < 0) {
+                    return tr_status_from_errno();
+                }
+                close(wal->curfd);
+                wal->curfd = -1;
+            }
+
+            pthread_mutex_lock(&wal->lock);
+            trstatus s = tr_wal_segopen(wal, seg, &wal->curfd);
+            wal->lastseg = max(wal->lastseg, seg);
+            pthread_mutex_unlock(&wal->lock);
+            if (tr_failed(s)) {
+                return s;
+            }
+
+            wal->curseg = seg;
+        }
+
+        trstatus s = tr_wal_pwrite(wal->curfd, wal->ring + pos, bytes, off);
+        if (tr_failed(s)) {
+            return s;
+        }
+
+        from += bytes;
+    }
+
+    return fdatasync(wal->curfd) < 0 ? tr_status_from_errno() : trstatus_ok;
+}
+
+// Creates segments ahead of the one being written, so the flusher rarely
+// has to create one on the commit path
+//
+static void tr_wal_preallocate(trwal *wal)
+{
+    pthread_mutex_lock(&wal->lock);
+
+    while (wal->lastseg < wal->curseg + wal->config.prealloc) {
+        int fd;
+        if (tr_failed(tr_wal_segopen(wal, wal->lastseg + 1, &fd))) {
+            break;
+        }
+
+        close(fd);
+        wal->lastseg += 1;
+    }
+
+    pthread_mutex_unlock(&wal->lock);
+}
+
+// Resumes every parked task whose record is durable, or every parked task
+// if the log has failed
+//
+static void tr_wal_resume(trwal *wal)
+{
+    trwalwaiter *waiter = atomic_exchange_explicit(&wal->waiters, NULL, memory_order_acquire);
+    trlsn durable = atomic_load(&wal->durable);
+    bool failed = tr_failed(atomic_load(&wal->error));
+
+    while (waiter != NULL) {
+        trwalwaiter *next = waiter->next;
+
+        if (waiter->lsn <= durable || failed) {
+            tr_task_resume(waiter->task);
+        } else {
+            trwalwaiter *head = atomic_load_explicit(&wal->waiters, memory_order_relaxed);
+            do {
+                waiter->next = head;
+            } while (!atomic_compare_exchange_weak_explicit(&wal->waiters, &head, waiter,
+                        memory_order_release, memory_order_relaxed));
+        }
+
+        waiter = next;
+    }
+}
+
+// Writes and syncs everything published, then wakes committers
+static void tr_wal_pass(trwal *wal)
+{
+    trlsn durable = atomic_load(&wal->durable);
+    trlsn target = atomic_load_explicit(&wal->published, memory_order_acquire);
+
+    if (target > durable && tr_ok(atomic_load(&wal->error))) {
+        trstatus s = tr_wal_write(wal, durable, target);
+        if (tr_ok(s)) {
+            atomic_store_explicit(&wal->durable, target, memory_order_release);
+            tr_wal_preallocate(wal);
+        } else {
+            tr_log("write-ahead log failed: 0x%08x", s);
+            atomic_store(&wal->error, s);
+        }
+
+        pthread_mutex_lock(&wal->lock);
+        wal->stat.nflushes += 1;
+        pthread_mutex_unlock(&wal->lock);
+    }
+
+    tr_wal_resume(wal);
+
+    pthread_mutex_lock(&wal->lock);
+    pthread_cond_broadcast(&wal->synced);
+    pthread_mutex_unlock(&wal->lock);
+}
+
+static void *tr_wal_flusher(void *arg)
+{
+    trwal *wal = arg;
+
+    tr_wal_preallocate(wal);
+
+    for (;;) {
+        pthread_mutex_lock(&wal->lock);
+
+        bool stopping = wal->stopping;
+        if (!stopping && !tr_wal_needflush(wal)) {
+
+            // Same handshake as the committers' tr_wal_kick()
+            atomic_store(&wal->sleeping, true);
+            atomic_thread_fence(memory_order_seq_cst);
+
+            if (!tr_wal_needflush(wal)) {
+                trtime deadline = tr_clock_now() + wal->config.interval;
+                struct timespec ts = {
+                    .tv_sec = deadline / tr_sec(1),
+                    .tv_nsec = deadline % tr_sec(1),
+                };
+                pthread_cond_timedwait(&wal->wake, &wal->lock, &ts);
+            }
+
+            atomic_store(&wal->sleeping, false);
+            stopping = wal->stopping;
+        }
+
+        pthread_mutex_unlock(&wal->lock);
+
+        tr_wal_pass(wal);
+
+        if (stopping &&
+            (atomic_load(&wal->durable) == atomic_load(&wal->published) ||
+             tr_failed(atomic_load(&wal->error)))) {
+            break;
+        }
+    }
+
+    return NULL;
+}
@@ -0,0 +1,211 @@
+//////////////////////////////////////////////////////////////////////////////
+//
+// Terrascale
+// Copyright (c) Dave Kilian & Emily Kilian 2023. All rights reserved.
+//
+// wal.h - a write-ahead log with group commit
+//
+// The log is a stream of records, each identified by its log sequence
+// number (LSN): the byte offset of the record in the stream. The stream is
+// stored in a directory of fixed-size segment files named wal-NNNNNNNN,
+// where segment N holds the LSNs [N * segsize, (N + 1) * segsize). Records
+// never span segments; a record which doesn't fit at the end of a segment
+// starts the next one, and the gap is skipped.
+//
+// Appending is lock-free. A committer reserves space for its record in the
+// log's in-memory ring buffer with a compare-and-swap on the reserved LSN,
+// copies the record in, and then publishes it. Publication happens in LSN
+// order, so the published prefix of the ring is always contiguous.
+//
+// A single flusher thread turns published records into durable ones. Each
+// pass writes everything published since the last pass with one write per
+// segment touched, then fdatasyncs once, so every committer whose record
+// made it into the batch pays for a single sync between them (group
+// commit). While the flusher is syncing, committers keep appending into the
+// ring, and their records form the next batch.
+//
+// Committers wait for durability either by parking a task (tr_wal_wait) or
+// by blocking a thread (tr_wal_commit). Task waiters are kept on a
+// lock-free stack which the flusher drains after each sync, resuming every
+// task whose record is now durable.
+//
+// Segments are preallocated ahead of the write position by the flusher,
+// so a commit never waits for the file system to allocate space, and
+// segments made obsolete by tr_wal_truncate() are recycled as future
+// segments rather than deleted. Recycled segments still contain stale
+// records, but those carry the LSNs of their old positions, so replay
+// recognizes them and stops.
+//
+// Each record carries a CRC-32C of its header and payload. A record torn by
+// a crash, or damaged on disk, fails the check, and replay treats it as
+// the end of the log rather than handing garbage to the caller.
+//
+//////////////////////////////////////////////////////////////////////////////
+
+#pragma once
+
+#include <runtime/clock.h>
+#include <runtime/ring.h>
+#include <taskman/taskman.h>
+
+// A log sequence number: a byte offset in the log stream
+typedef uint64_t trlsn;
+
+// Header at the beginning of every record, followed by the payload and then
+// padding to a multiple of 8 bytes
+typedef struct {
+
+    trlsn lsn;          // The record's own LSN
+    uint32_t length;    // Length of the payload in bytes
+    uint32_t flags;     // trwalrecordflags
+    uint32_t crc;       // CRC-32C of the header (with crc zero) and payload
+    uint32_t unused;    // Zero
+
+} trwalrecord;
+
+static_assert(sizeof(trwalrecord) == 24);
+
+// Size of a record with the given payload, including header and padding,
+// so a record appended at LSN n ends at n + tr_wal_recordsize(length)
+//
+static inline unsigned tr_wal_recordsize(unsigned length)
+{
+    return sizeof(trwalrecord) + ((length + 7) & ~7u);
+}
+
+// Flags for trwalrecord. Every record has exactly one of these set, so a
+// zero-filled (preallocated) header is never mistaken for a record.
+//
+typedef enum {
+
+    tr_walrecord_data = 0x01,   // Holds a payload appended by a committer
+    tr_walrecord_skip = 0x02,   // Fills a gap at the end of a segment
+
+} trwalrecordflags;
+
+// Called for each record found while opening a log
+typedef trstatus trwalreplayfn(void *context, trlsn lsn, const void *data, unsigned length);
+
+// Log configuration
+typedef struct {
+
+    const char *dir;        // Directory holding the segment files
+    unsigned segsize;       // Size of each segment file (default 16M)
+    unsigned buffersize;    // Size of the ring buffer, a power of two (default 4M)
+    unsigned prealloc;      // Segments to keep allocated ahead (default 2)
+    trtime interval;        // Flush at least this often when idle (default 10ms)
+    tralloctag tag;         // Tag for the log's heap allocations
+
+} trwalconfig;
+
+// A task waiting for its record to become durable
+typedef struct _trwalwaiter {
+
+    struct _trwalwaiter *next;  // Next waiter on the log's waiter stack
+    trtask *task;               // The parked task
+    trlsn lsn;                  // LSN the task is waiting for
+
+} trwalwaiter;
+
+// Log statistics
+typedef struct {
+
+    uint64_t nrecords;      // Records appended
+    uint64_t nbytes;        // Bytes appended, including headers and padding
+    uint64_t nflushes;      // Flusher passes which wrote and synced
+    uint64_t nsegments;     // Segment files created (not recycled)
+    uint64_t nrecycled;     // Segment files recycled
+
+} trwalstat;
+
+// A write-ahead log
+typedef struct {
+
+    trwalconfig config;         // Configuration, with defaults filled in
+    int dirfd;                  // The log directory
+
+    char *ring;                 // Ring buffer of not-yet-durable records
+
+    // Each counter gets its own cache line, since committers hammer the
+    // first two and the flusher owns the third
+    _Atomic trlsn reserved;     // End of reserved space
+    char pad1[tr_cacheline - sizeof(trlsn)];
+    _Atomic trlsn published;    // End of the copied prefix
+    char pad2[tr_cacheline - sizeof(trlsn)];
+    _Atomic trlsn durable;      // End of the synced prefix
+    char pad3[tr_cacheline - sizeof(trlsn)];
+
+    trlsn start;                    // End of the log when it was opened
+    _Atomic uint64_t nrecords;      // Records appended since opening
+    _Atomic trstatus error;         // First write error, which stops the log
+    _Atomic(trwalwaiter *) waiters; // Parked tasks (a Treiber stack)
+    _Atomic bool sleeping;          // Whether the flusher is idle
+    _Atomic unsigned nthreads;      // Threads blocked in tr_wal_commit
+
+    pthread_t flusher;          // The flusher thread
+    pthread_mutex_t lock;       // Protects the fields below
+    pthread_cond_t wake;        // Wakes the flusher
+    pthread_cond_t synced;      // Signaled after each sync
+    bool stopping;              // Tells the flusher to exit
+
+    uint32_t firstseg;          // Oldest segment still needed
+    uint32_t lastseg;           // Newest segment file which exists
+    trwalstat stat;             // Flusher statistics
+
+    uint32_t curseg;            // Segment the flusher is writing (flusher only)
+    int curfd;                  // File descriptor for curseg, or -1 (flusher only)
+
+} trwal;
+
+// Fills in the default configuration for a log in the given directory
+void tr_wal_defaults(trwalconfig *config, const char *dir);
+
+// Opens the log in the given directory, creating it if necessary.
+//
+// Every record in the log is passed to replay (which may be NULL) in LSN
+// order. Replay stops at the first record which isn't where it's supposed
+// to be or fails its checksum, which marks the end of the log, and new
+// records are appended from there. Whatever follows the end is erased, so
+// records that were cut off never reappear once new records reach them.
+// If replay returns a failure, opening fails with that status.
+//
+trstatus tr_wal_open(trwal *wal, const trwalconfig *config, trwalreplayfn *replay, void *context);
+
+// Stops the flusher, after making every appended record durable, and
+// closes the log
+//
+void tr_wal_close(trwal *wal);
+
+// Appends a record, returning in *end the LSN just past the record, which
+// is what a committer waits for. The record isn't durable until the log's
+// durable LSN reaches *end.
+//
+// Returns trstatus_too_large if the record can't fit in a segment or the
+// ring buffer. If the ring is full, waits for the flusher to make room.
+//
+trstatus tr_wal_append(trwal *wal, const void *data, unsigned length, trlsn *end);
+
+// Waits, from a task, until the log is durable up to the given LSN.
+//
+// Returns trstatus_ok if it already is. Otherwise links the caller-owned
+// waiter into the log's waiter list and returns trstatus_pending; the task
+// should return trstatus_pending from run(), and call tr_wal_wait again
+// with the same arguments when resumed, which then returns trstatus_ok (or
+// the log's error).
+//
+trstatus tr_wal_wait(trwal *wal, trwalwaiter *waiter, trlsn lsn, trtask *task);
+
+// Appends a record and blocks the calling thread until it's durable
+trstatus tr_wal_commit(trwal *wal, const void *data, unsigned length);
+
+// Gets the LSN up to which the log is durable
+trlsn tr_wal_durable(trwal *wal);
+
+// Declares that records before the given LSN are no longer needed (e.g.
+// after a checkpoint), so segments which contain only such records can be
+// recycled
+//
+trstatus tr_wal_truncate(trwal *wal, trlsn lsn);
+
+// Gets a snapshot of the log's statistics
+trwalstat tr_wal_stat(trwal *wal);
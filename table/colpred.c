@@ -0,0 +1,706 @@
+//////////////////////////////////////////////////////////////////////////////
+//
+// Terrascale
+// Copyright (c) Dave Kilian & Emily Kilian 2023. All rights reserved.
+//
+//////////////////////////////////////////////////////////////////////////////
+
+#include <pch.h>
+#include <table/colpred.h>
+
+#include <float.h>
+#include <math.h>
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+#endif
+
+static pthread_once_t tr_colpred_once = PTHREAD_ONCE_INIT;
+static trcolimpl tr_colpred_bestimpl;
+
+static void tr_colpred_init()
+{
+    tr_colpred_bestimpl = trcolimpl_scalar;
+
+#if defined(__x86_64__)
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) {
+        tr_colpred_bestimpl = trcolimpl_avx2;
+    } else if (__builtin_cpu_supports("sse4.2")) {
+        tr_colpred_bestimpl = trcolimpl_sse42;
+    }
+#endif
+}
+
+trcolimpl tr_colpred_best()
+{
+    tr_require(0 == pthread_once(&tr_colpred_once, &tr_colpred_init));
+    return tr_colpred_bestimpl;
+}
+
+//
+// Scalar kernels. Integer ranges use one unsigned comparison per value:
+// x - lo wraps around to a huge number when x < lo.
+//
+
+static void tr_colpred_i32_scalar(const void *values, unsigned nwords,
+        trcolvalue lo, trcolvalue hi, uint64_t *bitmap)
+{
+    const int32_t *v = values;
+    uint32_t base = (uint32_t)lo.i;
+    uint32_t span = (uint32_t)hi.i - base;
+
+    for (unsigned w = 0; w < nwords; ++w, v += 64) {
+        uint64_t bits = 0;
+        for (int i = 0; i < 64; ++i) {
+            bits |= (uint64_t)((uint32_t)v[i] - base <= span) << i;
+        }
+        bitmap[w] = bits;
+    }
+}
+
+static void tr_colpred_i64_scalar(const void *values, unsigned nwords,
+        trcolvalue lo, trcolvalue hi, uint64_t *bitmap)
+{
+    const int64_t *v = values;
+    uint64_t base = (uint64_t)lo.i;
+    uint64_t span = (uint64_t)hi.i - base;
+
+    for (unsigned w = 0; w < nwords; ++w, v += 64) {
+        uint64_t bits = 0;
+        for (int i = 0; i < 64; ++i) {
+            bits |= (uint64_t)((uint64_t)v[i] - base <= span) << i;
+        }
+        bitmap[w] = bits;
+    }
+}
+
+static void tr_colpred_f64_scalar(const void *values, unsigned nwords,
+        trcolvalue lo, trcolvalue hi, uint64_t *bitmap)
+{
+    const double *v = values;
+
+    for (unsigned w = 0; w < nwords; ++w, v += 64) {
+        uint64_t bits = 0;
+        for (int i = 0; i < 64; ++i) {
+            bits |= (uint64_t)(v[i] >= lo.f && v[i] <= hi.f) << i;
+        }
+        bitmap[w] = bits;
+    }
+}
+
+// Code kernels: unsigned codes of 1, 2 or 4 bytes, with the same trick
+#define tr_colpred_codes_scalar(name, ctype) \
+    static void name(const void *values, unsigned nwords, trcolvalue lo, trcolvalue hi, uint64_t *bitmap) \
+    { \
+        const ctype *v = values; \
+        ctype base = (ctype)lo.i; \
+        ctype span = (ctype)(hi.i - lo.i); \
+        \
+        for (unsigned w = 0; w < nwords; ++w, v += 64) { \
+            uint64_t bits = 0; \
+            for (int i = 0; i < 64; ++i) { \
+                bits |= (uint64_t)((ctype)(v[i] - base) <= span) << i; \
+            } \
+            bitmap[w] = bits; \
+        } \
+    }
+
+tr_colpred_codes_scalar(tr_colpred_u8_scalar, uint8_t)
+tr_colpred_codes_scalar(tr_colpred_u16_scalar, uint16_t)
+tr_colpred_codes_scalar(tr_colpred_u32_scalar, uint32_t)
+
+#undef tr_colpred_codes_scalar
+
+#if defined(__x86_64__)
+
+//
+// Vector kernels: compare a vector of values against both bounds, and
+// gather one bit per value with movemask. Integer compares are signed, so a
+// value is in range unless lo > x or x > hi.
+//
+
+__attribute__((target("sse4.2")))
+static void tr_colpred_i32_sse42(const void *values, unsigned nwords,
+        trcolvalue lo, trcolvalue hi, uint64_t *bitmap)
+{
+    const __m128i *v = values;
+    __m128i vlo = _mm_set1_epi32((int32_t)lo.i);
+    __m128i vhi = _mm_set1_epi32((int32_t)hi.i);
+
+    for (unsigned w = 0; w < nwords; ++w) {
+        uint64_t bits = 0;
+        for (int i = 0; i < 16; ++i) {
+            __m128i x = _mm_loadu_si128(v++);
+            __m128i out = _mm_or_si128(_mm_cmpgt_epi32(vlo, x), _mm_cmpgt_epi32(x, vhi));
+            bits |= (uint64_t)(~_mm_movemask_ps(_mm_castsi128_ps(out)) & 0xf) << (4 * i);
+        }
+        bitmap[w] = bits;
+    }
+}
+
+__attribute__((target("sse4.2")))
+static void tr_colpred_i64_sse42(const void *values, unsigned nwords,
+        trcolvalue lo, trcolvalue hi, uint64_t *bitmap)
+{
+    const __m128i *v = values;
+    __m128i vlo = _mm_set1_epi64x(lo.i);
+    __m128i vhi = _mm_set1_epi64x(hi.i);
+
+    for (unsigned w = 0; w < nwords; ++w) {
+        uint64_t bits = 0;
+        for (int i = 0; i < 32; ++i) {
+            __m128i x = _mm_loadu_si128(v++);
+            __m128i out = _mm_or_si128(_mm_cmpgt_epi64(vlo, x), _mm_cmpgt_epi64(x, vhi));
+            bits |= (uint64_t)(~_mm_movemask_pd(_mm_castsi128_pd(out)) & 0x3) << (2 * i);
+        }
+        bitmap[w] = bits;
+    }
+}
+
+__attribute__((target("sse4.2")))
+static void tr_colpred_f64_sse42(const void *values, unsigned nwords,
+        trcolvalue lo, trcolvalue hi, uint64_t *bitmap)
+{
+    const double *v = values;
+    __m128d vlo = _mm_set1_pd(lo.f);
+    __m128d vhi = _mm_set1_pd(hi.f);
+
+    for (unsigned w = 0; w < nwords; ++w) {
+        uint64_t bits = 0;
+        for (int i = 0; i < 32; ++i, v += 2) {
+            __m128d x = _mm_loadu_pd(v);
+            __m128d in = _mm_and_pd(_mm_cmpge_pd(x, vlo), _mm_cmple_pd(x, vhi));
+            bits |= (uint64_t)_mm_movemask_pd(in) << (2 * i);
+        }
+        bitmap[w] = bits;
+    }
+}
+
+__attribute__((target("avx2")))
+static void tr_colpred_i32_avx2(const void *values, unsigned nwords,
+        trcolvalue lo, trcolvalue hi, uint64_t *bitmap)
+{
+    const __m256i *v = values;
+    __m256i vlo = _mm256_set1_epi32((int32_t)lo.i);
+    __m256i vhi = _mm256_set1_epi32((int32_t)hi.i);
+
+    for (unsigned w = 0; w < nwords; ++w) {
+        uint64_t bits = 0;
+        for (int i = 0; i < 8; ++i) {
+            __m256i x = _mm256_loadu_si256(v++);
+            __m256i out = _mm256_or_si256(_mm256_cmpgt_epi32(vlo, x), _mm256_cmpgt_epi32(x, vhi));
+            bits |= (uint64_t)(~_mm256_movemask_ps(_mm256_castsi256_ps(out)) & 0xff) << (8 * i);
+        }
+        bitmap[w] = bits;
+    }
+}
+
+__attribute__((target("avx2")))
+static void tr_colpred_i64_avx2(const void *values, unsigned nwords,
+        trcolvalue lo, trcolvalue hi, uint64_t *bitmap)
+{
+    const __m256i *v = values;
+    __m256i vlo = _mm256_set1_epi64x(lo.i);
+    __m256i vhi = _mm256_set1_epi64x(hi.i);
+
+    for (unsigned w = 0; w < nwords; ++w) {
+        uint64_t bits = 0;
+        for (int i = 0; i < 16; ++i) {
+            __m256i x = _mm256_loadu_si256(v++);
+            __m256i out = _mm256_or_si256(_mm256_cmpgt_epi64(vlo, x), _mm256_cmpgt_epi64(x, vhi));
+            bits |= (uint64_t)(~_mm256_movemask_pd(_mm256_castsi256_pd(out)) & 0xf) << (4 * i);
+        }
+        bitmap[w] = bits;
+    }
+}
+
+__attribute__((target("avx2")))
+static void tr_colpred_f64_avx2(const void *values, unsigned nwords,
+        trcolvalue lo, trcolvalue hi, uint64_t *bitmap)
+{
+    const double *v = values;
+    __m256d vlo = _mm256_set1_pd(lo.f);
+    __m256d vhi = _mm256_set1_pd(hi.f);
+
+    for (unsigned w = 0; w < nwords; ++w) {
+        uint64_t bits = 0;
+        for (int i = 0; i < 16; ++i, v += 4) {
+            __m256d x = _mm256_loadu_pd(v);
+            __m256d in = _mm256_and_pd(_mm256_cmp_pd(x, vlo, _CMP_GE_OQ),
+                _mm256_cmp_pd(x, vhi, _CMP_LE_OQ));
+            bits |= (uint64_t)_mm256_movemask_pd(in) << (4 * i);
+        }
+        bitmap[w] = bits;
+    }
+}
+
+//
+// Vector code kernels. There are no unsigned compares, so codes are offset
+// by lo and tested with min(x - lo, span) == x - lo. 2-byte results are
+// packed to bytes before gathering; AVX2 packs within 128-bit lanes, so the
+// result is permuted back into order.
+//
+
+__attribute__((target("sse4.2")))
+static void tr_colpred_u8_sse42(const void *values, unsigned nwords,
+        trcolvalue lo, trcolvalue hi, uint64_t *bitmap)
+{
+    const __m128i *v = values;
+    __m128i base = _mm_set1_epi8((char)lo.i);
+    __m128i span = _mm_set1_epi8((char)(hi.i - lo.i));
+
+    for (unsigned w = 0; w < nwords; ++w) {
+        uint64_t bits = 0;
+        for (int i = 0; i < 4; ++i) {
+            __m128i x = _mm_sub_epi8(_mm_loadu_si128(v++), base);
+            __m128i in = _mm_cmpeq_epi8(_mm_min_epu8(x, span), x);
+            bits |= (uint64_t)(uint16_t)_mm_movemask_epi8(in) << (16 * i);
+        }
+        bitmap[w] = bits;
+    }
+}
+
+__attribute__((target("sse4.2")))
+static void tr_colpred_u16_sse42(const void *values, unsigned nwords,
+        trcolvalue lo, trcolvalue hi, uint64_t *bitmap)
+{
+    const __m128i *v = values;
+    __m128i base = _mm_set1_epi16((short)lo.i);
+    __m128i span = _mm_set1_epi16((short)(hi.i - lo.i));
+
+    for (unsigned w = 0; w < nwords; ++w) {
+        uint64_t bits = 0;
+        for (int i = 0; i < 4; ++i) {
+            __m128i x0 = _mm_sub_epi16(_mm_loadu_si128(v++), base);
+            __m128i x1 = _mm_sub_epi16(_mm_loadu_si128(v++), base);
+            __m128i in0 = _mm_cmpeq_epi16(_mm_min_epu16(x0, span), x0);
+            __m128i in1 = _mm_cmpeq_epi16(_mm_min_epu16(x1, span), x1);
+            bits |= (uint64_t)(uint16_t)_mm_movemask_epi8(_mm_packs_epi16(in0, in1)) << (16 * i);
+        }
+        bitmap[w] = bits;
+    }
+}
+
+__attribute__((target("sse4.2")))
+static void tr_colpred_u32_sse42(const void *values, unsigned nwords,
+        trcolvalue lo, trcolvalue hi, uint64_t *bitmap)
+{
+    const __m128i *v = values;
+    __m128i base = _mm_set1_epi32((int)lo.i);
+    __m128i span = _mm_set1_epi32((int)(hi.i - lo.i));
+
+    for (unsigned w = 0; w < nwords; ++w) {
+        uint64_t bits = 0;
+        for (int i = 0; i < 16; ++i) {
+            __m128i x = _mm_sub_epi32(_mm_loadu_si128(v++), base);
+            __m128i in = _mm_cmpeq_epi32(_mm_min_epu32(x, span), x);
+            bits |= (uint64_t)_mm_movemask_ps(_mm_castsi128_ps(in)) << (4 * i);
+        }
+        bitmap[w] = bits;
+    }
+}
+
+__attribute__((target("avx2")))
+static void tr_colpred_u8_avx2(const void *values, unsigned nwords,
+        trcolvalue lo, trcolvalue hi, uint64_t *bitmap)
+{
+    const __m256i *v = values;
+    __m256i base = _mm256_set1_epi8((char)lo.i);
+    __m256i span = _mm256_set1_epi8((char)(hi.i - lo.i));
+
+    for (unsigned w = 0; w < nwords; ++w) {
+        __m256i x0 = _mm256_sub_epi8(_mm256_loadu_si256(v++), base);
+        __m256i x1 = _mm256_sub_epi8(_mm256_loadu_si256(v++), base);
+        __m256i in0 = _mm256_cmpeq_epi8(_mm256_min_epu8(x0, span), x0);
+        __m256i in1 = _mm256_cmpeq_epi8(_mm256_min_epu8(x1, span), x1);
+        bitmap[w] = (uint64_t)(uint32_t)_mm256_movemask_epi8(in0) |
+                    (uint64_t)(uint32_t)_mm256_movemask_epi8(in1) << 32;
+    }
+}
+
+__attribute__((target("avx2")))
+static void tr_colpred_u16_avx2(const void *values, unsigned nwords,
+        trcolvalue lo, trcolvalue hi, uint64_t *bitmap)
+{
+    const __m256i *v = values;
+    __m256i base = _mm256_set1_epi16((short)lo.i);
+    __m256i span = _mm256_set1_epi16((short)(hi.i - lo.i));
+
+    for (unsigned w = 0; w < nwords; ++w) {
+        uint64_t bits = 0;
+        for (int i = 0; i < 2; ++i) {
+            __m256i x0 = _mm256_sub_epi16(_mm256_loadu_si256(v++), base);
+            __m256i x1 = _mm256_sub_epi16(_mm256_loadu_si256(v++), base);
+            __m256i in0 = _mm256_cmpeq_epi16(_mm256_min_epu16(x0, span), x0);
+            __m256i in1 = _mm256_cmpeq_epi16(_mm256_min_epu16(x1, span), x1);
+            __m256i in = _mm256_permute4x64_epi64(_mm256_packs_epi16(in0, in1), 0xd8);
+            bits |= (uint64_t)(uint32_t)_mm256_movemask_epi8(in) << (32 * i);
+        }
+        bitmap[w] = bits;
+    }
+}
+
+__attribute__((target("avx2")))
+static void tr_colpred_u32_avx2(const void *values, unsigned nwords,
+        trcolvalue lo, trcolvalue hi, uint64_t *bitmap)
+{
+    const __m256i *v = values;
+    __m256i base = _mm256_set1_epi32((int)lo.i);
+    __m256i span = _mm256_set1_epi32((int)(hi.i - lo.i));
+
+    for (unsigned w = 0; w < nwords; ++w) {
+        uint64_t bits = 0;
+        for (int i = 0; i < 8; ++i) {
+            __m256i x = _mm256_sub_epi32(_mm256_loadu_si256(v++), base);
+            __m256i in = _mm256_cmpeq_epi32(_mm256_min_epu32(x, span), x);
+            bits |= (uint64_t)_mm256_movemask_ps(_mm256_castsi256_ps(in)) << (8 * i);
+        }
+        bitmap[w] = bits;
+    }
+}
+
+#endif
+
+// Kernels by implementation and column type
+static trcolkernel *const tr_colpred_kernels[][3] =
+{
+    [trcolimpl_scalar] = { tr_colpred_i32_scalar, tr_colpred_i64_scalar, tr_colpred_f64_scalar },
+#if defined(__x86_64__)
+    [trcolimpl_sse42] = { tr_colpred_i32_sse42, tr_colpred_i64_sse42, tr_colpred_f64_sse42 },
+    [trcolimpl_avx2] = { tr_colpred_i32_avx2, tr_colpred_i64_avx2, tr_colpred_f64_avx2 },
+#endif
+};
+
+// Code kernels by implementation and code width (1, 2 and 4 bytes)
+static trcolkernel *const tr_colpred_codekernels[][3] =
+{
+    [trcolimpl_scalar] = { tr_colpred_u8_scalar, tr_colpred_u16_scalar, tr_colpred_u32_scalar },
+#if defined(__x86_64__)
+    [trcolimpl_sse42] = { tr_colpred_u8_sse42, tr_colpred_u16_sse42, tr_colpred_u32_sse42 },
+    [trcolimpl_avx2] = { tr_colpred_u8_avx2, tr_colpred_u16_avx2, tr_colpred_u32_avx2 },
+#endif
+};
+
+// Reduces an integer comparison to a range of matching values, clamped to
+// [least, greatest]
+//
+static void tr_colpred_range_int(trcolpred *pred, trcolop op, int64_t a, int64_t b,
+        int64_t least, int64_t greatest)
+{
+    int64_t lo = least;
+    int64_t hi = greatest;
+
+    switch (op) {
+    case trcolop_eq:
+    case trcolop_ne:
+        lo = hi = a;
+        pred->negate = op == trcolop_ne;
+        break;
+    case trcolop_lt:
+        if (a == INT64_MIN) {
+            lo = 1, hi = 0;
+        } else {
+            hi = a - 1;
+        }
+        break;
+    case trcolop_le:
+        hi = a;
+        break;
+    case trcolop_gt:
+        if (a == INT64_MAX) {
+            lo = 1, hi = 0;
+        } else {
+            lo = a + 1;
+        }
+        break;
+    case trcolop_ge:
+        lo = a;
+        break;
+    case trcolop_between:
+        lo = a, hi = b;
+        break;
+    }
+
+    lo = max(lo, least);
+    hi = min(hi, greatest);
+    pred->lo.i = lo;
+    pred->hi.i = hi;
+
+    // An empty range matches nothing, or when negated, everything
+    if (lo > hi) {
+        pred->none = !pred->negate;
+        pred->lo.i = least;
+        pred->hi.i = greatest;
+        pred->negate = false;
+    }
+}
+
+// Gets the greatest double less than a value, or NaN if there isn't one
+static double tr_colpred_below(double v)
+{
+    if (isnan(v) || v == -INFINITY) {
+        return NAN;
+    }
+    if (v == 0) {
+        return -DBL_TRUE_MIN;
+    }
+
+    uint64_t bits;
+    memcpy(&bits, &v, sizeof(bits));
+    bits += v > 0 ? -1 : 1;
+    memcpy(&v, &bits, sizeof(v));
+    return v;
+}
+
+// Reduces a floating-point comparison to a range of matching values. NaNs
+// never match a range.
+//
+static void tr_colpred_range_f64(trcolpred *pred, trcolop op, double a, double b)
+{
+    double lo = -INFINITY;
+    double hi = INFINITY;
+
+    switch (op) {
+    case trcolop_eq:
+    case trcolop_ne:
+        lo = hi = a;
+        pred->negate = op == trcolop_ne;
+        break;
+    case trcolop_lt:
+        hi = tr_colpred_below(a);
+        break;
+    case trcolop_le:
+        hi = a;
+        break;
+    case trcolop_gt:
+        lo = -tr_colpred_below(-a);
+        break;
+    case trcolop_ge:
+        lo = a;
+        break;
+    case trcolop_between:
+        lo = a, hi = b;
+        break;
+    }
+
+    pred->lo.f = lo;
+    pred->hi.f = hi;
+
+    // An empty range matches nothing. Negated (only x != NaN gets here), it
+    // matches everything, NaN included, so keep an empty range to negate
+    // rather than widening it to every ordered value.
+    if (!(lo <= hi)) {
+        pred->none = !pred->negate;
+        pred->lo.f = pred->negate ? INFINITY : -INFINITY;
+        pred->hi.f = pred->negate ? -INFINITY : INFINITY;
+    }
+}
+
+void tr_colpred_compile_with(trcolimpl impl, trcolpred *pred, trcoltype type,
+        trcolop op, trcolvalue a, trcolvalue b)
+{
+    tr_assert(impl <= tr_colpred_best());
+
+    pred->type = type;
+    pred->negate = false;
+    pred->none = false;
+    pred->kernel = tr_colpred_kernels[impl][type];
+    for (int i = 0; i < 3; ++i) {
+        pred->codes[i] = tr_colpred_codekernels[impl][i];
+    }
+
+    switch (type) {
+    case trcol_i32:
+        tr_colpred_range_int(pred, op, a.i, b.i, INT32_MIN, INT32_MAX);
+        break;
+    case trcol_i64:
+        tr_colpred_range_int(pred, op, a.i, b.i, INT64_MIN, INT64_MAX);
+        break;
+    case trcol_f64:
+        tr_colpred_range_f64(pred, op, a.f, b.f);
+        break;
+    }
+}
+
+void tr_colpred_compile(trcolpred *pred, trcoltype type, trcolop op, trcolvalue a, trcolvalue b)
+{
+    tr_colpred_compile_with(tr_colpred_best(), pred, type, op, a, b);
+}
+
+static bool tr_colpred_less(trcoltype type, trcolvalue a, trcolvalue b)
+{
+    return type == trcol_f64 ? a.f < b.f : a.i < b.i;
+}
+
+// Decides a chunk from its zone map: returns -1 if no row can match, 1 if
+// every non-null row matches, or 0 if the chunk must be scanned
+//
+static int tr_colpred_zone(const trcolpred *pred, const trcolchunk *chunk)
+{
+    if (pred->none || chunk->nnulls == chunk->nrows) {
+        return -1;
+    }
+    if (chunk->unordered) {
+        return 0;
+    }
+
+    bool outside = tr_colpred_less(pred->type, chunk->max, pred->lo) ||
+                   tr_colpred_less(pred->type, pred->hi, chunk->min);
+    bool inside = !tr_colpred_less(pred->type, chunk->min, pred->lo) &&
+                  !tr_colpred_less(pred->type, pred->hi, chunk->max);
+
+    if (outside) {
+        return pred->negate ? 1 : -1;
+    }
+    if (inside) {
+        return pred->negate ? -1 : 1;
+    }
+    return 0;
+}
+
+// Sets bits [from, to) of a bitmap
+static void tr_colpred_set(uint64_t *bitmap, unsigned from, unsigned to)
+{
+    while (from < to) {
+        unsigned n = min(to - from, 64 - from % 64);
+        bitmap[from / 64] |= (n == 64 ? ~0ull : ((1ull << n) - 1)) << (from % 64);
+        from += n;
+    }
+}
+
+// Finds the first dictionary entry not less than a value, or with
+// `greater`, greater than it
+//
+static unsigned tr_colpred_bound(const int64_t *dict, unsigned ndict, int64_t value, bool greater)
+{
+    unsigned lo = 0;
+    unsigned hi = ndict;
+    while (lo < hi) {
+        unsigned mid = (lo + hi) / 2;
+        if (dict[mid] < value || (greater && dict[mid] == value)) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+
+    return lo;
+}
+
+// Tests every value of a chunk against the predicate's range, ignoring
+// negation and nulls
+//
+static void tr_colpred_scan(const trcolpred *pred, const trcolchunk *chunk, unsigned nwords, uint64_t *bitmap)
+{
+    int64_t lo = pred->lo.i;
+    int64_t hi = pred->hi.i;
+    uint64_t codelo;
+    uint64_t codehi;
+
+    switch (chunk->encoding) {
+    case trcolenc_plain:
+        pred->kernel(chunk->values, nwords, pred->lo, pred->hi, bitmap);
+        return;
+
+    case trcolenc_runs:
+        memset(bitmap, 0, nwords * sizeof(uint64_t));
+        for (unsigned r = 0, start = 0; r < chunk->nruns; start = chunk->runs[r++].end) {
+            if (chunk->runs[r].value >= lo && chunk->runs[r].value <= hi) {
+                tr_colpred_set(bitmap, start, chunk->runs[r].end);
+            }
+        }
+        return;
+
+    case trcolenc_packed:
+        // The zone map has ruled out ranges entirely outside the chunk's
+        codelo = lo < chunk->min.i ? 0 : (uint64_t)lo - (uint64_t)chunk->min.i;
+        codehi = (uint64_t)min(hi, chunk->max.i) - (uint64_t)chunk->min.i;
+        break;
+
+    case trcolenc_dict: {
+        unsigned first = tr_colpred_bound(chunk->dict, chunk->ndict, lo, false);
+        unsigned end = tr_colpred_bound(chunk->dict, chunk->ndict, hi, true);
+        if (first == end) {
+            memset(bitmap, 0, nwords * sizeof(uint64_t));
+            return;
+        }
+        codelo = first;
+        codehi = end - 1;
+        break;
+    }
+    }
+
+    trcolvalue a = { .i = codelo };
+    trcolvalue b = { .i = codehi };
+    pred->codes[chunk->codewidth / 2](chunk->values, nwords, a, b, bitmap);
+}
+
+uint64_t tr_colpred_filter(const trcolpred *pred, const trcolumn *column,
+        uint64_t *bitmap, bool refine, trcolscanstat *stat)
+{
+    tr_assert(pred->type == column->type);
+
+    trcolscanstat counts = {0};
+    uint64_t selected = 0;
+    uint64_t scratch[tr_colchunk_rows / 64];
+
+    for (unsigned c = 0; c < column->nchunks; ++c) {
+        const trcolchunk *chunk = column->chunks + c;
+        uint64_t *out = bitmap + (size_t)c * (tr_colchunk_rows / 64);
+        unsigned nwords = (chunk->nrows + 63) / 64;
+        counts.nchunks++;
+
+        // Nothing left to refine
+        bool any = !refine;
+        for (unsigned w = 0; w < nwords && !any; ++w) {
+            any = out[w] != 0;
+        }
+        if (!any) {
+            counts.nskipped++;
+            continue;
+        }
+
+        int zone = tr_colpred_zone(pred, chunk);
+        if (zone < 0) {
+            memset(out, 0, nwords * sizeof(uint64_t));
+            counts.nskipped++;
+            continue;
+        }
+
+        if (zone > 0) {
+            memset(scratch, 0xff, nwords * sizeof(uint64_t));
+            counts.nfull++;
+        } else {
+            tr_colpred_scan(pred, chunk, nwords, scratch);
+            counts.nscanned++;
+            counts.nencoded += chunk->encoding != trcolenc_plain;
+        }
+
+        uint64_t flip = zone == 0 && pred->negate ? ~0ull : 0;
+        for (unsigned w = 0; w < nwords; ++w) {
+            uint64_t bits = scratch[w] ^ flip;
+            if (chunk->nulls != NULL) {
+                bits &= ~chunk->nulls[w];
+            }
+            if (refine) {
+                bits &= out[w];
+            }
+            out[w] = bits;
+        }
+
+        // Slots past the last row hold zeros, which may have matched
+        if (chunk->nrows % 64 != 0) {
+            out[nwords - 1] &= (1ull << (chunk->nrows % 64)) - 1;
+        }
+
+        for (unsigned w = 0; w < nwords; ++w) {
+            selected += __builtin_popcountll(out[w]);
+        }
+    }
+
+    if (stat != NULL) {
+        *stat = counts;
+    }
+    return selected;
+}
@@ -0,0 +1,115 @@
+//////////////////////////////////////////////////////////////////////////////
+//
+// Terrascale
+// Copyright (c) Dave Kilian & Emily Kilian 2023. All rights reserved.
+//
+// colpred.h - predicates over columns
+//
+// A predicate compares a column against constants (x < 5, x between 2 and
+// 7, ...), and filtering a column with it produces a selection bitmap: bit
+// i of word i / 64 is set if row i matches. Null rows never match, and NaNs
+// compare as IEEE 754 says, matching only !=.
+//
+// Compiling a predicate reduces every comparison to an inclusive range of
+// matching values, possibly negated (x != 5 is x outside [5, 5]), and picks
+// a kernel for the column's type which tests a range over 64 rows at a time
+// and produces one bitmap word. Kernels come in AVX2, SSE4.2 and portable
+// scalar implementations; the best one the CPU supports is chosen at
+// runtime.
+//
+// Encoded chunks (see column.h) are filtered without decoding them. The
+// range is translated into a range of codes (less the minimum for packed
+// chunks, or looked up in the dictionary), and narrow kernels test 1, 2 or
+// 4 byte codes against it, comparing 16 or 32 rows per instruction. Run
+// encoded chunks are tested a run at a time.
+//
+// Filtering first consults each chunk's zone map: a chunk whose values all
+// lie outside the range (or all inside it) is decided without looking at
+// its values at all. Predicates over several columns are combined by
+// refining: filtering with `refine` set ANDs the new matches into the
+// bitmap, and skips chunks in which nothing is selected any more.
+//
+//////////////////////////////////////////////////////////////////////////////
+
+#pragma once
+
+#include <table/column.h>
+
+// Comparisons
+typedef enum {
+
+    trcolop_eq,         // x == a
+    trcolop_ne,         // x != a
+    trcolop_lt,         // x < a
+    trcolop_le,         // x <= a
+    trcolop_gt,         // x > a
+    trcolop_ge,         // x >= a
+    trcolop_between,    // a <= x <= b
+
+} trcolop;
+
+// Available kernel implementations
+typedef enum {
+
+    trcolimpl_scalar,   // Portable
+    trcolimpl_sse42,    // 128-bit vectors
+    trcolimpl_avx2,     // 256-bit vectors
+
+} trcolimpl;
+
+// Sets bit i of bitmap[w] if values[64 * w + i] lies in [lo, hi], for each
+// of `nwords` words
+//
+typedef void trcolkernel(const void *values, unsigned nwords,
+        trcolvalue lo, trcolvalue hi, uint64_t *bitmap);
+
+// A compiled predicate
+typedef struct {
+
+    trcoltype type;         // Type of column it applies to
+    trcolvalue lo;          // Matching values, inclusive
+    trcolvalue hi;
+    bool negate;            // Whether values outside [lo, hi] match instead
+    bool none;              // Whether no value can match
+    trcolkernel *kernel;    // Tests values against [lo, hi]
+    trcolkernel *codes[3];  // Test 1, 2 and 4 byte unsigned codes
+
+} trcolpred;
+
+// Filtering statistics
+typedef struct {
+
+    uint64_t nchunks;       // Chunks considered
+    uint64_t nskipped;      // Chunks in which nothing could match
+    uint64_t nfull;         // Chunks in which everything matched
+    uint64_t nscanned;      // Chunks run through the kernel
+    uint64_t nencoded;      // Scanned chunks which were encoded
+
+} trcolscanstat;
+
+// Compiles a comparison of a column of the given type against `a` (and, for
+// trcolop_between, `b`), using the best kernels this CPU supports
+//
+void tr_colpred_compile(trcolpred *pred, trcoltype type, trcolop op, trcolvalue a, trcolvalue b);
+
+// Same as tr_colpred_compile, but using a particular implementation, which
+// must be supported by this CPU
+//
+void tr_colpred_compile_with(trcolimpl impl, trcolpred *pred, trcoltype type,
+        trcolop op, trcolvalue a, trcolvalue b);
+
+// Returns the fastest implementation this CPU supports
+trcolimpl tr_colpred_best();
+
+// Gets the number of words in a selection bitmap for a column
+static inline size_t tr_colpred_words(const trcolumn *column)
+{
+    return (column->nrows + 63) / 64;
+}
+
+// Filters a column, writing (or with `refine`, ANDing) its matches into a
+// selection bitmap of tr_colpred_words(column) words. Returns the number of
+// rows selected. `stat` may be NULL.
+//
+uint64_t tr_colpred_filter(const trcolpred *pred, const trcolumn *column,
+        uint64_t *bitmap, bool refine, trcolscanstat *stat);
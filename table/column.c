@@ -0,0 +1,669 @@
+//////////////////////////////////////////////////////////////////////////////
+//
+// Terrascale
+// Copyright (c) Dave Kilian & Emily Kilian 2023. All rights reserved.
+//
+//////////////////////////////////////////////////////////////////////////////
+
+#include <pch.h>
+#include <table/column.h>
+
+#include <math.h>
+
+void tr_column_initialize(trcolumn *column, trcoltype type, tralloctag tag)
+{
+    column->type = type;
+    column->chunks = NULL;
+    column->nchunks = 0;
+    column->capacity = 0;
+    column->nrows = 0;
+    column->encode = true;
+    column->tag = tag;
+}
+
+static void tr_column_decode(trcoltype type, const trcolchunk *chunk, unsigned index, unsigned count,
+        void *values);
+
+static void tr_column_free_chunk(trcolchunk *chunk)
+{
+    if (chunk->values != NULL) {
+        tr_free(chunk->values);
+    }
+    if (chunk->nulls != NULL) {
+        tr_free(chunk->nulls);
+    }
+    if (chunk->dict != NULL) {
+        tr_free(chunk->dict);
+    }
+    if (chunk->runs != NULL) {
+        tr_free(chunk->runs);
+    }
+}
+
+void tr_column_cleanup(trcolumn *column)
+{
+    for (unsigned i = 0; i < column->nchunks; ++i) {
+        tr_column_free_chunk(column->chunks + i);
+    }
+
+    if (column->chunks != NULL) {
+        tr_free(column->chunks);
+    }
+}
+
+// Turns an encoded chunk which is no longer full (see tr_column_truncate)
+// back into a plain one, so more values can be appended to it
+//
+static trstatus tr_column_unseal(trcolumn *column, trcolchunk *chunk)
+{
+    unsigned width = tr_coltype_width(column->type);
+    void *values = tr_alloc_aligned(tr_colchunk_rows * width, tr_colchunk_align, column->tag);
+    if (values == NULL) {
+        return trstatus_no_mem;
+    }
+    memset(values, 0, tr_colchunk_rows * width);
+
+    tr_column_decode(column->type, chunk, 0, chunk->nrows, values);
+    for (unsigned i = 0; i < chunk->nrows && chunk->nnulls != 0; ++i) {
+        if (tr_colchunk_null(chunk, i)) {
+            memset(ptr_add(values, i * width), 0, width);
+        }
+    }
+
+    if (chunk->values != NULL) {
+        tr_free(chunk->values);
+    }
+    if (chunk->dict != NULL) {
+        tr_free(chunk->dict);
+    }
+    if (chunk->runs != NULL) {
+        tr_free(chunk->runs);
+    }
+
+    chunk->encoding = trcolenc_plain;
+    chunk->values = values;
+    chunk->codewidth = 0;
+    chunk->dict = NULL;
+    chunk->ndict = 0;
+    chunk->runs = NULL;
+    chunk->nruns = 0;
+    return trstatus_ok;
+}
+
+// Gets the chunk to append to, starting a new one if the last is full
+static trcolchunk *tr_column_tail(trcolumn *column)
+{
+    if (column->nchunks > 0 && column->chunks[column->nchunks - 1].nrows < tr_colchunk_rows) {
+        trcolchunk *chunk = column->chunks + column->nchunks - 1;
+        if (chunk->encoding != trcolenc_plain && tr_failed(tr_column_unseal(column, chunk))) {
+            return NULL;
+        }
+        return chunk;
+    }
+
+    if (column->nchunks == column->capacity) {
+        unsigned capacity = max(column->capacity * 2, 4u);
+        trcolchunk *chunks = tr_alloc(capacity * sizeof(trcolchunk), column->tag);
+        if (chunks == NULL) {
+            return NULL;
+        }
+
+        if (column->chunks != NULL) {
+            memcpy(chunks, column->chunks, column->nchunks * sizeof(trcolchunk));
+            tr_free(column->chunks);
+        }
+        column->chunks = chunks;
+        column->capacity = capacity;
+    }
+
+    unsigned bytes = tr_colchunk_rows * tr_coltype_width(column->type);
+    void *values = tr_alloc_aligned(bytes, tr_colchunk_align, column->tag);
+    if (values == NULL) {
+        return NULL;
+    }
+    memset(values, 0, bytes);
+
+    trcolchunk *chunk = column->chunks + column->nchunks++;
+    chunk->encoding = trcolenc_plain;
+    chunk->values = values;
+    chunk->codewidth = 0;
+    chunk->dict = NULL;
+    chunk->ndict = 0;
+    chunk->runs = NULL;
+    chunk->nruns = 0;
+    chunk->nulls = NULL;
+    chunk->nrows = 0;
+    chunk->nnulls = 0;
+    chunk->unordered = false;
+    return chunk;
+}
+
+// Widens a stored value
+static trcolvalue tr_column_load(trcoltype type, const void *values, unsigned index)
+{
+    trcolvalue v;
+
+    switch (type) {
+    case trcol_i32:
+        v.i = ((const int32_t *)values)[index];
+        break;
+    case trcol_i64:
+        v.i = ((const int64_t *)values)[index];
+        break;
+    case trcol_f64:
+        v.f = ((const double *)values)[index];
+        break;
+    }
+
+    return v;
+}
+
+// Whether one value is less than another, by the column's type
+static bool tr_column_less(trcoltype type, trcolvalue a, trcolvalue b)
+{
+    return type == trcol_f64 ? a.f < b.f : a.i < b.i;
+}
+
+// Reads a code of the given width
+static uint32_t tr_column_code(const void *codes, unsigned width, unsigned index)
+{
+    switch (width) {
+    case 1:
+        return ((const uint8_t *)codes)[index];
+    case 2:
+        return ((const uint16_t *)codes)[index];
+    default:
+        return ((const uint32_t *)codes)[index];
+    }
+}
+
+// Writes a code of the given width
+static void tr_column_setcode(void *codes, unsigned width, unsigned index, uint32_t code)
+{
+    switch (width) {
+    case 1:
+        ((uint8_t *)codes)[index] = code;
+        break;
+    case 2:
+        ((uint16_t *)codes)[index] = code;
+        break;
+    default:
+        ((uint32_t *)codes)[index] = code;
+        break;
+    }
+}
+
+// Gets the bytes needed for codes up to `greatest`, or 8 if they won't fit
+// in 32 bits
+//
+static unsigned tr_column_codewidth(uint64_t greatest)
+{
+    return greatest <= UINT8_MAX ? 1 : greatest <= UINT16_MAX ? 2 : greatest <= UINT32_MAX ? 4 : 8;
+}
+
+static int tr_column_compare(const void *a, const void *b)
+{
+    int64_t x = *(const int64_t *)a;
+    int64_t y = *(const int64_t *)b;
+    return (x > y) - (x < y);
+}
+
+// Finds the index of a value in a dictionary
+static unsigned tr_column_lookup(const int64_t *dict, unsigned ndict, int64_t value)
+{
+    unsigned lo = 0;
+    unsigned hi = ndict;
+    while (lo < hi) {
+        unsigned mid = (lo + hi) / 2;
+        if (dict[mid] < value) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+
+    return lo;
+}
+
+// Builds a sorted dictionary of a chunk's distinct values. Returns NULL if
+// there are too many for 2-byte codes, or there's no memory.
+//
+static int64_t *tr_column_dictionary(trcolumn *column, trcolchunk *chunk, unsigned *ndict)
+{
+    unsigned n = 0;
+    int64_t *dict = tr_alloc((chunk->nrows - chunk->nnulls) * sizeof(int64_t), column->tag);
+    if (dict == NULL) {
+        return NULL;
+    }
+
+    for (unsigned i = 0; i < chunk->nrows; ++i) {
+        if (!tr_colchunk_null(chunk, i)) {
+            dict[n++] = tr_column_load(column->type, chunk->values, i).i;
+        }
+    }
+
+    qsort(dict, n, sizeof(int64_t), tr_column_compare);
+    unsigned distinct = 1;
+    for (unsigned i = 1; i < n; ++i) {
+        if (dict[i] != dict[distinct - 1]) {
+            dict[distinct++] = dict[i];
+        }
+    }
+
+    int64_t *result = NULL;
+    if (distinct <= UINT16_MAX + 1) {
+        result = tr_alloc(distinct * sizeof(int64_t), column->tag);
+        if (result != NULL) {
+            memcpy(result, dict, distinct * sizeof(int64_t));
+            *ndict = distinct;
+        }
+    }
+
+    tr_free(dict);
+    return result;
+}
+
+// Re-encodes a full chunk in whichever encoding is smallest. Encoding is
+// only an optimization, so if there's no memory the chunk stays plain.
+//
+static void tr_column_seal(trcolumn *column, trcolchunk *chunk)
+{
+    if (!column->encode || column->type == trcol_f64 || chunk->nnulls == chunk->nrows) {
+        return;
+    }
+
+    unsigned width = tr_coltype_width(column->type);
+    size_t best = (size_t)chunk->nrows * width;
+    trcolenc encoding = trcolenc_plain;
+
+    unsigned nruns = 0;
+    int64_t last = 0;
+    for (unsigned i = 0; i < chunk->nrows; ++i) {
+        if (!tr_colchunk_null(chunk, i)) {
+            int64_t v = tr_column_load(column->type, chunk->values, i).i;
+            nruns += nruns == 0 || v != last;
+            last = v;
+        }
+    }
+    if (nruns * sizeof(trcolrun) < best) {
+        best = nruns * sizeof(trcolrun);
+        encoding = trcolenc_runs;
+    }
+
+    unsigned packwidth = tr_column_codewidth((uint64_t)chunk->max.i - (uint64_t)chunk->min.i);
+    if ((size_t)chunk->nrows * packwidth < best) {
+        best = (size_t)chunk->nrows * packwidth;
+        encoding = trcolenc_packed;
+    }
+
+    // A dictionary needs at least a byte per row, and can only beat packing
+    // if it has narrower codes
+    unsigned ndict = 0;
+    int64_t *dict = NULL;
+    if (min(packwidth, width) > 1 && best > chunk->nrows) {
+        dict = tr_column_dictionary(column, chunk, &ndict);
+        if (dict != NULL) {
+            unsigned dictwidth = tr_column_codewidth(ndict - 1);
+            size_t size = (size_t)chunk->nrows * dictwidth + ndict * sizeof(int64_t);
+            if (size < best) {
+                best = size;
+                encoding = trcolenc_dict;
+            }
+        }
+    }
+
+    if (encoding != trcolenc_dict && dict != NULL) {
+        tr_free(dict);
+        dict = NULL;
+    }
+
+    switch (encoding) {
+    case trcolenc_plain:
+        return;
+
+    case trcolenc_runs: {
+        trcolrun *runs = tr_alloc(nruns * sizeof(trcolrun), column->tag);
+        if (runs == NULL) {
+            return;
+        }
+
+        // Nulls belong to the run before them, or the first run
+        unsigned n = 0;
+        for (unsigned i = 0; i < chunk->nrows; ++i) {
+            if (!tr_colchunk_null(chunk, i)) {
+                int64_t v = tr_column_load(column->type, chunk->values, i).i;
+                if (n == 0 || v != runs[n - 1].value) {
+                    if (n > 0) {
+                        runs[n - 1].end = i;
+                    }
+                    runs[n++].value = v;
+                }
+            }
+        }
+        runs[n - 1].end = chunk->nrows;
+
+        tr_free(chunk->values);
+        chunk->values = NULL;
+        chunk->runs = runs;
+        chunk->nruns = nruns;
+        break;
+    }
+
+    case trcolenc_packed:
+    case trcolenc_dict: {
+        unsigned codewidth = encoding == trcolenc_dict ? tr_column_codewidth(ndict - 1) : packwidth;
+        void *codes = tr_alloc_aligned(tr_colchunk_rows * codewidth, tr_colchunk_align, column->tag);
+        if (codes == NULL) {
+            if (dict != NULL) {
+                tr_free(dict);
+            }
+            return;
+        }
+        memset(codes, 0, tr_colchunk_rows * codewidth);
+
+        for (unsigned i = 0; i < chunk->nrows; ++i) {
+            if (!tr_colchunk_null(chunk, i)) {
+                int64_t v = tr_column_load(column->type, chunk->values, i).i;
+                uint32_t code = encoding == trcolenc_dict ?
+                    tr_column_lookup(dict, ndict, v) : (uint64_t)v - (uint64_t)chunk->min.i;
+                tr_column_setcode(codes, codewidth, i, code);
+            }
+        }
+
+        tr_free(chunk->values);
+        chunk->values = codes;
+        chunk->codewidth = codewidth;
+        chunk->dict = dict;
+        chunk->ndict = ndict;
+        break;
+    }
+    }
+
+    chunk->encoding = encoding;
+}
+
+trstatus tr_column_append(trcolumn *column, const void *values, unsigned count)
+{
+    unsigned width = tr_coltype_width(column->type);
+
+    while (count > 0) {
+        trcolchunk *chunk = tr_column_tail(column);
+        if (chunk == NULL) {
+            return trstatus_no_mem;
+        }
+
+        unsigned n = min(count, tr_colchunk_rows - chunk->nrows);
+        memcpy(ptr_add(chunk->values, chunk->nrows * width), values, n * width);
+
+        // Extend the zone map; a chunk of nothing but nulls has none yet
+        unsigned i = 0;
+        if (chunk->nnulls == chunk->nrows) {
+            chunk->min = chunk->max = tr_column_load(column->type, values, 0);
+            chunk->unordered = column->type == trcol_f64 && isnan(chunk->min.f);
+            i = 1;
+        }
+        for (; i < n; ++i) {
+            trcolvalue v = tr_column_load(column->type, values, i);
+            if (column->type == trcol_f64 && isnan(v.f)) {
+                chunk->unordered = true;
+            } else if (tr_column_less(column->type, v, chunk->min)) {
+                chunk->min = v;
+            }
+            if (tr_column_less(column->type, chunk->max, v)) {
+                chunk->max = v;
+            }
+        }
+
+        chunk->nrows += n;
+        column->nrows += n;
+        values = ptr_add(values, n * width);
+        count -= n;
+
+        if (chunk->nrows == tr_colchunk_rows) {
+            tr_column_seal(column, chunk);
+        }
+    }
+
+    return trstatus_ok;
+}
+
+trstatus tr_column_append_null(trcolumn *column)
+{
+    trcolchunk *chunk = tr_column_tail(column);
+    if (chunk == NULL) {
+        return trstatus_no_mem;
+    }
+
+    if (chunk->nulls == NULL) {
+        chunk->nulls = tr_alloc_aligned(tr_colchunk_rows / 8, tr_colchunk_align, column->tag);
+        if (chunk->nulls == NULL) {
+            return trstatus_no_mem;
+        }
+        memset(chunk->nulls, 0, tr_colchunk_rows / 8);
+    }
+
+    chunk->nulls[chunk->nrows / 64] |= 1ull << (chunk->nrows % 64);
+    chunk->nrows++;
+    chunk->nnulls++;
+    column->nrows++;
+
+    if (chunk->nrows == tr_colchunk_rows) {
+        tr_column_seal(column, chunk);
+    }
+    return trstatus_ok;
+}
+
+void tr_column_truncate(trcolumn *column, uint64_t nrows)
+{
+    tr_assert(nrows <= column->nrows);
+
+    unsigned keep = (nrows + tr_colchunk_rows - 1) / tr_colchunk_rows;
+    while (column->nchunks > keep) {
+        tr_column_free_chunk(column->chunks + --column->nchunks);
+    }
+    column->nrows = nrows;
+    if (keep == 0) {
+        return;
+    }
+
+    // Trim the last chunk in place. Its zone map may now be wider than its
+    // values, which is harmless, and an encoded chunk stays encoded until
+    // something is appended to it.
+    trcolchunk *chunk = column->chunks + keep - 1;
+    unsigned n = nrows - (uint64_t)(keep - 1) * tr_colchunk_rows;
+    unsigned width = tr_coltype_width(column->type);
+
+    for (unsigned i = n; i < chunk->nrows && chunk->nnulls != 0; ++i) {
+        if (tr_colchunk_null(chunk, i)) {
+            chunk->nulls[i / 64] &= ~(1ull << (i % 64));
+            chunk->nnulls--;
+        }
+    }
+
+    switch (chunk->encoding) {
+    case trcolenc_plain:
+        memset(ptr_add(chunk->values, n * width), 0, (chunk->nrows - n) * width);
+        break;
+    case trcolenc_packed:
+    case trcolenc_dict:
+        memset(ptr_add(chunk->values, n * chunk->codewidth), 0, (chunk->nrows - n) * chunk->codewidth);
+        break;
+    case trcolenc_runs:
+        while (chunk->nruns > 1 && chunk->runs[chunk->nruns - 2].end >= n) {
+            chunk->nruns--;
+        }
+        chunk->runs[chunk->nruns - 1].end = n;
+        break;
+    }
+
+    chunk->nrows = n;
+}
+
+bool tr_column_get(const trcolumn *column, uint64_t row, trcolvalue *value)
+{
+    tr_assert(row < column->nrows);
+
+    const trcolchunk *chunk = column->chunks + row / tr_colchunk_rows;
+    unsigned index = row % tr_colchunk_rows;
+    if (tr_colchunk_null(chunk, index)) {
+        return false;
+    }
+
+    switch (chunk->encoding) {
+    case trcolenc_plain:
+        *value = tr_column_load(column->type, chunk->values, index);
+        break;
+    case trcolenc_packed:
+        value->i = (uint64_t)chunk->min.i + tr_column_code(chunk->values, chunk->codewidth, index);
+        break;
+    case trcolenc_dict:
+        value->i = chunk->dict[tr_column_code(chunk->values, chunk->codewidth, index)];
+        break;
+    case trcolenc_runs: {
+        unsigned lo = 0;
+        unsigned hi = chunk->nruns - 1;
+        while (lo < hi) {
+            unsigned mid = (lo + hi) / 2;
+            if (chunk->runs[mid].end <= index) {
+                lo = mid + 1;
+            } else {
+                hi = mid;
+            }
+        }
+        value->i = chunk->runs[lo].value;
+        break;
+    }
+    }
+
+    return true;
+}
+
+// Decodes a chunk's packed or dictionary codes [index, index + count) of
+// one width into values of one width
+#define tr_column_decode_codes(vtype, ctype) \
+    do { \
+        const ctype *c = (const ctype *)chunk->values + index; \
+        vtype *v = values; \
+        if (chunk->encoding == trcolenc_packed) { \
+            uint64_t base = chunk->min.i; \
+            for (unsigned i = 0; i < count; ++i) { \
+                v[i] = (vtype)(base + c[i]); \
+            } \
+        } else { \
+            for (unsigned i = 0; i < count; ++i) { \
+                v[i] = (vtype)chunk->dict[c[i]]; \
+            } \
+        } \
+    } while (0)
+
+// Decodes rows [index, index + count) of a chunk, nulls aside
+static void tr_column_decode(trcoltype type, const trcolchunk *chunk, unsigned index, unsigned count,
+        void *values)
+{
+    unsigned width = tr_coltype_width(type);
+
+    switch (chunk->encoding) {
+    case trcolenc_plain:
+        memcpy(values, ptr_add(chunk->values, index * width), count * width);
+        break;
+    case trcolenc_packed:
+    case trcolenc_dict:
+        switch (chunk->codewidth * 8 + width) {
+        case 1 * 8 + 4: tr_column_decode_codes(int32_t, uint8_t); break;
+        case 2 * 8 + 4: tr_column_decode_codes(int32_t, uint16_t); break;
+        case 4 * 8 + 4: tr_column_decode_codes(int32_t, uint32_t); break;
+        case 1 * 8 + 8: tr_column_decode_codes(int64_t, uint8_t); break;
+        case 2 * 8 + 8: tr_column_decode_codes(int64_t, uint16_t); break;
+        default: tr_column_decode_codes(int64_t, uint32_t); break;
+        }
+        break;
+    case trcolenc_runs: {
+        unsigned lo = 0;
+        unsigned hi = chunk->nruns - 1;
+        while (lo < hi) {
+            unsigned mid = (lo + hi) / 2;
+            if (chunk->runs[mid].end <= index) {
+                lo = mid + 1;
+            } else {
+                hi = mid;
+            }
+        }
+
+        // Fill a run at a time
+        for (unsigned i = 0; i < count; ++lo) {
+            unsigned n = min(chunk->runs[lo].end - index, count) - i;
+            int64_t value = chunk->runs[lo].value;
+            for (unsigned end = i + n; i < end; ++i) {
+                if (width == 4) {
+                    ((int32_t *)values)[i] = (int32_t)value;
+                } else {
+                    ((int64_t *)values)[i] = value;
+                }
+            }
+        }
+        break;
+    }
+    }
+}
+
+#undef tr_column_decode_codes
+
+unsigned tr_column_read(const trcolumn *column, uint64_t row, unsigned count,
+        void *values, uint64_t *nulls)
+{
+    tr_assert(row + count <= column->nrows);
+
+    unsigned width = tr_coltype_width(column->type);
+    unsigned nnulls = 0;
+    if (nulls != NULL) {
+        memset(nulls, 0, (count + 63) / 64 * sizeof(uint64_t));
+    }
+
+    for (unsigned done = 0; done < count;) {
+        const trcolchunk *chunk = column->chunks + (row + done) / tr_colchunk_rows;
+        unsigned index = (row + done) % tr_colchunk_rows;
+        unsigned n = min(count - done, tr_colchunk_rows - index);
+        void *out = ptr_add(values, done * width);
+        tr_column_decode(column->type, chunk, index, n, out);
+
+        // Encoded chunks don't keep zero in null slots
+        if (chunk->nnulls != 0) {
+            for (unsigned i = 0; i < n; ++i) {
+                if (tr_colchunk_null(chunk, index + i)) {
+                    memset(ptr_add(out, i * width), 0, width);
+                    if (nulls != NULL) {
+                        nulls[(done + i) / 64] |= 1ull << (done + i) % 64;
+                    }
+                    nnulls++;
+                }
+            }
+        }
+        done += n;
+    }
+
+    return nnulls;
+}
+
+size_t tr_column_size(const trcolumn *column)
+{
+    size_t size = 0;
+    for (unsigned i = 0; i < column->nchunks; ++i) {
+        const trcolchunk *chunk = column->chunks + i;
+        switch (chunk->encoding) {
+        case trcolenc_plain:
+            size += tr_colchunk_rows * tr_coltype_width(column->type);
+            break;
+        case trcolenc_packed:
+            size += tr_colchunk_rows * chunk->codewidth;
+            break;
+        case trcolenc_dict:
+            size += tr_colchunk_rows * chunk->codewidth + chunk->ndict * sizeof(int64_t);
+            break;
+        case trcolenc_runs:
+            size += chunk->nruns * sizeof(trcolrun);
+            break;
+        }
+    }
+
+    return size;
+}
@@ -0,0 +1,161 @@
+//////////////////////////////////////////////////////////////////////////////
+//
+// Terrascale
+// Copyright (c) Dave Kilian & Emily Kilian 2023. All rights reserved.
+//
+// column.h - columnar storage
+//
+// A column stores one field of many rows contiguously, so scans which read
+// a few fields of many rows touch only the memory for those fields, and
+// filters can compare many values per instruction (see colpred.h).
+//
+// Columns are split into chunks of tr_colchunk_rows rows. Each chunk has:
+//
+// - Its values, packed at their natural width in a 64-byte aligned buffer
+//   sized for a whole chunk. Slots past the last row, and the slots of null
+//   rows, hold zero, so kernels can always process whole 64-row words.
+//
+// - A null bitmap (bit i set if row i is null), allocated only once the
+//   chunk has a null in it.
+//
+// - A zone map: the minimum and maximum non-null value in the chunk, so a
+//   filter can skip chunks in which nothing (or everything) can match. NaNs
+//   can't be ordered, so chunks holding them are always scanned.
+//
+// Rows are only ever appended, or truncated away to undo an append that
+// failed part way. Once an integer chunk is full it's sealed, and
+// re-encoded in whichever of these takes the least memory:
+//
+// - Plain: values at their natural width, as above.
+//
+// - Packed: each value minus the chunk's minimum, in 1, 2 or 4 bytes, for
+//   chunks whose values span a narrow range.
+//
+// - Dictionary: the chunk's distinct values, sorted, and a 1 or 2 byte code
+//   per row indexing them, for chunks with few distinct values spread
+//   widely. Sorting keeps codes in value order, so a range of values is a
+//   range of codes.
+//
+// - Runs: a value and the row where it stops repeating, for chunks with
+//   long runs of the same value. Null rows continue the run around them.
+//
+// Filters work on encoded chunks directly (see colpred.h), so they read 1
+// or 2 bytes per row rather than 4 or 8. Doubles aren't encoded.
+//
+//////////////////////////////////////////////////////////////////////////////
+
+#pragma once
+
+// Rows in a column chunk (a multiple of 64)
+#define tr_colchunk_rows 16384
+
+// Alignment of chunk buffers
+#define tr_colchunk_align 64
+
+// Types of column values
+typedef enum {
+
+    trcol_i32,          // 32-bit signed integers
+    trcol_i64,          // 64-bit signed integers
+    trcol_f64,          // Doubles
+
+} trcoltype;
+
+// A single value of any column type. 32-bit values are widened.
+typedef union {
+
+    int64_t i;
+    double f;
+
+} trcolvalue;
+
+// Encodings of column chunks
+typedef enum {
+
+    trcolenc_plain,     // Values
+    trcolenc_packed,    // Values less the minimum
+    trcolenc_dict,      // Codes into a dictionary
+    trcolenc_runs,      // Runs of equal values
+
+} trcolenc;
+
+// A run of equal values in a chunk
+typedef struct {
+
+    int64_t value;          // The value
+    uint32_t end;           // Row after the run's last
+
+} trcolrun;
+
+// A chunk of a column
+typedef struct {
+
+    trcolenc encoding;      // How values are stored
+    void *values;           // Values, or codes for packed and dictionary
+                            // chunks, tr_colchunk_rows of them
+    unsigned codewidth;     // Bytes per code
+    int64_t *dict;          // Sorted distinct values of dictionary chunks
+    unsigned ndict;
+    trcolrun *runs;         // Runs, in order, of run-encoded chunks
+    unsigned nruns;
+    uint64_t *nulls;        // Null bitmap, or NULL if there are no nulls
+    unsigned nrows;         // Rows in the chunk
+    unsigned nnulls;        // Null rows in the chunk
+    trcolvalue min;         // Zone map: least and greatest non-null values,
+    trcolvalue max;         // valid if nnulls < nrows
+    bool unordered;         // Whether there's a NaN, which the zone map omits
+
+} trcolchunk;
+
+// A column
+typedef struct {
+
+    trcoltype type;         // Type of the values
+    trcolchunk *chunks;     // The chunks
+    unsigned nchunks;       // Chunks in use
+    unsigned capacity;      // Chunks allocated
+    uint64_t nrows;         // Rows in the column
+    bool encode;            // Whether to encode full chunks (the default)
+    tralloctag tag;         // Tag for allocations
+
+} trcolumn;
+
+// Gets the size of one value of a type
+static inline unsigned tr_coltype_width(trcoltype type)
+{
+    return type == trcol_i32 ? 4 : 8;
+}
+
+// Initializes an empty column
+void tr_column_initialize(trcolumn *column, trcoltype type, tralloctag tag);
+
+// Frees the column's chunks
+void tr_column_cleanup(trcolumn *column);
+
+// Appends `count` values, read at the column's width
+trstatus tr_column_append(trcolumn *column, const void *values, unsigned count);
+
+// Appends a null
+trstatus tr_column_append_null(trcolumn *column);
+
+// Removes every row from `nrows` on. Never fails.
+void tr_column_truncate(trcolumn *column, uint64_t nrows);
+
+// Reads a row's value, widened to a trcolvalue. Returns false if it's null.
+bool tr_column_get(const trcolumn *column, uint64_t row, trcolvalue *value);
+
+// Decodes rows [row, row + count) into `values`, at the column's width,
+// with null rows as zero. If `nulls` isn't NULL, it's set to a bitmap of
+// the null rows ((count + 63) / 64 words). Returns the number of nulls.
+//
+unsigned tr_column_read(const trcolumn *column, uint64_t row, unsigned count,
+        void *values, uint64_t *nulls);
+
+// Gets the memory used by the column's values, null bitmaps aside
+size_t tr_column_size(const trcolumn *column);
+
+// Indicates whether a row is null
+static inline bool tr_colchunk_null(const trcolchunk *chunk, unsigned row)
+{
+    return chunk->nulls != NULL && (chunk->nulls[row / 64] >> (row % 64) & 1) != 0;
+}
@@ -0,0 +1,576 @@
+//////////////////////////////////////////////////////////////////////////////
+//
+// Terrascale
+// Copyright (c) Dave Kilian & Emily Kilian 2023. All rights reserved.
+//
+//////////////////////////////////////////////////////////////////////////////
+
+#include <pch.h>
+#include <table/load.h>
+
+#include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+struct _trloader;
+
+// One column's values parsed from a piece
+typedef struct {
+
+    void *values;           // Values, at the column's width
+    uint8_t *nulls;         // Nonzero for null rows, or NULL if there are none
+
+} trloadfield;
+
+// A piece of the input, parsed by its own task
+typedef struct {
+
+    trtask task;                    // Parses the piece
+    struct _trloader *loader;       // Owning load
+    unsigned index;                 // Position in the input
+    trloadfield *fields;            // Parsed values, one per column
+    unsigned nrows;                 // Rows parsed
+    unsigned capacity;              // Rows the fields have room for
+    size_t nbytes;                  // Bytes of input covered
+    trstatus status;                // Result of parsing
+    bool ready;                     // Whether parsing is finished
+
+} trloadpiece;
+
+// A load in progress
+typedef struct _trloader {
+
+    const trloadconfig *config;     // Options
+    const char *data;               // Input
+    size_t size;
+    trcolumn *columns;              // Columns to append to
+    unsigned ncolumns;
+    unsigned recordsize;            // Bytes per binary record
+    trloadpiece *pieces;            // Pieces of the input
+    unsigned npieces;
+    _Atomic unsigned firstbad;      // Earliest piece which failed to parse
+
+    pthread_mutex_t lock;           // Protects the pieces' ready flags and
+                                    // statuses, and the next four fields
+    pthread_cond_t done;            // Signaled as tasks finish
+    unsigned nextpiece;             // Next piece to append
+    unsigned nfinished;             // Tasks finished
+    bool appending;                 // Whether some task is appending pieces
+    trstatus status;                // First failure (appending task only)
+    trtime start;                   // When loading began
+    trloadstat stat;                // Progress (appending task only)
+
+} trloader;
+
+void tr_load_defaults(trloadconfig *config, trloadformat format)
+{
+    config->format = format;
+    config->delimiter = ',';
+    config->header = false;
+    config->piecesize = 4 * 1024 * 1024;
+    config->progress = NULL;
+    config->context = NULL;
+    config->tag = 'load';
+}
+
+// Finds where a piece starts. Every piece but the first starts just after
+// the first record boundary at or after its nominal start.
+//
+static size_t tr_load_boundary(trloader *loader, unsigned index)
+{
+    if (index >= loader->npieces) {
+        return loader->size;
+    }
+
+    size_t nominal = (size_t)index * loader->config->piecesize;
+
+    if (loader->config->format == trload_binary) {
+        size_t n = loader->recordsize;
+        return min((nominal + n - 1) / n * n, loader->size);
+    }
+
+    if (index == 0) {
+        if (!loader->config->header) {
+            return 0;
+        }
+        nominal = 1;
+    }
+
+    const char *nl = memchr(loader->data + nominal - 1, '\n', loader->size - (nominal - 1));
+    return nl != NULL ? (size_t)(nl - loader->data) + 1 : loader->size;
+}
+
+// Makes room for another row in a piece's fields
+static trstatus tr_load_grow(trloader *loader, trloadpiece *piece)
+{
+    if (piece->nrows < piece->capacity) {
+        return trstatus_ok;
+    }
+
+    unsigned capacity = max(piece->capacity * 2, 4096u);
+    for (unsigned c = 0; c < loader->ncolumns; ++c) {
+        trloadfield *field = piece->fields + c;
+        unsigned width = tr_coltype_width(loader->columns[c].type);
+
+        void *values = tr_alloc(capacity * width, loader->config->tag);
+        if (values == NULL) {
+            return trstatus_no_mem;
+        }
+        if (field->values != NULL) {
+            memcpy(values, field->values, piece->nrows * width);
+            tr_free(field->values);
+        }
+        field->values = values;
+
+        if (field->nulls != NULL) {
+            uint8_t *nulls = tr_alloc(capacity, loader->config->tag);
+            if (nulls == NULL) {
+                return trstatus_no_mem;
+            }
+            memcpy(nulls, field->nulls, piece->nrows);
+            memset(nulls + piece->nrows, 0, capacity - piece->nrows);
+            tr_free(field->nulls);
+            field->nulls = nulls;
+        }
+    }
+
+    piece->capacity = capacity;
+    return trstatus_ok;
+}
+
+// Parses a decimal integer making up all of [p, end)
+static bool tr_load_int(const char *p, const char *end, int64_t *value)
+{
+    bool negative = false;
+    if (p < end && (*p == '-' || *p == '+')) {
+        negative = *p++ == '-';
+    }
+    if (p == end) {
+        return false;
+    }
+
+    uint64_t v = 0;
+    for (; p < end; ++p) {
+        unsigned digit = (unsigned char)*p - '0';
+        if (digit > 9 || v > (UINT64_MAX - digit) / 10) {
+            return false;
+        }
+        v = v * 10 + digit;
+    }
+
+    if (v > (uint64_t)INT64_MAX + negative) {
+        return false;
+    }
+    *value = negative ? (int64_t)(0 - v) : (int64_t)v;
+    return true;
+}
+
+// Parses a decimal floating point number making up all of [p, end). Like
+// tr_load_int, this takes no spaces, and strtod's "inf", "nan" and hex
+// forms aren't numbers here.
+//
+static bool tr_load_double(const char *p, const char *end, double *value)
+{
+    char text[64];
+    size_t n = end - p;
+    if (n >= sizeof(text)) {
+        return false;
+    }
+
+    const char *digits = p < end && (*p == '-' || *p == '+') ? p + 1 : p;
+    if (digits == end || (*digits != '.' && !isdigit((unsigned char)*digits))) {
+        return false;
+    }
+    for (const char *q = digits; q < end; ++q) {
+        if (!isdigit((unsigned char)*q) && strchr(".eE+-", *q) == NULL) {
+            return false;
+        }
+    }
+    memcpy(text, p, n);
+    text[n] = '\0';
+
+    char *stop;
+    *value = strtod(text, &stop);
+    return stop == text + n;
+}
+
+// Parses one field of the row being added to a piece
+static trstatus tr_load_field(trloader *loader, trloadpiece *piece, unsigned c, const char *p, const char *end)
+{
+    trloadfield *field = piece->fields + c;
+    void *slot = ptr_add(field->values, piece->nrows * tr_coltype_width(loader->columns[c].type));
+
+    if (p == end) {
+        if (field->nulls == NULL) {
+            field->nulls = tr_alloc(piece->capacity, loader->config->tag);
+            if (field->nulls == NULL) {
+                return trstatus_no_mem;
+            }
+            memset(field->nulls, 0, piece->capacity);
+        }
+        field->nulls[piece->nrows] = 1;
+        memset(slot, 0, tr_coltype_width(loader->columns[c].type));
+        return trstatus_ok;
+    }
+
+    int64_t i;
+    switch (loader->columns[c].type) {
+    case trcol_i32:
+        if (!tr_load_int(p, end, &i) || i < INT32_MIN || i > INT32_MAX) {
+            return trstatus_parse;
+        }
+        *(int32_t *)slot = i;
+        break;
+    case trcol_i64:
+        if (!tr_load_int(p, end, &i)) {
+            return trstatus_parse;
+        }
+        *(int64_t *)slot = i;
+        break;
+    case trcol_f64:
+        if (!tr_load_double(p, end, slot)) {
+            return trstatus_parse;
+        }
+        break;
+    }
+
+    return trstatus_ok;
+}
+
+// Parses the lines of a CSV piece
+static trstatus tr_load_csv(trloader *loader, trloadpiece *piece, const char *p, const char *end)
+{
+    char delimiter = loader->config->delimiter;
+
+    while (p < end) {
+        const char *nl = memchr(p, '\n', end - p);
+        const char *next = nl != NULL ? nl + 1 : end;
+        const char *line = nl != NULL ? nl : end;
+        if (line > p && line[-1] == '\r') {
+            line--;
+        }
+
+        // Blank lines hold no record, except that with a single column
+        // they're a record whose one field is null
+        if (line == p && loader->ncolumns > 1) {
+            p = next;
+            continue;
+        }
+
+        trstatus status = tr_load_grow(loader, piece);
+        if (!tr_ok(status)) {
+            return status;
+        }
+
+        for (unsigned c = 0; c < loader->ncolumns; ++c) {
+            const char *stop = memchr(p, delimiter, line - p);
+            if (stop == NULL) {
+                stop = line;
+            }
+            if ((stop == line) != (c == loader->ncolumns - 1)) {
+                return trstatus_parse;
+            }
+
+            status = tr_load_field(loader, piece, c, p, stop);
+            if (!tr_ok(status)) {
+                return status;
+            }
+            p = stop + 1;
+        }
+
+        piece->nrows++;
+        p = next;
+    }
+
+    return trstatus_ok;
+}
+
+// Splits the records of a binary piece into columns
+static trstatus tr_load_binary(trloader *loader, trloadpiece *piece, const char *p, const char *end)
+{
+    unsigned nrows = (end - p) / loader->recordsize;
+    if (nrows == 0) {
+        return trstatus_ok;
+    }
+
+    for (unsigned c = 0; c < loader->ncolumns; ++c) {
+        piece->fields[c].values = tr_alloc(nrows * tr_coltype_width(loader->columns[c].type), loader->config->tag);
+        if (piece->fields[c].values == NULL) {
+            return trstatus_no_mem;
+        }
+    }
+
+    unsigned offset = 0;
+    for (unsigned c = 0; c < loader->ncolumns; ++c) {
+        const char *src = p + offset;
+        void *dst = piece->fields[c].values;
+
+        if (tr_coltype_width(loader->columns[c].type) == 4) {
+            for (unsigned r = 0; r < nrows; ++r, src += loader->recordsize) {
+                memcpy((uint32_t *)dst + r, src, 4);
+            }
+            offset += 4;
+        } else {
+            for (unsigned r = 0; r < nrows; ++r, src += loader->recordsize) {
+                memcpy((uint64_t *)dst + r, src, 8);
+            }
+            offset += 8;
+        }
+    }
+
+    piece->nrows = nrows;
+    return trstatus_ok;
+}
+
+// Appends a parsed piece to the columns. If that fails, the rows appended
+// so far are taken back out, so every column still ends at the same row.
+//
+static trstatus tr_load_append(trloader *loader, trloadpiece *piece)
+{
+    for (unsigned c = 0; c < loader->ncolumns && piece->nrows > 0; ++c) {
+        trcolumn *column = loader->columns + c;
+        trloadfield *field = piece->fields + c;
+        unsigned width = tr_coltype_width(column->type);
+        uint64_t before = column->nrows;
+
+        // Runs of non-null values go in whole
+        unsigned r = 0;
+        while (r < piece->nrows) {
+            unsigned n = 0;
+            while (r + n < piece->nrows && (field->nulls == NULL || field->nulls[r + n] == 0)) {
+                n++;
+            }
+
+            trstatus status = n > 0 ?
+                tr_column_append(column, ptr_add(field->values, r * width), n) :
+                tr_column_append_null(column);
+            if (!tr_ok(status)) {
+                tr_column_truncate(column, before);
+                for (unsigned d = 0; d < c; ++d) {
+                    tr_column_truncate(loader->columns + d, loader->columns[d].nrows - piece->nrows);
+                }
+                return status;
+            }
+            r += max(n, 1u);
+        }
+    }
+
+    return trstatus_ok;
+}
+
+static void tr_load_free(trloader *loader, trloadpiece *piece)
+{
+    if (piece->fields == NULL) {
+        return;
+    }
+
+    for (unsigned c = 0; c < loader->ncolumns; ++c) {
+        if (piece->fields[c].values != NULL) {
+            tr_free(piece->fields[c].values);
+        }
+        if (piece->fields[c].nulls != NULL) {
+            tr_free(piece->fields[c].nulls);
+        }
+    }
+
+    tr_free(piece->fields);
+    piece->fields = NULL;
+}
+
+// Parses a piece, unless an earlier one has already failed
+static trstatus tr_load_parse(trloader *loader, trloadpiece *piece)
+{
+    size_t start = tr_load_boundary(loader, piece->index);
+    size_t end = max(start, tr_load_boundary(loader, piece->index + 1));
+    piece->nbytes = end - start;
+
+    if (atomic_load(&loader->firstbad) < piece->index) {
+        return trstatus_ok;
+    }
+
+    piece->fields = tr_alloc(loader->ncolumns * sizeof(trloadfield), loader->config->tag);
+    if (piece->fields == NULL) {
+        return trstatus_no_mem;
+    }
+    memset(piece->fields, 0, loader->ncolumns * sizeof(trloadfield));
+
+    const char *p = loader->data + start;
+    return loader->config->format == trload_csv ?
+        tr_load_csv(loader, piece, p, loader->data + end) :
+        tr_load_binary(loader, piece, p, loader->data + end);
+}
+
+// Brings the elapsed time and rate up to date
+static void tr_load_elapsed(trloader *loader)
+{
+    loader->stat.elapsed = tr_clock_now() - loader->start;
+    loader->stat.rate = loader->stat.elapsed > 0 ?
+        loader->stat.nrows / tr_clock_seconds(loader->stat.elapsed) : 0;
+}
+
+static trstatus tr_load_run(trtask *task)
+{
+    trloadpiece *piece = task->context;
+    trloader *loader = piece->loader;
+
+    trstatus status = tr_load_parse(loader, piece);
+    if (!tr_ok(status)) {
+        unsigned bad = atomic_load(&loader->firstbad);
+        while (piece->index < bad && !atomic_compare_exchange_weak(&loader->firstbad, &bad, piece->index)) {
+        }
+    }
+
+    // Append this piece, and those after it which are waiting on it, unless
+    // another task is already appending; that task will get to this piece.
+    // Appending happens outside the lock, so finishing pieces never hold up
+    // the workers parsing others.
+    pthread_mutex_lock(&loader->lock);
+    piece->status = status;
+    piece->ready = true;
+    if (loader->appending) {
+        pthread_mutex_unlock(&loader->lock);
+        return trstatus_ok;
+    }
+    loader->appending = true;
+
+    while (loader->nextpiece < loader->npieces && loader->pieces[loader->nextpiece].ready) {
+        trloadpiece *next = loader->pieces + loader->nextpiece++;
+        pthread_mutex_unlock(&loader->lock);
+
+        if (tr_ok(loader->status)) {
+            loader->status = tr_ok(next->status) ? tr_load_append(loader, next) : next->status;
+        }
+        if (tr_ok(loader->status)) {
+            loader->stat.ndone += next->nbytes;
+            loader->stat.nrows += next->nrows;
+            tr_load_elapsed(loader);
+            if (loader->config->progress != NULL) {
+                loader->config->progress(&loader->stat, loader->config->context);
+            }
+        }
+
+        tr_load_free(loader, next);
+        pthread_mutex_lock(&loader->lock);
+    }
+
+    loader->appending = false;
+    pthread_mutex_unlock(&loader->lock);
+    return trstatus_ok;
+}
+
+static void tr_load_done(trtask *task, trstatus status)
+{
+    trloadpiece *piece = task->context;
+    trloader *loader = piece->loader;
+
+    (void)status;
+    pthread_mutex_lock(&loader->lock);
+    loader->nfinished++;
+    pthread_cond_signal(&loader->done);
+    pthread_mutex_unlock(&loader->lock);
+}
+
+trstatus tr_load_buffer(trtaskman *tm, const trloadconfig *config, const void *data, size_t size,
+        trcolumn *columns, unsigned ncolumns, trloadstat *stat)
+{
+    if (ncolumns == 0 || config->piecesize == 0) {
+        return trstatus_argument;
+    }
+
+    trloader loader = {
+        .config = config,
+        .data = data,
+        .size = size,
+        .columns = columns,
+        .ncolumns = ncolumns,
+        .firstbad = UINT32_MAX,
+        .status = trstatus_ok,
+        .start = tr_clock_now(),
+        .stat = { .nbytes = size },
+    };
+
+    for (unsigned c = 0; c < ncolumns; ++c) {
+        loader.recordsize += tr_coltype_width(columns[c].type);
+    }
+    if (config->format == trload_binary && size % loader.recordsize != 0) {
+        return trstatus_parse;
+    }
+
+    loader.npieces = (size + config->piecesize - 1) / config->piecesize;
+    loader.stat.npieces = loader.npieces;
+    if (loader.npieces > 0) {
+        loader.pieces = tr_alloc(loader.npieces * sizeof(trloadpiece), config->tag);
+        if (loader.pieces == NULL) {
+            return trstatus_no_mem;
+        }
+        memset(loader.pieces, 0, loader.npieces * sizeof(trloadpiece));
+    }
+
+    pthread_mutex_init(&loader.lock, NULL);
+    pthread_cond_init(&loader.done, NULL);
+
+    for (unsigned i = 0; i < loader.npieces; ++i) {
+        trloadpiece *piece = loader.pieces + i;
+        piece->loader = &loader;
+        piece->index = i;
+        tr_task_initialize(&piece->task, tr_load_run, piece);
+        piece->task.done = tr_load_done;
+        tr_taskman_submit(tm, &piece->task);
+    }
+
+    pthread_mutex_lock(&loader.lock);
+    while (loader.nfinished < loader.npieces) {
+        pthread_cond_wait(&loader.done, &loader.lock);
+    }
+    pthread_mutex_unlock(&loader.lock);
+
+    pthread_cond_destroy(&loader.done);
+    pthread_mutex_destroy(&loader.lock);
+    if (loader.pieces != NULL) {
+        tr_free(loader.pieces);
+    }
+
+    tr_load_elapsed(&loader);
+    if (stat != NULL) {
+        *stat = loader.stat;
+    }
+    return loader.status;
+}
+
+trstatus tr_load_file(trtaskman *tm, const trloadconfig *config, const char *path,
+        trcolumn *columns, unsigned ncolumns, trloadstat *stat)
+{
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return tr_status_from_errno();
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+        trstatus status = tr_status_from_errno();
+        close(fd);
+        return status;
+    }
+
+    void *data = NULL;
+    if (st.st_size > 0) {
+        data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (data == MAP_FAILED) {
+            trstatus status = tr_status_from_errno();
+            close(fd);
+            return status;
+        }
+        madvise(data, st.st_size, MADV_SEQUENTIAL);
+    }
+    close(fd);
+
+    trstatus status = tr_load_buffer(tm, config, data, st.st_size, columns, ncolumns, stat);
+
+    if (data != NULL) {
+        munmap(data, st.st_size);
+    }
+    return status;
+}
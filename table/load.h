@@ -0,0 +1,98 @@
+//////////////////////////////////////////////////////////////////////////////
+//
+// Terrascale
+// Copyright (c) Dave Kilian & Emily Kilian 2023. All rights reserved.
+//
+// load.h - parallel bulk loading into columns
+//
+// Bulk loading appends a whole file of records to a set of columns (see
+// column.h), one column per field, without going through transactions.
+//
+// The input is mapped into memory and cut into pieces of roughly
+// config.piecesize bytes. Each piece is parsed by its own task on a task
+// manager, into buffers of its own, so pieces are parsed in parallel. Each
+// piece finds its own boundaries: it starts just after the first record
+// separator at or after its nominal start, and runs up to where the next
+// piece starts, so a record split across two nominal pieces belongs to the
+// first.
+//
+// Parsed pieces are appended to the columns strictly in file order: the
+// task finishing a piece appends it, and any pieces after it which are
+// already parsed, as long as every piece before it has been appended and no
+// other task is busy appending. Appending takes no lock, so other workers
+// keep parsing meanwhile. The columns seal (and encode) chunks as they fill.
+//
+// Two formats are supported:
+//
+// - trload_csv: one record per line, fields separated by config.delimiter.
+//   Fields are decimal numbers, optionally signed, with no spaces or
+//   quoting; an empty field is null. Lines may end with "\r\n". Blank lines
+//   are skipped, unless there's a single column, in which case they're null.
+//
+// - trload_binary: fixed-size records, each field at its column's width,
+//   packed, in host byte order. There are no nulls.
+//
+// Progress can be followed with config.progress, which is called after each
+// piece is appended, one call at a time, from the task which appended it.
+//
+//////////////////////////////////////////////////////////////////////////////
+
+#pragma once
+
+#include <table/column.h>
+#include <taskman/taskman.h>
+
+// Input formats
+typedef enum {
+
+    trload_csv,         // Delimited text
+    trload_binary,      // Packed fixed-size records
+
+} trloadformat;
+
+// Loading progress
+typedef struct {
+
+    uint64_t nbytes;        // Size of the input
+    uint64_t ndone;         // Bytes appended so far
+    uint64_t nrows;         // Rows appended so far
+    unsigned npieces;       // Pieces the input was cut into
+    trtime elapsed;         // Time since loading began
+    double rate;            // Rows appended per second
+
+} trloadstat;
+
+// Called as loading progresses
+typedef void trloadprogressfn(const trloadstat *stat, void *context);
+
+// Loading options
+typedef struct {
+
+    trloadformat format;            // Input format
+    char delimiter;                 // CSV field separator
+    bool header;                    // Whether to skip the first CSV line
+    unsigned piecesize;             // Bytes parsed by each task
+    trloadprogressfn *progress;     // Called after each piece (may be NULL)
+    void *context;                  // Passed to progress
+    tralloctag tag;                 // Tag for parsing buffers
+
+} trloadconfig;
+
+// Fills in reasonable defaults for a format
+void tr_load_defaults(trloadconfig *config, trloadformat format);
+
+// Loads records from memory, appending field i of each to columns[i]. Runs
+// on the task manager's workers and blocks until done, so it must not be
+// called from one of them. `stat` may be NULL.
+//
+// Returns trstatus_parse if the input is malformed (a field isn't a number,
+// a line has the wrong number of fields, or a binary input isn't a whole
+// number of records). On that or any other failure, the columns hold the
+// rows before the first piece which failed, all of them the same number.
+//
+trstatus tr_load_buffer(trtaskman *tm, const trloadconfig *config, const void *data, size_t size,
+        trcolumn *columns, unsigned ncolumns, trloadstat *stat);
+
+// Same as tr_load_buffer, but maps a file for the input
+trstatus tr_load_file(trtaskman *tm, const trloadconfig *config, const char *path,
+        trcolumn *columns, unsigned ncolumns, trloadstat *stat);
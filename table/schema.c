@@ -0,0 +1,191 @@
+//////////////////////////////////////////////////////////////////////////////
+//
+// Terrascale
+// Copyright (c) Dave Kilian & Emily Kilian 2023. All rights reserved.
+//
+//////////////////////////////////////////////////////////////////////////////
+
+#include <pch.h>
+#include <table/schema.h>
+
+// Gets the size of a fixed-width type, which is also its alignment
+static unsigned tr_fieldtype_width(trfieldtype type)
+{
+    switch (type) {
+    case trfield_i8:
+        return 1;
+    case trfield_i16:
+        return 2;
+    case trfield_i32:
+        return 4;
+    case trfield_i64:
+    case trfield_f64:
+        return 8;
+    case trfield_bytes:
+        break;
+    }
+
+    return 0;
+}
+
+trstatus tr_rowlayout_compile(trrowlayout *layout, const trfielddef *defs, unsigned nfields, tralloctag tag)
+{
+    if (nfields == 0) {
+        return trstatus_argument;
+    }
+
+    layout->fields = tr_alloc(nfields * sizeof(trrowfield), tag);
+    if (layout->fields == NULL) {
+        return trstatus_no_mem;
+    }
+    layout->nfields = nfields;
+    layout->nvarlen = 0;
+    layout->tag = tag;
+
+    // Place fixed fields widest first; each width is a multiple of the
+    // next, so every field lands on its natural alignment
+    uint32_t offset = 0;
+    for (unsigned width = 8; width > 0; width /= 2) {
+        for (unsigned i = 0; i < nfields; ++i) {
+            if (tr_fieldtype_width(defs[i].type) == width) {
+                layout->fields[i].offset = offset;
+                offset += width;
+            }
+        }
+    }
+
+    // Then the varlen offset array
+    offset = (offset + 3) & ~3u;
+    layout->varoffsets = offset;
+    for (unsigned i = 0; i < nfields; ++i) {
+        if (defs[i].type == trfield_bytes) {
+            layout->fields[i].offset = offset;
+            offset += sizeof(uint32_t);
+            layout->nvarlen++;
+        }
+    }
+    if (layout->nvarlen > 0) {
+        offset += sizeof(uint32_t);
+    }
+
+    // Then the null bitmap
+    layout->nulls = offset;
+    layout->header = offset + (nfields + 7) / 8;
+
+    for (unsigned i = 0; i < nfields; ++i) {
+        trrowfield *field = layout->fields + i;
+        field->name = defs[i].name;
+        field->type = defs[i].type;
+        field->nulloffset = layout->nulls + i / 8;
+        field->nullmask = 1u << (i % 8);
+    }
+
+    return trstatus_ok;
+}
+
+void tr_rowlayout_cleanup(trrowlayout *layout)
+{
+    tr_free(layout->fields);
+}
+
+const trrowfield *tr_rowlayout_find(const trrowlayout *layout, const char *name)
+{
+    for (unsigned i = 0; i < layout->nfields; ++i) {
+        if (strcmp(layout->fields[i].name, name) == 0) {
+            return layout->fields + i;
+        }
+    }
+
+    return NULL;
+}
+
+size_t tr_row_size(const trrowlayout *layout, const trfieldvalue *values)
+{
+    size_t size = layout->header;
+    for (unsigned i = 0; i < layout->nfields; ++i) {
+        if (layout->fields[i].type == trfield_bytes && !values[i].null) {
+            size += values[i].bytes.size;
+        }
+    }
+
+    return size;
+}
+
+void tr_row_encode(const trrowlayout *layout, const trfieldvalue *values, void *row)
+{
+    memset(row, 0, layout->header);
+
+    uint32_t end = layout->header;
+    for (unsigned i = 0; i < layout->nfields; ++i) {
+        const trrowfield *field = layout->fields + i;
+        const trfieldvalue *value = values + i;
+        void *slot = ptr_add(row, field->offset);
+
+        if (value->null) {
+            *(uint8_t *)ptr_add(row, field->nulloffset) |= field->nullmask;
+            if (field->type == trfield_bytes) {
+                *(uint32_t *)slot = end;
+            }
+            continue;
+        }
+
+        switch (field->type) {
+        case trfield_i8:
+            *(int8_t *)slot = value->i;
+            break;
+        case trfield_i16:
+            *(int16_t *)slot = value->i;
+            break;
+        case trfield_i32:
+            *(int32_t *)slot = value->i;
+            break;
+        case trfield_i64:
+            *(int64_t *)slot = value->i;
+            break;
+        case trfield_f64:
+            *(double *)slot = value->f;
+            break;
+        case trfield_bytes:
+            *(uint32_t *)slot = end;
+            memcpy(ptr_add(row, end), value->bytes.data, value->bytes.size);
+            end += value->bytes.size;
+            break;
+        }
+    }
+
+    // Varlen fields are numbered in schema order, so the entry after the
+    // last one's holds the end of the data
+    if (layout->nvarlen > 0) {
+        *(uint32_t *)ptr_add(row, layout->nulls - sizeof(uint32_t)) = end;
+    }
+}
+
+void tr_row_decode(const trrowlayout *layout, const void *row, trfieldvalue *values)
+{
+    for (unsigned i = 0; i < layout->nfields; ++i) {
+        const trrowfield *field = layout->fields + i;
+        trfieldvalue *value = values + i;
+
+        value->null = tr_row_null(row, field);
+        switch (field->type) {
+        case trfield_i8:
+            value->i = tr_row_i8(row, field);
+            break;
+        case trfield_i16:
+            value->i = tr_row_i16(row, field);
+            break;
+        case trfield_i32:
+            value->i = tr_row_i32(row, field);
+            break;
+        case trfield_i64:
+            value->i = tr_row_i64(row, field);
+            break;
+        case trfield_f64:
+            value->f = tr_row_f64(row, field);
+            break;
+        case trfield_bytes:
+            value->bytes.data = tr_row_bytes(row, field, &value->bytes.size);
+            break;
+        }
+    }
+}
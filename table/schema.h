@@ -0,0 +1,161 @@
+//////////////////////////////////////////////////////////////////////////////
+//
+// Terrascale
+// Copyright (c) Dave Kilian & Emily Kilian 2023. All rights reserved.
+//
+// schema.h - table schemas and compiled row layouts
+//
+// A schema lists a table's fields. Compiling it produces a row layout, which
+// fixes where every field lives in a row so that reading or writing one is a
+// single load or store at a precomputed offset:
+//
+//   +---------------+-------------------------+-------+------------------+
+//   | fixed fields  | varlen offsets          | nulls | varlen data      |
+//   | widest first  | uint32_t[nvarlen + 1]   |       |                  |
+//   +---------------+-------------------------+-------+------------------+
+//
+// - Fixed-width fields are stored inline at their natural alignment, widest
+//   first so there is no padding between them. Rows must be 8-byte aligned.
+//
+// - Variable-length fields are stored back to back after the header. Entry
+//   i of the offset array is where the i'th of them starts, and entry i + 1
+//   where it ends, so finding one takes two adjacent loads rather than a
+//   walk over the fields before it.
+//
+// - The null bitmap holds one bit per field, in schema order. Null fields
+//   read as zero (or as empty).
+//
+// Accessors take the compiled trrowfield for a field, which carries its
+// offsets, so code looks fields up once (tr_rowlayout_find) and then uses
+// the typed inline accessors below on any number of rows.
+//
+//////////////////////////////////////////////////////////////////////////////
+
+#pragma once
+
+// Types of fields
+typedef enum {
+
+    trfield_i8,         // Signed integers
+    trfield_i16,
+    trfield_i32,
+    trfield_i64,
+    trfield_f64,        // Doubles
+    trfield_bytes,      // Variable-length byte strings
+
+} trfieldtype;
+
+// A field in a schema
+typedef struct {
+
+    const char *name;   // Name, which must outlive the layout
+    trfieldtype type;   // Type
+
+} trfielddef;
+
+// A value of any field type, used to build and decode whole rows
+typedef struct {
+
+    bool null;
+    union {
+        int64_t i;
+        double f;
+        struct {
+            const void *data;
+            uint32_t size;
+        } bytes;
+    };
+
+} trfieldvalue;
+
+// A field's place in a compiled layout
+typedef struct {
+
+    const char *name;       // Name
+    trfieldtype type;       // Type
+    uint32_t offset;        // Offset of the value, or for varlen fields of
+                            // its entry in the offset array
+    uint32_t nulloffset;    // Offset of the byte holding the null bit
+    uint8_t nullmask;       // Null bit in that byte
+
+} trrowfield;
+
+// A compiled row layout
+typedef struct {
+
+    trrowfield *fields;     // Fields, in schema order
+    unsigned nfields;       // Number of fields
+    unsigned nvarlen;       // Number of variable-length fields
+    uint32_t varoffsets;    // Offset of the varlen offset array
+    uint32_t nulls;         // Offset of the null bitmap
+    uint32_t header;        // Size of everything before the varlen data
+    tralloctag tag;         // Tag for allocations
+
+} trrowlayout;
+
+// Compiles a schema of `nfields` fields into a row layout
+trstatus tr_rowlayout_compile(trrowlayout *layout, const trfielddef *defs, unsigned nfields, tralloctag tag);
+
+// Frees a row layout
+void tr_rowlayout_cleanup(trrowlayout *layout);
+
+// Looks up a field by name. Returns NULL if there is none.
+const trrowfield *tr_rowlayout_find(const trrowlayout *layout, const char *name);
+
+// Gets the size of a row holding `values` (one per field, in schema order)
+size_t tr_row_size(const trrowlayout *layout, const trfieldvalue *values);
+
+// Writes a row holding `values` into `row`, which must be 8-byte aligned and
+// tr_row_size bytes long
+void tr_row_encode(const trrowlayout *layout, const trfieldvalue *values, void *row);
+
+// Reads every field of a row. Varlen values point into the row.
+void tr_row_decode(const trrowlayout *layout, const void *row, trfieldvalue *values);
+
+// Indicates whether a field of a row is null
+static inline bool tr_row_null(const void *row, const trrowfield *field)
+{
+    return (*(const uint8_t *)ptr_add(row, field->nulloffset) & field->nullmask) != 0;
+}
+
+// Reads fixed-width fields, which must be of the named type
+#define tr_row_getter(suffix, ctype, ftype) \
+    static inline ctype tr_row_##suffix(const void *row, const trrowfield *field) \
+    { \
+        tr_assert(field->type == (ftype)); \
+        return *(const ctype *)ptr_add(row, field->offset); \
+    }
+
+tr_row_getter(i8, int8_t, trfield_i8)
+tr_row_getter(i16, int16_t, trfield_i16)
+tr_row_getter(i32, int32_t, trfield_i32)
+tr_row_getter(i64, int64_t, trfield_i64)
+tr_row_getter(f64, double, trfield_f64)
+
+#undef tr_row_getter
+
+// Writes fixed-width fields in place, clearing their null bits
+#define tr_row_setter(suffix, ctype, ftype) \
+    static inline void tr_row_set_##suffix(void *row, const trrowfield *field, ctype value) \
+    { \
+        tr_assert(field->type == (ftype)); \
+        *(ctype *)ptr_add(row, field->offset) = value; \
+        *(uint8_t *)ptr_add(row, field->nulloffset) &= ~field->nullmask; \
+    }
+
+tr_row_setter(i8, int8_t, trfield_i8)
+tr_row_setter(i16, int16_t, trfield_i16)
+tr_row_setter(i32, int32_t, trfield_i32)
+tr_row_setter(i64, int64_t, trfield_i64)
+tr_row_setter(f64, double, trfield_f64)
+
+#undef tr_row_setter
+
+// Reads a variable-length field, returning its data and storing its size
+static inline const void *tr_row_bytes(const void *row, const trrowfield *field, uint32_t *size)
+{
+    tr_assert(field->type == trfield_bytes);
+    const uint32_t *entry = ptr_add(row, field->offset);
+    *size = entry[1] - entry[0];
+    return ptr_add(row, entry[0]);
+}
@@ -0,0 +1,391 @@
+//////////////////////////////////////////////////////////////////////////////
+//
+// Terrascale
+// Copyright (c) Dave Kilian & Emily Kilian 2023. All rights reserved.
+//
+//////////////////////////////////////////////////////////////////////////////
+
+#include <pch.h>
+#include <taskman/sync.h>
+
+#include <sched.h>
+
+// Lock modes a parked task can be waiting for (trtask.waitmode)
+enum {
+
+    tr_wait_exclusive = 1,
+    tr_wait_shared = 2,
+
+};
+
+// Number of times to spin on a busy guard before yielding the CPU
+#define tr_guard_spins 1024
+
+//
+// Each primitive's bookkeeping is protected by a small spinlock (the guard).
+// Critical sections under the guard are a handful of list operations and
+// never wait on anything, so spinning is cheaper than a pthread mutex and
+// doesn't put the worker thread to sleep.
+//
+
+static void tr_guard_lock(_Atomic bool *guard)
+{
+    int spins = 0;
+    while (atomic_exchange_explicit(guard, true, memory_order_acquire)) {
+        while (atomic_load_explicit(guard, memory_order_relaxed)) {
+            if (++spins >= tr_guard_spins) {
+                sched_yield();
+                spins = 0;
+            }
+        }
+    }
+}
+
+static void tr_guard_unlock(_Atomic bool *guard)
+{
+    atomic_store_explicit(guard, false, memory_order_release);
+}
+
+// Records an acquisition by the given task, including its wait if it had
+// to wait
+//
+static void tr_lock_acquired(trlockstat *stat, trtask *task)
+{
+    stat->nacquire += 1;
+
+    if (task != NULL && task->waitstart != 0) {
+        trtime waited = tr_clock_now() - task->waitstart;
+        stat->ncontended += 1;
+        stat->waittime += waited;
+        stat->maxwait = max(stat->maxwait, waited);
+        task->waitstart = 0;
+    }
+}
+
+// Links a task into a wait list.
+//
+// Tasks retrying after an unfair wakeup go back to the head of the list, so
+// losing a race doesn't also cost the task its place in line.
+//
+static void tr_lock_park(trlist *waiters, trtask *task, unsigned mode)
+{
+    task->waitmode = mode;
+
+    if (task->waitstart != 0) {
+        tr_list_prepend(waiters, &task->entry);
+    } else {
+        task->waitstart = tr_clock_now();
+        tr_list_append(waiters, &task->entry);
+    }
+}
+
+// Hands the lock to a waiter, which finds out when it calls acquire again
+static void tr_lock_grant(trlockstat *stat, trtask *task, trlist *woken)
+{
+    task->granted = true;
+    tr_lock_acquired(stat, task);
+    tr_list_append(woken, &task->entry);
+}
+
+// Consumes a grant made by tr_lock_grant, if there is one
+static bool tr_lock_take_grant(trtask *task)
+{
+    if (task->granted) {
+        task->granted = false;
+        return true;
+    }
+
+    return false;
+}
+
+// Resumes tasks which were removed from a wait list.
+// Called after dropping the guard, since resuming touches run queues.
+//
+static void tr_lock_wake(trlist *woken)
+{
+    trlist *entry;
+    while ((entry = tr_list_rmhead(woken)) != NULL) {
+        tr_task_resume(container_of(entry, trtask, entry));
+    }
+}
+
+static trtask *tr_lock_head(trlist *waiters)
+{
+    return tr_list_empty(waiters)
+        ? NULL
+        : container_of(waiters->next, trtask, entry);
+}
+
+void tr_mutex_initialize(trmutex *m, bool fair)
+{
+    atomic_init(&m->guard, false);
+    m->fair = fair;
+    m->held = false;
+    tr_list_initialize(&m->waiters);
+    memset(&m->stat, 0, sizeof(m->stat));
+}
+
+trstatus tr_mutex_acquire(trmutex *m, trtask *task)
+{
+    tr_guard_lock(&m->guard);
+
+    if (tr_lock_take_grant(task)) {
+        tr_assert(m->held);
+        tr_guard_unlock(&m->guard);
+        return trstatus_ok;
+    }
+
+    if (!m->held && (!m->fair || tr_list_empty(&m->waiters))) {
+        m->held = true;
+        tr_lock_acquired(&m->stat, task);
+        tr_guard_unlock(&m->guard);
+        return trstatus_ok;
+    }
+
+    tr_lock_park(&m->waiters, task, tr_wait_exclusive);
+    tr_guard_unlock(&m->guard);
+    return trstatus_pending;
+}
+
+trstatus tr_mutex_try_acquire(trmutex *m)
+{
+    trstatus status = trstatus_later;
+
+    tr_guard_lock(&m->guard);
+    if (!m->held && (!m->fair || tr_list_empty(&m->waiters))) {
+        m->held = true;
+        tr_lock_acquired(&m->stat, NULL);
+        status = trstatus_ok;
+    }
+    tr_guard_unlock(&m->guard);
+
+    return status;
+}
+
+void tr_mutex_release(trmutex *m)
+{
+    trlist woken = tr_list_staticinit(woken);
+
+    tr_guard_lock(&m->guard);
+    tr_assert(m->held);
+
+    trlist *entry = tr_list_rmhead(&m->waiters);
+    if (entry != NULL && m->fair) {
+        tr_lock_grant(&m->stat, container_of(entry, trtask, entry), &woken);
+    } else {
+        m->held = false;
+        if (entry != NULL) {
+            tr_list_append(&woken, entry);
+        }
+    }
+
+    tr_guard_unlock(&m->guard);
+    tr_lock_wake(&woken);
+}
+
+trlockstat tr_mutex_stat(trmutex *m)
+{
+    tr_guard_lock(&m->guard);
+    trlockstat stat = m->stat;
+    tr_guard_unlock(&m->guard);
+
+    return stat;
+}
+
+void tr_rwlock_initialize(trrwlock *rw, bool fair)
+{
+    atomic_init(&rw->guard, false);
+    rw->fair = fair;
+    rw->writer = false;
+    rw->readers = 0;
+    tr_list_initialize(&rw->waiters);
+    memset(&rw->stat, 0, sizeof(rw->stat));
+}
+
+trstatus tr_rwlock_acquire_shared(trrwlock *rw, trtask *task)
+{
+    tr_guard_lock(&rw->guard);
+
+    if (tr_lock_take_grant(task)) {
+        tr_assert(rw->readers > 0);
+        tr_guard_unlock(&rw->guard);
+        return trstatus_ok;
+    }
+
+    if (!rw->writer && (!rw->fair || tr_list_empty(&rw->waiters))) {
+        rw->readers += 1;
+        tr_lock_acquired(&rw->stat, task);
+        tr_guard_unlock(&rw->guard);
+        return trstatus_ok;
+    }
+
+    tr_lock_park(&rw->waiters, task, tr_wait_shared);
+    tr_guard_unlock(&rw->guard);
+    return trstatus_pending;
+}
+
+trstatus tr_rwlock_acquire_exclusive(trrwlock *rw, trtask *task)
+{
+    tr_guard_lock(&rw->guard);
+
+    if (tr_lock_take_grant(task)) {
+        tr_assert(rw->writer);
+        tr_guard_unlock(&rw->guard);
+        return trstatus_ok;
+    }
+
+    if (!rw->writer && rw->readers == 0 &&
+        (!rw->fair || tr_list_empty(&rw->waiters))) {
+
+        rw->writer = true;
+        tr_lock_acquired(&rw->stat, task);
+        tr_guard_unlock(&rw->guard);
+        return trstatus_ok;
+    }
+
+    tr_lock_park(&rw->waiters, task, tr_wait_exclusive);
+    tr_guard_unlock(&rw->guard);
+    return trstatus_pending;
+}
+
+// Admits (fair) or wakes (unfair) waiters after the lock became available.
+// Called with the guard held.
+//
+static void tr_rwlock_dispatch(trrwlock *rw, trlist *woken)
+{
+    trtask *head = tr_lock_head(&rw->waiters);
+    if (head == NULL || rw->writer) {
+        return;
+    }
+
+    if (head->waitmode == tr_wait_exclusive) {
+        if (rw->readers == 0) {
+            tr_list_remove(&head->entry);
+            if (rw->fair) {
+                rw->writer = true;
+                tr_lock_grant(&rw->stat, head, woken);
+            } else {
+                tr_list_append(woken, &head->entry);
+            }
+        }
+        return;
+    }
+
+    // Admit the whole run of readers at the head of the queue together
+    while ((head = tr_lock_head(&rw->waiters)) != NULL &&
+           head->waitmode == tr_wait_shared) {
+
+        tr_list_remove(&head->entry);
+        if (rw->fair) {
+            rw->readers += 1;
+            tr_lock_grant(&rw->stat, head, woken);
+        } else {
+            tr_list_append(woken, &head->entry);
+        }
+    }
+}
+
+void tr_rwlock_release_shared(trrwlock *rw)
+{
+    trlist woken = tr_list_staticinit(woken);
+
+    tr_guard_lock(&rw->guard);
+    tr_assert(rw->readers > 0 && !rw->writer);
+
+    rw->readers -= 1;
+    if (rw->readers == 0) {
+        tr_rwlock_dispatch(rw, &woken);
+    }
+
+    tr_guard_unlock(&rw->guard);
+    tr_lock_wake(&woken);
+}
+
+void tr_rwlock_release_exclusive(trrwlock *rw)
+{
+    trlist woken = tr_list_staticinit(woken);
+
+    tr_guard_lock(&rw->guard);
+    tr_assert(rw->writer && rw->readers == 0);
+
+    rw->writer = false;
+    tr_rwlock_dispatch(rw, &woken);
+
+    tr_guard_unlock(&rw->guard);
+    tr_lock_wake(&woken);
+}
+
+trlockstat tr_rwlock_stat(trrwlock *rw)
+{
+    tr_guard_lock(&rw->guard);
+    trlockstat stat = rw->stat;
+    tr_guard_unlock(&rw->guard);
+
+    return stat;
+}
+
+void tr_semaphore_initialize(trsemaphore *sem, unsigned count, bool fair)
+{
+    atomic_init(&sem->guard, false);
+    sem->fair = fair;
+    sem->count = count;
+    tr_list_initialize(&sem->waiters);
+    memset(&sem->stat, 0, sizeof(sem->stat));
+}
+
+trstatus tr_semaphore_acquire(trsemaphore *sem, trtask *task)
+{
+    tr_guard_lock(&sem->guard);
+
+    if (tr_lock_take_grant(task)) {
+        tr_guard_unlock(&sem->guard);
+        return trstatus_ok;
+    }
+
+    if (sem->count > 0 && (!sem->fair || tr_list_empty(&sem->waiters))) {
+        sem->count -= 1;
+        tr_lock_acquired(&sem->stat, task);
+        tr_guard_unlock(&sem->guard);
+        return trstatus_ok;
+    }
+
+    tr_lock_park(&sem->waiters, task, tr_wait_exclusive);
+    tr_guard_unlock(&sem->guard);
+    return trstatus_pending;
+}
+
+void tr_semaphore_release(trsemaphore *sem, unsigned count)
+{
+    trlist woken = tr_list_staticinit(woken);
+
+    tr_guard_lock(&sem->guard);
+    sem->count += count;
+
+    if (sem->fair) {
+        trlist *entry;
+        while (sem->count > 0 && (entry = tr_list_rmhead(&sem->waiters)) != NULL) {
+            sem->count -= 1;
+            tr_lock_grant(&sem->stat, container_of(entry, trtask, entry), &woken);
+        }
+    } else {
+        trlist *entry;
+        for (unsigned i = 0; i < count; ++i) {
+            if ((entry = tr_list_rmhead(&sem->waiters)) == NULL) {
+                break;
+            }
+            tr_list_append(&woken, entry);
+        }
+    }
+
+    tr_guard_unlock(&sem->guard);
+    tr_lock_wake(&woken);
+}
+
+trlockstat tr_semaphore_stat(trsemaphore *sem)
+{
+    tr_guard_lock(&sem->guard);
+    trlockstat stat = sem->stat;
+    tr_guard_unlock(&sem->guard);
+
+    return stat;
+}
@@ -0,0 +1,149 @@
+//////////////////////////////////////////////////////////////////////////////
+//
+// Terrascale
+// Copyright (c) Dave Kilian & Emily Kilian 2023. All rights reserved.
+//
+// sync.h - task-aware mutexes, reader/writer locks and semaphores
+//
+// A pthread_mutex_t blocks the whole worker thread while it waits, so every
+// other task queued on that worker waits too. The primitives in this file
+// park the *task* instead: the waiting task is linked into the lock's wait
+// list by its trtask.entry node, and its run() routine returns
+// trstatus_pending. The worker thread goes on to run other tasks, and the
+// task is resumed once the lock is available.
+//
+// The calling convention is the same for every primitive. From inside a
+// task's run() routine:
+//
+//     trstatus s = tr_mutex_acquire(&lock, task);
+//     if (s == trstatus_pending) {
+//         return trstatus_pending;  // run() is called again later
+//     }
+//     /* lock is held */
+//
+// When the task is resumed, it must call the same acquire routine again,
+// with the same arguments; that call completes the acquisition. Locks may be
+// held across yields and parks, since they belong to the task rather than
+// the thread. Acquire routines must only be called from task manager
+// worker threads.
+//
+// Each primitive can be created fair or unfair:
+//
+// - Fair locks grant waiters in FIFO order. On release, ownership is handed
+//   directly to the first waiter, and new arrivals queue behind existing
+//   waiters even if the lock happens to be free.
+//
+// - Unfair locks let a newly-arriving task take a free lock even when other
+//   tasks are waiting. Released waiters are woken to retry, and may lose the
+//   race. This trades tail latency for throughput, since the lock is never
+//   idle while a woken waiter travels back through a run queue.
+//
+// Each primitive keeps statistics (see trlockstat) so contention can be
+// measured per lock.
+//
+//////////////////////////////////////////////////////////////////////////////
+
+#pragma once
+
+#include <runtime/clock.h>
+#include <runtime/list.h>
+#include <taskman/taskman.h>
+
+// Contention statistics for a single lock
+typedef struct {
+
+    uint64_t nacquire;      // Number of successful acquisitions
+    uint64_t ncontended;    // Acquisitions which had to wait
+    trtime waittime;        // Total time tasks spent waiting
+    trtime maxwait;         // Longest single wait
+
+} trlockstat;
+
+// A task-aware mutual exclusion lock
+typedef struct {
+
+    _Atomic bool guard;     // Protects the fields below
+    bool fair;              // Whether waiters are granted in FIFO order
+    bool held;              // Whether some task holds the lock
+    trlist waiters;         // Parked tasks, linked by trtask.entry
+    trlockstat stat;        // Contention statistics
+
+} trmutex;
+
+// Initializes an unheld mutex
+void tr_mutex_initialize(trmutex *m, bool fair);
+
+// Acquires the mutex, or parks the task (see the top of this file)
+trstatus tr_mutex_acquire(trmutex *m, trtask *task);
+
+// Acquires the mutex if it's free (and, if fair, nobody is waiting).
+// Returns trstatus_later if the mutex could not be acquired.
+//
+trstatus tr_mutex_try_acquire(trmutex *m);
+
+// Releases the mutex, handing it to (or waking) the next waiter
+void tr_mutex_release(trmutex *m);
+
+// Gets a snapshot of the mutex's contention statistics
+trlockstat tr_mutex_stat(trmutex *m);
+
+// A task-aware reader/writer lock
+typedef struct {
+
+    _Atomic bool guard;     // Protects the fields below
+    bool fair;              // Whether waiters are granted in FIFO order
+    bool writer;            // Whether a writer holds the lock
+    unsigned readers;       // Number of readers holding the lock
+    trlist waiters;         // Parked tasks, linked by trtask.entry
+    trlockstat stat;        // Contention statistics (readers and writers)
+
+} trrwlock;
+
+// Initializes an unheld reader/writer lock.
+//
+// A fair rwlock queues new readers behind waiting writers, so writers are
+// never starved; when a writer releases, all readers at the head of the
+// queue are admitted together. An unfair rwlock admits readers whenever no
+// writer holds the lock.
+//
+void tr_rwlock_initialize(trrwlock *rw, bool fair);
+
+// Acquires the lock shared, or parks the task (see the top of this file)
+trstatus tr_rwlock_acquire_shared(trrwlock *rw, trtask *task);
+
+// Acquires the lock exclusive, or parks the task (see the top of this file)
+trstatus tr_rwlock_acquire_exclusive(trrwlock *rw, trtask *task);
+
+// Releases a shared hold on the lock
+void tr_rwlock_release_shared(trrwlock *rw);
+
+// Releases an exclusive hold on the lock
+void tr_rwlock_release_exclusive(trrwlock *rw);
+
+// Gets a snapshot of the lock's contention statistics
+trlockstat tr_rwlock_stat(trrwlock *rw);
+
+// A task-aware counting semaphore
+typedef struct {
+
+    _Atomic bool guard;     // Protects the fields below
+    bool fair;              // Whether waiters are granted in FIFO order
+    unsigned count;         // Number of units available
+    trlist waiters;         // Parked tasks, linked by trtask.entry
+    trlockstat stat;        // Contention statistics
+
+} trsemaphore;
+
+// Initializes a semaphore with the given number of available units
+void tr_semaphore_initialize(trsemaphore *sem, unsigned count, bool fair);
+
+// Takes one unit from the semaphore, or parks the task (see the top of this
+// file) until one is available
+//
+trstatus tr_semaphore_acquire(trsemaphore *sem, trtask *task);
+
+// Returns `count` units to the semaphore, waking waiters as appropriate
+void tr_semaphore_release(trsemaphore *sem, unsigned count);
+
+// Gets a snapshot of the semaphore's contention statistics
+trlockstat tr_semaphore_stat(trsemaphore *sem);
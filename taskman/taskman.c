@@ -0,0 +1,791 @@
+//////////////////////////////////////////////////////////////////////////////
+//
+// Terrascale
+// Copyright (c) Dave Kilian & Emily Kilian 2023. All rights reserved.
+//
+//////////////////////////////////////////////////////////////////////////////
+
+#include <pch.h>
+#include <taskman/taskman.h>
+
+#include <sched.h>
+#include <unistd.h>
+
+// Lifecycle of a task, tracked so that a tr_task_resume() which races with
+// the run() that parked the task doesn't schedule the task twice
+//
+enum {
+
+    tr_task_idle,       // Not yet submitted, or finished
+    tr_task_queued,     // In some worker's run queue
+    tr_task_running,    // run() is executing on some worker
+    tr_task_parked,     // run() returned pending; waiting for a resume
+    tr_task_notified,   // Resumed while still running; reschedule on return
+
+};
+
+// A trstack in a worker's stack pool
+typedef struct {
+
+    trslist link;   // Entry in trworker.stacks
+    trstack stack;  // The pooled stack itself
+
+} pooledstack;
+
+// Maximum number of idle stacks each worker keeps around
+#define tr_worker_maxstacks 64
+
+// Number of times an idle worker polls for work before going to sleep
+#define tr_worker_spins 128
+
+// Runnable tasks, one list per priority class, each ordered by due time
+typedef struct {
+
+    trlist classes[tr_taskclasses];             // Queued tasks by class
+    _Atomic unsigned depth[tr_taskclasses];     // Number of tasks per class
+
+} runqueue;
+
+// Per-class scheduler statistics kept by a single worker. Only the owning
+// worker writes these; other threads may read them at any time.
+//
+typedef struct {
+
+    _Atomic uint64_t nrun;          // See trtaskclassstat
+    _Atomic uint64_t nlate;         // See trtaskclassstat
+    _Atomic trtime waittime;        // See trtaskclassstat
+    _Atomic trtime maxwait;         // See trtaskclassstat
+
+} classcounters;
+
+// A worker thread and its run queue
+typedef struct _trworker {
+
+    trtaskman *tm;              // Task manager this worker belongs to
+    int index;                  // This worker's index (and shard number)
+    pthread_t thread;           // The worker thread itself
+
+    pthread_mutex_t lock;       // Protects queue (shared) / inbox (sharded)
+    pthread_cond_t wake;        // Signaled to wake a sleeping worker
+    _Atomic bool sleeping;      // Whether the worker is waiting on wake
+
+    runqueue queue;             // Runnable tasks
+    classcounters stats[tr_taskclasses]; // Scheduler statistics by class
+    trlist inbox;               // Sharded: tasks from non-worker threads
+    _Atomic bool hasinbox;      // Sharded: whether inbox is non-empty
+
+    trslist stacks;             // Pool of pooledstacks (owner only)
+    unsigned nstacks;           // Number of entries in stacks
+
+} trworker;
+
+// The worker the calling thread is, if any
+static _Thread_local trworker *tr_current_worker = NULL;
+
+void tr_task_initialize(trtask *task, trtaskfn *run, void *context)
+{
+    tr_list_initialize(&task->entry);
+    task->run = run;
+    task->done = NULL;
+    task->context = context;
+    task->taskman = NULL;
+    task->shard = 0;
+    task->priority = trtask_normal;
+    task->deadline = 0;
+    task->due = 0;
+    task->queuedat = 0;
+    task->slicestart = 0;
+    atomic_init(&task->state, tr_task_idle);
+    task->waitstart = 0;
+    task->waitmode = 0;
+    task->granted = false;
+}
+
+void tr_taskman_defaults(trtaskmanconfig *config, trtaskmode mode)
+{
+    config->mode = mode;
+    config->nworkers = 0;
+    config->pin = (mode == trtaskman_sharded);
+    config->ringsize = 256;
+    config->stacksize = 16 * 1024;
+    config->tag = 'task';
+
+    config->classes[trtask_critical].target = tr_ms(1);
+    config->classes[trtask_critical].slice = tr_us(500);
+    config->classes[trtask_normal].target = tr_ms(50);
+    config->classes[trtask_normal].slice = tr_ms(2);
+    config->classes[trtask_background].target = tr_sec(1);
+    config->classes[trtask_background].slice = tr_ms(1);
+}
+
+void tr_task_set_priority(trtask *task, trtaskclass priority, trtime deadline)
+{
+    tr_assert(priority >= 0 && priority < tr_taskclasses);
+    task->priority = priority;
+    task->deadline = deadline;
+}
+
+static void tr_runqueue_initialize(runqueue *rq)
+{
+    for (int c = 0; c < tr_taskclasses; ++c) {
+        tr_list_initialize(rq->classes + c);
+        atomic_init(rq->depth + c, 0);
+    }
+}
+
+static bool tr_runqueue_empty(runqueue *rq)
+{
+    for (int c = 0; c < tr_taskclasses; ++c) {
+        if (atomic_load_explicit(rq->depth + c, memory_order_relaxed) != 0) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+// Inserts a task into its class's queue, in order of due time
+static void tr_runqueue_insert(runqueue *rq, trtask *task)
+{
+    trlist *queue = rq->classes + task->priority;
+
+    // Scan from the tail, since due times mostly arrive in increasing order
+    trlist *after = queue->prev;
+    while (after != queue && container_of(after, trtask, entry)->due > task->due) {
+        after = after->prev;
+    }
+
+    tr_list_prepend(after, &task->entry);
+    atomic_fetch_add_explicit(rq->depth + task->priority, 1, memory_order_relaxed);
+}
+
+// Removes the next task to run, or returns NULL if the queue is empty.
+//
+// Normally this is the most urgent task of the most important class with
+// queued work. But if a less important class's most urgent task is already
+// overdue while the more important classes' are not, that task goes first,
+// so lower classes can't be starved indefinitely by a steady trickle of
+// higher-priority work.
+//
+static trtask *tr_runqueue_pop(runqueue *rq, trtime now)
+{
+    trtask *pick = NULL;
+
+    for (int c = 0; c < tr_taskclasses; ++c) {
+        trlist *queue = rq->classes + c;
+        if (tr_list_empty(queue)) {
+            continue;
+        }
+
+        trtask *head = container_of(queue->next, trtask, entry);
+        if (head->due <= now) {
+            pick = head;
+            break;
+        }
+
+        if (pick == NULL) {
+            pick = head;
+        }
+    }
+
+    if (pick != NULL) {
+        tr_list_remove(&pick->entry);
+        atomic_fetch_sub_explicit(rq->depth + pick->priority, 1, memory_order_relaxed);
+    }
+
+    return pick;
+}
+static trring *tr_taskman_ring(trtaskman *tm, int src, int dst)
+{
+    return tm->rings + src * tm->config.nworkers + dst;
+}
+
+// Wakes the given worker if it's asleep. The caller must already have
+// published the work it wants the worker to see.
+//
+static void tr_worker_poke(trworker *w)
+{
+    atomic_thread_fence(memory_order_seq_cst);
+    if (atomic_load(&w->sleeping)) {
+        pthread_mutex_lock(&w->lock);
+        pthread_cond_signal(&w->wake);
+        pthread_mutex_unlock(&w->lock);
+    }
+}
+
+// Wakes some sleeping worker other than `except`, so it can steal work
+static void tr_taskman_poke_thief(trtaskman *tm, trworker *except)
+{
+    for (int i = 0; i < tm->config.nworkers; ++i) {
+        trworker *w = tm->workers + i;
+        if (w != except && atomic_load(&w->sleeping)) {
+            tr_worker_poke(w);
+            return;
+        }
+    }
+}
+
+// Puts a task on the given worker's run queue
+static void tr_taskman_enqueue(trtaskman *tm, int shard, trtask *task)
+{
+    trworker *target = tm->workers + shard;
+    trworker *self = tr_current_worker;
+    if (self != NULL && self->tm != tm) {
+        self = NULL;
+    }
+
+    atomic_store(&task->state, tr_task_queued);
+
+    trtime now = tr_clock_now();
+    task->queuedat = now;
+    task->due = (task->deadline != 0)
+        ? task->deadline
+        : now + tm->config.classes[task->priority].target;
+
+    if (tm->config.mode == trtaskman_shared) {
+
+        pthread_mutex_lock(&target->lock);
+        tr_runqueue_insert(&target->queue, task);
+        bool wakeowner = atomic_load(&target->sleeping);
+        if (wakeowner) {
+            pthread_cond_signal(&target->wake);
+        }
+        pthread_mutex_unlock(&target->lock);
+
+        if (!wakeowner && target != self) {
+            tr_taskman_poke_thief(tm, target);
+        }
+
+        return;
+    }
+
+    if (self == target) {
+        tr_runqueue_insert(&target->queue, task);
+        return;
+    }
+
+    if (self != NULL &&
+        tr_ring_push(tr_taskman_ring(tm, self->index, target->index), task)) {
+
+        tr_worker_poke(target);
+        return;
+    }
+
+    // Not on a worker thread, or the ring is full: use the locked inbox
+    pthread_mutex_lock(&target->lock);
+    tr_list_append(&target->inbox, &task->entry);
+    atomic_store(&target->hasinbox, true);
+    if (atomic_load(&target->sleeping)) {
+        pthread_cond_signal(&target->wake);
+    }
+    pthread_mutex_unlock(&target->lock);
+}
+
+static void tr_taskman_finish(trtaskman *tm)
+{
+    if (atomic_fetch_sub(&tm->outstanding, 1) == 1) {
+        pthread_mutex_lock(&tm->idlelock);
+        pthread_cond_broadcast(&tm->idle);
+        pthread_mutex_unlock(&tm->idlelock);
+    }
+}
+
+// Runs a task on the calling worker and handles its return status
+static void tr_worker_run(trworker *w, trtask *task)
+{
+    trtaskman *tm = w->tm;
+
+    atomic_store(&task->state, tr_task_running);
+    if (tm->config.mode == trtaskman_shared) {
+        task->shard = w->index;
+    }
+
+    trtime now = tr_clock_now();
+    trtime waited = now - task->queuedat;
+    classcounters *stats = w->stats + task->priority;
+
+    atomic_fetch_add_explicit(&stats->nrun, 1, memory_order_relaxed);
+    atomic_fetch_add_explicit(&stats->waittime, waited, memory_order_relaxed);
+    if (waited > atomic_load_explicit(&stats->maxwait, memory_order_relaxed)) {
+        atomic_store_explicit(&stats->maxwait, waited, memory_order_relaxed);
+    }
+    if (now > task->due) {
+        atomic_fetch_add_explicit(&stats->nlate, 1, memory_order_relaxed);
+    }
+
+    task->slicestart = now;
+
+    trstatus status = task->run(task);
+
+    if (status == trstatus_pending) {
+        int expect = tr_task_running;
+        if (atomic_compare_exchange_strong(&task->state, &expect, tr_task_parked)) {
+            return;
+        }
+
+        // Somebody resumed the task before run() returned
+        tr_assert(expect == tr_task_notified);
+        tr_taskman_enqueue(tm, w->index, task);
+        return;
+    }
+
+    if (status == trstatus_later) {
+        tr_taskman_enqueue(tm, w->index, task);
+        return;
+    }
+
+    atomic_store(&task->state, tr_task_idle);
+    if (task->done != NULL) {
+        task->done(task, status);
+    }
+
+    tr_taskman_finish(tm);
+}
+
+// Moves tasks sent to this worker's shard into its local run queue
+static void tr_worker_collect(trworker *w)
+{
+    trtaskman *tm = w->tm;
+
+    for (int src = 0; src < tm->config.nworkers; ++src) {
+        trring *ring = tr_taskman_ring(tm, src, w->index);
+        trtask *task;
+        while ((task = tr_ring_pop(ring)) != NULL) {
+            tr_runqueue_insert(&w->queue, task);
+        }
+    }
+
+    if (atomic_load_explicit(&w->hasinbox, memory_order_relaxed)) {
+        trlist inbox = tr_list_staticinit(inbox);
+
+        pthread_mutex_lock(&w->lock);
+        tr_list_transfer(&w->inbox, &inbox);
+        atomic_store(&w->hasinbox, false);
+        pthread_mutex_unlock(&w->lock);
+
+        trlist *entry;
+        while ((entry = tr_list_rmhead(&inbox)) != NULL) {
+            tr_runqueue_insert(&w->queue, container_of(entry, trtask, entry));
+        }
+    }
+}
+
+// Indicates whether anything has been sent to this worker's shard
+static bool tr_worker_has_mail(trworker *w)
+{
+    trtaskman *tm = w->tm;
+
+    if (atomic_load(&w->hasinbox)) {
+        return true;
+    }
+
+    for (int src = 0; src < tm->config.nworkers; ++src) {
+        if (!tr_ring_empty(tr_taskman_ring(tm, src, w->index))) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+// Takes the most urgent task from another worker's queue (shared mode)
+static trtask *tr_worker_steal(trworker *w, trtime now)
+{
+    trtaskman *tm = w->tm;
+    int n = tm->config.nworkers;
+
+    for (int i = 1; i < n; ++i) {
+        trworker *victim = tm->workers + (w->index + i) % n;
+        if (tr_runqueue_empty(&victim->queue)) {
+            continue;
+        }
+
+        pthread_mutex_lock(&victim->lock);
+        trtask *task = tr_runqueue_pop(&victim->queue, now);
+        pthread_mutex_unlock(&victim->lock);
+
+        if (task != NULL) {
+            return task;
+        }
+    }
+
+    return NULL;
+}
+
+// Finds the next task for this worker to run, or NULL if there is none
+static trtask *tr_worker_next(trworker *w)
+{
+    trtime now = tr_clock_now();
+
+    if (w->tm->config.mode == trtaskman_shared) {
+        pthread_mutex_lock(&w->lock);
+        trtask *task = tr_runqueue_pop(&w->queue, now);
+        pthread_mutex_unlock(&w->lock);
+
+        return task != NULL ? task : tr_worker_steal(w, now);
+    }
+
+    // Collect on every dispatch, so urgent work sent from other shards
+    // isn't stuck behind this shard's backlog
+    tr_worker_collect(w);
+    return tr_runqueue_pop(&w->queue, now);
+}
+
+// Blocks until there might be work for this worker, or it should stop
+static void tr_worker_sleep(trworker *w)
+{
+    trtaskman *tm = w->tm;
+
+    pthread_mutex_lock(&w->lock);
+    atomic_store(&w->sleeping, true);
+    atomic_thread_fence(memory_order_seq_cst);
+
+    bool haswork = (tm->config.mode == trtaskman_shared)
+        ? !tr_runqueue_empty(&w->queue)
+        : !tr_list_empty(&w->inbox) || tr_worker_has_mail(w);
+
+    if (!haswork && !atomic_load(&tm->stopping)) {
+        pthread_cond_wait(&w->wake, &w->lock);
+    }
+
+    atomic_store(&w->sleeping, false);
+    pthread_mutex_unlock(&w->lock);
+}
+
+static void tr_worker_pin(trworker *w)
+{
+#ifdef __linux__
+    long ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+    if (ncpu > 0) {
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        CPU_SET(w->index % ncpu, &set);
+        pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+    }
+#else
+    (void)w; // No hard affinity on this platform; rely on the scheduler
+#endif
+}
+
+static void *tr_worker_main(void *arg)
+{
+    trworker *w = arg;
+    trtaskman *tm = w->tm;
+
+    tr_current_worker = w;
+    if (tm->config.pin) {
+        tr_worker_pin(w);
+    }
+
+    int idle = 0;
+    while (!atomic_load(&tm->stopping)) {
+
+        trtask *task = tr_worker_next(w);
+        if (task != NULL) {
+            tr_worker_run(w, task);
+            idle = 0;
+            continue;
+        }
+
+        if (++idle < tr_worker_spins) {
+            sched_yield();
+            continue;
+        }
+
+        tr_worker_sleep(w);
+        idle = 0;
+    }
+
+    tr_current_worker = NULL;
+    return NULL;
+}
+
+static void tr_taskman_stop_workers(trtaskman *tm, int nstarted)
+{
+    atomic_store(&tm->stopping, true);
+
+    for (int i = 0; i < nstarted; ++i) {
+        trworker *w = tm->workers + i;
+        pthread_mutex_lock(&w->lock);
+        pthread_cond_signal(&w->wake);
+        pthread_mutex_unlock(&w->lock);
+    }
+
+    for (int i = 0; i < nstarted; ++i) {
+        pthread_join(tm->workers[i].thread, NULL);
+    }
+}
+
+static void tr_taskman_free(trtaskman *tm, int nrings)
+{
+    for (int i = 0; i < nrings; ++i) {
+        tr_ring_cleanup(tm->rings + i);
+    }
+
+    if (tm->rings != NULL) {
+        tr_free(tm->rings);
+        tm->rings = NULL;
+    }
+
+    for (int i = 0; i < tm->config.nworkers; ++i) {
+        trworker *w = tm->workers + i;
+
+        trslist *link;
+        while ((link = tr_slist_pop(&w->stacks)) != NULL) {
+            pooledstack *ps = container_of(link, pooledstack, link);
+            tr_stack_cleanup(&ps->stack);
+            tr_free(ps);
+        }
+
+        pthread_cond_destroy(&w->wake);
+        pthread_mutex_destroy(&w->lock);
+    }
+
+    tr_free(tm->workers);
+    tm->workers = NULL;
+
+    pthread_cond_destroy(&tm->idle);
+    pthread_mutex_destroy(&tm->idlelock);
+}
+
+trstatus tr_taskman_initialize(trtaskman *tm, const trtaskmanconfig *config)
+{
+    tm->config = *config;
+    if (tm->config.nworkers <= 0) {
+        long ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+        tm->config.nworkers = ncpu > 0 ? (int)ncpu : 1;
+    }
+
+    int n = tm->config.nworkers;
+
+    tm->workers = tr_alloc(n * sizeof(trworker), tm->config.tag);
+    if (tm->workers == NULL) {
+        return trstatus_no_mem;
+    }
+
+    tm->rings = NULL;
+    atomic_init(&tm->nextshard, 0);
+    atomic_init(&tm->outstanding, 0);
+    atomic_init(&tm->stopping, false);
+    pthread_mutex_init(&tm->idlelock, NULL);
+    pthread_cond_init(&tm->idle, NULL);
+
+    for (int i = 0; i < n; ++i) {
+        trworker *w = tm->workers + i;
+        w->tm = tm;
+        w->index = i;
+        pthread_mutex_init(&w->lock, NULL);
+        pthread_cond_init(&w->wake, NULL);
+        atomic_init(&w->sleeping, false);
+        tr_runqueue_initialize(&w->queue);
+        memset(w->stats, 0, sizeof(w->stats));
+        tr_list_initialize(&w->inbox);
+        atomic_init(&w->hasinbox, false);
+        tr_slist_initialize(&w->stacks);
+        w->nstacks = 0;
+    }
+
+    int nrings = 0;
+    if (tm->config.mode == trtaskman_sharded) {
+
+        tm->rings = tr_alloc(n * n * sizeof(trring), tm->config.tag);
+        if (tm->rings == NULL) {
+            tr_taskman_free(tm, 0);
+            return trstatus_no_mem;
+        }
+
+        for (nrings = 0; nrings < n * n; ++nrings) {
+            trstatus s = tr_ring_initialize(
+                    tm->rings + nrings,
+                    tm->config.ringsize,
+                    tm->config.tag);
+
+            if (tr_failed(s)) {
+                tr_taskman_free(tm, nrings);
+                return s;
+            }
+        }
+    }
+
+    for (int i = 0; i < n; ++i) {
+        trworker *w = tm->workers + i;
+        int err = pthread_create(&w->thread, NULL, &tr_worker_main, w);
+        if (err != 0) {
+            tr_taskman_stop_workers(tm, i);
+            tr_taskman_free(tm, nrings);
+            return tr_status_from_errno_value(err);
+        }
+    }
+
+    return trstatus_ok;
+}
+
+void tr_taskman_cleanup(trtaskman *tm)
+{
+    int n = tm->config.nworkers;
+    tr_taskman_stop_workers(tm, n);
+    tr_taskman_free(tm, tm->rings != NULL ? n * n : 0);
+}
+
+int tr_taskman_nworkers(trtaskman *tm)
+{
+    return tm->config.nworkers;
+}
+
+int tr_taskman_current(trtaskman *tm)
+{
+    trworker *w = tr_current_worker;
+    return (w != NULL && w->tm == tm) ? w->index : -1;
+}
+
+void tr_taskman_submit(trtaskman *tm, trtask *task)
+{
+    int shard = tr_taskman_current(tm);
+    if (shard < 0) {
+        shard = atomic_fetch_add_explicit(&tm->nextshard, 1, memory_order_relaxed)
+              % tm->config.nworkers;
+    }
+
+    tr_taskman_submit_to(tm, shard, task);
+}
+
+void tr_taskman_submit_to(trtaskman *tm, int shard, trtask *task)
+{
+    tr_assert(shard >= 0 && shard < tm->config.nworkers);
+    tr_assert(atomic_load(&task->state) == tr_task_idle);
+
+    task->taskman = tm;
+    task->shard = shard;
+    atomic_fetch_add(&tm->outstanding, 1);
+
+    tr_taskman_enqueue(tm, shard, task);
+}
+
+void tr_task_resume(trtask *task)
+{
+    trtaskman *tm = task->taskman;
+
+    int expect = tr_task_parked;
+    if (!atomic_compare_exchange_strong(&task->state, &expect, tr_task_queued)) {
+
+        // Still inside run(); the worker reschedules the task when it returns
+        tr_assert(expect == tr_task_running);
+        expect = tr_task_running;
+        if (atomic_compare_exchange_strong(&task->state, &expect, tr_task_notified)) {
+            return;
+        }
+
+        // run() returned and parked the task in the meantime
+        tr_require(expect == tr_task_parked);
+        atomic_store(&task->state, tr_task_queued);
+    }
+
+    int shard = task->shard;
+    if (tm->config.mode == trtaskman_shared) {
+        int self = tr_taskman_current(tm);
+        if (self >= 0) {
+            shard = self;
+        }
+    }
+
+    tr_taskman_enqueue(tm, shard, task);
+}
+
+void tr_taskman_drain(trtaskman *tm)
+{
+    pthread_mutex_lock(&tm->idlelock);
+    while (atomic_load(&tm->outstanding) != 0) {
+        pthread_cond_wait(&tm->idle, &tm->idlelock);
+    }
+    pthread_mutex_unlock(&tm->idlelock);
+}
+
+bool tr_task_should_yield(trtask *task)
+{
+    trworker *w = tr_current_worker;
+    if (w == NULL || w->tm != task->taskman) {
+        return false;
+    }
+
+    // In sharded mode, urgent work sent from other shards or threads sits
+    // in the rings and inbox until it's collected; the running task is on
+    // its own shard, so collect it here rather than miss it
+    if (w->tm->config.mode == trtaskman_sharded && tr_worker_has_mail(w)) {
+        tr_worker_collect(w);
+    }
+
+    for (int c = 0; c < (int)task->priority; ++c) {
+        if (atomic_load_explicit(w->queue.depth + c, memory_order_relaxed) != 0) {
+            return true;
+        }
+    }
+
+    if (atomic_load_explicit(w->queue.depth + task->priority, memory_order_relaxed) == 0) {
+        return false;
+    }
+
+    trtime slice = task->taskman->config.classes[task->priority].slice;
+    return tr_clock_now() - task->slicestart >= slice;
+}
+
+trtaskclassstat tr_taskman_classstat(trtaskman *tm, trtaskclass priority)
+{
+    trtaskclassstat stat;
+    memset(&stat, 0, sizeof(stat));
+
+    for (int i = 0; i < tm->config.nworkers; ++i) {
+        trworker *w = tm->workers + i;
+        classcounters *counters = w->stats + priority;
+
+        stat.depth += atomic_load_explicit(w->queue.depth + priority, memory_order_relaxed);
+        stat.nrun += atomic_load_explicit(&counters->nrun, memory_order_relaxed);
+        stat.nlate += atomic_load_explicit(&counters->nlate, memory_order_relaxed);
+        stat.waittime += atomic_load_explicit(&counters->waittime, memory_order_relaxed);
+        stat.maxwait = max(stat.maxwait,
+                atomic_load_explicit(&counters->maxwait, memory_order_relaxed));
+    }
+
+    return stat;
+}
+
+trstack *tr_taskman_stack_get(trtaskman *tm)
+{
+    trworker *w = tr_current_worker;
+    tr_require(w != NULL && w->tm == tm);
+
+    trslist *link = tr_slist_pop(&w->stacks);
+    if (link != NULL) {
+        w->nstacks -= 1;
+        return &container_of(link, pooledstack, link)->stack;
+    }
+
+    pooledstack *ps = tr_alloc(sizeof(pooledstack), tm->config.tag);
+    if (ps == NULL) {
+        return NULL;
+    }
+
+    if (tr_failed(tr_stack_initialize(&ps->stack, tm->config.stacksize, tm->config.tag))) {
+        tr_free(ps);
+        return NULL;
+    }
+
+    return &ps->stack;
+}
+
+void tr_taskman_stack_put(trtaskman *tm, trstack *stack)
+{
+    trworker *w = tr_current_worker;
+    tr_require(w != NULL && w->tm == tm);
+
+    pooledstack *ps = container_of(stack, pooledstack, stack);
+
+    if (w->nstacks >= tr_worker_maxstacks) {
+        tr_stack_cleanup(&ps->stack);
+        tr_free(ps);
+        return;
+    }
+
+    tr_stack_clear(&ps->stack);
+    tr_slist_push(&w->stacks, &ps->link);
+    w->nstacks += 1;
+}
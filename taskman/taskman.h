@@ -0,0 +1,243 @@
+//////////////////////////////////////////////////////////////////////////////
+//
+// Terrascale
+// Copyright (c) Dave Kilian & Emily Kilian 2023. All rights reserved.
+//
+// taskman.h - a task manager for async requests
+//
+// A trtask is a resumable unit of work. The task manager runs a task by
+// calling its run() routine on one of its worker threads. The value run()
+// returns tells the task manager what to do next:
+//
+// - trstatus_pending: the task is parked, waiting on something (I/O, a
+//   lock, another task). It is not rescheduled until somebody calls
+//   tr_task_resume() on it, at which point run() is called again.
+//
+// - trstatus_later: the task voluntarily yields. It goes to the back of the
+//   run queue and run() is called again when its turn comes back around.
+//
+// - anything else: the task is finished. If the task has a done() routine,
+//   that is called with the final status; after that, the task manager
+//   never touches the task again, and the caller may reuse or free it.
+//
+// Because run() may be invoked many times for a single task, tasks usually
+// keep a small state machine in their context and pick up where they left
+// off on each call. Memory which must survive across calls belongs in the
+// task's context or on a trstack, never on the worker thread's stack.
+//
+// The task manager supports two execution modes:
+//
+// - trtaskman_shared: a shared pool. Each worker owns a run queue, but idle
+//   workers steal from busy workers' queues, so any worker may run any task.
+//   Data touched by tasks must be synchronized, since it may be accessed
+//   from several workers at once.
+//
+// - trtaskman_sharded: shared-nothing, thread-per-core. Each worker is
+//   pinned to a core and owns a shard; a task always runs on the shard it was
+//   submitted to. Data partitioned by shard can be accessed without locks.
+//   Tasks submitted from one worker to another travel over a dedicated
+//   single-producer, single-consumer trring for that pair of workers, so
+//   the hot path takes no locks at all. Submissions from threads outside
+//   the task manager go through a locked per-shard inbox.
+//
+// Each worker also owns a pool of trstacks which tasks running on that
+// worker can borrow, so per-request scratch memory is recycled without
+// going back to the heap.
+//
+// Every task belongs to a priority class (see trtaskclass). Workers always
+// run the most important class with queued work; within a class, tasks run
+// earliest-deadline-first. A task without an explicit deadline is given an
+// implicit one, its class's latency target after it was queued, so such
+// tasks run FIFO amongst themselves and a lower-class task whose implicit
+// deadline has passed is run ahead of higher classes rather than starving.
+//
+// Long-running tasks should call tr_task_should_yield() at convenient
+// points and return trstatus_later when it says so. This is how the task
+// manager preempts scans and background work in favor of latency-critical
+// requests queued behind them.
+//
+//////////////////////////////////////////////////////////////////////////////
+
+#pragma once
+
+#include <runtime/clock.h>
+#include <runtime/list.h>
+#include <runtime/ring.h>
+#include <runtime/stack.h>
+
+struct _trtask;
+struct _trtaskman;
+struct _trworker;
+
+// Called each time a task is scheduled (see the top of this file)
+typedef trstatus trtaskfn(struct _trtask *task);
+
+// Called once after a task finishes, with run()'s final status
+typedef void trtaskdonefn(struct _trtask *task, trstatus status);
+
+// Task priority classes, from most to least important
+typedef enum {
+
+    trtask_critical,    // Latency-critical requests (e.g. point lookups)
+    trtask_normal,      // Ordinary work (e.g. scans, analytic queries)
+    trtask_background,  // Maintenance (e.g. compaction, write-back)
+
+} trtaskclass;
+
+#define tr_taskclasses 3
+
+// A resumable unit of work
+typedef struct _trtask {
+
+    trlist entry;                   // Entry in a run queue or a wait list
+    trtaskfn *run;                  // Called each time the task is scheduled
+    trtaskdonefn *done;             // Called when finished (may be NULL)
+    void *context;                  // Caller-owned state for the task
+    struct _trtaskman *taskman;     // Owning task manager, set on submit
+    int shard;                      // Worker this task is affinitized to
+    trtaskclass priority;           // Priority class (default normal)
+    trtime deadline;                // Absolute deadline, or 0 for none
+    trtime due;                     // Effective deadline in the run queue
+    trtime queuedat;                // When the task was last queued
+    trtime slicestart;              // When the current run() call began
+    _Atomic int state;              // Scheduling state (private)
+    trtime waitstart;               // When the task began waiting on a lock
+    unsigned waitmode;              // Lock mode the task is waiting for
+    bool granted;                   // Whether a lock was handed to the task
+
+} trtask;
+
+// Initializes a task with the given run routine and context
+void tr_task_initialize(trtask *task, trtaskfn *run, void *context);
+
+// Sets a task's priority class and, optionally, an absolute deadline (as
+// returned by tr_clock_now), or 0 for no deadline. Takes effect the next
+// time the task is queued.
+//
+void tr_task_set_priority(trtask *task, trtaskclass priority, trtime deadline);
+
+// Indicates whether a running task should return trstatus_later at its
+// next convenient point. This is true if work of a more important class is
+// waiting on the task's worker (in sharded mode, including work sent to the
+// shard that the worker hasn't picked up yet), or if the task has used up its
+// class's time slice and other work of the same class is waiting.
+//
+// Must be called from within the task's run() routine.
+//
+bool tr_task_should_yield(trtask *task);
+
+// Execution modes (see the top of this file)
+typedef enum {
+
+    trtaskman_shared,   // Work-stealing shared pool
+    trtaskman_sharded,  // Thread-per-core, shared-nothing shards
+
+} trtaskmode;
+
+// Scheduling options for a single priority class
+typedef struct {
+
+    trtime target;          // Implicit deadline after a task is queued
+    trtime slice;           // Run time after which a task should yield
+
+} trtaskclassconfig;
+
+// Task manager creation options
+typedef struct {
+
+    trtaskmode mode;        // How tasks are assigned to workers
+    int nworkers;           // Number of workers, or 0 for one per core
+    bool pin;               // Whether to pin worker N to core N
+    unsigned ringsize;      // Per-pair ring capacity (sharded mode only)
+    unsigned stacksize;     // Size of pooled per-worker trstacks
+    tralloctag tag;         // Tag for the task manager's heap allocations
+    trtaskclassconfig classes[tr_taskclasses]; // Per-class scheduling
+
+} trtaskmanconfig;
+
+// Fills in reasonable defaults for the given mode
+void tr_taskman_defaults(trtaskmanconfig *config, trtaskmode mode);
+
+// A pool of worker threads which run tasks
+typedef struct _trtaskman {
+
+    trtaskmanconfig config;         // Options the manager was started with
+    struct _trworker *workers;      // Array of config.nworkers workers
+    trring *rings;                  // Sharded mode: [src * nworkers + dst]
+    _Atomic unsigned nextshard;     // Round-robin cursor for external submits
+    _Atomic long outstanding;       // Tasks submitted but not yet finished
+    _Atomic bool stopping;          // Set when workers should exit
+
+    pthread_mutex_t idlelock;       // Protects idle
+    pthread_cond_t idle;            // Signaled when outstanding drops to 0
+
+} trtaskman;
+
+// Starts a task manager's worker threads
+trstatus tr_taskman_initialize(trtaskman *tm, const trtaskmanconfig *config);
+
+// Stops all worker threads and frees the task manager's resources.
+//
+// Tasks which are still queued or parked when the task manager is cleaned up
+// are never run again. Call tr_taskman_drain() first for a clean shutdown.
+//
+void tr_taskman_cleanup(trtaskman *tm);
+
+// Gets the number of worker threads (and, in sharded mode, shards)
+int tr_taskman_nworkers(trtaskman *tm);
+
+// Queues a task to run.
+//
+// In shared mode, a task submitted from a worker goes to that worker's run
+// queue (other workers may steal it); a task submitted from outside the task
+// manager is distributed round-robin. In sharded mode, the task runs on the
+// calling worker's own shard, or a round-robin shard if the caller is not a
+// worker thread.
+//
+void tr_taskman_submit(trtaskman *tm, trtask *task);
+
+// Queues a task to run on the given shard.
+//
+// In sharded mode, the task is guaranteed to run on that shard's worker
+// (and to be resumed there after parking). In shared mode, the shard is only
+// a placement hint.
+//
+void tr_taskman_submit_to(trtaskman *tm, int shard, trtask *task);
+
+// Reschedules a task which returned trstatus_pending.
+// Safe to call from any thread, including from within another task.
+//
+void tr_task_resume(trtask *task);
+
+// Waits until every submitted task has finished
+void tr_taskman_drain(trtaskman *tm);
+
+// Gets the index of the worker running the calling thread, or -1 if the
+// calling thread does not belong to the given task manager.
+//
+int tr_taskman_current(trtaskman *tm);
+
+// Scheduler statistics for a single priority class
+typedef struct {
+
+    unsigned depth;         // Tasks currently queued
+    uint64_t nrun;          // Number of times a task was dispatched
+    uint64_t nlate;         // Dispatches which began after the task was due
+    trtime waittime;        // Total time tasks spent queued before dispatch
+    trtime maxwait;         // Longest time a task spent queued
+
+} trtaskclassstat;
+
+// Gets scheduler statistics for a priority class, summed over all workers
+trtaskclassstat tr_taskman_classstat(trtaskman *tm, trtaskclass priority);
+
+// Borrows a cleared trstack from the calling worker's pool.
+// Must be called from a worker thread. Returns NULL if out of memory.
+//
+trstack *tr_taskman_stack_get(trtaskman *tm);
+
+// Returns a trstack obtained from tr_taskman_stack_get to the calling
+// worker's pool. Must be called from a worker thread of the same task
+// manager, though not necessarily the one which borrowed the stack.
+//
+void tr_taskman_stack_put(trtaskman *tm, trstack *stack);
@@ -56,11 +56,30 @@ static void alloc_stats()
     TEST_EQUAL(stats[0].nbytes, 4 * sizeof(trallocstat));
 }
 
+static void alloc_aligned()
+{
+    unsigned aligns[] = { 1, 16, 64, 4096 };
+    for (int i = 0; i < arraysize(aligns); ++i) {
+        char *buffer = tr_alloc_aligned(100, aligns[i], 'algn');
+        TEST_NOT_NULL(buffer);
+        TEST_EQUAL((uintptr_t)buffer % aligns[i], 0);
+        memset(buffer, 0xff, 100);
+
+        trallocstat stat = tr_alloc_stat('algn');
+        TEST_EQUAL(stat.nalloc, 1);
+        TEST_EQUAL(stat.nbytes, 100);
+
+        tr_free(buffer);
+        TEST_EQUAL(tr_alloc_stat('algn').nalloc, 0);
+    }
+}
+
 static const test_case alloc_cases[] =
 {
     TEST_CASE(alloc_tagstr),
     TEST_CASE(alloc_basic),
     TEST_CASE(alloc_stats),
+    TEST_CASE(alloc_aligned),
 };
 
 TEST_SUITE(alloc_tests, alloc_cases);
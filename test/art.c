@@ -0,0 +1,251 @@
+/////////////////////////////////////////////////////////////////////////////
+//
+// Terrascale
+// Copyright (c) Dave Kilian & Emily Kilian 2023. All rights reserved.
+//
+//////////////////////////////////////////////////////////////////////////////
+
+#include <pch.h>
+#include <test/test.h>
+#include <index/art.h>
+#include <store/kv.h>
+
+#define ART_NKEYS 20000
+#define ART_KEYSIZE 64
+
+typedef struct {
+
+    uint8_t key[ART_KEYSIZE];
+    unsigned keylen;
+
+} art_key;
+
+// Keys like asset paths, sharing long prefixes, some of them prefixes of
+// others, and some binary
+//
+static void art_make_key(unsigned i, art_key *k)
+{
+    switch (i % 4) {
+    case 0:
+        k->keylen = snprintf((char *)k->key, ART_KEYSIZE, "assets/terrain/region%02u/tile%08u.png", i % 37, i);
+        break;
+    case 1:
+        k->keylen = snprintf((char *)k->key, ART_KEYSIZE, "assets/terrain/region%02u/tile%08u", (i - 1) % 37, i - 1);
+        break;
+    case 2:
+        k->keylen = snprintf((char *)k->key, ART_KEYSIZE, "%08u", i);
+        break;
+    default:
+        k->keylen = 12;
+        memset(k->key, 0, 12);
+        memcpy(k->key + 4, &i, sizeof(i));
+        break;
+    }
+}
+
+static int art_order(const void *a, const void *b)
+{
+    const art_key *ka = a, *kb = b;
+    return tr_kv_compare(ka->key, ka->keylen, kb->key, kb->keylen);
+}
+
+typedef struct {
+
+    const art_key *expected;    // Keys the scan should see, in order
+    unsigned count;             // How many
+    unsigned seen;              // How many it's seen so far
+    unsigned limit;             // How many to see before stopping
+
+} art_scan_check;
+
+static bool art_scan_next(const void *key, unsigned keylen, uint64_t value, void *context)
+{
+    art_scan_check *check = context;
+    (void)value;
+    TEST_LESS_THAN(check->seen, check->count);
+    if (check->seen < check->count) {
+        const art_key *k = check->expected + check->seen;
+        TEST_EQUAL(tr_kv_compare(key, keylen, k->key, k->keylen), 0);
+    }
+    return ++check->seen < check->limit;
+}
+
+// Checks scans from `from` against the sorted keys
+static void art_check_scan(const trart *tree, const art_key *sorted, unsigned count, const art_key *from,
+        unsigned limit)
+{
+    unsigned first = 0;
+    while (first < count && art_order(sorted + first, from) < 0) {
+        first++;
+    }
+
+    art_scan_check check = { sorted + first, count - first, 0, limit };
+    tr_art_scan(tree, from->key, from->keylen, art_scan_next, &check);
+    TEST_EQUAL(check.seen, min(count - first, limit));
+}
+
+static void art_put_get()
+{
+    art_key *keys = tr_alloc(ART_NKEYS * sizeof(art_key), 'tar1');
+    for (unsigned i = 0; i < ART_NKEYS; ++i) {
+        art_make_key(i, keys + i);
+    }
+
+    trart tree;
+    tr_art_initialize(&tree, 'tar1');
+    uint64_t value;
+    TEST_EQUAL(tr_art_get(&tree, "a", 1, &value), trstatus_not_found);
+
+    for (unsigned i = 0; i < ART_NKEYS; ++i) {
+        TEST_SUCCESS(tr_art_put(&tree, keys[i].key, keys[i].keylen, i + 1));
+    }
+    TEST_SUCCESS(tr_art_put(&tree, "", 0, 0));
+    for (unsigned i = 0; i < ART_NKEYS; i += 3) {
+        TEST_SUCCESS(tr_art_put(&tree, keys[i].key, keys[i].keylen, i));
+    }
+    TEST_EQUAL(tr_art_stat(&tree).nentries, ART_NKEYS + 1);
+
+    for (unsigned i = 0; i < ART_NKEYS; ++i) {
+        TEST_SUCCESS(tr_art_get(&tree, keys[i].key, keys[i].keylen, &value));
+        TEST_EQUAL(value, i % 3 == 0 ? i : i + 1);
+
+        // Prefixes and extensions of keys which aren't keys themselves
+        TEST_EQUAL(tr_art_get(&tree, keys[i].key, keys[i].keylen - 2, &value), trstatus_not_found);
+        art_key longer = keys[i];
+        longer.key[longer.keylen++] = '~';
+        TEST_EQUAL(tr_art_get(&tree, longer.key, longer.keylen, &value), trstatus_not_found);
+    }
+    TEST_SUCCESS(tr_art_get(&tree, "", 0, &value));
+    TEST_EQUAL(tr_art_put(&tree, keys[0].key, tr_art_maxkey + 1, 0), trstatus_too_large);
+
+    // Deleting every other key leaves the rest
+    for (unsigned i = 0; i < ART_NKEYS; i += 2) {
+        TEST_SUCCESS(tr_art_delete(&tree, keys[i].key, keys[i].keylen));
+        TEST_EQUAL(tr_art_delete(&tree, keys[i].key, keys[i].keylen), trstatus_not_found);
+    }
+    for (unsigned i = 0; i < ART_NKEYS; ++i) {
+        trstatus s = tr_art_get(&tree, keys[i].key, keys[i].keylen, &value);
+        TEST_EQUAL(s, i % 2 == 0 ? trstatus_not_found : trstatus_ok);
+    }
+    TEST_EQUAL(tr_art_stat(&tree).nentries, ART_NKEYS / 2 + 1);
+
+    // Deleting everything frees every node
+    TEST_SUCCESS(tr_art_delete(&tree, "", 0));
+    for (unsigned i = 1; i < ART_NKEYS; i += 2) {
+        TEST_SUCCESS(tr_art_delete(&tree, keys[i].key, keys[i].keylen));
+    }
+    trartstat stat = tr_art_stat(&tree);
+    TEST_EQUAL(stat.nentries, 0);
+    TEST_EQUAL(stat.bytes, 0);
+    TEST_NULL(tree.root);
+
+    tr_art_cleanup(&tree);
+    tr_free(keys);
+    TEST_EQUAL(tr_alloc_stat('tar1').nalloc, 0);
+}
+
+static void art_node_sizes()
+{
+    trart tree;
+    tr_art_initialize(&tree, 'tar2');
+
+    // A key for every byte after a shared prefix, so the node branching
+    // there grows through every size, then shrinks back as they go
+    uint8_t key[24] = "a shared prefix, x";
+    uint64_t counts[4][4] = {0};
+    unsigned checkpoints[] = { 4, 16, 48, 256 };
+    for (unsigned b = 0, c = 0; b < 256; ++b) {
+        key[17] = b;
+        TEST_SUCCESS(tr_art_put(&tree, key, 18, b));
+        if (b + 1 == checkpoints[c]) {
+            memcpy(counts[c++], tr_art_stat(&tree).nnodes, sizeof(counts[0]));
+        }
+    }
+    TEST_EQUAL(counts[0][trart_node4], 1);
+    TEST_EQUAL(counts[1][trart_node16], 1);
+    TEST_EQUAL(counts[2][trart_node48], 1);
+    TEST_EQUAL(counts[3][trart_node256], 1);
+    TEST_EQUAL(counts[3][trart_node4] + counts[3][trart_node16] + counts[3][trart_node48], 0);
+
+    for (unsigned b = 0; b < 256; ++b) {
+        uint64_t value;
+        key[17] = b;
+        TEST_SUCCESS(tr_art_get(&tree, key, 18, &value));
+        TEST_EQUAL(value, b);
+    }
+
+    for (unsigned b = 255; b >= 2; --b) {
+        key[17] = b;
+        TEST_SUCCESS(tr_art_delete(&tree, key, 18));
+    }
+    trartstat stat = tr_art_stat(&tree);
+    TEST_EQUAL(stat.nnodes[trart_node4], 1);
+    TEST_EQUAL(stat.nnodes[trart_node16] + stat.nnodes[trart_node48] + stat.nnodes[trart_node256], 0);
+
+    // A key which leaves the shared prefix part way splits it
+    TEST_SUCCESS(tr_art_put(&tree, "a shared thing", 14, 1000));
+    TEST_SUCCESS(tr_art_put(&tree, "a shared prefix", 15, 1001));
+    uint64_t value;
+    TEST_SUCCESS(tr_art_get(&tree, "a shared thing", 14, &value));
+    TEST_EQUAL(value, 1000);
+    TEST_SUCCESS(tr_art_get(&tree, "a shared prefix", 15, &value));
+    TEST_EQUAL(value, 1001);
+    key[17] = 1;
+    TEST_SUCCESS(tr_art_get(&tree, key, 18, &value));
+    TEST_EQUAL(value, 1);
+    TEST_EQUAL(tr_art_get(&tree, "a shared prefix, ", 17, &value), trstatus_not_found);
+    TEST_EQUAL(tr_art_get(&tree, "a shared", 8, &value), trstatus_not_found);
+
+    tr_art_cleanup(&tree);
+    TEST_EQUAL(tr_alloc_stat('tar2').nalloc, 0);
+}
+
+static void art_scan()
+{
+    art_key *keys = tr_alloc(ART_NKEYS * sizeof(art_key), 'tar3');
+    for (unsigned i = 0; i < ART_NKEYS; ++i) {
+        art_make_key(i, keys + i);
+    }
+
+    trart tree;
+    tr_art_initialize(&tree, 'tar3');
+    for (unsigned i = 0; i < ART_NKEYS; ++i) {
+        TEST_SUCCESS(tr_art_put(&tree, keys[i].key, keys[i].keylen, i));
+    }
+    qsort(keys, ART_NKEYS, sizeof(art_key), art_order);
+
+    // From the start, from each key, and from between keys
+    art_key from = { .keylen = 0 };
+    art_check_scan(&tree, keys, ART_NKEYS, &from, UINT32_MAX);
+    for (unsigned i = 0; i < ART_NKEYS; i += 97) {
+        art_check_scan(&tree, keys, ART_NKEYS, keys + i, 50);
+
+        from = keys[i];
+        from.key[from.keylen++] = 0;
+        art_check_scan(&tree, keys, ART_NKEYS, &from, 50);
+
+        from = keys[i];
+        from.keylen -= 1;
+        art_check_scan(&tree, keys, ART_NKEYS, &from, 50);
+    }
+
+    from.keylen = 7;
+    memcpy(from.key, "assets/", 7);
+    art_check_scan(&tree, keys, ART_NKEYS, &from, 100);
+    from.keylen = 3;
+    memcpy(from.key, "zzz", 3);
+    art_check_scan(&tree, keys, ART_NKEYS, &from, 100);
+
+    tr_art_cleanup(&tree);
+    tr_free(keys);
+    TEST_EQUAL(tr_alloc_stat('tar3').nalloc, 0);
+}
+
+static const test_case art_cases[] =
+{
+    TEST_CASE(art_put_get),
+    TEST_CASE(art_node_sizes),
+    TEST_CASE(art_scan),
+};
+
+TEST_SUITE(art_tests, art_cases);
@@ -0,0 +1,441 @@
+/////////////////////////////////////////////////////////////////////////////
+//
+// Terrascale
+// Copyright (c) Dave Kilian & Emily Kilian 2023. All rights reserved.
+//
+//////////////////////////////////////////////////////////////////////////////
+
+#include <pch.h>
+#include <test/test.h>
+#include <index/btree.h>
+#include <store/kv.h>
+
+#include <unistd.h>
+
+#define BTREE_NKEYS 20000
+
+static void btree_open_temp(trfile *file, char *path, size_t size)
+{
+    snprintf(path, size, "/tmp/trtest-btree-%d", (int)getpid());
+    TEST_SUCCESS(tr_file_open(file, path, tr_file_create | tr_file_truncate));
+}
+
+// Keys share long prefixes, and have different lengths
+static unsigned btree_key(unsigned i, char *key)
+{
+    return snprintf(key, 64, "terrascale/index/%u/%u", i % 7, i * 2654435761u % 1000003);
+}
+
+typedef struct {
+    char last[tr_btree_maxkey];
+    unsigned lastlen;
+    unsigned count;
+    uint64_t sum;
+    unsigned limit;
+} btree_scanstate;
+
+static bool btree_scan_check(const void *key, unsigned keylen, uint64_t value, void *context)
+{
+    btree_scanstate *state = context;
+    if (state->count > 0) {
+        TEST_LESS_THAN(tr_kv_compare(state->last, state->lastlen, key, keylen), 0);
+    }
+    memcpy(state->last, key, keylen);
+    state->lastlen = keylen;
+    state->count++;
+    state->sum += value;
+    return state->count < state->limit;
+}
+
+static void btree_check_all(trbtree *tree, unsigned nkeys, unsigned step)
+{
+    for (unsigned i = 0; i < nkeys; ++i) {
+        char key[64];
+        unsigned keylen = btree_key(i, key);
+        uint64_t value;
+        if (i % step == 0) {
+            TEST_SUCCESS(tr_btree_get(tree, key, keylen, &value));
+            TEST_EQUAL(value, i);
+        } else {
+            TEST_EQUAL(tr_btree_get(tree, key, keylen, &value), trstatus_not_found);
+        }
+    }
+
+    btree_scanstate state = { .limit = UINT32_MAX };
+    TEST_SUCCESS(tr_btree_scan(tree, "", 0, btree_scan_check, &state));
+    TEST_EQUAL(state.count, (nkeys + step - 1) / step);
+}
+
+static void btree_put_get()
+{
+    char path[64];
+    trfile file;
+    btree_open_temp(&file, path, sizeof(path));
+    trbufpool pool;
+    TEST_SUCCESS(tr_bufpool_initialize(&pool, 256, 'tbt1'));
+
+    trbtree tree;
+    TEST_SUCCESS(tr_btree_create(&tree, &pool, &file, 'tbt1'));
+    TEST_EQUAL(tr_btree_get(&tree, "a", 1, &(uint64_t){ 0 }), trstatus_not_found);
+
+    // Insert in a scattered order, then replace every value
+    for (unsigned i = 0; i < BTREE_NKEYS; ++i) {
+        char key[64];
+        unsigned j = i * 7919 % BTREE_NKEYS;
+        unsigned keylen = btree_key(j, key);
+        TEST_SUCCESS(tr_btree_put(&tree, key, keylen, j + 1));
+    }
+    for (unsigned i = 0; i < BTREE_NKEYS; ++i) {
+        char key[64];
+        unsigned keylen = btree_key(i, key);
+        TEST_SUCCESS(tr_btree_put(&tree, key, keylen, i));
+    }
+    btree_check_all(&tree, BTREE_NKEYS, 1);
+
+    trbtreestat stat;
+    TEST_SUCCESS(tr_btree_stat(&tree, &stat));
+    TEST_EQUAL(stat.nentries, BTREE_NKEYS);
+    TEST_GREATER_THAN(stat.height, 1);
+    TEST_GREATER_THAN(stat.leaffill, 0.5);
+    TEST_LESS_EQUAL(stat.leaffill, 1);
+
+    // Scans start anywhere, and stop when asked
+    char key[64];
+    unsigned keylen = btree_key(123, key);
+    btree_scanstate state = { .limit = 10 };
+    TEST_SUCCESS(tr_btree_scan(&tree, key, keylen, btree_scan_check, &state));
+    TEST_EQUAL(state.count, 10);
+
+    // Delete every other key
+    for (unsigned i = 1; i < BTREE_NKEYS; i += 2) {
+        keylen = btree_key(i, key);
+        TEST_SUCCESS(tr_btree_delete(&tree, key, keylen));
+        TEST_EQUAL(tr_btree_delete(&tree, key, keylen), trstatus_not_found);
+    }
+    btree_check_all(&tree, BTREE_NKEYS, 2);
+
+    // Reopen it through a fresh pool
+    TEST_SUCCESS(tr_btree_flush(&tree));
+    tr_btree_cleanup(&tree);
+    tr_bufpool_cleanup(&pool);
+    TEST_SUCCESS(tr_bufpool_initialize(&pool, 64, 'tbt1'));
+    TEST_SUCCESS(tr_btree_open(&tree, &pool, &file, 'tbt1'));
+    TEST_EQUAL(tree.meta.nentries, BTREE_NKEYS / 2);
+    btree_check_all(&tree, BTREE_NKEYS, 2);
+
+    tr_btree_cleanup(&tree);
+    tr_bufpool_cleanup(&pool);
+    tr_file_close(&file);
+    unlink(path);
+    TEST_EQUAL(tr_alloc_stat('tbt1').nalloc, 0);
+}
+
+static void btree_odd_keys()
+{
+    char path[64];
+    trfile file;
+    btree_open_temp(&file, path, sizeof(path));
+    trbufpool pool;
+    TEST_SUCCESS(tr_bufpool_initialize(&pool, 256, 'tbt2'));
+    trbtree tree;
+    TEST_SUCCESS(tr_btree_create(&tree, &pool, &file, 'tbt2'));
+
+    // The empty key, keys which are prefixes of each other, zero bytes
+    TEST_SUCCESS(tr_btree_put(&tree, "", 0, 1));
+    TEST_SUCCESS(tr_btree_put(&tree, "a", 1, 2));
+    TEST_SUCCESS(tr_btree_put(&tree, "a\0", 2, 3));
+    TEST_SUCCESS(tr_btree_put(&tree, "a\0\0\0\0", 5, 4));
+    TEST_SUCCESS(tr_btree_put(&tree, "abcd", 4, 5));
+    TEST_SUCCESS(tr_btree_put(&tree, "abcde", 5, 6));
+
+    // Long keys which differ only at the end force splits with long fences
+    uint8_t key[tr_btree_maxkey + 1];
+    memset(key, 'k', sizeof(key));
+    for (unsigned i = 0; i < 200; ++i) {
+        key[tr_btree_maxkey - 2] = 'a' + i % 26;
+        key[tr_btree_maxkey - 1] = 'a' + i / 26;
+        TEST_SUCCESS(tr_btree_put(&tree, key, tr_btree_maxkey, 100 + i));
+    }
+    TEST_EQUAL(tr_btree_put(&tree, key, tr_btree_maxkey + 1, 0), trstatus_too_large);
+
+    uint64_t value;
+    TEST_SUCCESS(tr_btree_get(&tree, "", 0, &value));
+    TEST_EQUAL(value, 1);
+    TEST_SUCCESS(tr_btree_get(&tree, "a\0", 2, &value));
+    TEST_EQUAL(value, 3);
+    TEST_SUCCESS(tr_btree_get(&tree, "a\0\0\0\0", 5, &value));
+    TEST_EQUAL(value, 4);
+    TEST_EQUAL(tr_btree_get(&tree, "a\0\0", 3, &value), trstatus_not_found);
+    TEST_SUCCESS(tr_btree_get(&tree, "abcde", 5, &value));
+    TEST_EQUAL(value, 6);
+    for (unsigned i = 0; i < 200; ++i) {
+        key[tr_btree_maxkey - 2] = 'a' + i % 26;
+        key[tr_btree_maxkey - 1] = 'a' + i / 26;
+        TEST_SUCCESS(tr_btree_get(&tree, key, tr_btree_maxkey, &value));
+        TEST_EQUAL(value, 100 + i);
+    }
+
+    btree_scanstate state = { .limit = UINT32_MAX };
+    TEST_SUCCESS(tr_btree_scan(&tree, "", 0, btree_scan_check, &state));
+    TEST_EQUAL(state.count, 206);
+
+    trbtreestat stat;
+    TEST_SUCCESS(tr_btree_stat(&tree, &stat));
+    TEST_GREATER_THAN(stat.height, 2);
+
+    tr_btree_cleanup(&tree);
+    tr_bufpool_cleanup(&pool);
+    tr_file_close(&file);
+    unlink(path);
+    TEST_EQUAL(tr_alloc_stat('tbt2').nalloc, 0);
+}
+
+// Sorts key indexes by key
+static int btree_sort_compare(const void *a, const void *b)
+{
+    char akey[64], bkey[64];
+    unsigned alen = btree_key(*(const unsigned *)a, akey);
+    unsigned blen = btree_key(*(const unsigned *)b, bkey);
+    return tr_kv_compare(akey, alen, bkey, blen);
+}
+
+static void btree_bulk_build()
+{
+    unsigned *order = tr_alloc(BTREE_NKEYS * sizeof(unsigned), 'tbt3');
+    for (unsigned i = 0; i < BTREE_NKEYS; ++i) {
+        order[i] = i;
+    }
+    qsort(order, BTREE_NKEYS, sizeof(unsigned), btree_sort_compare);
+
+    double fills[] = { 1.0, 0.7 };
+    for (unsigned f = 0; f < arraysize(fills); ++f) {
+        char path[64];
+        trfile file;
+        btree_open_temp(&file, path, sizeof(path));
+        trbufpool pool;
+        TEST_SUCCESS(tr_bufpool_initialize(&pool, 64, 'tbt3'));
+        trbtree tree;
+        TEST_SUCCESS(tr_btree_create(&tree, &pool, &file, 'tbt3'));
+
+        trbtbuilder builder;
+        TEST_EQUAL(tr_btree_build_begin(&builder, &tree, 0.2), trstatus_argument);
+        TEST_SUCCESS(tr_btree_build_begin(&builder, &tree, fills[f]));
+        for (unsigned i = 0; i < BTREE_NKEYS; ++i) {
+            char key[64];
+            unsigned keylen = btree_key(order[i], key);
+            TEST_SUCCESS(tr_btree_build_add(&builder, key, keylen, order[i]));
+        }
+        TEST_SUCCESS(tr_btree_build_finish(&builder));
+        btree_check_all(&tree, BTREE_NKEYS, 1);
+
+        // Pages are filled to the target, and no further
+        trbtreestat stat;
+        TEST_SUCCESS(tr_btree_stat(&tree, &stat));
+        TEST_EQUAL(stat.nentries, BTREE_NKEYS);
+        TEST_GREATER_THAN(stat.height, 1);
+        TEST_GREATER_THAN(stat.leaffill, fills[f] - 0.05);
+        TEST_LESS_EQUAL(stat.leaffill, fills[f]);
+
+        // A built tree takes inserts like any other
+        for (unsigned i = BTREE_NKEYS; i < BTREE_NKEYS * 2; ++i) {
+            char key[64];
+            unsigned keylen = btree_key(i, key);
+            TEST_SUCCESS(tr_btree_put(&tree, key, keylen, i));
+        }
+        btree_check_all(&tree, BTREE_NKEYS * 2, 1);
+
+        tr_btree_cleanup(&tree);
+        tr_bufpool_cleanup(&pool);
+        tr_file_close(&file);
+        unlink(path);
+    }
+
+    // Keys must be strictly increasing, and the tree empty
+    char path[64];
+    trfile file;
+    btree_open_temp(&file, path, sizeof(path));
+    trbufpool pool;
+    TEST_SUCCESS(tr_bufpool_initialize(&pool, 64, 'tbt3'));
+    trbtree tree;
+    TEST_SUCCESS(tr_btree_create(&tree, &pool, &file, 'tbt3'));
+    trbtbuilder builder;
+    TEST_SUCCESS(tr_btree_build_begin(&builder, &tree, 0.9));
+    TEST_SUCCESS(tr_btree_build_add(&builder, "b", 1, 1));
+    TEST_EQUAL(tr_btree_build_add(&builder, "b", 1, 2), trstatus_argument);
+    TEST_EQUAL(tr_btree_build_add(&builder, "a", 1, 2), trstatus_argument);
+    TEST_SUCCESS(tr_btree_build_add(&builder, "c", 1, 3));
+    TEST_SUCCESS(tr_btree_build_finish(&builder));
+    TEST_EQUAL(tree.meta.height, 1);
+    TEST_EQUAL(tr_btree_build_begin(&builder, &tree, 0.9), trstatus_argument);
+    uint64_t value;
+    TEST_SUCCESS(tr_btree_get(&tree, "c", 1, &value));
+    TEST_EQUAL(value, 3);
+
+    tr_btree_cleanup(&tree);
+    tr_bufpool_cleanup(&pool);
+    tr_file_close(&file);
+    unlink(path);
+    tr_free(order);
+    TEST_EQUAL(tr_alloc_stat('tbt3').nalloc, 0);
+}
+
+// Long keys which differ early, so the tree grows tall quickly
+static unsigned btree_long_key(unsigned i, char *key)
+{
+    int n = snprintf(key, 16, "%08u/", i * 7919 % 100003);
+    memset(key + n, 'x', 300 - n);
+    return 300;
+}
+
+static void btree_split_failure()
+{
+    char path[64], spare[80];
+    trfile file, sparefile;
+    btree_open_temp(&file, path, sizeof(path));
+    snprintf(spare, sizeof(spare), "%s-spare", path);
+    TEST_SUCCESS(tr_file_open(&sparefile, spare, tr_file_create | tr_file_truncate));
+
+    trbufpool pool;
+    TEST_SUCCESS(tr_bufpool_initialize(&pool, 16, 'tbt4'));
+    trbtree tree;
+    TEST_SUCCESS(tr_btree_create(&tree, &pool, &file, 'tbt4'));
+
+    // Leave the tree four frames: enough to split a leaf, but not to split
+    // its parent as well
+    trframe *pinned[12];
+    for (unsigned i = 0; i < 12; ++i) {
+        trpageno pageno;
+        TEST_SUCCESS(tr_bufpool_pin_new(&pool, &sparefile, &pageno, pinned + i));
+    }
+
+    char key[300];
+    unsigned n = 0;
+    trstatus s = trstatus_ok;
+    for (; n < 50000 && tr_ok(s); ++n) {
+        s = tr_btree_put(&tree, key, btree_long_key(n, key), n);
+    }
+    TEST_EQUAL(s, trstatus_no_mem);
+    n--;
+
+    // Everything put before the failed split is still reachable
+    for (unsigned i = 0; i < n; ++i) {
+        uint64_t value;
+        TEST_SUCCESS(tr_btree_get(&tree, key, btree_long_key(i, key), &value));
+        TEST_EQUAL(value, i);
+    }
+    TEST_EQUAL(tr_btree_get(&tree, key, btree_long_key(n, key), &(uint64_t){ 0 }), trstatus_not_found);
+    btree_scanstate state = { .limit = UINT32_MAX };
+    TEST_SUCCESS(tr_btree_scan(&tree, "", 0, btree_scan_check, &state));
+    TEST_EQUAL(state.count, n);
+
+    // With the frames back, the split goes through
+    for (unsigned i = 0; i < 12; ++i) {
+        tr_bufpool_unpin(&pool, pinned[i], false);
+    }
+    for (unsigned i = n; i < n + 1000; ++i) {
+        TEST_SUCCESS(tr_btree_put(&tree, key, btree_long_key(i, key), i));
+    }
+    for (unsigned i = 0; i < n + 1000; ++i) {
+        uint64_t value;
+        TEST_SUCCESS(tr_btree_get(&tree, key, btree_long_key(i, key), &value));
+        TEST_EQUAL(value, i);
+    }
+
+    trbtreestat stat;
+    TEST_SUCCESS(tr_btree_stat(&tree, &stat));
+    TEST_EQUAL(stat.nentries, n + 1000);
+
+    tr_btree_cleanup(&tree);
+    tr_bufpool_cleanup(&pool);
+    tr_file_close(&sparefile);
+    tr_file_close(&file);
+    unlink(spare);
+    unlink(path);
+    TEST_EQUAL(tr_alloc_stat('tbt4').nalloc, 0);
+}
+
+#define BTREE_NTHREADS 4
+
+typedef struct {
+    trbtree *tree;
+    int thread;
+} btree_worker;
+
+// Even threads put their share of the keys; odd ones look up and scan the
+// keys put beforehand
+//
+static void *btree_thread(void *context)
+{
+    btree_worker *w = context;
+    char key[64];
+
+    for (unsigned i = w->thread / 2; i < BTREE_NKEYS; i += BTREE_NTHREADS / 2) {
+        if (w->thread % 2 == 0) {
+            unsigned j = BTREE_NKEYS + i;
+            TEST_SUCCESS(tr_btree_put(w->tree, key, btree_key(j, key), j));
+        } else {
+            uint64_t value;
+            TEST_SUCCESS(tr_btree_get(w->tree, key, btree_key(i % 1000, key), &value));
+            TEST_EQUAL(value, i % 1000);
+            if (i % 1000 == 0) {
+                btree_scanstate state = { .limit = 500 };
+                TEST_SUCCESS(tr_btree_scan(w->tree, key, btree_key(i % 1000, key), btree_scan_check, &state));
+                TEST_EQUAL(state.count, 500);
+            }
+        }
+    }
+    return NULL;
+}
+
+static void btree_concurrent()
+{
+    char path[64];
+    trfile file;
+    btree_open_temp(&file, path, sizeof(path));
+    trbufpool pool;
+    TEST_SUCCESS(tr_bufpool_initialize(&pool, 256, 'tbt5'));
+    trbtree tree;
+    TEST_SUCCESS(tr_btree_create(&tree, &pool, &file, 'tbt5'));
+
+    char key[64];
+    for (unsigned i = 0; i < 1000; ++i) {
+        TEST_SUCCESS(tr_btree_put(&tree, key, btree_key(i, key), i));
+    }
+
+    pthread_t threads[BTREE_NTHREADS];
+    btree_worker workers[BTREE_NTHREADS];
+    for (int i = 0; i < BTREE_NTHREADS; ++i) {
+        workers[i] = (btree_worker){ &tree, i };
+        TEST_EQUAL(0, pthread_create(threads + i, NULL, &btree_thread, workers + i));
+    }
+    for (int i = 0; i < BTREE_NTHREADS; ++i) {
+        TEST_EQUAL(0, pthread_join(threads[i], NULL));
+    }
+
+    for (unsigned i = 0; i < BTREE_NKEYS; ++i) {
+        uint64_t value;
+        unsigned j = BTREE_NKEYS + i;
+        TEST_SUCCESS(tr_btree_get(&tree, key, btree_key(j, key), &value));
+        TEST_EQUAL(value, j);
+    }
+    btree_scanstate state = { .limit = UINT32_MAX };
+    TEST_SUCCESS(tr_btree_scan(&tree, "", 0, btree_scan_check, &state));
+    TEST_EQUAL(state.count, BTREE_NKEYS + 1000);
+
+    tr_btree_cleanup(&tree);
+    tr_bufpool_cleanup(&pool);
+    tr_file_close(&file);
+    unlink(path);
+    TEST_EQUAL(tr_alloc_stat('tbt5').nalloc, 0);
+}
+
+static const test_case btree_cases[] =
+{
+    TEST_CASE(btree_put_get),
+    TEST_CASE(btree_odd_keys),
+    TEST_CASE(btree_bulk_build),
+    TEST_CASE(btree_split_failure),
+    TEST_CASE(btree_concurrent),
+};
+
+TEST_SUITE(btree_tests, btree_cases);
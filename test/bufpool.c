@@ -0,0 +1,355 @@
+/////////////////////////////////////////////////////////////////////////////
+//
+// Terrascale
+// Copyright (c) Dave Kilian & Emily Kilian 2023. All rights reserved.
+//
+//////////////////////////////////////////////////////////////////////////////
+
+#include <pch.h>
+#include <test/test.h>
+#include <store/bufpool.h>
+
+#include <unistd.h>
+
+static void open_temp(trfile *file, char *path, size_t size)
+{
+    snprintf(path, size, "/tmp/trtest-bufpool-%d", (int)getpid());
+    TEST_SUCCESS(tr_file_open(file, path, tr_file_create | tr_file_truncate));
+}
+
+// Appends npages pages through the pool, each filled with its page number
+static void fill_file(trbufpool *pool, trfile *file, int npages)
+{
+    for (int i = 0; i < npages; ++i) {
+        trpageno pageno;
+        trframe *frame;
+        TEST_SUCCESS(tr_bufpool_pin_new(pool, file, &pageno, &frame));
+        TEST_EQUAL(pageno, (trpageno)i);
+        *(int *)tr_page_data(frame->data) = i;
+        tr_bufpool_unpin(pool, frame, true);
+    }
+}
+
+static void bufpool_hit_miss()
+{
+    char path[64];
+    trfile file;
+    open_temp(&file, path, sizeof(path));
+
+    trbufpool pool;
+    TEST_SUCCESS(tr_bufpool_initialize(&pool, 8, 'test'));
+    fill_file(&pool, &file, 4);
+
+    trframe *frame;
+    TEST_SUCCESS(tr_bufpool_pin(&pool, &file, 2, &frame));
+    TEST_EQUAL(*(int *)tr_page_data(frame->data), 2);
+    tr_bufpool_unpin(&pool, frame, false);
+
+    trbufpoolstat stat = tr_bufpool_stat(&pool);
+    TEST_EQUAL(stat.hits, 1);
+    TEST_EQUAL(stat.misses, 0);
+    TEST_EQUAL(stat.evictions, 0);
+
+    TEST_SUCCESS(tr_bufpool_flush(&pool, &file));
+    TEST_EQUAL(tr_bufpool_stat(&pool).writes, 4);
+
+    tr_bufpool_cleanup(&pool);
+    tr_file_close(&file);
+    unlink(path);
+}
+
+static void bufpool_eviction()
+{
+    char path[64];
+    trfile file;
+    open_temp(&file, path, sizeof(path));
+
+    // Four times as many pages as frames, so most must be evicted
+    trbufpool pool;
+    TEST_SUCCESS(tr_bufpool_initialize(&pool, 4, 'test'));
+    fill_file(&pool, &file, 16);
+
+    trbufpoolstat stat = tr_bufpool_stat(&pool);
+    TEST_EQUAL(stat.evictions, 12);
+    TEST_EQUAL(stat.writes, 12);
+
+    // Evicted dirty pages were written back, and read back in on demand
+    for (int pass = 0; pass < 2; ++pass) {
+        for (int i = 0; i < 16; ++i) {
+            trframe *frame;
+            TEST_SUCCESS(tr_bufpool_pin(&pool, &file, i, &frame));
+            TEST_EQUAL(*(int *)tr_page_data(frame->data), i);
+            tr_bufpool_unpin(&pool, frame, false);
+        }
+    }
+
+    stat = tr_bufpool_stat(&pool);
+    TEST_GREATER_THAN(stat.misses, 0);
+    TEST_EQUAL(stat.hits + stat.misses, 32);
+
+    tr_bufpool_cleanup(&pool);
+    tr_file_close(&file);
+    unlink(path);
+}
+
+static void bufpool_clock()
+{
+    char path[64];
+    trfile file;
+    open_temp(&file, path, sizeof(path));
+
+    trbufpool pool;
+    TEST_SUCCESS(tr_bufpool_initialize(&pool, 4, 'test'));
+    fill_file(&pool, &file, 8);
+    TEST_SUCCESS(tr_bufpool_flush(&pool, &file));
+
+    // Keep touching page 0 while streaming through the others; its reference
+    // bit should keep it resident
+    trframe *frame;
+    for (int i = 1; i < 8; ++i) {
+        TEST_SUCCESS(tr_bufpool_pin(&pool, &file, 0, &frame));
+        tr_bufpool_unpin(&pool, frame, false);
+        TEST_SUCCESS(tr_bufpool_pin(&pool, &file, i, &frame));
+        tr_bufpool_unpin(&pool, frame, false);
+    }
+
+    trbufpoolstat before = tr_bufpool_stat(&pool);
+    TEST_SUCCESS(tr_bufpool_pin(&pool, &file, 0, &frame));
+    tr_bufpool_unpin(&pool, frame, false);
+    TEST_EQUAL(tr_bufpool_stat(&pool).hits, before.hits + 1);
+
+    tr_bufpool_cleanup(&pool);
+    tr_file_close(&file);
+    unlink(path);
+}
+
+static void bufpool_all_pinned()
+{
+    char path[64];
+    trfile file;
+    open_temp(&file, path, sizeof(path));
+
+    trbufpool pool;
+    TEST_SUCCESS(tr_bufpool_initialize(&pool, 2, 'test'));
+
+    trpageno pageno;
+    trframe *frames[2];
+    TEST_SUCCESS(tr_bufpool_pin_new(&pool, &file, &pageno, frames + 0));
+    TEST_SUCCESS(tr_bufpool_pin_new(&pool, &file, &pageno, frames + 1));
+
+    trframe *extra;
+    TEST_EQUAL(tr_bufpool_pin_new(&pool, &file, &pageno, &extra), trstatus_no_mem);
+
+    tr_bufpool_unpin(&pool, frames[0], true);
+    tr_bufpool_unpin(&pool, frames[1], true);
+    TEST_SUCCESS(tr_bufpool_flush(&pool, &file));
+
+    tr_bufpool_cleanup(&pool);
+    tr_file_close(&file);
+    unlink(path);
+}
+
+static void bufpool_invalidate()
+{
+    char path[64], other[80];
+    trfile file;
+    open_temp(&file, path, sizeof(path));
+    snprintf(other, sizeof(other), "%s-other", path);
+
+    trbufpool pool;
+    TEST_SUCCESS(tr_bufpool_initialize(&pool, 8, 'test'));
+
+    // A second file, whose pages hold their page number plus 100
+    trfile second;
+    TEST_SUCCESS(tr_file_open(&second, other, tr_file_create | tr_file_truncate));
+    for (int i = 0; i < 4; ++i) {
+        trpageno pageno;
+        trframe *frame;
+        TEST_SUCCESS(tr_bufpool_pin_new(&pool, &second, &pageno, &frame));
+        *(int *)tr_page_data(frame->data) = 100 + i;
+        tr_bufpool_unpin(&pool, frame, true);
+    }
+    TEST_SUCCESS(tr_bufpool_flush(&pool, &second));
+    tr_bufpool_invalidate(&pool, &second);
+    tr_file_close(&second);
+
+    // Close the first file without invalidating it, and open the second
+    // in its trfile; the first file's cached pages must not be mistaken
+    // for the second's
+    fill_file(&pool, &file, 4);
+    TEST_SUCCESS(tr_bufpool_flush(&pool, &file));
+    tr_file_close(&file);
+    TEST_SUCCESS(tr_file_open(&file, other, 0));
+
+    trframe *frame;
+    TEST_SUCCESS(tr_bufpool_pin(&pool, &file, 2, &frame));
+    TEST_EQUAL(*(int *)tr_page_data(frame->data), 102);
+    tr_bufpool_unpin(&pool, frame, false);
+    TEST_EQUAL(tr_bufpool_stat(&pool).misses, 1);
+
+    // Once invalidated, the page is read again
+    tr_bufpool_invalidate(&pool, &file);
+    TEST_SUCCESS(tr_bufpool_pin(&pool, &file, 2, &frame));
+    TEST_EQUAL(*(int *)tr_page_data(frame->data), 102);
+    tr_bufpool_unpin(&pool, frame, false);
+    TEST_EQUAL(tr_bufpool_stat(&pool).misses, 2);
+
+    tr_bufpool_invalidate(&pool, &file);
+    tr_bufpool_cleanup(&pool);
+    tr_file_close(&file);
+    unlink(other);
+    unlink(path);
+}
+
+static void bufpool_writeback()
+{
+    char path[64];
+    trfile file;
+    open_temp(&file, path, sizeof(path));
+
+    trbufpool pool;
+    TEST_SUCCESS(tr_bufpool_initialize(&pool, 16, 'test'));
+    fill_file(&pool, &file, 10);
+    TEST_EQUAL(tr_bufpool_stat(&pool).writes, 0);
+
+    trtaskmanconfig config;
+    tr_taskman_defaults(&config, trtaskman_shared);
+    config.nworkers = 2;
+    config.pin = false;
+    config.tag = 'test';
+
+    trtaskman tm;
+    TEST_SUCCESS(tr_taskman_initialize(&tm, &config));
+    tr_bufpool_writeback(&pool, &tm);
+    tr_taskman_drain(&tm);
+    tr_taskman_cleanup(&tm);
+
+    TEST_EQUAL(tr_bufpool_stat(&pool).writes, 10);
+
+    // Everything is clean now, so a flush writes nothing
+    TEST_SUCCESS(tr_bufpool_flush(&pool, &file));
+    TEST_EQUAL(tr_bufpool_stat(&pool).writes, 10);
+
+    char *page = tr_alloc_aligned(tr_pagesize, tr_pagesize, 'test');
+    TEST_SUCCESS(tr_file_read(&file, 7, page));
+    TEST_EQUAL(*(int *)tr_page_data(page), 7);
+    tr_free(page);
+
+    tr_bufpool_cleanup(&pool);
+    tr_file_close(&file);
+    unlink(path);
+}
+
+static void bufpool_scan_resistance()
+{
+    char path[64];
+    trfile file;
+    open_temp(&file, path, sizeof(path));
+
+    trbufpool pool;
+    TEST_SUCCESS(tr_bufpool_initialize(&pool, 64, 'test'));
+    fill_file(&pool, &file, 256);
+    TEST_SUCCESS(tr_bufpool_flush(&pool, &file));
+
+    // A hot set of every other page, which is never sequential
+    trframe *frame;
+    for (int pass = 0; pass < 2; ++pass) {
+        for (int i = 0; i < 32; i += 2) {
+            TEST_SUCCESS(tr_bufpool_pin(&pool, &file, i, &frame));
+            tr_bufpool_unpin(&pool, frame, false);
+        }
+    }
+
+    // Scan the whole file, four times the size of the pool
+    for (int i = 0; i < 256; ++i) {
+        TEST_SUCCESS(tr_bufpool_pin(&pool, &file, i, &frame));
+        TEST_EQUAL(*(int *)tr_page_data(frame->data), i);
+        tr_bufpool_unpin(&pool, frame, false);
+    }
+
+    trbufpoolstat before = tr_bufpool_stat(&pool);
+    TEST_GREATER_THAN(before.sequential, 200);
+
+    for (int i = 0; i < 32; i += 2) {
+        TEST_SUCCESS(tr_bufpool_pin(&pool, &file, i, &frame));
+        tr_bufpool_unpin(&pool, frame, false);
+    }
+
+    trbufpoolstat stat = tr_bufpool_stat(&pool);
+    TEST_EQUAL(stat.hits, before.hits + 16);
+    TEST_EQUAL(stat.misses, before.misses);
+
+    tr_bufpool_cleanup(&pool);
+    tr_file_close(&file);
+    unlink(path);
+}
+
+static void bufpool_readahead()
+{
+    char path[64];
+    trfile file;
+    open_temp(&file, path, sizeof(path));
+
+    // Only the last 256 pages written are still resident
+    trbufpool pool;
+    TEST_SUCCESS(tr_bufpool_initialize(&pool, 256, 'test'));
+    fill_file(&pool, &file, 512);
+    TEST_SUCCESS(tr_bufpool_flush(&pool, &file));
+
+    trtaskmanconfig config;
+    tr_taskman_defaults(&config, trtaskman_shared);
+    config.nworkers = 2;
+    config.pin = false;
+    config.tag = 'test';
+
+    trtaskman tm;
+    TEST_SUCCESS(tr_taskman_initialize(&tm, &config));
+    tr_bufpool_readahead(&pool, &tm);
+
+    // The run becomes sequential at its fourth page, which starts reading
+    // the next window ahead; flushing waits for it
+    trframe *frame;
+    for (int i = 0; i < tr_bufpool_seqrun; ++i) {
+        TEST_SUCCESS(tr_bufpool_pin(&pool, &file, i, &frame));
+        tr_bufpool_unpin(&pool, frame, false);
+    }
+    TEST_SUCCESS(tr_bufpool_flush(&pool, &file));
+
+    trbufpoolstat before = tr_bufpool_stat(&pool);
+    TEST_EQUAL(before.prefetches, tr_bufpool_minreadahead);
+
+    for (int i = tr_bufpool_seqrun; i < tr_bufpool_seqrun + tr_bufpool_minreadahead; ++i) {
+        TEST_SUCCESS(tr_bufpool_pin(&pool, &file, i, &frame));
+        TEST_EQUAL(*(int *)tr_page_data(frame->data), i);
+        tr_bufpool_unpin(&pool, frame, false);
+    }
+    TEST_EQUAL(tr_bufpool_stat(&pool).misses, before.misses);
+
+    // The rest of the scan reads correctly however it races the readahead
+    for (int i = tr_bufpool_seqrun + tr_bufpool_minreadahead; i < 256; ++i) {
+        TEST_SUCCESS(tr_bufpool_pin(&pool, &file, i, &frame));
+        TEST_EQUAL(*(int *)tr_page_data(frame->data), i);
+        tr_bufpool_unpin(&pool, frame, false);
+    }
+    TEST_SUCCESS(tr_bufpool_flush(&pool, &file));
+
+    tr_taskman_drain(&tm);
+    tr_taskman_cleanup(&tm);
+    tr_bufpool_cleanup(&pool);
+    tr_file_close(&file);
+    unlink(path);
+}
+
+static const test_case bufpool_cases[] =
+{
+    TEST_CASE(bufpool_hit_miss),
+    TEST_CASE(bufpool_eviction),
+    TEST_CASE(bufpool_clock),
+    TEST_CASE(bufpool_all_pinned),
+    TEST_CASE(bufpool_invalidate),
+    TEST_CASE(bufpool_writeback),
+    TEST_CASE(bufpool_scan_resistance),
+    TEST_CASE(bufpool_readahead),
+};
+
+TEST_SUITE(bufpool_tests, bufpool_cases);
@@ -0,0 +1,35 @@
+/////////////////////////////////////////////////////////////////////////////
+//
+// Terrascale
+// Copyright (c) Dave Kilian & Emily Kilian 2023. All rights reserved.
+//
+//////////////////////////////////////////////////////////////////////////////
+
+#include <pch.h>
+#include <test/test.h>
+#include <runtime/clock.h>
+
+static void clock_units()
+{
+    TEST_EQUAL(tr_us(1), tr_ns(1000));
+    TEST_EQUAL(tr_ms(1), tr_us(1000));
+    TEST_EQUAL(tr_sec(1), tr_ms(1000));
+}
+
+static void clock_monotonic()
+{
+    trtime prev = tr_clock_now();
+    for (int i = 0; i < 1000; ++i) {
+        trtime now = tr_clock_now();
+        TEST_GREATER_EQUAL(now, prev);
+        prev = now;
+    }
+}
+
+static const test_case clock_cases[] =
+{
+    TEST_CASE(clock_units),
+    TEST_CASE(clock_monotonic),
+};
+
+TEST_SUITE(clock_tests, clock_cases);
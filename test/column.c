@@ -0,0 +1,453 @@
+/////////////////////////////////////////////////////////////////////////////
+//
+// Terrascale
+// Copyright (c) Dave Kilian & Emily Kilian 2023. All rights reserved.
+//
+//////////////////////////////////////////////////////////////////////////////
+
+#include <pch.h>
+#include <test/test.h>
+#include <table/colpred.h>
+
+#include <math.h>
+
+#define COLUMN_NROWS (2 * tr_colchunk_rows + 1000)
+
+static uint64_t column_rand(uint64_t *state)
+{
+    uint64_t x = *state;
+    x ^= x << 13;
+    x ^= x >> 7;
+    x ^= x << 17;
+    return *state = x;
+}
+
+static void column_append_get()
+{
+    trcolumn col;
+    tr_column_initialize(&col, trcol_i32, 'tcl1');
+
+    // Nulls only in the middle chunk
+    for (int32_t i = 0; i < COLUMN_NROWS; ++i) {
+        bool null = i >= tr_colchunk_rows && i < 2 * tr_colchunk_rows && i % 7 == 0;
+        if (null) {
+            TEST_SUCCESS(tr_column_append_null(&col));
+        } else {
+            int32_t v = i - 100;
+            TEST_SUCCESS(tr_column_append(&col, &v, 1));
+        }
+    }
+
+    TEST_EQUAL(col.nrows, COLUMN_NROWS);
+    TEST_EQUAL(col.nchunks, 3);
+    TEST_NULL(col.chunks[0].nulls);
+    TEST_NOT_NULL(col.chunks[1].nulls);
+    TEST_NULL(col.chunks[2].nulls);
+    TEST_EQUAL(col.chunks[2].nrows, 1000);
+    TEST_EQUAL((uintptr_t)col.chunks[2].values % tr_colchunk_align, 0);
+
+    // Row 16384 isn't a multiple of 7, but row 32767 is
+    for (int i = 0; i < 3; ++i) {
+        TEST_EQUAL(col.chunks[i].min.i, i * tr_colchunk_rows - 100);
+        TEST_EQUAL(col.chunks[i].max.i, min((i + 1) * tr_colchunk_rows, COLUMN_NROWS) - 101 - (i == 1));
+    }
+    TEST_EQUAL(col.chunks[1].nnulls, (2 * tr_colchunk_rows - 1) / 7 - (tr_colchunk_rows - 1) / 7);
+
+    for (int32_t i = 0; i < COLUMN_NROWS; ++i) {
+        trcolvalue v;
+        bool null = i >= tr_colchunk_rows && i < 2 * tr_colchunk_rows && i % 7 == 0;
+        TEST_EQUAL(tr_column_get(&col, i, &v), !null);
+        if (!null) {
+            TEST_EQUAL(v.i, i - 100);
+        }
+    }
+
+    // Bulk appends span chunks
+    trcolumn bulk;
+    tr_column_initialize(&bulk, trcol_f64, 'tcl1');
+    double *values = tr_alloc(COLUMN_NROWS * sizeof(double), 'tcl1');
+    for (int i = 0; i < COLUMN_NROWS; ++i) {
+        values[i] = i * 0.5;
+    }
+    TEST_SUCCESS(tr_column_append(&bulk, values, COLUMN_NROWS));
+    TEST_EQUAL(bulk.nchunks, 3);
+    TEST_EQUAL(bulk.chunks[1].min.f, tr_colchunk_rows * 0.5);
+    trcolvalue v;
+    TEST_TRUE(tr_column_get(&bulk, COLUMN_NROWS - 1, &v));
+    TEST_EQUAL(v.f, (COLUMN_NROWS - 1) * 0.5);
+
+    tr_free(values);
+    tr_column_cleanup(&bulk);
+    tr_column_cleanup(&col);
+    TEST_EQUAL(tr_alloc_stat('tcl1').nalloc, 0);
+}
+
+// Evaluates a comparison the slow way
+static bool column_compare(trcoltype type, trcolop op, trcolvalue x, trcolvalue a, trcolvalue b)
+{
+    if (type == trcol_f64) {
+        switch (op) {
+        case trcolop_eq: return x.f == a.f;
+        case trcolop_ne: return x.f != a.f;
+        case trcolop_lt: return x.f < a.f;
+        case trcolop_le: return x.f <= a.f;
+        case trcolop_gt: return x.f > a.f;
+        case trcolop_ge: return x.f >= a.f;
+        case trcolop_between: return x.f >= a.f && x.f <= b.f;
+        }
+    }
+
+    switch (op) {
+    case trcolop_eq: return x.i == a.i;
+    case trcolop_ne: return x.i != a.i;
+    case trcolop_lt: return x.i < a.i;
+    case trcolop_le: return x.i <= a.i;
+    case trcolop_gt: return x.i > a.i;
+    case trcolop_ge: return x.i >= a.i;
+    case trcolop_between: return x.i >= a.i && x.i <= b.i;
+    }
+
+    return false;
+}
+
+// Filters a column with every implementation, checking against column_compare
+static void column_check_filter(const trcolumn *col, trcolop op, trcolvalue a, trcolvalue b, uint64_t *bitmap)
+{
+    for (trcolimpl impl = trcolimpl_scalar; impl <= tr_colpred_best(); ++impl) {
+        trcolpred pred;
+        tr_colpred_compile_with(impl, &pred, col->type, op, a, b);
+        uint64_t count = tr_colpred_filter(&pred, col, bitmap, false, NULL);
+
+        uint64_t expect = 0;
+        for (uint64_t row = 0; row < col->nrows; ++row) {
+            trcolvalue x;
+            bool match = tr_column_get(col, row, &x) && column_compare(col->type, op, x, a, b);
+            TEST_EQUAL((bitmap[row / 64] >> (row % 64)) & 1, match);
+            expect += match;
+        }
+        TEST_EQUAL(count, expect);
+    }
+}
+
+static void column_filter_type(trcoltype type)
+{
+    trcolumn col;
+    tr_column_initialize(&col, type, 'tcl2');
+
+    // Small values, so comparisons often hit; some nulls, and for doubles
+    // some NaNs and infinities
+    uint64_t seed = 0x1234567;
+    for (int i = 0; i < COLUMN_NROWS; ++i) {
+        uint64_t r = column_rand(&seed);
+        if (r % 13 == 0) {
+            TEST_SUCCESS(tr_column_append_null(&col));
+            continue;
+        }
+
+        int32_t i32 = (int32_t)(r >> 32) % 50;
+        int64_t i64 = (int64_t)(r >> 8) % 50;
+        double f64 = (r % 101 == 0) ? NAN : (r % 103 == 0) ? -INFINITY : (int64_t)(r >> 40) % 50 / 4.0;
+        TEST_SUCCESS(tr_column_append(&col,
+            type == trcol_i32 ? (void *)&i32 : type == trcol_i64 ? (void *)&i64 : (void *)&f64, 1));
+    }
+
+    struct { trcolop op; double a, b; } cases[] = {
+        { trcolop_eq, 3, 0 }, { trcolop_ne, 3, 0 }, { trcolop_lt, -2, 0 }, { trcolop_le, 0, 0 },
+        { trcolop_gt, 7, 0 }, { trcolop_ge, 49, 0 }, { trcolop_between, -5, 5 },
+        { trcolop_between, 5, -5 }, { trcolop_gt, 1000, 0 }, { trcolop_ne, 1000, 0 },
+        { trcolop_lt, -1000, 0 }, { trcolop_ge, -1000, 0 },
+    };
+
+    size_t nwords = tr_colpred_words(&col);
+    uint64_t *bitmap = tr_alloc(nwords * sizeof(uint64_t), 'tcl2');
+
+    for (int c = 0; c < arraysize(cases); ++c) {
+        trcolvalue a, b;
+        if (type == trcol_f64) {
+            a.f = cases[c].a, b.f = cases[c].b;
+        } else {
+            a.i = cases[c].a, b.i = cases[c].b;
+        }
+        column_check_filter(&col, cases[c].op, a, b, bitmap);
+    }
+
+    // Comparisons with NaN follow C: only != matches, and it matches every
+    // non-null row, NaNs included
+    if (type == trcol_f64) {
+        const trcolop ops[] = { trcolop_eq, trcolop_ne, trcolop_lt, trcolop_ge, trcolop_between };
+        trcolvalue nan = { .f = NAN }, five = { .f = 5 };
+        for (int o = 0; o < arraysize(ops); ++o) {
+            column_check_filter(&col, ops[o], nan, five, bitmap);
+        }
+
+        // Also where the zone map decides, in a chunk without NaNs
+        trcolumn ordered;
+        tr_column_initialize(&ordered, trcol_f64, 'tcl2');
+        for (int i = 0; i < 100; ++i) {
+            double v = i / 3.0;
+            TEST_SUCCESS(tr_column_append(&ordered, &v, 1));
+        }
+        trcolpred pred;
+        trcolscanstat stat;
+        tr_colpred_compile(&pred, trcol_f64, trcolop_ne, nan, nan);
+        TEST_EQUAL(tr_colpred_filter(&pred, &ordered, bitmap, false, &stat), 100);
+        TEST_EQUAL(stat.nfull, 1);
+        column_check_filter(&ordered, trcolop_ne, nan, nan, bitmap);
+        tr_column_cleanup(&ordered);
+    }
+
+    // Integer comparisons against constants beyond the column's type
+    if (type == trcol_i32) {
+        trcolpred pred;
+        trcolvalue big = { .i = (int64_t)INT32_MAX + 1 };
+        tr_colpred_compile(&pred, type, trcolop_lt, big, big);
+        TEST_EQUAL(tr_colpred_filter(&pred, &col, bitmap, false, NULL), col.nrows - col.chunks[0].nnulls
+            - col.chunks[1].nnulls - col.chunks[2].nnulls);
+        tr_colpred_compile(&pred, type, trcolop_eq, big, big);
+        TEST_EQUAL(tr_colpred_filter(&pred, &col, bitmap, false, NULL), 0);
+    }
+
+    tr_free(bitmap);
+    tr_column_cleanup(&col);
+    TEST_EQUAL(tr_alloc_stat('tcl2').nalloc, 0);
+}
+
+static void column_filter_i32()
+{
+    column_filter_type(trcol_i32);
+}
+
+static void column_filter_i64()
+{
+    column_filter_type(trcol_i64);
+}
+
+static void column_filter_f64()
+{
+    column_filter_type(trcol_f64);
+}
+
+static void column_zone_maps()
+{
+    // A sorted column: zone maps decide every chunk but the one holding the
+    // bounds of the range
+    trcolumn ids, parity;
+    tr_column_initialize(&ids, trcol_i64, 'tcl3');
+    tr_column_initialize(&parity, trcol_i32, 'tcl3');
+    for (int64_t i = 0; i < 8 * tr_colchunk_rows; ++i) {
+        int32_t p = i % 2;
+        TEST_SUCCESS(tr_column_append(&ids, &i, 1));
+        TEST_SUCCESS(tr_column_append(&parity, &p, 1));
+    }
+
+    uint64_t *bitmap = tr_alloc(tr_colpred_words(&ids) * sizeof(uint64_t), 'tcl3');
+
+    trcolpred pred;
+    trcolscanstat stat;
+    trcolvalue lo = { .i = 2 * tr_colchunk_rows }, hi = { .i = 5 * tr_colchunk_rows + 10 };
+    tr_colpred_compile(&pred, trcol_i64, trcolop_between, lo, hi);
+    TEST_EQUAL(tr_colpred_filter(&pred, &ids, bitmap, false, &stat), 3 * tr_colchunk_rows + 11);
+    TEST_EQUAL(stat.nchunks, 8);
+    TEST_EQUAL(stat.nfull, 3);
+    TEST_EQUAL(stat.nscanned, 1);
+    TEST_EQUAL(stat.nskipped, 4);
+
+    // Refining skips chunks with nothing selected
+    trcolvalue one = { .i = 1 };
+    tr_colpred_compile(&pred, trcol_i32, trcolop_eq, one, one);
+    TEST_EQUAL(tr_colpred_filter(&pred, &parity, bitmap, true, &stat), (3 * tr_colchunk_rows + 10) / 2);
+    TEST_EQUAL(stat.nskipped, 4);
+    TEST_EQUAL(stat.nscanned, 4);
+    TEST_EQUAL(bitmap[2 * tr_colchunk_rows / 64], 0xaaaaaaaaaaaaaaaaull);
+
+    tr_free(bitmap);
+    tr_column_cleanup(&ids);
+    tr_column_cleanup(&parity);
+    TEST_EQUAL(tr_alloc_stat('tcl3').nalloc, 0);
+}
+
+static void column_encodings()
+{
+    // i64 chunks suiting each encoding, then one suiting none
+    trcolumn col;
+    tr_column_initialize(&col, trcol_i64, 'tcl4');
+    static const int64_t spread[] = { -1000000000000, -5, 0, 7, 99999, 1000000000000 };
+
+    uint64_t seed = 0xabcdef;
+    for (int i = 0; i < 6 * tr_colchunk_rows; ++i) {
+        uint64_t r = column_rand(&seed);
+        int64_t v;
+        switch (i / tr_colchunk_rows) {
+        case 0: v = i / 1000 - 3; break;                            // Runs
+        case 1: v = 1000 + r % 200; break;                          // Packed, 1 byte
+        case 2: v = spread[r % arraysize(spread)]; break;           // Dictionary, 1 byte
+        case 3: v = (int64_t)(r % 1000) * 1000000007; break;        // Dictionary, 2 bytes
+        case 4: v = -(int64_t)(r % 3000000000); break;              // Packed, 4 bytes
+        default: v = r; break;                                      // Plain
+        }
+
+        if (r % 11 == 0) {
+            TEST_SUCCESS(tr_column_append_null(&col));
+        } else {
+            TEST_SUCCESS(tr_column_append(&col, &v, 1));
+        }
+    }
+
+    TEST_EQUAL(col.nchunks, 6);
+    TEST_EQUAL(col.chunks[0].encoding, trcolenc_runs);
+    TEST_EQUAL(col.chunks[0].nruns, 17);
+    TEST_EQUAL(col.chunks[1].encoding, trcolenc_packed);
+    TEST_EQUAL(col.chunks[1].codewidth, 1);
+    TEST_EQUAL(col.chunks[2].encoding, trcolenc_dict);
+    TEST_EQUAL(col.chunks[2].codewidth, 1);
+    TEST_EQUAL(col.chunks[2].ndict, arraysize(spread));
+    TEST_EQUAL(col.chunks[3].encoding, trcolenc_dict);
+    TEST_EQUAL(col.chunks[3].codewidth, 2);
+    TEST_EQUAL(col.chunks[4].encoding, trcolenc_packed);
+    TEST_EQUAL(col.chunks[4].codewidth, 4);
+    TEST_EQUAL(col.chunks[5].encoding, trcolenc_plain);
+    TEST_LESS_THAN(tr_column_size(&col), 6 * tr_colchunk_rows * sizeof(int64_t) / 2);
+
+    // Decoding gives back what was appended
+    seed = 0xabcdef;
+    for (int i = 0; i < 6 * tr_colchunk_rows; ++i) {
+        uint64_t r = column_rand(&seed);
+        trcolvalue v;
+        TEST_EQUAL(tr_column_get(&col, i, &v), r % 11 != 0);
+        if (r % 11 != 0 && i / tr_colchunk_rows == 1) {
+            TEST_EQUAL(v.i, 1000 + (int64_t)(r % 200));
+        }
+        if (r % 11 != 0 && i / tr_colchunk_rows == 3) {
+            TEST_EQUAL(v.i, (int64_t)(r % 1000) * 1000000007);
+        }
+    }
+
+    // Ranges which land inside, between and around encoded values
+    struct { trcolop op; int64_t a, b; } cases[] = {
+        { trcolop_eq, 7, 0 }, { trcolop_ne, 7, 0 }, { trcolop_between, 1050, 1099 },
+        { trcolop_between, 1, 6 }, { trcolop_between, -6, 99999 }, { trcolop_lt, 5, 0 },
+        { trcolop_ge, 1000, 0 }, { trcolop_eq, 1000000007 * 500ll, 0 },
+        { trcolop_between, 1000000007 * 100ll, 1000000007 * 200ll - 1 },
+        { trcolop_gt, -1500000000, 0 }, { trcolop_le, -2999999990, 0 },
+    };
+
+    uint64_t *bitmap = tr_alloc(tr_colpred_words(&col) * sizeof(uint64_t), 'tcl4');
+    for (int c = 0; c < arraysize(cases); ++c) {
+        trcolvalue a = { .i = cases[c].a }, b = { .i = cases[c].b };
+        column_check_filter(&col, cases[c].op, a, b, bitmap);
+    }
+
+    trcolpred pred;
+    trcolscanstat stat;
+    trcolvalue a = { .i = 0 }, b = { .i = 1050 };
+    tr_colpred_compile(&pred, trcol_i64, trcolop_between, a, b);
+    tr_colpred_filter(&pred, &col, bitmap, false, &stat);
+    TEST_EQUAL(stat.nskipped, 1);   // All negative
+    TEST_EQUAL(stat.nscanned, 5);
+    TEST_EQUAL(stat.nencoded, 4);
+
+    // Encoding can be turned off, and 2-byte codes used for i32 columns
+    trcolumn plain, narrow;
+    tr_column_initialize(&plain, trcol_i64, 'tcl4');
+    tr_column_initialize(&narrow, trcol_i32, 'tcl4');
+    plain.encode = false;
+    for (int32_t i = 0; i < tr_colchunk_rows; ++i) {
+        int64_t v = i / 100;
+        int32_t w = (int32_t)(column_rand(&seed) % 40000) - 20000;
+        TEST_SUCCESS(tr_column_append(&plain, &v, 1));
+        TEST_SUCCESS(tr_column_append(&narrow, &w, 1));
+    }
+    TEST_EQUAL(plain.chunks[0].encoding, trcolenc_plain);
+    TEST_EQUAL(narrow.chunks[0].encoding, trcolenc_packed);
+    TEST_EQUAL(narrow.chunks[0].codewidth, 2);
+    a.i = -100, b.i = 5000;
+    column_check_filter(&narrow, trcolop_between, a, b, bitmap);
+    column_check_filter(&narrow, trcolop_ne, a, b, bitmap);
+
+    tr_free(bitmap);
+    tr_column_cleanup(&col);
+    tr_column_cleanup(&plain);
+    tr_column_cleanup(&narrow);
+    TEST_EQUAL(tr_alloc_stat('tcl4').nalloc, 0);
+}
+
+// Value of row i for column_truncate: runs in the first chunk, then values
+// suiting packing; every 11th row is null
+static int64_t column_truncate_value(uint64_t i)
+{
+    return i < tr_colchunk_rows ? (int64_t)(i / 1000) : 1000 + (int64_t)(i % 200);
+}
+
+static void column_truncate_fill(trcolumn *col, uint64_t nrows)
+{
+    for (uint64_t i = col->nrows; i < nrows; ++i) {
+        int64_t v = column_truncate_value(i);
+        TEST_SUCCESS(i % 11 == 0 ? tr_column_append_null(col) : tr_column_append(col, &v, 1));
+    }
+}
+
+static void column_truncate_check(const trcolumn *col, uint64_t *bitmap)
+{
+    for (uint64_t i = 0; i < col->nrows; ++i) {
+        trcolvalue v;
+        TEST_EQUAL(tr_column_get(col, i, &v), i % 11 != 0);
+        if (i % 11 != 0) {
+            TEST_EQUAL(v.i, column_truncate_value(i));
+        }
+    }
+
+    trcolvalue a = { .i = 3 }, b = { .i = 1100 };
+    column_check_filter(col, trcolop_between, a, b, bitmap);
+}
+
+static void column_truncate()
+{
+    trcolumn col;
+    tr_column_initialize(&col, trcol_i64, 'tcl5');
+    uint64_t *bitmap = tr_alloc(3 * (tr_colchunk_rows / 64) * sizeof(uint64_t), 'tcl5');
+
+    column_truncate_fill(&col, 2 * tr_colchunk_rows + 100);
+    TEST_EQUAL(col.chunks[0].encoding, trcolenc_runs);
+    TEST_EQUAL(col.chunks[1].encoding, trcolenc_packed);
+
+    // Into a packed chunk, which is unsealed once appended to again
+    tr_column_truncate(&col, tr_colchunk_rows + 5000);
+    TEST_EQUAL(col.nchunks, 2);
+    TEST_EQUAL(col.chunks[1].nrows, 5000);
+    TEST_EQUAL(col.chunks[1].encoding, trcolenc_packed);
+    column_truncate_check(&col, bitmap);
+    column_truncate_fill(&col, 2 * tr_colchunk_rows + 100);
+    TEST_EQUAL(col.chunks[1].encoding, trcolenc_packed);
+    column_truncate_check(&col, bitmap);
+
+    // Into a run-encoded chunk
+    tr_column_truncate(&col, 1500);
+    TEST_EQUAL(col.nchunks, 1);
+    TEST_EQUAL(col.chunks[0].nruns, 2);
+    TEST_EQUAL(col.chunks[0].nnulls, 137);
+    column_truncate_check(&col, bitmap);
+    column_truncate_fill(&col, tr_colchunk_rows + 10);
+    TEST_EQUAL(col.chunks[0].encoding, trcolenc_runs);
+    column_truncate_check(&col, bitmap);
+
+    tr_column_truncate(&col, 0);
+    TEST_EQUAL(col.nchunks, 0);
+    TEST_EQUAL(col.nrows, 0);
+
+    tr_free(bitmap);
+    tr_column_cleanup(&col);
+    TEST_EQUAL(tr_alloc_stat('tcl5').nalloc, 0);
+}
+
+static const test_case column_cases[] =
+{
+    TEST_CASE(column_append_get),
+    TEST_CASE(column_filter_i32),
+    TEST_CASE(column_filter_i64),
+    TEST_CASE(column_filter_f64),
+    TEST_CASE(column_zone_maps),
+    TEST_CASE(column_encodings),
+    TEST_CASE(column_truncate),
+};
+
+TEST_SUITE(column_tests, column_cases);
@@ -0,0 +1,86 @@
+/////////////////////////////////////////////////////////////////////////////
+//
+// Terrascale
+// Copyright (c) Dave Kilian & Emily Kilian 2023. All rights reserved.
+//
+//////////////////////////////////////////////////////////////////////////////
+
+#include <pch.h>
+#include <test/test.h>
+#include <runtime/crc32c.h>
+
+static void crc32c_vectors()
+{
+    TEST_EQUAL(tr_crc32c(0, "", 0), 0);
+    TEST_EQUAL(tr_crc32c(0, "123456789", 9), 0xe3069283);
+
+    // From RFC 3720 (iSCSI), appendix B.4
+    uint8_t buffer[32];
+    memset(buffer, 0, sizeof(buffer));
+    TEST_EQUAL(tr_crc32c(0, buffer, sizeof(buffer)), 0x8a9136aa);
+
+    memset(buffer, 0xff, sizeof(buffer));
+    TEST_EQUAL(tr_crc32c(0, buffer, sizeof(buffer)), 0x62a8ab43);
+
+    for (int i = 0; i < 32; ++i) {
+        buffer[i] = i;
+    }
+    TEST_EQUAL(tr_crc32c(0, buffer, sizeof(buffer)), 0x46dd794e);
+}
+
+static void crc32c_implementations()
+{
+    // Long enough to exercise both block sizes of the interleaved paths
+    size_t size = 3 * 8192 * 2 + 3 * 256 * 3 + 100;
+    uint8_t *buffer = tr_alloc(size, 'test');
+
+    uint32_t x = 1;
+    for (size_t i = 0; i < size; ++i) {
+        x = x * 1103515245u + 12345u;
+        buffer[i] = x >> 24;
+    }
+
+    // Every implementation agrees, at every alignment and many lengths
+    trcrcimpl best = tr_crc32c_best();
+    size_t lengths[] = { 0, 1, 7, 8, 9, 255, 767, 768, 769, 4096, 8192,
+                         3 * 8192 - 1, 3 * 8192, 3 * 8192 + 800, size - 8 };
+
+    for (int i = 0; i < arraysize(lengths); ++i) {
+        for (size_t offset = 0; offset < 8; ++offset) {
+            uint32_t expect = tr_crc32c_with(trcrc_software, 0, buffer + offset, lengths[i]);
+            for (trcrcimpl impl = trcrc_software; impl <= best; ++impl) {
+                TEST_EQUAL(tr_crc32c_with(impl, 0, buffer + offset, lengths[i]), expect);
+            }
+        }
+    }
+
+    tr_free(buffer);
+}
+
+static void crc32c_chaining()
+{
+    uint8_t buffer[1000];
+    for (int i = 0; i < arraysize(buffer); ++i) {
+        buffer[i] = i * 7;
+    }
+
+    uint32_t whole = tr_crc32c(0, buffer, sizeof(buffer));
+    for (size_t split = 0; split <= sizeof(buffer); split += 37) {
+        uint32_t crc = tr_crc32c(0, buffer, split);
+        crc = tr_crc32c(crc, buffer + split, sizeof(buffer) - split);
+        TEST_EQUAL(crc, whole);
+    }
+
+    // A single flipped bit always changes the checksum
+    buffer[500] ^= 0x10;
+    TEST_NOT_EQUAL(tr_crc32c(0, buffer, sizeof(buffer)), whole);
+}
+
+static const test_case crc32c_cases[] =
+{
+    TEST_CASE(crc32c_vectors),
+    TEST_CASE(crc32c_implementations),
+    TEST_CASE(crc32c_chaining),
+};
+
+TEST_SUITE(crc32c_tests, crc32c_cases);
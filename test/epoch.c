@@ -0,0 +1,193 @@
+/////////////////////////////////////////////////////////////////////////////
+//
+// Terrascale
+// Copyright (c) Dave Kilian & Emily Kilian 2023. All rights reserved.
+//
+//////////////////////////////////////////////////////////////////////////////
+
+#include <pch.h>
+#include <test/test.h>
+#include <protect/epoch.h>
+
+#define EPOCH_NTHREADS 4
+#define EPOCH_NITERS   20000
+#define EPOCH_MAGIC    0x5eed5eed5eed5eedull
+
+typedef struct {
+    trepochnode node;       // For deferred freeing
+    uint64_t value;         // Written once, before publishing
+    uint64_t check;         // value ^ EPOCH_MAGIC
+} epochblock;
+
+static epochblock *new_block(uint64_t value, tralloctag tag)
+{
+    epochblock *b = tr_alloc(sizeof(epochblock), tag);
+    b->value = value;
+    b->check = value ^ EPOCH_MAGIC;
+    return b;
+}
+
+static void epoch_deferred()
+{
+    trepoch epoch;
+    tr_epoch_initialize(&epoch);
+
+    trepochthread writer, reader;
+    tr_epoch_register(&epoch, &writer);
+    tr_epoch_register(&epoch, &reader);
+
+    // While the reader is pinned, nothing retired can be freed
+    tr_epoch_enter(&reader);
+    for (int i = 0; i < 10; ++i) {
+        epochblock *b = new_block(i, 'tep1');
+        tr_epoch_free(&writer, b, &b->node);
+    }
+
+    for (int i = 0; i < 5; ++i) {
+        TEST_EQUAL(tr_epoch_reclaim(&writer), 10);
+    }
+    TEST_EQUAL(tr_epoch_stat(&epoch).freed, 0);
+    TEST_EQUAL(tr_alloc_stat('tep1').nalloc, 10);
+
+    // Once it unpins, the epoch can advance past the retirements
+    tr_epoch_exit(&reader);
+    TEST_EQUAL(tr_epoch_reclaim(&writer), 0);
+
+    trepochstat stat = tr_epoch_stat(&epoch);
+    TEST_EQUAL(stat.retired, 10);
+    TEST_EQUAL(stat.freed, 10);
+    TEST_EQUAL(tr_alloc_stat('tep1').nalloc, 0);
+
+    tr_epoch_unregister(&reader);
+    tr_epoch_unregister(&writer);
+    tr_epoch_cleanup(&epoch);
+}
+
+static void epoch_nesting()
+{
+    trepoch epoch;
+    tr_epoch_initialize(&epoch);
+
+    trepochthread t;
+    tr_epoch_register(&epoch, &t);
+
+    tr_epoch_enter(&t);
+    tr_epoch_enter(&t);
+    tr_epoch_exit(&t);
+    TEST_TRUE((atomic_load(&t.local) & 1) != 0);
+
+    // A thread pinned at the current epoch lets it advance once, not twice
+    uint64_t start = tr_epoch_stat(&epoch).epoch;
+    tr_epoch_reclaim(&t);
+    tr_epoch_reclaim(&t);
+    TEST_EQUAL(tr_epoch_stat(&epoch).epoch, start + 1);
+
+    tr_epoch_exit(&t);
+    TEST_EQUAL(atomic_load(&t.local), 0);
+    tr_epoch_reclaim(&t);
+    TEST_EQUAL(tr_epoch_stat(&epoch).epoch, start + 2);
+
+    tr_epoch_unregister(&t);
+    tr_epoch_cleanup(&epoch);
+}
+
+static void epoch_batch()
+{
+    trepoch epoch;
+    tr_epoch_initialize(&epoch);
+
+    trepochthread t;
+    tr_epoch_register(&epoch, &t);
+
+    // Retiring alone reclaims, without explicit calls, and keeps the number
+    // waiting bounded
+    for (int i = 0; i < 100 * tr_epoch_batch; ++i) {
+        epochblock *b = new_block(i, 'tep2');
+        tr_epoch_free(&t, b, &b->node);
+        TEST_LESS_THAN(t.pending, 2 * tr_epoch_batch);
+    }
+
+    trepochstat stat = tr_epoch_stat(&epoch);
+    TEST_GREATER_THAN(stat.advances, 0);
+    TEST_GREATER_THAN(stat.freed, 90 * tr_epoch_batch);
+
+    // Unregistering hands the rest to the domain, and cleanup frees them
+    tr_epoch_unregister(&t);
+    tr_epoch_cleanup(&epoch);
+    TEST_EQUAL(tr_alloc_stat('tep2').nalloc, 0);
+}
+
+// Readers check the block they find through a shared pointer, which
+// writers keep replacing and retiring. A block freed too soon would be
+// reused by later allocations and fail its check.
+typedef struct {
+    trepoch *epoch;
+    _Atomic(epochblock *) *shared;
+    bool writer;
+    int failures;
+} epochworker;
+
+static void *epoch_thread(void *arg)
+{
+    epochworker *w = arg;
+    trepochthread t;
+    tr_epoch_register(w->epoch, &t);
+
+    for (uint64_t i = 0; i < EPOCH_NITERS; ++i) {
+        if (w->writer) {
+            epochblock *b = new_block(i, 'tep3');
+            epochblock *old = atomic_exchange(w->shared, b);
+            tr_epoch_free(&t, old, &old->node);
+        }
+
+        tr_epoch_enter(&t);
+        epochblock *b = atomic_load_explicit(w->shared, memory_order_acquire);
+        if ((b->value ^ b->check) != EPOCH_MAGIC) {
+            w->failures++;
+        }
+        tr_epoch_exit(&t);
+    }
+
+    tr_epoch_unregister(&t);
+    return NULL;
+}
+
+static void epoch_concurrent()
+{
+    trepoch epoch;
+    tr_epoch_initialize(&epoch);
+
+    _Atomic(epochblock *) shared = new_block(0, 'tep3');
+
+    pthread_t threads[EPOCH_NTHREADS];
+    epochworker workers[EPOCH_NTHREADS];
+    for (int i = 0; i < EPOCH_NTHREADS; ++i) {
+        workers[i] = (epochworker){ &epoch, &shared, i % 2 == 0, 0 };
+        TEST_EQUAL(0, pthread_create(threads + i, NULL, &epoch_thread, workers + i));
+    }
+
+    for (int i = 0; i < EPOCH_NTHREADS; ++i) {
+        pthread_join(threads[i], NULL);
+        TEST_EQUAL(workers[i].failures, 0);
+    }
+
+    trepochstat stat = tr_epoch_stat(&epoch);
+    TEST_EQUAL(stat.retired, EPOCH_NTHREADS / 2 * EPOCH_NITERS);
+    TEST_GREATER_THAN(stat.freed, 0);
+
+    tr_epoch_cleanup(&epoch);
+    TEST_EQUAL(tr_epoch_stat(&epoch).freed, stat.retired);
+
+    tr_free(atomic_load(&shared));
+    TEST_EQUAL(tr_alloc_stat('tep3').nalloc, 0);
+}
+
+static const test_case epoch_cases[] =
+{
+    TEST_CASE(epoch_deferred),
+    TEST_CASE(epoch_nesting),
+    TEST_CASE(epoch_batch),
+    TEST_CASE(epoch_concurrent),
+};
+
+TEST_SUITE(epoch_tests, epoch_cases);
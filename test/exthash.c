@@ -0,0 +1,135 @@
+/////////////////////////////////////////////////////////////////////////////
+//
+// Terrascale
+// Copyright (c) Dave Kilian & Emily Kilian 2023. All rights reserved.
+//
+//////////////////////////////////////////////////////////////////////////////
+
+#include <pch.h>
+#include <test/test.h>
+#include <index/exthash.h>
+
+#define EXTHASH_NKEYS 50000
+
+static uint64_t exthash_key(unsigned i)
+{
+    return (uint64_t)i * 0x9e3779b97f4a7c15ull;
+}
+
+static void exthash_check(const trexthash *table, unsigned nkeys, unsigned step)
+{
+    for (unsigned i = 0; i < nkeys; ++i) {
+        uint64_t value;
+        if (i % step == 0) {
+            TEST_SUCCESS(tr_exthash_get(table, exthash_key(i), &value));
+            TEST_EQUAL(value, i);
+        } else {
+            TEST_EQUAL(tr_exthash_get(table, exthash_key(i), &value), trstatus_not_found);
+        }
+    }
+}
+
+static void exthash_put_get()
+{
+    trexthash table;
+    TEST_SUCCESS(tr_exthash_initialize(&table, 'teh1'));
+    uint64_t value;
+    TEST_EQUAL(tr_exthash_get(&table, 1, &value), trstatus_not_found);
+
+    // Check everything whenever the directory is part way through doubling
+    unsigned nmigrating = 0;
+    for (unsigned i = 0; i < EXTHASH_NKEYS; ++i) {
+        TEST_SUCCESS(tr_exthash_put(&table, exthash_key(i), i + 1));
+        if (table.old != NULL && table.cursor > 0 && nmigrating++ % 16 == 0) {
+            for (unsigned k = 0; k <= i; ++k) {
+                TEST_SUCCESS(tr_exthash_get(&table, exthash_key(k), &value));
+                TEST_EQUAL(value, k + 1);
+            }
+        }
+    }
+    TEST_GREATER_THAN(nmigrating, 0);
+
+    for (unsigned i = 0; i < EXTHASH_NKEYS; ++i) {
+        TEST_SUCCESS(tr_exthash_put(&table, exthash_key(i), i));
+    }
+    exthash_check(&table, EXTHASH_NKEYS, 1);
+
+    trexthashstat stat = tr_exthash_stat(&table);
+    TEST_EQUAL(stat.nentries, EXTHASH_NKEYS);
+    TEST_GREATER_THAN(stat.depth, 10);
+    TEST_GREATER_THAN(stat.ndoublings, 10);
+    TEST_EQUAL(stat.nsplits + 1, stat.nbuckets);
+    TEST_GREATER_THAN(stat.load, 0.5);
+
+    // Deleting leaves the rest in place, and frees slots for new keys
+    for (unsigned i = 1; i < EXTHASH_NKEYS; i += 2) {
+        TEST_SUCCESS(tr_exthash_delete(&table, exthash_key(i)));
+        TEST_EQUAL(tr_exthash_delete(&table, exthash_key(i)), trstatus_not_found);
+    }
+    exthash_check(&table, EXTHASH_NKEYS, 2);
+    TEST_EQUAL(tr_exthash_stat(&table).nentries, EXTHASH_NKEYS / 2);
+
+    uint64_t nbuckets = tr_exthash_stat(&table).nbuckets;
+    for (unsigned i = 1; i < EXTHASH_NKEYS; i += 2) {
+        TEST_SUCCESS(tr_exthash_put(&table, exthash_key(i), i));
+    }
+    exthash_check(&table, EXTHASH_NKEYS, 1);
+    TEST_EQUAL(tr_exthash_stat(&table).nbuckets, nbuckets);
+
+    tr_exthash_cleanup(&table);
+    TEST_EQUAL(tr_alloc_stat('teh1').nalloc, 0);
+}
+
+static void exthash_colliding()
+{
+    trexthash table;
+    TEST_SUCCESS(tr_exthash_initialize(&table, 'teh2'));
+
+    // Small keys, whose hashes share their fingerprints and leading bits
+    // more than scrambled keys would, and cleanup part way through doubling
+    for (unsigned i = 0; i < 5000; ++i) {
+        TEST_SUCCESS(tr_exthash_put(&table, i, i));
+    }
+    for (unsigned i = 0; i < 5000; ++i) {
+        uint64_t value;
+        TEST_SUCCESS(tr_exthash_get(&table, i, &value));
+        TEST_EQUAL(value, i);
+    }
+
+    while (table.old == NULL) {
+        TEST_SUCCESS(tr_exthash_put(&table, table.nentries, table.nentries));
+    }
+
+    tr_exthash_cleanup(&table);
+    TEST_EQUAL(tr_alloc_stat('teh2').nalloc, 0);
+}
+
+static void exthash_shared_cleanup()
+{
+    trexthash table;
+    TEST_SUCCESS(tr_exthash_initialize(&table, 'teh3'));
+
+    // Grow through several doublings, finishing each, so most buckets are
+    // shared by runs of directory entries when the table is freed
+    unsigned depth = 0;
+    for (unsigned i = 0; depth < 8 || table.old != NULL; ++i) {
+        TEST_SUCCESS(tr_exthash_put(&table, exthash_key(i), i));
+        depth = table.depth;
+    }
+    trexthashstat stat = tr_exthash_stat(&table);
+    TEST_GREATER_EQUAL(stat.ndoublings, 8);
+    TEST_LESS_THAN(stat.nbuckets, (uint64_t)1 << stat.depth);
+
+    tr_exthash_cleanup(&table);
+    TEST_EQUAL(tr_alloc_stat('teh3').nalloc, 0);
+    TEST_EQUAL(tr_alloc_stat('teh3').nbytes, 0);
+}
+
+static const test_case exthash_cases[] =
+{
+    TEST_CASE(exthash_put_get),
+    TEST_CASE(exthash_colliding),
+    TEST_CASE(exthash_shared_cleanup),
+};
+
+TEST_SUITE(exthash_tests, exthash_cases);
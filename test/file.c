@@ -0,0 +1,288 @@
+/////////////////////////////////////////////////////////////////////////////
+//
+// Terrascale
+// Copyright (c) Dave Kilian & Emily Kilian 2023. All rights reserved.
+//
+//////////////////////////////////////////////////////////////////////////////
+
+#include <pch.h>
+#include <test/test.h>
+#include <store/file.h>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+static void temp_path(char *path, size_t size)
+{
+    snprintf(path, size, "/tmp/trtest-file-%d", (int)getpid());
+}
+
+static void fill_page(void *page, int seed)
+{
+    memset(page, 0, sizeof(trpagehdr));
+    memset(tr_page_data(page), seed, tr_page_payload);
+}
+
+static void file_readwrite()
+{
+    char path[64];
+    temp_path(path, sizeof(path));
+
+    trfile file;
+    TEST_SUCCESS(tr_file_open(&file, path, tr_file_create | tr_file_truncate));
+    TEST_EQUAL(tr_file_npages(&file), 0);
+
+    char *page = tr_alloc_aligned(tr_pagesize, tr_pagesize, 'test');
+    for (int i = 0; i < 4; ++i) {
+        fill_page(page, 'a' + i);
+        TEST_SUCCESS(tr_file_write(&file, i, page));
+    }
+    TEST_EQUAL(tr_file_npages(&file), 4);
+
+    for (int i = 3; i >= 0; --i) {
+        TEST_SUCCESS(tr_file_read(&file, i, page));
+        TEST_EQUAL(((trpagehdr *)page)->pageno, (trpageno)i);
+        TEST_EQUAL(((char *)tr_page_data(page))[0], 'a' + i);
+        TEST_EQUAL(((char *)tr_page_data(page))[tr_page_payload - 1], 'a' + i);
+    }
+
+    // Reading past the end is an overrun
+    TEST_EQUAL(tr_file_read(&file, 4, page), trstatus_overrun);
+
+    TEST_SUCCESS(tr_file_sync(&file));
+    tr_file_close(&file);
+
+    // Page count survives reopening
+    TEST_SUCCESS(tr_file_open(&file, path, tr_file_readonly));
+    TEST_EQUAL(tr_file_npages(&file), 4);
+    tr_file_close(&file);
+
+    tr_free(page);
+    unlink(path);
+}
+
+static void file_readv()
+{
+    char path[64];
+    temp_path(path, sizeof(path));
+
+    trfile file;
+    TEST_SUCCESS(tr_file_open(&file, path, tr_file_create | tr_file_truncate));
+
+    char *pages = tr_alloc_aligned(3 * tr_pagesize, tr_pagesize, 'test');
+    for (int i = 0; i < 3; ++i) {
+        fill_page(pages, 'x' + i);
+        TEST_SUCCESS(tr_file_write(&file, tr_file_extend(&file), pages));
+    }
+
+    memset(pages, 0, 3 * tr_pagesize);
+    TEST_SUCCESS(tr_file_readv(&file, 0, 3, pages));
+    for (int i = 0; i < 3; ++i) {
+        char *page = pages + i * tr_pagesize;
+        TEST_EQUAL(((trpagehdr *)page)->pageno, (trpageno)i);
+        TEST_EQUAL(((char *)tr_page_data(page))[100], 'x' + i);
+    }
+
+    TEST_EQUAL(tr_file_readv(&file, 1, 3, pages), trstatus_overrun);
+
+    tr_file_close(&file);
+    tr_free(pages);
+    unlink(path);
+}
+
+static void file_checksum()
+{
+    char path[64];
+    temp_path(path, sizeof(path));
+
+    trfile file;
+    TEST_SUCCESS(tr_file_open(&file, path, tr_file_create | tr_file_truncate));
+
+    char *page = tr_alloc_aligned(tr_pagesize, tr_pagesize, 'test');
+    fill_page(page, 'q');
+    TEST_SUCCESS(tr_file_write(&file, 0, page));
+    TEST_SUCCESS(tr_file_write(&file, 2, page));
+    TEST_NOT_EQUAL(((trpagehdr *)page)->checksum, 0);
+
+    // Page 1 was never written, so it reads back as zeros, which is valid
+    TEST_SUCCESS(tr_file_read(&file, 1, page));
+    TEST_EQUAL(((char *)tr_page_data(page))[0], 0);
+
+    // Flip one bit on disk behind the file's back
+    int fd = open(path, O_RDWR);
+    char byte;
+    TEST_EQUAL(pread(fd, &byte, 1, 2 * tr_pagesize + 1000), 1);
+    byte ^= 0x04;
+    TEST_EQUAL(pwrite(fd, &byte, 1, 2 * tr_pagesize + 1000), 1);
+    close(fd);
+
+    TEST_SUCCESS(tr_file_read(&file, 0, page));
+    TEST_EQUAL(tr_file_read(&file, 2, page), trstatus_corrupt);
+
+    char *pages = tr_alloc_aligned(3 * tr_pagesize, tr_pagesize, 'test');
+    TEST_EQUAL(tr_file_readv(&file, 0, 3, pages), trstatus_corrupt);
+    TEST_SUCCESS(tr_file_readv(&file, 0, 2, pages));
+
+    tr_file_close(&file);
+    tr_free(pages);
+    tr_free(page);
+    unlink(path);
+}
+
+static void file_compressed()
+{
+    char path[64];
+    temp_path(path, sizeof(path));
+
+    trfile file;
+    TEST_SUCCESS(tr_file_open(&file, path, tr_file_create | tr_file_truncate | tr_file_compress));
+
+    // Even pages compress well; odd pages are noise and are stored as is
+    char *page = tr_alloc_aligned(tr_pagesize, tr_pagesize, 'test');
+    uint32_t x = 1;
+    for (int i = 0; i < 8; ++i) {
+        fill_page(page, 'a' + i);
+        if (i % 2 == 1) {
+            uint8_t *data = tr_page_data(page);
+            for (size_t j = 0; j < tr_page_payload; ++j) {
+                x = x * 1103515245u + 12345u;
+                data[j] = x >> 24;
+            }
+        }
+        TEST_SUCCESS(tr_file_write(&file, i, page));
+        TEST_EQUAL((((trpagehdr *)page)->flags & tr_page_compressed) != 0, i % 2 == 0);
+    }
+
+    // The last page is compressed, so the file ends part way into it
+    TEST_SUCCESS(tr_file_write(&file, 8, memset(page, 0, tr_pagesize)));
+    tr_file_close(&file);
+    TEST_SUCCESS(tr_file_open(&file, path, tr_file_compress));
+    TEST_EQUAL(tr_file_npages(&file), 9);
+
+    char *pages = tr_alloc_aligned(9 * tr_pagesize, tr_pagesize, 'test');
+    TEST_SUCCESS(tr_file_readv(&file, 0, 9, pages));
+    for (int i = 0; i < 9; ++i) {
+        char *data = tr_page_data(pages + i * tr_pagesize);
+        TEST_EQUAL(((trpagehdr *)(pages + i * tr_pagesize))->pageno, (trpageno)i);
+        if (i % 2 == 0) {
+            char expect = i < 8 ? 'a' + i : 0;
+            TEST_EQUAL(data[0], expect);
+            TEST_EQUAL(data[tr_page_payload - 1], expect);
+        }
+    }
+
+    // Overwriting a raw page with a compressible one frees the tail
+    fill_page(page, 'r');
+    TEST_SUCCESS(tr_file_write(&file, 1, page));
+    TEST_SUCCESS(tr_file_read(&file, 1, page));
+    TEST_EQUAL(((char *)tr_page_data(page))[tr_page_payload - 1], 'r');
+
+    // Damage inside a compressed payload is caught by the checksum
+    int fd = open(path, O_RDWR);
+    char byte;
+    TEST_EQUAL(pread(fd, &byte, 1, 2 * tr_pagesize + 30), 1);
+    byte ^= 0x01;
+    TEST_EQUAL(pwrite(fd, &byte, 1, 2 * tr_pagesize + 30), 1);
+    close(fd);
+    TEST_EQUAL(tr_file_read(&file, 2, page), trstatus_corrupt);
+
+    tr_file_close(&file);
+    tr_free(pages);
+    tr_free(page);
+    unlink(path);
+}
+
+static void file_direct()
+{
+    char path[64];
+    temp_path(path, sizeof(path));
+
+    // Whether or not this filesystem supports direct I/O, the file works
+    trfile file;
+    TEST_SUCCESS(tr_file_open(&file, path, tr_file_create | tr_file_truncate | tr_file_direct));
+
+    char *page = tr_alloc_aligned(tr_pagesize, tr_pagesize, 'test');
+    for (int i = 0; i < 4; ++i) {
+        fill_page(page, 'd' + i);
+        TEST_SUCCESS(tr_file_write(&file, i, page));
+    }
+    TEST_SUCCESS(tr_file_sync(&file));
+
+    for (int i = 0; i < 4; ++i) {
+        TEST_SUCCESS(tr_file_read(&file, i, page));
+        TEST_EQUAL(((char *)tr_page_data(page))[500], 'd' + i);
+    }
+    tr_file_close(&file);
+
+    // Without the flag, I/O always goes through the page cache
+    TEST_SUCCESS(tr_file_open(&file, path, 0));
+    TEST_FALSE(tr_file_isdirect(&file));
+    TEST_SUCCESS(tr_file_read(&file, 3, page));
+    TEST_EQUAL(((char *)tr_page_data(page))[500], 'g');
+    tr_file_close(&file);
+
+    tr_free(page);
+    unlink(path);
+}
+
+static void file_scan()
+{
+    char path[64];
+    temp_path(path, sizeof(path));
+
+    trfile file;
+    TEST_SUCCESS(tr_file_open(&file, path, tr_file_create | tr_file_truncate | tr_file_direct));
+
+    char *page = tr_alloc_aligned(tr_pagesize, tr_pagesize, 'test');
+    for (int i = 0; i < 100; ++i) {
+        fill_page(page, i);
+        TEST_SUCCESS(tr_file_write(&file, i, page));
+    }
+
+    // Pages come back in order, across several windows of growing size
+    trfilescan scan;
+    TEST_SUCCESS(tr_filescan_open(&scan, &file, 3, 90, 16, 'test'));
+
+    const void *data;
+    trpageno pageno;
+    trpageno expect = 3;
+    while (tr_ok(tr_filescan_next(&scan, &data, &pageno))) {
+        TEST_EQUAL(pageno, expect);
+        TEST_EQUAL(((trpagehdr *)data)->pageno, expect);
+        TEST_EQUAL(((uint8_t *)tr_page_data(data))[7], (uint8_t)expect);
+        expect++;
+    }
+    TEST_EQUAL(expect, 90);
+    TEST_EQUAL(scan.window, 16);
+    TEST_EQUAL(tr_filescan_next(&scan, &data, &pageno), trstatus_not_found);
+    tr_filescan_close(&scan);
+
+    // Scans are clipped to the end of the file
+    TEST_SUCCESS(tr_filescan_open(&scan, &file, 95, 1000, 0, 'test'));
+    int count = 0;
+    while (tr_ok(tr_filescan_next(&scan, &data, &pageno))) {
+        count++;
+    }
+    TEST_EQUAL(count, 5);
+    tr_filescan_close(&scan);
+
+    TEST_SUCCESS(tr_filescan_open(&scan, &file, 200, 300, 0, 'test'));
+    TEST_EQUAL(tr_filescan_next(&scan, &data, &pageno), trstatus_not_found);
+    tr_filescan_close(&scan);
+
+    tr_file_close(&file);
+    tr_free(page);
+    unlink(path);
+}
+
+static const test_case file_cases[] =
+{
+    TEST_CASE(file_readwrite),
+    TEST_CASE(file_readv),
+    TEST_CASE(file_checksum),
+    TEST_CASE(file_compressed),
+    TEST_CASE(file_direct),
+    TEST_CASE(file_scan),
+};
+
+TEST_SUITE(file_tests, file_cases);
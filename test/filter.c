@@ -0,0 +1,98 @@
+/////////////////////////////////////////////////////////////////////////////
+//
+// Terrascale
+// Copyright (c) Dave Kilian & Emily Kilian 2023. All rights reserved.
+//
+//////////////////////////////////////////////////////////////////////////////
+
+#include <pch.h>
+#include <test/test.h>
+#include <runtime/hash.h>
+#include <store/filter.h>
+
+static void hash_bytes()
+{
+    char a[32] = "the quick brown fox jumps over";
+    char b[32];
+    memcpy(b, a, sizeof(a));
+
+    // Equal inputs hash equally; any change to bytes, length or seed doesn't
+    for (size_t len = 0; len < sizeof(a); ++len) {
+        TEST_EQUAL(tr_hash_bytes(a, len, 0), tr_hash_bytes(b, len, 0));
+        TEST_NOT_EQUAL(tr_hash_bytes(a, len, 0), tr_hash_bytes(a, len, 1));
+        if (len > 0) {
+            TEST_NOT_EQUAL(tr_hash_bytes(a, len, 0), tr_hash_bytes(a, len - 1, 0));
+            b[len - 1] ^= 0x20;
+            TEST_NOT_EQUAL(tr_hash_bytes(a, len, 0), tr_hash_bytes(b, len, 0));
+            b[len - 1] ^= 0x20;
+        }
+    }
+
+    // Trailing zeros still change the hash
+    char zeros[16] = {0};
+    TEST_NOT_EQUAL(tr_hash_bytes(zeros, 3, 0), tr_hash_bytes(zeros, 4, 0));
+
+    // Consecutive integers spread over every bit
+    uint64_t all = 0, none = ~0ull;
+    for (uint64_t i = 0; i < 64; ++i) {
+        all |= tr_hash_u64(i);
+        none &= tr_hash_u64(i);
+    }
+    TEST_EQUAL(all, ~0ull);
+    TEST_EQUAL(none, 0);
+}
+
+static void filter_layout(trfilterlayout layout)
+{
+    const uint64_t nkeys = 10000;
+    uint64_t *hashes = tr_alloc(nkeys * sizeof(uint64_t), 'test');
+    for (uint64_t i = 0; i < nkeys; ++i) {
+        hashes[i] = tr_hash_bytes(&i, sizeof(i), 0);
+    }
+
+    size_t size = tr_filter_size(nkeys, 10, layout);
+    if (layout == trfilter_blocked) {
+        TEST_EQUAL((size - 1) % tr_filter_blocksize, 0);
+        TEST_GREATER_EQUAL(size, nkeys * 10 / 8 + 1);
+        TEST_LESS_THAN(size, nkeys * 10 / 8 + 1 + tr_filter_blocksize);
+    } else {
+        TEST_EQUAL(size, nkeys * 10 / 8 + 1);
+    }
+    void *filter = tr_alloc_aligned(size, tr_filter_blocksize, 'test');
+    tr_filter_build(filter, size, 10, layout, hashes, nkeys);
+
+    // No false negatives
+    for (uint64_t i = 0; i < nkeys; ++i) {
+        TEST_TRUE(tr_filter_check(filter, size, hashes[i]));
+    }
+
+    // About 1% false positives at 10 bits per key, a little more if blocked
+    unsigned positives = 0;
+    for (uint64_t i = nkeys; i < 11 * nkeys; ++i) {
+        positives += tr_filter_check(filter, size, tr_hash_bytes(&i, sizeof(i), 0));
+    }
+    TEST_LESS_THAN(positives, nkeys * 10 / 50);
+
+    // An empty filter rejects everything; a malformed one accepts everything
+    size_t empty = tr_filter_size(0, 10, layout);
+    tr_filter_build(filter, empty, 10, layout, NULL, 0);
+    TEST_FALSE(tr_filter_check(filter, empty, hashes[0]));
+    TEST_TRUE(tr_filter_check(filter, 1, hashes[0]));
+
+    tr_free(filter);
+    tr_free(hashes);
+}
+
+static void filter_check()
+{
+    filter_layout(trfilter_flat);
+    filter_layout(trfilter_blocked);
+}
+
+static const test_case filter_cases[] =
+{
+    TEST_CASE(hash_bytes),
+    TEST_CASE(filter_check),
+};
+
+TEST_SUITE(filter_tests, filter_cases);
@@ -0,0 +1,111 @@
+/////////////////////////////////////////////////////////////////////////////
+//
+// Terrascale
+// Copyright (c) Dave Kilian & Emily Kilian 2023. All rights reserved.
+//
+//////////////////////////////////////////////////////////////////////////////
+
+#include <pch.h>
+#include <test/test.h>
+#include <protect/latch.h>
+
+#define LATCH_NTHREADS 4
+#define LATCH_NITERS   20000
+
+static void latch_versions()
+{
+    trlatch latch;
+    tr_latch_initialize(&latch);
+
+    uint64_t v;
+    TEST_TRUE(tr_latch_read(&latch, &v));
+    TEST_TRUE(tr_latch_validate(&latch, v));
+
+    // A write in between invalidates the read, and a stale version can't
+    // be upgraded
+    TEST_TRUE(tr_latch_lock(&latch));
+    tr_latch_unlock(&latch);
+    TEST_FALSE(tr_latch_validate(&latch, v));
+    TEST_FALSE(tr_latch_upgrade(&latch, v));
+
+    TEST_TRUE(tr_latch_read(&latch, &v));
+    TEST_TRUE(tr_latch_upgrade(&latch, v));
+    TEST_FALSE(tr_latch_validate(&latch, v));
+    tr_latch_unlock_obsolete(&latch);
+
+    TEST_FALSE(tr_latch_read(&latch, &v));
+    TEST_FALSE(tr_latch_lock(&latch));
+}
+
+// Writers keep two words equal under the latch; optimistic readers must
+// never validate a read which saw them differ
+typedef struct {
+    trlatch latch;
+    uint64_t a;
+    uint64_t b;
+} latchpair;
+
+typedef struct {
+    latchpair *pair;
+    bool writer;
+    int torn;
+    int restarts;
+} latchworker;
+
+static void *latch_thread(void *arg)
+{
+    latchworker *w = arg;
+
+    for (int i = 0; i < LATCH_NITERS; ++i) {
+        if (w->writer) {
+            tr_latch_lock(&w->pair->latch);
+            w->pair->a++;
+            w->pair->b++;
+            tr_latch_unlock(&w->pair->latch);
+            continue;
+        }
+
+        for (;;) {
+            uint64_t v;
+            tr_latch_read(&w->pair->latch, &v);
+            uint64_t a = *(volatile uint64_t *)&w->pair->a;
+            uint64_t b = *(volatile uint64_t *)&w->pair->b;
+            if (tr_latch_validate(&w->pair->latch, v)) {
+                w->torn += a != b;
+                break;
+            }
+            w->restarts++;
+        }
+    }
+
+    return NULL;
+}
+
+static void latch_concurrent()
+{
+    latchpair pair = {0};
+    tr_latch_initialize(&pair.latch);
+
+    pthread_t threads[LATCH_NTHREADS];
+    latchworker workers[LATCH_NTHREADS];
+    for (int i = 0; i < LATCH_NTHREADS; ++i) {
+        workers[i] = (latchworker){ &pair, i < 2, 0, 0 };
+        TEST_EQUAL(0, pthread_create(threads + i, NULL, &latch_thread, workers + i));
+    }
+
+    for (int i = 0; i < LATCH_NTHREADS; ++i) {
+        pthread_join(threads[i], NULL);
+        TEST_EQUAL(workers[i].torn, 0);
+    }
+
+    TEST_EQUAL(pair.a, 2 * LATCH_NITERS);
+    TEST_EQUAL(pair.b, 2 * LATCH_NITERS);
+}
+
+static const test_case latch_cases[] =
+{
+    TEST_CASE(latch_versions),
+    TEST_CASE(latch_concurrent),
+};
+
+TEST_SUITE(latch_tests, latch_cases);
@@ -0,0 +1,264 @@
+/////////////////////////////////////////////////////////////////////////////
+//
+// Terrascale
+// Copyright (c) Dave Kilian & Emily Kilian 2023. All rights reserved.
+//
+//////////////////////////////////////////////////////////////////////////////
+
+#include <pch.h>
+#include <test/test.h>
+#include <table/load.h>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#define LOAD_NROWS 50000
+
+static void load_taskman(trtaskman *tm)
+{
+    trtaskmanconfig config;
+    tr_taskman_defaults(&config, trtaskman_shared);
+    config.nworkers = 4;
+    config.pin = false;
+    config.tag = 'tld0';
+    TEST_SUCCESS(tr_taskman_initialize(tm, &config));
+}
+
+static void load_columns(trcolumn *columns, tralloctag tag)
+{
+    tr_column_initialize(columns + 0, trcol_i32, tag);
+    tr_column_initialize(columns + 1, trcol_i64, tag);
+    tr_column_initialize(columns + 2, trcol_f64, tag);
+}
+
+// Values of row i; the i64 field of every 17th row is null
+static int32_t load_i32(int i) { return i % 1000 - 500; }
+static int64_t load_i64(int i) { return (int64_t)i * 1000003 - 7; }
+static double load_f64(int i) { return i * 0.25; }
+
+static void load_check(trcolumn *columns, uint64_t nrows, bool nulls)
+{
+    for (int c = 0; c < 3; ++c) {
+        TEST_EQUAL(columns[c].nrows, nrows);
+    }
+
+    for (uint64_t i = 0; i < nrows; ++i) {
+        trcolvalue v;
+        TEST_TRUE(tr_column_get(columns + 0, i, &v));
+        TEST_EQUAL(v.i, load_i32(i));
+        bool null = nulls && i % 17 == 0;
+        TEST_EQUAL(tr_column_get(columns + 1, i, &v), !null);
+        if (!null) {
+            TEST_EQUAL(v.i, load_i64(i));
+        }
+        TEST_TRUE(tr_column_get(columns + 2, i, &v));
+        TEST_EQUAL(v.f, load_f64(i));
+    }
+}
+
+typedef struct {
+    unsigned ncalls;
+    uint64_t lastrows;
+    uint64_t lastbytes;
+} load_progress;
+
+static void load_progress_fn(const trloadstat *stat, void *context)
+{
+    load_progress *progress = context;
+    TEST_GREATER_EQUAL(stat->nrows, progress->lastrows);
+    TEST_GREATER_THAN(stat->ndone, progress->lastbytes);
+    progress->ncalls++;
+    progress->lastrows = stat->nrows;
+    progress->lastbytes = stat->ndone;
+}
+
+static void load_csv()
+{
+    trtaskman tm;
+    load_taskman(&tm);
+
+    // A header, nulls, a blank line and some CRLF line endings
+    size_t capacity = LOAD_NROWS * 64;
+    char *text = tr_alloc(capacity, 'tld1');
+    size_t size = snprintf(text, capacity, "zoom,id,size\n");
+    for (int i = 0; i < LOAD_NROWS; ++i) {
+        if (i % 17 == 0) {
+            size += snprintf(text + size, capacity - size, "%d,,%.2f", load_i32(i), load_f64(i));
+        } else {
+            size += snprintf(text + size, capacity - size, "%d,%lld,%.2f",
+                load_i32(i), (long long)load_i64(i), load_f64(i));
+        }
+        size += snprintf(text + size, capacity - size, i % 3 == 0 ? "\r\n" : "\n");
+        if (i == 1234) {
+            size += snprintf(text + size, capacity - size, "\n");
+        }
+    }
+
+    trcolumn columns[3];
+    load_columns(columns, 'tld1');
+
+    trloadconfig config;
+    tr_load_defaults(&config, trload_csv);
+    config.header = true;
+    config.piecesize = 4000;
+    config.tag = 'tld1';
+    load_progress progress = {0};
+    config.progress = load_progress_fn;
+    config.context = &progress;
+
+    trloadstat stat;
+    TEST_SUCCESS(tr_load_buffer(&tm, &config, text, size, columns, 3, &stat));
+    TEST_EQUAL(stat.nrows, LOAD_NROWS);
+    TEST_EQUAL(stat.nbytes, size);
+    TEST_EQUAL(stat.npieces, (size + 3999) / 4000);
+    TEST_EQUAL(progress.ncalls, stat.npieces);
+    TEST_EQUAL(progress.lastrows, LOAD_NROWS);
+    TEST_GREATER_THAN(stat.rate, 0);
+    load_check(columns, LOAD_NROWS, true);
+    trcolvalue v;
+
+    config.header = false;
+    config.progress = NULL;
+
+    // With a single column, a blank line is a null
+    trcolumn single;
+    tr_column_initialize(&single, trcol_f64, 'tld1');
+    TEST_SUCCESS(tr_load_buffer(&tm, &config, "1.5\n\r\n-2e3\n", 11, &single, 1, &stat));
+    TEST_EQUAL(single.nrows, 3);
+    TEST_FALSE(tr_column_get(&single, 1, &v));
+    TEST_TRUE(tr_column_get(&single, 2, &v));
+    TEST_EQUAL(v.f, -2000);
+    tr_column_cleanup(&single);
+
+    // Loading again appends; a file without a final newline still loads
+    TEST_SUCCESS(tr_load_buffer(&tm, &config, "1,2,3.5\n4,5,6", 13, columns, 3, &stat));
+    TEST_EQUAL(stat.nrows, 2);
+    TEST_TRUE(tr_column_get(columns + 2, LOAD_NROWS + 1, &v));
+    TEST_EQUAL(v.f, 6);
+
+    for (int c = 0; c < 3; ++c) {
+        tr_column_cleanup(columns + c);
+    }
+    tr_free(text);
+    tr_taskman_cleanup(&tm);
+    TEST_EQUAL(tr_alloc_stat('tld1').nalloc, 0);
+}
+
+static void load_binary()
+{
+    trtaskman tm;
+    load_taskman(&tm);
+
+    char path[64];
+    snprintf(path, sizeof(path), "/tmp/trtest-load-%d", (int)getpid());
+    int fd = open(path, O_CREAT | O_TRUNC | O_WRONLY, 0644);
+    TEST_GREATER_EQUAL(fd, 0);
+    for (int i = 0; i < LOAD_NROWS; ++i) {
+        char record[20];
+        int32_t a = load_i32(i);
+        int64_t b = load_i64(i);
+        double c = load_f64(i);
+        memcpy(record, &a, 4);
+        memcpy(record + 4, &b, 8);
+        memcpy(record + 12, &c, 8);
+        TEST_EQUAL(write(fd, record, sizeof(record)), sizeof(record));
+    }
+    close(fd);
+
+    trcolumn columns[3];
+    load_columns(columns, 'tld2');
+
+    trloadconfig config;
+    tr_load_defaults(&config, trload_binary);
+    config.piecesize = 10000;
+    config.tag = 'tld2';
+
+    trloadstat stat;
+    TEST_SUCCESS(tr_load_file(&tm, &config, path, columns, 3, &stat));
+    TEST_EQUAL(stat.nrows, LOAD_NROWS);
+    TEST_EQUAL(stat.ndone, LOAD_NROWS * 20);
+    load_check(columns, LOAD_NROWS, false);
+
+    unlink(path);
+    TEST_FAIL(tr_load_file(&tm, &config, path, columns, 3, &stat));
+
+    for (int c = 0; c < 3; ++c) {
+        tr_column_cleanup(columns + c);
+    }
+    tr_taskman_cleanup(&tm);
+    TEST_EQUAL(tr_alloc_stat('tld2').nalloc, 0);
+}
+
+static void load_errors()
+{
+    trtaskman tm;
+    load_taskman(&tm);
+
+    size_t capacity = LOAD_NROWS * 64;
+    char *text = tr_alloc(capacity, 'tld3');
+    size_t size = 0;
+    for (int i = 0; i < LOAD_NROWS; ++i) {
+        size += snprintf(text + size, capacity - size, "%d,%lld,%.2f\n",
+            load_i32(i), (long long)load_i64(i), load_f64(i));
+    }
+
+    trloadconfig config;
+    tr_load_defaults(&config, trload_csv);
+    config.piecesize = 4000;
+    config.tag = 'tld3';
+    trcolumn columns[3];
+
+    // A bad field half way through keeps the rows of the pieces before it
+    char *bad = strchr(text + size / 2, '\n') + 1;
+    bad[0] = 'x';
+    uint64_t badrow = 0;
+    for (char *p = text; p < bad; ++p) {
+        badrow += *p == '\n';
+    }
+    load_columns(columns, 'tld3');
+    TEST_EQUAL(tr_load_buffer(&tm, &config, text, size, columns, 3, NULL), trstatus_parse);
+    TEST_LESS_EQUAL(columns[0].nrows, badrow);
+    TEST_GREATER_THAN(columns[0].nrows + config.piecesize / 8, badrow);
+    load_check(columns, columns[0].nrows, false);
+    for (int c = 0; c < 3; ++c) {
+        tr_column_cleanup(columns + c);
+    }
+
+    // Too few fields, too many, and values out of range
+    const char *inputs[] = {
+        "1,2,3\n4,5\n", "1,2,3,4\n", "3000000000,1,1\n", "1,1,1.5.5\n", "1,+,1\n",
+        "1,1, 1.5\n", "1,1,nan\n", "1,1,-inf\n", "1,1,0x1p3\n", "1, 2,1\n",
+    };
+    for (int i = 0; i < arraysize(inputs); ++i) {
+        load_columns(columns, 'tld3');
+        TEST_EQUAL(tr_load_buffer(&tm, &config, inputs[i], strlen(inputs[i]), columns, 3, NULL), trstatus_parse);
+        for (int c = 0; c < 3; ++c) {
+            tr_column_cleanup(columns + c);
+        }
+    }
+
+    // Binary input must be whole records
+    load_columns(columns, 'tld3');
+    config.format = trload_binary;
+    TEST_EQUAL(tr_load_buffer(&tm, &config, text, 21, columns, 3, NULL), trstatus_parse);
+    trloadstat stat;
+    TEST_SUCCESS(tr_load_buffer(&tm, &config, text, 0, columns, 3, &stat));
+    TEST_EQUAL(columns[0].nrows, 0);
+    TEST_EQUAL(stat.rate, 0);
+    for (int c = 0; c < 3; ++c) {
+        tr_column_cleanup(columns + c);
+    }
+
+    tr_free(text);
+    tr_taskman_cleanup(&tm);
+    TEST_EQUAL(tr_alloc_stat('tld3').nalloc, 0);
+}
+
+static const test_case load_cases[] =
+{
+    TEST_CASE(load_csv),
+    TEST_CASE(load_binary),
+    TEST_CASE(load_errors),
+};
+
+TEST_SUITE(load_tests, load_cases);
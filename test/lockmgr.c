@@ -0,0 +1,344 @@
+/////////////////////////////////////////////////////////////////////////////
+//
+// Terrascale
+// Copyright (c) Dave Kilian & Emily Kilian 2023. All rights reserved.
+//
+//////////////////////////////////////////////////////////////////////////////
+
+#include <pch.h>
+#include <test/test.h>
+#include <protect/lockmgr.h>
+
+#define LOCKMGR_NACCOUNTS 32
+#define LOCKMGR_NCLIENTS  8
+#define LOCKMGR_NITERS    200
+
+static void start_taskman(trtaskman *tm)
+{
+    trtaskmanconfig config;
+    tr_taskman_defaults(&config, trtaskman_shared);
+    config.nworkers = 4;
+    config.tag = 'test';
+    TEST_SUCCESS(tr_taskman_initialize(tm, &config));
+}
+
+static void lockmgr_hierarchy()
+{
+    trlockmgr mgr;
+    TEST_SUCCESS(tr_lockmgr_initialize(&mgr, 0, 'tlm1'));
+
+    trlockowner a, b;
+    tr_lockmgr_owner_initialize(&mgr, &a);
+    tr_lockmgr_owner_initialize(&mgr, &b);
+
+    // Reading a row takes intention locks above it
+    TEST_SUCCESS(tr_lockmgr_lock(&a, NULL, tr_lockname_row(1, 1, 1), trlock_s));
+    TEST_EQUAL(tr_lockmgr_held(&a, tr_lockname_table(1)), trlock_is);
+    TEST_EQUAL(tr_lockmgr_held(&a, tr_lockname_page(1, 1)), trlock_is);
+    TEST_EQUAL(tr_lockmgr_held(&a, tr_lockname_row(1, 1, 1)), trlock_s);
+
+    // Writers of other rows don't conflict, writers of the same row do
+    TEST_SUCCESS(tr_lockmgr_lock(&b, NULL, tr_lockname_row(1, 1, 2), trlock_x));
+    TEST_EQUAL(tr_lockmgr_lock(&b, NULL, tr_lockname_row(1, 1, 1), trlock_x), trstatus_later);
+    TEST_SUCCESS(tr_lockmgr_lock(&b, NULL, tr_lockname_row(1, 1, 1), trlock_s));
+    TEST_EQUAL(tr_lockmgr_held(&b, tr_lockname_table(1)), trlock_ix);
+
+    // A table-wide lock conflicts with anybody working beneath it
+    TEST_EQUAL(tr_lockmgr_lock(&a, NULL, tr_lockname_table(1), trlock_s), trstatus_later);
+    TEST_EQUAL(tr_lockmgr_held(&a, tr_lockname_table(1)), trlock_is);
+    tr_lockmgr_release_all(&b);
+    TEST_EQUAL(tr_lockmgr_held(&b, tr_lockname_row(1, 1, 2)), trlock_none);
+
+    TEST_SUCCESS(tr_lockmgr_lock(&a, NULL, tr_lockname_table(1), trlock_s));
+    TEST_EQUAL(tr_lockmgr_lock(&b, NULL, tr_lockname_row(1, 2, 1), trlock_x), trstatus_later);
+    TEST_SUCCESS(tr_lockmgr_lock(&b, NULL, tr_lockname_row(1, 2, 1), trlock_s));
+
+    // S on the table covers reading its rows; writing one takes SIX
+    uint64_t held = tr_lockmgr_stat(&mgr).nheld;
+    TEST_SUCCESS(tr_lockmgr_lock(&a, NULL, tr_lockname_row(1, 3, 1), trlock_s));
+    TEST_EQUAL(tr_lockmgr_held(&a, tr_lockname_row(1, 3, 1)), trlock_none);
+    TEST_EQUAL(tr_lockmgr_stat(&mgr).nheld, held);
+
+    tr_lockmgr_release_all(&b);
+    TEST_SUCCESS(tr_lockmgr_lock(&a, NULL, tr_lockname_row(1, 3, 1), trlock_x));
+    TEST_EQUAL(tr_lockmgr_held(&a, tr_lockname_table(1)), trlock_six);
+    TEST_EQUAL(tr_lockmgr_held(&a, tr_lockname_page(1, 3)), trlock_ix);
+    TEST_EQUAL(tr_lockmgr_held(&a, tr_lockname_row(1, 3, 1)), trlock_x);
+
+    // Other tables are unaffected
+    TEST_SUCCESS(tr_lockmgr_lock(&b, NULL, tr_lockname_table(2), trlock_x));
+
+    trlockmgrstat stat = tr_lockmgr_stat(&mgr);
+    TEST_EQUAL(stat.nheld, 6);
+    TEST_GREATER_EQUAL(stat.nconversions, 2);
+    TEST_EQUAL(stat.locks.ncontended, 0);
+
+    tr_lockmgr_owner_cleanup(&a);
+    tr_lockmgr_owner_cleanup(&b);
+    TEST_EQUAL(tr_lockmgr_stat(&mgr).nheld, 0);
+    tr_lockmgr_cleanup(&mgr);
+    TEST_EQUAL(tr_alloc_stat('tlm1').nalloc, 0);
+}
+
+static void lockmgr_escalation()
+{
+    trlockmgr mgr;
+    TEST_SUCCESS(tr_lockmgr_initialize(&mgr, 16, 'tlm2'));
+
+    trlockowner a, b;
+    tr_lockmgr_owner_initialize(&mgr, &a);
+    tr_lockmgr_owner_initialize(&mgr, &b);
+
+    // The 17th row lock turns 16 row locks on 4 pages into one table lock
+    for (int i = 0; i < 16; ++i) {
+        TEST_SUCCESS(tr_lockmgr_lock(&a, NULL, tr_lockname_row(1, i / 4, i), trlock_s));
+    }
+    TEST_EQUAL(tr_lockmgr_stat(&mgr).nheld, 21);
+    TEST_SUCCESS(tr_lockmgr_lock(&a, NULL, tr_lockname_row(1, 4, 16), trlock_s));
+
+    trlockmgrstat stat = tr_lockmgr_stat(&mgr);
+    TEST_EQUAL(stat.nescalations, 1);
+    TEST_EQUAL(stat.nheld, 1);
+    TEST_EQUAL(tr_lockmgr_held(&a, tr_lockname_table(1)), trlock_s);
+    TEST_EQUAL(tr_lockmgr_held(&a, tr_lockname_row(1, 0, 0)), trlock_none);
+    TEST_EQUAL(tr_lockmgr_lock(&b, NULL, tr_lockname_row(1, 9, 99), trlock_x), trstatus_later);
+    tr_lockmgr_release_all(&a);
+
+    // Escalation doesn't happen while it would conflict with somebody else
+    TEST_SUCCESS(tr_lockmgr_lock(&b, NULL, tr_lockname_row(1, 9, 99), trlock_x));
+    for (int i = 0; i < 32; ++i) {
+        TEST_SUCCESS(tr_lockmgr_lock(&a, NULL, tr_lockname_row(1, i / 4, i), trlock_s));
+    }
+    TEST_EQUAL(tr_lockmgr_stat(&mgr).nescalations, 1);
+    TEST_EQUAL(tr_lockmgr_held(&a, tr_lockname_table(1)), trlock_is);
+    TEST_EQUAL(tr_lockmgr_held(&a, tr_lockname_row(1, 7, 31)), trlock_s);
+
+    // Once it's gone, writes escalate to X
+    tr_lockmgr_release_all(&b);
+    TEST_SUCCESS(tr_lockmgr_lock(&a, NULL, tr_lockname_row(1, 8, 32), trlock_x));
+    TEST_EQUAL(tr_lockmgr_stat(&mgr).nescalations, 2);
+    TEST_EQUAL(tr_lockmgr_held(&a, tr_lockname_table(1)), trlock_x);
+    TEST_EQUAL(tr_lockmgr_stat(&mgr).nheld, 1);
+
+    tr_lockmgr_owner_cleanup(&a);
+    tr_lockmgr_owner_cleanup(&b);
+    tr_lockmgr_cleanup(&mgr);
+    TEST_EQUAL(tr_alloc_stat('tlm2').nalloc, 0);
+}
+
+// A task which takes one lock, waiting if need be
+typedef struct {
+    trtask task;
+    trlockowner *owner;
+    trlockname name;
+    trlockmode mode;
+    _Atomic bool parked;
+    trstatus status;
+} lockwaiter;
+
+static trstatus lockwaiter_run(trtask *task)
+{
+    lockwaiter *w = container_of(task, lockwaiter, task);
+
+    trstatus s = tr_lockmgr_lock(w->owner, task, w->name, w->mode);
+    if (s == trstatus_pending) {
+        atomic_store(&w->parked, true);
+        return trstatus_pending;
+    }
+
+    w->status = s;
+    return trstatus_ok;
+}
+
+static void lockmgr_wait_die()
+{
+    trlockmgr mgr;
+    TEST_SUCCESS(tr_lockmgr_initialize(&mgr, 0, 'tlm3'));
+
+    trlockowner older, younger;
+    tr_lockmgr_owner_initialize(&mgr, &older);
+    tr_lockmgr_owner_initialize(&mgr, &younger);
+    TEST_LESS_THAN(older.age, younger.age);
+
+    trtaskman tm;
+    start_taskman(&tm);
+
+    // The younger owner may not wait for the older one...
+    trlockname row = tr_lockname_row(1, 1, 1);
+    TEST_SUCCESS(tr_lockmgr_lock(&older, NULL, row, trlock_x));
+
+    lockwaiter w = { .owner = &younger, .name = row, .mode = trlock_s };
+    tr_task_initialize(&w.task, &lockwaiter_run, NULL);
+    tr_taskman_submit(&tm, &w.task);
+    tr_taskman_drain(&tm);
+    TEST_EQUAL(w.status, trstatus_conflict);
+    TEST_FALSE(atomic_load(&w.parked));
+    tr_lockmgr_release_all(&younger);
+    tr_lockmgr_release_all(&older);
+
+    // ...but the older may wait for the younger, and gets the lock when the
+    // younger releases it
+    TEST_SUCCESS(tr_lockmgr_lock(&younger, NULL, row, trlock_x));
+
+    w = (lockwaiter){ .owner = &older, .name = row, .mode = trlock_s };
+    tr_task_initialize(&w.task, &lockwaiter_run, NULL);
+    tr_taskman_submit(&tm, &w.task);
+    while (!atomic_load(&w.parked)) {
+        sched_yield();
+    }
+
+    tr_lockmgr_release_all(&younger);
+    tr_taskman_drain(&tm);
+    TEST_SUCCESS(w.status);
+    TEST_EQUAL(tr_lockmgr_held(&older, row), trlock_s);
+    tr_lockmgr_release_all(&older);
+
+    trlockmgrstat stat = tr_lockmgr_stat(&mgr);
+    TEST_EQUAL(stat.nconflicts, 1);
+    TEST_EQUAL(stat.locks.ncontended, 1);
+    TEST_GREATER_THAN(stat.locks.waittime, 0);
+
+    tr_taskman_cleanup(&tm);
+    tr_lockmgr_owner_cleanup(&older);
+    tr_lockmgr_owner_cleanup(&younger);
+    tr_lockmgr_cleanup(&mgr);
+    TEST_EQUAL(tr_alloc_stat('tlm3').nalloc, 0);
+}
+
+// Clients transfer between accounts under row X locks, holding them across a
+// yield so others have to wait, while auditors lock the whole table S and
+// check the total. Transfers refused by wait-die release and retry.
+typedef struct {
+    trtask task;
+    trlockowner owner;
+    bool auditor;
+    int remaining;
+    int phase;              // 0: choosing, 1: locking, 2: holding
+    uint64_t seed;
+    int from, to;
+    int64_t saved[2];       // Balances read while holding the locks
+} lockclient;
+
+static int64_t balances[LOCKMGR_NACCOUNTS];
+static _Atomic int violations;
+static _Atomic int retries;
+
+static trstatus lockclient_lock(lockclient *c, trlockname name, trlockmode mode)
+{
+    trstatus s = tr_lockmgr_lock(&c->owner, &c->task, name, mode);
+    if (s == trstatus_conflict) {
+        tr_lockmgr_release_all(&c->owner);
+        atomic_fetch_add(&retries, 1);
+        return trstatus_later;
+    }
+
+    return s;
+}
+
+static trstatus lockclient_run(trtask *task)
+{
+    lockclient *c = container_of(task, lockclient, task);
+    trstatus s;
+
+    while (c->remaining > 0) {
+        if (c->phase == 0) {
+            c->seed = c->seed * 6364136223846793005ull + 1442695040888963407ull;
+            c->from = (c->seed >> 33) % LOCKMGR_NACCOUNTS;
+            c->to = (c->from + 1 + (c->seed >> 45) % (LOCKMGR_NACCOUNTS - 1)) % LOCKMGR_NACCOUNTS;
+            c->phase = 1;
+        }
+
+        if (c->phase == 1) {
+            if (c->auditor) {
+                s = lockclient_lock(c, tr_lockname_table(1), trlock_s);
+            } else {
+                s = lockclient_lock(c, tr_lockname_row(1, c->from / 8, c->from), trlock_x);
+                if (s == trstatus_ok) {
+                    s = lockclient_lock(c, tr_lockname_row(1, c->to / 8, c->to), trlock_x);
+                }
+            }
+            if (s != trstatus_ok) {
+                return s;
+            }
+
+            c->saved[0] = balances[c->from];
+            c->saved[1] = balances[c->to];
+            c->phase = 2;
+            return trstatus_later;
+        }
+
+        if (c->auditor) {
+            int64_t total = 0;
+            for (int i = 0; i < LOCKMGR_NACCOUNTS; ++i) {
+                total += balances[i];
+            }
+            if (total != 0) {
+                atomic_fetch_add(&violations, 1);
+            }
+        } else {
+            balances[c->from] = c->saved[0] - 1;
+            balances[c->to] = c->saved[1] + 1;
+        }
+
+        tr_lockmgr_release_all(&c->owner);
+        c->remaining -= 1;
+        c->phase = 0;
+    }
+
+    return trstatus_ok;
+}
+
+static void lockmgr_concurrent()
+{
+    trlockmgr mgr;
+    TEST_SUCCESS(tr_lockmgr_initialize(&mgr, 0, 'tlm4'));
+    memset(balances, 0, sizeof(balances));
+    atomic_store(&violations, 0);
+    atomic_store(&retries, 0);
+
+    trtaskman tm;
+    start_taskman(&tm);
+
+    lockclient clients[LOCKMGR_NCLIENTS];
+    for (int i = 0; i < LOCKMGR_NCLIENTS; ++i) {
+        lockclient *c = clients + i;
+        tr_task_initialize(&c->task, &lockclient_run, NULL);
+        tr_lockmgr_owner_initialize(&mgr, &c->owner);
+        c->auditor = i < 2;
+        c->remaining = LOCKMGR_NITERS;
+        c->phase = 0;
+        c->seed = i + 1;
+        tr_taskman_submit(&tm, &c->task);
+    }
+
+    tr_taskman_drain(&tm);
+    tr_taskman_cleanup(&tm);
+
+    int64_t total = 0;
+    for (int i = 0; i < LOCKMGR_NACCOUNTS; ++i) {
+        total += balances[i];
+    }
+    TEST_EQUAL(total, 0);
+    TEST_EQUAL(atomic_load(&violations), 0);
+
+    trlockmgrstat stat = tr_lockmgr_stat(&mgr);
+    TEST_EQUAL(stat.nheld, 0);
+    TEST_GREATER_THAN(stat.locks.ncontended + stat.nconflicts, 0);
+    TEST_EQUAL(stat.nconflicts, (uint64_t)atomic_load(&retries));
+
+    for (int i = 0; i < LOCKMGR_NCLIENTS; ++i) {
+        tr_lockmgr_owner_cleanup(&clients[i].owner);
+    }
+    tr_lockmgr_cleanup(&mgr);
+    TEST_EQUAL(tr_alloc_stat('tlm4').nalloc, 0);
+}
+
+static const test_case lockmgr_cases[] =
+{
+    TEST_CASE(lockmgr_hierarchy),
+    TEST_CASE(lockmgr_escalation),
+    TEST_CASE(lockmgr_wait_die),
+    TEST_CASE(lockmgr_concurrent),
+};
+
+TEST_SUITE(lockmgr_tests, lockmgr_cases);
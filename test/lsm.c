@@ -0,0 +1,518 @@
+/////////////////////////////////////////////////////////////////////////////
+//
+// Terrascale
+// Copyright (c) Dave Kilian & Emily Kilian 2023. All rights reserved.
+//
+//////////////////////////////////////////////////////////////////////////////
+
+#include <pch.h>
+#include <test/test.h>
+#include <store/lsm.h>
+
+#include <dirent.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+static void temp_dir(char *path, size_t size, const char *name)
+{
+    snprintf(path, size, "/tmp/trtest-%s-%d", name, (int)getpid());
+}
+
+static void remove_dir(const char *path)
+{
+    DIR *dir = opendir(path);
+    if (dir == NULL) {
+        return;
+    }
+
+    struct dirent *entry;
+    while ((entry = readdir(dir)) != NULL) {
+        if (entry->d_name[0] != '.') {
+            unlinkat(dirfd(dir), entry->d_name, 0);
+        }
+    }
+
+    closedir(dir);
+    rmdir(path);
+}
+
+static void start_taskman(trtaskman *tm)
+{
+    trtaskmanconfig config;
+    tr_taskman_defaults(&config, trtaskman_shared);
+    config.nworkers = 2;
+    config.pin = false;
+    config.tag = 'test';
+    TEST_SUCCESS(tr_taskman_initialize(tm, &config));
+}
+
+// A configuration small enough that a few thousand writes reach level 2
+static void small_config(trlsmconfig *config, const char *dir, trtaskman *tm)
+{
+    tr_lsm_defaults(config, dir, tm);
+    config->memtablesize = 64 << 10;
+    config->blocksize = 1024;
+    config->tablesize = 32 << 10;
+    config->l0trigger = 2;
+    config->l0stop = 6;
+    config->levelbase = 128 << 10;
+    config->multiplier = 4;
+    config->tag = 'test';
+}
+
+static void make_key(char *key, int i)
+{
+    snprintf(key, 16, "key%07d", i);
+}
+
+static void put_value(trlsm *lsm, int i, int version)
+{
+    char key[16];
+    char value[100];
+    make_key(key, i);
+    memset(value, 0, sizeof(value));
+    snprintf(value, sizeof(value), "value %d %d", i, version);
+    TEST_SUCCESS(tr_lsm_put(lsm, key, strlen(key), value, 20 + i % 80, NULL));
+}
+
+// Checks a key's value was written by put_value with the given version, or
+// that the key has no value if version is negative
+//
+static void check_value(trlsm *lsm, int i, int version)
+{
+    char key[16];
+    char value[100], expect[32];
+    unsigned vallen;
+    make_key(key, i);
+
+    trstatus s = tr_lsm_get(lsm, key, strlen(key), value, sizeof(value), &vallen);
+    if (version < 0) {
+        TEST_EQUAL(s, trstatus_not_found);
+        return;
+    }
+
+    TEST_SUCCESS(s);
+    TEST_EQUAL(vallen, (unsigned)(20 + i % 80));
+    snprintf(expect, sizeof(expect), "value %d %d", i, version);
+    TEST_EQUAL(strcmp(value, expect), 0);
+}
+
+static void lsm_basic()
+{
+    char dir[64];
+    temp_dir(dir, sizeof(dir), "lsm");
+    remove_dir(dir);
+
+    trtaskman tm;
+    start_taskman(&tm);
+
+    trlsmconfig config;
+    small_config(&config, dir, &tm);
+
+    trlsm lsm;
+    TEST_SUCCESS(tr_lsm_open(&lsm, &config));
+
+    for (int i = 0; i < 100; ++i) {
+        put_value(&lsm, i, 1);
+    }
+    for (int i = 0; i < 100; i += 3) {
+        put_value(&lsm, i, 2);
+    }
+    for (int i = 0; i < 100; i += 5) {
+        char key[16];
+        make_key(key, i);
+        TEST_SUCCESS(tr_lsm_delete(&lsm, key, strlen(key), NULL));
+    }
+
+    for (int pass = 0; pass < 2; ++pass) {
+        for (int i = 0; i < 100; ++i) {
+            check_value(&lsm, i, i % 5 == 0 ? -1 : i % 3 == 0 ? 2 : 1);
+        }
+
+        // The second time, everything comes from a table
+        TEST_SUCCESS(tr_lsm_flush(&lsm));
+        trlsmstat stat = tr_lsm_stat(&lsm);
+        TEST_EQUAL(stat.nflushes, 1);
+        TEST_EQUAL(stat.ntables[0], 1);
+    }
+
+    // Too small a buffer reports the length needed
+    char small[4];
+    unsigned vallen;
+    TEST_EQUAL(tr_lsm_get(&lsm, "key0000001", 10, small, sizeof(small), &vallen), trstatus_too_small);
+    TEST_EQUAL(vallen, 21);
+
+    // Empty values are values
+    TEST_SUCCESS(tr_lsm_put(&lsm, "empty", 5, NULL, 0, NULL));
+    TEST_SUCCESS(tr_lsm_get(&lsm, "empty", 5, small, sizeof(small), &vallen));
+    TEST_EQUAL(vallen, 0);
+
+    char longkey[tr_kv_maxkey + 1] = {0};
+    TEST_EQUAL(tr_lsm_put(&lsm, longkey, sizeof(longkey), "x", 1, NULL), trstatus_too_large);
+
+    TEST_SUCCESS(tr_lsm_close(&lsm));
+    tr_taskman_cleanup(&tm);
+    remove_dir(dir);
+}
+
+static void lsm_compaction()
+{
+    char dir[64];
+    temp_dir(dir, sizeof(dir), "lsm");
+    remove_dir(dir);
+
+    trtaskman tm;
+    start_taskman(&tm);
+
+    trlsmconfig config;
+    small_config(&config, dir, &tm);
+
+    trlsm lsm;
+    TEST_SUCCESS(tr_lsm_open(&lsm, &config));
+
+    // Several versions of each key, with some deleted at the end
+    const int nkeys = 6000;
+    for (int version = 0; version < 3; ++version) {
+        for (int i = 0; i < nkeys; ++i) {
+            put_value(&lsm, (i * 7919) % nkeys, version);
+        }
+    }
+    for (int i = 0; i < nkeys; i += 4) {
+        char key[16];
+        make_key(key, i);
+        TEST_SUCCESS(tr_lsm_delete(&lsm, key, strlen(key), NULL));
+    }
+
+    TEST_SUCCESS(tr_lsm_flush(&lsm));
+    TEST_SUCCESS(tr_lsm_settle(&lsm));
+
+    trlsmstat stat = tr_lsm_stat(&lsm);
+    TEST_GREATER_THAN(stat.nflushes, 10);
+    TEST_GREATER_THAN(stat.ncompactions, 0);
+    TEST_LESS_THAN(stat.ntables[0], config.l0trigger);
+    TEST_GREATER_THAN(stat.ntables[2], 0);
+    TEST_LESS_EQUAL(stat.nbytes[1], config.levelbase);
+    TEST_GREATER_THAN(stat.flushbytes + stat.compactbytes, stat.userbytes);
+
+    for (int i = 0; i < nkeys; ++i) {
+        check_value(&lsm, i, i % 4 == 0 ? -1 : 2);
+    }
+    TEST_SUCCESS(tr_lsm_close(&lsm));
+
+    // Everything is still there after reopening, and stale versions have
+    // been compacted away
+    TEST_SUCCESS(tr_lsm_open(&lsm, &config));
+    for (int i = 0; i < nkeys; ++i) {
+        check_value(&lsm, i, i % 4 == 0 ? -1 : 2);
+    }
+
+    uint64_t total = 0;
+    stat = tr_lsm_stat(&lsm);
+    for (int i = 0; i < tr_lsm_nlevels; ++i) {
+        total += stat.nbytes[i];
+    }
+    TEST_LESS_THAN(total, (uint64_t)nkeys * 3 * 60);
+
+    TEST_SUCCESS(tr_lsm_close(&lsm));
+    tr_taskman_cleanup(&tm);
+    remove_dir(dir);
+}
+
+static void lsm_orphans()
+{
+    char dir[64];
+    temp_dir(dir, sizeof(dir), "lsm");
+    remove_dir(dir);
+
+    trtaskman tm;
+    start_taskman(&tm);
+
+    trlsmconfig config;
+    small_config(&config, dir, &tm);
+
+    trlsm lsm;
+    TEST_SUCCESS(tr_lsm_open(&lsm, &config));
+    put_value(&lsm, 1, 1);
+    TEST_SUCCESS(tr_lsm_close(&lsm));
+
+    // Files a crash could leave behind are cleaned up
+    char path[128];
+    snprintf(path, sizeof(path), "%s/999999.sst", dir);
+    FILE *f = fopen(path, "w");
+    fclose(f);
+    snprintf(path, sizeof(path), "%s/000002.sst.tmp", dir);
+    f = fopen(path, "w");
+    fclose(f);
+
+    // Other files which merely start with a number are left alone
+    static const char *const others[] = { "123.log", "42", "7.sstable", "8.sst.bak" };
+    for (int i = 0; i < arraysize(others); ++i) {
+        snprintf(path, sizeof(path), "%s/%s", dir, others[i]);
+        f = fopen(path, "w");
+        fclose(f);
+    }
+
+    TEST_SUCCESS(tr_lsm_open(&lsm, &config));
+    snprintf(path, sizeof(path), "%s/999999.sst", dir);
+    TEST_EQUAL(access(path, F_OK), -1);
+    snprintf(path, sizeof(path), "%s/000002.sst.tmp", dir);
+    TEST_EQUAL(access(path, F_OK), -1);
+    for (int i = 0; i < arraysize(others); ++i) {
+        snprintf(path, sizeof(path), "%s/%s", dir, others[i]);
+        TEST_EQUAL(access(path, F_OK), 0);
+    }
+    check_value(&lsm, 1, 1);
+    TEST_SUCCESS(tr_lsm_close(&lsm));
+
+    // A damaged manifest is caught
+    snprintf(path, sizeof(path), "%s/MANIFEST", dir);
+    f = fopen(path, "r+");
+    fseek(f, 44, SEEK_SET);
+    fputc(0x7f, f);
+    fclose(f);
+    TEST_EQUAL(tr_lsm_open(&lsm, &config), trstatus_corrupt);
+
+    tr_taskman_cleanup(&tm);
+    remove_dir(dir);
+}
+
+// Writes to a store with a log, and exits without closing the store, as if
+// the process had crashed. Runs in a child process.
+//
+static void crash_writer(const trlsmconfig *config, const trwalconfig *walconfig)
+{
+    trtaskman tm;
+    start_taskman(&tm);
+
+    trlsmconfig local = *config;
+    local.taskman = &tm;
+
+    trlsm lsm;
+    trwal wal;
+    TEST_SUCCESS(tr_lsm_open(&lsm, &local));
+    TEST_SUCCESS(tr_wal_open(&wal, walconfig, &tr_lsm_replay, &lsm));
+    tr_lsm_attach(&lsm, &wal);
+
+    trlsn lsn = 0, last = 0;
+    for (int i = 0; i < 3000; ++i) {
+        char key[16];
+        make_key(key, i % 1000);
+        if (i % 7 == 6) {
+            TEST_SUCCESS(tr_lsm_delete(&lsm, key, strlen(key), &lsn));
+        } else {
+            char value[100] = {0};
+            snprintf(value, sizeof(value), "value %d %d", i % 1000, i / 1000);
+            TEST_SUCCESS(tr_lsm_put(&lsm, key, strlen(key), value, 20 + i % 1000 % 80, &lsn));
+        }
+        TEST_GREATER_THAN(lsn, last);
+        last = lsn;
+    }
+
+    // Some writes are in tables, and the rest only in the log
+    trlsmstat stat = tr_lsm_stat(&lsm);
+    TEST_GREATER_THAN(stat.nflushes, 0);
+    TEST_SUCCESS(tr_lsm_settle(&lsm));
+    tr_wal_close(&wal);
+    _exit(0);
+}
+
+static void lsm_wal()
+{
+    char dir[64], waldir[64];
+    temp_dir(dir, sizeof(dir), "lsm");
+    temp_dir(waldir, sizeof(waldir), "lsmwal");
+    remove_dir(dir);
+    remove_dir(waldir);
+
+    trtaskman tm;
+    trlsmconfig config;
+    small_config(&config, dir, NULL);
+
+    trwalconfig walconfig;
+    tr_wal_defaults(&walconfig, waldir);
+    walconfig.segsize = 64 << 10;
+    walconfig.buffersize = 64 << 10;
+    walconfig.tag = 'test';
+
+    fflush(stdout);
+    pid_t pid = fork();
+    TEST_TRUE(pid >= 0);
+    if (pid == 0) {
+        crash_writer(&config, &walconfig);
+    }
+
+    int status;
+    TEST_EQUAL(waitpid(pid, &status, 0), pid);
+    TEST_TRUE(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+
+    // Replay restores what the tables don't have
+    start_taskman(&tm);
+    config.taskman = &tm;
+
+    trlsm lsm;
+    trwal wal;
+    TEST_SUCCESS(tr_lsm_open(&lsm, &config));
+    TEST_SUCCESS(tr_wal_open(&wal, &walconfig, &tr_lsm_replay, &lsm));
+    tr_lsm_attach(&lsm, &wal);
+
+    for (int k = 0; k < 1000; ++k) {
+        int i = 2000 + k;
+        check_value(&lsm, k, i % 7 == 6 ? -1 : 2);
+    }
+
+    // New writes win over replayed ones, and survive a clean close
+    put_value(&lsm, 5, 9);
+    check_value(&lsm, 5, 9);
+    TEST_SUCCESS(tr_lsm_close(&lsm));
+    tr_wal_close(&wal);
+
+    TEST_SUCCESS(tr_lsm_open(&lsm, &config));
+    TEST_SUCCESS(tr_wal_open(&wal, &walconfig, &tr_lsm_replay, &lsm));
+    tr_lsm_attach(&lsm, &wal);
+    check_value(&lsm, 5, 9);
+    check_value(&lsm, 6, 2);
+    TEST_SUCCESS(tr_lsm_close(&lsm));
+    tr_wal_close(&wal);
+
+    tr_taskman_cleanup(&tm);
+    remove_dir(dir);
+    remove_dir(waldir);
+}
+
+typedef struct {
+    trlsm *lsm;
+    int thread;
+} writer;
+
+#define lsm_nthreads 4
+
+static void *write_thread(void *context)
+{
+    writer *w = context;
+    for (int i = w->thread; i < 8000; i += lsm_nthreads) {
+        put_value(w->lsm, i, 1);
+        if (i % 10 == 0) {
+            check_value(w->lsm, i, 1);
+        }
+    }
+    return NULL;
+}
+
+static void lsm_concurrent()
+{
+    char dir[64];
+    temp_dir(dir, sizeof(dir), "lsm");
+    remove_dir(dir);
+
+    trtaskman tm;
+    start_taskman(&tm);
+
+    trlsmconfig config;
+    small_config(&config, dir, &tm);
+
+    trlsm lsm;
+    TEST_SUCCESS(tr_lsm_open(&lsm, &config));
+
+    pthread_t threads[lsm_nthreads];
+    writer writers[lsm_nthreads];
+    for (int i = 0; i < lsm_nthreads; ++i) {
+        writers[i] = (writer){ &lsm, i };
+        TEST_EQUAL(0, pthread_create(threads + i, NULL, &write_thread, writers + i));
+    }
+    for (int i = 0; i < lsm_nthreads; ++i) {
+        TEST_EQUAL(0, pthread_join(threads[i], NULL));
+    }
+
+    for (int i = 0; i < 8000; ++i) {
+        check_value(&lsm, i, 1);
+    }
+
+    TEST_SUCCESS(tr_lsm_close(&lsm));
+    tr_taskman_cleanup(&tm);
+    remove_dir(dir);
+}
+
+// Writes from a task, which parks whenever writes stall
+typedef struct {
+    trlsm *lsm;
+    int next;
+    trstatus status;
+} taskwriter;
+
+static trstatus write_task(trtask *task)
+{
+    taskwriter *w = task->context;
+    for (; w->next < 4000; ++w->next) {
+        char key[16];
+        char value[100] = {0};
+        make_key(key, w->next);
+        snprintf(value, sizeof(value), "value %d %d", w->next, 1);
+
+        trstatus s = tr_lsm_put_task(w->lsm, key, strlen(key), value, 20 + w->next % 80, NULL, task);
+        if (s == trstatus_pending) {
+            return trstatus_pending;
+        }
+        if (tr_failed(s)) {
+            return s;
+        }
+    }
+    return trstatus_ok;
+}
+
+static void write_task_done(trtask *task, trstatus status)
+{
+    taskwriter *w = task->context;
+    w->status = status;
+}
+
+static void lsm_tasks()
+{
+    char dir[64];
+    temp_dir(dir, sizeof(dir), "lsm");
+    remove_dir(dir);
+
+    // With one shard, the flush task runs on the writer's worker, so the
+    // writer must park rather than block for it
+    trtaskmanconfig tmconfig;
+    tr_taskman_defaults(&tmconfig, trtaskman_sharded);
+    tmconfig.nworkers = 1;
+    tmconfig.pin = false;
+    tmconfig.tag = 'test';
+    trtaskman tm;
+    TEST_SUCCESS(tr_taskman_initialize(&tm, &tmconfig));
+
+    trlsmconfig config;
+    small_config(&config, dir, &tm);
+
+    trlsm lsm;
+    TEST_SUCCESS(tr_lsm_open(&lsm, &config));
+
+    taskwriter w = { &lsm, 0, trstatus_pending };
+    trtask task;
+    tr_task_initialize(&task, &write_task, &w);
+    task.done = &write_task_done;
+    tr_taskman_submit(&tm, &task);
+    tr_taskman_drain(&tm);
+
+    TEST_SUCCESS(w.status);
+    TEST_LESS_THAN(0, tr_lsm_stat(&lsm).nstalls);
+    for (int i = 0; i < 4000; ++i) {
+        check_value(&lsm, i, 1);
+    }
+
+    TEST_SUCCESS(tr_lsm_close(&lsm));
+    tr_taskman_cleanup(&tm);
+    remove_dir(dir);
+}
+
+static const test_case lsm_cases[] =
+{
+    TEST_CASE(lsm_basic),
+    TEST_CASE(lsm_compaction),
+    TEST_CASE(lsm_orphans),
+    TEST_CASE(lsm_wal),
+    TEST_CASE(lsm_concurrent),
+    TEST_CASE(lsm_tasks),
+};
+
+TEST_SUITE(lsm_tests, lsm_cases);
@@ -0,0 +1,141 @@
+/////////////////////////////////////////////////////////////////////////////
+//
+// Terrascale
+// Copyright (c) Dave Kilian & Emily Kilian 2023. All rights reserved.
+//
+//////////////////////////////////////////////////////////////////////////////
+
+#include <pch.h>
+#include <test/test.h>
+#include <runtime/lz.h>
+
+// Compresses and decompresses a buffer, checking it comes back the same
+static unsigned roundtrip(const uint8_t *data, unsigned length)
+{
+    unsigned bound = tr_lz_bound(length);
+    uint8_t *compressed = tr_alloc(bound, 'test');
+    uint8_t *output = tr_alloc(length + 1, 'test');
+
+    unsigned zlength, rawlength;
+    TEST_SUCCESS(tr_lz_compress(data, length, compressed, bound, &zlength));
+    TEST_TRUE(zlength <= bound);
+    TEST_SUCCESS(tr_lz_decompress(compressed, zlength, output, length, &rawlength));
+    TEST_EQUAL(rawlength, length);
+    TEST_EQUAL(memcmp(output, data, length), 0);
+
+    tr_free(output);
+    tr_free(compressed);
+    return zlength;
+}
+
+static void fill_random(uint8_t *data, unsigned length, uint32_t seed)
+{
+    for (unsigned i = 0; i < length; ++i) {
+        seed = seed * 1103515245u + 12345u;
+        data[i] = seed >> 24;
+    }
+}
+
+static void lz_roundtrip()
+{
+    unsigned size = 300000;
+    uint8_t *data = tr_alloc(size, 'test');
+
+    // Every short length, including those too short to hold a match
+    memset(data, 'a', size);
+    for (unsigned length = 0; length < 100; ++length) {
+        roundtrip(data, length);
+    }
+
+    // Runs compress to almost nothing, and exercise overlapping copies
+    TEST_TRUE(roundtrip(data, size) < size / 200);
+
+    // Short repeating patterns, for every offset below the copy width
+    for (unsigned period = 1; period <= 16; ++period) {
+        for (unsigned i = 0; i < 5000; ++i) {
+            data[i] = 'A' + i % period;
+        }
+        TEST_TRUE(roundtrip(data, 5000) < 200);
+    }
+
+    // Text-like data with matches near and far, and long literal runs
+    fill_random(data, size, 7);
+    for (unsigned i = 0; i < size; i += 1000) {
+        memcpy(data + i + 500, data + i + 100, 300);
+    }
+    for (unsigned i = 70000; i + 400 < size; i += 70000) {
+        memcpy(data + i, data + i - 66000, 400);
+    }
+    roundtrip(data, size);
+
+    tr_free(data);
+}
+
+static void lz_incompressible()
+{
+    unsigned size = 65536;
+    uint8_t *data = tr_alloc(size, 'test');
+    fill_random(data, size, 3);
+
+    // Random data expands, but never beyond the bound
+    unsigned zlength = roundtrip(data, size);
+    TEST_TRUE(zlength > size);
+
+    // Asking for it to shrink fails cleanly
+    uint8_t *compressed = tr_alloc(size, 'test');
+    TEST_EQUAL(tr_lz_compress(data, size, compressed, size - 1, &zlength), trstatus_too_small);
+
+    tr_free(compressed);
+    tr_free(data);
+}
+
+static void lz_malformed()
+{
+    uint8_t data[1000];
+    for (int i = 0; i < arraysize(data); ++i) {
+        data[i] = (uint8_t)(i % 17);
+    }
+
+    uint8_t compressed[tr_lz_bound(sizeof(data))];
+    unsigned zlength, length;
+    TEST_SUCCESS(tr_lz_compress(data, sizeof(data), compressed, sizeof(compressed), &zlength));
+
+    // Too little room for the output
+    uint8_t output[sizeof(data)];
+    TEST_EQUAL(tr_lz_decompress(compressed, zlength, output, sizeof(output) - 1, &length), trstatus_overrun);
+
+    // Every truncation of the block is caught
+    for (unsigned n = 0; n < zlength; ++n) {
+        trstatus s = tr_lz_decompress(compressed, n, output, sizeof(output), &length);
+        TEST_TRUE(s == trstatus_overrun || (tr_ok(s) && length < sizeof(data)));
+    }
+
+    // A match reaching back before the start of the output
+    uint8_t before[] = { 0x10, 'x', 0x05, 0x00, 0x00 };
+    TEST_EQUAL(tr_lz_decompress(before, sizeof(before), output, sizeof(output), &length), trstatus_overrun);
+
+    // A zero offset
+    uint8_t zero[] = { 0x10, 'x', 0x00, 0x00, 0x00 };
+    TEST_EQUAL(tr_lz_decompress(zero, sizeof(zero), output, sizeof(output), &length), trstatus_overrun);
+
+    // A literal run longer than the input
+    uint8_t literal[] = { 0xf0, 0xff, 0xff, 'x' };
+    TEST_EQUAL(tr_lz_decompress(literal, sizeof(literal), output, sizeof(output), &length), trstatus_overrun);
+
+    // Random garbage never gets out of bounds, whatever it decodes to
+    uint8_t garbage[64];
+    for (uint32_t seed = 0; seed < 2000; ++seed) {
+        fill_random(garbage, sizeof(garbage), seed);
+        trstatus s = tr_lz_decompress(garbage, sizeof(garbage), output, sizeof(output), &length);
+        TEST_TRUE(s == trstatus_overrun || (tr_ok(s) && length <= sizeof(output)));
+    }
+}
+
+static const test_case lz_cases[] =
+{
+    TEST_CASE(lz_roundtrip),
+    TEST_CASE(lz_incompressible),
+    TEST_CASE(lz_malformed),
+};
+
+TEST_SUITE(lz_tests, lz_cases);
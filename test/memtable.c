@@ -0,0 +1,185 @@
+/////////////////////////////////////////////////////////////////////////////
+//
+// Terrascale
+// Copyright (c) Dave Kilian & Emily Kilian 2023. All rights reserved.
+//
+//////////////////////////////////////////////////////////////////////////////
+
+#include <pch.h>
+#include <test/test.h>
+#include <store/memtable.h>
+
+static void put(trmemtable *mt, const char *key, const char *value, trseqno seq)
+{
+    trkvitem item = {
+        .key = key,
+        .keylen = strlen(key),
+        .value = value,
+        .vallen = value != NULL ? strlen(value) : 0,
+        .seq = seq,
+        .tombstone = value == NULL,
+    };
+    TEST_SUCCESS(tr_memtable_insert(mt, &item));
+}
+
+static void memtable_basic()
+{
+    trmemtable mt;
+    TEST_SUCCESS(tr_memtable_initialize(&mt, 'test'));
+    TEST_NULL(tr_memtable_first(&mt));
+
+    put(&mt, "banana", "yellow", 1);
+    put(&mt, "apple", "red", 2);
+    put(&mt, "cherry", "dark", 3);
+    put(&mt, "apple", "green", 4);
+    put(&mt, "banana", NULL, 5);
+    put(&mt, "app", "short", 6);
+
+    trkvitem item;
+    TEST_SUCCESS(tr_memtable_get(&mt, "apple", 5, &item));
+    TEST_EQUAL(item.seq, 4);
+    TEST_EQUAL(item.vallen, 5);
+    TEST_EQUAL(memcmp(item.value, "green", 5), 0);
+
+    // Deletes are entries too
+    TEST_SUCCESS(tr_memtable_get(&mt, "banana", 6, &item));
+    TEST_TRUE(item.tombstone);
+
+    TEST_EQUAL(tr_memtable_get(&mt, "appl", 4, &item), trstatus_not_found);
+    TEST_EQUAL(tr_memtable_get(&mt, "zebra", 5, &item), trstatus_not_found);
+
+    // Iteration is in key order, newest first within a key
+    static const struct { const char *key; trseqno seq; } expect[] = {
+        { "app", 6 }, { "apple", 4 }, { "apple", 2 },
+        { "banana", 5 }, { "banana", 1 }, { "cherry", 3 },
+    };
+
+    int n = 0;
+    for (trmemnode *node = tr_memtable_first(&mt); node != NULL; node = tr_memtable_next(node)) {
+        tr_memtable_item(node, &item);
+        TEST_LESS_THAN(n, arraysize(expect));
+        TEST_EQUAL(item.keylen, strlen(expect[n].key));
+        TEST_EQUAL(memcmp(item.key, expect[n].key, item.keylen), 0);
+        TEST_EQUAL(item.seq, expect[n].seq);
+        n++;
+    }
+    TEST_EQUAL(n, arraysize(expect));
+
+    tr_memtable_cleanup(&mt);
+}
+
+static void memtable_large()
+{
+    trmemtable mt;
+    TEST_SUCCESS(tr_memtable_initialize(&mt, 'test'));
+    size_t empty = tr_memtable_size(&mt);
+
+    // Values bigger than a chunk get a chunk of their own
+    size_t biglen = 3 << 20;
+    char *big = tr_alloc(biglen, 'test');
+    memset(big, 'b', biglen);
+
+    trkvitem item = { .key = "big", .keylen = 3, .value = big, .vallen = biglen, .seq = 1 };
+    TEST_SUCCESS(tr_memtable_insert(&mt, &item));
+    TEST_GREATER_THAN(tr_memtable_size(&mt), empty + biglen);
+
+    put(&mt, "small", "value", 2);
+    TEST_SUCCESS(tr_memtable_get(&mt, "big", 3, &item));
+    TEST_EQUAL(item.vallen, biglen);
+    TEST_EQUAL(((const char *)item.value)[biglen - 1], 'b');
+    TEST_SUCCESS(tr_memtable_get(&mt, "small", 5, &item));
+
+    tr_free(big);
+    tr_memtable_cleanup(&mt);
+}
+
+typedef struct {
+    trmemtable *mt;
+    int thread;
+} inserter;
+
+#define memtable_nthreads 4
+#define memtable_nkeys 20000
+
+static void *insert_thread(void *context)
+{
+    inserter *ins = context;
+
+    // Threads interleave their keys, and all write some shared keys
+    for (int i = 0; i < memtable_nkeys; ++i) {
+        char key[16];
+        uint32_t value = i;
+        snprintf(key, sizeof(key), "k%08d", i * memtable_nthreads + ins->thread);
+
+        trkvitem item = {
+            .key = key,
+            .keylen = strlen(key),
+            .value = &value,
+            .vallen = sizeof(value),
+            .seq = (trseqno)i * memtable_nthreads + ins->thread + 1,
+        };
+        TEST_SUCCESS(tr_memtable_insert(ins->mt, &item));
+
+        if (i % 100 == 0) {
+            item.key = "shared";
+            item.keylen = 6;
+            TEST_SUCCESS(tr_memtable_insert(ins->mt, &item));
+        }
+    }
+
+    return NULL;
+}
+
+static void memtable_concurrent()
+{
+    trmemtable mt;
+    TEST_SUCCESS(tr_memtable_initialize(&mt, 'test'));
+
+    pthread_t threads[memtable_nthreads];
+    inserter inserters[memtable_nthreads];
+    for (int i = 0; i < memtable_nthreads; ++i) {
+        inserters[i] = (inserter){ &mt, i };
+        TEST_EQUAL(0, pthread_create(threads + i, NULL, &insert_thread, inserters + i));
+    }
+    for (int i = 0; i < memtable_nthreads; ++i) {
+        TEST_EQUAL(0, pthread_join(threads[i], NULL));
+    }
+
+    // Every entry made it in, in order
+    int n = 0, shared = 0;
+    trkvitem prev = {0};
+    for (trmemnode *node = tr_memtable_first(&mt); node != NULL; node = tr_memtable_next(node)) {
+        trkvitem item;
+        tr_memtable_item(node, &item);
+        if (prev.key != NULL) {
+            int c = tr_kv_compare(prev.key, prev.keylen, item.key, item.keylen);
+            TEST_TRUE(c < 0 || (c == 0 && prev.seq > item.seq));
+        }
+        if (item.keylen == 6) {
+            shared++;
+        }
+        prev = item;
+        n++;
+    }
+    TEST_EQUAL(n, memtable_nthreads * memtable_nkeys + shared);
+    TEST_EQUAL(shared, memtable_nthreads * memtable_nkeys / 100);
+
+    trkvitem item;
+    TEST_SUCCESS(tr_memtable_get(&mt, "k00012345", 9, &item));
+    TEST_EQUAL(*(const uint32_t *)item.value, 12345 / memtable_nthreads);
+
+    // The newest of the shared writes wins
+    TEST_SUCCESS(tr_memtable_get(&mt, "shared", 6, &item));
+    TEST_EQUAL(item.seq, (trseqno)(memtable_nkeys - 100) * memtable_nthreads + memtable_nthreads);
+
+    tr_memtable_cleanup(&mt);
+}
+
+static const test_case memtable_cases[] =
+{
+    TEST_CASE(memtable_basic),
+    TEST_CASE(memtable_large),
+    TEST_CASE(memtable_concurrent),
+};
+
+TEST_SUITE(memtable_tests, memtable_cases);
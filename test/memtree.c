@@ -0,0 +1,179 @@
+/////////////////////////////////////////////////////////////////////////////
+//
+// Terrascale
+// Copyright (c) Dave Kilian & Emily Kilian 2023. All rights reserved.
+//
+//////////////////////////////////////////////////////////////////////////////
+
+#include <pch.h>
+#include <test/test.h>
+#include <index/memtree.h>
+
+#define MEMTREE_NKEYS    20000
+#define MEMTREE_NREADERS 3
+#define MEMTREE_NWRITERS 2
+
+static uint64_t mix(uint64_t x)
+{
+    x ^= x >> 33;
+    x *= 0xff51afd7ed558ccdull;
+    x ^= x >> 33;
+    return x;
+}
+
+static void memtree_put_get()
+{
+    trmemtree tree;
+    TEST_SUCCESS(tr_memtree_initialize(&tree, 'test'));
+
+    // Random order, so splits happen all over the tree
+    for (uint64_t i = 0; i < MEMTREE_NKEYS; ++i) {
+        TEST_SUCCESS(tr_memtree_put(&tree, mix(i), i));
+    }
+
+    trmemtreestat stat = tr_memtree_stat(&tree);
+    TEST_GREATER_THAN(stat.height, 2);
+    TEST_GREATER_EQUAL(stat.nleaves, MEMTREE_NKEYS / tr_memtree_fanout);
+
+    for (uint64_t i = 0; i < MEMTREE_NKEYS; ++i) {
+        uint64_t value;
+        TEST_SUCCESS(tr_memtree_get(&tree, mix(i), &value));
+        TEST_EQUAL(value, i);
+    }
+
+    uint64_t value;
+    TEST_EQUAL(tr_memtree_get(&tree, mix(MEMTREE_NKEYS), &value), trstatus_not_found);
+
+    // Replacing keeps one entry per key
+    TEST_SUCCESS(tr_memtree_put(&tree, mix(7), 700));
+    TEST_SUCCESS(tr_memtree_get(&tree, mix(7), &value));
+    TEST_EQUAL(value, 700);
+
+    tr_memtree_cleanup(&tree);
+}
+
+static void memtree_delete_scan()
+{
+    trmemtree tree;
+    TEST_SUCCESS(tr_memtree_initialize(&tree, 'test'));
+
+    // Ascending order fills leaves from the right
+    for (uint64_t i = 0; i < MEMTREE_NKEYS; ++i) {
+        TEST_SUCCESS(tr_memtree_put(&tree, i * 2, i));
+    }
+
+    // Delete every key which is a multiple of 4
+    for (uint64_t i = 0; i < MEMTREE_NKEYS; i += 2) {
+        TEST_SUCCESS(tr_memtree_delete(&tree, i * 2));
+    }
+    TEST_EQUAL(tr_memtree_delete(&tree, 0), trstatus_not_found);
+    TEST_EQUAL(tr_memtree_delete(&tree, 1), trstatus_not_found);
+
+    // A scan from between keys crosses many leaves and ends at the last key
+    static uint64_t keys[MEMTREE_NKEYS], values[MEMTREE_NKEYS];
+    unsigned n = tr_memtree_scan(&tree, 1001, keys, values, MEMTREE_NKEYS);
+    TEST_EQUAL(n, (2 * MEMTREE_NKEYS - 2 - 1002) / 4 + 1);
+    for (unsigned i = 0; i < n; ++i) {
+        TEST_EQUAL(keys[i] % 4, 2);
+        TEST_EQUAL(values[i], keys[i] / 2);
+        if (i > 0) {
+            TEST_EQUAL(keys[i], keys[i - 1] + 4);
+        }
+    }
+    TEST_GREATER_EQUAL(keys[0], 1001);
+
+    // A short scan stops at its capacity
+    TEST_EQUAL(tr_memtree_scan(&tree, 0, keys, values, 10), 10);
+    TEST_EQUAL(keys[0], 2);
+    TEST_EQUAL(keys[9], 38);
+    TEST_EQUAL(tr_memtree_scan(&tree, UINT64_MAX, keys, values, 10), 0);
+
+    tr_memtree_cleanup(&tree);
+}
+
+// Writers insert disjoint keys while readers look up keys inserted before
+// they started, and scan; nothing inserted may ever go missing
+typedef struct {
+    trmemtree *tree;
+    int index;
+    int failures;
+} memtreeworker;
+
+static void *memtree_writer(void *arg)
+{
+    memtreeworker *w = arg;
+
+    for (uint64_t i = w->index; i < MEMTREE_NKEYS; i += MEMTREE_NWRITERS) {
+        if (tr_failed(tr_memtree_put(w->tree, mix(MEMTREE_NKEYS + i), i))) {
+            w->failures++;
+        }
+    }
+
+    return NULL;
+}
+
+static void *memtree_reader(void *arg)
+{
+    memtreeworker *w = arg;
+    uint64_t keys[100], values[100];
+
+    for (int pass = 0; pass < 3; ++pass) {
+        for (uint64_t i = 0; i < MEMTREE_NKEYS; ++i) {
+            uint64_t value;
+            if (tr_failed(tr_memtree_get(w->tree, mix(i), &value)) || value != i) {
+                w->failures++;
+            }
+
+            if (i % 1000 == 0) {
+                unsigned n = tr_memtree_scan(w->tree, mix(i), keys, values, 100);
+                for (unsigned j = 1; j < n; ++j) {
+                    w->failures += keys[j] <= keys[j - 1];
+                }
+            }
+        }
+    }
+
+    return NULL;
+}
+
+static void memtree_concurrent()
+{
+    trmemtree tree;
+    TEST_SUCCESS(tr_memtree_initialize(&tree, 'test'));
+    for (uint64_t i = 0; i < MEMTREE_NKEYS; ++i) {
+        TEST_SUCCESS(tr_memtree_put(&tree, mix(i), i));
+    }
+
+    pthread_t threads[MEMTREE_NREADERS + MEMTREE_NWRITERS];
+    memtreeworker workers[MEMTREE_NREADERS + MEMTREE_NWRITERS];
+    for (int i = 0; i < MEMTREE_NREADERS + MEMTREE_NWRITERS; ++i) {
+        workers[i] = (memtreeworker){ &tree, i % MEMTREE_NWRITERS, 0 };
+        TEST_EQUAL(0, pthread_create(threads + i, NULL,
+            i < MEMTREE_NWRITERS ? &memtree_writer : &memtree_reader, workers + i));
+    }
+
+    for (int i = 0; i < MEMTREE_NREADERS + MEMTREE_NWRITERS; ++i) {
+        pthread_join(threads[i], NULL);
+        TEST_EQUAL(workers[i].failures, 0);
+    }
+
+    static uint64_t keys[2 * MEMTREE_NKEYS + 1], values[2 * MEMTREE_NKEYS + 1];
+    TEST_EQUAL(tr_memtree_scan(&tree, 0, keys, values, arraysize(keys)), 2 * MEMTREE_NKEYS);
+
+    for (uint64_t i = 0; i < 2 * MEMTREE_NKEYS; ++i) {
+        uint64_t value;
+        TEST_SUCCESS(tr_memtree_get(&tree, mix(i), &value));
+        TEST_EQUAL(value, i < MEMTREE_NKEYS ? i : i - MEMTREE_NKEYS);
+    }
+
+    tr_memtree_cleanup(&tree);
+}
+
+static const test_case memtree_cases[] =
+{
+    TEST_CASE(memtree_put_get),
+    TEST_CASE(memtree_delete_scan),
+    TEST_CASE(memtree_concurrent),
+};
+
+TEST_SUITE(memtree_tests, memtree_cases);
@@ -0,0 +1,335 @@
+/////////////////////////////////////////////////////////////////////////////
+//
+// Terrascale
+// Copyright (c) Dave Kilian & Emily Kilian 2023. All rights reserved.
+//
+//////////////////////////////////////////////////////////////////////////////
+
+#include <pch.h>
+#include <test/test.h>
+#include <protect/mvcc.h>
+
+#define MVCC_NACCOUNTS 16
+#define MVCC_NWRITERS  3
+#define MVCC_NITERS    5000
+#define MVCC_BALANCE   1000
+
+static void write_int(trmvcctxn *txn, trmvccrow *row, int value)
+{
+    TEST_SUCCESS(tr_mvcc_write(txn, row, &value, sizeof(value)));
+}
+
+static trstatus read_int(trmvcctxn *txn, trmvccrow *row, int *value)
+{
+    unsigned length;
+    trstatus s = tr_mvcc_read(txn, row, value, sizeof(*value), &length);
+    if (tr_ok(s)) {
+        TEST_EQUAL(length, sizeof(*value));
+    }
+    return s;
+}
+
+static int chain_length(trmvccrow *row)
+{
+    int n = 0;
+    for (trversion *v = atomic_load(&row->head); v != NULL; v = atomic_load(&v->older)) {
+        n++;
+    }
+    return n;
+}
+
+static void mvcc_snapshot()
+{
+    trmvcc mvcc;
+    tr_mvcc_initialize(&mvcc, 'tmvc');
+
+    trmvccrow row;
+    tr_mvcc_row_initialize(&row);
+
+    trmvcctxn t1, t2, t3;
+    tr_mvcc_begin(&mvcc, &t1);
+
+    // A write is visible to its own transaction straight away, and to
+    // nobody else until it commits
+    tr_mvcc_begin(&mvcc, &t2);
+    write_int(&t2, &row, 42);
+
+    int value;
+    TEST_SUCCESS(read_int(&t2, &row, &value));
+    TEST_EQUAL(value, 42);
+    TEST_EQUAL(read_int(&t1, &row, &value), trstatus_not_found);
+
+    tr_mvcc_commit(&t2);
+
+    // Snapshots taken before the commit still don't see it
+    TEST_EQUAL(read_int(&t1, &row, &value), trstatus_not_found);
+
+    tr_mvcc_begin(&mvcc, &t3);
+    TEST_SUCCESS(read_int(&t3, &row, &value));
+    TEST_EQUAL(value, 42);
+
+    unsigned length;
+    TEST_EQUAL(tr_mvcc_read(&t3, &row, &value, 2, &length), trstatus_too_small);
+    TEST_EQUAL(length, sizeof(int));
+
+    tr_mvcc_commit(&t3);
+    tr_mvcc_commit(&t1);
+
+    tr_mvcc_row_cleanup(&row);
+    tr_mvcc_cleanup(&mvcc);
+}
+
+static void mvcc_abort_delete()
+{
+    trmvcc mvcc;
+    tr_mvcc_initialize(&mvcc, 'tmvc');
+
+    trmvccrow row;
+    tr_mvcc_row_initialize(&row);
+
+    trmvcctxn txn;
+    tr_mvcc_begin(&mvcc, &txn);
+    write_int(&txn, &row, 1);
+    tr_mvcc_commit(&txn);
+
+    // Several writes to a row, then an abort, leave the row as it was
+    tr_mvcc_begin(&mvcc, &txn);
+    write_int(&txn, &row, 2);
+    write_int(&txn, &row, 3);
+    TEST_SUCCESS(tr_mvcc_delete(&txn, &row));
+
+    int value;
+    TEST_EQUAL(read_int(&txn, &row, &value), trstatus_not_found);
+    tr_mvcc_abort(&txn);
+
+    tr_mvcc_begin(&mvcc, &txn);
+    TEST_SUCCESS(read_int(&txn, &row, &value));
+    TEST_EQUAL(value, 1);
+    TEST_SUCCESS(tr_mvcc_delete(&txn, &row));
+    tr_mvcc_commit(&txn);
+
+    // With nobody left to see it, the deleted row is collected entirely
+    tr_mvcc_begin(&mvcc, &txn);
+    TEST_EQUAL(read_int(&txn, &row, &value), trstatus_not_found);
+    tr_mvcc_commit(&txn);
+    TEST_NULL(atomic_load(&row.head));
+
+    trmvccstat stat = tr_mvcc_stat(&mvcc);
+    TEST_EQUAL(stat.commits, 3);
+    TEST_EQUAL(stat.aborts, 1);
+    TEST_EQUAL(stat.versions, 5);
+
+    tr_mvcc_row_cleanup(&row);
+    tr_mvcc_cleanup(&mvcc);
+    TEST_EQUAL(tr_alloc_stat('tmvc').nalloc, 0);
+}
+
+static void mvcc_conflict()
+{
+    trmvcc mvcc;
+    tr_mvcc_initialize(&mvcc, 'tmvc');
+
+    trmvccrow row;
+    tr_mvcc_row_initialize(&row);
+
+    // The second writer of an uncommitted row loses
+    trmvcctxn t1, t2;
+    tr_mvcc_begin(&mvcc, &t1);
+    tr_mvcc_begin(&mvcc, &t2);
+    write_int(&t1, &row, 1);
+
+    int value = 2;
+    TEST_EQUAL(tr_mvcc_write(&t2, &row, &value, sizeof(value)), trstatus_conflict);
+    tr_mvcc_abort(&t2);
+
+    // So does a writer whose snapshot predates the row's last commit
+    tr_mvcc_begin(&mvcc, &t2);
+    tr_mvcc_commit(&t1);
+    TEST_EQUAL(tr_mvcc_delete(&t2, &row), trstatus_conflict);
+    tr_mvcc_abort(&t2);
+
+    tr_mvcc_begin(&mvcc, &t2);
+    write_int(&t2, &row, 3);
+    tr_mvcc_commit(&t2);
+
+    TEST_EQUAL(tr_mvcc_stat(&mvcc).conflicts, 2);
+
+    tr_mvcc_row_cleanup(&row);
+    tr_mvcc_cleanup(&mvcc);
+}
+
+static void mvcc_collect()
+{
+    trmvcc mvcc;
+    tr_mvcc_initialize(&mvcc, 'tmvc');
+
+    trmvccrow rows[2];
+    tr_mvcc_row_initialize(rows + 0);
+    tr_mvcc_row_initialize(rows + 1);
+
+    trmvcctxn txn, old;
+    tr_mvcc_begin(&mvcc, &txn);
+    write_int(&txn, rows + 0, 0);
+    write_int(&txn, rows + 1, 0);
+    tr_mvcc_commit(&txn);
+
+    // Without older snapshots, commits keep one version per row
+    for (int i = 1; i <= 10; ++i) {
+        tr_mvcc_begin(&mvcc, &txn);
+        write_int(&txn, rows + 0, i);
+        tr_mvcc_commit(&txn);
+        TEST_EQUAL(chain_length(rows + 0), 1);
+    }
+
+    // An old snapshot holds back collection, and still reads its versions
+    tr_mvcc_begin(&mvcc, &old);
+    for (int i = 11; i <= 20; ++i) {
+        tr_mvcc_begin(&mvcc, &txn);
+        write_int(&txn, rows + 0, i);
+        write_int(&txn, rows + 1, i);
+        tr_mvcc_commit(&txn);
+    }
+    TEST_EQUAL(chain_length(rows + 0), 11);
+    TEST_EQUAL(tr_mvcc_oldest(&mvcc), old.snapshot);
+
+    int value;
+    TEST_SUCCESS(read_int(&old, rows + 0, &value));
+    TEST_EQUAL(value, 10);
+    TEST_SUCCESS(read_int(&old, rows + 1, &value));
+    TEST_EQUAL(value, 0);
+    tr_mvcc_commit(&old);
+
+    // Once it's gone, a vacuum collects everything but the newest versions
+    TEST_EQUAL(tr_mvcc_vacuum(&mvcc, rows, 2), 20);
+    TEST_EQUAL(chain_length(rows + 0), 1);
+    TEST_EQUAL(chain_length(rows + 1), 1);
+
+    tr_mvcc_row_cleanup(rows + 0);
+    tr_mvcc_row_cleanup(rows + 1);
+    tr_mvcc_cleanup(&mvcc);
+    TEST_EQUAL(tr_alloc_stat('tmvc').nalloc, 0);
+}
+
+// Writers move money between accounts while a reader keeps summing them;
+// every snapshot must see the same total.
+typedef struct {
+    trmvcc *mvcc;
+    trmvccrow *accounts;
+    int seed;
+    int commits;
+    int failures;
+} mvccworker;
+
+static void *transfer_thread(void *arg)
+{
+    mvccworker *w = arg;
+    unsigned seed = w->seed;
+
+    for (int i = 0; i < MVCC_NITERS; ++i) {
+        int from = rand_r(&seed) % MVCC_NACCOUNTS;
+        int to = (from + 1 + rand_r(&seed) % (MVCC_NACCOUNTS - 1)) % MVCC_NACCOUNTS;
+        int amount = rand_r(&seed) % 10;
+
+        trmvcctxn txn;
+        tr_mvcc_begin(w->mvcc, &txn);
+
+        int a, b;
+        if (tr_failed(read_int(&txn, w->accounts + from, &a)) ||
+            tr_failed(read_int(&txn, w->accounts + to, &b))) {
+            w->failures++;
+        }
+
+        a -= amount;
+        b += amount;
+        if (tr_ok(tr_mvcc_write(&txn, w->accounts + from, &a, sizeof(a))) &&
+            tr_ok(tr_mvcc_write(&txn, w->accounts + to, &b, sizeof(b)))) {
+            tr_mvcc_commit(&txn);
+            w->commits++;
+        } else {
+            tr_mvcc_abort(&txn);
+        }
+    }
+
+    return NULL;
+}
+
+static void *audit_thread(void *arg)
+{
+    mvccworker *w = arg;
+
+    for (int i = 0; i < MVCC_NITERS; ++i) {
+        trmvcctxn txn;
+        tr_mvcc_begin(w->mvcc, &txn);
+
+        int total = 0;
+        for (int j = 0; j < MVCC_NACCOUNTS; ++j) {
+            int value;
+            if (tr_failed(read_int(&txn, w->accounts + j, &value))) {
+                w->failures++;
+            }
+            total += value;
+        }
+
+        if (total != MVCC_NACCOUNTS * MVCC_BALANCE) {
+            w->failures++;
+        }
+        tr_mvcc_commit(&txn);
+    }
+
+    return NULL;
+}
+
+static void mvcc_concurrent()
+{
+    trmvcc mvcc;
+    tr_mvcc_initialize(&mvcc, 'tmvc');
+
+    trmvccrow accounts[MVCC_NACCOUNTS];
+    trmvcctxn txn;
+    tr_mvcc_begin(&mvcc, &txn);
+    for (int i = 0; i < MVCC_NACCOUNTS; ++i) {
+        tr_mvcc_row_initialize(accounts + i);
+        write_int(&txn, accounts + i, MVCC_BALANCE);
+    }
+    tr_mvcc_commit(&txn);
+
+    pthread_t threads[MVCC_NWRITERS + 1];
+    mvccworker workers[MVCC_NWRITERS + 1];
+    for (int i = 0; i <= MVCC_NWRITERS; ++i) {
+        workers[i] = (mvccworker){ &mvcc, accounts, i + 1, 0, 0 };
+        TEST_EQUAL(0, pthread_create(threads + i, NULL,
+            i < MVCC_NWRITERS ? &transfer_thread : &audit_thread, workers + i));
+    }
+
+    int commits = 0;
+    for (int i = 0; i <= MVCC_NWRITERS; ++i) {
+        pthread_join(threads[i], NULL);
+        TEST_EQUAL(workers[i].failures, 0);
+        commits += workers[i].commits;
+    }
+    TEST_GREATER_THAN(commits, 0);
+
+    trmvccstat stat = tr_mvcc_stat(&mvcc);
+    TEST_EQUAL(stat.commits + stat.aborts, MVCC_NWRITERS * MVCC_NITERS + MVCC_NITERS + 1);
+    TEST_GREATER_THAN(stat.collected, 0);
+
+    tr_mvcc_vacuum(&mvcc, accounts, MVCC_NACCOUNTS);
+    for (int i = 0; i < MVCC_NACCOUNTS; ++i) {
+        TEST_EQUAL(chain_length(accounts + i), 1);
+        tr_mvcc_row_cleanup(accounts + i);
+    }
+
+    tr_mvcc_cleanup(&mvcc);
+    TEST_EQUAL(tr_alloc_stat('tmvc').nalloc, 0);
+}
+
+static const test_case mvcc_cases[] =
+{
+    TEST_CASE(mvcc_snapshot),
+    TEST_CASE(mvcc_abort_delete),
+    TEST_CASE(mvcc_conflict),
+    TEST_CASE(mvcc_collect),
+    TEST_CASE(mvcc_concurrent),
+};
+
+TEST_SUITE(mvcc_tests, mvcc_cases);
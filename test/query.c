@@ -0,0 +1,419 @@
+/////////////////////////////////////////////////////////////////////////////
+//
+// Terrascale
+// Copyright (c) Dave Kilian & Emily Kilian 2023. All rights reserved.
+//
+//////////////////////////////////////////////////////////////////////////////
+
+#include <pch.h>
+#include <test/test.h>
+#include <query/query.h>
+#include <runtime/hash.h>
+
+#include <math.h>
+
+// Not a multiple of the batch size, or of a chunk
+#define QUERY_NROWS 50000
+
+// Fills columns of each encoding:
+//
+// - 0: i32 row numbers (packed once sealed)
+// - 1: i64 values from a few spread widely (dictionary), every 7th null
+// - 2: i32 long runs
+// - 3: f64 row / 4, every 11th null
+//
+static void query_columns(trcolumn *columns, tralloctag tag)
+{
+    tr_column_initialize(columns + 0, trcol_i32, tag);
+    tr_column_initialize(columns + 1, trcol_i64, tag);
+    tr_column_initialize(columns + 2, trcol_i32, tag);
+    tr_column_initialize(columns + 3, trcol_f64, tag);
+
+    for (int32_t i = 0; i < QUERY_NROWS; ++i) {
+        int64_t wide = (int64_t)(i % 13) * 1000000007ll - 5000000000ll;
+        int32_t run = i / 3000;
+        double f = i / 4.0;
+        TEST_SUCCESS(tr_column_append(columns + 0, &i, 1));
+        TEST_SUCCESS(i % 7 == 0 ? tr_column_append_null(columns + 1) : tr_column_append(columns + 1, &wide, 1));
+        TEST_SUCCESS(tr_column_append(columns + 2, &run, 1));
+        TEST_SUCCESS(i % 11 == 0 ? tr_column_append_null(columns + 3) : tr_column_append(columns + 3, &f, 1));
+    }
+}
+
+static void query_cleanup_columns(trcolumn *columns, unsigned ncolumns)
+{
+    for (unsigned i = 0; i < ncolumns; ++i) {
+        tr_column_cleanup(columns + i);
+    }
+}
+
+// Gets a row's value from a batch, or false if it's null
+static bool query_value(const trbatch *batch, unsigned column, unsigned row, trcolvalue *value)
+{
+    const trvector *v = batch->columns + column;
+    *value = tr_vector_get(v, row);
+    return !tr_vector_null(v, row);
+}
+
+// Row number k of a batch's live rows
+static unsigned query_row(const trbatch *batch, unsigned k)
+{
+    return batch->sel != NULL ? batch->sel[k] : k;
+}
+
+static void query_scan()
+{
+    trcolumn columns[4];
+    query_columns(columns, 'tqr1');
+    const trcolumn *inputs[] = { columns + 0, columns + 1, columns + 2, columns + 3 };
+    TEST_EQUAL(columns[0].chunks[0].encoding, trcolenc_packed);
+    TEST_EQUAL(columns[1].chunks[0].encoding, trcolenc_dict);
+    TEST_EQUAL(columns[2].chunks[0].encoding, trcolenc_runs);
+
+    trquery query;
+    TEST_SUCCESS(tr_query_initialize(&query, 'tqr1'));
+    trqop *scan;
+    TEST_SUCCESS(tr_query_scan(&query, inputs, 4, &scan));
+
+    // Every value matches the column's, and the same batch is reused
+    uint64_t row = 0;
+    trbatch *batch, *first = NULL;
+    for (;;) {
+        TEST_SUCCESS(tr_query_next(scan, &batch));
+        if (batch == NULL) {
+            break;
+        }
+        if (first == NULL) {
+            first = batch;
+        }
+        TEST_TRUE(batch == first);
+        TEST_NULL(batch->sel);
+        TEST_EQUAL(batch->count, min(QUERY_NROWS - row, tr_batch_rows));
+
+        for (unsigned i = 0; i < batch->count; ++i, ++row) {
+            for (unsigned c = 0; c < 4; ++c) {
+                trcolvalue expected, actual;
+                bool present = tr_column_get(columns + c, row, &expected);
+                TEST_EQUAL(query_value(batch, c, i, &actual), present);
+                if (present) {
+                    TEST_EQUAL(actual.i, expected.i);
+                } else {
+                    TEST_EQUAL(actual.i, 0);
+                }
+            }
+        }
+    }
+    TEST_EQUAL(row, QUERY_NROWS);
+
+    // Reading across chunks, at an odd offset
+    int64_t values[3000];
+    uint64_t nulls[(3000 + 63) / 64];
+    unsigned nnulls = tr_column_read(columns + 1, tr_colchunk_rows - 1234, 3000, values, nulls);
+    unsigned expected = 0;
+    for (unsigned i = 0; i < 3000; ++i) {
+        uint64_t r = tr_colchunk_rows - 1234 + i;
+        trcolvalue v;
+        bool present = tr_column_get(columns + 1, r, &v);
+        TEST_EQUAL(nulls[i / 64] >> (i % 64) & 1, !present);
+        TEST_EQUAL(values[i], present ? v.i : 0);
+        expected += !present;
+    }
+    TEST_EQUAL(nnulls, expected);
+
+    tr_query_cleanup(&query);
+    query_cleanup_columns(columns, 4);
+    TEST_EQUAL(tr_alloc_stat('tqr1').nalloc, 0);
+}
+
+static void query_filter_project()
+{
+    trcolumn columns[4];
+    query_columns(columns, 'tqr2');
+    const trcolumn *inputs[] = { columns + 0, columns + 1, columns + 2, columns + 3 };
+
+    // Rows where 1000 <= c0 <= 40000 and c3 != 2000, as c0, c0 * 3 - c2,
+    // c3 + 0.5, c1 - c0
+    trquery query;
+    TEST_SUCCESS(tr_query_initialize(&query, 'tqr2'));
+    trqop *scan, *between, *ne, *project;
+    TEST_SUCCESS(tr_query_scan(&query, inputs, 4, &scan));
+    TEST_SUCCESS(tr_query_filter(&query, scan, 0, trcolop_between, (trcolvalue){ .i = 1000 },
+        (trcolvalue){ .i = 40000 }, &between));
+    TEST_SUCCESS(tr_query_filter(&query, between, 3, trcolop_ne, (trcolvalue){ .f = 2000.0 },
+        (trcolvalue){ 0 }, &ne));
+    TEST_EQUAL(tr_query_filter(&query, ne, 4, trcolop_eq, (trcolvalue){ 0 }, (trcolvalue){ 0 }, &project),
+        trstatus_argument);
+
+    trqexpr exprs[] = {
+        { .op = trqexpr_column, .left = 0 },
+        { .op = trqexpr_sub, .left = 4, .right = 2 },
+        { .op = trqexpr_add, .left = 3, .constant = true, .value = { .f = 0.5 } },
+        { .op = trqexpr_sub, .left = 1, .right = 0 },
+    };
+
+    // The first projection passes the input's columns along, and adds c0 * 3
+    trqexpr all[] = {
+        { .op = trqexpr_column, .left = 0 },
+        { .op = trqexpr_column, .left = 1 },
+        { .op = trqexpr_column, .left = 2 },
+        { .op = trqexpr_column, .left = 3 },
+        { .op = trqexpr_mul, .left = 0, .constant = true, .value = { .i = 3 } },
+    };
+    trqop *widened;
+    TEST_SUCCESS(tr_query_project(&query, ne, all, 5, &widened));
+    TEST_SUCCESS(tr_query_project(&query, widened, exprs, 4, &project));
+    TEST_EQUAL(project->types[0], trcol_i32);
+    TEST_EQUAL(project->types[1], trcol_i64);
+    TEST_EQUAL(project->types[2], trcol_f64);
+    TEST_EQUAL(project->types[3], trcol_i64);
+
+    uint64_t nrows = 0;
+    int32_t last = -1;
+    for (;;) {
+        trbatch *batch;
+        TEST_SUCCESS(tr_query_next(project, &batch));
+        if (batch == NULL) {
+            break;
+        }
+        TEST_GREATER_THAN(batch->nsel, 0);
+
+        for (unsigned k = 0; k < batch->nsel; ++k) {
+            unsigned row = query_row(batch, k);
+            trcolvalue v;
+            TEST_TRUE(query_value(batch, 0, row, &v));
+            int32_t i = (int32_t)v.i;
+            TEST_GREATER_THAN(i, last);
+            last = i;
+
+            TEST_TRUE(i >= 1000 && i <= 40000 && i % 11 != 0 && i != 8000);
+            nrows++;
+
+            TEST_TRUE(query_value(batch, 1, row, &v));
+            TEST_EQUAL(v.i, 3 * i - i / 3000);
+            TEST_TRUE(query_value(batch, 2, row, &v));
+            TEST_TRUE(v.f == i / 4.0 + 0.5);
+            bool present = query_value(batch, 3, row, &v);
+            TEST_EQUAL(present, i % 7 != 0);
+            if (present) {
+                TEST_EQUAL(v.i, (i % 13) * 1000000007ll - 5000000000ll - i);
+            }
+        }
+    }
+
+    uint64_t expected = 0;
+    for (int32_t i = 1000; i <= 40000; ++i) {
+        expected += i % 11 != 0 && i != 8000;
+    }
+    TEST_EQUAL(nrows, expected);
+
+    tr_query_cleanup(&query);
+    query_cleanup_columns(columns, 4);
+    TEST_EQUAL(tr_alloc_stat('tqr2').nalloc, 0);
+}
+
+static void query_aggregate()
+{
+    trcolumn columns[4];
+    query_columns(columns, 'tqr3');
+    const trcolumn *inputs[] = { columns + 0, columns + 1, columns + 2, columns + 3 };
+
+    // Grouped by c1 (13 values and null): count(c3), sum(c0), min(c3),
+    // max(c0)
+    trquery query;
+    TEST_SUCCESS(tr_query_initialize(&query, 'tqr3'));
+    trqop *scan, *agg, *total;
+    TEST_SUCCESS(tr_query_scan(&query, inputs, 4, &scan));
+    trqagg aggs[] = {
+        { trqagg_count, 3 },
+        { trqagg_sum, 0 },
+        { trqagg_min, 3 },
+        { trqagg_max, 0 },
+    };
+    TEST_EQUAL(tr_query_aggregate(&query, scan, 3, aggs, 4, &agg), trstatus_argument);
+    TEST_SUCCESS(tr_query_aggregate(&query, scan, 1, aggs, 4, &agg));
+    TEST_EQUAL(agg->ncolumns, 5);
+    TEST_EQUAL(agg->types[4], trcol_i64);
+    TEST_EQUAL(agg->types[3], trcol_f64);
+
+    unsigned ngroups = 0;
+    bool seen[14] = {0};
+    for (;;) {
+        trbatch *batch;
+        TEST_SUCCESS(tr_query_next(agg, &batch));
+        if (batch == NULL) {
+            break;
+        }
+
+        for (unsigned row = 0; row < batch->count; ++row, ++ngroups) {
+            trcolvalue key;
+            int g = query_value(batch, 0, row, &key) ? (int)((key.i + 5000000000ll) / 1000000007ll) : 13;
+            TEST_FALSE(seen[g]);
+            seen[g] = true;
+
+            // Totals by brute force
+            uint64_t count = 0;
+            int64_t sum = 0, greatest = INT64_MIN;
+            double least = INFINITY;
+            for (int32_t i = 0; i < QUERY_NROWS; ++i) {
+                if ((g == 13) != (i % 7 == 0) || (g != 13 && i % 13 != g)) {
+                    continue;
+                }
+                if (i % 11 != 0) {
+                    count++;
+                    least = min(least, i / 4.0);
+                }
+                sum += i;
+                greatest = max(greatest, (int64_t)i);
+            }
+
+            trcolvalue v;
+            TEST_TRUE(query_value(batch, 1, row, &v));
+            TEST_EQUAL((uint64_t)v.i, count);
+            TEST_TRUE(query_value(batch, 2, row, &v));
+            TEST_EQUAL(v.i, sum);
+            TEST_TRUE(query_value(batch, 3, row, &v));
+            TEST_TRUE(v.f == least);
+            TEST_TRUE(query_value(batch, 4, row, &v));
+            TEST_EQUAL(v.i, greatest);
+        }
+    }
+    TEST_EQUAL(ngroups, 14);
+
+    // Grouped by c2, which has no nulls: a group per run
+    trqop *runs;
+    trqagg counts[] = { { trqagg_count, 0 } };
+    TEST_SUCCESS(tr_query_scan(&query, inputs, 4, &scan));
+    TEST_SUCCESS(tr_query_aggregate(&query, scan, 2, counts, 1, &runs));
+    uint64_t nruns = 0, nrows = 0;
+    for (;;) {
+        trbatch *batch;
+        TEST_SUCCESS(tr_query_next(runs, &batch));
+        if (batch == NULL) {
+            break;
+        }
+        for (unsigned row = 0; row < batch->count; ++row, ++nruns) {
+            trcolvalue key, count;
+            TEST_TRUE(query_value(batch, 0, row, &key));
+            TEST_TRUE(query_value(batch, 1, row, &count));
+            TEST_EQUAL(count.i, min(QUERY_NROWS - key.i * 3000, 3000));
+            nrows += count.i;
+        }
+    }
+    TEST_EQUAL(nruns, (QUERY_NROWS + 2999) / 3000);
+    TEST_EQUAL(nrows, QUERY_NROWS);
+
+    // Over no rows at all: one row, with a count of zero and a null sum
+    trqop *none;
+    TEST_SUCCESS(tr_query_scan(&query, inputs, 4, &scan));
+    TEST_SUCCESS(tr_query_filter(&query, scan, 0, trcolop_lt, (trcolvalue){ .i = 0 }, (trcolvalue){ 0 }, &none));
+    trqagg sums[] = { { trqagg_count, 0 }, { trqagg_sum, 3 } };
+    TEST_SUCCESS(tr_query_aggregate(&query, none, tr_query_nogroup, sums, 2, &total));
+    trbatch *batch;
+    TEST_SUCCESS(tr_query_next(total, &batch));
+    TEST_EQUAL(batch->count, 1);
+    trcolvalue v;
+    TEST_TRUE(query_value(batch, 0, 0, &v));
+    TEST_EQUAL(v.i, 0);
+    TEST_FALSE(query_value(batch, 1, 0, &v));
+    TEST_SUCCESS(tr_query_next(total, &batch));
+    TEST_NULL(batch);
+
+    tr_query_cleanup(&query);
+    query_cleanup_columns(columns, 4);
+    TEST_EQUAL(tr_alloc_stat('tqr3').nalloc, 0);
+}
+
+static void query_join()
+{
+    // Build: 3000 rows (id, key) with keys 0..999 three times each, key 7
+    // another 1500 times, and some nulls. Probe: 20000 rows (id, key) with
+    // keys 0..1999, and some nulls.
+    trcolumn build[2], probe[2];
+    tr_column_initialize(build + 0, trcol_i64, 'tqr4');
+    tr_column_initialize(build + 1, trcol_i32, 'tqr4');
+    tr_column_initialize(probe + 0, trcol_i64, 'tqr4');
+    tr_column_initialize(probe + 1, trcol_i64, 'tqr4');
+
+    enum { nbuild = 4500, nprobe = 20000 };
+    int32_t *buildkeys = tr_alloc(nbuild * sizeof(int32_t), 'tqr4');
+    int64_t *probekeys = tr_alloc(nprobe * sizeof(int64_t), 'tqr4');
+    for (int64_t i = 0; i < nbuild; ++i) {
+        buildkeys[i] = i < 3000 ? (int32_t)(i * 7 % 1000) : 7;
+        TEST_SUCCESS(tr_column_append(build + 0, &i, 1));
+        TEST_SUCCESS(i % 101 == 5 ? tr_column_append_null(build + 1) : tr_column_append(build + 1, buildkeys + i, 1));
+    }
+    for (int64_t i = 0; i < nprobe; ++i) {
+        probekeys[i] = i * 13 % 2000;
+        TEST_SUCCESS(tr_column_append(probe + 0, &i, 1));
+        TEST_SUCCESS(i % 97 == 3 ? tr_column_append_null(probe + 1) : tr_column_append(probe + 1, probekeys + i, 1));
+    }
+
+    trquery query;
+    TEST_SUCCESS(tr_query_initialize(&query, 'tqr4'));
+    const trcolumn *buildcols[] = { build + 0, build + 1 };
+    const trcolumn *probecols[] = { probe + 0, probe + 1 };
+    trqop *buildscan, *probescan, *filtered, *join;
+    TEST_SUCCESS(tr_query_scan(&query, buildcols, 2, &buildscan));
+    TEST_SUCCESS(tr_query_scan(&query, probecols, 2, &probescan));
+
+    // Probe from id 1 on, so the probe batches have selection vectors
+    TEST_SUCCESS(tr_query_filter(&query, probescan, 0, trcolop_ge, (trcolvalue){ .i = 1 }, (trcolvalue){ 0 },
+        &filtered));
+    TEST_SUCCESS(tr_query_join(&query, buildscan, 1, filtered, 1, &join));
+    TEST_EQUAL(join->ncolumns, 4);
+
+    // Count matches and hash the pairs
+    uint64_t nmatches = 0, checksum = 0;
+    int64_t lastprobe = -1;
+    for (;;) {
+        trbatch *batch;
+        TEST_SUCCESS(tr_query_next(join, &batch));
+        if (batch == NULL) {
+            break;
+        }
+        TEST_LESS_EQUAL(batch->count, tr_batch_rows);
+        for (unsigned k = 0; k < batch->nsel; ++k) {
+            unsigned row = query_row(batch, k);
+            trcolvalue pid, pkey, bid, bkey;
+            TEST_TRUE(query_value(batch, 0, row, &pid));
+            TEST_TRUE(query_value(batch, 1, row, &pkey));
+            TEST_TRUE(query_value(batch, 2, row, &bid));
+            TEST_TRUE(query_value(batch, 3, row, &bkey));
+            TEST_EQUAL(pkey.i, bkey.i);
+            TEST_GREATER_EQUAL(pid.i, lastprobe);
+            lastprobe = pid.i;
+            nmatches++;
+            checksum += tr_hash_u64(pid.i * nbuild + bid.i);
+        }
+    }
+
+    uint64_t expected = 0, expectedsum = 0;
+    for (int64_t p = 1; p < nprobe; ++p) {
+        for (int64_t b = 0; b < nbuild; ++b) {
+            if (p % 97 != 3 && b % 101 != 5 && probekeys[p] == buildkeys[b]) {
+                expected++;
+                expectedsum += tr_hash_u64(p * nbuild + b);
+            }
+        }
+    }
+    TEST_GREATER_THAN(expected, 0);
+    TEST_EQUAL(nmatches, expected);
+    TEST_EQUAL(checksum, expectedsum);
+
+    tr_query_cleanup(&query);
+    tr_free(buildkeys);
+    tr_free(probekeys);
+    query_cleanup_columns(build, 2);
+    query_cleanup_columns(probe, 2);
+    TEST_EQUAL(tr_alloc_stat('tqr4').nalloc, 0);
+}
+
+static const test_case query_cases[] =
+{
+    TEST_CASE(query_scan),
+    TEST_CASE(query_filter_project),
+    TEST_CASE(query_aggregate),
+    TEST_CASE(query_join),
+};
+
+TEST_SUITE(query_tests, query_cases);
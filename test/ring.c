@@ -0,0 +1,113 @@
+/////////////////////////////////////////////////////////////////////////////
+//
+// Terrascale
+// Copyright (c) Dave Kilian & Emily Kilian 2023. All rights reserved.
+//
+//////////////////////////////////////////////////////////////////////////////
+
+#include <pch.h>
+#include <test/test.h>
+#include <runtime/ring.h>
+
+#include <sched.h>
+
+static void ring_initialize()
+{
+    trring ring;
+    TEST_FAIL(tr_ring_initialize(&ring, 0, 'test'));
+    TEST_FAIL(tr_ring_initialize(&ring, 3, 'test'));
+
+    TEST_SUCCESS(tr_ring_initialize(&ring, 4, 'test'));
+    TEST_TRUE(tr_ring_empty(&ring));
+    TEST_NULL(tr_ring_pop(&ring));
+    tr_ring_cleanup(&ring);
+}
+
+static void ring_fifo()
+{
+    trring ring;
+    TEST_SUCCESS(tr_ring_initialize(&ring, 4, 'test'));
+
+    int items[4];
+    for (int i = 0; i < 4; ++i) {
+        TEST_TRUE(tr_ring_push(&ring, items + i));
+    }
+
+    TEST_FALSE(tr_ring_push(&ring, items));
+    TEST_FALSE(tr_ring_empty(&ring));
+
+    for (int i = 0; i < 4; ++i) {
+        TEST_EQUAL(tr_ring_pop(&ring), items + i);
+    }
+
+    TEST_NULL(tr_ring_pop(&ring));
+    TEST_TRUE(tr_ring_empty(&ring));
+    tr_ring_cleanup(&ring);
+}
+
+static void ring_wrap()
+{
+    trring ring;
+    TEST_SUCCESS(tr_ring_initialize(&ring, 4, 'test'));
+
+    int items[3];
+    for (int round = 0; round < 10; ++round) {
+        for (int i = 0; i < 3; ++i) {
+            TEST_TRUE(tr_ring_push(&ring, items + i));
+        }
+        for (int i = 0; i < 3; ++i) {
+            TEST_EQUAL(tr_ring_pop(&ring), items + i);
+        }
+    }
+
+    TEST_TRUE(tr_ring_empty(&ring));
+    tr_ring_cleanup(&ring);
+}
+
+#define RING_THREAD_COUNT 100000
+
+static void *ring_producer(void *arg)
+{
+    trring *ring = arg;
+    for (uintptr_t i = 1; i <= RING_THREAD_COUNT; ++i) {
+        while (!tr_ring_push(ring, (void *)i)) {
+            sched_yield();
+        }
+    }
+
+    return NULL;
+}
+
+static void ring_threads()
+{
+    trring ring;
+    TEST_SUCCESS(tr_ring_initialize(&ring, 64, 'test'));
+
+    pthread_t producer;
+    TEST_EQUAL(0, pthread_create(&producer, NULL, &ring_producer, &ring));
+
+    uintptr_t expect = 1;
+    while (expect <= RING_THREAD_COUNT) {
+        void *item = tr_ring_pop(&ring);
+        if (item != NULL) {
+            TEST_EQUAL((uintptr_t)item, expect);
+            expect += 1;
+        } else {
+            sched_yield();
+        }
+    }
+
+    TEST_EQUAL(0, pthread_join(producer, NULL));
+    TEST_TRUE(tr_ring_empty(&ring));
+    tr_ring_cleanup(&ring);
+}
+
+static const test_case ring_cases[] =
+{
+    TEST_CASE(ring_initialize),
+    TEST_CASE(ring_fifo),
+    TEST_CASE(ring_wrap),
+    TEST_CASE(ring_threads),
+};
+
+TEST_SUITE(ring_tests, ring_cases);
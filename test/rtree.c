@@ -0,0 +1,190 @@
+/////////////////////////////////////////////////////////////////////////////
+//
+// Terrascale
+// Copyright (c) Dave Kilian & Emily Kilian 2023. All rights reserved.
+//
+//////////////////////////////////////////////////////////////////////////////
+
+#include <pch.h>
+#include <test/test.h>
+#include <index/rtree.h>
+
+#define RTREE_NENTRIES 20000
+#define RTREE_NWINDOWS 300
+
+static uint64_t rtree_rand(uint64_t *state)
+{
+    uint64_t x = *state;
+    x ^= x << 13;
+    x ^= x >> 7;
+    x ^= x << 17;
+    return *state = x;
+}
+
+// A random rectangle in [0, 1000)^2, at most `size` on a side
+static trrect rtree_random_rect(uint64_t *state, unsigned size)
+{
+    double x = rtree_rand(state) % 1000, y = rtree_rand(state) % 1000;
+    return tr_rect_make(x, y, x + rtree_rand(state) % size, y + rtree_rand(state) % size);
+}
+
+typedef struct {
+
+    uint64_t count;
+    uint64_t sum;
+    uint64_t limit;
+
+} rtree_result;
+
+static bool rtree_collect(trrect rect, uint64_t value, void *context)
+{
+    (void)rect;
+    rtree_result *result = context;
+    result->count++;
+    result->sum += value;
+    return result->count < result->limit;
+}
+
+// Checks that every node's rectangles are within its parent's, that the
+// leaves are all at level 0, and that nodes below the root aren't too empty
+//
+static uint64_t rtree_check_node(const trrtnode *node, trrect bounds, bool root, bool packed)
+{
+    if (!root && !packed) {
+        TEST_GREATER_EQUAL(node->count, tr_rtree_minfill);
+    }
+    TEST_LESS_EQUAL(node->count, tr_rtree_fanout);
+
+    uint64_t nentries = 0;
+    for (unsigned i = 0; i < node->count; ++i) {
+        trrect r = tr_rect_make(node->minx[i], node->miny[i], node->maxx[i], node->maxy[i]);
+        TEST_TRUE(tr_rect_contains(bounds, r));
+        if (node->level > 0) {
+            TEST_EQUAL(node->children[i]->level + 1, node->level);
+            nentries += rtree_check_node(node->children[i], r, false, packed);
+        } else {
+            nentries++;
+        }
+    }
+    return nentries;
+}
+
+// Compares window queries against checking every entry
+static void rtree_check(const trrtree *tree, const trrtentry *entries, uint64_t count, bool packed)
+{
+    trrect everything = tr_rect_make(-INFINITY, -INFINITY, INFINITY, INFINITY);
+    TEST_EQUAL(rtree_check_node(tree->root, everything, true, packed), count);
+
+    uint64_t seed = 0x9e3779b97f4a7c15;
+    for (unsigned w = 0; w < RTREE_NWINDOWS; ++w) {
+        trrect window = rtree_random_rect(&seed, 100);
+        rtree_result expected = {0}, actual = { .limit = UINT64_MAX };
+        for (uint64_t i = 0; i < count; ++i) {
+            if (tr_rect_intersects(entries[i].rect, window)) {
+                expected.count++;
+                expected.sum += entries[i].value;
+            }
+        }
+        tr_rtree_search(tree, window, rtree_collect, &actual);
+        TEST_EQUAL(actual.count, expected.count);
+        TEST_EQUAL(actual.sum, expected.sum);
+    }
+}
+
+static trrtentry *rtree_entries(uint64_t count, tralloctag tag)
+{
+    trrtentry *entries = tr_alloc(count * sizeof(trrtentry), tag);
+    uint64_t seed = 0x2545f4914f6cdd1d;
+    for (uint64_t i = 0; i < count; ++i) {
+        // Some points and some tall or wide rectangles among the small ones
+        unsigned size = i % 10 == 0 ? 1 : i % 10 == 1 ? 200 : 20;
+        entries[i] = (trrtentry){ rtree_random_rect(&seed, size), i };
+    }
+    return entries;
+}
+
+static void rtree_insert_search()
+{
+    trrtentry *entries = rtree_entries(RTREE_NENTRIES, 'trt1');
+    trrtree tree;
+    TEST_SUCCESS(tr_rtree_initialize(&tree, 'trt1'));
+
+    rtree_result result = { .limit = UINT64_MAX };
+    tr_rtree_search(&tree, tr_rect_make(0, 0, 1000, 1000), rtree_collect, &result);
+    TEST_EQUAL(result.count, 0);
+
+    for (uint64_t i = 0; i < RTREE_NENTRIES; ++i) {
+        TEST_SUCCESS(tr_rtree_insert(&tree, entries[i].rect, entries[i].value));
+        if (i == 100 || i == 1000) {
+            rtree_check(&tree, entries, i + 1, false);
+        }
+    }
+    rtree_check(&tree, entries, RTREE_NENTRIES, false);
+
+    trrtreestat stat = tr_rtree_stat(&tree);
+    TEST_EQUAL(stat.nentries, RTREE_NENTRIES);
+    TEST_GREATER_EQUAL(stat.height, 3);
+    TEST_GREATER_THAN(stat.leaffill, 0.5);
+
+    // Invalid rectangles are refused, and a query can stop early
+    TEST_EQUAL(tr_rtree_insert(&tree, tr_rect_make(1, 0, 0, 1), 0), trstatus_argument);
+    TEST_EQUAL(tr_rtree_insert(&tree, tr_rect_make(NAN, 0, 0, 1), 0), trstatus_argument);
+    result = (rtree_result){ .limit = 10 };
+    tr_rtree_search(&tree, tr_rect_make(0, 0, 1000, 1000), rtree_collect, &result);
+    TEST_EQUAL(result.count, 10);
+
+    tr_rtree_cleanup(&tree);
+    tr_free(entries);
+    TEST_EQUAL(tr_alloc_stat('trt1').nalloc, 0);
+}
+
+static void rtree_bulk_build()
+{
+    trrtentry *entries = rtree_entries(RTREE_NENTRIES, 'trt2');
+    trrtentry *copy = tr_alloc(RTREE_NENTRIES * sizeof(trrtentry), 'trt2');
+    memcpy(copy, entries, RTREE_NENTRIES * sizeof(trrtentry));
+
+    trrtree tree;
+    TEST_SUCCESS(tr_rtree_initialize(&tree, 'trt2'));
+    TEST_SUCCESS(tr_rtree_build(&tree, copy, RTREE_NENTRIES));
+    rtree_check(&tree, entries, RTREE_NENTRIES, true);
+
+    trrtreestat stat = tr_rtree_stat(&tree);
+    TEST_EQUAL(stat.nentries, RTREE_NENTRIES);
+    TEST_EQUAL(stat.nleaves, (RTREE_NENTRIES + tr_rtree_fanout - 1) / tr_rtree_fanout);
+    TEST_GREATER_THAN(stat.leaffill, 0.99);
+    TEST_EQUAL(tr_rtree_build(&tree, copy, RTREE_NENTRIES), trstatus_argument);
+
+    // Inserts after building split the full nodes
+    uint64_t seed = 0x5851f42d4c957f2d;
+    trrtentry *more = tr_alloc(2 * RTREE_NENTRIES * sizeof(trrtentry), 'trt2');
+    memcpy(more, entries, RTREE_NENTRIES * sizeof(trrtentry));
+    for (uint64_t i = RTREE_NENTRIES; i < 2 * RTREE_NENTRIES; ++i) {
+        more[i] = (trrtentry){ rtree_random_rect(&seed, 20), i };
+        TEST_SUCCESS(tr_rtree_insert(&tree, more[i].rect, more[i].value));
+    }
+    rtree_check(&tree, more, 2 * RTREE_NENTRIES, true);
+    tr_rtree_cleanup(&tree);
+
+    // Building from one entry, or none, and an invalid rectangle
+    TEST_SUCCESS(tr_rtree_initialize(&tree, 'trt2'));
+    TEST_SUCCESS(tr_rtree_build(&tree, copy, 0));
+    copy[1].rect = tr_rect_make(0, 1, 0, 0);
+    TEST_EQUAL(tr_rtree_build(&tree, copy, 2), trstatus_argument);
+    TEST_SUCCESS(tr_rtree_build(&tree, copy, 1));
+    TEST_EQUAL(tr_rtree_stat(&tree).height, 1);
+    tr_rtree_cleanup(&tree);
+
+    tr_free(more);
+    tr_free(copy);
+    tr_free(entries);
+    TEST_EQUAL(tr_alloc_stat('trt2').nalloc, 0);
+}
+
+static const test_case rtree_cases[] =
+{
+    TEST_CASE(rtree_insert_search),
+    TEST_CASE(rtree_bulk_build),
+};
+
+TEST_SUITE(rtree_tests, rtree_cases);
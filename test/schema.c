@@ -0,0 +1,140 @@
+/////////////////////////////////////////////////////////////////////////////
+//
+// Terrascale
+// Copyright (c) Dave Kilian & Emily Kilian 2023. All rights reserved.
+//
+//////////////////////////////////////////////////////////////////////////////
+
+#include <pch.h>
+#include <test/test.h>
+#include <table/schema.h>
+
+static const trfielddef schema_defs[] = {
+    { "flags", trfield_i8 },
+    { "name", trfield_bytes },
+    { "zoom", trfield_i32 },
+    { "id", trfield_i64 },
+    { "level", trfield_i16 },
+    { "note", trfield_bytes },
+    { "size", trfield_f64 },
+    { "x", trfield_i32 },
+    { "tags", trfield_bytes },
+};
+
+static void schema_layout()
+{
+    trrowlayout layout;
+    TEST_SUCCESS(tr_rowlayout_compile(&layout, schema_defs, arraysize(schema_defs), 'tsc1'));
+    TEST_EQUAL(layout.nfields, arraysize(schema_defs));
+    TEST_EQUAL(layout.nvarlen, 3);
+
+    // Widest first: id, size, zoom, x, level, flags, then the offset array
+    TEST_EQUAL(tr_rowlayout_find(&layout, "id")->offset, 0);
+    TEST_EQUAL(tr_rowlayout_find(&layout, "size")->offset, 8);
+    TEST_EQUAL(tr_rowlayout_find(&layout, "zoom")->offset, 16);
+    TEST_EQUAL(tr_rowlayout_find(&layout, "x")->offset, 20);
+    TEST_EQUAL(tr_rowlayout_find(&layout, "level")->offset, 24);
+    TEST_EQUAL(tr_rowlayout_find(&layout, "flags")->offset, 26);
+    TEST_EQUAL(layout.varoffsets, 28);
+    TEST_EQUAL(tr_rowlayout_find(&layout, "name")->offset, 28);
+    TEST_EQUAL(tr_rowlayout_find(&layout, "note")->offset, 32);
+    TEST_EQUAL(tr_rowlayout_find(&layout, "tags")->offset, 36);
+    TEST_EQUAL(layout.nulls, 44);
+    TEST_EQUAL(layout.header, 46);
+    TEST_NULL(tr_rowlayout_find(&layout, "missing"));
+
+    // Fixed fields alone need no offset array
+    trrowlayout fixed;
+    trfielddef defs[] = { { "a", trfield_i8 }, { "b", trfield_i32 } };
+    TEST_SUCCESS(tr_rowlayout_compile(&fixed, defs, arraysize(defs), 'tsc1'));
+    TEST_EQUAL(fixed.fields[1].offset, 0);
+    TEST_EQUAL(fixed.fields[0].offset, 4);
+    TEST_EQUAL(fixed.nulls, 8);
+    TEST_EQUAL(fixed.header, 9);
+    tr_rowlayout_cleanup(&fixed);
+
+    TEST_EQUAL(tr_rowlayout_compile(&fixed, defs, 0, 'tsc1'), trstatus_argument);
+
+    tr_rowlayout_cleanup(&layout);
+    TEST_EQUAL(tr_alloc_stat('tsc1').nalloc, 0);
+}
+
+static void schema_rows()
+{
+    trrowlayout layout;
+    TEST_SUCCESS(tr_rowlayout_compile(&layout, schema_defs, arraysize(schema_defs), 'tsc2'));
+
+    trfieldvalue values[arraysize(schema_defs)] = {
+        { .i = -3 },
+        { .bytes = { "terrascale", 10 } },
+        { .i = 12 },
+        { .i = INT64_MIN + 7 },
+        { .null = true },
+        { .null = true },
+        { .f = 2.5 },
+        { .i = -40000 },
+        { .bytes = { "ab", 2 } },
+    };
+
+    size_t size = tr_row_size(&layout, values);
+    TEST_EQUAL(size, layout.header + 12);
+    uint64_t row[8];
+    tr_row_encode(&layout, values, row);
+
+    const trrowfield *name = tr_rowlayout_find(&layout, "name");
+    const trrowfield *note = tr_rowlayout_find(&layout, "note");
+    const trrowfield *tags = tr_rowlayout_find(&layout, "tags");
+    const trrowfield *level = tr_rowlayout_find(&layout, "level");
+    const trrowfield *x = tr_rowlayout_find(&layout, "x");
+
+    TEST_EQUAL(tr_row_i8(row, tr_rowlayout_find(&layout, "flags")), -3);
+    TEST_EQUAL(tr_row_i32(row, tr_rowlayout_find(&layout, "zoom")), 12);
+    TEST_EQUAL(tr_row_i64(row, tr_rowlayout_find(&layout, "id")), INT64_MIN + 7);
+    TEST_EQUAL(tr_row_f64(row, tr_rowlayout_find(&layout, "size")), 2.5);
+    TEST_EQUAL(tr_row_i32(row, x), -40000);
+    TEST_TRUE(tr_row_null(row, level));
+    TEST_EQUAL(tr_row_i16(row, level), 0);
+    TEST_FALSE(tr_row_null(row, x));
+
+    uint32_t n;
+    const void *data = tr_row_bytes(row, name, &n);
+    TEST_EQUAL(n, 10);
+    TEST_EQUAL(memcmp(data, "terrascale", 10), 0);
+    data = tr_row_bytes(row, note, &n);
+    TEST_TRUE(tr_row_null(row, note));
+    TEST_EQUAL(n, 0);
+    data = tr_row_bytes(row, tags, &n);
+    TEST_EQUAL(n, 2);
+    TEST_EQUAL(memcmp(data, "ab", 2), 0);
+    TEST_EQUAL((size_t)ptr_dist(row, data) + n, size);
+
+    // In-place updates
+    tr_row_set_i16(row, level, 9);
+    tr_row_set_i32(row, x, 77);
+    TEST_FALSE(tr_row_null(row, level));
+    TEST_EQUAL(tr_row_i16(row, level), 9);
+    TEST_EQUAL(tr_row_i32(row, x), 77);
+    TEST_TRUE(tr_row_null(row, note));
+
+    trfieldvalue decoded[arraysize(schema_defs)];
+    tr_row_decode(&layout, row, decoded);
+    TEST_EQUAL(decoded[0].i, -3);
+    TEST_EQUAL(decoded[1].bytes.size, 10);
+    TEST_EQUAL(decoded[3].i, INT64_MIN + 7);
+    TEST_FALSE(decoded[4].null);
+    TEST_EQUAL(decoded[4].i, 9);
+    TEST_TRUE(decoded[5].null);
+    TEST_EQUAL(decoded[7].i, 77);
+    TEST_EQUAL(decoded[8].bytes.size, 2);
+
+    tr_rowlayout_cleanup(&layout);
+    TEST_EQUAL(tr_alloc_stat('tsc2').nalloc, 0);
+}
+
+static const test_case schema_cases[] =
+{
+    TEST_CASE(schema_layout),
+    TEST_CASE(schema_rows),
+};
+
+TEST_SUITE(schema_tests, schema_cases);
@@ -0,0 +1,230 @@
+/////////////////////////////////////////////////////////////////////////////
+//
+// Terrascale
+// Copyright (c) Dave Kilian & Emily Kilian 2023. All rights reserved.
+//
+//////////////////////////////////////////////////////////////////////////////
+
+#include <pch.h>
+#include <test/test.h>
+#include <store/segment.h>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+static void temp_path(char *path, size_t size)
+{
+    snprintf(path, size, "/tmp/trtest-segment-%d", (int)getpid());
+}
+
+// Writes a segment whose blob i is i bytes long, each byte equal to i
+static void write_segment(const char *path, int count)
+{
+    char blob[256];
+
+    trsegwriter writer;
+    TEST_SUCCESS(tr_segwriter_create(&writer, path, 'test'));
+    for (int i = 0; i < count; ++i) {
+        uint32_t index;
+        memset(blob, i, sizeof(blob));
+        TEST_SUCCESS(tr_segwriter_add(&writer, blob, i % 256, &index));
+        TEST_EQUAL(index, (uint32_t)i);
+    }
+    TEST_SUCCESS(tr_segwriter_finish(&writer));
+}
+
+// Overwrites bytes of a file in place
+static void patch_file(const char *path, off_t offset, const void *data, size_t bytes)
+{
+    int fd = open(path, O_WRONLY);
+    TEST_TRUE(fd >= 0);
+    TEST_EQUAL(pwrite(fd, data, bytes, offset), (ssize_t)bytes);
+    close(fd);
+}
+
+static void segment_roundtrip()
+{
+    char path[64];
+    temp_path(path, sizeof(path));
+    write_segment(path, 1000);
+
+    trsegment seg;
+    TEST_SUCCESS(tr_segment_open(&seg, path, trsegment_random));
+    TEST_EQUAL(seg.count, 1000);
+
+    for (uint32_t i = 0; i < 1000; ++i) {
+        const uint8_t *data;
+        uint64_t length;
+        TEST_SUCCESS(tr_segment_get(&seg, i, (const void **)&data, &length));
+        TEST_EQUAL(length, i % 256);
+        TEST_EQUAL((uintptr_t)data % tr_segment_align, 0);
+        for (uint64_t j = 0; j < length; ++j) {
+            TEST_EQUAL(data[j], (uint8_t)i);
+        }
+    }
+
+    const void *data;
+    uint64_t length;
+    TEST_EQUAL(tr_segment_get(&seg, 1000, &data, &length), trstatus_not_found);
+
+    TEST_SUCCESS(tr_segment_advise(&seg, trsegment_sequential));
+    tr_segment_close(&seg);
+
+    // An empty segment is still a segment
+    write_segment(path, 0);
+    TEST_SUCCESS(tr_segment_open(&seg, path, trsegment_normal));
+    TEST_EQUAL(seg.count, 0);
+    tr_segment_close(&seg);
+
+    unlink(path);
+}
+
+static void segment_bad_header()
+{
+    char path[64];
+    temp_path(path, sizeof(path));
+    trsegment seg;
+
+    write_segment(path, 10);
+    uint32_t magic = 0x12345678;
+    patch_file(path, offsetof(trseghdr, magic), &magic, sizeof(magic));
+    TEST_EQUAL(tr_segment_open(&seg, path, trsegment_normal), trstatus_parse);
+
+    write_segment(path, 10);
+    uint16_t version = tr_segment_version + 1;
+    patch_file(path, offsetof(trseghdr, version), &version, sizeof(version));
+    TEST_EQUAL(tr_segment_open(&seg, path, trsegment_normal), trstatus_version);
+
+    // Truncation is caught by the recorded file size
+    write_segment(path, 10);
+    TEST_EQUAL(truncate(path, 100), 0);
+    TEST_EQUAL(tr_segment_open(&seg, path, trsegment_normal), trstatus_overrun);
+
+    TEST_EQUAL(truncate(path, 4), 0);
+    TEST_EQUAL(tr_segment_open(&seg, path, trsegment_normal), trstatus_parse);
+
+    unlink(path);
+}
+
+static void segment_bad_offset()
+{
+    char path[64];
+    temp_path(path, sizeof(path));
+    write_segment(path, 10);
+
+    trsegment seg;
+    TEST_SUCCESS(tr_segment_open(&seg, path, trsegment_normal));
+    off_t index = (const char *)seg.index - (const char *)seg.base;
+    tr_segment_close(&seg);
+
+    // Point blob 3 past the end of the file
+    trsegentry entry = { .offset = 1 << 20, .length = 1 };
+    patch_file(path, index + 3 * sizeof(trsegentry), &entry, sizeof(entry));
+
+    TEST_SUCCESS(tr_segment_open(&seg, path, trsegment_normal));
+
+    const void *data;
+    uint64_t length;
+    TEST_EQUAL(tr_segment_get(&seg, 3, &data, &length), trstatus_overrun);
+    TEST_SUCCESS(tr_segment_get(&seg, 4, &data, &length));
+    tr_segment_close(&seg);
+
+    unlink(path);
+}
+
+static void segment_compressed()
+{
+    char path[64];
+    temp_path(path, sizeof(path));
+
+    // A compressible blob, a random one which can't shrink, and a tiny one
+    uint8_t *smooth = tr_alloc(4096, 'test');
+    uint8_t *noise = tr_alloc(4096, 'test');
+    uint32_t x = 1;
+    for (int i = 0; i < 4096; ++i) {
+        smooth[i] = (uint8_t)(i / 64);
+        x = x * 1103515245u + 12345u;
+        noise[i] = x >> 24;
+    }
+
+    trsegwriter writer;
+    uint32_t index;
+    TEST_SUCCESS(tr_segwriter_create(&writer, path, 'test'));
+    TEST_SUCCESS(tr_segwriter_add_compressed(&writer, smooth, 4096, &index));
+    TEST_SUCCESS(tr_segwriter_add_compressed(&writer, noise, 4096, &index));
+    TEST_SUCCESS(tr_segwriter_add_compressed(&writer, "z", 1, &index));
+    TEST_SUCCESS(tr_segwriter_add(&writer, smooth, 4096, &index));
+    TEST_SUCCESS(tr_segwriter_finish(&writer));
+
+    trsegment seg;
+    TEST_SUCCESS(tr_segment_open(&seg, path, trsegment_normal));
+    TEST_TRUE(seg.index[0].length < seg.index[0].rawlength);
+    TEST_EQUAL(seg.index[1].length, seg.index[1].rawlength);
+
+    // Compressed blobs can't be handed out in place
+    const void *data;
+    uint64_t length;
+    TEST_EQUAL(tr_segment_get(&seg, 0, &data, &length), trstatus_support);
+    TEST_SUCCESS(tr_segment_get(&seg, 1, &data, &length));
+    TEST_EQUAL(length, 4096);
+
+    uint8_t *buffer = tr_alloc(4096, 'test');
+    TEST_EQUAL(tr_segment_read(&seg, 0, buffer, 100, &length), trstatus_too_small);
+    TEST_EQUAL(length, 4096);
+
+    TEST_SUCCESS(tr_segment_read(&seg, 0, buffer, 4096, &length));
+    TEST_EQUAL(length, 4096);
+    TEST_EQUAL(memcmp(buffer, smooth, 4096), 0);
+
+    TEST_SUCCESS(tr_segment_read(&seg, 1, buffer, 4096, &length));
+    TEST_EQUAL(memcmp(buffer, noise, 4096), 0);
+
+    TEST_SUCCESS(tr_segment_read(&seg, 2, buffer, 4096, &length));
+    TEST_EQUAL(length, 1);
+    TEST_EQUAL(buffer[0], 'z');
+
+    TEST_SUCCESS(tr_segment_read(&seg, 3, buffer, 4096, &length));
+    TEST_EQUAL(memcmp(buffer, smooth, 4096), 0);
+
+    off_t offset = seg.index[0].offset;
+    tr_segment_close(&seg);
+
+    // Damage the compressed blob's first token so it claims a huge literal run
+    uint8_t token = 0xff;
+    patch_file(path, offset, &token, 1);
+    TEST_SUCCESS(tr_segment_open(&seg, path, trsegment_normal));
+    TEST_EQUAL(tr_segment_read(&seg, 0, buffer, 4096, &length), trstatus_corrupt);
+    tr_segment_close(&seg);
+
+    tr_free(buffer);
+    tr_free(noise);
+    tr_free(smooth);
+    unlink(path);
+}
+
+static void segment_abort()
+{
+    char path[64];
+    temp_path(path, sizeof(path));
+    unlink(path);
+
+    trsegwriter writer;
+    uint32_t index;
+    TEST_SUCCESS(tr_segwriter_create(&writer, path, 'test'));
+    TEST_SUCCESS(tr_segwriter_add(&writer, "abc", 3, &index));
+    tr_segwriter_abort(&writer);
+
+    // Nothing appears under the final name
+    TEST_TRUE(access(path, F_OK) != 0);
+}
+
+static const test_case segment_cases[] =
+{
+    TEST_CASE(segment_roundtrip),
+    TEST_CASE(segment_bad_header),
+    TEST_CASE(segment_bad_offset),
+    TEST_CASE(segment_compressed),
+    TEST_CASE(segment_abort),
+};
+
+TEST_SUITE(segment_tests, segment_cases);
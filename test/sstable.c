@@ -0,0 +1,171 @@
+/////////////////////////////////////////////////////////////////////////////
+//
+// Terrascale
+// Copyright (c) Dave Kilian & Emily Kilian 2023. All rights reserved.
+//
+//////////////////////////////////////////////////////////////////////////////
+
+#include <pch.h>
+#include <test/test.h>
+#include <runtime/hash.h>
+#include <store/sstable.h>
+
+#include <unistd.h>
+
+static void temp_path(char *path, size_t size)
+{
+    snprintf(path, size, "/tmp/trtest-sstable-%d", (int)getpid());
+}
+
+static void make_key(char *key, int i)
+{
+    snprintf(key, 16, "key%07d", i);
+}
+
+// Writes a table with keys 0, 2, 4, ... where every tenth is deleted
+static void write_table(const char *path, int count, unsigned blocksize)
+{
+    trsstbuilder builder;
+    TEST_SUCCESS(tr_sstbuilder_create(&builder, path, blocksize, 10, 'test'));
+
+    for (int i = 0; i < count; ++i) {
+        char key[16], value[64];
+        make_key(key, 2 * i);
+        memset(value, 'a' + i % 26, sizeof(value));
+
+        trkvitem item = {
+            .key = key,
+            .keylen = strlen(key),
+            .value = value,
+            .vallen = i % 64,
+            .seq = 1000 + i,
+            .tombstone = i % 10 == 9,
+        };
+        TEST_SUCCESS(tr_sstbuilder_add(&builder, &item));
+    }
+
+    TEST_EQUAL(tr_sstbuilder_size(&builder) > 0, count > 0);
+    TEST_SUCCESS(tr_sstbuilder_finish(&builder));
+}
+
+static trstatus lookup(trsstable *table, int i, trkvitem *item)
+{
+    char key[16];
+    make_key(key, i);
+    return tr_sstable_get(table, key, strlen(key), tr_hash_bytes(key, strlen(key), 0), item);
+}
+
+static void sstable_get()
+{
+    char path[64];
+    temp_path(path, sizeof(path));
+    write_table(path, 5000, 1024);
+
+    trsstable table;
+    TEST_SUCCESS(tr_sstable_open(&table, path, 7, 'test'));
+    TEST_EQUAL(table.number, 7);
+    TEST_EQUAL(table.nentries, 5000);
+    TEST_EQUAL(table.maxseq, 1000 + 4999);
+    TEST_GREATER_THAN(table.nblocks, 50);
+    TEST_EQUAL(memcmp(table.smallest, "key0000000", 10), 0);
+    TEST_EQUAL(memcmp(table.largest, "key0009998", 10), 0);
+
+    trkvitem item;
+    for (int i = 0; i < 5000; ++i) {
+        TEST_SUCCESS(lookup(&table, 2 * i, &item));
+        TEST_EQUAL(item.seq, (trseqno)(1000 + i));
+        TEST_EQUAL(item.tombstone, i % 10 == 9);
+        if (!item.tombstone) {
+            TEST_EQUAL(item.vallen, (unsigned)(i % 64));
+            TEST_TRUE(item.vallen == 0 || ((const char *)item.value)[0] == 'a' + i % 26);
+        }
+    }
+
+    // Keys between and around the table's keys aren't there
+    for (int i = -1; i < 10001; i += 2) {
+        TEST_EQUAL(lookup(&table, i, &item), trstatus_not_found);
+    }
+    TEST_FALSE(tr_sstable_covers(&table, "key", 3));
+    TEST_FALSE(tr_sstable_covers(&table, "key1", 4));
+    TEST_TRUE(tr_sstable_covers(&table, "key0005", 7));
+
+    tr_sstable_close(&table);
+    unlink(path);
+}
+
+static void sstable_iterate()
+{
+    char path[64];
+    temp_path(path, sizeof(path));
+    write_table(path, 3000, 4096);
+
+    trsstable table;
+    TEST_SUCCESS(tr_sstable_open(&table, path, 1, 'test'));
+
+    trsstiter iter;
+    tr_sstiter_initialize(&iter, &table);
+
+    trkvitem item;
+    int n = 0;
+    while (tr_ok(tr_sstiter_next(&iter, &item))) {
+        char key[16];
+        make_key(key, 2 * n);
+        TEST_EQUAL(item.keylen, strlen(key));
+        TEST_EQUAL(memcmp(item.key, key, item.keylen), 0);
+        n++;
+    }
+    TEST_EQUAL(n, 3000);
+    TEST_EQUAL(tr_sstiter_next(&iter, &item), trstatus_not_found);
+
+    tr_sstable_close(&table);
+
+    // An empty table has no key range
+    write_table(path, 0, 4096);
+    TEST_SUCCESS(tr_sstable_open(&table, path, 2, 'test'));
+    TEST_EQUAL(table.nblocks, 0);
+    TEST_NULL(table.smallest);
+    TEST_EQUAL(lookup(&table, 0, &item), trstatus_not_found);
+    tr_sstiter_initialize(&iter, &table);
+    TEST_EQUAL(tr_sstiter_next(&iter, &item), trstatus_not_found);
+    tr_sstable_close(&table);
+
+    unlink(path);
+}
+
+static void sstable_abort()
+{
+    char path[64];
+    temp_path(path, sizeof(path));
+    unlink(path);
+
+    trsstbuilder builder;
+    TEST_SUCCESS(tr_sstbuilder_create(&builder, path, 4096, 10, 'test'));
+    trkvitem item = { .key = "a", .keylen = 1, .value = "b", .vallen = 1, .seq = 1 };
+    TEST_SUCCESS(tr_sstbuilder_add(&builder, &item));
+    tr_sstbuilder_abort(&builder);
+
+    trsstable table;
+    TEST_FAIL(tr_sstable_open(&table, path, 1, 'test'));
+    TEST_EQUAL(access(path, F_OK), -1);
+
+    // Segments which aren't tables are rejected
+    trsegwriter writer;
+    uint32_t index;
+    TEST_SUCCESS(tr_segwriter_create(&writer, path, 'test'));
+    for (int i = 0; i < 3; ++i) {
+        TEST_SUCCESS(tr_segwriter_add(&writer, "nope", 4, &index));
+    }
+    TEST_SUCCESS(tr_segwriter_finish(&writer));
+    TEST_EQUAL(tr_sstable_open(&table, path, 1, 'test'), trstatus_parse);
+
+    unlink(path);
+}
+
+static const test_case sstable_cases[] =
+{
+    TEST_CASE(sstable_get),
+    TEST_CASE(sstable_iterate),
+    TEST_CASE(sstable_abort),
+};
+
+TEST_SUITE(sstable_tests, sstable_cases);
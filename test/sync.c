@@ -0,0 +1,322 @@
+/////////////////////////////////////////////////////////////////////////////
+//
+// Terrascale
+// Copyright (c) Dave Kilian & Emily Kilian 2023. All rights reserved.
+//
+//////////////////////////////////////////////////////////////////////////////
+
+#include <pch.h>
+#include <test/test.h>
+#include <taskman/sync.h>
+
+#include <sched.h>
+
+#define SYNC_NTASKS 8
+#define SYNC_NITERS 200
+
+static void start_taskman(trtaskman *tm)
+{
+    trtaskmanconfig config;
+    tr_taskman_defaults(&config, trtaskman_shared);
+    config.nworkers = 4;
+    config.tag = 'test';
+    TEST_SUCCESS(tr_taskman_initialize(tm, &config));
+}
+
+// Each client repeatedly takes a lock, yields while holding it, then
+// releases it. Holding the lock across a yield forces other tasks to park.
+typedef struct {
+    trtask task;            // The client task
+    void *lock;             // The lock under test
+    bool writer;            // Whether to take the lock exclusive (rwlock)
+    int remaining;          // Iterations left to run
+    int phase;              // 0: acquiring, 1: holding
+    int saved;              // Counter value read while holding the lock
+} syncclient;
+
+static int counter;                 // Protected by the lock under test
+static _Atomic int readers_inside;  // Readers currently holding the rwlock
+static _Atomic int writers_inside;  // Writers currently holding the rwlock
+static _Atomic int inside;          // Tasks currently holding a unit
+static _Atomic int maxinside;       // Most tasks ever holding a unit
+static _Atomic int violations;      // Exclusion violations observed
+
+static trstatus mutex_client(trtask *task)
+{
+    syncclient *c = container_of(task, syncclient, task);
+
+    while (c->remaining > 0) {
+        if (c->phase == 0) {
+            if (tr_mutex_acquire(c->lock, task) == trstatus_pending) {
+                return trstatus_pending;
+            }
+            c->saved = counter;
+            c->phase = 1;
+            return trstatus_later;
+        }
+
+        counter = c->saved + 1;
+        tr_mutex_release(c->lock);
+        c->remaining -= 1;
+        c->phase = 0;
+    }
+
+    return trstatus_ok;
+}
+
+static void run_clients(trtaskfn *run, void *lock, int nwriters)
+{
+    trtaskman tm;
+    start_taskman(&tm);
+
+    syncclient clients[SYNC_NTASKS];
+    for (int i = 0; i < SYNC_NTASKS; ++i) {
+        syncclient *c = clients + i;
+        tr_task_initialize(&c->task, run, NULL);
+        c->lock = lock;
+        c->writer = i < nwriters;
+        c->remaining = SYNC_NITERS;
+        c->phase = 0;
+        tr_taskman_submit(&tm, &c->task);
+    }
+
+    tr_taskman_drain(&tm);
+    tr_taskman_cleanup(&tm);
+}
+
+static void mutex_run(bool fair)
+{
+    trmutex m;
+    tr_mutex_initialize(&m, fair);
+    counter = 0;
+
+    run_clients(&mutex_client, &m, 0);
+
+    TEST_EQUAL(counter, SYNC_NTASKS * SYNC_NITERS);
+    TEST_FALSE(m.held);
+    TEST_TRUE(tr_list_empty(&m.waiters));
+
+    trlockstat stat = tr_mutex_stat(&m);
+    TEST_EQUAL(stat.nacquire, SYNC_NTASKS * SYNC_NITERS);
+    TEST_GREATER_THAN(stat.ncontended, 0);
+    TEST_LESS_EQUAL(stat.ncontended, stat.nacquire);
+    TEST_GREATER_THAN(stat.waittime, 0);
+    TEST_LESS_EQUAL(stat.maxwait, stat.waittime);
+}
+
+static void sync_mutex_fair()
+{
+    mutex_run(true);
+}
+
+static void sync_mutex_unfair()
+{
+    mutex_run(false);
+}
+
+static void sync_mutex_try()
+{
+    trmutex m;
+    tr_mutex_initialize(&m, true);
+
+    TEST_SUCCESS(tr_mutex_try_acquire(&m));
+    TEST_EQUAL(tr_mutex_try_acquire(&m), trstatus_later);
+    tr_mutex_release(&m);
+    TEST_SUCCESS(tr_mutex_try_acquire(&m));
+    tr_mutex_release(&m);
+
+    TEST_EQUAL(tr_mutex_stat(&m).nacquire, 2);
+    TEST_EQUAL(tr_mutex_stat(&m).ncontended, 0);
+}
+
+static _Atomic int parked;  // Tasks parked by park_on_mutex
+
+typedef struct {
+    trtask task;            // The parking task
+    trmutex *mutex;         // The mutex to park on
+    bool waited;            // Whether the task has parked already
+} mutexparker;
+
+// Parks on the mutex once, and finishes when woken without retrying, so
+// the mutex is left free for the test to take
+static trstatus park_on_mutex(trtask *task)
+{
+    mutexparker *p = container_of(task, mutexparker, task);
+    if (!p->waited) {
+        p->waited = true;
+        TEST_EQUAL(tr_mutex_acquire(p->mutex, task), trstatus_pending);
+        atomic_fetch_add(&parked, 1);
+        return trstatus_pending;
+    }
+
+    return trstatus_ok;
+}
+
+static void sync_mutex_try_unfair()
+{
+    trtaskman tm;
+    start_taskman(&tm);
+
+    trmutex m;
+    tr_mutex_initialize(&m, false);
+    TEST_SUCCESS(tr_mutex_try_acquire(&m));
+
+    mutexparker parkers[2];
+    atomic_store(&parked, 0);
+    for (int i = 0; i < 2; ++i) {
+        parkers[i] = (mutexparker){ .mutex = &m };
+        tr_task_initialize(&parkers[i].task, &park_on_mutex, NULL);
+        tr_taskman_submit(&tm, &parkers[i].task);
+    }
+    while (atomic_load(&parked) < 2) {
+        sched_yield();
+    }
+
+    // Releasing wakes one waiter and leaves the other queued. An unfair
+    // mutex is up for grabs regardless, just as tr_mutex_acquire would see.
+    tr_mutex_release(&m);
+    TEST_SUCCESS(tr_mutex_try_acquire(&m));
+    tr_mutex_release(&m);
+
+    tr_taskman_drain(&tm);
+    tr_taskman_cleanup(&tm);
+}
+
+static trstatus rwlock_client(trtask *task)
+{
+    syncclient *c = container_of(task, syncclient, task);
+
+    while (c->remaining > 0) {
+        if (c->phase == 0) {
+            trstatus s = c->writer
+                ? tr_rwlock_acquire_exclusive(c->lock, task)
+                : tr_rwlock_acquire_shared(c->lock, task);
+
+            if (s == trstatus_pending) {
+                return trstatus_pending;
+            }
+
+            if (c->writer) {
+                atomic_fetch_add(&writers_inside, 1);
+                if (atomic_load(&readers_inside) != 0 ||
+                    atomic_load(&writers_inside) != 1) {
+                    atomic_fetch_add(&violations, 1);
+                }
+            } else {
+                atomic_fetch_add(&readers_inside, 1);
+                if (atomic_load(&writers_inside) != 0) {
+                    atomic_fetch_add(&violations, 1);
+                }
+            }
+
+            c->phase = 1;
+            return trstatus_later;
+        }
+
+        if (c->writer) {
+            atomic_fetch_sub(&writers_inside, 1);
+            tr_rwlock_release_exclusive(c->lock);
+        } else {
+            atomic_fetch_sub(&readers_inside, 1);
+            tr_rwlock_release_shared(c->lock);
+        }
+
+        c->remaining -= 1;
+        c->phase = 0;
+    }
+
+    return trstatus_ok;
+}
+
+static void rwlock_run(bool fair)
+{
+    trrwlock rw;
+    tr_rwlock_initialize(&rw, fair);
+    atomic_store(&violations, 0);
+
+    run_clients(&rwlock_client, &rw, 2);
+
+    TEST_EQUAL(atomic_load(&violations), 0);
+    TEST_FALSE(rw.writer);
+    TEST_EQUAL(rw.readers, 0);
+    TEST_TRUE(tr_list_empty(&rw.waiters));
+    TEST_EQUAL(tr_rwlock_stat(&rw).nacquire, SYNC_NTASKS * SYNC_NITERS);
+}
+
+static void sync_rwlock_fair()
+{
+    rwlock_run(true);
+}
+
+static void sync_rwlock_unfair()
+{
+    rwlock_run(false);
+}
+
+static trstatus semaphore_client(trtask *task)
+{
+    syncclient *c = container_of(task, syncclient, task);
+
+    while (c->remaining > 0) {
+        if (c->phase == 0) {
+            if (tr_semaphore_acquire(c->lock, task) == trstatus_pending) {
+                return trstatus_pending;
+            }
+
+            int now = atomic_fetch_add(&inside, 1) + 1;
+            int prev = atomic_load(&maxinside);
+            while (now > prev && !atomic_compare_exchange_weak(&maxinside, &prev, now)) {
+            }
+
+            c->phase = 1;
+            return trstatus_later;
+        }
+
+        atomic_fetch_sub(&inside, 1);
+        tr_semaphore_release(c->lock, 1);
+        c->remaining -= 1;
+        c->phase = 0;
+    }
+
+    return trstatus_ok;
+}
+
+static void semaphore_run(bool fair)
+{
+    trsemaphore sem;
+    tr_semaphore_initialize(&sem, 3, fair);
+    atomic_store(&inside, 0);
+    atomic_store(&maxinside, 0);
+
+    run_clients(&semaphore_client, &sem, 0);
+
+    TEST_EQUAL(sem.count, 3);
+    TEST_LESS_EQUAL(atomic_load(&maxinside), 3);
+    TEST_GREATER_THAN(atomic_load(&maxinside), 0);
+    TEST_TRUE(tr_list_empty(&sem.waiters));
+    TEST_EQUAL(tr_semaphore_stat(&sem).nacquire, SYNC_NTASKS * SYNC_NITERS);
+}
+
+static void sync_semaphore_fair()
+{
+    semaphore_run(true);
+}
+
+static void sync_semaphore_unfair()
+{
+    semaphore_run(false);
+}
+
+static const test_case sync_cases[] =
+{
+    TEST_CASE(sync_mutex_fair),
+    TEST_CASE(sync_mutex_unfair),
+    TEST_CASE(sync_mutex_try),
+    TEST_CASE(sync_mutex_try_unfair),
+    TEST_CASE(sync_rwlock_fair),
+    TEST_CASE(sync_rwlock_unfair),
+    TEST_CASE(sync_semaphore_fair),
+    TEST_CASE(sync_semaphore_unfair),
+};
+
+TEST_SUITE(sync_tests, sync_cases);
@@ -0,0 +1,520 @@
+/////////////////////////////////////////////////////////////////////////////
+//
+// Terrascale
+// Copyright (c) Dave Kilian & Emily Kilian 2023. All rights reserved.
+//
+//////////////////////////////////////////////////////////////////////////////
+
+#include <pch.h>
+#include <test/test.h>
+#include <taskman/taskman.h>
+
+#include <sched.h>
+
+static void start_taskman(trtaskman *tm, trtaskmode mode, int nworkers)
+{
+    trtaskmanconfig config;
+    tr_taskman_defaults(&config, mode);
+    config.nworkers = nworkers;
+    config.pin = false;
+    config.tag = 'test';
+    TEST_SUCCESS(tr_taskman_initialize(tm, &config));
+}
+
+static _Atomic int counter;
+
+static trstatus count_task(trtask *task)
+{
+    atomic_fetch_add(&counter, 1);
+    (void)task;
+    return trstatus_ok;
+}
+
+static void run_many(trtaskmode mode)
+{
+    trtaskman tm;
+    start_taskman(&tm, mode, 4);
+
+    trtask tasks[1000];
+    atomic_store(&counter, 0);
+    for (int i = 0; i < arraysize(tasks); ++i) {
+        tr_task_initialize(tasks + i, &count_task, NULL);
+        tr_taskman_submit(&tm, tasks + i);
+    }
+
+    tr_taskman_drain(&tm);
+    TEST_EQUAL(atomic_load(&counter), arraysize(tasks));
+
+    tr_taskman_cleanup(&tm);
+}
+
+static void taskman_shared_run()
+{
+    run_many(trtaskman_shared);
+}
+
+static void taskman_sharded_run()
+{
+    run_many(trtaskman_sharded);
+}
+
+typedef struct {
+    int remaining;  // How many more times to yield
+    trstatus final; // What to return once done yielding
+    trstatus seen;  // Status passed to the done() routine
+} yieldstate;
+
+static trstatus yield_task(trtask *task)
+{
+    yieldstate *st = task->context;
+    if (st->remaining > 0) {
+        st->remaining -= 1;
+        return trstatus_later;
+    }
+
+    return st->final;
+}
+
+static void yield_done(trtask *task, trstatus status)
+{
+    yieldstate *st = task->context;
+    st->seen = status;
+}
+
+static void taskman_yield()
+{
+    trtaskman tm;
+    start_taskman(&tm, trtaskman_shared, 2);
+
+    yieldstate st = { .remaining = 10, .final = trstatus_not_found };
+    trtask task;
+    tr_task_initialize(&task, &yield_task, &st);
+    task.done = &yield_done;
+
+    tr_taskman_submit(&tm, &task);
+    tr_taskman_drain(&tm);
+
+    TEST_EQUAL(st.remaining, 0);
+    TEST_EQUAL(st.seen, trstatus_not_found);
+
+    tr_taskman_cleanup(&tm);
+}
+
+typedef struct {
+    _Atomic int phase;  // 0: not yet run, 1: parked, 2: resumed and finished
+    trtask *waiter;     // The task to resume (for waker tasks)
+} parkstate;
+
+static trstatus park_task(trtask *task)
+{
+    parkstate *st = task->context;
+    if (atomic_load(&st->phase) == 0) {
+        atomic_store(&st->phase, 1);
+        return trstatus_pending;
+    }
+
+    atomic_store(&st->phase, 2);
+    return trstatus_ok;
+}
+
+static trstatus wake_task(trtask *task)
+{
+    parkstate *st = task->context;
+    if (atomic_load(&st->phase) != 1) {
+        return trstatus_later;
+    }
+
+    tr_task_resume(st->waiter);
+    return trstatus_ok;
+}
+
+static void park_resume(trtaskmode mode)
+{
+    trtaskman tm;
+    start_taskman(&tm, mode, 3);
+
+    parkstate st;
+    atomic_init(&st.phase, 0);
+
+    trtask parker, waker;
+    tr_task_initialize(&parker, &park_task, &st);
+    tr_task_initialize(&waker, &wake_task, &st);
+    st.waiter = &parker;
+
+    tr_taskman_submit_to(&tm, 0, &parker);
+    tr_taskman_submit_to(&tm, 2, &waker);
+    tr_taskman_drain(&tm);
+
+    TEST_EQUAL(atomic_load(&st.phase), 2);
+    tr_taskman_cleanup(&tm);
+}
+
+static void taskman_shared_park()
+{
+    park_resume(trtaskman_shared);
+}
+
+static void taskman_sharded_park()
+{
+    park_resume(trtaskman_sharded);
+}
+
+typedef struct {
+    trtaskman *tm;      // The task manager running the task
+    int expect;         // The shard the task should run on
+    _Atomic int *wrong; // Incremented if the task ran on the wrong shard
+    trtask task;        // The task itself
+} affinitystate;
+
+static trstatus affinity_task(trtask *task)
+{
+    affinitystate *st = task->context;
+    if (tr_taskman_current(st->tm) != st->expect) {
+        atomic_fetch_add(st->wrong, 1);
+    }
+
+    return trstatus_ok;
+}
+
+typedef struct {
+    affinitystate *targets; // Tasks to fan out, one per target
+    int ntargets;           // Number of entries in targets
+} fanoutstate;
+
+static trstatus fanout_task(trtask *task)
+{
+    fanoutstate *st = task->context;
+    for (int i = 0; i < st->ntargets; ++i) {
+        affinitystate *target = st->targets + i;
+        tr_taskman_submit_to(target->tm, target->expect, &target->task);
+    }
+
+    return trstatus_ok;
+}
+
+static void taskman_sharded_affinity()
+{
+    trtaskman tm;
+    start_taskman(&tm, trtaskman_sharded, 4);
+
+    // Fan out from a worker so submissions travel over the rings, with more
+    // tasks than a ring holds so the inbox fallback gets exercised too
+    enum { ntargets = 2000 };
+    affinitystate *targets = tr_alloc(ntargets * sizeof(affinitystate), 'test');
+    _Atomic int wrong = 0;
+
+    for (int i = 0; i < ntargets; ++i) {
+        targets[i].tm = &tm;
+        targets[i].expect = i % 4;
+        targets[i].wrong = &wrong;
+        tr_task_initialize(&targets[i].task, &affinity_task, targets + i);
+    }
+
+    fanoutstate st = { .targets = targets, .ntargets = ntargets };
+    trtask fanout;
+    tr_task_initialize(&fanout, &fanout_task, &st);
+
+    tr_taskman_submit_to(&tm, 1, &fanout);
+    tr_taskman_drain(&tm);
+
+    TEST_EQUAL(atomic_load(&wrong), 0);
+
+    tr_free(targets);
+    tr_taskman_cleanup(&tm);
+}
+
+typedef struct {
+    trtaskman *tm;      // The task manager running the task
+    trstack *first;     // The first stack borrowed
+    bool reused;        // Whether the pool handed back the same stack
+} stackstate;
+
+static trstatus stack_task(trtask *task)
+{
+    stackstate *st = task->context;
+
+    trstack *stack = tr_taskman_stack_get(st->tm);
+    if (stack == NULL || tr_stack_alloc(stack, 64) == NULL) {
+        return trstatus_no_mem;
+    }
+
+    st->first = stack;
+    tr_taskman_stack_put(st->tm, stack);
+
+    stack = tr_taskman_stack_get(st->tm);
+    st->reused = (stack == st->first && stack->stackptr == stack->segments->startptr);
+    tr_taskman_stack_put(st->tm, stack);
+
+    return trstatus_ok;
+}
+
+static void taskman_stack_pool()
+{
+    unsigned nalloc = tr_alloc_stat('test').nalloc;
+
+    trtaskman tm;
+    start_taskman(&tm, trtaskman_sharded, 1);
+
+    stackstate st = { .tm = &tm };
+    trtask task;
+    tr_task_initialize(&task, &stack_task, &st);
+
+    tr_taskman_submit(&tm, &task);
+    tr_taskman_drain(&tm);
+
+    TEST_TRUE(st.reused);
+    TEST_EQUAL(tr_taskman_current(&tm), -1);
+
+    tr_taskman_cleanup(&tm);
+    TEST_EQUAL(tr_alloc_stat('test').nalloc, nalloc);
+}
+
+typedef struct {
+    trtask task;            // The task being ordered
+    int id;                 // Identifies the task in the run order
+    int *order;             // Where to record the order tasks ran in
+    _Atomic int *next;      // Next free slot in order
+} ordered;
+
+static trstatus ordered_task(trtask *task)
+{
+    ordered *o = container_of(task, ordered, task);
+    o->order[atomic_fetch_add(o->next, 1)] = o->id;
+    return trstatus_ok;
+}
+
+typedef struct {
+    trtaskman *tm;          // The task manager running the seeder
+    ordered *tasks;         // Tasks to submit
+    int ntasks;             // Number of tasks to submit
+    bool yielded;           // Whether should_yield told the seeder to yield
+} seedstate;
+
+// Submits tasks from inside a worker, so none can run until this returns
+static trstatus seed_task(trtask *task)
+{
+    seedstate *st = task->context;
+    for (int i = 0; i < st->ntasks; ++i) {
+        tr_taskman_submit(st->tm, &st->tasks[i].task);
+    }
+
+    st->yielded = tr_task_should_yield(task);
+    return trstatus_ok;
+}
+
+static void run_ordered(
+        trtaskman *tm,
+        const trtaskclass *classes,
+        const trtime *deadlines,
+        int ntasks,
+        int *order,
+        trtaskclass seedclass,
+        bool *yielded)
+{
+    ordered tasks[16];
+    _Atomic int next = 0;
+    tr_require(ntasks <= arraysize(tasks));
+
+    for (int i = 0; i < ntasks; ++i) {
+        tasks[i].id = i;
+        tasks[i].order = order;
+        tasks[i].next = &next;
+        tr_task_initialize(&tasks[i].task, &ordered_task, NULL);
+        tr_task_set_priority(&tasks[i].task, classes[i], deadlines[i]);
+    }
+
+    seedstate st = { .tm = tm, .tasks = tasks, .ntasks = ntasks };
+    trtask seed;
+    tr_task_initialize(&seed, &seed_task, &st);
+    tr_task_set_priority(&seed, seedclass, 0);
+
+    tr_taskman_submit(tm, &seed);
+    tr_taskman_drain(tm);
+
+    TEST_EQUAL(atomic_load(&next), ntasks);
+    *yielded = st.yielded;
+}
+
+static void start_single(trtaskman *tm, trtime background_target)
+{
+    trtaskmanconfig config;
+    tr_taskman_defaults(&config, trtaskman_sharded);
+    config.nworkers = 1;
+    config.pin = false;
+    config.tag = 'test';
+    for (int c = 0; c < tr_taskclasses; ++c) {
+        config.classes[c].target = tr_sec(60);
+        config.classes[c].slice = tr_sec(60);
+    }
+    config.classes[trtask_background].target = background_target;
+    TEST_SUCCESS(tr_taskman_initialize(tm, &config));
+}
+
+static void taskman_priority_order()
+{
+    trtaskman tm;
+    start_single(&tm, tr_sec(60));
+
+    trtime now = tr_clock_now();
+    const trtaskclass classes[] = {
+        trtask_background, trtask_normal, trtask_critical,
+        trtask_critical, trtask_normal, trtask_critical,
+    };
+    const trtime deadlines[] = {
+        0, 0, now + tr_sec(30),
+        now + tr_sec(10), 0, now + tr_sec(20),
+    };
+
+    int order[6];
+    bool yielded;
+    run_ordered(&tm, classes, deadlines, 6, order, trtask_normal, &yielded);
+
+    // Critical tasks by deadline, then normal FIFO, then background
+    const int expect[] = { 3, 5, 2, 1, 4, 0 };
+    for (int i = 0; i < 6; ++i) {
+        TEST_EQUAL(order[i], expect[i]);
+    }
+
+    // The seeder queued critical work behind itself, so it should yield
+    TEST_TRUE(yielded);
+
+    TEST_EQUAL(tr_taskman_classstat(&tm, trtask_critical).nrun, 3);
+    TEST_EQUAL(tr_taskman_classstat(&tm, trtask_normal).nrun, 3);
+    TEST_EQUAL(tr_taskman_classstat(&tm, trtask_background).nrun, 1);
+    TEST_EQUAL(tr_taskman_classstat(&tm, trtask_critical).depth, 0);
+
+    tr_taskman_cleanup(&tm);
+}
+
+static void taskman_priority_aging()
+{
+    // Background tasks are overdue as soon as they're queued
+    trtaskman tm;
+    start_single(&tm, tr_ns(1));
+
+    trtime now = tr_clock_now();
+    const trtaskclass classes[] = {
+        trtask_critical, trtask_background, trtask_normal,
+    };
+    const trtime deadlines[] = {
+        now + tr_sec(10), 0, 0,
+    };
+
+    int order[3];
+    bool yielded;
+    run_ordered(&tm, classes, deadlines, 3, order, trtask_critical, &yielded);
+
+    TEST_EQUAL(order[0], 1);
+    TEST_EQUAL(order[1], 0);
+    TEST_EQUAL(order[2], 2);
+
+    // Only less important work was queued, and the slice hadn't run out
+    TEST_FALSE(yielded);
+
+    TEST_GREATER_EQUAL(tr_taskman_classstat(&tm, trtask_background).nlate, 1);
+    TEST_EQUAL(tr_taskman_classstat(&tm, trtask_critical).nlate, 0);
+
+    tr_taskman_cleanup(&tm);
+}
+
+typedef struct {
+    _Atomic bool started;   // Set once the scan is running
+    bool yielded;           // Whether should_yield told the scan to yield
+} scanstate;
+
+// Runs until told to yield, or gives up after a while
+static trstatus scan_task(trtask *task)
+{
+    scanstate *st = task->context;
+    atomic_store(&st->started, true);
+
+    trtime until = tr_clock_now() + tr_sec(10);
+    while (tr_clock_now() < until) {
+        if (tr_task_should_yield(task)) {
+            st->yielded = true;
+            break;
+        }
+    }
+
+    return trstatus_ok;
+}
+
+typedef struct {
+    trtaskman *tm;          // The task manager to submit to
+    trtask *task;           // The critical task to send to shard 0
+} sendstate;
+
+static trstatus send_task(trtask *task)
+{
+    sendstate *st = task->context;
+    tr_taskman_submit_to(st->tm, 0, st->task);
+    return trstatus_ok;
+}
+
+// Sends critical work to a shard running a background scan, either from
+// another worker (over a ring) or from outside the task manager (through
+// the inbox), and checks that the scan is told to yield to it
+//
+static void run_preempt(bool fromworker)
+{
+    trtaskman tm;
+    trtaskmanconfig config;
+    tr_taskman_defaults(&config, trtaskman_sharded);
+    config.nworkers = 2;
+    config.pin = false;
+    config.tag = 'test';
+    config.classes[trtask_background].slice = tr_sec(60);
+    TEST_SUCCESS(tr_taskman_initialize(&tm, &config));
+
+    scanstate scan = { .started = false };
+    trtask scantask;
+    tr_task_initialize(&scantask, &scan_task, &scan);
+    tr_task_set_priority(&scantask, trtask_background, 0);
+    tr_taskman_submit_to(&tm, 0, &scantask);
+
+    while (!atomic_load(&scan.started)) {
+        sched_yield();
+    }
+
+    atomic_store(&counter, 0);
+    trtask critical;
+    tr_task_initialize(&critical, &count_task, NULL);
+    tr_task_set_priority(&critical, trtask_critical, 0);
+
+    sendstate send = { .tm = &tm, .task = &critical };
+    trtask sender;
+    tr_task_initialize(&sender, &send_task, &send);
+    if (fromworker) {
+        tr_taskman_submit_to(&tm, 1, &sender);
+    } else {
+        tr_taskman_submit_to(&tm, 0, &critical);
+    }
+
+    tr_taskman_drain(&tm);
+    TEST_TRUE(scan.yielded);
+    TEST_EQUAL(atomic_load(&counter), 1);
+
+    tr_taskman_cleanup(&tm);
+}
+
+static void taskman_sharded_preempt()
+{
+    run_preempt(false);
+    run_preempt(true);
+}
+
+static const test_case taskman_cases[] =
+{
+    TEST_CASE(taskman_shared_run),
+    TEST_CASE(taskman_sharded_run),
+    TEST_CASE(taskman_yield),
+    TEST_CASE(taskman_shared_park),
+    TEST_CASE(taskman_sharded_park),
+    TEST_CASE(taskman_sharded_affinity),
+    TEST_CASE(taskman_stack_pool),
+    TEST_CASE(taskman_priority_order),
+    TEST_CASE(taskman_priority_aging),
+    TEST_CASE(taskman_sharded_preempt),
+};
+
+TEST_SUITE(taskman_tests, taskman_cases);
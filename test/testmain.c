@@ -9,10 +9,37 @@
 #include <test/test.h>
 
 extern test_suite alloc_tests;
+extern test_suite art_tests;
+extern test_suite btree_tests;
+extern test_suite bufpool_tests;
+extern test_suite clock_tests;
+extern test_suite column_tests;
+extern test_suite crc32c_tests;
+extern test_suite epoch_tests;
+extern test_suite exthash_tests;
+extern test_suite file_tests;
+extern test_suite filter_tests;
+extern test_suite latch_tests;
 extern test_suite list_tests;
+extern test_suite load_tests;
+extern test_suite lockmgr_tests;
+extern test_suite lz_tests;
+extern test_suite lsm_tests;
 extern test_suite macro_tests;
+extern test_suite memtable_tests;
+extern test_suite memtree_tests;
+extern test_suite mvcc_tests;
+extern test_suite query_tests;
+extern test_suite ring_tests;
+extern test_suite rtree_tests;
+extern test_suite schema_tests;
+extern test_suite segment_tests;
+extern test_suite sstable_tests;
 extern test_suite stack_tests;
 extern test_suite status_tests;
+extern test_suite sync_tests;
+extern test_suite taskman_tests;
+extern test_suite wal_tests;
 
 static const test_suite *test_suites[] =
 {
@@ -21,6 +48,33 @@ static const test_suite *test_suites[] =
     &list_tests,
     &alloc_tests,
     &stack_tests,
+    &clock_tests,
+    &ring_tests,
+    &crc32c_tests,
+    &lz_tests,
+    &taskman_tests,
+    &sync_tests,
+    &epoch_tests,
+    &mvcc_tests,
+    &latch_tests,
+    &lockmgr_tests,
+    &file_tests,
+    &bufpool_tests,
+    &wal_tests,
+    &segment_tests,
+    &filter_tests,
+    &memtable_tests,
+    &sstable_tests,
+    &lsm_tests,
+    &memtree_tests,
+    &column_tests,
+    &schema_tests,
+    &load_tests,
+    &btree_tests,
+    &exthash_tests,
+    &rtree_tests,
+    &art_tests,
+    &query_tests,
 };
 
 static const int nsuites = arraysize(test_suites);
@@ -0,0 +1,319 @@
+/////////////////////////////////////////////////////////////////////////////
+//
+// Terrascale
+// Copyright (c) Dave Kilian & Emily Kilian 2023. All rights reserved.
+//
+//////////////////////////////////////////////////////////////////////////////
+
+#include <pch.h>
+#include <test/test.h>
+#include <store/wal.h>
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+static void temp_dir(char *path, size_t size)
+{
+    snprintf(path, size, "/tmp/trtest-wal-%d", (int)getpid());
+}
+
+static void remove_dir(const char *path)
+{
+    DIR *dir = opendir(path);
+    if (dir == NULL) {
+        return;
+    }
+
+    struct dirent *entry;
+    while ((entry = readdir(dir)) != NULL) {
+        if (entry->d_name[0] != '.') {
+            unlinkat(dirfd(dir), entry->d_name, 0);
+        }
+    }
+
+    closedir(dir);
+    rmdir(path);
+}
+
+static void small_config(trwalconfig *config, const char *dir)
+{
+    tr_wal_defaults(config, dir);
+    config->segsize = 8192;
+    config->buffersize = 8192;
+    config->prealloc = 1;
+    config->tag = 'test';
+}
+
+// Replay callback which checks records are numbered 0, 1, 2, ...
+typedef struct {
+    int nrecords;
+    trlsn last;
+    trlsn *lsns;    // Where to note each record's LSN, if anywhere
+} replaystate;
+
+static trstatus check_record(void *context, trlsn lsn, const void *data, unsigned length)
+{
+    replaystate *state = context;
+    TEST_EQUAL(length, 4 + (unsigned)(state->nrecords % 200));
+    TEST_EQUAL(*(const int *)data, state->nrecords);
+    TEST_TRUE(state->nrecords == 0 || lsn > state->last);
+
+    state->last = lsn;
+    state->nrecords += 1;
+    return trstatus_ok;
+}
+
+static void commit_records(trwal *wal, int first, int count)
+{
+    char record[256] = {0};
+    for (int i = first; i < first + count; ++i) {
+        *(int *)record = i;
+        TEST_SUCCESS(tr_wal_commit(wal, record, 4 + (i % 200)));
+    }
+}
+
+static void wal_replay()
+{
+    char dir[64];
+    temp_dir(dir, sizeof(dir));
+    remove_dir(dir);
+
+    trwalconfig config;
+    small_config(&config, dir);
+
+    // Enough variable-length records to cross many segments and wrap the
+    // ring many times
+    trwal wal;
+    replaystate state = {0};
+    TEST_SUCCESS(tr_wal_open(&wal, &config, &check_record, &state));
+    TEST_EQUAL(state.nrecords, 0);
+    commit_records(&wal, 0, 500);
+
+    trwalstat stat = tr_wal_stat(&wal);
+    TEST_EQUAL(stat.nrecords, 500);
+    TEST_GREATER_THAN(stat.nsegments, 5);
+    TEST_EQUAL(tr_wal_durable(&wal), stat.nbytes);
+    tr_wal_close(&wal);
+
+    // Reopening replays everything, then appends after it
+    state = (replaystate){0};
+    TEST_SUCCESS(tr_wal_open(&wal, &config, &check_record, &state));
+    TEST_EQUAL(state.nrecords, 500);
+    commit_records(&wal, 500, 100);
+    tr_wal_close(&wal);
+
+    state = (replaystate){0};
+    TEST_SUCCESS(tr_wal_open(&wal, &config, &check_record, &state));
+    TEST_EQUAL(state.nrecords, 600);
+
+    char big[8192];
+    trlsn end;
+    TEST_EQUAL(tr_wal_append(&wal, big, sizeof(big), &end), trstatus_too_large);
+    tr_wal_close(&wal);
+
+    remove_dir(dir);
+}
+
+static trstatus count_record(void *context, trlsn lsn, const void *data, unsigned length)
+{
+    *(int *)context += 1;
+    (void)lsn; (void)data; (void)length;
+    return trstatus_ok;
+}
+
+static void wal_recycle()
+{
+    char dir[64];
+    temp_dir(dir, sizeof(dir));
+    remove_dir(dir);
+
+    trwalconfig config;
+    small_config(&config, dir);
+
+    trwal wal;
+    TEST_SUCCESS(tr_wal_open(&wal, &config, NULL, NULL));
+    commit_records(&wal, 0, 200);
+
+    // Recycle everything before the last record's segment
+    trlsn durable = tr_wal_durable(&wal);
+    uint64_t created = tr_wal_stat(&wal).nsegments;
+    TEST_SUCCESS(tr_wal_truncate(&wal, durable));
+    TEST_GREATER_THAN(tr_wal_stat(&wal).nrecycled, 0);
+
+    // New records land in recycled segments rather than new ones
+    commit_records(&wal, 200, 200);
+    TEST_EQUAL(tr_wal_stat(&wal).nsegments, created);
+    tr_wal_close(&wal);
+
+    // Replay starts from the first segment kept, and the stale records in
+    // recycled segments don't confuse it
+    int nrecords = 0;
+    TEST_SUCCESS(tr_wal_open(&wal, &config, &count_record, &nrecords));
+    TEST_GREATER_THAN(nrecords, 200);
+    TEST_LESS_THAN(nrecords, 400);
+    tr_wal_close(&wal);
+
+    remove_dir(dir);
+}
+
+// Replay callback which remembers each record's LSN
+static trstatus note_record(void *context, trlsn lsn, const void *data, unsigned length)
+{
+    replaystate *state = context;
+    TEST_SUCCESS(check_record(context, lsn, data, length));
+    state->lsns[state->nrecords - 1] = lsn;
+    return trstatus_ok;
+}
+
+static void wal_checksum()
+{
+    char dir[64];
+    temp_dir(dir, sizeof(dir));
+    remove_dir(dir);
+
+    trwalconfig config;
+    small_config(&config, dir);
+
+    trwal wal;
+    TEST_SUCCESS(tr_wal_open(&wal, &config, NULL, NULL));
+    commit_records(&wal, 0, 10);
+    tr_wal_close(&wal);
+
+    trlsn lsns[10];
+    replaystate state = { .lsns = lsns };
+    TEST_SUCCESS(tr_wal_open(&wal, &config, &note_record, &state));
+    TEST_EQUAL(state.nrecords, 10);
+    tr_wal_close(&wal);
+
+    // Flip a payload bit in the sixth record, which sits in the first
+    // segment; everything from there on is lost
+    char path[128];
+    snprintf(path, sizeof(path), "%s/wal-00000000", dir);
+    int fd = open(path, O_RDWR);
+    TEST_GREATER_EQUAL(fd, 0);
+    off_t at = lsns[5] + sizeof(trwalrecord) + 2;
+    char byte;
+    TEST_EQUAL(pread(fd, &byte, 1, at), 1);
+    byte ^= 0x10;
+    TEST_EQUAL(pwrite(fd, &byte, 1, at), 1);
+    close(fd);
+
+    state = (replaystate){0};
+    TEST_SUCCESS(tr_wal_open(&wal, &config, &check_record, &state));
+    TEST_EQUAL(state.nrecords, 5);
+
+    // The log carries on from the damaged record. The old records after it
+    // are gone, even though new ones end exactly where they began.
+    commit_records(&wal, 5, 3);
+    tr_wal_close(&wal);
+
+    state = (replaystate){0};
+    TEST_SUCCESS(tr_wal_open(&wal, &config, &check_record, &state));
+    TEST_EQUAL(state.nrecords, 8);
+    commit_records(&wal, 8, 2);
+    tr_wal_close(&wal);
+
+    state = (replaystate){0};
+    TEST_SUCCESS(tr_wal_open(&wal, &config, &check_record, &state));
+    TEST_EQUAL(state.nrecords, 10);
+    tr_wal_close(&wal);
+
+    remove_dir(dir);
+}
+
+typedef struct {
+    trtask task;
+    trwal *wal;
+    trwalwaiter waiter;
+    trlsn end;
+    int remaining;
+    bool waiting;
+} committer;
+
+static trstatus commit_task(trtask *task)
+{
+    committer *c = container_of(task, committer, task);
+
+    for (;;) {
+        if (!c->waiting) {
+            int value = c->remaining;
+            TEST_SUCCESS(tr_wal_append(c->wal, &value, sizeof(value), &c->end));
+            c->waiting = true;
+        }
+
+        trstatus s = tr_wal_wait(c->wal, &c->waiter, c->end, task);
+        if (s == trstatus_pending) {
+            return trstatus_pending;
+        }
+
+        TEST_SUCCESS(s);
+        TEST_GREATER_EQUAL(tr_wal_durable(c->wal), c->end);
+        c->waiting = false;
+
+        if (--c->remaining == 0) {
+            return trstatus_ok;
+        }
+    }
+}
+
+static void wal_group_commit()
+{
+    char dir[64];
+    temp_dir(dir, sizeof(dir));
+    remove_dir(dir);
+
+    trwalconfig config;
+    tr_wal_defaults(&config, dir);
+    config.segsize = 64 * 1024;
+    config.buffersize = 64 * 1024;
+    config.tag = 'test';
+
+    trwal wal;
+    TEST_SUCCESS(tr_wal_open(&wal, &config, NULL, NULL));
+
+    trtaskmanconfig tmconfig;
+    tr_taskman_defaults(&tmconfig, trtaskman_shared);
+    tmconfig.nworkers = 2;
+    tmconfig.pin = false;
+    tmconfig.tag = 'test';
+
+    trtaskman tm;
+    TEST_SUCCESS(tr_taskman_initialize(&tm, &tmconfig));
+
+    committer committers[16];
+    for (int i = 0; i < arraysize(committers); ++i) {
+        committer *c = committers + i;
+        c->wal = &wal;
+        c->remaining = 50;
+        c->waiting = false;
+        tr_task_initialize(&c->task, &commit_task, c);
+        tr_taskman_submit(&tm, &c->task);
+    }
+
+    tr_taskman_drain(&tm);
+    tr_taskman_cleanup(&tm);
+
+    // Committers shared syncs
+    trwalstat stat = tr_wal_stat(&wal);
+    TEST_EQUAL(stat.nrecords, 16 * 50);
+    TEST_LESS_EQUAL(stat.nflushes, stat.nrecords);
+    tr_wal_close(&wal);
+
+    int nrecords = 0;
+    TEST_SUCCESS(tr_wal_open(&wal, &config, &count_record, &nrecords));
+    TEST_EQUAL(nrecords, 16 * 50);
+    tr_wal_close(&wal);
+
+    remove_dir(dir);
+}
+
+static const test_case wal_cases[] =
+{
+    TEST_CASE(wal_replay),
+    TEST_CASE(wal_recycle),
+    TEST_CASE(wal_checksum),
+    TEST_CASE(wal_group_commit),
+};
+
+TEST_SUITE(wal_tests, wal_cases);